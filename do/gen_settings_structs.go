@@ -300,6 +300,9 @@ var (
 
 	PrinterDefaults = []*Field{
 		MkField("PrintScale", Utf8String, "shrink", "default value for scaling (shrink, fit, none)"),
+		MkField("PrintAsVector", Bool, false,
+			"if true, PDF and XPS documents are sent to the printer as vector graphics instead of bitmaps "+
+				"(pages with transparency are still printed as bitmaps)").SetVersion("3.3"),
 	}
 
 	ForwardSearch = []*Field{
@@ -573,6 +576,36 @@ var (
 		MkField("CustomScreenDPI", Int, 0,
 			"actual resolution of the main screen in DPI (if this value "+
 				"isn't positive, the system's UI setting is used)").SetExpert().SetVersion("2.5"),
+		MkField("RenderThreads", Int, 0,
+			"number of threads used for rendering pages in the background (if this "+
+				"value isn't positive, it's derived from the number of CPU cores)").SetExpert().SetVersion("3.3"),
+		MkField("RenderCacheSizeMB", Int, 0,
+			"maximum memory (in MB) used for caching rendered pages (if this value isn't positive, "+
+				"it's derived from the size of the screens and the amount of installed memory)").SetExpert().SetVersion("3.3"),
+		MkField("TileCacheSizeMB", Int, 200,
+			"maximum disk space (in MB) used for keeping the pages that were visible when a document was closed, "+
+				"so that they can be shown immediately when it's reopened (0 disables this)").SetExpert().SetVersion("3.3"),
+		MkField("IndexTextInBackground", Bool, true,
+			"if true, the text of longer documents is indexed in the background so that "+
+				"searching them is faster").SetExpert().SetVersion("3.3"),
+		MkField("TextCacheSizeMB", Int, 64,
+			"maximum memory (in MB) used for caching the text of a document's pages (text that has been "+
+				"dropped from the cache is extracted again when needed; 0 means no limit)").SetExpert().SetVersion("3.3"),
+		MkField("ScalableAllocator", Bool, true,
+			"if true, documents are rendered with a memory allocator that keeps freed memory in per-thread "+
+				"caches, so that rendering on several threads doesn't wait for the shared heap").SetExpert().SetVersion("3.3"),
+		MkField("ImageCacheSizeMB", Int, 256,
+			"maximum memory (in MB) used for caching the decoded images and loaded fonts of PDF and XPS documents, "+
+				"which is shared by all open documents (if this value isn't positive, 256 MB are used)").SetExpert().SetVersion("3.3"),
+		MkField("GdiObjectsLimit", Int, 8000,
+			"when the process uses more GDI objects than this, rendered pages that aren't visible and the caches of "+
+				"background tabs are freed right away (Windows allows 10000 per process; 0 disables this)").SetExpert().SetVersion("3.3"),
+		MkField("RenderInSeparateProcess", Bool, false,
+			"if true, the pages of PDF and XPS documents are rendered in a separate process, so that a document "+
+				"which crashes or hangs the renderer doesn't take down the whole application").SetExpert().SetVersion("3.3"),
+		MkField("GpuCompositing", Bool, false,
+			"if true, the rendered pages are composited on the GPU with Direct2D, which makes scrolling and "+
+				"zooming smoother on high resolution displays (not used in remote sessions)").SetExpert().SetVersion("3.3"),
 		EmptyLine(),
 
 		MkField("RememberStatePerDocument", Bool, True,
@@ -635,6 +668,14 @@ var (
 				"(needed for auto-updating)").SetDoc("data required for reloading documents after an auto-update").SetVersion("3.0"),
 		MkCompactStruct("TimeOfLastUpdateCheck", FileTime,
 			"timestamp of the last update check").SetStructName("FILETIME").SetDoc("data required to determine when SumatraPDF last checked for updates"),
+		MkField("UpdateCheckETag", Utf8String, nil,
+			"ETag of the update information received by the last update check").SetDoc("data required for conditional update checks").SetVersion("3.3"),
+		MkField("UpdateCheckLastModified", Utf8String, nil,
+			"Last-Modified date of the update information received by the last update check").SetDoc("data required for conditional update checks").SetVersion("3.3"),
+		MkField("UpdateCheckLatest", Utf8String, nil,
+			"latest version offered according to the last update check").SetDoc("cached result of the last update check").SetVersion("3.3"),
+		MkField("UpdateCheckStable", Utf8String, nil,
+			"stable version according to the last update check").SetDoc("cached result of the last update check").SetVersion("3.3"),
 		MkField("OpenCountWeek", Int, 0,
 			"week count since 2011-01-01 needed to \"age\" openCount values in file history").SetDoc("value required to determine recency for the OpenCount value in FileStates"),
 		// non-serialized fields
@@ -104,6 +104,20 @@ static pdf_fontlistMS fontlistMS = {
 
 static int did_init = 0;
 static CRITICAL_SECTION cs_fonts;
+// where to persist the list of fonts in the Windows fonts directory (optional)
+static WCHAR* fontlist_cache_path = NULL;
+
+#define FONTLIST_CACHE_MAGIC 0x314c4653 // "SFL1"
+
+// the cache file consists of this header followed by count sys_font_info entries.
+// it's only valid as long as the fonts directory's last modification time
+// (which changes whenever fonts are installed or removed) is the same
+typedef struct {
+    DWORD magic;
+    DWORD entrySize;
+    FILETIME fontsDirTime;
+    DWORD count;
+} fontlist_cache_header;
 
 static inline USHORT BEtoHs(USHORT x) {
     BYTE* data = (BYTE*)&x;
@@ -456,6 +470,75 @@ static void extend_system_font_list(fz_context* ctx, const WCHAR* path) {
     FindClose(hList);
 }
 
+// replaces the (still empty) font list with the cached one, if it's up-to-date
+static int load_cached_font_list(const FILETIME* fontsDirTime) {
+    fontlist_cache_header hdr;
+    sys_font_info* fontmap;
+    DWORD nRead = 0, size, i;
+    HANDLE h;
+    BOOL ok;
+
+    if (!fontlist_cache_path)
+        return 0;
+    h = CreateFile(fontlist_cache_path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h == INVALID_HANDLE_VALUE)
+        return 0;
+    ok = ReadFile(h, &hdr, sizeof(hdr), &nRead, NULL);
+    if (!ok || nRead != sizeof(hdr) || hdr.magic != FONTLIST_CACHE_MAGIC || hdr.entrySize != sizeof(sys_font_info) ||
+        CompareFileTime(&hdr.fontsDirTime, fontsDirTime) != 0 || hdr.count == 0 || hdr.count > 1024 * 1024) {
+        CloseHandle(h);
+        return 0;
+    }
+    size = hdr.count * sizeof(sys_font_info);
+    fontmap = malloc(size);
+    if (!fontmap) {
+        CloseHandle(h);
+        return 0;
+    }
+    ok = ReadFile(h, fontmap, size, &nRead, NULL);
+    CloseHandle(h);
+    if (!ok || nRead != size) {
+        free(fontmap);
+        return 0;
+    }
+    for (i = 0; i < hdr.count; i++) {
+        fontmap[i].fontface[MAX_FACENAME - 1] = '\0';
+        fontmap[i].fontpath[MAX_PATH - 1] = '\0';
+    }
+
+    free(fontlistMS.fontmap);
+    fontlistMS.fontmap = fontmap;
+    fontlistMS.len = fontlistMS.cap = (int)hdr.count;
+    return 1;
+}
+
+static void save_cached_font_list(const FILETIME* fontsDirTime) {
+    fontlist_cache_header hdr = {FONTLIST_CACHE_MAGIC, sizeof(sys_font_info), *fontsDirTime, (DWORD)fontlistMS.len};
+    WCHAR dir[MAX_PATH], *sep;
+    DWORD nWritten = 0, size = fontlistMS.len * sizeof(sys_font_info);
+    HANDLE h;
+    BOOL ok;
+
+    if (!fontlist_cache_path || fontlistMS.len == 0)
+        return;
+    // the cache directory might not have been created yet
+    lstrcpyn(dir, fontlist_cache_path, nelem(dir));
+    sep = wcsrchr(dir, '\\');
+    if (sep) {
+        *sep = '\0';
+        CreateDirectory(dir, NULL);
+    }
+    h = CreateFile(fontlist_cache_path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h == INVALID_HANDLE_VALUE)
+        return;
+    // a truncated file is rejected when loading, as it's shorter than the header claims
+    ok = WriteFile(h, &hdr, sizeof(hdr), &nWritten, NULL) && nWritten == sizeof(hdr);
+    ok = ok && WriteFile(h, fontlistMS.fontmap, size, &nWritten, NULL) && nWritten == size;
+    CloseHandle(h);
+    if (!ok)
+        DeleteFile(fontlist_cache_path);
+}
+
 // cf. http://blogs.msdn.com/b/oldnewthing/archive/2004/10/25/247180.aspx
 EXTERN_C IMAGE_DOS_HEADER __ImageBase;
 #define CURRENT_HMODULE ((HMODULE)&__ImageBase)
@@ -466,8 +549,20 @@ static void create_system_font_list(fz_context* ctx) {
 
     cch = GetWindowsDirectory(szFontDir, nelem(szFontDir) - 12);
     if (0 < cch && cch < nelem(szFontDir) - 12) {
-        wcscat_s(szFontDir, MAX_PATH, L"\\Fonts\\*.?t?");
-        extend_system_font_list(ctx, szFontDir);
+        // parsing thousands of font files takes a while, so the result is cached
+        WIN32_FILE_ATTRIBUTE_DATA dirInfo;
+        FILETIME dirTime = {0};
+        int canCache;
+        wcscat_s(szFontDir, MAX_PATH, L"\\Fonts");
+        canCache = GetFileAttributesEx(szFontDir, GetFileExInfoStandard, &dirInfo);
+        if (canCache)
+            dirTime = dirInfo.ftLastWriteTime;
+        if (!canCache || !load_cached_font_list(&dirTime)) {
+            wcscat_s(szFontDir, MAX_PATH, L"\\*.?t?");
+            extend_system_font_list(ctx, szFontDir);
+            if (canCache)
+                save_cached_font_list(&dirTime);
+        }
     }
 
     if (fontlistMS.len == 0)
@@ -516,10 +611,13 @@ static void* fz_resize_array(fz_context* ctx, void* p, unsigned int count, unsig
     return np;
 }
 
+// all documents' contexts are cloned from a single base context (cf. NewFzContext)
+// and thus share a font context, so font files are cached per font context
+// (and are kept for as long as it lives, i.e. until the process exits)
 typedef struct cached_font {
     struct cached_font* next;
     sys_font_info* fi;
-    fz_context* ctx;
+    fz_font_context* fontCtx;
     fz_buffer* buffer;
 } cached_font;
 
@@ -530,7 +628,7 @@ static fz_buffer* get_cached_font_buffer(fz_context* ctx, sys_font_info* fi) {
     cached_font* f = cached_fonts;
     fz_buffer* buffer = NULL;
     while (f) {
-        if (f->ctx == ctx && f->fi == fi) {
+        if (f->fontCtx == ctx->font && f->fi == fi) {
             buffer = f->buffer;
             break;
         }
@@ -540,32 +638,13 @@ static fz_buffer* get_cached_font_buffer(fz_context* ctx, sys_font_info* fi) {
     return buffer;
 }
 
-void drop_cached_fonts_for_ctx(fz_context* ctx) {
+static void ensure_system_font_list(fz_context* ctx) {
     EnterCriticalSection(&cs_fonts);
-
-    cached_font** currp = &cached_fonts;
-    cached_font** nextp;
-    cached_font* curr;
-    cached_font* next;
-    int refs;
-    while (1) {
-        curr = *currp;
-        if (!curr) {
-            break;
+    if (fontlistMS.len == 0) {
+        fz_try(ctx) {
+            create_system_font_list(ctx);
         }
-        nextp = &(curr->next);
-        if (curr->ctx == ctx) {
-            next = *nextp;
-            refs = curr->buffer->refs;
-            if (refs != 1) {
-                // TODO: crash?
-                fz_warn(ctx, "drop_cached_fonts_for_ctx: bad refcount %d", refs);
-            }
-            fz_drop_buffer(curr->ctx, curr->buffer);
-            free(curr);
-            *currp = next;
-        } else {
-            currp = nextp;
+        fz_catch(ctx) {
         }
     }
     LeaveCriticalSection(&cs_fonts);
@@ -577,15 +656,7 @@ static fz_font* pdf_load_windows_font_by_name(fz_context* ctx, const char* orig_
     fz_font* font;
     fz_buffer* buffer;
 
-    EnterCriticalSection(&cs_fonts);
-    if (fontlistMS.len == 0) {
-        fz_try(ctx) {
-            create_system_font_list(ctx);
-        }
-        fz_catch(ctx) {
-        }
-    }
-    LeaveCriticalSection(&cs_fonts);
+    ensure_system_font_list(ctx);
 
     if (fontlistMS.len == 0)
         fz_throw(ctx, FZ_ERROR_GENERIC, "fonterror: couldn't find any fonts");
@@ -654,7 +725,7 @@ static fz_font* pdf_load_windows_font_by_name(fz_context* ctx, const char* orig_
         }
         cached_font* f = malloc(sizeof(cached_font));
         f->fi = found;
-        f->ctx = ctx;
+        f->fontCtx = ctx->font;
         f->buffer = buffer;
         EnterCriticalSection(&cs_fonts);
         f->next = cached_fonts;
@@ -773,9 +844,38 @@ void init_system_font_list(void) {
 }
 
 void destroy_system_font_list(void) {
+    if (!did_init)
+        return;
+    // wait for pdf_preload_system_font_list, in case it's still running
+    EnterCriticalSection(&cs_fonts);
     free(fontlistMS.fontmap);
     memset(&fontlistMS, 0, sizeof(fontlistMS));
+    free(fontlist_cache_path);
+    fontlist_cache_path = NULL;
+    LeaveCriticalSection(&cs_fonts);
     DeleteCriticalSection(&cs_fonts);
+    did_init = 0;
+}
+
+// sets the file for persisting the list of system fonts between runs.
+// must be called on the main thread before any document is loaded
+void pdf_set_system_font_list_cache(const WCHAR* path) {
+    init_system_font_list();
+    free(fontlist_cache_path);
+    fontlist_cache_path = path ? _wcsdup(path) : NULL;
+}
+
+// builds (or loads) the list of system fonts, so that the first document
+// which needs a non-embedded font doesn't have to wait for it.
+// can be called on any thread after pdf_set_system_font_list_cache
+void pdf_preload_system_font_list(void) {
+#ifdef _WIN32
+    fz_context* ctx = fz_new_context(NULL, NULL, FZ_STORE_UNLIMITED);
+    if (!ctx)
+        return;
+    ensure_system_font_list(ctx);
+    fz_drop_context(ctx);
+#endif
 }
 
 void pdf_install_load_system_font_funcs(fz_context* ctx) {
@@ -44,6 +44,14 @@
 #  define TBLS 1
 #endif /* BYFOUR */
 
+/* SumatraPDF: ARMv8.1 (required by Windows on ARM64) has CRC32 instructions
+   for the polynomial used by zlib, which are much faster than the tables */
+#if defined(_M_ARM64)
+#  include <intrin.h>
+   local unsigned long crc32_arm64 OF((unsigned long,
+                        const unsigned char FAR *, z_size_t));
+#endif
+
 /* Local functions for crc concatenation */
 local unsigned long gf2_matrix_times OF((unsigned long *mat,
                                          unsigned long vec));
@@ -206,6 +214,10 @@ unsigned long ZEXPORT crc32_z(crc, buf, len)
 {
     if (buf == Z_NULL) return 0UL;
 
+#if defined(_M_ARM64)
+    return crc32_arm64(crc, buf, len);
+#endif
+
 #ifdef DYNAMIC_CRC_TABLE
     if (crc_table_empty)
         make_crc_table();
@@ -262,6 +274,35 @@ unsigned long ZEXPORT crc32(crc, buf, len)
             crc_table[1][(c >> 16) & 0xff] ^ crc_table[0][c >> 24]
 #define DOLIT32 DOLIT4; DOLIT4; DOLIT4; DOLIT4; DOLIT4; DOLIT4; DOLIT4; DOLIT4
 
+#if defined(_M_ARM64)
+
+/* ========================================================================= */
+local unsigned long crc32_arm64(crc, buf, len)
+    unsigned long crc;
+    const unsigned char FAR *buf;
+    z_size_t len;
+{
+    unsigned int c;
+
+    c = ~(unsigned int)crc;
+    while (len && ((ptrdiff_t)buf & 7)) {
+        c = __crc32b(c, *buf++);
+        len--;
+    }
+    while (len >= 8) {
+        c = __crc32d(c, *(const unsigned __int64 FAR *)buf);
+        buf += 8;
+        len -= 8;
+    }
+    while (len) {
+        c = __crc32b(c, *buf++);
+        len--;
+    }
+    return (unsigned long)~c;
+}
+
+#endif
+
 /* ========================================================================= */
 local unsigned long crc32_little(crc, buf, len)
     unsigned long crc;
@@ -0,0 +1,189 @@
+; Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+; License: GPLv3
+
+; the same as fonts_64.asm in the syntax of armasm64.exe (nasm can only create
+; x86 and x64 objects). labels have to start in the first column
+
+    AREA |.rdata|, DATA, READONLY, ALIGN=3
+
+; ---------
+
+    EXPORT _binary_Dingbats_cff
+    EXPORT _binary_Dingbats_cff_size
+
+_binary_Dingbats_cff
+    INCBIN resources/fonts/urw/Dingbats.cff
+_binary_Dingbats_cff_end
+    ALIGN 8
+_binary_Dingbats_cff_size
+    DCQ _binary_Dingbats_cff_end - _binary_Dingbats_cff
+
+; ---------
+
+    EXPORT _binary_NimbusMonoPS_Regular_cff
+    EXPORT _binary_NimbusMonoPS_Regular_cff_size
+
+_binary_NimbusMonoPS_Regular_cff
+    INCBIN resources/fonts/urw/NimbusMonoPS-Regular.cff
+_binary_NimbusMonoPS_Regular_cff_end
+    ALIGN 8
+_binary_NimbusMonoPS_Regular_cff_size
+    DCQ _binary_NimbusMonoPS_Regular_cff_end - _binary_NimbusMonoPS_Regular_cff
+
+; ---------
+
+    EXPORT _binary_NimbusMonoPS_Italic_cff
+    EXPORT _binary_NimbusMonoPS_Italic_cff_size
+
+_binary_NimbusMonoPS_Italic_cff
+    INCBIN resources/fonts/urw/NimbusMonoPS-Italic.cff
+_binary_NimbusMonoPS_Italic_cff_end
+    ALIGN 8
+_binary_NimbusMonoPS_Italic_cff_size
+    DCQ _binary_NimbusMonoPS_Italic_cff_end - _binary_NimbusMonoPS_Italic_cff
+
+; ---------
+
+    EXPORT _binary_NimbusMonoPS_Bold_cff
+    EXPORT _binary_NimbusMonoPS_Bold_cff_size
+
+_binary_NimbusMonoPS_Bold_cff
+    INCBIN resources/fonts/urw/NimbusMonoPS-Bold.cff
+_binary_NimbusMonoPS_Bold_cff_end
+    ALIGN 8
+_binary_NimbusMonoPS_Bold_cff_size
+    DCQ _binary_NimbusMonoPS_Bold_cff_end - _binary_NimbusMonoPS_Bold_cff
+
+; ---------
+
+    EXPORT _binary_NimbusMonoPS_BoldItalic_cff
+    EXPORT _binary_NimbusMonoPS_BoldItalic_cff_size
+
+_binary_NimbusMonoPS_BoldItalic_cff
+    INCBIN resources/fonts/urw/NimbusMonoPS-BoldItalic.cff
+_binary_NimbusMonoPS_BoldItalic_cff_end
+    ALIGN 8
+_binary_NimbusMonoPS_BoldItalic_cff_size
+    DCQ _binary_NimbusMonoPS_BoldItalic_cff_end - _binary_NimbusMonoPS_BoldItalic_cff
+
+; ---------
+
+    EXPORT _binary_NimbusRoman_Regular_cff
+    EXPORT _binary_NimbusRoman_Regular_cff_size
+
+_binary_NimbusRoman_Regular_cff
+    INCBIN resources/fonts/urw/NimbusRoman-Regular.cff
+_binary_NimbusRoman_Regular_cff_end
+    ALIGN 8
+_binary_NimbusRoman_Regular_cff_size
+    DCQ _binary_NimbusRoman_Regular_cff_end - _binary_NimbusRoman_Regular_cff
+
+; ---------
+
+    EXPORT _binary_NimbusRoman_Italic_cff
+    EXPORT _binary_NimbusRoman_Italic_cff_size
+
+_binary_NimbusRoman_Italic_cff
+    INCBIN resources/fonts/urw/NimbusRoman-Italic.cff
+_binary_NimbusRoman_Italic_cff_end
+    ALIGN 8
+_binary_NimbusRoman_Italic_cff_size
+    DCQ _binary_NimbusRoman_Italic_cff_end - _binary_NimbusRoman_Italic_cff
+
+; ---------
+
+    EXPORT _binary_NimbusRoman_Bold_cff
+    EXPORT _binary_NimbusRoman_Bold_cff_size
+
+_binary_NimbusRoman_Bold_cff
+    INCBIN resources/fonts/urw/NimbusRoman-Bold.cff
+_binary_NimbusRoman_Bold_cff_end
+    ALIGN 8
+_binary_NimbusRoman_Bold_cff_size
+    DCQ _binary_NimbusRoman_Bold_cff_end - _binary_NimbusRoman_Bold_cff
+
+; ---------
+
+    EXPORT _binary_NimbusRoman_BoldItalic_cff
+    EXPORT _binary_NimbusRoman_BoldItalic_cff_size
+
+_binary_NimbusRoman_BoldItalic_cff
+    INCBIN resources/fonts/urw/NimbusRoman-BoldItalic.cff
+_binary_NimbusRoman_BoldItalic_cff_end
+    ALIGN 8
+_binary_NimbusRoman_BoldItalic_cff_size
+    DCQ _binary_NimbusRoman_BoldItalic_cff_end - _binary_NimbusRoman_BoldItalic_cff
+
+; ---------
+
+    EXPORT _binary_NimbusSans_Regular_cff
+    EXPORT _binary_NimbusSans_Regular_cff_size
+
+_binary_NimbusSans_Regular_cff
+    INCBIN resources/fonts/urw/NimbusSans-Regular.cff
+_binary_NimbusSans_Regular_cff_end
+    ALIGN 8
+_binary_NimbusSans_Regular_cff_size
+    DCQ _binary_NimbusSans_Regular_cff_end - _binary_NimbusSans_Regular_cff
+
+; ---------
+
+    EXPORT _binary_NimbusSans_Italic_cff
+    EXPORT _binary_NimbusSans_Italic_cff_size
+
+_binary_NimbusSans_Italic_cff
+    INCBIN resources/fonts/urw/NimbusSans-Italic.cff
+_binary_NimbusSans_Italic_cff_end
+    ALIGN 8
+_binary_NimbusSans_Italic_cff_size
+    DCQ _binary_NimbusSans_Italic_cff_end - _binary_NimbusSans_Italic_cff
+
+; ---------
+
+    EXPORT _binary_NimbusSans_Bold_cff
+    EXPORT _binary_NimbusSans_Bold_cff_size
+
+_binary_NimbusSans_Bold_cff
+    INCBIN resources/fonts/urw/NimbusSans-Bold.cff
+_binary_NimbusSans_Bold_cff_end
+    ALIGN 8
+_binary_NimbusSans_Bold_cff_size
+    DCQ _binary_NimbusSans_Bold_cff_end - _binary_NimbusSans_Bold_cff
+
+; ---------
+
+    EXPORT _binary_NimbusSans_BoldItalic_cff
+    EXPORT _binary_NimbusSans_BoldItalic_cff_size
+
+_binary_NimbusSans_BoldItalic_cff
+    INCBIN resources/fonts/urw/NimbusSans-BoldItalic.cff
+_binary_NimbusSans_BoldItalic_cff_end
+    ALIGN 8
+_binary_NimbusSans_BoldItalic_cff_size
+    DCQ _binary_NimbusSans_BoldItalic_cff_end - _binary_NimbusSans_BoldItalic_cff
+
+; ---------
+
+    EXPORT _binary_StandardSymbolsPS_cff
+    EXPORT _binary_StandardSymbolsPS_cff_size
+
+_binary_StandardSymbolsPS_cff
+    INCBIN resources/fonts/urw/StandardSymbolsPS.cff
+_binary_StandardSymbolsPS_cff_end
+    ALIGN 8
+_binary_StandardSymbolsPS_cff_size
+    DCQ _binary_StandardSymbolsPS_cff_end - _binary_StandardSymbolsPS_cff
+
+; ---------
+
+    EXPORT _binary_DroidSansFallbackFull_ttf
+    EXPORT _binary_DroidSansFallbackFull_ttf_size
+
+_binary_DroidSansFallbackFull_ttf
+    INCBIN resources/fonts/droid/DroidSansFallbackFull.ttf
+_binary_DroidSansFallbackFull_ttf_end
+    ALIGN 8
+_binary_DroidSansFallbackFull_ttf_size
+    DCQ _binary_DroidSansFallbackFull_ttf_end - _binary_DroidSansFallbackFull_ttf
+
+    END
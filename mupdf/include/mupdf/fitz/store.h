@@ -351,6 +351,27 @@ int fz_store_scavenge_external(fz_context *ctx, size_t size, int *phase);
 */
 int fz_shrink_store(fz_context *ctx, unsigned int percent);
 
+/**
+	SumatraPDF: how well the store has been used so far.
+
+	hits, misses: Number of calls to fz_find_item that have found
+	an item or not.
+
+	evictions: Number of items evicted to make room for others.
+
+	size, max: Current and maximum size of the store (in bytes).
+*/
+typedef struct
+{
+	size_t hits;
+	size_t misses;
+	size_t evictions;
+	size_t size;
+	size_t max;
+} fz_store_stats;
+
+void fz_get_store_stats(fz_context *ctx, fz_store_stats *stats);
+
 /**
 	Callback function called by fz_filter_store on every item within
 	the store.
@@ -74,6 +74,34 @@ pdf_document *pdf_open_document(fz_context *ctx, const char *filename);
 */
 pdf_document *pdf_open_document_with_stream(fz_context *ctx, fz_stream *file);
 
+/*
+	SumatraPDF: Hooks for reporting the progress of and for caching
+	the result of repairing a broken xref while opening a document.
+
+	progress: Called repeatedly while the file is being scanned
+	(pos out of len bytes have been scanned). Throw to abort the
+	repair.
+
+	load: Returns the data passed to save by an earlier repair of
+	the same file (or NULL). Invalid data is ignored.
+
+	save: Called after a successful repair with data that allows
+	to repair the same file again without having to scan it.
+*/
+typedef struct
+{
+	void (*progress)(fz_context *ctx, void *opaque, int64_t pos, int64_t len);
+	fz_buffer *(*load)(fz_context *ctx, void *opaque);
+	void (*save)(fz_context *ctx, void *opaque, fz_buffer *data);
+	void *opaque;
+} pdf_repair_hooks;
+
+/*
+	SumatraPDF: Same as pdf_open_document_with_stream, but calls
+	hooks, if the xref has to be repaired while opening.
+*/
+pdf_document *pdf_open_document_with_stream_and_repair_hooks(fz_context *ctx, fz_stream *file, const pdf_repair_hooks *hooks);
+
 /*
 	Closes and frees an opened PDF document.
 
@@ -318,6 +346,8 @@ struct pdf_document
 	pdf_rev_page_map *rev_page_map;
 
 	int repair_attempted;
+	/* SumatraPDF: only set while opening */
+	const pdf_repair_hooks *repair_hooks;
 
 	/* State indicating which file parsing method we are using */
 	int file_reading_linearly;
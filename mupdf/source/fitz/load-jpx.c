@@ -479,6 +479,12 @@ fz_load_jpx_info(fz_context *ctx, const unsigned char *data, size_t size, int *w
 	*yresp = state.yres;
 }
 
+fz_pixmap *
+fz_load_jpx_reduced(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *defcs, int *l2factor)
+{
+	return fz_load_jpx(ctx, data, size, defcs);
+}
+
 #else /* HAVE_LURATECH */
 
 #include <openjpeg.h>
@@ -723,11 +729,15 @@ static OPJ_BOOL fz_opj_stream_seek(OPJ_OFF_T seek_pos, void * p_user_data)
 	return OPJ_TRUE;
 }
 
+/* SumatraPDF: if l2factor isn't NULL, only the resolution level needed for
+ * subsampling by up to 2^*l2factor is decoded (and *l2factor is reduced by
+ * the amount of subsampling that's been done) */
 static fz_pixmap *
-jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_t size, fz_colorspace *defcs, int onlymeta)
+jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_t size, fz_colorspace *defcs, int onlymeta, int *l2factor)
 {
 	fz_pixmap *img = NULL;
 	opj_dparameters_t params;
+	int reduce = 0;
 	opj_codec_t *codec;
 	opj_image_t *jpx;
 	opj_stream_t *stream;
@@ -782,6 +792,27 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 		fz_throw(ctx, FZ_ERROR_GENERIC, "Failed to read JPX header");
 	}
 
+	/* SumatraPDF: the component offsets below don't account for reduced
+	 * resolutions, so only reduce images without an offset */
+	if (!onlymeta && l2factor && *l2factor > 0 && jpx->x0 == 0 && jpx->y0 == 0)
+	{
+		opj_codestream_info_v2_t *info = opj_get_cstr_info(codec);
+		if (info && info->m_default_tile_info.tccp_info)
+		{
+			reduce = *l2factor;
+			for (i = 0; i < info->nbcomps; i++)
+			{
+				int maxreduce = (int)info->m_default_tile_info.tccp_info[i].numresolutions - 1;
+				if (reduce > maxreduce)
+					reduce = maxreduce;
+			}
+			if (reduce < 0 || !opj_set_decoded_resolution_factor(codec, reduce))
+				reduce = 0;
+		}
+		if (info)
+			opj_destroy_cstr_info(&info);
+	}
+
 	if (!opj_decode(codec, stream, jpx))
 	{
 		opj_stream_destroy(stream);
@@ -818,6 +849,13 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 
 	state->width = w = jpx->x1 - jpx->x0;
 	state->height = h = jpx->y1 - jpx->y0;
+	if (reduce > 0)
+	{
+		/* the image's coordinates are those of the full resolution */
+		w = (jpx->x1 + (1 << reduce) - 1) >> reduce;
+		h = (jpx->y1 + (1 << reduce) - 1) >> reduce;
+		*l2factor -= reduce;
+	}
 	state->xres = 72; /* openjpeg does not read the JPEG 2000 resc box */
 	state->yres = 72; /* openjpeg does not read the JPEG 2000 resc box */
 
@@ -958,7 +996,26 @@ fz_load_jpx(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspa
 	fz_try(ctx)
 	{
 		opj_lock(ctx);
-		pix = jpx_read_image(ctx, &state, data, size, defcs, 0);
+		pix = jpx_read_image(ctx, &state, data, size, defcs, 0, NULL);
+	}
+	fz_always(ctx)
+		opj_unlock(ctx);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return pix;
+}
+
+fz_pixmap *
+fz_load_jpx_reduced(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *defcs, int *l2factor)
+{
+	fz_jpxd state = { 0 };
+	fz_pixmap *pix = NULL;
+
+	fz_try(ctx)
+	{
+		opj_lock(ctx);
+		pix = jpx_read_image(ctx, &state, data, size, defcs, 0, l2factor);
 	}
 	fz_always(ctx)
 		opj_unlock(ctx);
@@ -976,7 +1033,7 @@ fz_load_jpx_info(fz_context *ctx, const unsigned char *data, size_t size, int *w
 	fz_try(ctx)
 	{
 		opj_lock(ctx);
-		jpx_read_image(ctx, &state, data, size, NULL, 1);
+		jpx_read_image(ctx, &state, data, size, NULL, 1, NULL);
 	}
 	fz_always(ctx)
 		opj_unlock(ctx);
@@ -1000,6 +1057,12 @@ fz_load_jpx(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspa
 	fz_throw(ctx, FZ_ERROR_GENERIC, "JPX support disabled");
 }
 
+fz_pixmap *
+fz_load_jpx_reduced(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *defcs, int *l2factor)
+{
+	fz_throw(ctx, FZ_ERROR_GENERIC, "JPX support disabled");
+}
+
 void
 fz_load_jpx_info(fz_context *ctx, const unsigned char *data, size_t size, int *wp, int *hp, int *xresp, int *yresp, fz_colorspace **cspacep)
 {
@@ -24,6 +24,12 @@ do_scavenging_malloc(fz_context *ctx, size_t size)
 	void *p;
 	int phase = 0;
 
+	/* SumatraPDF: allocators are thread-safe, the lock is only needed for scavenging
+	 * (so that allocations on different threads don't serialize on it) */
+	p = ctx->alloc.malloc(ctx->alloc.user, size);
+	if (p != NULL)
+		return p;
+
 	fz_lock(ctx, FZ_LOCK_ALLOC);
 	do {
 		p = ctx->alloc.malloc(ctx->alloc.user, size);
@@ -44,6 +50,11 @@ do_scavenging_realloc(fz_context *ctx, void *p, size_t size)
 	void *q;
 	int phase = 0;
 
+	/* SumatraPDF: see do_scavenging_malloc */
+	q = ctx->alloc.realloc(ctx->alloc.user, p, size);
+	if (q != NULL)
+		return q;
+
 	fz_lock(ctx, FZ_LOCK_ALLOC);
 	do {
 		q = ctx->alloc.realloc(ctx->alloc.user, p, size);
@@ -135,12 +146,9 @@ fz_realloc_no_throw(fz_context *ctx, void *p, size_t size)
 void
 fz_free(fz_context *ctx, void *p)
 {
+	/* SumatraPDF: see do_scavenging_malloc */
 	if (p)
-	{
-		fz_lock(ctx, FZ_LOCK_ALLOC);
 		ctx->alloc.free(ctx->alloc.user, p);
-		fz_unlock(ctx, FZ_LOCK_ALLOC);
-	}
 }
 
 char *
@@ -37,6 +37,11 @@ struct fz_store
 	int defer_reap_count;
 	int needs_reaping;
 	int scavenging;
+
+	/* SumatraPDF: cf. fz_get_store_stats */
+	size_t hits;
+	size_t misses;
+	size_t evictions;
 };
 
 void
@@ -347,6 +352,7 @@ ensure_space(fz_context *ctx, size_t tofree)
 			if (item->type->make_hash_key(ctx, &hash, item->key))
 				fz_hash_remove(ctx, store->hash, &hash);
 		}
+		store->evictions++;
 
 		/* Link into to_be_freed */
 		item->next = to_be_freed;
@@ -598,9 +604,11 @@ fz_find_item(fz_context *ctx, fz_store_drop_fn *drop, void *key, const fz_store_
 			(void)Memento_takeRef(item->val);
 			item->val->refs++;
 		}
+		store->hits++;
 		fz_unlock(ctx, FZ_LOCK_ALLOC);
 		return (void *)item->val;
 	}
+	store->misses++;
 	fz_unlock(ctx, FZ_LOCK_ALLOC);
 
 	return NULL;
@@ -829,6 +837,7 @@ scavenge(fz_context *ctx, size_t tofree)
 			FZ_LOG_DUMP_STORE(ctx, "Before scavenge:\n");
 		}
 		freed += largest->size;
+		store->evictions++;
 		evict(ctx, largest); /* Drops then retakes lock */
 	}
 	while (freed < tofree);
@@ -1051,6 +1060,24 @@ void fz_filter_store(fz_context *ctx, fz_store_filter_fn *fn, void *arg, const f
 	}
 }
 
+/* SumatraPDF */
+void fz_get_store_stats(fz_context *ctx, fz_store_stats *stats)
+{
+	fz_store *store = ctx->store;
+
+	memset(stats, 0, sizeof(*stats));
+	if (!store)
+		return;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	stats->hits = store->hits;
+	stats->misses = store->misses;
+	stats->evictions = store->evictions;
+	stats->size = store->size;
+	stats->max = store->max;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
+
 void fz_defer_reap_start(fz_context *ctx)
 {
 	if (ctx->store == NULL)
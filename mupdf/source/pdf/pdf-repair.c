@@ -2,6 +2,7 @@
 #include "mupdf/pdf.h"
 
 #include <string.h>
+#include <limits.h>
 
 /* Scan file for objects and reconstruct xref table */
 
@@ -281,6 +282,117 @@ orphan_object(fz_context *ctx, pdf_document *doc, pdf_obj *obj)
 	doc->orphans[doc->orphans_count++] = obj;
 }
 
+/* SumatraPDF: a cached repair consists of "<version> <maxnum> <listlen>",
+   the list's entries (five numbers each) and the repaired trailer */
+#define REPAIR_CACHE_VERSION 1
+/* SumatraPDF: how often to report progress while scanning */
+#define REPAIR_PROGRESS_STEP (1 << 20)
+
+static void
+save_repair(fz_context *ctx, const pdf_repair_hooks *hooks, struct entry *list, int listlen, int maxnum, pdf_obj *trailer)
+{
+	fz_buffer *data = NULL;
+	fz_output *out = NULL;
+	int i;
+
+	fz_var(data);
+	fz_var(out);
+
+	fz_try(ctx)
+	{
+		data = fz_new_buffer(ctx, 32 * (size_t)listlen + 256);
+		out = fz_new_output_with_buffer(ctx, data);
+		fz_write_printf(ctx, out, "%d %d %d\n", REPAIR_CACHE_VERSION, maxnum, listlen);
+		for (i = 0; i < listlen; i++)
+			fz_write_printf(ctx, out, "%d %d %ld %ld %d\n", list[i].num, list[i].gen, list[i].ofs, list[i].stm_ofs, list[i].stm_len);
+		pdf_print_obj(ctx, out, trailer, 1, 1);
+		fz_close_output(ctx, out);
+		hooks->save(ctx, hooks->opaque, data);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_output(ctx, out);
+		fz_drop_buffer(ctx, data);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
+		fz_warn(ctx, "cannot save repaired xref");
+	}
+}
+
+static int64_t
+lex_cached_int(fz_context *ctx, fz_stream *stm, pdf_lexbuf *buf, int64_t min, int64_t max)
+{
+	if (pdf_lex(ctx, stm, buf) != PDF_TOK_INT || buf->i < min || buf->i > max)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "invalid cached repair");
+	return buf->i;
+}
+
+/* returns 1 and replaces the list, if valid data has been cached */
+static int
+load_repair(fz_context *ctx, pdf_document *doc, const pdf_repair_hooks *hooks, struct entry **listp, int *listlenp, int *listcapp, int *maxnump, pdf_obj **trailerp)
+{
+	fz_buffer *data = NULL;
+	fz_stream *stm = NULL;
+	struct entry *list = NULL;
+	pdf_obj *trailer = NULL;
+	pdf_lexbuf buf;
+	int listlen = 0, maxnum = 0, i;
+
+	data = hooks->load(ctx, hooks->opaque);
+	if (!data)
+		return 0;
+
+	pdf_lexbuf_init(ctx, &buf, PDF_LEXBUF_SMALL);
+
+	fz_var(stm);
+	fz_var(list);
+	fz_var(trailer);
+
+	fz_try(ctx)
+	{
+		stm = fz_open_buffer(ctx, data);
+		lex_cached_int(ctx, stm, &buf, REPAIR_CACHE_VERSION, REPAIR_CACHE_VERSION);
+		maxnum = (int)lex_cached_int(ctx, stm, &buf, 1, PDF_MAX_OBJECT_NUMBER);
+		/* each entry takes up at least ten bytes */
+		listlen = (int)lex_cached_int(ctx, stm, &buf, 1, (int64_t)fz_minz(data->len / 10, INT_MAX - 1));
+		list = fz_malloc_array(ctx, listlen + 1, struct entry);
+		for (i = 0; i < listlen; i++)
+		{
+			list[i].num = (int)lex_cached_int(ctx, stm, &buf, 1, maxnum);
+			list[i].gen = (int)lex_cached_int(ctx, stm, &buf, 0, 65535);
+			list[i].ofs = lex_cached_int(ctx, stm, &buf, 0, INT64_MAX);
+			list[i].stm_ofs = lex_cached_int(ctx, stm, &buf, 0, INT64_MAX);
+			list[i].stm_len = (int)lex_cached_int(ctx, stm, &buf, -1, INT_MAX);
+		}
+		if (pdf_lex(ctx, stm, &buf) != PDF_TOK_OPEN_DICT)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "invalid cached repair");
+		trailer = pdf_parse_dict(ctx, doc, stm, &buf);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_stream(ctx, stm);
+		fz_drop_buffer(ctx, data);
+		pdf_lexbuf_fin(ctx, &buf);
+	}
+	fz_catch(ctx)
+	{
+		fz_free(ctx, list);
+		pdf_drop_obj(ctx, trailer);
+		fz_warn(ctx, "ignoring invalid cached repair");
+		return 0;
+	}
+
+	fz_free(ctx, *listp);
+	*listp = list;
+	*listlenp = listlen;
+	*listcapp = listlen + 1;
+	*maxnump = maxnum;
+	*trailerp = trailer;
+	return 1;
+}
+
 static int is_white(int c)
 {
 	return c == '\x00' || c == '\x09' || c == '\x0a' || c == '\x0c' || c == '\x0d' || c == '\x20';
@@ -314,6 +426,10 @@ pdf_repair_xref(fz_context *ctx, pdf_document *doc)
 	pdf_lexbuf *buf = &doc->lexbuf.base;
 	int num_roots = 0;
 	int max_roots = 0;
+	/* SumatraPDF */
+	const pdf_repair_hooks *hooks = doc->repair_hooks;
+	pdf_obj *cached_trailer = NULL;
+	int64_t file_len = 0, next_progress = 0;
 
 	fz_var(encrypt);
 	fz_var(id);
@@ -323,6 +439,7 @@ pdf_repair_xref(fz_context *ctx, pdf_document *doc)
 	fz_var(info);
 	fz_var(list);
 	fz_var(obj);
+	fz_var(cached_trailer);
 
 	fz_warn(ctx, "repairing PDF document");
 
@@ -343,6 +460,25 @@ pdf_repair_xref(fz_context *ctx, pdf_document *doc)
 		listcap = 1024;
 		list = fz_malloc_array(ctx, listcap, struct entry);
 
+		/* SumatraPDF: don't scan a file that has been repaired before */
+		if (hooks && hooks->load && load_repair(ctx, doc, hooks, &list, &listlen, &listcap, &maxnum, &cached_trailer))
+		{
+			encrypt = pdf_keep_obj(ctx, pdf_dict_get(ctx, cached_trailer, PDF_NAME(Encrypt)));
+			id = pdf_keep_obj(ctx, pdf_dict_get(ctx, cached_trailer, PDF_NAME(ID)));
+			info = pdf_keep_obj(ctx, pdf_dict_get(ctx, cached_trailer, PDF_NAME(Info)));
+			dict = pdf_dict_get(ctx, cached_trailer, PDF_NAME(Root));
+			if (dict)
+				add_root(ctx, dict, &roots, &num_roots, &max_roots);
+			goto have_list;
+		}
+
+		if (hooks && hooks->progress)
+		{
+			fz_seek(ctx, doc->file, 0, SEEK_END);
+			file_len = fz_tell(ctx, doc->file);
+			fz_seek(ctx, doc->file, 0, 0);
+		}
+
 		/* look for '%PDF' version marker within first kilobyte of file */
 		n = fz_read(ctx, doc->file, (unsigned char *)buf->scratch, fz_minz(buf->size, 1024));
 
@@ -371,6 +507,11 @@ pdf_repair_xref(fz_context *ctx, pdf_document *doc)
 			tmpofs = fz_tell(ctx, doc->file);
 			if (tmpofs < 0)
 				fz_throw(ctx, FZ_ERROR_GENERIC, "cannot tell in file");
+			if (hooks && hooks->progress && tmpofs >= next_progress)
+			{
+				hooks->progress(ctx, hooks->opaque, tmpofs, file_len);
+				next_progress = tmpofs + REPAIR_PROGRESS_STEP;
+			}
 
 			fz_try(ctx)
 				tok = pdf_lex_no_string(ctx, doc->file, buf);
@@ -527,6 +668,7 @@ pdf_repair_xref(fz_context *ctx, pdf_document *doc)
 			}
 		}
 
+have_list:
 		if (listlen == 0)
 			fz_throw(ctx, FZ_ERROR_GENERIC, "no objects found");
 
@@ -664,9 +806,13 @@ pdf_repair_xref(fz_context *ctx, pdf_document *doc)
 			pdf_drop_obj(ctx, id);
 			id = NULL;
 		}
+
+		if (!cached_trailer && hooks && hooks->save)
+			save_repair(ctx, hooks, list, listlen, maxnum, pdf_trailer(ctx, doc));
 	}
 	fz_always(ctx)
 	{
+		pdf_drop_obj(ctx, cached_trailer);
 		for (i = 0; i < num_roots; i++)
 			pdf_drop_obj(ctx, roots[i]);
 		fz_free(ctx, roots);
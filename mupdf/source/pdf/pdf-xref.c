@@ -2383,6 +2383,29 @@ pdf_open_document_with_stream(fz_context *ctx, fz_stream *file)
 	return doc;
 }
 
+/* SumatraPDF: allow reporting progress of and caching repairs */
+pdf_document *
+pdf_open_document_with_stream_and_repair_hooks(fz_context *ctx, fz_stream *file, const pdf_repair_hooks *hooks)
+{
+	pdf_document *doc = pdf_new_document(ctx, file);
+	doc->repair_hooks = hooks;
+	fz_try(ctx)
+	{
+		pdf_init_document(ctx, doc);
+	}
+	fz_always(ctx)
+	{
+		doc->repair_hooks = NULL;
+	}
+	fz_catch(ctx)
+	{
+		int caught = fz_caught(ctx);
+		fz_drop_document(ctx, &doc->super);
+		fz_throw(ctx, caught, "Failed to open doc from stream");
+	}
+	return doc;
+}
+
 pdf_document *
 pdf_open_document(fz_context *ctx, const char *filename)
 {
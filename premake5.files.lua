@@ -287,6 +287,10 @@ function libjpeg_turbo_files()
     })
     files {"ext/libjpeg-turbo/simd/jsimd_x86_64.c"}
 
+  -- the NEON code in this version of libjpeg-turbo is for 32-bit ARM only
+  filter {'platforms:arm64'}
+    files {"ext/libjpeg-turbo/jsimd_none.c"}
+
   filter {}
 
 end
@@ -418,8 +422,10 @@ function sumatrapdf_files()
     "Installer.cpp",
     "InstUninstCommon.cpp",
     "Uninstaller.cpp",
+    "MemStats.*",
     "Menu.*",
     "MuiEbookPageDef.*",
+    "MultiTextSearch.*",
     "Notifications.*",
     "PagesLayoutDef.*",
     "ParseBKM.*",
@@ -427,9 +433,11 @@ function sumatrapdf_files()
     "Print.*",
     "ProgressUpdateUI.*",
     "RenderCache.*",
+    "RenderWorker.*",
     "resource.h",
     "SaveAsPdf.*",
     "SearchAndDDE.*",
+    "SearchResults.*",
     "Selection.*",
     "SettingsStructs.*",
     "SumatraPDF.cpp",
@@ -448,7 +456,10 @@ function sumatrapdf_files()
     "Tabs.*",
     "Tester.*",
     "TextSearch.*",
+    "TextIndex.*",
     "TextSelection.*",
+    "TileCache.*",
+    "TileCompositor.*",
     "Theme.*",
     "TocEditor.*",
     "TocEditTitle.*",
@@ -478,6 +489,7 @@ end
 
 function utils_files()
   files_in_dir("src/utils", {
+    "AhoCorasick.*",
     "ApiHook.*",
     "Archive.*",
     "BaseUtil.*",
@@ -514,6 +526,7 @@ function utils_files()
     "SerializeTxt.*",
     "SettingsUtil.*",
     "SquareTreeParser.*",
+    "Sse2Neon.h",
     "StrconvUtil.*",
     "StrFormat.*",
     "StringViewUtil.*",
@@ -522,6 +535,7 @@ function utils_files()
     "StrUtil_win.cpp",
     "ThreadUtil.*",
     "TgaReader.*",
+    "Trace.*",
     "TrivialHtmlParser.*",
     "TxtParser.*",
     "UITask.*",
@@ -596,6 +610,12 @@ function mupdf_files()
     }
   filter {}
 
+  filter {"platforms:arm64"}
+    files {
+      "mupdf/fonts_arm64.asm",
+    }
+  filter {}
+
   files_in_dir("mupdf/source/cbz", {
     "mucbz.c",
     "muimg.c",
@@ -873,6 +893,7 @@ end
 
 function test_util_files()
   files_in_dir( "src/utils", {
+    "AhoCorasick.*",
     "BaseUtil.*",
     "BitManip.*",
     "ByteOrderDecoder.*",
@@ -897,6 +918,7 @@ function test_util_files()
     "StrUtil.*",
     "StrUtil_win.cpp",
     "SquareTreeParser.*",
+    "Sse2Neon.h",
     "TrivialHtmlParser.*",
     "UtAssert.*",
     --"VarintGob*",
@@ -918,6 +940,50 @@ function test_util_files()
   })
 end
 
+-- same as test_util_files() but without the tests
+function bench_util_files()
+  files_in_dir( "src/utils", {
+    "AhoCorasick.*",
+    "BaseUtil.*",
+    "BitManip.*",
+    "ByteOrderDecoder.*",
+    "CmdLineParser.*",
+    "ColorUtil.*",
+    "CryptoUtil.*",
+    "CssParser.*",
+    "Dict.*",
+    "Dpi.*",
+    "FileUtil.*",
+    "GeomUtil.*",
+    "HtmlParserLookup.*",
+    "HtmlPrettyPrint.*",
+    "HtmlPullParser.*",
+    "JsonParser.*",
+    "Scoped.*",
+    "SettingsUtil.*",
+    "Log.*",
+    "StrconvUtil.*",
+    "StrFormat.*",
+    "StringViewUtil.*",
+    "StrUtil.*",
+    "StrUtil_win.cpp",
+    "SquareTreeParser.*",
+    "Sse2Neon.h",
+    "Timer.h",
+    "TrivialHtmlParser.*",
+    "Vec.*",
+    "WinUtil.*",
+    "WinDynCalls.*",
+  })
+  files_in_dir("src", {
+    "AppUtil.*",
+    "Flags.*",
+    "SumatraConfig.*",
+    "SettingsStructs.*",
+    "tools/bench_util.cpp"
+  })
+end
+
 function engine_dump_files()
   files_in_dir("src", {
     "EngineDump.cpp",
@@ -53,7 +53,7 @@ include("premake5.files.lua")
 
 workspace "SumatraPDF"
   configurations { "Debug", "Release", "ReleaseAnalyze", }
-  platforms { "x32", "x32_asan", "x64", "x64_ramicro" }
+  platforms { "x32", "x32_asan", "x64", "x64_ramicro", "arm64" }
   startproject "SumatraPDF"
 
   filter "platforms:x32"
@@ -81,6 +81,12 @@ workspace "SumatraPDF"
      defines { "RAMICRO"}
   filter {}
 
+  -- native build for Windows on ARM (instead of running under x64 emulation)
+  filter "platforms:arm64"
+     architecture "ARM64"
+     resdefines { "_WIN64" }
+  filter {}
+
   disablewarnings { "4127", "4189", "4324", "4458", "4522", "4611", "4702", "4800", "6319" }
   warnings "Extra"
 
@@ -126,6 +132,14 @@ workspace "SumatraPDF"
     targetdir "out/dbg64ra"
   filter {}
 
+  filter {"platforms:arm64", "configurations:Release"}
+    targetdir "out/arm64"
+  filter {"platforms:arm64", "configurations:ReleaseAnalyze"}
+    targetdir "out/arm64_prefast"
+  filter {"platforms:arm64", "configurations:Debug"}
+    targetdir "out/dbgarm64"
+  filter {}
+
   objdir "%{cfg.targetdir}/obj"
 
   -- https://github.com/premake/premake-core/wiki/symbols
@@ -405,6 +419,15 @@ workspace "SumatraPDF"
         '..\\bin\\nasm.exe -f win64 -DWIN64 -I ../mupdf/ -o "%{cfg.objdir}/%{file.basename}.obj" "%{file.relpath}"'
       }
     filter {}
+
+    -- nasm can't create ARM64 objects, so the fonts are included with armasm64.exe from msvc
+    filter {'files:**.asm', 'platforms:arm64'}
+      buildmessage 'Compiling %{file.relpath}'
+      buildoutputs { '%{cfg.objdir}/%{file.basename}.obj' }
+      buildcommands {
+        'armasm64.exe -i ../mupdf/ -o "%{cfg.objdir}/%{file.basename}.obj" "%{file.relpath}"'
+      }
+    filter {}
     mupdf_files()
     links { "zlib", "freetype", "libjpeg-turbo", "jbig2dec", "openjpeg", "lcms2", "harfbuzz", "mujs" }
 
@@ -551,6 +574,17 @@ workspace "SumatraPDF"
     links { "gdiplus", "comctl32", "shlwapi", "Version" }
 
 
+  project "bench_util"
+    kind "ConsoleApp"
+    language "C++"
+    cppdialect "C++latest"
+    disablewarnings { "4838" }
+    defines { "NO_LIBMUPDF" }
+    includedirs { "src" }
+    bench_util_files()
+    links { "gdiplus", "comctl32", "shlwapi", "Version" }
+
+
   project "plugin-test"
     kind "WindowedApp"
     language "C++"
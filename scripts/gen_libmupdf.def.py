@@ -112,6 +112,12 @@ EXPORTS
 	LzmaDecode
 	x86_Convert
 
+; mujs exports (required for MultiTextSearch)
+
+	js_regcomp
+	js_regexec
+	js_regfree
+
 ; libwebp exports (required for WebpReader)
 
 	WebPDecodeBGRAInto
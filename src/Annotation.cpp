@@ -298,18 +298,79 @@ Annotation* MakeAnnotationSmx(AnnotationType type, int pageNo, RectD rect, COLOR
     return res;
 }
 
-Vec<Annotation*> FilterAnnotationsForPage(Vec<Annotation*>* annots, int pageNo) {
+AnnotationsIndex::AnnotationsIndex() {
+    InitializeCriticalSection(&cs);
+}
+
+AnnotationsIndex::~AnnotationsIndex() {
+    DeleteCriticalSection(&cs);
+}
+
+void AnnotationsIndex::Reset(Vec<Annotation*>* newAnnots) {
+    ScopedCritSec scope(&cs);
+    annots = newAnnots;
+    firstOnPage.Reset();
+    lastOnPage.Reset();
+    nextOnPage.Reset();
+}
+
+// must be called with cs held
+void AnnotationsIndex::Update() {
+    int n = annots ? annots->isize() : 0;
+    if (n < nextOnPage.isize()) {
+        // shouldn't happen, but the list was changed in other ways than appending
+        firstOnPage.Reset();
+        lastOnPage.Reset();
+        nextOnPage.Reset();
+    }
+    for (int i = nextOnPage.isize(); i < n; i++) {
+        nextOnPage.Append(-1);
+        int pageNo = annots->at(i)->PageNo();
+        if (pageNo < 0) {
+            continue;
+        }
+        while (firstOnPage.isize() <= pageNo) {
+            firstOnPage.Append(-1);
+            lastOnPage.Append(-1);
+        }
+        int last = lastOnPage.at(pageNo);
+        if (last < 0) {
+            firstOnPage.at(pageNo) = i;
+        } else {
+            nextOnPage.at(last) = i;
+        }
+        lastOnPage.at(pageNo) = i;
+    }
+}
+
+bool AnnotationsIndex::HasAnnotationsOnPage(int pageNo) {
+    ScopedCritSec scope(&cs);
+    Update();
+    return pageNo >= 0 && pageNo < firstOnPage.isize() && firstOnPage.at(pageNo) >= 0;
+}
+
+void AnnotationsIndex::GetForPage(int pageNo, Vec<Annotation*>& result) {
+    ScopedCritSec scope(&cs);
+    Update();
+    if (pageNo < 0 || pageNo >= firstOnPage.isize()) {
+        return;
+    }
+    for (int i = firstOnPage.at(pageNo); i >= 0; i = nextOnPage.at(i)) {
+        result.Append(annots->at(i));
+    }
+}
+
+Vec<Annotation*> FilterAnnotationsForPage(AnnotationsIndex* index, int pageNo) {
+    Vec<Annotation*> pageAnnots;
     Vec<Annotation*> result;
-    if (!annots) {
+    if (!index) {
         return result;
     }
-    for (auto& annot : *annots) {
+    index->GetForPage(pageNo, pageAnnots);
+    for (auto& annot : pageAnnots) {
         if (annot->isDeleted) {
             continue;
         }
-        if (annot->PageNo() != pageNo) {
-            continue;
-        }
         // include all annotations for pageNo that can be rendered by fz_run_user_annots
         switch (annot->Type()) {
             case AnnotationType::Highlight:
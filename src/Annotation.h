@@ -82,5 +82,33 @@ std::string_view AnnotationName(AnnotationType);
 bool IsAnnotationEq(Annotation* a1, Annotation* a2);
 
 void DeleteVecAnnotations(Vec<Annotation*>* annots);
-Vec<Annotation*> FilterAnnotationsForPage(Vec<Annotation*>* annots, int pageNo);
+
+// finds the annotations of a page without looking at those of all other pages.
+// annotations are only ever appended to the list of user annotations (deleting
+// one only marks it as deleted and moving one doesn't change its page), so
+// the index catches up with newly appended annotations when it's queried
+struct AnnotationsIndex {
+    CRITICAL_SECTION cs;
+    Vec<Annotation*>* annots = nullptr;
+    // for each page, the index in annots of its first and last annotation
+    Vec<int> firstOnPage;
+    Vec<int> lastOnPage;
+    // for each annotation, the index of the next one on the same page
+    Vec<int> nextOnPage;
+
+    AnnotationsIndex();
+    ~AnnotationsIndex();
+
+    void Reset(Vec<Annotation*>* annots);
+    // includes deleted annotations
+    bool HasAnnotationsOnPage(int pageNo);
+    void GetForPage(int pageNo, Vec<Annotation*>& result);
+
+  private:
+    void Update();
+};
+
+// returns the (not deleted) annotations for pageNo that can be rendered by
+// fz_run_user_annots. index can be nullptr
+Vec<Annotation*> FilterAnnotationsForPage(AnnotationsIndex* index, int pageNo);
 AnnotationType AnnotationTypeFromPdfAnnot(enum pdf_annot_type tp);
@@ -6,12 +6,14 @@
 #include "utils/FileWatcher.h"
 #include "utils/UITask.h"
 #include "utils/ScopedWin.h"
+#include "utils/ThreadUtil.h"
 
 #include "wingui/TreeModel.h"
 
 #include "Annotation.h"
 #include "EngineBase.h"
 #include "EngineEbook.h"
+#include "EnginePs.h"
 
 #include "SumatraConfig.h"
 #include "SettingsStructs.h"
@@ -30,6 +32,41 @@
 
 static WatchedFile* gWatchedSettingsFile = nullptr;
 
+// prefs::Save() is called after every change of the settings (including opening
+// and closing documents), so saving is delayed a bit in order to turn a burst of
+// changes into a single write
+#define PREFS_SAVE_DELAY_MS 2000
+
+static UINT_PTR gSaveTimerId = 0;
+
+// the settings are serialized on the ui thread (GlobalPrefs isn't thread-safe)
+// but written out by a background thread, so that a slow (e.g. network) drive
+// doesn't block the ui. Only the most recently serialized data is kept for writing
+struct PrefsWrite {
+    AutoFreeWstr path;
+    AutoFree data;
+    // binary snapshot of the same settings, empty if they shouldn't be cached
+    AutoFree snapshot;
+};
+
+struct PrefsWriteResult {
+    bool ok;
+    FILETIME modTime;
+};
+
+static Mutex gPrefsWriteMutex;
+// these are protected by gPrefsWriteMutex
+static PrefsWrite* gPendingWrite = nullptr;
+static bool gIsWriterRunning = false;
+static Vec<PrefsWriteResult> gWriteResults;
+
+// these are only accessed on the ui thread
+static HANDLE gWriterThread = nullptr;
+// content of the settings file as last saved (or read), to avoid
+// re-reading it for every save as long as nobody else modifies it
+static AutoFree gLastPrefsData;
+static FILETIME gLastPrefsDataTime{};
+
 // number of weeks past since 2011-01-01
 static int GetWeekCount() {
     SYSTEMTIME date20110101 = {0};
@@ -61,36 +98,207 @@ WCHAR* GetSettingsPath() {
     return AppGenDataFilename(GetSettingsFileNameNoFree());
 }
 
+// the binary snapshot of the settings only has to be parsed when
+// the settings file has changed since it was last loaded or saved
+static WCHAR* GetSettingsCachePath() {
+    if (gIsRaMicroBuild) {
+        return AppGenDataFilename(L"RAMicroPDF-settings.bin");
+    }
+    return AppGenDataFilename(L"SumatraPDF-settings.bin");
+}
+
+// the snapshot is only valid for a settings file with this size and modification time
+struct SettingsCacheHeader {
+    i64 fileSize;
+    FILETIME modTime;
+};
+
+static bool GetSettingsCacheHeader(const WCHAR* path, SettingsCacheHeader& hdr) {
+    WIN32_FILE_ATTRIBUTE_DATA fileInfo;
+    if (!GetFileAttributesExW(path, GetFileExInfoStandard, &fileInfo)) {
+        return false;
+    }
+    hdr.fileSize = ((i64)fileInfo.nFileSizeHigh << 32) | fileInfo.nFileSizeLow;
+    hdr.modTime = fileInfo.ftLastWriteTime;
+    return true;
+}
+
+static GlobalPrefs* LoadSettingsCache(const WCHAR* path) {
+    SettingsCacheHeader hdr;
+    if (!GetSettingsCacheHeader(path, hdr)) {
+        return nullptr;
+    }
+    AutoFreeWstr cachePath = GetSettingsCachePath();
+    AutoFree data = file::ReadFile(cachePath.get());
+    if (data.size() < sizeof(hdr)) {
+        return nullptr;
+    }
+    SettingsCacheHeader* cached = (SettingsCacheHeader*)data.Get();
+    if (cached->fileSize != hdr.fileSize || !FileTimeEq(cached->modTime, hdr.modTime)) {
+        return nullptr;
+    }
+    return NewGlobalPrefsFromBin({data.Get() + sizeof(hdr), data.size() - sizeof(hdr)});
+}
+
+// returns an empty snapshot if the settings can't be cached
+static std::string_view SerializeSettingsCache(GlobalPrefs* gp) {
+    // fewer fields are written if these are false, so the snapshot would differ
+    if (!gp->rememberStatePerDocument || !gp->rememberOpenedFiles) {
+        return {};
+    }
+    size_t size = 0;
+    char* snapshot = SerializeGlobalPrefsBin(gp, &size);
+    return {snapshot, size};
+}
+
+// must be called right after the settings file at path has been written
+static void WriteSettingsCache(const WCHAR* path, std::string_view snapshot) {
+    AutoFreeWstr cachePath = GetSettingsCachePath();
+    SettingsCacheHeader hdr;
+    if (snapshot.empty() || !GetSettingsCacheHeader(path, hdr)) {
+        file::Delete(cachePath);
+        return;
+    }
+    str::Str data;
+    data.Append((const char*)&hdr, sizeof(hdr));
+    data.Append(snapshot.data(), snapshot.size());
+    file::WriteFile(cachePath.get(), data.AsView());
+}
+
+// gp must have the same values as parsing the current settings file would produce
+static void SaveSettingsCache(const WCHAR* path, GlobalPrefs* gp) {
+    if (!HasPermission(Perm_SavePreferences)) {
+        return;
+    }
+    AutoFree snapshot = SerializeSettingsCache(gp);
+    WriteSettingsCache(path, snapshot.as_view());
+}
+
+// the data is written to a temporary file first, so that a crash or
+// a full disk can't leave a truncated settings file behind
+static bool WriteFileAtomic(const WCHAR* path, std::string_view data) {
+    AutoFreeWstr tmpPath = str::Join(path, L".tmp");
+    bool ok = file::WriteFile(tmpPath.get(), data);
+    if (ok) {
+        ok = MoveFileExW(tmpPath, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+    }
+    if (!ok) {
+        file::Delete(tmpPath);
+    }
+    return ok;
+}
+
+static bool IsWriterRunning() {
+    gPrefsWriteMutex.Lock();
+    bool isRunning = gIsWriterRunning;
+    gPrefsWriteMutex.Unlock();
+    return isRunning;
+}
+
+// applies the results of the writes that have finished since the last call
+static void ProcessWriteResults() {
+    gPrefsWriteMutex.Lock();
+    for (PrefsWriteResult& res : gWriteResults) {
+        if (!res.ok) {
+            // the content on disk is unknown, so re-read it for the next save
+            gLastPrefsData.Set(nullptr);
+            gLastPrefsDataTime = {};
+            continue;
+        }
+        gLastPrefsDataTime = res.modTime;
+        // so that Reload() doesn't reload our own changes
+        if (gGlobalPrefs) {
+            gGlobalPrefs->lastPrefUpdate = res.modTime;
+        }
+    }
+    gWriteResults.Reset();
+    gPrefsWriteMutex.Unlock();
+}
+
+static DWORD WINAPI PrefsWriterThread(LPVOID) {
+    for (;;) {
+        gPrefsWriteMutex.Lock();
+        PrefsWrite* w = gPendingWrite;
+        gPendingWrite = nullptr;
+        if (!w) {
+            gIsWriterRunning = false;
+            gPrefsWriteMutex.Unlock();
+            return 0;
+        }
+        gPrefsWriteMutex.Unlock();
+
+        PrefsWriteResult res{};
+        res.ok = WriteFileAtomic(w->path, w->data.as_view());
+        if (res.ok) {
+            WriteSettingsCache(w->path, w->snapshot.as_view());
+            res.modTime = file::GetModificationTime(w->path);
+        }
+        delete w;
+
+        gPrefsWriteMutex.Lock();
+        gWriteResults.Append(res);
+        gPrefsWriteMutex.Unlock();
+        uitask::Post(ProcessWriteResults);
+    }
+}
+
+// replaces a not yet started write, if there is one
+static void QueueWrite(PrefsWrite* w) {
+    gPrefsWriteMutex.Lock();
+    delete gPendingWrite;
+    gPendingWrite = w;
+    bool startThread = !gIsWriterRunning;
+    gIsWriterRunning = true;
+    gPrefsWriteMutex.Unlock();
+
+    if (!startThread) {
+        return;
+    }
+    if (gWriterThread) {
+        CloseHandle(gWriterThread);
+    }
+    gWriterThread = CreateThread(nullptr, 0, PrefsWriterThread, nullptr, 0, nullptr);
+    if (!gWriterThread) {
+        PrefsWriterThread(nullptr);
+    }
+}
+
 /* Caller needs to prefs::CleanUp() */
 bool Load() {
     CrashIf(gGlobalPrefs);
 
     AutoFreeWstr path = GetSettingsPath();
-    AutoFree prefsData = file::ReadFile(path.get());
-
-    gGlobalPrefs = NewGlobalPrefs(prefsData.data);
-    CrashAlwaysIf(!gGlobalPrefs);
-    auto* gprefs = gGlobalPrefs;
-
-    // in pre-release builds between 3.1.10079 and 3.1.10377,
-    // RestoreSession was a string with the additional option "auto"
-    // TODO: remove this after 3.2 has been released
+    gGlobalPrefs = LoadSettingsCache(path);
+    if (!gGlobalPrefs) {
+        AutoFree prefsData = file::ReadFile(path.get());
+        gGlobalPrefs = NewGlobalPrefs(prefsData.data);
+        CrashAlwaysIf(!gGlobalPrefs);
+        auto* gprefs = gGlobalPrefs;
+
+        // in pre-release builds between 3.1.10079 and 3.1.10377,
+        // RestoreSession was a string with the additional option "auto"
+        // TODO: remove this after 3.2 has been released
 #if defined(DEBUG) || defined(PRE_RELEASE_VER)
-    if (!gprefs->restoreSession && prefsData.data && str::Find(prefsData.data, "\nRestoreSession = auto")) {
-        gprefs->restoreSession = true;
-    }
+        if (!gprefs->restoreSession && prefsData.data && str::Find(prefsData.data, "\nRestoreSession = auto")) {
+            gprefs->restoreSession = true;
+        }
 #endif
 
 #ifdef DISABLE_EBOOK_UI
-    if (!prefsData || !str::Find(prefsData, "UseFixedPageUI =")) {
-        gprefs->ebookUI.useFixedPageUI = gprefs->chmUI.useFixedPageUI = true;
-    }
+        if (!prefsData || !str::Find(prefsData, "UseFixedPageUI =")) {
+            gprefs->ebookUI.useFixedPageUI = gprefs->chmUI.useFixedPageUI = true;
+        }
 #endif
 #ifdef DISABLE_TABS
-    if (!prefsData || !str::Find(prefsData, "UseTabs =")) {
-        gprefs->useTabs = false;
-    }
+        if (!prefsData || !str::Find(prefsData, "UseTabs =")) {
+            gprefs->useTabs = false;
+        }
 #endif
+        if (prefsData.data) {
+            SaveSettingsCache(path, gprefs);
+        }
+    }
+    auto* gprefs = gGlobalPrefs;
 
     if (!gprefs->uiLanguage || !trans::ValidateLangCode(gprefs->uiLanguage)) {
         // guess the ui language on first start
@@ -122,6 +330,10 @@ bool Load() {
     // TODO: verify that all states have a non-nullptr file path?
     gFileHistory.UpdateStatesSource(gprefs->fileStates);
     SetDefaultEbookFont(gprefs->ebookUI.fontName, gprefs->ebookUI.fontSize);
+    AutoFreeWstr layoutCacheDir(AppGenDataFilename(L"sumatrapdfcache\\layouts"));
+    SetEbookLayoutCacheDir(layoutCacheDir);
+    AutoFreeWstr psCacheDir(AppGenDataFilename(L"sumatrapdfcache\\ps"));
+    SetPsConversionCacheDir(psCacheDir);
 
     if (!file::Exists(path.get())) {
         Save();
@@ -129,22 +341,7 @@ bool Load() {
     return true;
 }
 
-// called whenever global preferences change or a file is
-// added or removed from gFileHistory (in order to keep
-// the list of recently opened documents in sync)
-bool Save() {
-    // don't save preferences without the proper permission
-    if (!HasPermission(Perm_SavePreferences)) {
-        return false;
-    }
-
-    // update display states for all tabs
-    for (WindowInfo* win : gWindows) {
-        for (TabInfo* tab : win->tabs) {
-            UpdateTabFileDisplayStateForTab(tab);
-        }
-    }
-
+static bool SaveNow() {
     // remove entries which should (no longer) be remembered
     gFileHistory.Purge(!gGlobalPrefs->rememberStatePerDocument);
     // update display mode and zoom fields from internal values
@@ -156,9 +353,14 @@ bool Save() {
     if (!path.data) {
         return false;
     }
-    AutoFree prevPrefsData = file::ReadFile(path.data);
+    ProcessWriteResults();
+    // while a write is in progress, the file will soon contain gLastPrefsData
+    if (!IsWriterRunning() && !FileTimeEq(file::GetModificationTime(path.get()), gLastPrefsDataTime)) {
+        gLastPrefsData = file::ReadFile(path.data);
+        gLastPrefsDataTime = file::GetModificationTime(path.get());
+    }
     size_t prefsDataSize = 0;
-    AutoFree prefsData = SerializeGlobalPrefs(gGlobalPrefs, prevPrefsData.data, &prefsDataSize);
+    AutoFree prefsData = SerializeGlobalPrefs(gGlobalPrefs, gLastPrefsData.data, &prefsDataSize);
 
     CrashIf(!prefsData.data || 0 == prefsDataSize);
     if (!prefsData.data || 0 == prefsDataSize) {
@@ -166,21 +368,78 @@ bool Save() {
     }
 
     // only save if anything's changed at all
-    if (prevPrefsData.size() == prefsDataSize && str::Eq(prefsData.get(), prevPrefsData.data)) {
+    if (gLastPrefsData.size() == prefsDataSize && str::Eq(prefsData.get(), gLastPrefsData.data)) {
         return true;
     }
 
-    bool ok = file::WriteFile(path.get(), prefsData.as_view());
-    if (!ok) {
+    auto w = new PrefsWrite();
+    w->path.Set(path.StealData());
+    w->data = std::move(prefsData);
+    w->snapshot = SerializeSettingsCache(gGlobalPrefs);
+    gLastPrefsData.SetCopy(w->data.get());
+    QueueWrite(w);
+    return true;
+}
+
+static void CALLBACK OnSaveTimer(HWND, UINT, UINT_PTR, DWORD) {
+    KillTimer(nullptr, gSaveTimerId);
+    gSaveTimerId = 0;
+    SaveNow();
+}
+
+// called whenever global preferences change or a file is
+// added or removed from gFileHistory (in order to keep
+// the list of recently opened documents in sync)
+// the settings are written with a delay, call Flush() if they
+// must be on disk when this returns
+bool Save() {
+    // don't save preferences without the proper permission
+    if (!HasPermission(Perm_SavePreferences)) {
         return false;
     }
-    gGlobalPrefs->lastPrefUpdate = file::GetModificationTime(path.get());
+
+    // update display states for all tabs
+    // (done right away, as the tabs might be gone when the timer fires)
+    for (WindowInfo* win : gWindows) {
+        for (TabInfo* tab : win->tabs) {
+            UpdateTabFileDisplayStateForTab(tab);
+        }
+    }
+
+    if (gSaveTimerId) {
+        return true;
+    }
+    gSaveTimerId = SetTimer(nullptr, 0, PREFS_SAVE_DELAY_MS, OnSaveTimer);
+    if (!gSaveTimerId) {
+        return SaveNow();
+    }
     return true;
 }
 
+// saves pending changes right away and waits until they've been written
+void Flush() {
+    if (gSaveTimerId) {
+        KillTimer(nullptr, gSaveTimerId);
+        gSaveTimerId = 0;
+        SaveNow();
+    }
+    if (gWriterThread) {
+        WaitForSingleObject(gWriterThread, INFINITE);
+        CloseHandle(gWriterThread);
+        gWriterThread = nullptr;
+    }
+    ProcessWriteResults();
+}
+
 // refresh the preferences when a different SumatraPDF process saves them
 // or if they are edited by the user using a text editor
 bool Reload() {
+    ProcessWriteResults();
+    // our own changes that haven't been written yet take precedence
+    if (gSaveTimerId || IsWriterRunning()) {
+        return true;
+    }
+
     AutoFreeWstr path = GetSettingsPath();
     if (!file::Exists(path)) {
         return false;
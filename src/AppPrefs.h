@@ -16,6 +16,7 @@ WCHAR* GetSettingsPath();
 
 bool Load();
 bool Save();
+void Flush();
 bool Reload();
 void CleanUp();
 
@@ -5,6 +5,7 @@
 #include "utils/WinDynCalls.h"
 #include "utils/Dpi.h"
 #include "utils/FileUtil.h"
+#include "utils/GdiPlusUtil.h"
 #include "utils/Timer.h"
 #include "utils/UITask.h"
 #include "utils/WinUtil.h"
@@ -30,6 +31,7 @@
 #include "Theme.h"
 #include "GlobalPrefs.h"
 #include "RenderCache.h"
+#include "TileCompositor.h"
 #include "ProgressUpdateUI.h"
 #include "TextSelection.h"
 #include "TextSearch.h"
@@ -75,13 +77,18 @@ void UpdateDeltaPerLine() {
 
 static void OnVScroll(WindowInfo* win, WPARAM wParam) {
     CrashIf(!win->AsFixed());
+    DisplayModel* dm = win->AsFixed();
 
     SCROLLINFO si = {0};
     si.cbSize = sizeof(si);
     si.fMask = SIF_ALL;
     GetScrollInfo(win->hwndCanvas, SB_VERT, &si);
 
-    int currPos = si.nPos;
+    // scroll in canvas coordinates, as the scrollbar positions might be scaled
+    // down (cf. DisplayModel::GetScrollbarScaleY)
+    i64 currPos = dm->GetViewPort().y;
+    i64 newPos = currPos;
+    i64 pageDy = (i64)si.nPage * dm->GetScrollbarScaleY();
     auto ctrl = win->ctrl;
     int lineHeight = DpiScale(win->hwndCanvas, 16);
     bool isFitPage = (ZOOM_FIT_PAGE == ctrl->GetZoomVirtual());
@@ -92,44 +99,47 @@ static void OnVScroll(WindowInfo* win, WPARAM wParam) {
     USHORT message = LOWORD(wParam);
     switch (message) {
         case SB_TOP:
-            si.nPos = si.nMin;
+            newPos = 0;
             break;
         case SB_BOTTOM:
-            si.nPos = si.nMax;
+            newPos = dm->GetCanvasSize().dy;
             break;
         case SB_LINEUP:
-            si.nPos -= lineHeight;
+            newPos -= lineHeight;
             break;
         case SB_LINEDOWN:
-            si.nPos += lineHeight;
+            newPos += lineHeight;
             break;
         case SB_HPAGEUP:
-            si.nPos -= si.nPage / 2;
+            newPos -= pageDy / 2;
             break;
         case SB_HPAGEDOWN:
-            si.nPos += si.nPage / 2;
+            newPos += pageDy / 2;
             break;
         case SB_PAGEUP:
-            si.nPos -= si.nPage;
+            newPos -= pageDy;
             break;
         case SB_PAGEDOWN:
-            si.nPos += si.nPage;
+            newPos += pageDy;
             break;
         case SB_THUMBTRACK:
-            si.nPos = si.nTrackPos;
+            newPos = dm->ScrollbarToCanvasY(si.nTrackPos);
             break;
     }
 
+    i64 maxPos = dm->GetCanvasSize().dy - dm->GetViewPort().dy;
+    newPos = limitValue(newPos, (i64)0, std::max(maxPos, (i64)0));
+
     // Set the position and then retrieve it.  Due to adjustments
     // by Windows it may not be the same as the value set.
     si.fMask = SIF_POS;
+    si.nPos = dm->CanvasYToScrollbar(newPos);
     SetScrollInfo(win->hwndCanvas, SB_VERT, &si, TRUE);
-    GetScrollInfo(win->hwndCanvas, SB_VERT, &si);
 
     // If the position has changed or we're dealing with a touchpad scroll event,
     // scroll the window and update it
-    if (si.nPos != currPos || message == SB_THUMBTRACK) {
-        win->AsFixed()->ScrollYTo(si.nPos);
+    if (newPos != currPos || message == SB_THUMBTRACK) {
+        dm->ScrollYTo(newPos);
     }
 }
 
@@ -623,6 +633,49 @@ static void DebugShowLinks(DisplayModel& dm, HDC hdc) {
     }
 }
 
+// how long painting the canvas took the last time (shown by the performance overlay)
+static double gLastPaintMs = 0;
+
+static void DrawPerfHud(WindowInfo* win, HDC hdc) {
+    if (!gShowPerfHud) {
+        return;
+    }
+    DisplayModel* dm = win->AsFixed();
+    RenderCache& rc = gRenderCache;
+    int nCached;
+    size_t cacheSize;
+    {
+        ScopedCritSec scope(&rc.cacheAccess);
+        nCached = rc.cacheCount;
+        cacheSize = rc.cacheSize;
+    }
+    int nRequests = rc.QueueDepth();
+    int nTiles = rc.tileCacheHits + rc.tileCacheMisses;
+    float hitRatio = nTiles ? 100.f * rc.tileCacheHits / nTiles : 0.f;
+    size_t textSize = dm->textCache ? dm->textCache->cachedSize : 0;
+    FzStoreStats store;
+    GetFzStoreStats(&store);
+
+    AutoFreeWstr txt(str::Format(L"render queue: %d\ncache: %d bitmaps, %.1f MB\ncache hits: %d, misses: %d (%.0f%%)\n"
+                                 L"last tile render: %.1f ms\ntext cache: %.1f MB\npaint: %.1f ms\n"
+                                 L"image store: %.1f of %.0f MB\nstore hits: %d, misses: %d, evictions: %d",
+                                 nRequests, nCached, cacheSize / (1024.f * 1024.f), rc.tileCacheHits,
+                                 rc.tileCacheMisses, hitRatio, rc.lastRenderMs, textSize / (1024.f * 1024.f),
+                                 gLastPaintMs, store.size / (1024.f * 1024.f), store.maxSize / (1024.f * 1024.f),
+                                 (int)store.hits, (int)store.misses, (int)store.evictions));
+
+    AutoDeleteFont font(CreateSimpleFont(hdc, L"MS Shell Dlg", 12));
+    ScopedSelectFont restoreFont(hdc, font);
+    int padding = DpiScale(win->hwndFrame, 4);
+    RECT rcTxt = {padding, padding, 0, 0};
+    DrawTextW(hdc, txt, -1, &rcTxt, DT_CALCRECT | DT_NOPREFIX);
+    RECT rcBg = {0, 0, rcTxt.right + padding, rcTxt.bottom + padding};
+    FillRect(hdc, &rcBg, GetStockBrush(BLACK_BRUSH));
+    SetTextColor(hdc, WIN_COL_WHITE);
+    SetBkMode(hdc, TRANSPARENT);
+    DrawTextW(hdc, txt, -1, &rcTxt, DT_NOPREFIX);
+}
+
 // cf. http://forums.fofou.org/sumatrapdf/topic?id=3183580
 static void GetGradientColor(COLORREF a, COLORREF b, float perc, TRIVERTEX* tv) {
     u8 ar, ag, ab;
@@ -635,12 +688,115 @@ static void GetGradientColor(COLORREF a, COLORREF b, float perc, TRIVERTEX* tv)
     tv->Blue = (COLOR16)((ab + perc * (bb - ab)) * 256);
 }
 
-static void DrawDocument(WindowInfo* win, HDC hdc, RECT* rcArea) {
-    CrashIf(!win->AsFixed());
-    if (!win->AsFixed())
+// multiplies the pixels in rect with col, weighted by col's alpha (which
+// is how the engines render highlights, cf. fz_run_user_page_annots)
+static void PaintHighlightMultiplied(HDC hdc, Rect rect, COLORREF col) {
+    if (rect.IsEmpty()) {
         return;
-    DisplayModel* dm = win->AsFixed();
+    }
+    HANDLE hMap = nullptr;
+    HBITMAP hbmp = CreateMemoryBitmap(rect.Size(), &hMap);
+    DIBSECTION info{};
+    if (!hbmp || GetObject(hbmp, sizeof(info), &info) != sizeof(info) || !info.dsBm.bmBits) {
+        DeleteObject(hbmp);
+        CloseHandle(hMap);
+        return;
+    }
+    HDC bmpDC = CreateCompatibleDC(hdc);
+    HGDIOBJ prevBmp = SelectObject(bmpDC, hbmp);
+    BitBlt(bmpDC, 0, 0, rect.dx, rect.dy, hdc, rect.x, rect.y, SRCCOPY);
+    GdiFlush();
+
+    u8 r, g, b, a;
+    UnpackRgba(col, r, g, b, a);
+    // d * (1 - a + a * c) in fixed point
+    u32 fb = 255 * 255 - a * (255 - b);
+    u32 fg = 255 * 255 - a * (255 - g);
+    u32 fr = 255 * 255 - a * (255 - r);
+    u8* pixels = (u8*)info.dsBm.bmBits;
+    size_t n = (size_t)rect.dx * rect.dy;
+    for (size_t i = 0; i < n; i++, pixels += 4) {
+        pixels[0] = (u8)(pixels[0] * fb / (255 * 255));
+        pixels[1] = (u8)(pixels[1] * fg / (255 * 255));
+        pixels[2] = (u8)(pixels[2] * fr / (255 * 255));
+    }
+
+    BitBlt(hdc, rect.x, rect.y, rect.dx, rect.dy, bmpDC, 0, 0, SRCCOPY);
+    SelectObject(bmpDC, prevBmp);
+    DeleteDC(bmpDC);
+    DeleteObject(hbmp);
+    CloseHandle(hMap);
+}
+
+static Gdiplus::PointF CvtToScreenF(DisplayModel* dm, int pageNo, PointD pt) {
+    PageInfo* pageInfo = dm->GetPageInfo(pageNo);
+    PointD p = dm->GetEngine()->Transform(pt, pageNo, dm->GetZoomReal(pageNo), dm->GetRotation());
+    return Gdiplus::PointF((float)(p.x + pageInfo->pageOnScreen.x), (float)(p.y + pageInfo->pageOnScreen.y));
+}
+
+static void DrawAnnotationLine(Gdiplus::Graphics& g, DisplayModel* dm, int pageNo, Gdiplus::Pen& pen, PointD p1,
+                               PointD p2) {
+    g.DrawLine(&pen, CvtToScreenF(dm, pageNo, p1), CvtToScreenF(dm, pageNo, p2));
+}
+
+// user annotations aren't part of the rendered tiles but are painted
+// on top of them, so that adding or changing them doesn't require
+// re-rendering the page (the engines still render them for printing, etc.)
+static void PaintUserAnnotations(HDC hdc, DisplayModel* dm, int pageNo, Rect bounds) {
+    if (!dm->userAnnots) {
+        return;
+    }
+    Vec<Annotation*> annots = FilterAnnotationsForPage(dm->GetEngine()->userAnnotsIndex, pageNo);
+    if (annots.size() == 0) {
+        return;
+    }
+
+    Gdiplus::Graphics g(hdc);
+    g.SetSmoothingMode(Gdiplus::SmoothingModeAntiAlias);
+    g.SetPageUnit(Gdiplus::UnitPixel);
+    g.SetClip(bounds.ToGdipRect());
+    float zoom = dm->GetZoomReal(pageNo);
+
+    for (Annotation* annot : annots) {
+        RectD rect = annot->Rect();
+        COLORREF col = annot->Color();
+        if (AnnotationType::Highlight == annot->type) {
+            Rect r = dm->CvtToScreen(pageNo, rect).Intersect(bounds);
+            PaintHighlightMultiplied(hdc, r, col);
+            continue;
+        }
+        u8 cr, cg, cb;
+        UnpackRgb(col, cr, cg, cb);
+        Gdiplus::Color lineCol(cr, cg, cb);
+        switch (annot->type) {
+            case AnnotationType::Underline: {
+                Gdiplus::Pen pen(lineCol, zoom);
+                double y = rect.BR().y - 0.25;
+                DrawAnnotationLine(g, dm, pageNo, pen, PointD(rect.x, y), PointD(rect.BR().x, y));
+                break;
+            }
+            case AnnotationType::StrikeOut: {
+                Gdiplus::Pen pen(lineCol, zoom);
+                double y = rect.y + rect.dy / 2;
+                DrawAnnotationLine(g, dm, pageNo, pen, PointD(rect.x, y), PointD(rect.BR().x, y));
+                break;
+            }
+            case AnnotationType::Squiggly: {
+                Gdiplus::Pen pen(lineCol, 0.5f * zoom);
+                // the dash pattern is relative to the pen's width
+                Gdiplus::REAL dash[2] = {2, 2};
+                pen.SetDashPattern(dash, dimof(dash));
+                double y = rect.BR().y;
+                DrawAnnotationLine(g, dm, pageNo, pen, PointD(rect.x + 1, y), PointD(rect.BR().x, y));
+                DrawAnnotationLine(g, dm, pageNo, pen, PointD(rect.x, y - 0.5), PointD(rect.BR().x, y - 0.5));
+                break;
+            }
+        }
+    }
+}
 
+static void PaintCanvasBackground(WindowInfo* win, HDC hdc, RECT* rcArea) {
+    DisplayModel* dm = win->AsFixed();
     bool isImage = dm->GetEngine()->IsImageCollection();
     // draw comic books and single images on a black background
     // (without frame and shadow)
@@ -669,9 +825,9 @@ static void DrawDocument(WindowInfo* win, HDC hdc, RECT* rcArea) {
             colors[1] = gcols->at(1);
             colors[2] = gcols->at(2);
         }
-        Size size = dm->GetCanvasSize();
+        CanvasSize size = dm->GetCanvasSize();
         float percTop = 1.0f * dm->GetViewPort().y / size.dy;
-        float percBot = 1.0f * dm->GetViewPort().BR().y / size.dy;
+        float percBot = 1.0f * dm->GetViewPort().Bottom() / size.dy;
         if (!IsContinuous(dm->GetDisplayMode())) {
             percTop += dm->CurrentPageNo() - 1;
             percTop /= dm->PageCount();
@@ -712,69 +868,80 @@ static void DrawDocument(WindowInfo* win, HDC hdc, RECT* rcArea) {
         }
         GradientFill(hdc, tv, dimof(tv), gr, nMesh, GRADIENT_FILL_RECT_V);
     }
+}
 
-    bool rendering = false;
+// returns false if no part of the page is within paintArea
+static bool GetPageBoundsToPaint(DisplayModel* dm, int pageNo, Rect paintArea, Rect* boundsOut) {
+    PageInfo* pageInfo = dm->GetPageInfo(pageNo);
+    if (!pageInfo || 0.0f == pageInfo->visibleRatio) {
+        return false;
+    }
+    CrashIf(!pageInfo->shown);
+    if (!pageInfo->shown) {
+        return false;
+    }
     Rect screen(Point(), dm->GetViewPort().Size());
+    *boundsOut = pageInfo->pageOnScreen.Intersect(screen);
+    return !boundsOut->Intersect(paintArea).IsEmpty();
+}
 
-    for (int pageNo = 1; pageNo <= dm->PageCount(); ++pageNo) {
-        PageInfo* pageInfo = dm->GetPageInfo(pageNo);
-        if (!pageInfo || 0.0f == pageInfo->visibleRatio) {
-            continue;
-        }
-        CrashIf(!pageInfo->shown);
-        if (!pageInfo->shown) {
-            continue;
-        }
-
-        Rect bounds = pageInfo->pageOnScreen.Intersect(screen);
-        // don't paint the frame background for images
-        if (!dm->GetEngine()->IsImageCollection()) {
-            Rect r = pageInfo->pageOnScreen;
-            auto presMode = win->presentation;
-            PaintPageFrameAndShadow(hdc, bounds, r, presMode);
-        }
+static void PaintPageFrame(WindowInfo* win, HDC hdc, int pageNo, Rect bounds) {
+    DisplayModel* dm = win->AsFixed();
+    // don't paint the frame background for images
+    if (!dm->GetEngine()->IsImageCollection()) {
+        Rect r = dm->GetPageInfo(pageNo)->pageOnScreen;
+        auto presMode = win->presentation;
+        PaintPageFrameAndShadow(hdc, bounds, r, presMode);
+    }
+}
 
-        bool renderOutOfDateCue = false;
-        UINT renderDelay = gRenderCache.Paint(hdc, bounds, dm, pageNo, pageInfo, &renderOutOfDateCue);
-
-        if (renderDelay) {
-            AutoDeleteFont fontRightTxt(CreateSimpleFont(hdc, L"MS Shell Dlg", 14));
-            HGDIOBJ hPrevFont = SelectObject(hdc, fontRightTxt);
-            auto col = GetAppColor(AppColor::MainWindowText);
-            SetTextColor(hdc, col);
-            if (renderDelay != RENDER_DELAY_FAILED) {
-                if (renderDelay < REPAINT_MESSAGE_DELAY_IN_MS) {
-                    win->RepaintAsync(REPAINT_MESSAGE_DELAY_IN_MS / 4);
-                } else {
-                    DrawCenteredText(hdc, bounds, _TR("Please wait - rendering..."), IsUIRightToLeft());
-                }
-                rendering = true;
+// paints what goes over the tiles of a page. returns true if the page
+// is still being rendered
+static bool PaintPageOverlays(WindowInfo* win, HDC hdc, int pageNo, Rect bounds, UINT renderDelay,
+                              bool renderOutOfDateCue) {
+    if (renderDelay) {
+        bool rendering = false;
+        AutoDeleteFont fontRightTxt(CreateSimpleFont(hdc, L"MS Shell Dlg", 14));
+        HGDIOBJ hPrevFont = SelectObject(hdc, fontRightTxt);
+        auto col = GetAppColor(AppColor::MainWindowText);
+        SetTextColor(hdc, col);
+        if (renderDelay != RENDER_DELAY_FAILED) {
+            if (renderDelay < REPAINT_MESSAGE_DELAY_IN_MS) {
+                win->RepaintAsync(REPAINT_MESSAGE_DELAY_IN_MS / 4);
             } else {
-                DrawCenteredText(hdc, bounds, _TR("Couldn't render the page"), IsUIRightToLeft());
+                DrawCenteredText(hdc, bounds, _TR("Please wait - rendering..."), IsUIRightToLeft());
             }
-            SelectObject(hdc, hPrevFont);
-            continue;
+            rendering = true;
+        } else {
+            DrawCenteredText(hdc, bounds, _TR("Couldn't render the page"), IsUIRightToLeft());
         }
+        SelectObject(hdc, hPrevFont);
+        return rendering;
+    }
 
-        if (!renderOutOfDateCue) {
-            continue;
-        }
+    PaintUserAnnotations(hdc, win->AsFixed(), pageNo, bounds);
 
-        HDC bmpDC = CreateCompatibleDC(hdc);
-        if (bmpDC) {
-            SelectObject(bmpDC, gBitmapReloadingCue);
-            int size = DpiScale(win->hwndFrame, 16);
-            int cx = std::min(bounds.dx, 2 * size);
-            int cy = std::min(bounds.dy, 2 * size);
-            int x = bounds.x + bounds.dx - std::min((cx + size) / 2, cx);
-            int y = bounds.y + std::max((cy - size) / 2, 0);
-            int dxDest = std::min(cx, size);
-            int dyDest = std::min(cy, size);
-            StretchBlt(hdc, x, y, dxDest, dyDest, bmpDC, 0, 0, 16, 16, SRCCOPY);
-            DeleteDC(bmpDC);
-        }
+    if (!renderOutOfDateCue) {
+        return false;
     }
 
+    HDC bmpDC = CreateCompatibleDC(hdc);
+    if (bmpDC) {
+        SelectObject(bmpDC, gBitmapReloadingCue);
+        int size = DpiScale(win->hwndFrame, 16);
+        int cx = std::min(bounds.dx, 2 * size);
+        int cy = std::min(bounds.dy, 2 * size);
+        int x = bounds.x + bounds.dx - std::min((cx + size) / 2, cx);
+        int y = bounds.y + std::max((cy - size) / 2, 0);
+        int dxDest = std::min(cx, size);
+        int dyDest = std::min(cy, size);
+        StretchBlt(hdc, x, y, dxDest, dyDest, bmpDC, 0, 0, 16, 16, SRCCOPY);
+        DeleteDC(bmpDC);
+    }
+    return false;
+}
+
+static void PaintCanvasOverlays(WindowInfo* win, HDC hdc, bool rendering) {
     if (win->showSelection) {
         PaintSelection(win, hdc);
     }
@@ -783,31 +950,171 @@ static void DrawDocument(WindowInfo* win, HDC hdc, RECT* rcArea) {
         PaintForwardSearchMark(win, hdc);
     }
 
+    if (win->currentTab->searchHits) {
+        PaintSearchHitMarks(win, hdc);
+    }
+
     if (!rendering) {
-        DebugShowLinks(*dm, hdc);
+        DebugShowLinks(*win->AsFixed(), hdc);
+    }
+
+    DrawPerfHud(win, hdc);
+}
+
+static void DrawDocument(WindowInfo* win, HDC hdc, RECT* rcArea) {
+    CrashIf(!win->AsFixed());
+    if (!win->AsFixed())
+        return;
+    DisplayModel* dm = win->AsFixed();
+
+    PaintCanvasBackground(win, hdc, rcArea);
+
+    bool rendering = false;
+    Rect screen(Point(), dm->GetViewPort().Size());
+    // only blit the tiles within the area to repaint (BeginPaint's DC
+    // is clipped to it anyway, so everything else would be wasted)
+    Rect paintArea = screen.Intersect(Rect::FromRECT(*rcArea));
+
+    int lastVisiblePage = dm->LastVisiblePageNo();
+    for (int pageNo = dm->FirstVisiblePageNo(); pageNo > 0 && pageNo <= lastVisiblePage; ++pageNo) {
+        Rect bounds;
+        if (!GetPageBoundsToPaint(dm, pageNo, paintArea, &bounds)) {
+            continue;
+        }
+        PaintPageFrame(win, hdc, pageNo, bounds);
+
+        bool renderOutOfDateCue = false;
+        Rect tilesBounds = bounds.Intersect(paintArea);
+        PageInfo* pageInfo = dm->GetPageInfo(pageNo);
+        UINT renderDelay = gRenderCache.Paint(hdc, tilesBounds, dm, pageNo, pageInfo, &renderOutOfDateCue);
+        if (PaintPageOverlays(win, hdc, pageNo, bounds, renderDelay, renderOutOfDateCue)) {
+            rendering = true;
+        }
+    }
+
+    PaintCanvasOverlays(win, hdc, rendering);
+}
+
+struct PaintedPage {
+    int pageNo = 0;
+    Rect bounds;
+    UINT renderDelay = 0;
+    bool renderOutOfDateCue = false;
+};
+
+// same as DrawDocument, except that the tiles are drawn by the GPU. Direct2D
+// and GDI can't draw at the same time, so everything below the tiles is
+// painted first, then all the tiles and then everything going over them
+static bool DrawDocumentComposited(WindowInfo* win, TileCompositor* compositor, Rect area) {
+    DisplayModel* dm = win->AsFixed();
+    if (!compositor->BeginDraw(area)) {
+        return false;
+    }
+    Rect screen(Point(), dm->GetViewPort().Size());
+    Rect paintArea = screen.Intersect(area);
+    RECT rcArea = area.ToRECT();
+
+    Vec<PaintedPage> pages;
+    int lastVisiblePage = dm->LastVisiblePageNo();
+    for (int pageNo = dm->FirstVisiblePageNo(); pageNo > 0 && pageNo <= lastVisiblePage; ++pageNo) {
+        PaintedPage page;
+        page.pageNo = pageNo;
+        if (GetPageBoundsToPaint(dm, pageNo, paintArea, &page.bounds)) {
+            pages.Append(page);
+        }
+    }
+
+    HDC hdc = compositor->BeginGdi();
+    if (!hdc) {
+        compositor->EndDraw();
+        return false;
+    }
+    PaintCanvasBackground(win, hdc, &rcArea);
+    for (PaintedPage& page : pages) {
+        PaintPageFrame(win, hdc, page.pageNo, page.bounds);
+    }
+    compositor->EndGdi();
+
+    for (PaintedPage& page : pages) {
+        Rect tilesBounds = page.bounds.Intersect(paintArea);
+        PageInfo* pageInfo = dm->GetPageInfo(page.pageNo);
+        page.renderDelay = gRenderCache.Paint(nullptr, tilesBounds, dm, page.pageNo, pageInfo,
+                                              &page.renderOutOfDateCue, compositor);
+    }
+
+    hdc = compositor->BeginGdi();
+    if (!hdc) {
+        compositor->EndDraw();
+        return false;
+    }
+    bool rendering = false;
+    for (PaintedPage& page : pages) {
+        if (PaintPageOverlays(win, hdc, page.pageNo, page.bounds, page.renderDelay, page.renderOutOfDateCue)) {
+            rendering = true;
+        }
+    }
+    PaintCanvasOverlays(win, hdc, rendering);
+    compositor->EndGdi();
+
+    return compositor->EndDraw();
+}
+
+// the canvas has been painted without the compositor, so the content
+// it retains is out of date
+static void DiscardCompositedContent(WindowInfo* win) {
+    if (win->compositor) {
+        win->compositor->ReleaseTarget();
     }
 }
 
 static void OnPaintDocument(WindowInfo* win) {
     auto t = TimeGet();
+    // tabs in the background give up their rendered pages first
+    if (IsNearGdiObjectsLimit()) {
+        for (WindowInfo* w : gWindows) {
+            FreeBackgroundTabCaches(w, true);
+        }
+    }
     PAINTSTRUCT ps;
     HDC hdc = BeginPaint(win->hwndCanvas, &ps);
 
+    // compositing on the GPU is pointless in remote sessions, where
+    // the canvas is transferred as a bitmap anyway
+    bool useCompositor = gGlobalPrefs->gpuCompositing && !gRenderCache.isRemoteSession;
+    if (useCompositor && !win->compositor) {
+        win->compositor = TileCompositor::Create(win->hwndCanvas);
+    }
+
     switch (win->presentation) {
         case PM_BLACK_SCREEN:
+            DiscardCompositedContent(win);
             FillRect(hdc, &ps.rcPaint, GetStockBrush(BLACK_BRUSH));
             break;
         case PM_WHITE_SCREEN:
+            DiscardCompositedContent(win);
             FillRect(hdc, &ps.rcPaint, GetStockBrush(WHITE_BRUSH));
             break;
-        default:
-            DrawDocument(win, win->buffer->GetDC(), &ps.rcPaint);
+        default: {
+            if (useCompositor && win->compositor &&
+                DrawDocumentComposited(win, win->compositor, Rect::FromRECT(ps.rcPaint))) {
+                break;
+            }
+            DiscardCompositedContent(win);
+            // only the update region is flushed, so don't bother drawing
+            // the background, frames and tiles anywhere else
+            HDC hdcBuffer = win->buffer->GetDC();
+            int savedDC = SaveDC(hdcBuffer);
+            IntersectClipRect(hdcBuffer, ps.rcPaint.left, ps.rcPaint.top, ps.rcPaint.right, ps.rcPaint.bottom);
+            DrawDocument(win, hdcBuffer, &ps.rcPaint);
+            RestoreDC(hdcBuffer, savedDC);
             win->buffer->Flush(hdc);
+        }
     }
 
     EndPaint(win->hwndCanvas, &ps);
+    gLastPaintMs = TimeSinceInMs(t);
     if (gShowFrameRate) {
-        win->frameRateWnd->ShowFrameRateDur(TimeSinceInMs(t));
+        win->frameRateWnd->ShowFrameRateDur(gLastPaintMs);
     }
 }
 
@@ -926,6 +1233,9 @@ static LRESULT CanvasOnMouseWheel(WindowInfo* win, UINT message, WPARAM wParam,
         si.fMask = SIF_PAGE;
         GetScrollInfo(win->hwndCanvas, horizontal ? SB_HORZ : SB_VERT, &si);
         int scrollBy = -MulDiv(si.nPage, delta, WHEEL_DELTA);
+        if (!horizontal) {
+            scrollBy *= win->AsFixed()->GetScrollbarScaleY();
+        }
         if (horizontal) {
             win->AsFixed()->ScrollXBy(scrollBy);
         } else {
@@ -1023,8 +1333,16 @@ static LRESULT OnGesture(WindowInfo* win, UINT message, WPARAM wParam, LPARAM lP
     switch (gi.dwID) {
         case GID_ZOOM:
             if (gi.dwFlags != GF_BEGIN && win->AsFixed()) {
+                // only render the pages again once the gesture has ended
+                DisplayModel* dm = win->AsFixed();
+                if (!gRenderCache.isRemoteSession) {
+                    dm->DeferRendering(500);
+                }
                 float zoom = (float)LowerU64(gi.ullArguments) / (float)win->touchState.startArg;
                 ZoomToSelection(win, zoom, false, true);
+                if (gi.dwFlags & GF_END) {
+                    dm->StopDeferringRendering();
+                }
             }
             win->touchState.startArg = LowerU64(gi.ullArguments);
             break;
@@ -1248,6 +1566,7 @@ static void OnPaintAbout(WindowInfo* win) {
     auto t = TimeGet();
     PAINTSTRUCT ps;
     HDC hdc = BeginPaint(win->hwndCanvas, &ps);
+    DiscardCompositedContent(win);
 
     auto txtCol = GetAppColor(AppColor::MainWindowText);
     auto bgCol = GetAppColor(AppColor::MainWindowBg);
@@ -1291,7 +1610,7 @@ static void OnMouseLeftButtonUpAbout(WindowInfo* win, int x, int y, WPARAM key)
         } else if (!str::StartsWithI(url, L"http:") && !str::StartsWithI(url, L"https:") &&
                    !str::StartsWithI(url, L"mailto:")) {
             LoadArgs args(url, win);
-            LoadDocument(args);
+            LoadDocumentAsync(args);
         } else {
             SumatraLaunchBrowser(url);
         }
@@ -1379,6 +1698,7 @@ static LRESULT WndProcCanvasAbout(WindowInfo* win, HWND hwnd, UINT msg, WPARAM w
 static void OnPaintError(WindowInfo* win) {
     PAINTSTRUCT ps;
     HDC hdc = BeginPaint(win->hwndCanvas, &ps);
+    DiscardCompositedContent(win);
 
     AutoDeleteFont fontRightTxt(CreateSimpleFont(hdc, L"MS Shell Dlg", 14));
     HGDIOBJ hPrevFont = SelectObject(hdc, fontRightTxt);
@@ -1426,6 +1746,29 @@ void WindowInfo::RepaintAsync(UINT delay) {
     });
 }
 
+// while the window is being resized (or moved to a monitor with a different DPI),
+// the existing bitmaps are shown scaled and the pages are only rendered anew
+// once the size hasn't changed for RESIZE_RENDER_DELAY_IN_MS
+void DeferRenderingWhileResizing(WindowInfo* win) {
+    DisplayModel* dm = win->AsFixed();
+    if (!dm || gRenderCache.isRemoteSession) {
+        return;
+    }
+    // rendering is stopped from deferring by the timer, this is just a fallback
+    dm->DeferRendering(RESIZE_RENDER_DELAY_IN_MS * 5);
+    // requests for the old viewport (and zoom level) are no longer of use
+    gRenderCache.ClearQueueForDisplayModel(dm);
+    gRenderCache.AbortCurrentRequests(dm);
+    SetTimer(win->hwndCanvas, RESIZE_RENDER_TIMER_ID, RESIZE_RENDER_DELAY_IN_MS, nullptr);
+}
+
+void StopDeferringRenderingAfterResize(WindowInfo* win) {
+    KillTimer(win->hwndCanvas, RESIZE_RENDER_TIMER_ID);
+    if (win->AsFixed()) {
+        win->AsFixed()->StopDeferringRendering();
+    }
+}
+
 static void OnTimer(WindowInfo* win, HWND hwnd, WPARAM timerId) {
     Point pt;
 
@@ -1451,6 +1794,10 @@ static void OnTimer(WindowInfo* win, HWND hwnd, WPARAM timerId) {
             }
             break;
 
+        case ZOOM_ANIMATION_TIMER_ID:
+            OnZoomAnimationTimer(win);
+            break;
+
         case HIDE_CURSOR_TIMER_ID:
             KillTimer(hwnd, HIDE_CURSOR_TIMER_ID);
             if (win->presentation) {
@@ -1485,6 +1832,30 @@ static void OnTimer(WindowInfo* win, HWND hwnd, WPARAM timerId) {
                     tab->AsEbook()->TriggerLayout();
                 }
             }
+            // background tabs are updated when they're selected
+            if (win->AsFixed()) {
+                DisplayModel* dm = win->AsFixed();
+                int pageCount = dm->PageCount();
+                dm->UpdatePageSizes();
+                // ebooks gain pages while they're being laid out
+                if (dm->PageCount() != pageCount) {
+                    UpdateToolbarPageText(win, dm->PageCount(), true);
+                }
+            }
+            break;
+
+        case FIND_AS_YOU_TYPE_TIMER_ID:
+            OnFindAsYouTypeTimer(win);
+            break;
+
+        case FREE_BACKGROUND_TABS_TIMER_ID:
+            if (!FreeBackgroundTabCaches(win)) {
+                KillTimer(hwnd, FREE_BACKGROUND_TABS_TIMER_ID);
+            }
+            break;
+
+        case RESIZE_RENDER_TIMER_ID:
+            StopDeferringRenderingAfterResize(win);
             break;
     }
 }
@@ -1545,6 +1916,10 @@ LRESULT CALLBACK WndProcCanvas(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp) {
 
         case WM_SIZE:
             if (!IsIconic(win->hwndFrame)) {
+                // don't defer e.g. switching to fullscreen, which is a single resize
+                if (win->inSizeMove && win->buffer && win->canvasRc != ClientRect(hwnd)) {
+                    DeferRenderingWhileResizing(win);
+                }
                 win->UpdateCanvasSize();
             }
             return 0;
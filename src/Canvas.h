@@ -3,4 +3,7 @@
 
 void UpdateDeltaPerLine();
 
+void DeferRenderingWhileResizing(WindowInfo* win);
+void StopDeferringRenderingAfterResize(WindowInfo* win);
+
 LRESULT CALLBACK WndProcCanvas(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam);
@@ -104,6 +104,9 @@ struct ButtonInfo {
     bool inactive = false;
     // form the inner rectangle where the button image is drawn
     RECT margins = {0};
+    // kept around so that repainting (e.g. when hovering) doesn't
+    // have to allocate a bitmap (re-created when the button is resized)
+    DoubleBuffer* buffer = nullptr;
 
     ButtonInfo() = default;
 };
@@ -141,6 +144,9 @@ CaptionInfo::~CaptionInfo() {
     if (theme) {
         theme::CloseThemeData(theme);
     }
+    for (ButtonInfo& bi : btn) {
+        delete bi.buffer;
+    }
 }
 
 void CaptionInfo::UpdateBackgroundAlpha() {
@@ -488,11 +494,14 @@ static void DrawCaptionButton(DRAWITEMSTRUCT* item, WindowInfo* win) {
 
     Rect rButton = Rect::FromRECT(item->rcItem);
 
-    DoubleBuffer buffer(item->hwndItem, rButton);
-    HDC memDC = buffer.GetDC();
-
     UINT button = item->CtlID - BTN_ID_FIRST;
     ButtonInfo* bi = &win->caption->btn[button];
+    if (!bi->buffer || bi->buffer->GetRect() != rButton) {
+        delete bi->buffer;
+        bi->buffer = new DoubleBuffer(item->hwndItem, rButton);
+    }
+    HDC memDC = bi->buffer->GetDC();
+
     Rect rc(rButton);
     rc.x += bi->margins.left;
     rc.y += bi->margins.top;
@@ -593,7 +602,7 @@ static void DrawCaptionButton(DRAWITEMSTRUCT* item, WindowInfo* win) {
         DrawIconEx(memDC, x, y, hIcon, xIcon, yIcon, 0, NULL, DI_NORMAL);
     }
 
-    buffer.Flush(item->hDC);
+    bi->buffer->Flush(item->hDC);
 }
 
 void PaintParentBackground(HWND hwnd, HDC hdc) {
@@ -6,6 +6,7 @@
 #include <chm_lib.h>
 #include "utils/ByteReader.h"
 #include "utils/FileUtil.h"
+#include "utils/FileTypeSniff.h"
 #include "utils/HtmlParserLookup.h"
 #include "utils/TrivialHtmlParser.h"
 #include "utils/ScopedWin.h"
@@ -18,6 +19,11 @@
 #include "EbookBase.h"
 #include "ChmDoc.h"
 
+// number of decompressed LZX blocks (usually 32 kB each) that CHMLib keeps
+// around (its default of 5 means that pages sharing blocks with recently
+// shown content are decompressed again and again while navigating)
+#define CHM_BLOCKS_CACHED 64
+
 ChmDoc::~ChmDoc() {
     chm_close(chmHandle);
 }
@@ -270,6 +276,7 @@ bool ChmDoc::Load(const WCHAR* fileName) {
     if (!chmHandle) {
         return false;
     }
+    chm_set_param(chmHandle, CHM_PARAM_MAX_BLOCKS_CACHED, CHM_BLOCKS_CACHED);
 
     ParseWindowsData();
     if (!ParseSystemData()) {
@@ -551,7 +558,7 @@ bool ChmDoc::ParseIndex(EbookTocVisitor* visitor) {
 
 bool ChmDoc::IsSupportedFile(const WCHAR* fileName, bool sniff) {
     if (sniff)
-        return file::StartsWith(fileName, "ITSF");
+        return str::StartsWith(ReadFileHeader(fileName), "ITSF");
 
     return str::EndsWithI(fileName, L".chm");
 }
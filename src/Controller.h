@@ -21,8 +21,17 @@ class ControllerCallback {
     virtual void GotoLink(PageDestination* dest) = 0;
     // DisplayModel //
     virtual void Repaint() = 0;
-    virtual void UpdateScrollbars(Size canvas) = 0;
+    // like Repaint, for when only a part of the canvas has changed
+    // (may be called from any thread)
+    virtual void RepaintArea(Rect area) = 0;
+    // update the scrollbars to the DisplayModel's canvas size and view port
+    virtual void UpdateScrollbars() = 0;
     virtual void RequestRendering(int pageNo) = 0;
+    // like RequestRendering for a page that isn't visible yet, <distance> pages
+    // away from the visible ones (the request might be ignored)
+    virtual void PrefetchRendering(int pageNo, int distance) = 0;
+    // remove a not yet started rendering request from the queue
+    virtual void CancelRendering(int pageNo) = 0;
     virtual void CleanUp(DisplayModel* dm) = 0;
     virtual void RenderThumbnail(DisplayModel* dm, Size size, const onBitmapRenderedCb&) = 0;
     // ChmModel //
@@ -34,6 +43,7 @@ class ControllerCallback {
     virtual void SaveDownload(const WCHAR* url, std::string_view data) = 0;
     // EbookController //
     virtual void HandleLayoutedPages(EbookController* ctrl, EbookFormattingData* data) = 0;
+    // also used by DisplayModel for picking up page sizes determined in the background
     virtual void RequestDelayedLayout(int delay) = 0;
 };
 
@@ -45,6 +45,8 @@ static bool gDisableSymbolsDownload = true;
 static bool gDisableSymbolsDownload = false;
 #endif
 
+#define SYMBOLS_DIR_PREFIX L"symbols-"
+
 #define DLURLBASE L"https://kjkpubsf.sfo2.digitaloceanspaces.com/software/sumatrapdf/"
 
 // Get url for file with symbols. Caller needs to free().
@@ -66,6 +68,29 @@ static WCHAR* BuildSymbolsUrl() {
     return str::Format(L"%s%s.pdb.lzsa", urlBase, is64);
 }
 
+// symbols only match the build they were created for, so they're cached
+// in a directory named after the build (e.g. "symbols-SumatraPDF-3.2-64").
+// Caller needs to free().
+static WCHAR* BuildSymbolsDirName() {
+    AutoFreeWstr url = BuildSymbolsUrl();
+    AutoFreeWstr name = str::Dup(path::GetBaseNameNoFree(url));
+    WCHAR* ext = (WCHAR*)str::FindI(name, L".pdb.lzsa");
+    if (ext) {
+        *ext = 0;
+    }
+    return str::Join(SYMBOLS_DIR_PREFIX, name);
+}
+
+// set SUMATRAPDF_NO_SYMBOLS_DOWNLOAD environment variable to never download
+// symbols when crashing (e.g. on machines without internet access or to save
+// bandwidth). Symbols that are already cached are still used, otherwise the
+// callstacks only have module-relative addresses (section:offset) which
+// are symbolized on the server from the uploaded report
+static bool IsSymbolsDownloadDisabled() {
+    DWORD n = GetEnvironmentVariableA("SUMATRAPDF_NO_SYMBOLS_DOWNLOAD", nullptr, 0);
+    return n != 0;
+}
+
 /* Note: we cannot use standard malloc()/free()/new()/delete() in crash handler.
 For multi-thread safety, there is a per-heap lock taken by HeapAlloc() etc.
 It's possible that a crash originates from  inside such functions after a lock
@@ -85,6 +110,9 @@ static HeapAllocator* gCrashHandlerAllocator = nullptr;
 static WCHAR* gSymbolsUrl = nullptr;
 static WCHAR* gCrashDumpPath = nullptr;
 static WCHAR* gSymbolPathW = nullptr;
+// directory in which symbols for all builds are cached
+static WCHAR* gSymbolsBaseDir = nullptr;
+// directory with symbols for this build
 static WCHAR* gSymbolsDir = nullptr;
 static WCHAR* gLibMupdfPdbPath = nullptr;
 static WCHAR* gSumatraPdfDllPdbPath = nullptr;
@@ -101,11 +129,14 @@ WCHAR* gCrashFilePath = nullptr;
 static MINIDUMP_EXCEPTION_INFORMATION gMei = {0};
 static LPTOP_LEVEL_EXCEPTION_FILTER gPrevExceptionFilter = nullptr;
 
-static char* BuildCrashInfoText(size_t* sizeOut) {
+static char* BuildCrashInfoText(bool hasSymbols, size_t* sizeOut) {
     str::Str s(16 * 1024, gCrashHandlerAllocator);
     if (gSystemInfo) {
         s.Append(gSystemInfo);
     }
+    if (!hasSymbols) {
+        s.Append("Symbols: not available (symbolize on the server)\n");
+    }
 
     GetStressTestInfo(&s);
     s.Append("\n");
@@ -149,11 +180,34 @@ static void SendCrashInfo(char* s, size_t size) {
     HttpPost(CRASH_SUBMIT_SERVER, CRASH_SUBMIT_PORT, CRASH_SUBMIT_URL, &headers, &data);
 }
 
-// We might have symbol files for older builds. If we're here, then we
-// didn't get the symbols so we assume it's because symbols didn't match
-// Returns false if files were there but we couldn't delete them
+// removes symbols cached for other builds (and symbols stored directly
+// in gSymbolsBaseDir, where they used to be stored before being cached per build)
+static void DeleteSymbolsOfOtherBuilds() {
+    AutoFreeWstr pattern = path::Join(gSymbolsBaseDir, L"*");
+    WIN32_FIND_DATAW fdata;
+    HANDLE hfind = FindFirstFileW(pattern, &fdata);
+    if (INVALID_HANDLE_VALUE == hfind) {
+        return;
+    }
+    const WCHAR* thisBuild = path::GetBaseNameNoFree(gSymbolsDir);
+    do {
+        const WCHAR* name = fdata.cFileName;
+        bool isDir = (fdata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+        AutoFreeWstr path = path::Join(gSymbolsBaseDir, name);
+        if (isDir && str::StartsWithI(name, SYMBOLS_DIR_PREFIX) && !str::EqI(name, thisBuild)) {
+            bool ok = dir::RemoveAll(path);
+            dbglogf(L"DeleteSymbolsOfOtherBuilds: deleted '%s' (%d)\n", path.Get(), (int)ok);
+        } else if (!isDir && str::EndsWithI(name, L".pdb")) {
+            bool ok = file::Delete(path);
+            dbglogf(L"DeleteSymbolsOfOtherBuilds: deleted '%s' (%d)\n", path.Get(), (int)ok);
+        }
+    } while (FindNextFileW(hfind, &fdata));
+    FindClose(hfind);
+}
+
+// If we're here, then we have symbol files for this build but they didn't
+// work, so we assume they're corrupted and download them again
 static void DeleteSymbolsIfExist() {
-    // TODO: remove all files in symDir (symbols, previous crash files
     bool ok = file::Delete(gLibMupdfPdbPath);
     dbglogf(L"DeleteSymbolsIfExist: deleted '%s' (%d)\n", gLibMupdfPdbPath, (int)ok);
     ok = file::Delete(gSumatraPdfPdbPath);
@@ -210,6 +264,7 @@ static bool DownloadAndUnzipSymbols(const WCHAR* symDir) {
     }
 
     DeleteSymbolsIfExist();
+    DeleteSymbolsOfOtherBuilds();
 
     if (gDisableSymbolsDownload) {
         // don't care about debug builds because we don't release them
@@ -236,19 +291,23 @@ static bool DownloadAndUnzipSymbols(const WCHAR* symDir) {
     return ok;
 }
 
-bool CrashHandlerDownloadSymbols() {
-    dbglog("CrashHandlerDownloadSymbols()\n");
-    if (!dir::Create(gSymbolsDir)) {
-        dbglog("CrashHandlerDownloadSymbols: couldn't create symbols dir\n");
+// uses symbols from the cache, if we already have them for this build
+static bool LoadCachedSymbols() {
+    if (!dbghelp::Initialize(gSymbolPathW, false)) {
+        dbglog("LoadCachedSymbols: dbghelp::Initialize() failed\n");
         return false;
     }
+    return dbghelp::HasSymbols();
+}
 
-    if (!dbghelp::Initialize(gSymbolPathW, false)) {
-        dbglog("CrashHandlerDownloadSymbols: dbghelp::Initialize() failed\n");
+bool CrashHandlerDownloadSymbols() {
+    dbglog("CrashHandlerDownloadSymbols()\n");
+    if (!dir::CreateAll(gSymbolsDir)) {
+        dbglog("CrashHandlerDownloadSymbols: couldn't create symbols dir\n");
         return false;
     }
 
-    if (dbghelp::HasSymbols()) {
+    if (LoadCachedSymbols()) {
         dbglog("CrashHandlerDownloadSymbols(): skipping because dbghelp::HasSymbols()\n");
         return true;
     }
@@ -284,11 +343,17 @@ void SubmitCrashInfo() {
 
     dbglogf(L"SubmitCrashInfo: gSymbolPathW: '%s'\n", gSymbolPathW);
 
-    bool ok = CrashHandlerDownloadSymbols();
+    bool hasSymbols = false;
+    if (IsSymbolsDownloadDisabled()) {
+        dbglog("SubmitCrashInfo: symbols download disabled\n");
+        hasSymbols = LoadCachedSymbols();
+    } else {
+        hasSymbols = CrashHandlerDownloadSymbols();
+    }
 
     char* s = nullptr;
     size_t size = 0;
-    s = BuildCrashInfoText(&size);
+    s = BuildCrashInfoText(hasSymbols, &size);
     if (!s) {
         dbglog("SubmitCrashInfo(): skipping because !BuildCrashInfoText()\n");
         return;
@@ -611,15 +676,18 @@ bool SetSymbolsDir(const WCHAR* symDir) {
         return false;
     }
 
+    free(gSymbolsBaseDir);
     free(gSymbolsDir);
     free(gLibMupdfPdbPath);
     free(gSumatraPdfDllPdbPath);
     free(gSumatraPdfPdbPath);
 
-    gSymbolsDir = str::Dup(symDir);
-    gSumatraPdfPdbPath = path::Join(symDir, L"SumatraPDF.pdb");
-    gSumatraPdfDllPdbPath = path::Join(symDir, L"SumatraPDF-dll.pdb");
-    gLibMupdfPdbPath = path::Join(symDir, L"libmupdf.pdb");
+    gSymbolsBaseDir = str::Dup(symDir);
+    AutoFreeWstr dirName = BuildSymbolsDirName();
+    gSymbolsDir = path::Join(symDir, dirName);
+    gSumatraPdfPdbPath = path::Join(gSymbolsDir, L"SumatraPDF.pdb");
+    gSumatraPdfDllPdbPath = path::Join(gSymbolsDir, L"SumatraPDF-dll.pdb");
+    gLibMupdfPdbPath = path::Join(gSymbolsDir, L"libmupdf.pdb");
     BuildSymbolPath();
     return true;
 }
@@ -728,6 +796,7 @@ void UninstallCrashHandler() {
 
     free(gCrashDumpPath);
     free(gSymbolsUrl);
+    free(gSymbolsBaseDir);
     free(gSymbolsDir);
     free(gLibMupdfPdbPath);
     free(gSumatraPdfPdbPath);
@@ -46,6 +46,7 @@
 #include "utils/BaseUtil.h"
 #include "utils/WinUtil.h"
 #include "utils/ScopedWin.h"
+#include "utils/Timer.h"
 #include "utils/Log.h"
 
 #include "wingui/TreeModel.h"
@@ -62,9 +63,24 @@
 #include "ProgressUpdateUI.h"
 #include "TextSelection.h"
 #include "TextSearch.h"
+#include "TextIndex.h"
 
 // if true, we pre-render the pages right before and after the visible pages
 static bool gPredictiveRender = true;
+// when repeatedly scrolling in the same direction, we additionally pre-render
+// up to this many rows of pages ahead (the faster the scrolling, the more)
+#define MAX_PREFETCH_ROWS 4
+// scroll moves more than this many ms apart don't count as a streak
+#define SCROLL_STREAK_TIMEOUT_MS 1000
+// during presentations, this many pages after resp. before the current one
+// are kept rendered, so that flipping to them doesn't have to wait
+#define PRESENTATION_PAGES_AHEAD 2
+#define PRESENTATION_PAGES_BEHIND 1
+// how often to check for page sizes determined in the background
+#define PAGE_SIZES_UPDATE_DELAY_MS 500
+// the vertical scrollbar range is limited to this (canvas coordinates are
+// 64-bit but scrollbar positions are ints)
+#define MAX_SCROLLBAR_DY (INT_MAX / 2)
 
 static int ColumnsFromDisplayMode(DisplayMode displayMode) {
     if (!IsSingle(displayMode))
@@ -114,9 +130,15 @@ SizeD DisplayModel::PageSizeAfterRotation(int pageNo, bool fitToContent) const {
         if (pageInfo->contentBox.IsEmpty())
             return PageSizeAfterRotation(pageNo);
     }
+    if (fitToContent) {
+        return engine->Transform(pageInfo->contentBox, pageNo, 1.0, rotation).Size();
+    }
 
-    RectD box = fitToContent ? pageInfo->contentBox : pageInfo->page;
-    return engine->Transform(box, pageNo, 1.0, rotation).Size();
+    if (pageInfo->rotatedSize.IsEmpty() || pageInfo->sizeRotation != rotation) {
+        pageInfo->rotatedSize = engine->Transform(pageInfo->page, pageNo, 1.0, rotation).Size();
+        pageInfo->sizeRotation = rotation;
+    }
+    return pageInfo->rotatedSize;
 }
 
 /* given 'columns' and an absolute 'pageNo', return the number of the first
@@ -152,6 +174,8 @@ DisplayModel::DisplayModel(EngineBase* engine, ControllerCallback* cb) : Control
     this->engine = engine;
     CrashIf(!engine || engine->PageCount() <= 0);
     engineType = engine->kind;
+    // the text cache must know about at least as many pages as we do
+    pageCount = engine->PageCount();
 
     if (!engine->IsImageCollection()) {
         windowMargin = gGlobalPrefs->fixedPageUI.windowMargin;
@@ -170,12 +194,21 @@ DisplayModel::DisplayModel(EngineBase* engine, ControllerCallback* cb) : Control
 #endif
 
     textCache = new DocumentTextCache(engine);
+    textCache->maxSize = (size_t)std::max(gGlobalPrefs->textCacheSizeMB, 0) * 1024 * 1024;
     textSelection = new TextSelection(engine, textCache);
     textSearch = new TextSearch(engine, textCache);
+    if (gGlobalPrefs->indexTextInBackground && pageCount >= TEXT_INDEX_MIN_PAGES) {
+        textIndex = new TextIndex(engine, textCache);
+        textSearch->SetTextIndex(textIndex);
+    }
 }
 
 DisplayModel::~DisplayModel() {
     dontRenderFlag = true;
+    // stops indexing first, as CleanUp saves the text
+    // (which releases the text loaded when opening)
+    textSearch->SetTextIndex(nullptr);
+    delete textIndex;
     cb->CleanUp(this);
 
     delete pdfSync;
@@ -195,7 +228,28 @@ PageInfo* DisplayModel::GetPageInfo(int pageNo) const {
     if (!pagesInfo) {
         return nullptr;
     }
-    return &(pagesInfo[pageNo - 1]);
+    PageInfo* pageInfo = &(pagesInfo[pageNo - 1]);
+    // RecalcVisibleParts only updates pageOnScreen for the visible pages
+    if (pageInfo->pageOnScreenGen != pageOnScreenGen) {
+        pageInfo->pageOnScreen = pageInfo->pos.RelativeTo(pageOnScreenOriginX, pageOnScreenOriginY);
+        pageInfo->pageOnScreenGen = pageOnScreenGen;
+    }
+    return pageInfo;
+}
+
+// returns the index of the first row which ends below y (or pageRows.size())
+int DisplayModel::FindPageRow(i64 y) const {
+    int lo = 0;
+    int hi = pageRows.isize();
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (pageRows.at(mid).bottom <= y) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
 }
 
 // Call this before the first Relayout
@@ -235,18 +289,20 @@ void DisplayModel::SetInitialViewSettings(DisplayMode newDisplayMode, int newSta
     BuildPagesInfo();
 }
 
+// size used for pages with an empty mediabox (A4 resp. letter size)
+static RectD DefaultPageRect(EngineBase* engine) {
+    float fileDPI = engine->GetFileDPI();
+    if (0 == GetMeasurementSystem()) {
+        return RectD(0, 0, 21.0 / 2.54 * fileDPI, 29.7 / 2.54 * fileDPI);
+    }
+    return RectD(0, 0, 8.5 * fileDPI, 11 * fileDPI);
+}
+
 void DisplayModel::BuildPagesInfo() {
     CrashIf(pagesInfo);
-    int pageCount = PageCount();
     pagesInfo = AllocArray<PageInfo>(pageCount);
 
-    RectD defaultRect;
-    float fileDPI = engine->GetFileDPI();
-    if (0 == GetMeasurementSystem()) {
-        defaultRect = RectD(0, 0, 21.0 / 2.54 * fileDPI, 29.7 / 2.54 * fileDPI);
-    } else {
-        defaultRect = RectD(0, 0, 8.5 * fileDPI, 11 * fileDPI);
-    }
+    RectD defaultRect = DefaultPageRect(engine);
 
     int columns = ColumnsFromDisplayMode(displayMode);
     int newStartPage = startPage;
@@ -254,10 +310,11 @@ void DisplayModel::BuildPagesInfo() {
         newStartPage--;
     }
 
+    // read before the sizes, so that these are final for all these pages
+    finalPageSizes = engine->FinalPageSizesCount();
     for (int pageNo = 1; pageNo <= pageCount; pageNo++) {
         PageInfo* pageInfo = GetPageInfo(pageNo);
         pageInfo->page = engine->PageMediabox(pageNo);
-        // layout pages with an empty mediabox as A4 size (resp. letter size)
         if (pageInfo->page.IsEmpty()) {
             pageInfo->page = defaultRect;
         }
@@ -269,6 +326,75 @@ void DisplayModel::BuildPagesInfo() {
             pageInfo->shown = true;
         }
     }
+
+    pageSizesPending = engine->HasPendingPageSizes();
+    if (pageSizesPending) {
+        cb->RequestDelayedLayout(PAGE_SIZES_UPDATE_DELAY_MS);
+    }
+}
+
+// picks up the page sizes the engine has determined since the last call
+// and relayouts the pages if needed (called periodically while
+// EngineBase::HasPendingPageSizes)
+void DisplayModel::UpdatePageSizes() {
+    if (!pageSizesPending) {
+        return;
+    }
+    // check before reading the sizes so that no update is missed
+    pageSizesPending = engine->HasPendingPageSizes();
+    int newFinalPageSizes = engine->FinalPageSizesCount();
+
+    // the layout only has to be updated from the first changed page on
+    int firstChangedPageNo = 0;
+    int newPageCount = engine->PageCount();
+    if (newPageCount > pageCount) {
+        PageInfo* newPagesInfo = (PageInfo*)realloc(pagesInfo, newPageCount * sizeof(PageInfo));
+        if (newPagesInfo) {
+            pagesInfo = newPagesInfo;
+            RectD defaultRect = DefaultPageRect(engine);
+            for (int pageNo = pageCount + 1; pageNo <= newPageCount; pageNo++) {
+                PageInfo* pageInfo = &pagesInfo[pageNo - 1];
+                *pageInfo = PageInfo();
+                pageInfo->page = engine->PageMediabox(pageNo);
+                if (pageInfo->page.IsEmpty()) {
+                    pageInfo->page = defaultRect;
+                }
+                pageInfo->shown = IsContinuous(displayMode);
+            }
+            textCache->SetPageCount(newPageCount);
+            firstChangedPageNo = pageCount + 1;
+            pageCount = newPageCount;
+        }
+    }
+    for (int pageNo = finalPageSizes + 1; pageNo <= PageCount(); pageNo++) {
+        PageInfo* pageInfo = GetPageInfo(pageNo);
+        RectD page = engine->PageMediabox(pageNo);
+        if (!page.IsEmpty() && page != pageInfo->page) {
+            pageInfo->page = page;
+            pageInfo->rotatedSize = SizeD();
+            if (!firstChangedPageNo || pageNo < firstChangedPageNo) {
+                firstChangedPageNo = pageNo;
+            }
+        }
+    }
+    finalPageSizes = std::min(newFinalPageSizes, PageCount());
+
+    if (firstChangedPageNo && zoomVirtual != INVALID_ZOOM) {
+        // keep the same part of the current page in view
+        ScrollState ss = GetScrollState();
+        Relayout(zoomVirtual, rotation, firstChangedPageNo);
+        if (ValidPageNo(pendingScrollState.page)) {
+            ss = pendingScrollState;
+        }
+        SetScrollState(ss);
+    }
+    if (ValidPageNo(pendingScrollState.page) || !pageSizesPending) {
+        pendingScrollState = ScrollState();
+    }
+
+    if (pageSizesPending) {
+        cb->RequestDelayedLayout(PAGE_SIZES_UPDATE_DELAY_MS);
+    }
 }
 
 // TODO: a better name e.g. ShouldShow() to better distinguish between
@@ -303,6 +429,25 @@ bool DisplayModel::PageVisibleNearby(int pageNo) const {
     return false;
 }
 
+/* Return true if a page has been requested for prefetching because
+   it's likely to be scrolled into view soon */
+bool DisplayModel::PagePrefetched(int pageNo) const {
+    if (PageKeptForPresentation(pageNo)) {
+        return true;
+    }
+    return prefetchFirst <= pageNo && pageNo <= prefetchLast && prefetchFirst > 0;
+}
+
+/* Return true if a page is one of the pages around the current one
+   which are kept rendered during presentations */
+bool DisplayModel::PageKeptForPresentation(int pageNo) const {
+    if (!presentationMode || !ValidPageNo(pageNo)) {
+        return false;
+    }
+    int currPageNo = CurrentPageNo();
+    return currPageNo - PRESENTATION_PAGES_BEHIND <= pageNo && pageNo <= currPageNo + PRESENTATION_PAGES_AHEAD;
+}
+
 /* Return true if the first page is fully visible and alone on a line in
    show cover mode (i.e. it's not possible to flip to a previous page) */
 bool DisplayModel::FirstBookPageVisible() const {
@@ -389,14 +534,18 @@ int DisplayModel::FirstVisiblePageNo() const {
     if (!pagesInfo)
         return INVALID_PAGE_NO;
 
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
-        PageInfo* pageInfo = GetPageInfo(pageNo);
-        if (pageInfo->visibleRatio > 0.0)
-            return pageNo;
+    if (0 == visibleFirst) {
+        /* If no pages are visible */
+        return INVALID_PAGE_NO;
     }
+    return visibleFirst;
+}
 
-    /* If no pages are visible */
-    return INVALID_PAGE_NO;
+int DisplayModel::LastVisiblePageNo() const {
+    if (0 == visibleLast) {
+        return INVALID_PAGE_NO;
+    }
+    return visibleLast;
 }
 
 // we consider the most visible page the current one
@@ -413,7 +562,7 @@ int DisplayModel::CurrentPageNo() const {
     int mostVisiblePage = INVALID_PAGE_NO;
     float ratio = 0;
 
-    for (int pageNo = 1; pageNo <= PageCount(); pageNo++) {
+    for (int pageNo = visibleFirst; pageNo > 0 && pageNo <= visibleLast; pageNo++) {
         PageInfo* pageInfo = GetPageInfo(pageNo);
         if (pageInfo->visibleRatio > ratio) {
             mostVisiblePage = pageNo;
@@ -501,120 +650,166 @@ float DisplayModel::GetZoomReal(int pageNo) const {
      * zoom changes
      * rotation changes
      * switching between display modes
-     * navigating to another page in non-continuous mode */
-void DisplayModel::Relayout(float newZoomVirtual, int newRotation) {
+     * navigating to another page in non-continuous mode
+   If only the sizes of pages from firstChangedPageNo on have changed (e.g.
+   because they've been determined in the background), the rows above them
+   are kept as they are, whenever the size of a page depends neither on
+   the view port nor on the other pages (continuous layout at a fixed zoom) */
+void DisplayModel::Relayout(float newZoomVirtual, int newRotation, int firstChangedPageNo) {
     CrashIf(!pagesInfo);
     if (!pagesInfo) {
         return;
     }
 
-    rotation = NormalizeRotation(newRotation);
+    newRotation = NormalizeRotation(newRotation);
+    int columns = ColumnsFromDisplayMode(GetDisplayMode());
+    float currZoomReal = zoomReal;
+    // fit zoom levels depend on the view port size (and thus on the scrollbars)
+    bool isFitZoom = ZOOM_FIT_WIDTH == newZoomVirtual || ZOOM_FIT_PAGE == newZoomVirtual ||
+                     ZOOM_FIT_CONTENT == newZoomVirtual;
+
+    int keptRows = 0;
+    bool canKeepRows = firstChangedPageNo > 1 && IsContinuous(GetDisplayMode()) && !isFitZoom &&
+                       newZoomVirtual == zoomVirtual && newRotation == rotation && INVALID_ZOOM != zoomReal &&
+                       pageRows.size() > 0 && pageRows.at(0).y == windowMargin.top;
+    if (canKeepRows) {
+        keptRows = pageRows.isize();
+        while (keptRows > 0 && pageRows.at(keptRows - 1).lastPageNo >= firstChangedPageNo) {
+            keptRows--;
+        }
+        // the last row might be a partial one which new pages are added to
+        if (keptRows == pageRows.isize()) {
+            keptRows--;
+        }
+    }
+    int prevCanvasDx = canvasSize.dx;
+    int prevViewPortDx = viewPort.dx;
+    int prevColumnMaxDx[2] = {0, 0};
+    if (pageRows.size() > 0) {
+        prevColumnMaxDx[0] = pageRows.Last().columnMaxDx[0];
+        prevColumnMaxDx[1] = pageRows.Last().columnMaxDx[1];
+    }
+    int firstPageNo = keptRows > 0 ? pageRows.at(keptRows - 1).lastPageNo + 1 : 1;
+
+    rotation = newRotation;
+    if (keptRows > 0) {
+        for (int pageNo = firstPageNo; pageNo <= PageCount(); pageNo++) {
+            GetPageInfo(pageNo)->zoomReal = zoomReal;
+        }
+    }
 
     bool needHScroll = false;
     bool needVScroll = false;
-    viewPort = Rect(viewPort.TL(), totalViewPortSize);
+    viewPort.dx = totalViewPortSize.dx;
+    viewPort.dy = totalViewPortSize.dy;
+
+    /* calculate the size of each page and the position of each row on the
+       canvas, given current zoom, rotation, columns parameters. You can think
+       of it as a simple table layout i.e. rows with a fixed number of columns.
+       The rows' y and bottom are the cumulative heights of the rows above */
+    i64 canvasDy = 0;
+    int canvasDx = 0;
+    int columnMaxWidth[2] = {0, 0};
+    bool sizesValid = false;
+    for (;;) {
+        if (!sizesValid) {
+            if (0 == keptRows) {
+                CalcZoomReal(newZoomVirtual);
+            }
+            i64 currPosY = windowMargin.top;
+            columnMaxWidth[0] = columnMaxWidth[1] = 0;
+            if (keptRows > 0) {
+                PageRow& lastRow = pageRows.at(keptRows - 1);
+                currPosY = lastRow.bottom + pageSpacing.dy;
+                columnMaxWidth[0] = lastRow.columnMaxDx[0];
+                columnMaxWidth[1] = lastRow.columnMaxDx[1];
+            }
+            pageRows.RemoveAt(keptRows, pageRows.size() - keptRows);
 
-RestartLayout:
-    int currPosY = windowMargin.top;
-    float currZoomReal = zoomReal;
-    CalcZoomReal(newZoomVirtual);
+            PageRow* row = nullptr;
+            int pageInARow = 0;
+            for (int pageNo = firstPageNo; pageNo <= PageCount(); ++pageNo) {
+                PageInfo* pageInfo = GetPageInfo(pageNo);
+                if (!pageInfo->shown) {
+                    CrashIf(0.0 != pageInfo->visibleRatio);
+                    continue;
+                }
+                SizeD pageSize = PageSizeAfterRotation(pageNo);
+                CanvasRect& pos = pageInfo->pos;
+                // don't add the full 0.5 for rounding to account for precision errors
+                float zoom = GetZoomReal(pageNo);
+                pos.dx = (int)(pageSize.dx * zoom + 0.499);
+                pos.dy = (int)(pageSize.dy * zoom + 0.499);
+                pos.y = currPosY;
+
+                if (IsBookView(GetDisplayMode()) && pageNo == 1 && columns - pageInARow > 1) {
+                    pageInARow++;
+                }
+                CrashIf(pageInARow >= dimof(columnMaxWidth));
+                if (columnMaxWidth[pageInARow] < pos.dx) {
+                    columnMaxWidth[pageInARow] = pos.dx;
+                }
 
-    int newViewPortOffsetX = 0;
-    if (0 != currZoomReal && INVALID_ZOOM != currZoomReal) {
-        newViewPortOffsetX = (int)(viewPort.x * zoomReal / currZoomReal);
-    }
-    viewPort.x = newViewPortOffsetX;
-    /* calculate the position of each page on the canvas, given current zoom,
-       rotation, columns parameters. You can think of it as a simple
-       table layout i.e. rows with a fixed number of columns. */
-    int columns = ColumnsFromDisplayMode(GetDisplayMode());
-    int columnMaxWidth[2] = {0, 0};
-    int pageInARow = 0;
-    int rowMaxPageDy = 0;
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
-        PageInfo* pageInfo = GetPageInfo(pageNo);
-        if (!pageInfo->shown) {
-            CrashIf(0.0 != pageInfo->visibleRatio);
-            continue;
-        }
-        SizeD pageSize = PageSizeAfterRotation(pageNo);
-        Rect pos;
-        // don't add the full 0.5 for rounding to account for precision errors
-        float zoom = GetZoomReal(pageNo);
-        pos.dx = (int)(pageSize.dx * zoom + 0.499);
-        pos.dy = (int)(pageSize.dy * zoom + 0.499);
-
-        if (rowMaxPageDy < pos.dy) {
-            rowMaxPageDy = pos.dy;
+                if (!row) {
+                    pageRows.Append({pageNo, pageNo, pos.y, pos.Bottom()});
+                    row = &pageRows.Last();
+                } else {
+                    row->lastPageNo = pageNo;
+                    row->bottom = std::max(row->bottom, pos.Bottom());
+                }
+                row->columnMaxDx[0] = columnMaxWidth[0];
+                row->columnMaxDx[1] = columnMaxWidth[1];
+
+                pageInARow++;
+                AssertCrash(pageInARow <= columns);
+                if (pageInARow == columns) {
+                    /* starting next row */
+                    currPosY = row->bottom + pageSpacing.dy;
+                    row = nullptr;
+                    pageInARow = 0;
+                }
+            }
+            if (row) {
+                /* this is a partial row */
+                currPosY = row->bottom + pageSpacing.dy;
+            }
+            canvasDy = currPosY + windowMargin.bottom - pageSpacing.dy;
+
+            if (columns == 2 && PageCount() == 1) {
+                /* don't center a single page over two columns */
+                if (IsBookView(GetDisplayMode())) {
+                    columnMaxWidth[0] = columnMaxWidth[1];
+                } else {
+                    columnMaxWidth[1] = columnMaxWidth[0];
+                }
+            }
+            canvasDx = windowMargin.left + columnMaxWidth[0] +
+                       (columns == 2 ? pageSpacing.dx + columnMaxWidth[1] : 0) + windowMargin.right;
+            sizesValid = true;
         }
-        pos.y = currPosY;
 
-        // restart the layout if we detect we need to show scrollbars
-        if (!needVScroll && viewPort.dy < currPosY + rowMaxPageDy) {
+        // predict the scrollbars from the canvas size instead of restarting the
+        // layout (only fit zoom levels require to recalculate the page sizes
+        // after showing a scrollbar, as the pages get smaller)
+        if (!needVScroll && canvasDy > viewPort.dy) {
             needVScroll = true;
             viewPort.dx -= GetSystemMetrics(SM_CXVSCROLL);
-            goto RestartLayout;
-        }
-
-        if (IsBookView(GetDisplayMode()) && pageNo == 1 && columns - pageInARow > 1) {
-            pageInARow++;
-        }
-        CrashIf(pageInARow >= dimof(columnMaxWidth));
-        if (columnMaxWidth[pageInARow] < pos.dx) {
-            columnMaxWidth[pageInARow] = pos.dx;
-        }
-
-        if (!needHScroll && viewPort.dx < windowMargin.left + columnMaxWidth[0] +
-                                              (columns == 2 ? pageSpacing.dx + columnMaxWidth[1] : 0) +
-                                              windowMargin.right) {
+        } else if (!needHScroll && canvasDx > viewPort.dx) {
             needHScroll = true;
             viewPort.dy -= GetSystemMetrics(SM_CYHSCROLL);
-            goto RestartLayout;
-        }
-
-        pageInfo->pos = pos;
-
-        pageInARow++;
-        AssertCrash(pageInARow <= columns);
-        if (pageInARow == columns) {
-            /* starting next row */
-            currPosY += rowMaxPageDy + pageSpacing.dy;
-            rowMaxPageDy = 0;
-            pageInARow = 0;
-        }
-    }
-
-    if (pageInARow != 0) {
-        /* this is a partial row */
-        currPosY += rowMaxPageDy + pageSpacing.dy;
-    }
-    // restart the layout if we detect we need to show scrollbars
-    // (there are some edge cases we can't catch in the above loop)
-    const int canvasDy = currPosY + windowMargin.bottom - pageSpacing.dy;
-    if (!needVScroll && canvasDy > viewPort.dy) {
-        needVScroll = true;
-        viewPort.dx -= GetSystemMetrics(SM_CXVSCROLL);
-        goto RestartLayout;
-    }
-
-    if (columns == 2 && PageCount() == 1) {
-        /* don't center a single page over two columns */
-        if (IsBookView(GetDisplayMode())) {
-            columnMaxWidth[0] = columnMaxWidth[1];
         } else {
-            columnMaxWidth[1] = columnMaxWidth[0];
+            break;
+        }
+        if (isFitZoom) {
+            sizesValid = false;
         }
     }
 
-    // restart the layout if we detect we need to show scrollbars
-    // (there are some edge cases we can't catch in the above loop)
-    int canvasDx = windowMargin.left + columnMaxWidth[0] + (columns == 2 ? pageSpacing.dx + columnMaxWidth[1] : 0) +
-                   windowMargin.right;
-    if (!needHScroll && canvasDx > viewPort.dx) {
-        needHScroll = true;
-        viewPort.dy -= GetSystemMetrics(SM_CYHSCROLL);
-        goto RestartLayout;
+    int newViewPortOffsetX = 0;
+    if (0 != currZoomReal && INVALID_ZOOM != currZoomReal) {
+        newViewPortOffsetX = (int)(viewPort.x * zoomReal / currZoomReal);
     }
+    viewPort.x = newViewPortOffsetX;
 
     /* since pages can be smaller than the drawing area, center them in x axis */
     int offX = 0;
@@ -624,10 +819,17 @@ RestartLayout:
         canvasDx = viewPort.dx;
     }
 
+    // the x positions of the kept rows only change along with the column widths
+    int firstPageNoX = 1;
+    if (keptRows > 0 && canvasDx == prevCanvasDx && viewPort.dx == prevViewPortDx &&
+        columnMaxWidth[0] == prevColumnMaxDx[0] && columnMaxWidth[1] == prevColumnMaxDx[1]) {
+        firstPageNoX = firstPageNo;
+    }
+
     CrashIf(offX < 0);
-    pageInARow = 0;
+    int pageInARow = 0;
     int pageOffX = offX + windowMargin.left;
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
+    for (int pageNo = firstPageNoX; pageNo <= PageCount(); ++pageNo) {
         PageInfo* pageInfo = GetPageInfo(pageNo);
         if (!pageInfo->shown) {
             CrashIf(0.0 != pageInfo->visibleRatio);
@@ -676,7 +878,7 @@ RestartLayout:
 
     /* if a page is smaller than drawing area in y axis, y-center the page */
     if (canvasDy < viewPort.dy) {
-        int offY = windowMargin.top + (viewPort.dy - canvasDy) / 2;
+        int offY = windowMargin.top + (int)(viewPort.dy - canvasDy) / 2;
         CrashIf(offY < 0.0);
         for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
             PageInfo* pageInfo = GetPageInfo(pageNo);
@@ -686,9 +888,14 @@ RestartLayout:
             }
             pageInfo->pos.y += offY;
         }
+        for (PageRow& row : pageRows) {
+            row.y += offY;
+            row.bottom += offY;
+        }
     }
 
-    canvasSize = Size(std::max(canvasDx, viewPort.dx), std::max(canvasDy, viewPort.dy));
+    canvasSize.dx = std::max(canvasDx, viewPort.dx);
+    canvasSize.dy = std::max(canvasDy, (i64)viewPort.dy);
 }
 
 void DisplayModel::ChangeStartPage(int newStartPage) {
@@ -712,6 +919,7 @@ void DisplayModel::ChangeStartPage(int newStartPage) {
         }
         pageInfo->visibleRatio = 0.0;
     }
+    visibleFirst = visibleLast = 0;
     Relayout(zoomVirtual, rotation);
 }
 
@@ -725,24 +933,38 @@ void DisplayModel::RecalcVisibleParts() {
         return;
     }
 
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
-        PageInfo* pageInfo = GetPageInfo(pageNo);
-        if (!pageInfo->shown) {
-            CrashIf(0.0 != pageInfo->visibleRatio);
-            continue;
-        }
-
-        Rect pageRect = pageInfo->pos;
-        Rect visiblePart = pageRect.Intersect(viewPort);
+    // only the previously and the currently visible pages have to be updated
+    for (int pageNo = visibleFirst; pageNo > 0 && pageNo <= visibleLast; ++pageNo) {
+        GetPageInfo(pageNo)->visibleRatio = 0.0;
+    }
+    visibleFirst = visibleLast = 0;
+    // the render threads also call GetPageInfo, so update the origin first
+    pageOnScreenOriginX = viewPort.x;
+    pageOnScreenOriginY = viewPort.y;
+    pageOnScreenGen++;
 
-        pageInfo->visibleRatio = 0.0;
-        if (!visiblePart.IsEmpty()) {
+    for (int i = FindPageRow(viewPort.y); i < pageRows.isize(); i++) {
+        PageRow& row = pageRows.at(i);
+        if (row.y >= viewPort.Bottom()) {
+            break;
+        }
+        for (int pageNo = row.firstPageNo; pageNo <= row.lastPageNo; ++pageNo) {
+            // this also updates pageOnScreen
+            PageInfo* pageInfo = GetPageInfo(pageNo);
+            CrashIf(!pageInfo->shown);
+            Rect pageRect = pageInfo->pageOnScreen;
+            Rect visiblePart = pageRect.Intersect(Rect(Point(), viewPort.Size()));
+            if (visiblePart.IsEmpty()) {
+                continue;
+            }
             CrashIf(pageRect.dx <= 0 || pageRect.dy <= 0);
             // calculate with floating point precision to prevent an integer overflow
             pageInfo->visibleRatio = 1.0f * visiblePart.dx * visiblePart.dy / ((float)pageRect.dx * pageRect.dy);
+            if (0 == visibleFirst) {
+                visibleFirst = pageNo;
+            }
+            visibleLast = pageNo;
         }
-        pageInfo->pageOnScreen = pageRect;
-        pageInfo->pageOnScreen.Offset(-viewPort.x, -viewPort.y);
     }
 }
 
@@ -752,13 +974,13 @@ int DisplayModel::GetPageNoByPoint(Point pt) {
         return -1;
     }
 
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
+    int i = FindPageRow(pt.y + pageOnScreenOriginY);
+    if (i >= pageRows.isize()) {
+        return -1;
+    }
+    PageRow& row = pageRows.at(i);
+    for (int pageNo = row.firstPageNo; pageNo <= row.lastPageNo; ++pageNo) {
         PageInfo* pageInfo = GetPageInfo(pageNo);
-        AssertCrash(0.0 == pageInfo->visibleRatio || pageInfo->shown);
-        if (!pageInfo->shown) {
-            continue;
-        }
-
         if (pageInfo->pageOnScreen.Contains(pt)) {
             return pageNo;
         }
@@ -890,31 +1112,43 @@ bool DisplayModel::IsOverText(Point pt) {
     return textSelection->IsOverGlyph(pageNo, pos.x, pos.y);
 }
 
-void DisplayModel::RenderVisibleParts() {
-    int firstVisiblePage = 0;
-    int lastVisiblePage = 0;
+void DisplayModel::DeferRendering(int durationMs) {
+    renderingDeferredSince = TimeGet();
+    renderingDeferredMs = durationMs;
+}
 
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
-        PageInfo* pageInfo = GetPageInfo(pageNo);
-        if (pageInfo->visibleRatio > 0.0) {
-            CrashIf(!pageInfo->shown);
-            if (0 == firstVisiblePage)
-                firstVisiblePage = pageNo;
-            lastVisiblePage = pageNo;
-        }
+void DisplayModel::StopDeferringRendering() {
+    if (renderingDeferredMs > 0) {
+        renderingDeferredMs = 0;
+        RenderVisibleParts();
     }
+}
+
+bool DisplayModel::IsRenderingDeferred() const {
+    return renderingDeferredMs > 0 && TimeSinceInMs(renderingDeferredSince) < renderingDeferredMs;
+}
+
+void DisplayModel::RenderVisibleParts() {
+    if (IsRenderingDeferred()) {
+        return;
+    }
+    int firstVisiblePage = visibleFirst;
+    int lastVisiblePage = visibleLast;
     // no page is visible if e.g. the window is resized
     // vertically until only the title bar remains visible
     if (0 == firstVisiblePage)
         return;
 
-    // rendering happens LIFO except if the queue is currently
-    // empty, so request the visible pages first and last to
-    // make sure they're rendered before the predicted pages
+    // the render queue renders visible pages before the predicted
+    // ones, no matter in which order they've been requested
     for (int pageNo = firstVisiblePage; pageNo <= lastVisiblePage; pageNo++) {
         cb->RequestRendering(pageNo);
     }
 
+    if (gPredictiveRender) {
+        PrefetchPages(firstVisiblePage, lastVisiblePage);
+    }
+
     if (gPredictiveRender) {
         // prerender two more pages in facing and book view modes
         // if the rendering queue still has place for them
@@ -932,13 +1166,62 @@ void DisplayModel::RenderVisibleParts() {
         if (lastVisiblePage < PageCount()) {
             cb->RequestRendering(lastVisiblePage + 1);
         }
+        // the pages are rendered at the exact zoom they'll be shown at
+        // (Fit Page in single page mode, cf. SetPresentationMode)
+        for (int pageNo = lastVisiblePage + 2; PageKeptForPresentation(pageNo); pageNo++) {
+            cb->RequestRendering(pageNo);
+        }
     }
+}
 
-    // request the visible pages last so that the above requested
-    // invisible pages are not rendered if the queue fills up
-    for (int pageNo = lastVisiblePage; pageNo >= firstVisiblePage; pageNo--) {
-        cb->RequestRendering(pageNo);
+// remember in which direction and how fast the user is scrolling
+void DisplayModel::TrackScrolling(int dir) {
+    bool isStreak = scrollStreak > 0 && TimeSinceInMs(lastScrollTime) < SCROLL_STREAK_TIMEOUT_MS;
+    if (dir != scrollDir) {
+        // pages prefetched for the other direction won't be needed
+        CancelPrefetching();
+        isStreak = false;
+    }
+    scrollDir = dir;
+    scrollStreak = isStreak ? scrollStreak + 1 : 1;
+    lastScrollTime = TimeGet();
+}
+
+// request rendering of the pages the user is scrolling towards
+// (they're rendered after the visible and directly adjacent pages)
+void DisplayModel::PrefetchPages(int firstVisiblePage, int lastVisiblePage) {
+    if (0 == scrollDir || scrollStreak < 2 || TimeSinceInMs(lastScrollTime) >= SCROLL_STREAK_TIMEOUT_MS) {
+        return;
+    }
+    int columns = ColumnsFromDisplayMode(GetDisplayMode());
+    int rows = std::min(scrollStreak / 2, MAX_PREFETCH_ROWS);
+    // directly adjacent pages are already requested in RenderVisibleParts
+    int first, last;
+    if (scrollDir > 0) {
+        first = lastVisiblePage + columns + 1;
+        last = std::min(lastVisiblePage + (rows + 1) * columns, PageCount());
+    } else {
+        first = std::max(firstVisiblePage - (rows + 1) * columns, 1);
+        last = firstVisiblePage - columns - 1;
+    }
+    if (first > last) {
+        return;
+    }
+    prefetchFirst = first;
+    prefetchLast = last;
+    for (int i = 0; i <= last - first; i++) {
+        int pageNo = scrollDir > 0 ? first + i : last - i;
+        cb->PrefetchRendering(pageNo, i + 1);
+    }
+}
+
+void DisplayModel::CancelPrefetching() {
+    for (int pageNo = prefetchFirst; pageNo > 0 && pageNo <= prefetchLast; pageNo++) {
+        if (!PageVisibleNearby(pageNo) && !PageKeptForPresentation(pageNo)) {
+            cb->CancelRendering(pageNo);
+        }
     }
+    prefetchFirst = prefetchLast = 0;
 }
 
 void DisplayModel::SetViewPortSize(Size newViewPortSize) {
@@ -962,7 +1245,7 @@ void DisplayModel::SetViewPortSize(Size newViewPortSize) {
     } else {
         RecalcVisibleParts();
         RenderVisibleParts();
-        cb->UpdateScrollbars(canvasSize);
+        cb->UpdateScrollbars();
     }
 }
 
@@ -1020,9 +1303,11 @@ void DisplayModel::GoToPage(int pageNo, int scrollY, bool addNavPt, int scrollX)
     } else if (ZOOM_FIT_CONTENT == zoomVirtual) {
         // make sure that CalcZoomReal uses the correct page to calculate
         // the zoom level for (visibility will be recalculated below anyway)
-        for (int i = PageCount(); i > 0; i--) {
-            GetPageInfo(i)->visibleRatio = (i == pageNo ? 1.0f : 0);
+        for (int i = visibleFirst; i > 0 && i <= visibleLast; i++) {
+            GetPageInfo(i)->visibleRatio = 0;
         }
+        GetPageInfo(pageNo)->visibleRatio = 1.0f;
+        visibleFirst = visibleLast = pageNo;
         Relayout(zoomVirtual, rotation);
     }
     // lf("DisplayModel::GoToPage(pageNo=%d, scrollY=%d)", pageNo, scrollY);
@@ -1068,11 +1353,11 @@ void DisplayModel::GoToPage(int pageNo, int scrollY, bool addNavPt, int scrollX)
     }
 
     viewPort.x = limitValue(viewPort.x, 0, canvasSize.dx - viewPort.dx);
-    viewPort.y = limitValue(viewPort.y, 0, canvasSize.dy - viewPort.dy);
+    viewPort.y = limitValue(viewPort.y, (i64)0, canvasSize.dy - viewPort.dy);
 
     RecalcVisibleParts();
     RenderVisibleParts();
-    cb->UpdateScrollbars(canvasSize);
+    cb->UpdateScrollbars();
     cb->PageNoChanged(this, pageNo);
     RepaintDisplay();
 }
@@ -1107,6 +1392,7 @@ void DisplayModel::SetDisplayMode(DisplayMode newDisplayMode, bool keepContinuou
             pageInfo->shown = true;
             pageInfo->visibleRatio = 0.0;
         }
+        visibleFirst = visibleLast = 0;
         Relayout(zoomVirtual, rotation);
     }
     GoToPage(currPageNo, 0);
@@ -1146,6 +1432,7 @@ void DisplayModel::SetPresentationMode(bool enable) {
    Returns true if advanced to the next page or false if couldn't advance
    (e.g. because already was at the last page) */
 bool DisplayModel::GoToNextPage() {
+    TrackScrolling(1);
     int columns = ColumnsFromDisplayMode(GetDisplayMode());
     int currPageNo = CurrentPageNo();
     // Fully display the current page, if the previous page is still visible
@@ -1164,6 +1451,7 @@ bool DisplayModel::GoToNextPage() {
 }
 
 bool DisplayModel::GoToPrevPage(int scrollY) {
+    TrackScrolling(-1);
     int columns = ColumnsFromDisplayMode(GetDisplayMode());
     int currPageNo = CurrentPageNo();
 
@@ -1227,7 +1515,7 @@ void DisplayModel::ScrollXTo(int xOff) {
     int currPageNo = CurrentPageNo();
     viewPort.x = xOff;
     RecalcVisibleParts();
-    cb->UpdateScrollbars(canvasSize);
+    cb->UpdateScrollbars();
 
     if (CurrentPageNo() != currPageNo)
         cb->PageNoChanged(this, CurrentPageNo());
@@ -1240,7 +1528,7 @@ void DisplayModel::ScrollXBy(int dx) {
         ScrollXTo(newOffX);
 }
 
-void DisplayModel::ScrollYTo(int yOff) {
+void DisplayModel::ScrollYTo(i64 yOff) {
     int currPageNo = CurrentPageNo();
     viewPort.y = yOff;
     RecalcVisibleParts();
@@ -1252,12 +1540,24 @@ void DisplayModel::ScrollYTo(int yOff) {
     RepaintDisplay();
 }
 
+int DisplayModel::GetScrollbarScaleY() const {
+    return (int)(canvasSize.dy / MAX_SCROLLBAR_DY) + 1;
+}
+
+int DisplayModel::CanvasYToScrollbar(i64 y) const {
+    return (int)(y / GetScrollbarScaleY());
+}
+
+i64 DisplayModel::ScrollbarToCanvasY(int pos) const {
+    return (i64)pos * GetScrollbarScaleY();
+}
+
 /* Scroll the doc in y-axis by 'dy'. If 'changePage' is TRUE, automatically
    switch to prev/next page in non-continuous mode if we scroll past the edges
    of current page */
 void DisplayModel::ScrollYBy(int dy, bool changePage) {
     PageInfo* pageInfo;
-    int currYOff = viewPort.y;
+    i64 currYOff = viewPort.y;
     int newPageNo;
     int currPageNo;
 
@@ -1265,7 +1565,7 @@ void DisplayModel::ScrollYBy(int dy, bool changePage) {
     if (0 == dy)
         return;
 
-    int newYOff = currYOff;
+    i64 newYOff = currYOff;
 
     if (!IsContinuous(GetDisplayMode()) && changePage) {
         if ((dy < 0) && (0 == currYOff)) {
@@ -1276,14 +1576,14 @@ void DisplayModel::ScrollYBy(int dy, bool changePage) {
                 newYOff = pageInfo->pos.dy - viewPort.dy;
                 if (newYOff < 0)
                     newYOff = 0; /* TODO: center instead? */
-                GoToPrevPage(newYOff);
+                GoToPrevPage((int)newYOff);
                 return;
             }
         }
 
         /* see if we have to change page when scrolling forward */
         if ((dy > 0) && (startPage < PageCount())) {
-            if (viewPort.y + viewPort.dy >= canvasSize.dy) {
+            if (viewPort.Bottom() >= canvasSize.dy) {
                 GoToNextPage();
                 return;
             }
@@ -1291,15 +1591,16 @@ void DisplayModel::ScrollYBy(int dy, bool changePage) {
     }
 
     newYOff += dy;
-    newYOff = limitValue(newYOff, 0, canvasSize.dy - viewPort.dy);
+    newYOff = limitValue(newYOff, (i64)0, canvasSize.dy - viewPort.dy);
     if (newYOff == currYOff)
         return;
 
+    TrackScrolling(dy > 0 ? 1 : -1);
     currPageNo = CurrentPageNo();
     viewPort.y = newYOff;
     RecalcVisibleParts();
     RenderVisibleParts();
-    cb->UpdateScrollbars(canvasSize);
+    cb->UpdateScrollbars();
     newPageNo = CurrentPageNo();
     if (newPageNo != currPageNo)
         cb->PageNoChanged(this, newPageNo);
@@ -1440,11 +1741,12 @@ void DisplayModel::RotateBy(int newRotation) {
 /* Given <region> (in user coordinates ) on page <pageNo>, copies text in that region
  * into a newly allocated buffer (which the caller needs to free()). */
 WCHAR* DisplayModel::GetTextInRegion(int pageNo, RectD region) {
-    Rect* coords;
-    const WCHAR* pageText = textCache->GetTextForPage(pageNo, nullptr, &coords);
+    PageTextPin pin(textCache, pageNo);
+    const WCHAR* pageText = textCache->GetTextForPage(pageNo);
     if (str::IsEmpty(pageText)) {
         return nullptr;
     }
+    ScopedMem<Rect> coords(textCache->GetCoordsForPage(pageNo));
 
     str::WStr result;
     Rect regionI = region.Round();
@@ -1543,6 +1845,12 @@ ScrollState DisplayModel::GetScrollState() {
 }
 
 void DisplayModel::SetScrollState(ScrollState state) {
+    // restore the position once the page has been laid out
+    if (!ValidPageNo(state.page) && pageSizesPending) {
+        pendingScrollState = state;
+        return;
+    }
+    pendingScrollState = ScrollState();
     // Update the internal metrics first
     GoToPage(state.page, 0);
     // Bail out, if the page wasn't scrolled
@@ -9,6 +9,35 @@ constexpr int INVALID_PAGE_NO = -1;
 // TODO: duplicated in GlobalPrefs.h
 #define INVALID_ZOOM -99.0f
 
+/* The canvas of a long document at a high zoom level can get higher than
+   what fits into an int, so vertical canvas coordinates are 64-bit.
+   Window coordinates (such as PageInfo::pageOnScreen) remain ints. */
+struct CanvasSize {
+    int dx = 0;
+    i64 dy = 0;
+};
+
+struct CanvasRect {
+    int x = 0;
+    i64 y = 0;
+    int dx = 0;
+    int dy = 0;
+
+    geomutil::SizeT<int> Size() const {
+        return geomutil::SizeT<int>(dx, dy);
+    }
+    i64 Bottom() const {
+        return y + dy;
+    }
+    /* position relative to the given canvas position, with y limited to
+       a range which can't overflow when used in window coordinates
+       (only matters for pages far away from the view port) */
+    Rect RelativeTo(int originX, i64 originY) const {
+        i64 relY = limitValue(y - originY, (i64)(INT_MIN / 4), (i64)(INT_MAX / 4));
+        return Rect(x - originX, (int)relY, dx, dy);
+    }
+};
+
 /* Describes many attributes of one page in one, convenient place */
 struct PageInfo {
     /* data that is constant for a given page. page size in document units */
@@ -16,6 +45,11 @@ struct PageInfo {
 
     /* data that is calculated when needed. actual content size within a page (View target) */
     RectD contentBox{};
+    /* size of the page after applying rotation (at zoom 1.0), cached because
+       layouting needs it for every page (valid if not empty and sizeRotation
+       matches the current rotation) */
+    SizeD rotatedSize{};
+    int sizeRotation = 0;
 
     /* data that needs to be set before DisplayModel::Relayout().
        Determines whether a given page should be shown on the screen. */
@@ -25,12 +59,14 @@ struct PageInfo {
     /* position and size within total area after applying zoom and rotation.
        Represents display rectangle for a given page.
        Calculated in DisplayModel::Relayout() */
-    Rect pos{};
+    CanvasRect pos{};
 
     /* data that changes due to scrolling. Calculated in DisplayModel::RecalcVisibleParts() */
     float visibleRatio; /* (0.0 = invisible, 1.0 = fully visible) */
-    /* position of page relative to visible view port: pos.Offset(-viewPort.x, -viewPort.y) */
+    /* position of page relative to visible view port: pos.RelativeTo(viewPort.x, viewPort.y)
+       (only updated for visible pages, the others are updated in GetPageInfo) */
     Rect pageOnScreen{};
+    int pageOnScreenGen = 0;
 
     // when zoomVirtual in DisplayMode is ZOOM_FIT_PAGE, ZOOM_FIT_WIDTH
     // or ZOOM_FIT_CONTENT, this is per-page zoom level
@@ -55,6 +91,7 @@ struct ScrollState {
 struct DocumentTextCache;
 struct TextSelection;
 class TextSearch;
+class TextIndex;
 struct TextSel;
 class Synchronizer;
 
@@ -79,7 +116,7 @@ class DisplayModel : public Controller {
         return engine->defaultFileExt;
     }
     int PageCount() const override {
-        return engine->PageCount();
+        return pageCount;
     }
     WCHAR* GetProperty(DocumentProperty prop) override {
         return engine->GetProperty(prop);
@@ -135,7 +172,7 @@ class DisplayModel : public Controller {
 
     // common shortcuts
     bool ValidPageNo(int pageNo) const override {
-        return 1 <= pageNo && pageNo <= engine->PageCount();
+        return 1 <= pageNo && pageNo <= pageCount;
     }
     bool GoToNextPage() override;
     bool GoToPrevPage(bool toBottom = false) override {
@@ -173,6 +210,8 @@ class DisplayModel : public Controller {
     TextSelection* textSelection = nullptr;
     // access only from Search thread
     TextSearch* textSearch = nullptr;
+    // only for longer documents (can be nullptr)
+    TextIndex* textIndex = nullptr;
 
     PageInfo* GetPageInfo(int pageNo) const;
 
@@ -181,9 +220,10 @@ class DisplayModel : public Controller {
         return rotation;
     }
     float GetZoomReal(int pageNo) const;
-    void Relayout(float zoomVirtual, int rotation);
+    void Relayout(float zoomVirtual, int rotation, int firstChangedPageNo = 1);
+    void UpdatePageSizes();
 
-    Rect GetViewPort() const {
+    CanvasRect GetViewPort() const {
         return viewPort;
     }
     bool NeedHScroll() const {
@@ -192,20 +232,29 @@ class DisplayModel : public Controller {
     bool NeedVScroll() const {
         return viewPort.dx < totalViewPortSize.dx;
     }
-    Size GetCanvasSize() const {
+    CanvasSize GetCanvasSize() const {
         return canvasSize;
     }
+    /* Win32 scrollbars only have int positions, so a canvas higher than
+       that is mapped onto the vertical scrollbar with this many pixels
+       per scrollbar unit (1 for all but extremely long canvases) */
+    int GetScrollbarScaleY() const;
+    int CanvasYToScrollbar(i64 y) const;
+    i64 ScrollbarToCanvasY(int pos) const;
 
     bool PageShown(int pageNo) const;
     bool PageVisible(int pageNo) const;
     bool PageVisibleNearby(int pageNo) const;
+    bool PagePrefetched(int pageNo) const;
+    bool PageKeptForPresentation(int pageNo) const;
     int FirstVisiblePageNo() const;
+    int LastVisiblePageNo() const;
     bool FirstBookPageVisible() const;
     bool LastBookPageVisible() const;
 
     void ScrollXTo(int xOff);
     void ScrollXBy(int dx);
-    void ScrollYTo(int yOff);
+    void ScrollYTo(i64 yOff);
     void ScrollYBy(int dy, bool changePage);
     /* a "virtual" zoom level. Can be either a real zoom level in percent
        (i.e. 100.0 is original size) or one of virtual values ZOOM_FIT_PAGE,
@@ -244,10 +293,21 @@ class DisplayModel : public Controller {
     void RepaintDisplay() {
         cb->Repaint();
     }
+    void RepaintDisplayArea(Rect area) {
+        cb->RepaintArea(area);
+    }
 
     /* allow resizing a window without triggering a new rendering (needed for window destruction) */
     bool dontRenderFlag = false;
 
+    /* while zooming is animated (or a zoom gesture is in progress), pages are
+       only rendered once the final zoom level has been reached, until then
+       the already rendered tiles are scaled (the deferral expires on its own,
+       in case it doesn't get stopped) */
+    void DeferRendering(int durationMs);
+    void StopDeferringRendering();
+    bool IsRenderingDeferred() const;
+
     bool GetPresentationMode() const {
         return presentationMode;
     }
@@ -260,6 +320,9 @@ class DisplayModel : public Controller {
     Point GetContentStart(int pageNo);
     void RecalcVisibleParts();
     void RenderVisibleParts();
+    void TrackScrolling(int dir);
+    void PrefetchPages(int firstVisiblePage, int lastVisiblePage);
+    void CancelPrefetching();
     void AddNavPoint();
     RectD GetContentBox(int pageNo);
     void CalcZoomReal(float zoomVirtual);
@@ -268,10 +331,35 @@ class DisplayModel : public Controller {
     int GetPageNextToPoint(Point pt);
 
     EngineBase* engine = nullptr;
+    /* the engine's page count as of the last UpdatePageSizes()
+       (ebook engines keep adding pages while laying out in the background) */
+    int pageCount = 0;
 
     /* an array of PageInfo, len of array is pageCount */
     PageInfo* pagesInfo = nullptr;
 
+    /* a row of shown pages (all pages of a row have the same pos.y) */
+    struct PageRow {
+        int firstPageNo;
+        int lastPageNo;
+        i64 y;
+        i64 bottom;
+        /* widths of the widest pages per column in this and all previous rows
+           (so that the layout can be continued after any row) */
+        int columnMaxDx[2];
+    };
+    /* rows sorted by position (calculated in Relayout()), so that the visible
+       pages can be found with a binary search instead of looping over all pages */
+    Vec<PageRow> pageRows;
+    int FindPageRow(i64 y) const;
+    /* range of pages with visibleRatio > 0 (all others have visibleRatio == 0) */
+    int visibleFirst = 0;
+    int visibleLast = 0;
+    /* pageOnScreen of pages with an older generation is relative to pageOnScreenOriginX/Y */
+    int pageOnScreenGen = 1;
+    int pageOnScreenOriginX = 0;
+    i64 pageOnScreenOriginY = 0;
+
     DisplayMode displayMode = DM_AUTOMATIC;
     /* In non-continuous mode is the first page from a file that we're
        displaying.
@@ -279,11 +367,11 @@ class DisplayModel : public Controller {
     int startPage = 1;
 
     /* size of virtual canvas containing all rendered pages. */
-    Size canvasSize;
+    CanvasSize canvasSize;
     /* size and position of the viewport on the canvas (resp size of the visible
        part of the canvase available for content (totalViewPortSize minus scroll bars)
        (canvasSize is always at least as big as viewPort.Size()) */
-    Rect viewPort;
+    CanvasRect viewPort;
     /* total size of view port (draw area), including scroll bars */
     Size totalViewPortSize;
 
@@ -308,6 +396,25 @@ class DisplayModel : public Controller {
     float presZoomVirtual = INVALID_ZOOM;
     DisplayMode presDisplayMode = DM_AUTOMATIC;
 
+    /* direction (1 for forward, -1 for backward) and number of the most recent
+       quickly repeated scroll moves, used for predicting the pages to render next */
+    int scrollDir = 0;
+    int scrollStreak = 0;
+    LARGE_INTEGER lastScrollTime{};
+    /* cf. DeferRendering */
+    LARGE_INTEGER renderingDeferredSince{};
+    int renderingDeferredMs = 0;
+    /* range of pages last requested for prefetching */
+    int prefetchFirst = 0;
+    int prefetchLast = 0;
+    /* true while the engine is still determining page sizes */
+    bool pageSizesPending = false;
+    /* pages 1 to finalPageSizes have been laid out with their final sizes
+       (UpdatePageSizes only has to check the pages after them) */
+    int finalPageSizes = 0;
+    /* scroll position on a page that hasn't been laid out yet */
+    ScrollState pendingScrollState;
+
     Vec<ScrollState> navHistory;
     /* index of the "current" history entry (to be updated on navigation),
        resp. number of Back history entries */
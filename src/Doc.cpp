@@ -3,6 +3,7 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
+#include "utils/FileTypeSniff.h"
 #include "utils/Archive.h"
 #include "utils/GdiPlusUtil.h"
 #include "utils/HtmlParserLookup.h"
@@ -281,6 +282,7 @@ Doc Doc::CreateFromFile(const WCHAR* filePath) {
 }
 
 bool Doc::IsSupportedFile(const WCHAR* filePath, bool sniff) {
+    ScopedFileHeaderCache headerCache;
     return EpubDoc::IsSupportedFile(filePath, sniff) || Fb2Doc::IsSupportedFile(filePath, sniff) ||
            MobiDoc::IsSupportedFile(filePath, sniff) || PalmDoc::IsSupportedFile(filePath, sniff);
 }
@@ -74,6 +74,9 @@ struct EbookFormattingData {
     size_t pageCount;
     bool finished;
     LONG threadNo;
+    // pages of the current page formatted ahead of the rest
+    // (shown until the current page's been reached)
+    bool isPreview = false;
 
     EbookFormattingData(HtmlPage** pages, size_t pageCount, bool finished, LONG threadNo)
         : pageCount(pageCount), finished(finished), threadNo(threadNo) {
@@ -105,12 +108,17 @@ class EbookFormattingThread : public ThreadBase {
     int reparseIdx = 0;
     int pagesAfterReparseIdx = 0;
 
+    // state of the formatter at reparseIdx, for formatting the pages
+    // to show before starting from the beginning (we own it)
+    ReparseData* previewState = nullptr;
+
   public:
     void SendPagesIfNecessary(bool force, bool finished);
+    bool FormatPreview();
     bool Format();
 
     EbookFormattingThread(Doc doc, HtmlFormatterArgs* args, EbookController* ctrl, int reparseIdx,
-                          ControllerCallback* cb);
+                          ReparseData* previewState, ControllerCallback* cb);
     virtual ~EbookFormattingThread();
 
     // ThreadBase
@@ -118,19 +126,22 @@ class EbookFormattingThread : public ThreadBase {
 };
 
 EbookFormattingThread::EbookFormattingThread(Doc doc, HtmlFormatterArgs* args, EbookController* ctrl, int reparseIdx,
-                                             ControllerCallback* cb) {
+                                             ReparseData* previewState, ControllerCallback* cb) {
     this->doc = doc;
     this->cb = cb;
     this->controller = ctrl;
     this->formatterArgs = args;
     this->reparseIdx = reparseIdx;
+    this->previewState = previewState;
     CrashIf(reparseIdx < 0);
+    CrashIf(previewState && previewState->reparseIdx != reparseIdx);
     AssertCrash(doc.IsDocLoaded() || (doc.IsNone() && (nullptr != args->htmlStr)));
 }
 
 EbookFormattingThread::~EbookFormattingThread() {
     // lf("ThreadLayoutEbook::~ThreadLayoutEbook()");
     delete formatterArgs;
+    delete previewState;
 }
 
 // send accumulated pages if we filled the buffer or the caller forces us
@@ -148,6 +159,41 @@ void EbookFormattingThread::SendPagesIfNecessary(bool force, bool finished) {
     cb->HandleLayoutedPages(controller, msg);
 }
 
+// formatting a large book from the beginning takes a while, so first
+// format the 2 pages at reparseIdx from the state they're starting with
+// returns true if layout thread was cancelled
+bool EbookFormattingThread::FormatPreview() {
+    if (!previewState) {
+        return false;
+    }
+    formatterArgs->reparseIdx = previewState->reparseIdx;
+    formatterArgs->reparseData = previewState;
+    HtmlFormatter* formatter = doc.CreateFormatter(formatterArgs);
+    while (pageCount < 2) {
+        HtmlPage* pd = formatter->Next();
+        if (!pd) {
+            break;
+        }
+        pages[pageCount++] = pd;
+    }
+    delete formatter;
+    formatterArgs->reparseData = nullptr;
+
+    if (WasCancelRequested()) {
+        for (int i = 0; i < pageCount; i++) {
+            delete pages[i];
+        }
+        pageCount = 0;
+        return true;
+    }
+    EbookFormattingData* msg = new EbookFormattingData(pages, pageCount, false, GetNo());
+    msg->isPreview = true;
+    pageCount = 0;
+    memset(pages, 0, sizeof(pages));
+    cb->HandleLayoutedPages(controller, msg);
+    return false;
+}
+
 // layout pages from a given reparse point (beginning if nullptr)
 // returns true if layout thread was cancelled
 bool EbookFormattingThread::Format() {
@@ -191,18 +237,24 @@ bool EbookFormattingThread::Format() {
 
 void EbookFormattingThread::Run() {
     // auto t = TimeGet();
+    if (FormatPreview()) {
+        // send a 'finished' message so that the thread object gets deleted
+        SendPagesIfNecessary(true, true /* finished */);
+        return;
+    }
     Format();
     // lf("Formatting time: %.2f ms", t.Stop());
 }
 
-static void DeletePages(Vec<HtmlPage*>** toDeletePtr) {
-    if (!*toDeletePtr) {
-        return;
+// the allocator holds the text of the pages, so they're deleted together
+static void DeletePages(Vec<HtmlPage*>** toDeletePtr, PoolAllocator** allocatorPtr) {
+    if (*toDeletePtr) {
+        DeleteVecMembers(**toDeletePtr);
+        delete *toDeletePtr;
+        *toDeletePtr = nullptr;
     }
-
-    DeleteVecMembers(**toDeletePtr);
-    delete *toDeletePtr;
-    *toDeletePtr = nullptr;
+    delete *allocatorPtr;
+    *allocatorPtr = nullptr;
 }
 
 EbookController::EbookController(Doc doc, EbookControls* ctrls, ControllerCallback* cb)
@@ -250,14 +302,64 @@ void EbookController::StopFormattingThread() {
     delete formattingThread;
     formattingThread = nullptr;
     formattingThreadNo = -1;
-    DeletePages(&incomingPages);
+    DeletePreviewPages();
+    DeletePages(&incomingPages, &incomingPagesAllocator);
+}
+
+// shows the pages formatted from the current page's reparse point
+// while formatting from the beginning hasn't reached it yet
+void EbookController::ShowPreviewPages(EbookFormattingData* ft) {
+    if (!incomingPages || previewPages || 0 == ft->pageCount) {
+        DeleteEbookFormattingData(ft);
+        return;
+    }
+    previewPages = new Vec<HtmlPage*>();
+    for (size_t i = 0; i < ft->pageCount; i++) {
+        previewPages->Append(ft->pages[i]);
+    }
+    ctrls->pagesLayout->GetPage1()->SetPage(previewPages->at(0));
+    if (IsDoublePage() && previewPages->size() > 1) {
+        ctrls->pagesLayout->GetPage2()->SetPage(previewPages->at(1));
+    } else {
+        ctrls->pagesLayout->GetPage2()->SetPage(nullptr);
+    }
+    // ft->pages are now owned by previewPages
+    delete ft;
+}
+
+// if the preview pages are still shown, the previous pages are shown instead
+void EbookController::DeletePreviewPages() {
+    if (!previewPages) {
+        return;
+    }
+    PageControl* page1 = ctrls->pagesLayout->GetPage1();
+    PageControl* page2 = ctrls->pagesLayout->GetPage2();
+    if (previewPages->Contains(page1->GetPage()) || previewPages->Contains(page2->GetPage())) {
+        page1->FreeRenderedPages();
+        page2->FreeRenderedPages();
+        HtmlPage* p1 = nullptr;
+        HtmlPage* p2 = nullptr;
+        if (pages && currPageNo > 0 && currPageNo <= pages->isize()) {
+            p1 = pages->at(currPageNo - 1);
+            if (IsDoublePage() && currPageNo < pages->isize()) {
+                p2 = pages->at(currPageNo);
+            }
+        }
+        page1->SetPage(p1);
+        page2->SetPage(p2);
+    }
+    DeleteVecMembers(*previewPages);
+    delete previewPages;
+    previewPages = nullptr;
 }
 
 void EbookController::CloseCurrentDocument() {
     ctrls->pagesLayout->GetPage1()->SetPage(nullptr);
     ctrls->pagesLayout->GetPage2()->SetPage(nullptr);
+    ctrls->pagesLayout->GetPage1()->FreeRenderedPages();
+    ctrls->pagesLayout->GetPage2()->FreeRenderedPages();
     StopFormattingThread();
-    DeletePages(&pages);
+    DeletePages(&pages, &pagesAllocator);
     doc.Delete();
     pageSize = Size(0, 0);
 }
@@ -307,6 +409,10 @@ void EbookController::HandlePagesFromEbookLayout(EbookFormattingData* ft) {
         DeleteEbookFormattingData(ft);
         return;
     }
+    if (ft->isPreview) {
+        ShowPreviewPages(ft);
+        return;
+    }
     // lf("EbookController::HandlePagesFromEbookLayout() %d pages, ft=0x%x", ft->pageCount, (int)ft);
     if (incomingPages) {
         for (size_t i = 0; i < ft->pageCount; i++) {
@@ -315,10 +421,18 @@ void EbookController::HandlePagesFromEbookLayout(EbookFormattingData* ft) {
         int pageNo = PageForReparsePoint(incomingPages, currPageReparseIdx);
         if (pageNo > 0) {
             Vec<HtmlPage*>* toDelete = pages;
+            PoolAllocator* toDeleteAllocator = pagesAllocator;
             pages = incomingPages;
+            pagesAllocator = incomingPagesAllocator;
             incomingPages = nullptr;
-            DeletePages(&toDelete);
+            incomingPagesAllocator = nullptr;
+            // a new page might be allocated where a deleted one was
+            ctrls->pagesLayout->GetPage1()->FreeRenderedPages();
+            ctrls->pagesLayout->GetPage2()->FreeRenderedPages();
+            DeletePages(&toDelete, &toDeleteAllocator);
             GoToPage(pageNo, false);
+            // the preview pages are no longer shown
+            DeletePreviewPages();
         }
     } else {
         CrashIf(!pages);
@@ -361,9 +475,20 @@ void EbookController::TriggerLayout() {
     StopFormattingThread();
     CrashIf(incomingPages);
     incomingPages = new Vec<HtmlPage*>(1024);
+    incomingPagesAllocator = new PoolAllocator();
+
+    // the current page can be re-formatted right away if we know
+    // the state formatting was in when it started
+    ReparseData* previewState = nullptr;
+    if (pages && currPageNo > 1 && currPageNo <= pages->isize()) {
+        HtmlPage* p = pages->at(currPageNo - 1);
+        if (p->reparseData && p->reparseIdx == currPageReparseIdx) {
+            previewState = new ReparseData(*p->reparseData);
+        }
+    }
 
-    HtmlFormatterArgs* args = CreateFormatterArgsDoc(doc, size.dx, size.dy, &textAllocator);
-    formattingThread = new EbookFormattingThread(doc, args, this, currPageReparseIdx, cb);
+    HtmlFormatterArgs* args = CreateFormatterArgsDoc(doc, size.dx, size.dy, incomingPagesAllocator);
+    formattingThread = new EbookFormattingThread(doc, args, this, currPageReparseIdx, previewState, cb);
     formattingThreadNo = formattingThread->GetNo();
     formattingThread->Start();
     UpdateStatus();
@@ -546,6 +671,22 @@ void EbookController::GoToPage(int pageNo, bool addNavPoint) {
     UpdateStatus();
     // update the ToC selection
     cb->PageNoChanged(this, pageNo);
+    PrerenderNextPages();
+}
+
+// shows the current page(s) right away and then renders the next page(s),
+// so that turning the page only has to show the already rendered page(s)
+void EbookController::PrerenderNextPages() {
+    int dist = IsDoublePage() ? 2 : 1;
+    int nextIdx = currPageNo - 1 + dist;
+    if (nextIdx >= pages->isize()) {
+        return;
+    }
+    UpdateWindow(ctrls->mainWnd->hwndParent);
+    ctrls->pagesLayout->GetPage1()->PrerenderPage(pages->at(nextIdx));
+    if (IsDoublePage() && nextIdx + 1 < pages->isize()) {
+        ctrls->pagesLayout->GetPage2()->PrerenderPage(pages->at(nextIdx + 1));
+    }
 }
 
 bool EbookController::GoToNextPage() {
@@ -107,14 +107,17 @@ class EbookController : public Controller {
     TocTree* tocTree = nullptr;
     Doc doc;
 
-    // TODO: this should be recycled along with pages so that its
-    // memory use doesn't grow without bounds
-    PoolAllocator textAllocator;
-
     Vec<HtmlPage*>* pages = nullptr;
+    // the text of pages is allocated per layout and freed along with them
+    // so that re-layouting (e.g. while resizing) doesn't keep growing memory
+    PoolAllocator* pagesAllocator = nullptr;
 
     // pages being sent from background formatting thread
     Vec<HtmlPage*>* incomingPages = nullptr;
+    PoolAllocator* incomingPagesAllocator = nullptr;
+    // the current page formatted ahead of incomingPages
+    // (their text is allocated by incomingPagesAllocator as well)
+    Vec<HtmlPage*>* previewPages = nullptr;
 
     // currPageNo is in range 1..$numberOfPages.
     int currPageNo = 0;
@@ -139,10 +142,13 @@ class EbookController : public Controller {
 
     Vec<HtmlPage*>* GetPages();
     void UpdateStatus();
+    void PrerenderNextPages();
     bool FormattingInProgress() const {
         return formattingThread != nullptr;
     }
     void StopFormattingThread();
+    void ShowPreviewPages(EbookFormattingData* ft);
+    void DeletePreviewPages();
     void CloseCurrentDocument();
     int GetMaxPageCount() const;
     bool IsDoublePage() const;
@@ -141,6 +141,13 @@ PageControl::~PageControl() {
         // TODO: make Control's destructor clear the tooltip?
         Control::NotifyMouseLeave();
     }
+    FreeRenderedPages();
+}
+
+void PageBitmap::Free() {
+    ::delete bmp;
+    bmp = nullptr;
+    page = nullptr;
 }
 
 void PageControl::SetPage(HtmlPage* newPage) {
@@ -196,53 +203,109 @@ Gdiplus::Size PageControl::GetDrawableSize() const {
     return s;
 }
 
-void PageControl::Paint(Graphics* gfx, int offX, int offY) {
-    CrashIf(!IsVisible());
+void PageControl::FreeRenderedPages() {
+    rendered.Free();
+    prerendered.Free();
+}
 
-    auto timerAll = TimeGet();
+void PageControl::PrerenderPage(HtmlPage* p) {
+    if (!p || !IsVisible() || IsUpToDate(rendered, p) || IsUpToDate(prerendered, p)) {
+        return;
+    }
+    RenderPage(prerendered, p);
+}
+
+bool PageControl::IsUpToDate(PageBitmap& pb, HtmlPage* p) const {
+    if (!pb.bmp || pb.page != p) {
+        return false;
+    }
+    COLORREF txtCol, bgCol;
+    GetEbookUiColors(txtCol, bgCol);
+    Gdiplus::Size size(pos.Width, pos.Height);
+    return pb.size.Equals(size) && pb.textColor == txtCol && pb.bgColor == bgCol && pb.style == cachedStyle &&
+           pb.debugPaint == IsDebugPaint();
+}
+
+bool PageControl::RenderPage(PageBitmap& pb, HtmlPage* p) {
+    Gdiplus::Size size(pos.Width, pos.Height);
+    if (size.Width <= 0 || size.Height <= 0) {
+        pb.Free();
+        return false;
+    }
+    if (!pb.bmp || !pb.size.Equals(size)) {
+        ::delete pb.bmp;
+        pb.bmp = ::new Bitmap(size.Width, size.Height, PixelFormat32bppARGB);
+        if (pb.bmp->GetLastStatus() != Ok) {
+            pb.Free();
+            return false;
+        }
+    }
+    COLORREF txtCol, bgCol;
+    GetEbookUiColors(txtCol, bgCol);
+    pb.page = p;
+    pb.size = size;
+    pb.textColor = txtCol;
+    pb.bgColor = bgCol;
+    pb.style = cachedStyle;
+    pb.debugPaint = IsDebugPaint();
+
+    Graphics gfx((Image*)pb.bmp);
+    InitGraphicsMode(&gfx);
+    gfx.Clear(Color(0, 0, 0, 0));
 
     CachedStyle* s = cachedStyle;
-    auto timerFill = TimeGet();
-    Gdiplus::Rect r(offX, offY, pos.Width, pos.Height);
+    Gdiplus::Rect r(0, 0, pos.Width, pos.Height);
     if (!s->bgColor->IsTransparent()) {
         Brush* br = BrushFromColorData(s->bgColor, r);
-        gfx->FillRectangle(br, r);
+        gfx.FillRectangle(br, r);
     }
-    double durFill = TimeSinceInMs(timerFill);
-
-    if (!page)
-        return;
 
     // during resize the page we currently show might be bigger than
     // our area. To avoid drawing outside our area we clip
-    Region origClipRegion;
-    gfx->GetClip(&origClipRegion);
     r.X += s->padding.left;
     r.Y += s->padding.top;
     r.Width -= (s->padding.left + s->padding.right);
     r.Height -= (s->padding.top + s->padding.bottom);
     r.Inflate(1, 0);
-    gfx->SetClip(r, CombineModeReplace);
+    gfx.SetClip(r, CombineModeReplace);
 
-    COLORREF txtCol, bgCol;
-    GetEbookUiColors(txtCol, bgCol);
     Color textColor, bgColor;
     textColor.SetFromCOLORREF(txtCol);
+    bgColor.SetFromCOLORREF(bgCol);
 
-    ITextRender* textRender = CreateTextRender(GetTextRenderMethod(), gfx, pos.Width, pos.Height);
+    ITextRender* textRender = CreateTextRender(GetTextRenderMethod(), &gfx, pos.Width, pos.Height);
     // ITextRender *textRender = CreateTextRender(TextRenderMethodHdc, gfx, pos.Width, pos.Height);
-
-    bgColor.SetFromCOLORREF(bgCol);
     textRender->SetTextBgColor(bgColor);
-
-    auto timerDrawHtml = TimeGet();
-    DrawHtmlPage(gfx, textRender, &page->instructions, (float)r.X, (float)r.Y, IsDebugPaint(), textColor);
-    double durDraw = TimeSinceInMs(timerDrawHtml);
-    gfx->SetClip(&origClipRegion, CombineModeReplace);
+    DrawHtmlPage(&gfx, textRender, &p->instructions, (float)r.X, (float)r.Y, IsDebugPaint(), textColor);
     delete textRender;
+    return true;
+}
+
+void PageControl::Paint(Graphics* gfx, int offX, int offY) {
+    CrashIf(!IsVisible());
 
-    double durAll = TimeSinceInMs(timerAll);
-    // logf("all: %.2f, fill: %.2f, draw html: %.2f\n", durAll, durFill, durDraw);
+    bool isRendered = page && IsUpToDate(rendered, page);
+    if (page && !isRendered) {
+        if (IsUpToDate(prerendered, page)) {
+            std::swap(rendered, prerendered);
+            isRendered = true;
+        } else {
+            isRendered = RenderPage(rendered, page);
+        }
+    }
+    if (isRendered) {
+        // the size is explicit so that the bitmap's resolution is ignored
+        Gdiplus::Rect dst(offX, offY, rendered.size.Width, rendered.size.Height);
+        gfx->DrawImage(rendered.bmp, dst);
+        return;
+    }
+
+    CachedStyle* s = cachedStyle;
+    Gdiplus::Rect r(offX, offY, pos.Width, pos.Height);
+    if (!s->bgColor->IsTransparent()) {
+        Brush* br = BrushFromColorData(s->bgColor, r);
+        gfx->FillRectangle(br, r);
+    }
 }
 
 Control* CreatePageControl(TxtNode* structDef) {
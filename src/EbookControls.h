@@ -27,12 +27,33 @@ void SetMainWndBgCol(EbookControls* ctrls);
 class HtmlPage;
 struct DrawInstr;
 
+// a page rendered at a given size and with given colors
+struct PageBitmap {
+    Gdiplus::Bitmap* bmp = nullptr;
+    HtmlPage* page = nullptr;
+    Gdiplus::Size size;
+    COLORREF textColor = 0;
+    COLORREF bgColor = 0;
+    CachedStyle* style = nullptr;
+    bool debugPaint = false;
+
+    void Free();
+};
+
 // control that shows a single ebook page
 // TODO: move to a separate file
 class PageControl : public Control {
     HtmlPage* page;
     int cursorX, cursorY;
 
+    // the shown page, so that repaints only have to blit it
+    PageBitmap rendered;
+    // the page that is likely to be shown next (cf. PrerenderPage)
+    PageBitmap prerendered;
+
+    bool IsUpToDate(PageBitmap& pb, HtmlPage* p) const;
+    bool RenderPage(PageBitmap& pb, HtmlPage* p);
+
   public:
     PageControl();
     virtual ~PageControl();
@@ -42,6 +63,12 @@ class PageControl : public Control {
         return page;
     }
 
+    // renders p ahead of time, so that showing it with SetPage
+    // doesn't have to wait for the rendering
+    void PrerenderPage(HtmlPage* p);
+    // must be called before the pages that have been shown are deleted
+    void FreeRenderedPages();
+
     Gdiplus::Size GetDrawableSize() const;
     DrawInstr* GetLinkAt(int x, int y) const;
 
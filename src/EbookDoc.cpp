@@ -3,7 +3,9 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/Archive.h"
+#include "utils/Dict.h"
 #include "utils/FileUtil.h"
+#include "utils/FileTypeSniff.h"
 #include "utils/GdiPlusUtil.h"
 #include "utils/HtmlParserLookup.h"
 #include "utils/HtmlPullParser.h"
@@ -149,14 +151,46 @@ inline char decode64(char c) {
     return -1;
 }
 
+// maps all bytes to their value in base64 encoding (or 0xFF)
+struct Base64Table {
+    u8 values[256];
+
+    Base64Table() {
+        for (int i = 0; i < 256; i++) {
+            values[i] = (u8)decode64((char)i);
+        }
+    }
+};
+
 static char* Base64Decode(const char* s, size_t sLen, size_t* lenOut) {
+    static Base64Table table;
+    const u8* values = table.values;
     const char* end = s + sLen;
     char* result = AllocArray<char>(sLen * 3 / 4);
     char* curr = result;
     unsigned char c = 0;
     int step = 0;
     for (; s < end && *s != '='; s++) {
-        char n = decode64(*s);
+        // decode whole groups of 4 characters at once, until reaching
+        // a line break or the padding (which are handled below)
+        if (0 == step % 4) {
+            while (s + 4 <= end) {
+                u32 a = values[(u8)s[0]], b = values[(u8)s[1]];
+                u32 c2 = values[(u8)s[2]], d = values[(u8)s[3]];
+                if ((a | b | c2 | d) & 0x80) {
+                    break;
+                }
+                u32 v = (a << 18) | (b << 12) | (c2 << 6) | d;
+                *curr++ = (char)(v >> 16);
+                *curr++ = (char)(v >> 8);
+                *curr++ = (char)v;
+                s += 4;
+            }
+            if (s >= end || *s == '=') {
+                break;
+            }
+        }
+        char n = (char)values[(u8)*s];
         if (-1 == n) {
             if (str::IsWs(*s))
                 continue;
@@ -251,23 +285,37 @@ const char* EPUB_ENC_NS = "http://www.w3.org/2001/04/xmlenc#";
 EpubDoc::EpubDoc(const WCHAR* fileName) {
     this->fileName.SetCopy(fileName);
     InitializeCriticalSection(&zipAccess);
+    InitializeCriticalSection(&imagesAccess);
+    imagesByPath = new dict::MapStrToInt();
     zip = OpenZipArchive(fileName, true);
 }
 
 EpubDoc::EpubDoc(IStream* stream) {
     InitializeCriticalSection(&zipAccess);
+    InitializeCriticalSection(&imagesAccess);
+    imagesByPath = new dict::MapStrToInt();
     zip = OpenZipArchive(stream, true);
 }
 
 EpubDoc::~EpubDoc() {
+    EnterCriticalSection(&imagesAccess);
+    prefetchCanceled = true;
+    LeaveCriticalSection(&imagesAccess);
+    if (prefetchThread) {
+        WaitForSingleObject(prefetchThread, INFINITE);
+        CloseHandle(prefetchThread);
+    }
+
     EnterCriticalSection(&zipAccess);
 
     for (size_t i = 0; i < images.size(); i++) {
         free(images.at(i).base.data);
         free(images.at(i).fileName);
     }
+    delete imagesByPath;
 
     LeaveCriticalSection(&zipAccess);
+    DeleteCriticalSection(&imagesAccess);
     DeleteCriticalSection(&zipAccess);
     delete zip;
 }
@@ -297,6 +345,19 @@ static bool isImageMediaType(const WCHAR* mediatype) {
     return str::Eq(mediatype, L"image/png") || str::Eq(mediatype, L"image/jpeg") || str::Eq(mediatype, L"image/gif");
 }
 
+// limit for the size of images decompressed ahead of time
+#define EPUB_PREFETCH_SIZE (32 * 1024 * 1024)
+
+// the key under which an image is indexed, so that references
+// (cf. GetImageData) can be looked up without comparing every path
+static char* NormalizeImagePath(const char* path) {
+    char* key = NormalizeURL(path, "");
+    // some EPUB producers use wrong path separators
+    if (str::FindChar(key, '\\'))
+        str::TransChars(key, "\\", "/");
+    return key;
+}
+
 bool EpubDoc::Load() {
     if (!zip) {
         return false;
@@ -377,6 +438,8 @@ bool EpubDoc::Load() {
             auto tmp = strconv::WstrToUtf8(imgPath);
             data.fileName = (char*)tmp.data();
             data.fileId = zip->GetFileId(data.fileName);
+            AutoFree key(NormalizeImagePath(data.fileName));
+            imagesByPath->Insert(key, images.isize());
             images.Append(data);
         } else if (isHtmlMediaType(mediatype)) {
             AutoFreeWstr htmlPath(node->GetAttribute("href"));
@@ -443,6 +506,7 @@ bool EpubDoc::Load() {
         AutoFree utf8_path = strconv::WstrToUtf8(fullPath);
         DebugCrashIf(str::FindChar(utf8_path.Get(), '"'));
         str::TransChars(utf8_path.Get(), "\"", "'");
+        sectionStarts.Append((int)htmlData.size());
         htmlData.AppendFmt("<pagebreak page_path=\"%s\" page_marker />", utf8_path.Get());
         htmlData.Append(html.data);
     }
@@ -491,65 +555,150 @@ std::string_view EpubDoc::GetHtmlData() const {
     return htmlData.AsView();
 }
 
-ImageData* EpubDoc::GetImageData(const char* fileName, const char* pagePath) {
-    ScopedCritSec scope(&zipAccess);
+const Vec<int>& EpubDoc::GetSectionStarts() const {
+    return sectionStarts;
+}
 
-    if (!pagePath) {
-        CrashIf(true);
-        // if we're reparsing, we might not have pagePath, which is needed to
-        // build the exact url so try to find a partial match
-        // TODO: the correct approach would be to extend reparseIdx into a
-        // struct ReparseData, which would include pagePath and all other
-        // styling related state (such as nextPageStyle, listDepth, etc. including
-        // format specific state such as hiddenDepth and titleCount) and store it
-        // in every HtmlPage, but this should work well enough for now
-        for (size_t i = 0; i < images.size(); i++) {
-            ImageData2* img = &images.at(i);
-            if (str::EndsWithI(img->fileName, fileName)) {
-                if (!img->base.data) {
-                    auto res = zip->GetFileDataById(img->fileId);
-                    img->base.len = res.size();
-                    img->base.data = (char*)res.data();
+// decompresses an image, unless that has already happened (e.g. on the prefetching thread)
+ImageData* EpubDoc::LoadImage(int idx) {
+    {
+        ScopedCritSec scope(&imagesAccess);
+        ImageData2* img = &images.at(idx);
+        if (img->base.data) {
+            return &img->base;
+        }
+    }
+
+    ScopedCritSec zipScope(&zipAccess);
+    size_t fileId;
+    {
+        ScopedCritSec scope(&imagesAccess);
+        ImageData2* img = &images.at(idx);
+        if (img->base.data) {
+            return &img->base;
+        }
+        fileId = img->fileId;
+    }
+    auto res = zip->GetFileDataById(fileId);
+
+    ScopedCritSec scope(&imagesAccess);
+    ImageData2* img = &images.at(idx);
+    if (!res.data()) {
+        // don't try again
+        img->fileId = (size_t)-1;
+        return nullptr;
+    }
+    img->base.len = res.size();
+    img->base.data = (char*)res.data();
+    return &img->base;
+}
+
+void EpubDoc::StartPrefetching(int nextIdx) {
+    ScopedCritSec scope(&imagesAccess);
+    prefetchStart = nextIdx;
+    if (prefetchRunning || prefetchCanceled || nextIdx >= images.isize()) {
+        return;
+    }
+    if (prefetchThread) {
+        // the previous thread has run out of images and is exiting
+        WaitForSingleObject(prefetchThread, INFINITE);
+        CloseHandle(prefetchThread);
+    }
+    prefetchThread = CreateThread(nullptr, 0, PrefetchImagesThread, this, 0, nullptr);
+    prefetchRunning = prefetchThread != nullptr;
+}
+
+// images are usually listed in the manifest in the order in which they're
+// referenced, so this decompresses the images which will be laid out next
+// (as long as they fit into EPUB_PREFETCH_SIZE)
+DWORD WINAPI EpubDoc::PrefetchImagesThread(LPVOID data) {
+    EpubDoc* doc = (EpubDoc*)data;
+    auto& fileInfos = doc->zip->GetFileInfos();
+    for (;;) {
+        int idx = -1;
+        {
+            ScopedCritSec scope(&doc->imagesAccess);
+            size_t totalSize = 0;
+            for (int i = doc->prefetchStart; i < doc->images.isize() && !doc->prefetchCanceled; i++) {
+                ImageData2& img = doc->images.at(i);
+                if (img.fileId == (size_t)-1) {
+                    continue;
+                }
+                totalSize += fileInfos.at(img.fileId)->fileSizeUncompressed;
+                if (totalSize > EPUB_PREFETCH_SIZE) {
+                    break;
                 }
-                if (img->base.data)
-                    return &img->base;
+                if (!img.base.data) {
+                    idx = i;
+                    break;
+                }
+            }
+            if (idx < 0) {
+                doc->prefetchRunning = false;
+                return 0;
             }
         }
-        return nullptr;
+        doc->LoadImage(idx);
     }
+}
 
-    AutoFree url(NormalizeURL(fileName, pagePath));
-    // some EPUB producers use wrong path separators
-    if (str::FindChar(url, '\\'))
-        str::TransChars(url, "\\", "/");
-    for (size_t i = 0; i < images.size(); i++) {
-        ImageData2* img = &images.at(i);
-        if (str::Eq(img->fileName, url)) {
-            if (!img->base.data) {
-                auto res = zip->GetFileDataById(img->fileId);
-                img->base.len = res.size();
-                img->base.data = (char*)res.data();
+ImageData* EpubDoc::GetImageData(const char* fileName, const char* pagePath) {
+    int idx = -1;
+    AutoFree url;
+    if (!pagePath) {
+        CrashIf(true);
+        // if we're reparsing without the page's ReparseData (which includes
+        // pagePath), we might not have pagePath, which is needed to
+        // build the exact url so try to find a partial match
+        ScopedCritSec scope(&imagesAccess);
+        for (size_t i = 0; i < images.size() && idx < 0; i++) {
+            if (str::EndsWithI(images.at(i).fileName, fileName)) {
+                idx = (int)i;
             }
-            if (img->base.data)
-                return &img->base;
+        }
+    } else {
+        AutoFree absUrl(NormalizeURL(fileName, pagePath));
+        url.Set(NormalizeImagePath(absUrl));
+        ScopedCritSec scope(&imagesAccess);
+        if (!imagesByPath->Get(url, &idx)) {
+            idx = -1;
         }
     }
 
+    if (idx >= 0) {
+        ImageData* img = LoadImage(idx);
+        StartPrefetching(idx + 1);
+        return img;
+    }
+    if (!pagePath) {
+        return nullptr;
+    }
+
     // try to also load images which aren't registered in the manifest
-    ImageData2 data = {0};
-    data.fileId = zip->GetFileId(url);
-    if (data.fileId != (size_t)-1) {
-        auto res = zip->GetFileDataById(data.fileId);
-        data.base.len = res.size();
-        data.base.data = (char*)res.data();
-        if (data.base.data) {
-            data.fileName = str::Dup(url);
-            images.Append(data);
-            return &images.Last().base;
-        }
+    ScopedCritSec zipScope(&zipAccess);
+    size_t fileId = zip->GetFileId(url);
+    if (fileId == (size_t)-1) {
+        return nullptr;
+    }
+    auto res = zip->GetFileDataById(fileId);
+    if (!res.data()) {
+        return nullptr;
     }
 
-    return nullptr;
+    ScopedCritSec scope(&imagesAccess);
+    // another thread might have added the image in the meantime
+    if (imagesByPath->Get(url, &idx)) {
+        free((void*)res.data());
+        return &images.at(idx).base;
+    }
+    ImageData2 data = {0};
+    data.fileId = fileId;
+    data.base.len = res.size();
+    data.base.data = (char*)res.data();
+    data.fileName = str::Dup(url);
+    imagesByPath->Insert(url, images.isize());
+    images.Append(data);
+    return &images.Last().base;
 }
 
 std::string_view EpubDoc::GetFileData(const char* relPath, const char* pagePath) {
@@ -710,6 +859,10 @@ bool EpubDoc::IsSupportedFile(const WCHAR* fileName, bool sniff) {
     if (!sniff) {
         return str::EndsWithI(fileName, L".epub");
     }
+    // don't try to open files that aren't ZIP archives
+    if (!str::StartsWith(ReadFileHeader(fileName), "PK\x03\x04")) {
+        return false;
+    }
     AutoDelete<MultiFormatArchive> archive = OpenZipArchive(fileName, true);
     if (!archive.get()) {
         return false;
@@ -761,17 +914,25 @@ const char* FB2_MAIN_NS = "http://www.gribuser.ru/xml/fictionbook/2.0";
 const char* FB2_XLINK_NS = "http://www.w3.org/1999/xlink";
 
 Fb2Doc::Fb2Doc(const WCHAR* fileName) : fileName(str::Dup(fileName)), stream(nullptr), isZipped(false), hasToc(false) {
+    InitializeCriticalSection(&imagesAccess);
+    imagesByName = new dict::MapStrToInt();
 }
 
 Fb2Doc::Fb2Doc(IStream* stream) : fileName(nullptr), stream(stream), isZipped(false), hasToc(false) {
+    InitializeCriticalSection(&imagesAccess);
+    imagesByName = new dict::MapStrToInt();
     stream->AddRef();
 }
 
 Fb2Doc::~Fb2Doc() {
+    EnterCriticalSection(&imagesAccess);
     for (size_t i = 0; i < images.size(); i++) {
         free(images.at(i).base.data);
         free(images.at(i).fileName);
     }
+    delete imagesByName;
+    LeaveCriticalSection(&imagesAccess);
+    DeleteCriticalSection(&imagesAccess);
     if (stream)
         stream->Release();
 }
@@ -928,6 +1089,10 @@ bool Fb2Doc::Load() {
             ExtractImage(&parser, tok);
     }
 
+    // images point into the file's data
+    if (images.size() > 0) {
+        fileData = std::move(data);
+    }
     return xmlData.size() > 0;
 }
 
@@ -943,13 +1108,13 @@ void Fb2Doc::ExtractImage(HtmlPullParser* parser, HtmlToken* tok) {
     if (!tok || !tok->IsText())
         return;
 
+    // decoding is delayed until the image is needed (cf. GetImageData)
     ImageData2 data = {0};
-    data.base.data = Base64Decode(tok->s, tok->sLen, &data.base.len);
-    if (!data.base.data)
-        return;
     data.fileName = str::Join("#", id);
     data.fileId = images.size();
+    imagesByName->Insert(data.fileName, (int)data.fileId);
     images.Append(data);
+    imagesBase64.Append({tok->s, tok->sLen});
 }
 
 std::string_view Fb2Doc::GetXmlData() const {
@@ -966,11 +1131,19 @@ size_t Fb2Doc::GetXmlDataSize() const {
 }
 
 ImageData* Fb2Doc::GetImageData(const char* fileName) {
-    for (size_t i = 0; i < images.size(); i++) {
-        if (str::Eq(images.at(i).fileName, fileName))
-            return &images.at(i).base;
+    ScopedCritSec scope(&imagesAccess);
+
+    int idx;
+    if (!fileName || !imagesByName->Get(fileName, &idx))
+        return nullptr;
+    ImageData2* img = &images.at(idx);
+    if (!img->base.data) {
+        std::string_view base64 = imagesBase64.at(idx);
+        img->base.data = Base64Decode(base64.data(), base64.size(), &img->base.len);
     }
-    return nullptr;
+    if (!img->base.data)
+        return nullptr;
+    return &img->base;
 }
 
 ImageData* Fb2Doc::GetCoverImage() {
@@ -1212,13 +1385,12 @@ bool PalmDoc::IsSupportedFile(const WCHAR* fileName, bool sniff) {
         return isPdb || isPrc;
     }
 
-    PdbReader pdbReader;
-    auto data = file::ReadFile(fileName);
-    if (!pdbReader.Parse(data)) {
+    PdbHeader hdr;
+    if (!PdbReader::ParseHeaderOnly(ReadFileHeader(fileName), &hdr)) {
         return false;
     }
 
-    const char* kind = pdbReader.GetDbType();
+    const char* kind = hdr.typeCreator;
     return str::Eq(kind, "TEXtREAd") || str::Eq(kind, "TEXtTlDc");
 }
 
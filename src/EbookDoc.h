@@ -3,6 +3,9 @@
 
 class HtmlPullParser;
 struct HtmlToken;
+namespace dict {
+class MapStrToInt;
+}
 
 char* NormalizeURL(const char* url, const char* base);
 
@@ -21,11 +24,25 @@ class PropertyMap {
 class EpubDoc {
     MultiFormatArchive* zip = nullptr;
     // zip and images are the only mutable members of EpubDoc after initialization;
-    // access to them must be serialized for multi-threaded users (such as EbookController)
+    // access to them must be serialized for multi-threaded users (such as EbookController).
+    // zipAccess is held while decompressing, imagesAccess only briefly for accessing
+    // images (so that already loaded images can be returned in the meantime).
+    // zipAccess must be acquired first when both are needed
     CRITICAL_SECTION zipAccess;
+    CRITICAL_SECTION imagesAccess;
 
     str::Str htmlData;
+    // offsets into htmlData at which the spine's documents start
+    Vec<int> sectionStarts;
     Vec<ImageData2> images;
+    // maps the normalized path of an image to its index in images
+    dict::MapStrToInt* imagesByPath = nullptr;
+    // the images following the most recently requested one are
+    // decompressed ahead of time on a background thread
+    HANDLE prefetchThread = nullptr;
+    bool prefetchRunning = false;
+    bool prefetchCanceled = false;
+    int prefetchStart = 0;
     AutoFreeWstr tocPath;
     AutoFreeWstr fileName;
     PropertyMap props;
@@ -37,12 +54,18 @@ class EpubDoc {
     bool ParseNavToc(const char* data, size_t dataLen, const char* pagePath, EbookTocVisitor* visitor);
     bool ParseNcxToc(const char* data, size_t dataLen, const char* pagePath, EbookTocVisitor* visitor);
 
+    ImageData* LoadImage(int idx);
+    void StartPrefetching(int nextIdx);
+    static DWORD WINAPI PrefetchImagesThread(LPVOID data);
+
   public:
     explicit EpubDoc(const WCHAR* fileName);
     explicit EpubDoc(IStream* stream);
     ~EpubDoc();
 
     std::string_view GetHtmlData() const;
+    // every section starts on a new page, so they can be laid out independently
+    const Vec<int>& GetSectionStarts() const;
 
     ImageData* GetImageData(const char* id, const char* pagePath);
     std::string_view GetFileData(const char* relPath, const char* pagePath);
@@ -69,7 +92,16 @@ class Fb2Doc {
     IStream* stream = nullptr;
 
     str::Str xmlData;
+    // images are only decoded when they're first needed; access to them must
+    // be serialized for multi-threaded users (such as EbookController)
+    CRITICAL_SECTION imagesAccess;
     Vec<ImageData2> images;
+    // base64 encoded data of images (pointing into fileData)
+    Vec<std::string_view> imagesBase64;
+    // maps an image name to its index in images
+    dict::MapStrToInt* imagesByName = nullptr;
+    // the file's content (only kept if it contains images)
+    AutoFree fileData;
     AutoFree coverImage;
     PropertyMap props;
     bool isZipped = false;
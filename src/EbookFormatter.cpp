@@ -129,6 +129,24 @@ void MobiFormatter::HandleHtmlTag(HtmlToken* t) {
 
 /* EPUB-specific formatting methods */
 
+EpubFormatter::EpubFormatter(HtmlFormatterArgs* args, EpubDoc* doc)
+    : HtmlFormatter(args), epubDoc(doc), hiddenDepth(0) {
+    ReparseData* rd = GetReparseData(args);
+    if (rd) {
+        pagePath.SetCopy(rd->pagePath);
+        hiddenDepth = rd->hiddenDepth;
+    }
+    UpdateInitialReparseData();
+}
+
+void EpubFormatter::SaveReparseData(ReparseData* rd) {
+    // this is called for every token and the path rarely changes
+    if (!str::Eq(rd->pagePath, pagePath)) {
+        rd->pagePath.SetCopy(pagePath);
+    }
+    rd->hiddenDepth = hiddenDepth;
+}
+
 void EpubFormatter::HandleTagImg(HtmlToken* t) {
     CrashIf(!epubDoc);
     if (t->IsEndTag())
@@ -154,7 +172,7 @@ void EpubFormatter::HandleTagPagebreak(HtmlToken* t) {
         currPage->instructions.Append(DrawInstr::Anchor(attr->val, attr->valLen, bbox));
         pagePath.Set(str::DupN(attr->val, attr->valLen));
         // reset CSS style rules for the new document
-        styleRules.Reset();
+        ResetStyleRules();
     }
 }
 
@@ -225,6 +243,12 @@ bool EpubFormatter::IgnoreText() {
 
 Fb2Formatter::Fb2Formatter(HtmlFormatterArgs* args, Fb2Doc* doc)
     : HtmlFormatter(args), fb2Doc(doc), section(1), titleCount(0) {
+    ReparseData* rd = GetReparseData(args);
+    if (rd) {
+        section = rd->section;
+        titleCount = rd->titleCount;
+    }
+    UpdateInitialReparseData();
     if (args->reparseIdx != 0)
         return;
     ImageData* cover = doc->GetCoverImage();
@@ -262,6 +286,11 @@ void Fb2Formatter::HandleTagAsHtml(HtmlToken* t, const char* name) {
     HtmlFormatter::HandleHtmlTag(&tok);
 }
 
+void Fb2Formatter::SaveReparseData(ReparseData* rd) {
+    rd->section = section;
+    rd->titleCount = titleCount;
+}
+
 // the name doesn't quite fit: this handles FB2 tags
 void Fb2Formatter::HandleHtmlTag(HtmlToken* t) {
     if (Tag_Title == t->tag || Tag_Subtitle == t->tag) {
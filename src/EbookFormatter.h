@@ -28,6 +28,7 @@ class EpubFormatter : public HtmlFormatter {
     virtual void HandleTagLink(HtmlToken* t);
     virtual void HandleHtmlTag(HtmlToken* t);
     virtual bool IgnoreText();
+    virtual void SaveReparseData(ReparseData* rd);
 
     void HandleTagSvgImage(HtmlToken* t);
 
@@ -36,8 +37,7 @@ class EpubFormatter : public HtmlFormatter {
     size_t hiddenDepth;
 
   public:
-    EpubFormatter(HtmlFormatterArgs* args, EpubDoc* doc) : HtmlFormatter(args), epubDoc(doc), hiddenDepth(0) {
-    }
+    EpubFormatter(HtmlFormatterArgs* args, EpubDoc* doc);
 };
 
 /* formatting extensions for FictionBook */
@@ -55,6 +55,7 @@ class Fb2Formatter : public HtmlFormatter {
     virtual bool IgnoreText() {
         return false;
     }
+    virtual void SaveReparseData(ReparseData* rd);
 
     Fb2Doc* fb2Doc;
 
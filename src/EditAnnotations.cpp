@@ -12,6 +12,7 @@ extern "C" {
 #include "utils/LogDbg.h"
 #include "utils/FileUtil.h"
 #include "utils/ScopedWin.h"
+#include "utils/UITask.h"
 #include "utils/WinUtil.h"
 #include "utils/Dpi.h"
 
@@ -37,8 +38,10 @@ extern "C" {
 #include "DisplayModel.h"
 #include "ProgressUpdateUI.h"
 #include "Notifications.h"
+#include "SumatraPDF.h"
 #include "WindowInfo.h"
 #include "TabInfo.h"
+#include "Translations.h"
 #include "EditAnnotations.h"
 
 using std::placeholders::_1;
@@ -218,8 +221,16 @@ static void ButtonSavePDFHandler(EditAnnotationsWindow* w) {
         // ask the user to select a new name
     }
     EngineBase* engine = w->tab->AsFixed()->GetEngine();
-    EnginePdfSaveUpdated(engine, dstFilePath);
-    // TODO: show a notification if saved or error message if failed to save
+    WindowInfo* win = w->tab->win;
+    // saving large documents can take a while
+    EnginePdfSaveUpdatedAsync(engine, dstFilePath, [win](bool ok) {
+        uitask::Post([win, ok] {
+            if (!WindowInfoStillValid(win)) {
+                return;
+            }
+            win->ShowNotification(ok ? _TR("Saved annotations") : _TR("Failed to save annotations"));
+        });
+    });
 }
 
 void ShowAnnotationRect(EditAnnotationsWindow* w, Annotation* annot) {
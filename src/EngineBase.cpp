@@ -12,7 +12,19 @@
 #include "Annotation.h"
 #include "EngineBase.h"
 
+MemCounter gRenderedBitmapMem;
+
+RenderedBitmap::RenderedBitmap(HBITMAP hbmp, ::Size size, HANDLE hMap) : hbmp(hbmp), size(size), hMap(hMap) {
+    MemCounterAlloc(gRenderedBitmapMem, (size_t)size.dx * size.dy * 4);
+}
+
 RenderedBitmap::~RenderedBitmap() {
+    MemCounterFree(gRenderedBitmapMem, (size_t)size.dx * size.dy * 4);
+    // the next bitmap of the same size gets rendered into this one's memory
+    if (ReturnToBitmapPool(hbmp, hMap)) {
+        hMap.Detach();
+        return;
+    }
     DeleteObject(hbmp);
 }
 
@@ -176,6 +188,7 @@ PageElement* clonePageElement(PageElement* el) {
     res->kind = el->kind;
     res->pageNo = el->pageNo;
     res->rect = el->rect;
+    res->imageID = el->imageID;
     res->value = str::Dup(el->value);
     res->dest = clonePageDestination(el->dest);
     return res;
@@ -444,6 +457,7 @@ RenderPageArgs::RenderPageArgs(int pageNo, float zoom, int rotation, RectD* page
 
 EngineBase::~EngineBase() {
     free(decryptionKey);
+    delete userAnnotsIndex;
 }
 
 int EngineBase::PageCount() const {
@@ -456,6 +470,24 @@ RectD EngineBase::PageContentBox(int pageNo, RenderTarget target) {
     return PageMediabox(pageNo);
 }
 
+bool EngineBase::HasPendingPageSizes() {
+    return false;
+}
+
+int EngineBase::FinalPageSizesCount() {
+    return PageCount();
+}
+
+bool EngineBase::WaitForPageData(int pageNo, DWORD timeoutMs) {
+    UNUSED(pageNo);
+    UNUSED(timeoutMs);
+    return false;
+}
+
+bool EngineBase::RenderPageToDC(HDC, RenderPageArgs&, Point) {
+    return false;
+}
+
 bool EngineBase::SaveFileAsPDF(const char* pdfFileName, bool includeUserAnnots) {
     UNUSED(pdfFileName);
     UNUSED(includeUserAnnots);
@@ -486,6 +518,10 @@ int EngineBase::GetAnnotations(Vec<Annotation*>* annotsOut) {
 void EngineBase::SetUserAnnotations(Vec<Annotation*>* annots) {
     // owned by DisplayModel
     userAnnots = annots;
+    if (!userAnnotsIndex) {
+        userAnnotsIndex = new AnnotationsIndex();
+    }
+    userAnnotsIndex->Reset(annots);
 }
 
 PageDestination* EngineBase::GetNamedDest(const WCHAR* name) {
@@ -526,6 +562,16 @@ const WCHAR* EngineBase::FileName() const {
     return fileNameBase.get();
 }
 
+bool EngineBase::GetPageFingerprint(int pageNo, u8 digestOut[16]) {
+    UNUSED(pageNo);
+    UNUSED(digestOut);
+    return false;
+}
+
+void EngineBase::FreeCachedPages() {
+    // nothing to free by default
+}
+
 RenderedBitmap* EngineBase::GetImageForPageElement(PageElement*) {
     CrashMe();
     return nullptr;
@@ -539,3 +585,25 @@ PointD EngineBase::Transform(PointD pt, int pageNo, float zoom, int rotation, bo
     RectD rect = Transform(RectD(pt, SizeD()), pageNo, zoom, rotation, inverse);
     return PointD(rect.x, rect.y);
 }
+
+static bool HasUserAnnotsOnPage(EngineBase* engine, int pageNo) {
+    if (!engine->userAnnots || !engine->userAnnotsIndex) {
+        return false;
+    }
+    return engine->userAnnotsIndex->HasAnnotationsOnPage(pageNo);
+}
+
+bool IsPageUnchanged(EngineBase* oldEngine, EngineBase* newEngine, int pageNo) {
+    if (pageNo < 1 || pageNo > oldEngine->PageCount() || pageNo > newEngine->PageCount()) {
+        return false;
+    }
+    // these are rendered by the engine but not part of the fingerprint
+    if (HasUserAnnotsOnPage(oldEngine, pageNo) || HasUserAnnotsOnPage(newEngine, pageNo)) {
+        return false;
+    }
+    u8 oldDigest[16], newDigest[16];
+    if (!oldEngine->GetPageFingerprint(pageNo, oldDigest) || !newEngine->GetPageFingerprint(pageNo, newDigest)) {
+        return false;
+    }
+    return memeq(oldDigest, newDigest, sizeof(oldDigest));
+}
@@ -18,7 +18,13 @@ extern Kind kindEngineHtml;
 extern Kind kindEngineTxt;
 
 /* certain OCGs will only be rendered for some of these (e.g. watermarks) */
-enum class RenderTarget { View, Print, Export };
+// Preview is for quickly rendered low quality bitmaps, shown
+// until the page has been rendered for View
+enum class RenderTarget { View, Print, Export, Preview };
+
+// Draft is for rendering as quickly as possible while the view is about to change
+// anyway (no anti-aliasing and no transparency groups for annotations)
+enum class RenderQuality { Normal, Draft };
 
 enum PageLayoutType {
     Layout_Single = 0,
@@ -49,8 +55,7 @@ class RenderedBitmap {
     Size size = {};
     AutoCloseHandle hMap = {};
 
-    RenderedBitmap(HBITMAP hbmp, Size size, HANDLE hMap = nullptr) : hbmp(hbmp), size(size), hMap(hMap) {
-    }
+    RenderedBitmap(HBITMAP hbmp, Size size, HANDLE hMap = nullptr);
     ~RenderedBitmap();
     RenderedBitmap* Clone() const;
     HBITMAP GetBitmap() const;
@@ -58,6 +63,9 @@ class RenderedBitmap {
     bool StretchDIBits(HDC hdc, Rect target) const;
 };
 
+// all live RenderedBitmaps (assuming 4 bytes per pixel)
+extern MemCounter gRenderedBitmapMem;
+
 extern Kind kindDestinationNone;
 extern Kind kindDestinationScrollTo;
 extern Kind kindDestinationLaunchURL;
@@ -263,7 +271,11 @@ struct RenderPageArgs {
     /* if nullptr: defaults to the page's mediabox */
     RectD* pageRect = nullptr;
     RenderTarget target = RenderTarget::View;
+    RenderQuality quality = RenderQuality::Normal;
     AbortCookie** cookie_out = nullptr;
+    // user annotations are painted as an overlay by the canvas, so that
+    // changing them doesn't require re-rendering the page (cf. PaintUserAnnotations)
+    bool skipUserAnnots = false;
 
     RenderPageArgs(int pageNo, float zoom, int rotation, RectD* pageRect = nullptr,
                    RenderTarget target = RenderTarget::View, AbortCookie** cookie_out = nullptr);
@@ -293,6 +305,8 @@ class EngineBase {
     // annotations from .smx file and added by the user
     // owned by DisplayModel
     Vec<Annotation*>* userAnnots = nullptr;
+    // userAnnots by page
+    AnnotationsIndex* userAnnotsIndex = nullptr;
 
     // TODO: migrate other engines to use this
     AutoFreeWstr fileNameBase;
@@ -309,10 +323,24 @@ class EngineBase {
     // the box inside PageMediabox that actually contains any relevant content
     // (used for auto-cropping in Fit Content mode, can be PageMediabox)
     virtual RectD PageContentBox(int pageNo, RenderTarget target = RenderTarget::View);
+    // true while the sizes of some pages are still being determined in the background
+    // (PageMediabox returns an estimate for these pages until then)
+    virtual bool HasPendingPageSizes();
+    // the sizes of the pages up to this one are final (pages after it might
+    // already have their final size as well, e.g. once they've been rendered)
+    virtual int FinalPageSizesCount();
+    // for documents which are still being read (e.g. from a network drive): returns
+    // true if a page can't be used yet and should be requested again later
+    // (after having waited up to timeoutMs for more of the document to arrive)
+    virtual bool WaitForPageData(int pageNo, DWORD timeoutMs);
 
     // renders a page into a cacheable RenderedBitmap
     // (*cookie_out must be deleted after the call returns)
     virtual RenderedBitmap* RenderPage(RenderPageArgs& args) = 0;
+    // draws a page as vector graphics to a device context (e.g. for printing) with
+    // the top-left corner of the rendered area at offset. returns false without
+    // having drawn anything if that isn't possible (use RenderPage instead then)
+    virtual bool RenderPageToDC(HDC hdc, RenderPageArgs& args, Point offset);
 
     // applies zoom and rotation to a point in user/page space converting
     // it into device/screen space - or in the inverse direction
@@ -405,6 +433,15 @@ class EngineBase {
     // without also measuring rendering times
     virtual bool BenchLoadPage(int pageNo) = 0;
 
+    // a hash of everything that determines how a page looks and which text it contains,
+    // for finding the pages that haven't changed when a document is reloaded
+    // returns false if this isn't supported for the document type
+    virtual bool GetPageFingerprint(int pageNo, u8 digestOut[16]);
+
+    // frees the pages that have been loaded along with what's been cached for
+    // rendering them and extracting their text (all of it is loaded again when needed)
+    virtual void FreeCachedPages();
+
     // the name of the file this engine handles
     const WCHAR* FileName() const;
 
@@ -414,10 +451,20 @@ class EngineBase {
     void SetFileName(const WCHAR* s);
 };
 
+// true if page pageNo looks the same in both engines (which are usually for
+// two versions of the same file), as far as GetPageFingerprint can tell
+bool IsPageUnchanged(EngineBase* oldEngine, EngineBase* newEngine, int pageNo);
+
 class PasswordUI {
   public:
     virtual WCHAR* GetPassword(const WCHAR* fileName, unsigned char* fileDigest, unsigned char decryptionKeyOut[32],
                                bool* saveKey) = 0;
+    // called while a broken document is being repaired (which can take a while
+    // for larger files), loading is canceled if this returns false
+    virtual bool UpdateRepairProgress(int percent) {
+        UNUSED(percent);
+        return true;
+    }
     virtual ~PasswordUI() {
     }
 };
@@ -10,6 +10,7 @@
 #include <miniexp.h>
 #include "utils/ByteReader.h"
 #include "utils/FileUtil.h"
+#include "utils/FileTypeSniff.h"
 #include "utils/WinUtil.h"
 #include "utils/ScopedWin.h"
 #include "utils/Log.h"
@@ -126,9 +127,11 @@ static TocItem* newDjVuTocItem(TocItem* parent, const char* title, const char* l
     return res;
 }
 
+// each document has its own context (with its own message queue), so that
+// documents don't have to wait for each other while being rendered
+// (miniexp, which is shared by all contexts, does its own locking)
 struct DjVuContext {
     ddjvu_context_t* ctx = nullptr;
-    int refCount = 1;
     CRITICAL_SECTION lock;
 
     DjVuContext() {
@@ -139,22 +142,6 @@ struct DjVuContext {
         CrashIf(!ctx);
     }
 
-    int AddRef() {
-        EnterCriticalSection(&lock);
-        ++refCount;
-        int res = refCount;
-        LeaveCriticalSection(&lock);
-        return res;
-    }
-
-    int Release() {
-        EnterCriticalSection(&lock);
-        CrashIf(refCount <= 0);
-        --refCount;
-        LeaveCriticalSection(&lock);
-        return refCount;
-    }
-
     ~DjVuContext() {
         EnterCriticalSection(&lock);
         if (ctx) {
@@ -201,36 +188,18 @@ struct DjVuContext {
     }
 };
 
-// TODO: make it non-static because it accesses other static state
-// in djvu which got deleted first
-static DjVuContext* gDjVuContext;
-
-static DjVuContext* GetDjVuContext() {
-    if (!gDjVuContext) {
-        gDjVuContext = new DjVuContext();
-    } else {
-        gDjVuContext->AddRef();
-    }
-    return gDjVuContext;
-}
-
-static void ReleaseDjVuContext() {
-    CrashIf(!gDjVuContext);
-    int refCount = gDjVuContext->Release();
-    if (refCount != 0) {
-        return;
-    }
-}
-
 void CleanupDjVuEngine() {
-    if (gDjVuContext) {
-        CrashIf(gDjVuContext->refCount != 0);
-        delete gDjVuContext;
-        gDjVuContext = nullptr;
-    }
     minilisp_finish();
 }
 
+// number of decoded pages kept per document
+#define DJVU_DECODED_PAGES_CACHE_SIZE 3
+
+struct DecodedDjVuPage {
+    int pageNo;
+    ddjvu_page_t* page;
+};
+
 class EngineDjVu : public EngineBase {
   public:
     EngineDjVu();
@@ -239,6 +208,10 @@ class EngineDjVu : public EngineBase {
 
     RectD PageMediabox(int pageNo) override;
     RectD PageContentBox(int pageNo, RenderTarget target = RenderTarget::View) override;
+    bool HasPendingPageSizes() override;
+    int FinalPageSizesCount() override;
+    // called on pageSizesThread
+    void ResolvePageSizes();
 
     RenderedBitmap* RenderPage(RenderPageArgs&) override;
 
@@ -270,7 +243,25 @@ class EngineDjVu : public EngineBase {
   protected:
     IStream* stream = nullptr;
 
+    // access to doc (and everything derived from it) is protected by djvu->lock
+    DjVuContext* djvu = nullptr;
+
+    // mediaboxes (and whether they're still estimated) are
+    // protected by mediaboxAccess instead of djvu->lock, so that
+    // PageMediabox doesn't have to wait for pages being rendered
+    CRITICAL_SECTION mediaboxAccess;
     RectD* mediaboxes = nullptr;
+    bool* mediaboxesEstimated = nullptr;
+    // the resolution of the pages (0 if unknown), so that text and links
+    // needn't call ddjvu_document_get_pageinfo for converting coordinates
+    int* pageDpis = nullptr;
+
+    HANDLE pageSizesThread = nullptr;
+    bool pageSizesPending = false;
+    bool abortPageSizes = false;
+    // the sizes of the first nFinalPageSizes pages have been determined
+    // (protected by mediaboxAccess)
+    int nFinalPageSizes = 0;
 
     ddjvu_document_t* doc = nullptr;
     miniexp_t outline = miniexp_nil;
@@ -279,7 +270,15 @@ class EngineDjVu : public EngineBase {
 
     Vec<ddjvu_fileinfo_t> fileInfos;
 
-    RenderedBitmap* CreateRenderedBitmap(const char* bmpData, Size size, bool grayscale) const;
+    // the most recently used pages (most recent first) remain decoded, so that
+    // pages needn't be decoded again e.g. when rendered at a different zoom level
+    // and so that components shared between consecutive pages (e.g. JB2 shape
+    // dictionaries) are found by libdjvu instead of being decoded for every page
+    // (libdjvu's own cache remains disabled, cf. DjVuContext::OpenFile)
+    Vec<DecodedDjVuPage> decodedPages;
+
+    ddjvu_page_t* GetDecodedPage(int pageNo);
+    HBITMAP CreateRenderBitmap(Size size, bool grayscale, HANDLE* hMapOut, void** dataOut) const;
     void DrawUserAnnots(RenderedBitmap* bmp, int pageNo, float zoom, int rotation, Rect screen);
     bool ExtractPageText(miniexp_t item, str::WStr& extracted, Vec<Rect>& coords);
     char* ResolveNamedDest(const char* name);
@@ -288,6 +287,8 @@ class EngineDjVu : public EngineBase {
     bool Load(IStream* stream);
     bool FinishLoading();
     bool LoadMediaboxes();
+    void ResolvePageSize(int pageNo);
+    float GetDpiFactor(int pageNo);
 };
 
 EngineDjVu::EngineDjVu() {
@@ -297,15 +298,27 @@ EngineDjVu::EngineDjVu() {
     fileDPI = 300.0f;
     supportsAnnotations = true;
     supportsAnnotationsForSaving = false;
-    GetDjVuContext();
+    djvu = new DjVuContext();
+    InitializeCriticalSection(&mediaboxAccess);
 }
 
 EngineDjVu::~EngineDjVu() {
-    ScopedCritSec scope(&gDjVuContext->lock);
+    if (pageSizesThread) {
+        abortPageSizes = true;
+        WaitForSingleObject(pageSizesThread, INFINITE);
+        CloseHandle(pageSizesThread);
+    }
+
+    EnterCriticalSection(&djvu->lock);
 
     delete tocTree;
     free(mediaboxes);
+    free(mediaboxesEstimated);
+    free(pageDpis);
 
+    for (DecodedDjVuPage& decoded : decodedPages) {
+        ddjvu_page_release(decoded.page);
+    }
     if (annos) {
         for (int i = 0; i < pageCount; i++) {
             if (annos[i]) {
@@ -323,7 +336,10 @@ EngineDjVu::~EngineDjVu() {
     if (stream) {
         stream->Release();
     }
-    ReleaseDjVuContext();
+
+    LeaveCriticalSection(&djvu->lock);
+    delete djvu;
+    DeleteCriticalSection(&mediaboxAccess);
 }
 
 EngineBase* EngineDjVu::Clone() {
@@ -338,9 +354,81 @@ EngineBase* EngineDjVu::Clone() {
 
 RectD EngineDjVu::PageMediabox(int pageNo) {
     CrashIf(pageNo < 1 || pageNo > pageCount);
+    ScopedCritSec scope(&mediaboxAccess);
     return mediaboxes[pageNo - 1];
 }
 
+bool EngineDjVu::HasPendingPageSizes() {
+    ScopedCritSec scope(&mediaboxAccess);
+    return pageSizesPending;
+}
+
+int EngineDjVu::FinalPageSizesCount() {
+    ScopedCritSec scope(&mediaboxAccess);
+    return pageSizesPending ? nFinalPageSizes : pageCount;
+}
+
+// Note: make sure to only call with djvu->lock
+void EngineDjVu::ResolvePageSize(int pageNo) {
+    {
+        ScopedCritSec scope(&mediaboxAccess);
+        if (!mediaboxesEstimated || !mediaboxesEstimated[pageNo - 1]) {
+            return;
+        }
+    }
+    RectD mbox;
+    ddjvu_status_t status;
+    ddjvu_pageinfo_t info;
+    while ((status = ddjvu_document_get_pageinfo(doc, pageNo - 1, &info)) < DDJVU_JOB_OK) {
+        djvu->SpinMessageLoop();
+    }
+    int dpi = 0;
+    if (DDJVU_JOB_OK == status) {
+        double dx = info.width * GetFileDPI() / info.dpi;
+        double dy = info.height * GetFileDPI() / info.dpi;
+        mbox = RectD(0, 0, dx, dy);
+        dpi = info.dpi;
+    }
+    ScopedCritSec scope(&mediaboxAccess);
+    mediaboxes[pageNo - 1] = mbox;
+    pageDpis[pageNo - 1] = dpi;
+    mediaboxesEstimated[pageNo - 1] = false;
+}
+
+// for converting from the page's to the engine's coordinates
+float EngineDjVu::GetDpiFactor(int pageNo) {
+    ScopedCritSec scope(&mediaboxAccess);
+    int dpi = pageDpis[pageNo - 1];
+    return dpi > 0 ? GetFileDPI() / dpi : 1.0f;
+}
+
+// determines the sizes of the pages which were only estimated in FinishLoading
+// (DisplayModel::UpdatePageSizes picks them up while HasPendingPageSizes)
+void EngineDjVu::ResolvePageSizes() {
+    int first;
+    {
+        ScopedCritSec scope(&mediaboxAccess);
+        first = nFinalPageSizes + 1;
+    }
+    for (int pageNo = first; pageNo <= pageCount && !abortPageSizes; pageNo++) {
+        // release djvu->lock after every page so that rendering isn't held up
+        {
+            ScopedCritSec scope(&djvu->lock);
+            ResolvePageSize(pageNo);
+        }
+        ScopedCritSec scope(&mediaboxAccess);
+        nFinalPageSizes = pageNo;
+    }
+    ScopedCritSec scope(&mediaboxAccess);
+    pageSizesPending = false;
+}
+
+static DWORD WINAPI ResolvePageSizesThread(LPVOID data) {
+    EngineDjVu* engine = (EngineDjVu*)data;
+    engine->ResolvePageSizes();
+    return 0;
+}
+
 bool EngineDjVu::HasClipOptimizations(int pageNo) {
     UNUSED(pageNo);
     return false;
@@ -426,6 +514,7 @@ bool EngineDjVu::LoadMediaboxes() {
             if (dpi < 25 || 6000 < dpi) {
                 dpi = 300;
             }
+            pageDpis[pages] = dpi;
             mediaboxes[pages].dx = GetFileDPI() * info.width / dpi;
             mediaboxes[pages].dy = GetFileDPI() * info.height / dpi;
             if ((info.flags & 4)) {
@@ -441,12 +530,12 @@ bool EngineDjVu::LoadMediaboxes() {
 
 bool EngineDjVu::Load(const WCHAR* fileName) {
     SetFileName(fileName);
-    doc = gDjVuContext->OpenFile(fileName);
+    doc = djvu->OpenFile(fileName);
     return FinishLoading();
 }
 
 bool EngineDjVu::Load(IStream* stream) {
-    doc = gDjVuContext->OpenStream(stream);
+    doc = djvu->OpenStream(stream);
     return FinishLoading();
 }
 
@@ -455,10 +544,10 @@ bool EngineDjVu::FinishLoading() {
         return false;
     }
 
-    ScopedCritSec scope(&gDjVuContext->lock);
+    ScopedCritSec scope(&djvu->lock);
 
     while (!ddjvu_document_decoding_done(doc)) {
-        gDjVuContext->SpinMessageLoop();
+        djvu->SpinMessageLoop();
     }
 
     if (ddjvu_document_decoding_error(doc)) {
@@ -471,19 +560,32 @@ bool EngineDjVu::FinishLoading() {
     }
 
     mediaboxes = AllocArray<RectD>(pageCount);
+    pageDpis = AllocArray<int>(pageCount);
     bool ok = LoadMediaboxes();
     if (!ok) {
-        // fall back to the slower but safer way to extract page mediaboxes
+        ZeroMemory(pageDpis, pageCount * sizeof(int));
+        // fall back to the slower but safer way to extract page mediaboxes.
+        // for indirect and bundled documents with many pages, this takes
+        // seconds, so the other pages are assumed to be as large as the
+        // first one until their sizes have been determined in the
+        // background (or the page is rendered)
+        mediaboxesEstimated = AllocArray<bool>(pageCount);
         for (int i = 0; i < pageCount; i++) {
-            ddjvu_status_t status;
-            ddjvu_pageinfo_t info;
-            while ((status = ddjvu_document_get_pageinfo(doc, i, &info)) < DDJVU_JOB_OK) {
-                gDjVuContext->SpinMessageLoop();
-            }
-            if (DDJVU_JOB_OK == status) {
-                double dx = info.width * GetFileDPI() / info.dpi;
-                double dy = info.height * GetFileDPI() / info.dpi;
-                mediaboxes[i] = RectD(0, 0, dx, dy);
+            mediaboxesEstimated[i] = true;
+        }
+        ResolvePageSize(1);
+        nFinalPageSizes = 1;
+        for (int i = 1; i < pageCount; i++) {
+            mediaboxes[i] = mediaboxes[0];
+        }
+        if (pageCount > 1) {
+            pageSizesPending = true;
+            pageSizesThread = CreateThread(nullptr, 0, ResolvePageSizesThread, this, 0, 0);
+            if (!pageSizesThread) {
+                pageSizesPending = false;
+                for (int pageNo = 2; pageNo <= pageCount; pageNo++) {
+                    ResolvePageSize(pageNo);
+                }
             }
         }
     }
@@ -494,7 +596,7 @@ bool EngineDjVu::FinishLoading() {
     }
 
     while ((outline = ddjvu_document_get_outline(doc)) == miniexp_dummy) {
-        gDjVuContext->SpinMessageLoop();
+        djvu->SpinMessageLoop();
     }
     if (!miniexp_consp(outline) || miniexp_car(outline) != miniexp_symbol("bookmarks")) {
         ddjvu_miniexp_release(doc, outline);
@@ -506,7 +608,7 @@ bool EngineDjVu::FinishLoading() {
         ddjvu_status_t status;
         ddjvu_fileinfo_s info;
         while ((status = ddjvu_document_get_fileinfo(doc, i, &info)) < DDJVU_JOB_OK) {
-            gDjVuContext->SpinMessageLoop();
+            djvu->SpinMessageLoop();
         }
         if (DDJVU_JOB_OK == status && info.type == 'P' && info.pageno >= 0) {
             fileInfos.Append(info);
@@ -524,7 +626,11 @@ void EngineDjVu::DrawUserAnnots(RenderedBitmap* bmp, int pageNo, float zoom, int
         return;
     }
 
-    int n = userAnnots->isize();
+    Vec<Annotation*> annots = FilterAnnotationsForPage(userAnnotsIndex, pageNo);
+    if (annots.size() == 0) {
+        return;
+    }
+
     HDC hdc = CreateCompatibleDC(nullptr);
     {
         ScopedSelectObject bmpScope(hdc, bmp->GetBitmap());
@@ -532,14 +638,7 @@ void EngineDjVu::DrawUserAnnots(RenderedBitmap* bmp, int pageNo, float zoom, int
         g.SetCompositingQuality(CompositingQualityHighQuality);
         g.SetPageUnit(UnitPixel);
 
-        for (int i = 0; i < n; i++) {
-            Annotation* annot = userAnnots->at(i);
-            if (annot->isDeleted) {
-                continue;
-            }
-            if (annot->pageNo != pageNo) {
-                continue;
-            }
+        for (Annotation* annot : annots) {
             RectD rect = annot->Rect();
             RectD arect;
             switch (annot->type) {
@@ -582,8 +681,12 @@ void EngineDjVu::DrawUserAnnots(RenderedBitmap* bmp, int pageNo, float zoom, int
     DeleteDC(hdc);
 }
 
-RenderedBitmap* EngineDjVu::CreateRenderedBitmap(const char* bmpData, Size size, bool grayscale) const {
+// creates the DIB section that RenderPage renders into: 8-bit grayscale for
+// bitonal pages and 24-bit BGR for others (both match a ddjvu_format_t)
+HBITMAP EngineDjVu::CreateRenderBitmap(Size size, bool grayscale, HANDLE* hMapOut, void** dataOut) const {
     int stride = ((size.dx * (grayscale ? 1 : 3) + 3) / 4) * 4;
+    *hMapOut = nullptr;
+    *dataOut = nullptr;
 
     BITMAPINFO* bmi = (BITMAPINFO*)calloc(1, sizeof(BITMAPINFOHEADER) + (grayscale ? 256 * sizeof(RGBQUAD) : 0));
     if (!bmi) {
@@ -605,51 +708,73 @@ RenderedBitmap* EngineDjVu::CreateRenderedBitmap(const char* bmpData, Size size,
     bmi->bmiHeader.biSizeImage = size.dy * stride;
     bmi->bmiHeader.biClrUsed = grayscale ? 256 : 0;
 
-    void* data = nullptr;
-    HANDLE hMap =
+    *hMapOut =
         CreateFileMapping(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, bmi->bmiHeader.biSizeImage, nullptr);
-    HBITMAP hbmp = CreateDIBSection(nullptr, bmi, DIB_RGB_COLORS, &data, hMap, 0);
-    if (hbmp) {
-        memcpy(data, bmpData, bmi->bmiHeader.biSizeImage);
+    HBITMAP hbmp = CreateDIBSection(nullptr, bmi, DIB_RGB_COLORS, dataOut, *hMapOut, 0);
+    free(bmi);
+    if (hbmp && !*dataOut) {
+        DeleteObject(hbmp);
+        hbmp = nullptr;
     }
+    return hbmp;
+}
 
-    free(bmi);
+// Note: make sure to only call with djvu->lock
+// the returned page is owned by decodedPages
+ddjvu_page_t* EngineDjVu::GetDecodedPage(int pageNo) {
+    for (size_t i = 0; i < decodedPages.size(); i++) {
+        if (decodedPages.at(i).pageNo == pageNo) {
+            DecodedDjVuPage decoded = decodedPages.PopAt(i);
+            decodedPages.InsertAt(0, decoded);
+            return decoded.page;
+        }
+    }
+
+    ddjvu_page_t* page = ddjvu_page_create_by_pageno(doc, pageNo - 1);
+    if (!page) {
+        return nullptr;
+    }
+    while (!ddjvu_page_decoding_done(page)) {
+        djvu->SpinMessageLoop();
+    }
+    if (ddjvu_page_decoding_error(page)) {
+        ddjvu_page_release(page);
+        return nullptr;
+    }
 
-    return new RenderedBitmap(hbmp, size, hMap);
+    if (decodedPages.size() >= DJVU_DECODED_PAGES_CACHE_SIZE) {
+        ddjvu_page_release(decodedPages.Last().page);
+        decodedPages.RemoveLast();
+    }
+    decodedPages.InsertAt(0, {pageNo, page});
+    return page;
 }
 
 RenderedBitmap* EngineDjVu::RenderPage(RenderPageArgs& args) {
-    ScopedCritSec scope(&gDjVuContext->lock);
+    ScopedCritSec scope(&djvu->lock);
     auto pageRect = args.pageRect;
     auto zoom = args.zoom;
     auto pageNo = args.pageNo;
     auto rotation = args.rotation;
+    ResolvePageSize(pageNo);
     RectD pageRc = pageRect ? *pageRect : PageMediabox(pageNo);
     Rect screen = Transform(pageRc, pageNo, zoom, rotation).Round();
     Rect full = Transform(PageMediabox(pageNo), pageNo, zoom, rotation).Round();
     screen = full.Intersect(screen);
 
-    ddjvu_page_t* page = ddjvu_page_create_by_pageno(doc, pageNo - 1);
+    ddjvu_page_t* page = GetDecodedPage(pageNo);
     if (!page) {
         return nullptr;
     }
     int rotation4 = (((-rotation / 90) % 4) + 4) % 4;
     ddjvu_page_set_rotation(page, (ddjvu_page_rotation_t)rotation4);
 
-    while (!ddjvu_page_decoding_done(page)) {
-        gDjVuContext->SpinMessageLoop();
-    }
-    if (ddjvu_page_decoding_error(page)) {
-        return nullptr;
-    }
-
     bool isBitonal = DDJVU_PAGETYPE_BITONAL == ddjvu_page_get_type(page);
     ddjvu_format_style_t style = isBitonal ? DDJVU_FORMAT_GREY8 : DDJVU_FORMAT_BGR24;
     ddjvu_format_t* fmt = ddjvu_format_create(style, 0, nullptr);
 
     defer {
         ddjvu_format_release(fmt);
-        ddjvu_page_release(page);
     };
 
     int topToBottom = TRUE;
@@ -657,54 +782,50 @@ RenderedBitmap* EngineDjVu::RenderPage(RenderPageArgs& args) {
     ddjvu_rect_t prect = {full.x, full.y, full.dx, full.dy};
     ddjvu_rect_t rrect = {screen.x, 2 * full.y - screen.y + full.dy - screen.dy, screen.dx, screen.dy};
 
-    RenderedBitmap* bmp = nullptr;
+    // render directly into the memory of the resulting bitmap
+    // (whose rows are DWORD aligned, as expected by ddjvu_page_render)
     size_t bytesPerPixel = isBitonal ? 1 : 3;
     size_t dx = (size_t)screen.dx;
     size_t dy = (size_t)screen.dy;
     size_t stride = ((dx * bytesPerPixel + 3) / 4) * 4;
-    size_t nBytes = stride * (dy + 5);
-    AutoFree bmpData = AllocArray<char>(nBytes);
-    if (!bmpData) {
-        return nullptr;
+    HANDLE hMap = nullptr;
+    void* data = nullptr;
+    HBITMAP hbmp = CreateRenderBitmap(screen.Size(), isBitonal, &hMap, &data);
+    if (hbmp) {
+        ddjvu_render_mode_t mode = isBitonal ? DDJVU_RENDER_MASKONLY : DDJVU_RENDER_COLOR;
+        int ok = ddjvu_page_render(page, mode, &prect, &rrect, fmt, (unsigned long)stride, (char*)data);
+        if (!ok) {
+            // nothing was rendered, leave the page blank (same as WinDjView)
+            memset(data, 0xFF, stride * dy);
+        }
     }
-
-    ddjvu_render_mode_t mode = isBitonal ? DDJVU_RENDER_MASKONLY : DDJVU_RENDER_COLOR;
-    int ok = ddjvu_page_render(page, mode, &prect, &rrect, fmt, (unsigned long)stride, bmpData.Get());
-    if (!ok) {
-        // nothing was rendered, leave the page blank (same as WinDjView)
-        memset(bmpData, 0xFF, stride * dy);
-        isBitonal = true;
+    // return a RenderedBitmap even if hbmp is nullptr so that callers can
+    // distinguish rendering errors from GDI resource exhaustion
+    RenderedBitmap* bmp = new RenderedBitmap(hbmp, screen.Size(), hMap);
+    if (!args.skipUserAnnots) {
+        DrawUserAnnots(bmp, pageNo, zoom, rotation, screen);
     }
-    bmp = CreateRenderedBitmap(bmpData, screen.Size(), isBitonal);
-    DrawUserAnnots(bmp, pageNo, zoom, rotation, screen);
 
     return bmp;
 }
 
 RectD EngineDjVu::PageContentBox(int pageNo, RenderTarget target) {
     UNUSED(target);
-    ScopedCritSec scope(&gDjVuContext->lock);
+    ScopedCritSec scope(&djvu->lock);
 
+    ResolvePageSize(pageNo);
     RectD pageRc = PageMediabox(pageNo);
-    ddjvu_page_t* page = ddjvu_page_create_by_pageno(doc, pageNo - 1);
+    ddjvu_page_t* page = GetDecodedPage(pageNo);
     if (!page) {
         return pageRc;
     }
     ddjvu_page_set_rotation(page, DDJVU_ROTATE_0);
 
-    while (!ddjvu_page_decoding_done(page)) {
-        gDjVuContext->SpinMessageLoop();
-    }
-    if (ddjvu_page_decoding_error(page)) {
-        return pageRc;
-    }
-
     // render the page in 8-bit grayscale up to 250x250 px in size
     ddjvu_format_t* fmt = ddjvu_format_create(DDJVU_FORMAT_GREY8, 0, nullptr);
 
     defer {
         ddjvu_format_release(fmt);
-        ddjvu_page_release(page);
     };
 
     ddjvu_format_set_row_order(fmt, /* top_to_bottom */ TRUE);
@@ -864,23 +985,33 @@ bool EngineDjVu::ExtractPageText(miniexp_t item, str::WStr& extracted, Vec<Rect>
     item = miniexp_cdr(item);
     Rect rect = Rect::FromXY(x0, y0, x1, y1);
 
+    // symbols are interned, so looking them up once is enough
+    // (miniexp_symbol has to take a lock for every lookup)
+    static miniexp_t symChar = miniexp_symbol("char");
+    static miniexp_t symWord = miniexp_symbol("word");
+
     miniexp_t str = miniexp_car(item);
     if (miniexp_stringp(str) && !miniexp_cdr(item)) {
-        if (type != miniexp_symbol("char") && type != miniexp_symbol("word") ||
+        if (type != symChar && type != symWord ||
             coords.size() > 0 && rect.y < coords.Last().y - coords.Last().dy * 0.8) {
             AppendNewline(extracted, coords, lineSep);
         }
         const char* content = miniexp_to_str(str);
-        WCHAR* value = strconv::Utf8ToWstr(content);
-        if (value) {
-            size_t len = str::Len(value);
+        // convert right into extracted instead of allocating every word
+        // (UTF-8 never needs fewer bytes than UTF-16 needs WCHARs)
+        size_t cbLen = str::Len(content);
+        size_t start = extracted.size();
+        WCHAR* dst = cbLen > 0 ? extracted.AppendBlanks(cbLen) : nullptr;
+        if (dst) {
+            size_t len = (size_t)MultiByteToWideChar(CP_UTF8, 0, content, (int)cbLen, dst, (int)cbLen);
+            extracted.RemoveAt(start + len, cbLen - len);
             // TODO: split the rectangle into individual parts per glyph
-            for (size_t i = 0; i < len; i++) {
-                coords.Append(Rect(rect.x, rect.y, rect.dx, rect.dy));
+            Rect* dstCoords = coords.AppendBlanks(len);
+            for (size_t i = 0; dstCoords && i < len; i++) {
+                dstCoords[i] = rect;
             }
-            extracted.AppendAndFree(value);
         }
-        if (miniexp_symbol("word") == type) {
+        if (symWord == type) {
             extracted.Append(' ');
             coords.Append(Rect(rect.x + rect.dx, rect.y, 2, rect.dy));
         }
@@ -896,11 +1027,11 @@ bool EngineDjVu::ExtractPageText(miniexp_t item, str::WStr& extracted, Vec<Rect>
 
 WCHAR* EngineDjVu::ExtractPageText(int pageNo, Rect** coordsOut) {
     const WCHAR* lineSep = L"\n";
-    ScopedCritSec scope(&gDjVuContext->lock);
+    ScopedCritSec scope(&djvu->lock);
 
     miniexp_t pagetext;
     while ((pagetext = ddjvu_document_get_pagetext(doc, pageNo - 1, nullptr)) == miniexp_dummy) {
-        gDjVuContext->SpinMessageLoop();
+        djvu->SpinMessageLoop();
     }
     if (miniexp_nil == pagetext) {
         return nullptr;
@@ -919,14 +1050,8 @@ WCHAR* EngineDjVu::ExtractPageText(int pageNo, Rect** coordsOut) {
 
     CrashIf(str::Len(extracted.Get()) != coords.size());
     if (coordsOut) {
-        ddjvu_status_t status;
-        ddjvu_pageinfo_t info;
-        while ((status = ddjvu_document_get_pageinfo(doc, pageNo - 1, &info)) < DDJVU_JOB_OK) {
-            gDjVuContext->SpinMessageLoop();
-        }
-        float dpiFactor = 1.0;
-        if (DDJVU_JOB_OK == status)
-            dpiFactor = GetFileDPI() / info.dpi;
+        ResolvePageSize(pageNo);
+        float dpiFactor = GetDpiFactor(pageNo);
 
         // TODO: the coordinates aren't completely correct yet
         Rect page = PageMediabox(pageNo).Round();
@@ -953,29 +1078,21 @@ WCHAR* EngineDjVu::ExtractPageText(int pageNo, Rect** coordsOut) {
 Vec<PageElement*>* EngineDjVu::GetElements(int pageNo) {
     CrashIf(pageNo < 1 || pageNo > PageCount());
     if (annos && miniexp_dummy == annos[pageNo - 1]) {
-        ScopedCritSec scope(&gDjVuContext->lock);
+        ScopedCritSec scope(&djvu->lock);
         while ((annos[pageNo - 1] = ddjvu_document_get_pageanno(doc, pageNo - 1)) == miniexp_dummy) {
-            gDjVuContext->SpinMessageLoop();
+            djvu->SpinMessageLoop();
         }
     }
     if (!annos || !annos[pageNo - 1]) {
         return nullptr;
     }
 
-    ScopedCritSec scope(&gDjVuContext->lock);
+    ScopedCritSec scope(&djvu->lock);
 
     Vec<PageElement*>* els = new Vec<PageElement*>();
+    ResolvePageSize(pageNo);
     Rect page = PageMediabox(pageNo).Round();
-
-    ddjvu_status_t status;
-    ddjvu_pageinfo_t info;
-    while ((status = ddjvu_document_get_pageinfo(doc, pageNo - 1, &info)) < DDJVU_JOB_OK) {
-        gDjVuContext->SpinMessageLoop();
-    }
-    float dpiFactor = 1.0;
-    if (DDJVU_JOB_OK == status) {
-        dpiFactor = GetFileDPI() / info.dpi;
-    }
+    float dpiFactor = GetDpiFactor(pageNo);
 
     miniexp_t* links = ddjvu_anno_get_hyperlinks(annos[pageNo - 1]);
     for (int i = 0; links[i]; i++) {
@@ -1148,7 +1265,7 @@ TocTree* EngineDjVu::GetToc() {
     if (tocTree) {
         return tocTree;
     }
-    ScopedCritSec scope(&gDjVuContext->lock);
+    ScopedCritSec scope(&djvu->lock);
     int idCounter = 0;
     TocItem* root = BuildTocTree(nullptr, outline, idCounter);
     if (!root) {
@@ -1199,7 +1316,7 @@ EngineBase* EngineDjVu::CreateFromStream(IStream* stream) {
 
 bool IsDjVuEngineSupportedFile(const WCHAR* fileName, bool sniff) {
     if (sniff) {
-        return file::StartsWith(fileName, "AT&T");
+        return str::StartsWith(ReadFileHeader(fileName), "AT&T");
     }
 
     return str::EndsWithI(fileName, L".djvu");
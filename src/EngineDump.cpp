@@ -8,6 +8,7 @@
 #include "utils/GdiPlusUtil.h"
 #include "mui/MiniMui.h"
 #include "utils/TgaReader.h"
+#include "utils/Timer.h"
 #include "utils/WinUtil.h"
 
 #include "wingui/TreeModel.h"
@@ -446,6 +447,152 @@ bool RenderDocument(EngineBase* engine, const WCHAR* renderPath, float zoom = 1.
     return success;
 }
 
+// a manifest for -perf consists of lines of the form
+//   <page number or *> <baseline in ms> <file path>
+// (empty lines and lines starting with '#' are ignored, relative file
+// paths are relative to the manifest's directory)
+struct PerfBaseline {
+    // index into PerfManifest::files
+    int fileIdx = 0;
+    // 0 for all pages without a baseline of their own
+    int pageNo = 0;
+    float ms = 0;
+};
+
+struct PerfManifest {
+    WStrVec files;
+    Vec<PerfBaseline> baselines;
+};
+
+static bool ParsePerfManifest(const WCHAR* manifestPath, PerfManifest& manifest) {
+    AutoFree data(file::ReadFile(manifestPath));
+    if (!data.Get()) {
+        ErrOut("Error: Couldn't read %s!", manifestPath);
+        return false;
+    }
+    AutoFreeWstr dataW(strconv::Utf8ToWstr(data.Get()));
+    AutoFreeWstr dir(path::GetDir(manifestPath));
+    WStrVec lines;
+    lines.Split(dataW, L"\n", true);
+    for (size_t i = 0; i < lines.size(); i++) {
+        WCHAR* line = lines.at(i);
+        str::TrimWS(line, str::TrimOpt::Both);
+        if (!*line || *line == '#') {
+            continue;
+        }
+        PerfBaseline bl;
+        AutoFreeWstr fileName;
+        if (!str::Parse(line, L"*%_%f%_%S", &bl.ms, &fileName) &&
+            !str::Parse(line, L"%d%_%f%_%S", &bl.pageNo, &bl.ms, &fileName)) {
+            ErrOut("Error: Invalid line %d in %s: %s", (int)i + 1, manifestPath, line);
+            return false;
+        }
+        AutoFreeWstr filePath(path::Join(dir, fileName));
+        if (path::IsAbsolute(fileName)) {
+            filePath.SetCopy(fileName);
+        }
+        int fileIdx = manifest.files.Find(filePath);
+        if (fileIdx < 0) {
+            fileIdx = (int)manifest.files.size();
+            manifest.files.Append(filePath.StealData());
+        }
+        bl.fileIdx = fileIdx;
+        manifest.baselines.Append(bl);
+    }
+    return true;
+}
+
+// returns the baseline for a page or a negative time if it shouldn't be timed
+static float GetPerfBaseline(PerfManifest& manifest, int fileIdx, int pageNo) {
+    float res = -1;
+    for (PerfBaseline& bl : manifest.baselines) {
+        if (bl.fileIdx != fileIdx) {
+            continue;
+        }
+        if (bl.pageNo == pageNo) {
+            return bl.ms;
+        }
+        if (bl.pageNo == 0) {
+            res = bl.ms;
+        }
+    }
+    return res;
+}
+
+static int cmpFloat(const void* a, const void* b) {
+    float f1 = *(const float*)a;
+    float f2 = *(const float*)b;
+    return f1 < f2 ? -1 : f1 > f2 ? 1 : 0;
+}
+
+// returns the median render time (or a negative value if rendering failed)
+static float TimePageRendering(EngineBase* engine, int pageNo, float zoom, int repeat) {
+    // page loading is cached, so it's excluded from the measurement
+    if (!engine->BenchLoadPage(pageNo)) {
+        return -1;
+    }
+    Vec<float> times;
+    for (int i = 0; i < repeat; i++) {
+        auto t = TimeGet();
+        RenderPageArgs args(pageNo, zoom, 0);
+        RenderedBitmap* bmp = engine->RenderPage(args);
+        if (!bmp) {
+            return -1;
+        }
+        delete bmp;
+        times.Append((float)TimeSinceInMs(t));
+    }
+    times.Sort(cmpFloat);
+    return times.at(times.size() / 2);
+}
+
+// renders all pages with a baseline and returns the number of pages
+// that took more than thresholdPercent longer than their baseline (or
+// couldn't be rendered). with writeBaseline, all pages are timed and
+// a new manifest is written to stdout instead
+static int RunPerfManifest(const WCHAR* manifestPath, float zoom, int repeat, float thresholdPercent,
+                           bool writeBaseline) {
+    PerfManifest manifest;
+    if (!ParsePerfManifest(manifestPath, manifest)) {
+        return 1;
+    }
+    int nFailed = 0;
+    for (size_t fileIdx = 0; fileIdx < manifest.files.size(); fileIdx++) {
+        const WCHAR* filePath = manifest.files.at(fileIdx);
+        EngineBase* engine = EngineManager::CreateEngine(filePath);
+        if (!engine) {
+            ErrOut("Error: Couldn't create an engine for %s!", filePath);
+            nFailed++;
+            continue;
+        }
+        for (int pageNo = 1; pageNo <= engine->PageCount(); pageNo++) {
+            float baseline = GetPerfBaseline(manifest, (int)fileIdx, pageNo);
+            if (baseline < 0 && !writeBaseline) {
+                continue;
+            }
+            float ms = TimePageRendering(engine, pageNo, zoom, repeat);
+            if (ms < 0) {
+                ErrOut("FAIL %s page %d: couldn't render", filePath, pageNo);
+                nFailed++;
+                continue;
+            }
+            if (writeBaseline) {
+                AutoFree pathUtf8(strconv::WstrToUtf8(filePath));
+                Out("%d %.2f %s\n", pageNo, ms, pathUtf8.Get());
+                continue;
+            }
+            bool failed = ms > baseline * (1 + thresholdPercent / 100);
+            if (failed) {
+                nFailed++;
+            }
+            ErrOut("%s %s page %d: %.2f ms (baseline %.2f ms)", failed ? L"FAIL" : L"ok  ", filePath, pageNo, ms,
+                   baseline);
+        }
+        delete engine;
+    }
+    return nFailed;
+}
+
 class PasswordHolder : public PasswordUI {
     const WCHAR* password;
 
@@ -474,6 +621,8 @@ int main(int argc, char** argv) {
     Usage:
         ErrOut("%s [-pwd <password>][-quick][-render <path-%%d.tga>] <filename>",
                path::GetBaseNameNoFree(argList.at(0)));
+        ErrOut("%s -perf <manifest> [-zoom <n%%>][-repeat <n>][-threshold <n%%>][-baseline]",
+               path::GetBaseNameNoFree(argList.at(0)));
         return 2;
     }
 
@@ -483,6 +632,10 @@ int main(int argc, char** argv) {
     WCHAR* renderPath = nullptr;
     float renderZoom = 1.f;
     bool loadOnly = false, silent = false;
+    WCHAR* perfManifest = nullptr;
+    int perfRepeat = 3;
+    float perfThreshold = 25.f;
+    bool perfBaseline = false;
 #ifdef DEBUG
     int breakAlloc = 0;
 #endif
@@ -509,6 +662,20 @@ int main(int argc, char** argv) {
         // -full is for backward compatibility
         else if (str::Eq(argList.at(i), L"-full"))
             fullDump = true;
+        // -perf <manifest> checks rendering times against baselines
+        else if (str::Eq(argList.at(i), L"-perf") && i + 1 < argList.size() && !perfManifest)
+            perfManifest = argList.at(++i);
+        else if (str::Eq(argList.at(i), L"-zoom") && i + 1 < argList.size() &&
+                 str::Parse(argList.at(i + 1), L"%f%%%$", &renderZoom) && renderZoom > 0.f) {
+            renderZoom /= 100.f;
+            i++;
+        } else if (str::Eq(argList.at(i), L"-repeat") && i + 1 < argList.size())
+            perfRepeat = std::max(_wtoi(argList.at(++i)), 1);
+        else if (str::Eq(argList.at(i), L"-threshold") && i + 1 < argList.size() &&
+                 str::Parse(argList.at(i + 1), L"%f%%%$", &perfThreshold))
+            i++;
+        else if (str::Eq(argList.at(i), L"-baseline"))
+            perfBaseline = true;
 #ifdef DEBUG
         else if (str::Eq(argList.at(i), L"-breakalloc") && i + 1 < argList.size())
             breakAlloc = _wtoi(argList.at(++i));
@@ -518,6 +685,12 @@ int main(int argc, char** argv) {
         else
             goto Usage;
     }
+    if (perfManifest) {
+        ScopedGdiPlus gdiPlus;
+        ScopedMiniMui miniMui;
+        int nFailed = RunPerfManifest(perfManifest, renderZoom, perfRepeat, perfThreshold, perfBaseline);
+        return nFailed > 0 ? 1 : 0;
+    }
     if (!filePath)
         goto Usage;
 
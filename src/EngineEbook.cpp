@@ -7,6 +7,7 @@
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
 #include "utils/Archive.h"
+#include "utils/CryptoUtil.h"
 #include "utils/Dpi.h"
 #include "utils/FileUtil.h"
 #include "utils/GdiPlusUtil.h"
@@ -57,6 +58,120 @@ void SetDefaultEbookFont(const WCHAR* name, float size) {
     gDefaultFontSize = size * 0.8f;
 }
 
+/* persisted page breaks of previously laid out documents */
+
+#define EBOOK_LAYOUT_FILE_MAGIC 0x314C5053 // "SPL1"
+// bump whenever HtmlFormatter changes where pages break
+#define EBOOK_LAYOUT_CACHE_VERSION 1
+#define EBOOK_LAYOUT_CACHE_MAX_FILES 64
+
+static AutoFreeWstr gLayoutCacheDir;
+
+void SetEbookLayoutCacheDir(const WCHAR* dir) {
+    // the directory is used by formatting threads
+    if (!str::Eq(gLayoutCacheDir, dir)) {
+        gLayoutCacheDir.SetCopy(dir);
+    }
+}
+
+// a layout file consists of this header followed by
+// the reparseIdx of every page
+struct EbookLayoutFileHeader {
+    u32 magic;
+    int nPages;
+};
+
+// the name of a layout file depends on the document's fingerprint (cf.
+// CalcFileFingerprint) and on all the arguments affecting page breaks
+static WCHAR* GetLayoutCachePath(const WCHAR* filePath, HtmlFormatterArgs* args, bool skipEmptyPages) {
+    if (!gLayoutCacheDir) {
+        return nullptr;
+    }
+    unsigned char fileDigest[16];
+    if (!CalcFileFingerprint(filePath, fileDigest)) {
+        return nullptr;
+    }
+    AutoFree fileFingerPrint(_MemToHex(&fileDigest));
+    AutoFree fontNameU(strconv::WstrToUtf8(args->GetFontName()));
+    if (!fontNameU.Get()) {
+        return nullptr;
+    }
+    str::Str key;
+    key.Append(fileFingerPrint.Get());
+    key.AppendFmt("|%.2f|%.2f|%s|%.2f|%d|%d|%d", args->pageDx, args->pageDy, fontNameU.Get(), args->fontSize,
+                  (int)args->textRenderMethod, skipEmptyPages ? 1 : 0, EBOOK_LAYOUT_CACHE_VERSION);
+    unsigned char digest[16];
+    CalcMD5Digest((unsigned char*)key.Get(), key.size(), digest);
+    AutoFree fingerPrint(_MemToHex(&digest));
+
+    AutoFreeWstr fileName(strconv::FromAnsi(fingerPrint));
+    fileName.Set(str::Join(fileName, L".layout"));
+    return path::Join(gLayoutCacheDir, fileName);
+}
+
+static bool LoadCachedPageBreaks(const WCHAR* path, Vec<int>& pageBreaksOut) {
+    AutoFree data(file::ReadFile(path));
+    if (data.size() < sizeof(EbookLayoutFileHeader)) {
+        return false;
+    }
+    EbookLayoutFileHeader* hdr = (EbookLayoutFileHeader*)data.Get();
+    if (hdr->magic != EBOOK_LAYOUT_FILE_MAGIC || hdr->nPages <= 0 ||
+        data.size() != sizeof(EbookLayoutFileHeader) + (size_t)hdr->nPages * sizeof(int)) {
+        return false;
+    }
+    int* pageBreaks = (int*)(data.Get() + sizeof(EbookLayoutFileHeader));
+    return pageBreaksOut.Append(pageBreaks, hdr->nPages);
+}
+
+struct LayoutFileInfo {
+    WCHAR* name;
+    FILETIME lastWrite;
+};
+
+static int cmpLayoutFileInfoNewestFirst(const void* a, const void* b) {
+    const LayoutFileInfo* fa = (const LayoutFileInfo*)a;
+    const LayoutFileInfo* fb = (const LayoutFileInfo*)b;
+    return CompareFileTime(&fb->lastWrite, &fa->lastWrite);
+}
+
+// keeps the layouts of the most recently read documents
+static void CleanUpLayoutCache() {
+    Vec<LayoutFileInfo> files;
+    AutoFreeWstr pattern(path::Join(gLayoutCacheDir, L"*.layout"));
+    WIN32_FIND_DATA fdata;
+    HANDLE hfind = FindFirstFile(pattern, &fdata);
+    if (INVALID_HANDLE_VALUE == hfind) {
+        return;
+    }
+    do {
+        files.Append(LayoutFileInfo{str::Dup(fdata.cFileName), fdata.ftLastWriteTime});
+    } while (FindNextFile(hfind, &fdata));
+    FindClose(hfind);
+
+    files.Sort(cmpLayoutFileInfoNewestFirst);
+    for (size_t i = 0; i < files.size(); i++) {
+        if (i >= EBOOK_LAYOUT_CACHE_MAX_FILES) {
+            AutoFreeWstr path(path::Join(gLayoutCacheDir, files[i].name));
+            file::Delete(path);
+        }
+        free(files[i].name);
+    }
+}
+
+static void SaveCachedPageBreaks(const WCHAR* path, Vec<HtmlPage*>* pages) {
+    if (!dir::CreateAll(gLayoutCacheDir)) {
+        return;
+    }
+    str::Str data;
+    EbookLayoutFileHeader hdr = {EBOOK_LAYOUT_FILE_MAGIC, pages->isize()};
+    data.Append((const char*)&hdr, sizeof(hdr));
+    for (HtmlPage* page : *pages) {
+        data.Append((const char*)&page->reparseIdx, sizeof(page->reparseIdx));
+    }
+    file::WriteFile(path, data.AsView());
+    CleanUpLayoutCache();
+}
+
 /* common classes for EPUB, FictionBook2, Mobi, PalmDOC, CHM, HTML and TXT engines */
 
 struct PageAnchor {
@@ -77,6 +192,23 @@ class EbookAbortCookie : public AbortCookie {
     }
 };
 
+#define EBOOK_MAX_SECTION_THREADS 4
+
+// a part of a document which is laid out by its own HtmlFormatter
+struct EbookSection {
+    // offsets into HtmlFormatterArgs::htmlStr
+    int start = 0;
+    int end = 0;
+    Vec<HtmlPage*> pages;
+    // for the text of pages (see HtmlFormatterArgs::textAllocator)
+    PoolAllocator allocator;
+    bool laidOut = false;
+
+    ~EbookSection() {
+        DeleteVecMembers(pages);
+    }
+};
+
 class EngineEbook : public EngineBase {
   public:
     EngineEbook();
@@ -104,6 +236,16 @@ class EngineEbook : public EngineBase {
 
     bool BenchLoadPage(int pageNo) override;
 
+    // true while pages are still being laid out in the background
+    // (PageCount() keeps growing until then)
+    bool HasPendingPageSizes() override;
+
+    // runs on formattingThread
+    void FormatRemainingPages();
+    // runs on sectionThreads
+    void FormatSections();
+    void FormatSection(EbookSection* section);
+
   protected:
     Vec<HtmlPage*>* pages = nullptr;
     Vec<PageAnchor> anchors;
@@ -118,11 +260,54 @@ class EngineEbook : public EngineBase {
     RectD pageRect;
     float pageBorder;
 
+    // after the first few pages, the rest of the document is laid out
+    // by formatter on formattingThread (appending to pages under pagesAccess)
+    HtmlFormatter* formatter = nullptr;
+    HtmlFormatterArgs* formatterArgs = nullptr;
+    bool skipEmptyPages = false;
+    HANDLE formattingThread = nullptr;
+    bool stopFormatting = false;
+    // where the page breaks are saved once all pages have been laid out.
+    // if they were saved before, PageCount() is known right away and
+    // pages that haven't been laid out yet can be waited for with WaitForPage
+    AutoFreeWstr layoutCachePath;
+    CONDITION_VARIABLE pageLaidOut;
+
+    // documents consisting of parts which always start on a new page
+    // (such as the documents in an EPUB's spine) can set sectionStarts
+    // before StartFormatting. all but the first section are then laid out
+    // in parallel on sectionThreads and appended to pages in order
+    Vec<int> sectionStarts;
+    Vec<EbookSection*> sections;
+
+    // links and images of the pages, created on first use (links
+    // to pages that haven't been laid out yet can't be resolved, so
+    // they're only cached once all pages have been laid out)
+    Vec<Vec<PageElement*>*> pageElements;
+    HANDLE sectionThreads[EBOOK_MAX_SECTION_THREADS] = {};
+    int nSectionThreads = 0;
+    LONG nextSection = -1;
+    CONDITION_VARIABLE sectionLaidOut;
+
+    // only needed by engines using StartFormatting
+    virtual HtmlFormatter* CreateFormatter(HtmlFormatterArgs* args);
+    bool StartFormatting(HtmlFormatterArgs* args, bool skipEmptyPages);
+    // must be called by the destructors of derived classes before
+    // freeing the document the formatter is working on
+    void StopFormatting();
+    // for when all pages are needed (e.g. for the table of contents)
+    void WaitForFormatting();
+    void WaitForPage(int pageNo);
+    // clones are used e.g. for printing, which needs all pages right away
+    static EngineBase* WithAllPages(EngineBase* engine);
+
     void GetTransform(Matrix& m, float zoom, int rotation);
     bool ExtractPageAnchors();
     WCHAR* ExtractFontList();
 
     virtual PageElement* CreatePageLink(DrawInstr* link, Rect rect, int pageNo);
+    Vec<PageElement*>* CreateElements(int pageNo);
+    Vec<PageElement*>* GetCachedElements(int pageNo);
 
     Vec<DrawInstr>* GetHtmlPage(int pageNo);
 };
@@ -178,15 +363,26 @@ EngineEbook::EngineEbook() {
     pageBorder = 0.4f * GetFileDPI();
     preferredLayout = Layout_Book;
     InitializeCriticalSection(&pagesAccess);
+    InitializeConditionVariable(&pageLaidOut);
+    InitializeConditionVariable(&sectionLaidOut);
 }
 
 EngineEbook::~EngineEbook() {
+    StopFormatting();
     EnterCriticalSection(&pagesAccess);
 
     if (pages) {
         DeleteVecMembers(*pages);
     }
     delete pages;
+    // the sections' allocators must outlive the pages
+    DeleteVecMembers(sections);
+    for (Vec<PageElement*>* els : pageElements) {
+        if (els) {
+            DeleteVecMembers(*els);
+            delete els;
+        }
+    }
 
     LeaveCriticalSection(&pagesAccess);
     DeleteCriticalSection(&pagesAccess);
@@ -233,6 +429,232 @@ bool EngineEbook::BenchLoadPage(int pageNo) {
     return true;
 }
 
+// enough pages for filling the window when the document is first shown
+#define EBOOK_PAGES_FORMATTED_UPFRONT 8
+
+static DWORD WINAPI EbookFormattingThreadProc(LPVOID data) {
+    EngineEbook* engine = (EngineEbook*)data;
+    engine->FormatRemainingPages();
+    return 0;
+}
+
+static DWORD WINAPI EbookSectionThreadProc(LPVOID data) {
+    EngineEbook* engine = (EngineEbook*)data;
+    engine->FormatSections();
+    return 0;
+}
+
+// leave a core for the UI thread (and one for formattingThread)
+static int GetSectionThreadsCount() {
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return std::min((int)si.dwNumberOfProcessors - 1, EBOOK_MAX_SECTION_THREADS);
+}
+
+// HtmlFormatterArgs can't be copied because of fontName
+static HtmlFormatterArgs* CopyFormatterArgs(HtmlFormatterArgs* args) {
+    HtmlFormatterArgs* res = new HtmlFormatterArgs();
+    res->pageDx = args->pageDx;
+    res->pageDy = args->pageDy;
+    res->SetFontName(args->GetFontName());
+    res->fontSize = args->fontSize;
+    res->textAllocator = args->textAllocator;
+    res->textRenderMethod = args->textRenderMethod;
+    res->htmlStr = args->htmlStr;
+    res->reparseIdx = args->reparseIdx;
+    return res;
+}
+
+HtmlFormatter* EngineEbook::CreateFormatter(HtmlFormatterArgs* args) {
+    UNUSED(args);
+    CrashIf(true);
+    return nullptr;
+}
+
+// lays out the first few pages right away and the remaining ones in the background
+// (takes ownership of args)
+bool EngineEbook::StartFormatting(HtmlFormatterArgs* args, bool skipEmptyPages) {
+    CrashIf(pages || formatter);
+    this->formatterArgs = args;
+    this->skipEmptyPages = skipEmptyPages;
+    layoutCachePath.Set(GetLayoutCachePath(FileName(), args, skipEmptyPages));
+
+    int nThreads = sectionStarts.size() > 1 ? GetSectionThreadsCount() : 0;
+    if (nThreads > 0) {
+        for (int i = 1; i < sectionStarts.isize(); i++) {
+            EbookSection* section = new EbookSection();
+            section->start = sectionStarts[i];
+            section->end = i + 1 < sectionStarts.isize() ? sectionStarts[i + 1] : (int)args->htmlStr.size();
+            sections.Append(section);
+        }
+        // formatter only lays out the first section
+        std::string_view htmlStr = args->htmlStr;
+        args->htmlStr = {htmlStr.data(), (size_t)sections[0]->start};
+        formatter = CreateFormatter(args);
+        args->htmlStr = htmlStr;
+        for (int i = 0; i < nThreads; i++) {
+            HANDLE h = CreateThread(nullptr, 0, EbookSectionThreadProc, this, 0, nullptr);
+            if (h) {
+                sectionThreads[nSectionThreads++] = h;
+            }
+        }
+    } else {
+        formatter = CreateFormatter(args);
+    }
+
+    pages = new Vec<HtmlPage*>();
+    HtmlPage* page = nullptr;
+    while (pages->size() < EBOOK_PAGES_FORMATTED_UPFRONT && (page = formatter->Next(skipEmptyPages)) != nullptr) {
+        pages->Append(page);
+    }
+    pageCount = (int)pages->size();
+    bool morePages = page || sections.size() > 0;
+    Vec<int> cachedPageBreaks;
+    if (morePages && layoutCachePath && LoadCachedPageBreaks(layoutCachePath, cachedPageBreaks)) {
+        pageCount = std::max(pageCount, cachedPageBreaks.isize());
+    }
+    if (!ExtractPageAnchors()) {
+        // frees formatter and args
+        stopFormatting = true;
+        FormatRemainingPages();
+        return false;
+    }
+
+    if (morePages) {
+        formattingThread = CreateThread(nullptr, 0, EbookFormattingThreadProc, this, 0, nullptr);
+    } else {
+        // all pages have been laid out already
+        stopFormatting = true;
+    }
+    if (!formattingThread) {
+        FormatRemainingPages();
+    }
+    return true;
+}
+
+void EngineEbook::FormatRemainingPages() {
+    HtmlPage* page;
+    while (!stopFormatting && (page = formatter->Next(skipEmptyPages)) != nullptr) {
+        ScopedCritSec scope(&pagesAccess);
+        pages->Append(page);
+        // the page count might already be known from the layout cache
+        pageCount = std::max(pageCount, pages->isize());
+        ExtractPageAnchors();
+        WakeAllConditionVariable(&pageLaidOut);
+    }
+
+    for (EbookSection* section : sections) {
+        // without sectionThreads, the work is done here
+        if (!section->laidOut && nSectionThreads == 0 && !stopFormatting) {
+            FormatSection(section);
+        }
+        ScopedCritSec scope(&pagesAccess);
+        while (!section->laidOut && !stopFormatting) {
+            SleepConditionVariableCS(&sectionLaidOut, &pagesAccess, INFINITE);
+        }
+        if (stopFormatting) {
+            break;
+        }
+        pages->Append(section->pages.LendData(), section->pages.size());
+        section->pages.Reset();
+        pageCount = std::max(pageCount, pages->isize());
+        ExtractPageAnchors();
+        WakeAllConditionVariable(&pageLaidOut);
+    }
+    if (nSectionThreads > 0) {
+        WaitForMultipleObjects(nSectionThreads, sectionThreads, TRUE, INFINITE);
+        for (int i = 0; i < nSectionThreads; i++) {
+            CloseHandle(sectionThreads[i]);
+        }
+        nSectionThreads = 0;
+    }
+
+    // short documents are always laid out right away
+    bool finished = !stopFormatting;
+    if (finished && layoutCachePath && pages->size() > EBOOK_PAGES_FORMATTED_UPFRONT) {
+        SaveCachedPageBreaks(layoutCachePath, pages);
+    }
+
+    ScopedCritSec scope(&pagesAccess);
+    delete formatter;
+    formatter = nullptr;
+    delete formatterArgs;
+    formatterArgs = nullptr;
+    // also wakes up the threads waiting for pages if the
+    // cached layout had more pages than there actually are
+    WakeAllConditionVariable(&pageLaidOut);
+}
+
+// lays out sections in the order they're picked up by sectionThreads
+void EngineEbook::FormatSections() {
+    for (;;) {
+        int idx = (int)InterlockedIncrement(&nextSection);
+        if (stopFormatting || idx >= sections.isize()) {
+            break;
+        }
+        FormatSection(sections[idx]);
+    }
+}
+
+void EngineEbook::FormatSection(EbookSection* section) {
+    HtmlFormatterArgs* args = CopyFormatterArgs(formatterArgs);
+    args->htmlStr = {formatterArgs->htmlStr.data(), (size_t)section->end};
+    args->reparseIdx = section->start;
+    args->textAllocator = &section->allocator;
+    HtmlFormatter* sectionFormatter = CreateFormatter(args);
+    HtmlPage* page;
+    while (!stopFormatting && (page = sectionFormatter->Next(skipEmptyPages)) != nullptr) {
+        section->pages.Append(page);
+    }
+    delete sectionFormatter;
+    delete args;
+
+    ScopedCritSec scope(&pagesAccess);
+    section->laidOut = true;
+    WakeAllConditionVariable(&sectionLaidOut);
+}
+
+bool EngineEbook::HasPendingPageSizes() {
+    // not taking pagesAccess, as it's held for rendering
+    return formatter != nullptr;
+}
+
+void EngineEbook::StopFormatting() {
+    if (!formattingThread) {
+        return;
+    }
+    stopFormatting = true;
+    {
+        // formattingThread might be waiting for a section
+        ScopedCritSec scope(&pagesAccess);
+        WakeAllConditionVariable(&sectionLaidOut);
+    }
+    WaitForFormatting();
+}
+
+void EngineEbook::WaitForFormatting() {
+    if (formattingThread) {
+        WaitForSingleObject(formattingThread, INFINITE);
+        CloseHandle(formattingThread);
+        formattingThread = nullptr;
+    }
+}
+
+// must be called without holding pagesAccess
+void EngineEbook::WaitForPage(int pageNo) {
+    ScopedCritSec scope(&pagesAccess);
+    while (formatter && pageNo > pages->isize()) {
+        SleepConditionVariableCS(&pageLaidOut, &pagesAccess, INFINITE);
+    }
+}
+
+EngineBase* EngineEbook::WithAllPages(EngineBase* engine) {
+    if (engine) {
+        ((EngineEbook*)engine)->WaitForFormatting();
+    }
+    return engine;
+}
+
 void EngineEbook::GetTransform(Matrix& m, float zoom, int rotation) {
     GetBaseTransform(m, pageRect.ToGdipRectF(), zoom, rotation);
 }
@@ -241,14 +663,22 @@ Vec<DrawInstr>* EngineEbook::GetHtmlPage(int pageNo) {
     CrashIf(pageNo < 1 || PageCount() < pageNo);
     if (pageNo < 1 || PageCount() < pageNo)
         return nullptr;
+    // pages might be growing on formattingThread
+    ScopedCritSec scope(&pagesAccess);
+    // with the page count known from the layout cache, not
+    // all pages might have been laid out yet (cf. WaitForPage)
+    if (pageNo > pages->isize()) {
+        return nullptr;
+    }
     return &pages->at(pageNo - 1)->instructions;
 }
 
+// extracts the anchors of all pages added since the last call
 bool EngineEbook::ExtractPageAnchors() {
     ScopedCritSec scope(&pagesAccess);
 
-    DrawInstr* baseAnchor = nullptr;
-    for (int pageNo = 1; pageNo <= pageCount; pageNo++) {
+    DrawInstr* baseAnchor = baseAnchors.size() > 0 ? baseAnchors.Last() : nullptr;
+    for (int pageNo = baseAnchors.isize() + 1; pageNo <= pages->isize(); pageNo++) {
         Vec<DrawInstr>* pageInstrs = GetHtmlPage(pageNo);
         if (!pageInstrs) {
             return false;
@@ -331,16 +761,9 @@ static void DrawAnnotationSquiggly(Graphics& g, Annotation* annot) {
     g.DrawLine(&p, p1, p2);
 }
 
-static void DrawAnnotations(Graphics& g, Vec<Annotation*>* annots, int pageNo) {
-    if (!annots) {
-        return;
-    }
-    int n = annots->isize();
-    for (int i = 0; i < n; i++) {
-        Annotation* annot = annots->at(i);
-        if (annot->pageNo != pageNo) {
-            continue;
-        }
+static void DrawAnnotations(Graphics& g, AnnotationsIndex* annotsIndex, int pageNo) {
+    Vec<Annotation*> annots = FilterAnnotationsForPage(annotsIndex, pageNo);
+    for (Annotation* annot : annots) {
         PointF p1, p2;
         switch (annot->type) {
             case AnnotationType::Highlight:
@@ -395,12 +818,18 @@ RenderedBitmap* EngineEbook::RenderPage(RenderPageArgs& args) {
         *args.cookie_out = cookie;
     }
 
+    WaitForPage(pageNo);
     ScopedCritSec scope(&pagesAccess);
 
     mui::ITextRender* textDraw = mui::TextRenderGdiplus::Create(&g);
-    DrawHtmlPage(&g, textDraw, GetHtmlPage(pageNo), pageBorder, pageBorder, false, Color((ARGB)Color::Black),
-                 cookie ? &cookie->abort : nullptr);
-    DrawAnnotations(g, userAnnots, pageNo);
+    Vec<DrawInstr>* pageInstrs = GetHtmlPage(pageNo);
+    if (pageInstrs) {
+        DrawHtmlPage(&g, textDraw, pageInstrs, pageBorder, pageBorder, false, Color((ARGB)Color::Black),
+                     cookie ? &cookie->abort : nullptr);
+    }
+    if (!args.skipUserAnnots) {
+        DrawAnnotations(g, userAnnotsIndex, pageNo);
+    }
     delete textDraw;
     DeleteDC(hDC);
 
@@ -421,6 +850,7 @@ static Rect GetInstrBbox(DrawInstr& instr, float pageBorder) {
 
 WCHAR* EngineEbook::ExtractPageText(int pageNo, Rect** coordsOut) {
     const WCHAR* lineSep = L"\n";
+    WaitForPage(pageNo);
     ScopedCritSec scope(&pagesAccess);
 
     str::WStr content;
@@ -430,6 +860,9 @@ WCHAR* EngineEbook::ExtractPageText(int pageNo, Rect** coordsOut) {
     bool insertSpace = false;
 
     Vec<DrawInstr>* pageInstrs = GetHtmlPage(pageNo);
+    if (!pageInstrs) {
+        return nullptr;
+    }
     for (DrawInstr& i : *pageInstrs) {
         Rect bbox = GetInstrBbox(i, pageBorder);
         switch (i.type) {
@@ -518,10 +951,14 @@ PageElement* EngineEbook::CreatePageLink(DrawInstr* link, Rect rect, int pageNo)
     return newEbookLink(link, rect, dest, pageNo);
 }
 
-Vec<PageElement*>* EngineEbook::GetElements(int pageNo) {
+// must be called while holding pagesAccess
+Vec<PageElement*>* EngineEbook::CreateElements(int pageNo) {
     Vec<PageElement*>* els = new Vec<PageElement*>();
 
     Vec<DrawInstr>* pageInstrs = GetHtmlPage(pageNo);
+    if (!pageInstrs) {
+        return els;
+    }
     size_t n = pageInstrs->size();
     for (size_t idx = 0; idx < n; idx++) {
         DrawInstr& i = pageInstrs->at(idx);
@@ -540,15 +977,41 @@ Vec<PageElement*>* EngineEbook::GetElements(int pageNo) {
     return els;
 }
 
+// returns nullptr while pages are still being laid out
+// must be called while holding pagesAccess
+Vec<PageElement*>* EngineEbook::GetCachedElements(int pageNo) {
+    if (formatter || pageNo < 1 || pageNo > pages->isize()) {
+        return nullptr;
+    }
+    if (pageElements.size() < pages->size()) {
+        pageElements.AppendBlanks(pages->size() - pageElements.size());
+    }
+    Vec<PageElement*>*& els = pageElements.at(pageNo - 1);
+    if (!els) {
+        els = CreateElements(pageNo);
+    }
+    return els;
+}
+
+Vec<PageElement*>* EngineEbook::GetElements(int pageNo) {
+    ScopedCritSec scope(&pagesAccess);
+    Vec<PageElement*>* cached = GetCachedElements(pageNo);
+    if (!cached) {
+        return CreateElements(pageNo);
+    }
+    Vec<PageElement*>* els = new Vec<PageElement*>(cached->size());
+    for (PageElement* el : *cached) {
+        els->Append(clonePageElement(el));
+    }
+    return els;
+}
+
 static RenderedBitmap* getImageFromData(ImageData id) {
-    HBITMAP hbmp;
-    Bitmap* bmp = BitmapFromData(id.data, id.len);
-    if (!bmp || bmp->GetHBITMAP((ARGB)Color::White, &hbmp) != Ok) {
-        delete bmp;
+    Size size;
+    HBITMAP hbmp = GetCachedImageAsHBITMAP(id, &size);
+    if (!hbmp) {
         return nullptr;
     }
-    Size size(bmp->GetWidth(), bmp->GetHeight());
-    delete bmp;
     return new RenderedBitmap(hbmp, size);
 }
 
@@ -562,10 +1025,19 @@ RenderedBitmap* EngineEbook::GetImageForPageElement(PageElement* el) {
 }
 
 PageElement* EngineEbook::GetElementAtPos(int pageNo, PointD pt) {
-    Vec<PageElement*>* els = GetElements(pageNo);
-    if (!els)
+    ScopedCritSec scope(&pagesAccess);
+    Vec<PageElement*>* cached = GetCachedElements(pageNo);
+    if (cached) {
+        // this is called for every mouse move, so only the hit is copied
+        for (PageElement* el : *cached) {
+            if (el->GetRect().Contains(pt)) {
+                return clonePageElement(el);
+            }
+        }
         return nullptr;
+    }
 
+    Vec<PageElement*>* els = CreateElements(pageNo);
     PageElement* el = nullptr;
     for (size_t i = 0; i < els->size() && !el; i++)
         if (els->at(i)->GetRect().Contains(pt))
@@ -579,7 +1051,9 @@ PageElement* EngineEbook::GetElementAtPos(int pageNo, PointD pt) {
     return el;
 }
 
+// note: only finds destinations on pages which have already been laid out
 PageDestination* EngineEbook::GetNamedDest(const WCHAR* name) {
+    ScopedCritSec scope(&pagesAccess);
     AutoFree name_utf8(strconv::WstrToUtf8(name));
     const char* id = name_utf8.Get();
     if (str::FindChar(id, '#')) {
@@ -631,6 +1105,7 @@ PageDestination* EngineEbook::GetNamedDest(const WCHAR* name) {
 }
 
 WCHAR* EngineEbook::ExtractFontList() {
+    WaitForFormatting();
     ScopedCritSec scope(&pagesAccess);
 
     Vec<mui::CachedFont*> seenFonts;
@@ -763,6 +1238,10 @@ class EngineEpub : public EngineEbook {
     bool Load(const WCHAR* fileName);
     bool Load(IStream* stream);
     bool FinishLoading();
+
+    HtmlFormatter* CreateFormatter(HtmlFormatterArgs* args) override {
+        return new EpubFormatter(args, doc);
+    }
 };
 
 EngineEpub::EngineEpub() : EngineEbook() {
@@ -771,6 +1250,7 @@ EngineEpub::EngineEpub() : EngineEbook() {
 }
 
 EngineEpub::~EngineEpub() {
+    StopFormatting();
     delete doc;
     delete tocTree;
     if (stream) {
@@ -780,10 +1260,10 @@ EngineEpub::~EngineEpub() {
 
 EngineBase* EngineEpub::Clone() {
     if (stream) {
-        return CreateFromStream(stream);
+        return WithAllPages(CreateFromStream(stream));
     }
     if (FileName()) {
-        return CreateFromFile(FileName());
+        return WithAllPages(CreateFromFile(FileName()));
     }
     return nullptr;
 }
@@ -814,20 +1294,17 @@ bool EngineEpub::FinishLoading() {
         return false;
     }
 
-    HtmlFormatterArgs args{};
-    args.htmlStr = doc->GetHtmlData();
-    args.pageDx = (float)pageRect.dx - 2 * pageBorder;
-    args.pageDy = (float)pageRect.dy - 2 * pageBorder;
-    args.SetFontName(GetDefaultFontName());
-    args.fontSize = GetDefaultFontSize();
-    args.textAllocator = &allocator;
-    args.textRenderMethod = mui::TextRenderMethodGdiplusQuick;
-
-    pages = EpubFormatter(&args, doc).FormatAllPages(false);
+    HtmlFormatterArgs* args = new HtmlFormatterArgs();
+    args->htmlStr = doc->GetHtmlData();
+    args->pageDx = (float)pageRect.dx - 2 * pageBorder;
+    args->pageDy = (float)pageRect.dy - 2 * pageBorder;
+    args->SetFontName(GetDefaultFontName());
+    args->fontSize = GetDefaultFontSize();
+    args->textAllocator = &allocator;
+    args->textRenderMethod = mui::TextRenderMethodGdiplusQuick;
 
-    // must set pageCount before ExtractPageAnchors
-    pageCount = (int)pages->size();
-    if (!ExtractPageAnchors()) {
+    sectionStarts = doc->GetSectionStarts();
+    if (!StartFormatting(args, false)) {
         return false;
     }
 
@@ -867,6 +1344,7 @@ TocTree* EngineEpub::GetToc() {
     if (tocTree) {
         return tocTree;
     }
+    WaitForFormatting();
     EbookTocBuilder builder(this);
     doc->ParseToc(&builder);
     TocItem* root = builder.GetRoot();
@@ -920,6 +1398,7 @@ class EngineFb2 : public EngineEbook {
         defaultFileExt = L".fb2";
     }
     virtual ~EngineFb2() {
+        StopFormatting();
         delete tocTree;
         delete doc;
     }
@@ -928,7 +1407,7 @@ class EngineFb2 : public EngineEbook {
         if (!fileName) {
             return nullptr;
         }
-        return CreateFromFile(fileName);
+        return WithAllPages(CreateFromFile(fileName));
     }
 
     WCHAR* GetProperty(DocumentProperty prop) override {
@@ -947,6 +1426,10 @@ class EngineFb2 : public EngineEbook {
     bool Load(const WCHAR* fileName);
     bool Load(IStream* stream);
     bool FinishLoading();
+
+    HtmlFormatter* CreateFormatter(HtmlFormatterArgs* args) override {
+        return new Fb2Formatter(args, doc);
+    }
 };
 
 bool EngineFb2::Load(const WCHAR* fileName) {
@@ -965,23 +1448,20 @@ bool EngineFb2::FinishLoading() {
         return false;
     }
 
-    HtmlFormatterArgs args;
-    args.htmlStr = doc->GetXmlData();
-    args.pageDx = (float)pageRect.dx - 2 * pageBorder;
-    args.pageDy = (float)pageRect.dy - 2 * pageBorder;
-    args.SetFontName(GetDefaultFontName());
-    args.fontSize = GetDefaultFontSize();
-    args.textAllocator = &allocator;
-    args.textRenderMethod = mui::TextRenderMethodGdiplusQuick;
+    HtmlFormatterArgs* args = new HtmlFormatterArgs();
+    args->htmlStr = doc->GetXmlData();
+    args->pageDx = (float)pageRect.dx - 2 * pageBorder;
+    args->pageDy = (float)pageRect.dy - 2 * pageBorder;
+    args->SetFontName(GetDefaultFontName());
+    args->fontSize = GetDefaultFontSize();
+    args->textAllocator = &allocator;
+    args->textRenderMethod = mui::TextRenderMethodGdiplusQuick;
 
     if (doc->IsZipped()) {
         defaultFileExt = L".fb2z";
     }
 
-    pages = Fb2Formatter(&args, doc).FormatAllPages(false);
-    // must set pageCount before ExtractPageAnchors
-    pageCount = (int)pages->size();
-    if (!ExtractPageAnchors()) {
+    if (!StartFormatting(args, false)) {
         return false;
     }
     return pageCount > 0;
@@ -991,6 +1471,7 @@ TocTree* EngineFb2::GetToc() {
     if (tocTree) {
         return tocTree;
     }
+    WaitForFormatting();
     EbookTocBuilder builder(this);
     doc->ParseToc(&builder);
     TocItem* root = builder.GetRoot();
@@ -1042,6 +1523,7 @@ class EngineMobi : public EngineEbook {
         defaultFileExt = L".mobi";
     }
     ~EngineMobi() override {
+        StopFormatting();
         delete tocTree;
         delete doc;
     }
@@ -1050,7 +1532,7 @@ class EngineMobi : public EngineEbook {
         if (!fileName) {
             return nullptr;
         }
-        return CreateFromFile(fileName);
+        return WithAllPages(CreateFromFile(fileName));
     }
 
     WCHAR* GetProperty(DocumentProperty prop) override {
@@ -1070,6 +1552,10 @@ class EngineMobi : public EngineEbook {
     bool Load(const WCHAR* fileName);
     bool Load(IStream* stream);
     bool FinishLoading();
+
+    HtmlFormatter* CreateFormatter(HtmlFormatterArgs* args) override {
+        return new MobiFormatter(args, doc);
+    }
 };
 
 bool EngineMobi::Load(const WCHAR* fileName) {
@@ -1088,19 +1574,16 @@ bool EngineMobi::FinishLoading() {
         return false;
     }
 
-    HtmlFormatterArgs args;
-    args.htmlStr = doc->GetHtmlData();
-    args.pageDx = (float)pageRect.dx - 2 * pageBorder;
-    args.pageDy = (float)pageRect.dy - 2 * pageBorder;
-    args.SetFontName(GetDefaultFontName());
-    args.fontSize = GetDefaultFontSize();
-    args.textAllocator = &allocator;
-    args.textRenderMethod = mui::TextRenderMethodGdiplusQuick;
+    HtmlFormatterArgs* args = new HtmlFormatterArgs();
+    args->htmlStr = doc->GetHtmlData();
+    args->pageDx = (float)pageRect.dx - 2 * pageBorder;
+    args->pageDy = (float)pageRect.dy - 2 * pageBorder;
+    args->SetFontName(GetDefaultFontName());
+    args->fontSize = GetDefaultFontSize();
+    args->textAllocator = &allocator;
+    args->textRenderMethod = mui::TextRenderMethodGdiplusQuick;
 
-    pages = MobiFormatter(&args, doc).FormatAllPages();
-    // must set pageCount before ExtractPageAnchors
-    pageCount = (int)pages->size();
-    if (!ExtractPageAnchors()) {
+    if (!StartFormatting(args, true)) {
         return false;
     }
     return pageCount > 0;
@@ -1111,13 +1594,19 @@ PageDestination* EngineMobi::GetNamedDest(const WCHAR* name) {
     if (filePos < 0 || 0 == filePos && *name != '0') {
         return nullptr;
     }
+    ScopedCritSec scope(&pagesAccess);
     int pageNo;
-    for (pageNo = 1; pageNo < PageCount(); pageNo++) {
+    int nLaidOut = pages->isize();
+    for (pageNo = 1; pageNo < nLaidOut; pageNo++) {
         if (pages->at(pageNo)->reparseIdx > filePos) {
             break;
         }
     }
-    CrashIf(pageNo < 1 || pageNo > PageCount());
+    CrashIf(pageNo < 1 || pageNo > nLaidOut);
+    if (pageNo == nLaidOut && HasPendingPageSizes()) {
+        // filePos might be on a page that hasn't been laid out yet
+        return nullptr;
+    }
 
     const std::string_view htmlData = doc->GetHtmlData();
     size_t htmlLen = htmlData.size();
@@ -1126,7 +1615,6 @@ PageDestination* EngineMobi::GetNamedDest(const WCHAR* name) {
         return nullptr;
     }
 
-    ScopedCritSec scope(&pagesAccess);
     Vec<DrawInstr>* pageInstrs = GetHtmlPage(pageNo);
     // link to the bottom of the page, if filePos points
     // beyond the last visible DrawInstr of a page
@@ -1147,6 +1635,7 @@ TocTree* EngineMobi::GetToc() {
     if (tocTree) {
         return tocTree;
     }
+    WaitForFormatting();
     EbookTocBuilder builder(this);
     doc->ParseToc(&builder);
     TocItem* root = builder.GetRoot();
@@ -1240,7 +1729,6 @@ bool EnginePdb::Load(const WCHAR* fileName) {
     args.textRenderMethod = mui::TextRenderMethodGdiplusQuick;
 
     pages = HtmlFormatter(&args).FormatAllPages();
-    // must set pageCount before ExtractPageAnchors
     pageCount = (int)pages->size();
     if (!ExtractPageAnchors()) {
         return false;
@@ -1371,7 +1859,7 @@ void ChmFormatter::HandleTagPagebreak(HtmlToken* t) {
         currPage->instructions.Append(DrawInstr::Anchor(attr->val, attr->valLen, bbox));
         pagePath.Set(str::DupN(attr->val, attr->valLen));
         // reset CSS style rules for the new document
-        styleRules.Reset();
+        ResetStyleRules();
     }
 }
 
@@ -1565,7 +2053,6 @@ bool EngineChm::Load(const WCHAR* fileName) {
     args.textRenderMethod = mui::TextRenderMethodGdiplusQuick;
 
     pages = ChmFormatter(&args, dataCache).FormatAllPages(false);
-    // must set pageCount before ExtractPageAnchors
     pageCount = (int)pages->size();
     if (!ExtractPageAnchors()) {
         return false;
@@ -1707,7 +2194,6 @@ bool EngineHtml::Load(const WCHAR* fileName) {
     args.textRenderMethod = mui::TextRenderMethodGdiplus;
 
     pages = HtmlFileFormatter(&args, doc).FormatAllPages(false);
-    // must set pageCount before ExtractPageAnchors
     pageCount = (int)pages->size();
     if (!ExtractPageAnchors()) {
         return false;
@@ -1826,7 +2312,6 @@ bool EngineTxt::Load(const WCHAR* fileName) {
     args.textRenderMethod = mui::TextRenderMethodGdiplus;
 
     pages = TxtFormatter(&args).FormatAllPages(false);
-    // must set pageCount before ExtractPageAnchors
     pageCount = (int)pages->size();
     if (!ExtractPageAnchors()) {
         return false;
@@ -26,3 +26,7 @@ bool IsTxtEngineSupportedFile(const WCHAR* fileName, bool sniff = false);
 EngineBase* CreateTxtEngineFromFile(const WCHAR* fileName);
 
 void SetDefaultEbookFont(const WCHAR* name, float size);
+// page breaks are saved in this directory, so that the page count of
+// a document opened again is known before it's been laid out completely
+// (nullptr disables saving them)
+void SetEbookLayoutCacheDir(const WCHAR* dir);
@@ -13,6 +13,7 @@ extern "C" {
 #include "utils/FileUtil.h"
 #include "utils/HtmlParserLookup.h"
 #include "utils/HtmlPullParser.h"
+#include "utils/Trace.h"
 #include "utils/TrivialHtmlParser.h"
 #include "utils/WinUtil.h"
 #include "utils/ZipUtil.h"
@@ -24,6 +25,7 @@ extern "C" {
 #include "Annotation.h"
 #include "EngineBase.h"
 #include "EngineFzUtil.h"
+#include "EngineManager.h"
 
 // extensions to Fitz that are usable for both PDF and XPS
 
@@ -31,6 +33,242 @@ extern "C" {
 // and displayed; larger files will be kept open while they're displayed
 // so that their content can be loaded on demand in order to preserve memory
 #define MAX_MEMORY_FILE_SIZE (32 * 1024 * 1024)
+// larger files are read on demand even if they're read progressively
+#define MAX_PROGRESSIVE_FILE_SIZE (512 * 1024 * 1024)
+#define PROGRESSIVE_READ_CHUNK_SIZE (256 * 1024)
+
+MemCounter gFzMem;
+
+// _msize() is cheap compared to what fitz does with the memory,
+// so the allocations of all contexts can always be counted
+static void* fz_malloc_counted(void*, size_t size) {
+    void* p = malloc(size);
+    if (p) {
+        MemCounterAlloc(gFzMem, _msize(p));
+    }
+    return p;
+}
+
+static void* fz_realloc_counted(void*, void* old, size_t size) {
+    size_t oldSize = old ? _msize(old) : 0;
+    void* p = realloc(old, size);
+    if (!p) {
+        // fitz never reallocates to 0 bytes, so old is still valid
+        return nullptr;
+    }
+    if (old) {
+        MemCounterFree(gFzMem, oldSize);
+    }
+    MemCounterAlloc(gFzMem, _msize(p));
+    return p;
+}
+
+static void fz_free_counted(void*, void* p) {
+    if (p) {
+        MemCounterFree(gFzMem, _msize(p));
+    }
+    free(p);
+}
+
+fz_alloc_context fz_alloc_counted = {nullptr, fz_malloc_counted, fz_realloc_counted, fz_free_counted};
+
+// fitz allocates and frees lots of small objects while running content streams
+// (paths, clip stacks, glyphs), which serializes render threads on the CRT's
+// heap lock. fz_alloc_scalable rounds small allocations up to a few size classes
+// and keeps freed blocks in per-thread caches for re-use by the same thread.
+// Blocks may be freed on any thread, they're simply cached by that thread.
+
+// each block is preceded by its size class and requested size
+// (two size_t, so that the data keeps malloc's alignment)
+struct FzBlockHeader {
+    size_t size;
+    size_t sizeClass;
+};
+
+#define FZ_LARGE_BLOCK ((size_t)-1)
+// upper limit for the number of freed blocks kept per thread and size class
+#define FZ_MAX_CACHED_BLOCKS 512
+
+static const size_t gFzSizeClasses[] = {16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024};
+
+struct FzThreadCache {
+    FzBlockHeader* freeBlocks[dimof(gFzSizeClasses)] = {};
+    int nFreeBlocks[dimof(gFzSizeClasses)] = {};
+
+    ~FzThreadCache() {
+        for (size_t i = 0; i < dimof(gFzSizeClasses); i++) {
+            while (freeBlocks[i]) {
+                FzBlockHeader* next = *(FzBlockHeader**)(freeBlocks[i] + 1);
+                MemCounterFree(gFzMem, sizeof(FzBlockHeader) + gFzSizeClasses[i]);
+                free(freeBlocks[i]);
+                freeBlocks[i] = next;
+            }
+        }
+    }
+};
+
+static thread_local FzThreadCache gFzThreadCache;
+
+static size_t FzSizeClassFor(size_t size) {
+    for (size_t i = 0; i < dimof(gFzSizeClasses); i++) {
+        if (size <= gFzSizeClasses[i]) {
+            return i;
+        }
+    }
+    return FZ_LARGE_BLOCK;
+}
+
+static size_t FzBlockSize(FzBlockHeader* hdr) {
+    size_t n = hdr->sizeClass == FZ_LARGE_BLOCK ? hdr->size : gFzSizeClasses[hdr->sizeClass];
+    return sizeof(FzBlockHeader) + n;
+}
+
+static void* fz_malloc_scalable(void*, size_t size) {
+    size_t sizeClass = FzSizeClassFor(size);
+    FzBlockHeader* hdr = nullptr;
+    if (sizeClass != FZ_LARGE_BLOCK) {
+        FzThreadCache& cache = gFzThreadCache;
+        hdr = cache.freeBlocks[sizeClass];
+        if (hdr) {
+            // freed blocks are linked through their (no longer used) data
+            cache.freeBlocks[sizeClass] = *(FzBlockHeader**)(hdr + 1);
+            cache.nFreeBlocks[sizeClass]--;
+            hdr->size = size;
+            return hdr + 1;
+        }
+        hdr = (FzBlockHeader*)malloc(sizeof(FzBlockHeader) + gFzSizeClasses[sizeClass]);
+    } else {
+        hdr = (FzBlockHeader*)malloc(sizeof(FzBlockHeader) + size);
+    }
+    if (!hdr) {
+        return nullptr;
+    }
+    hdr->size = size;
+    hdr->sizeClass = sizeClass;
+    MemCounterAlloc(gFzMem, FzBlockSize(hdr));
+    return hdr + 1;
+}
+
+static void fz_free_scalable(void*, void* p) {
+    if (!p) {
+        return;
+    }
+    FzBlockHeader* hdr = (FzBlockHeader*)p - 1;
+    size_t sizeClass = hdr->sizeClass;
+    if (sizeClass != FZ_LARGE_BLOCK) {
+        FzThreadCache& cache = gFzThreadCache;
+        if (cache.nFreeBlocks[sizeClass] < FZ_MAX_CACHED_BLOCKS) {
+            *(FzBlockHeader**)p = cache.freeBlocks[sizeClass];
+            cache.freeBlocks[sizeClass] = hdr;
+            cache.nFreeBlocks[sizeClass]++;
+            return;
+        }
+    }
+    MemCounterFree(gFzMem, FzBlockSize(hdr));
+    free(hdr);
+}
+
+static void* fz_realloc_scalable(void* opaque, void* old, size_t size) {
+    if (!old) {
+        return fz_malloc_scalable(opaque, size);
+    }
+    FzBlockHeader* hdr = (FzBlockHeader*)old - 1;
+    if (hdr->sizeClass != FZ_LARGE_BLOCK && size <= gFzSizeClasses[hdr->sizeClass]) {
+        hdr->size = size;
+        return old;
+    }
+    if (hdr->sizeClass == FZ_LARGE_BLOCK && FzSizeClassFor(size) == FZ_LARGE_BLOCK) {
+        size_t oldSize = FzBlockSize(hdr);
+        FzBlockHeader* newHdr = (FzBlockHeader*)realloc(hdr, sizeof(FzBlockHeader) + size);
+        if (!newHdr) {
+            // fitz never reallocates to 0 bytes, so old is still valid
+            return nullptr;
+        }
+        newHdr->size = size;
+        MemCounterFree(gFzMem, oldSize);
+        MemCounterAlloc(gFzMem, FzBlockSize(newHdr));
+        return newHdr + 1;
+    }
+    void* p = fz_malloc_scalable(opaque, size);
+    if (!p) {
+        return nullptr;
+    }
+    memcpy(p, old, std::min(hdr->size, size));
+    fz_free_scalable(opaque, old);
+    return p;
+}
+
+static fz_alloc_context fz_alloc_scalable = {nullptr, fz_malloc_scalable, fz_realloc_scalable, fz_free_scalable};
+
+static bool gUseScalableFzAllocator = false;
+
+void EnableScalableFzAllocator(bool enable) {
+    gUseScalableFzAllocator = enable;
+}
+
+// a context's memory is always freed with the allocator it was created with,
+// so this may change at any time (it only affects contexts created afterwards)
+fz_alloc_context* GetFzAllocator() {
+    return gUseScalableFzAllocator ? &fz_alloc_scalable : &fz_alloc_counted;
+}
+
+// in mupdf_load_system_font.c
+extern "C" void pdf_install_load_system_font_funcs(fz_context* ctx);
+
+static CRITICAL_SECTION gFzMutexes[FZ_LOCK_MAX];
+
+static void fz_lock_shared_cs(void*, int lock) {
+    EnterCriticalSection(&gFzMutexes[lock]);
+}
+
+static void fz_unlock_shared_cs(void*, int lock) {
+    LeaveCriticalSection(&gFzMutexes[lock]);
+}
+
+static fz_locks_context gFzLocks = {nullptr, fz_lock_shared_cs, fz_unlock_shared_cs};
+
+static size_t gFzStoreSize = MAX_CONTEXT_MEMORY;
+
+void SetFzStoreSizeMB(int sizeMB) {
+    gFzStoreSize = sizeMB > 0 ? (size_t)sizeMB * 1024 * 1024 : MAX_CONTEXT_MEMORY;
+}
+
+// the base context is never used directly and lives until the process exits
+static fz_context* CreateSharedFzContext() {
+    for (size_t i = 0; i < dimof(gFzMutexes); i++) {
+        InitializeCriticalSection(&gFzMutexes[i]);
+    }
+    fz_context* ctx = fz_new_context(GetFzAllocator(), &gFzLocks, gFzStoreSize);
+    if (ctx) {
+        pdf_install_load_system_font_funcs(ctx);
+    }
+    return ctx;
+}
+
+static fz_context* GetSharedFzContext() {
+    // engines are created on several threads, static initialization is thread-safe
+    static fz_context* sharedCtx = CreateSharedFzContext();
+    return sharedCtx;
+}
+
+fz_context* NewFzContext() {
+    return fz_clone_context(GetSharedFzContext());
+}
+
+void GetFzStoreStats(FzStoreStats* stats) {
+    *stats = {};
+    fz_context* ctx = GetSharedFzContext();
+    if (!ctx) {
+        return;
+    }
+    fz_store_stats fzStats;
+    fz_get_store_stats(ctx, &fzStats);
+    stats->hits = fzStats.hits;
+    stats->misses = fzStats.misses;
+    stats->evictions = fzStats.evictions;
+    stats->size = fzStats.size;
+    stats->maxSize = fzStats.max;
+}
 
 RectD fz_rect_to_RectD(fz_rect rect) {
     return RectD::FromXY(rect.x0, rect.y0, rect.x1, rect.y1);
@@ -96,42 +334,104 @@ fz_matrix fz_create_view_ctm(fz_rect mediabox, float zoom, int rotation) {
     return ctm;
 }
 
+// reads are buffered and the buffer grows while a stream is read sequentially.
+// seeking within the buffered data doesn't call into the IStream at all and the
+// IStream's seek pointer is only moved when reading, as each call might have
+// to be marshalled to another thread (e.g. for the preview handler)
+#define ISTREAM_MIN_READ_SIZE (16 * 1024)
+#define ISTREAM_MAX_READ_SIZE (1024 * 1024)
+
 struct istream_filter {
     IStream* stream;
-    unsigned char buf[4096];
+    // the size of the stream (-1 if unknown)
+    i64 size;
+    // the position of the IStream's seek pointer
+    i64 streamPos;
+    // buf contains bufLen bytes from offset bufPos
+    i64 bufPos;
+    size_t bufLen;
+    size_t bufSize;
+    // doubled for sequential reads, reset for random ones
+    size_t readSize;
+    unsigned char* buf;
 };
 
 extern "C" static int next_istream(fz_context* ctx, fz_stream* stm, size_t max) {
     UNUSED(max);
     istream_filter* state = (istream_filter*)stm->state;
-    ULONG cbRead = sizeof(state->buf);
-    HRESULT res = state->stream->Read(state->buf, sizeof(state->buf), &cbRead);
-    if (FAILED(res))
-        fz_throw(ctx, FZ_ERROR_GENERIC, "IStream read error: %x", res);
-    stm->rp = state->buf;
-    stm->wp = stm->rp + cbRead;
-    stm->pos += cbRead;
+    i64 pos = stm->pos;
+    i64 bufEnd = state->bufPos + (i64)state->bufLen;
+    // the data might still be buffered after seeking back
+    if (pos < state->bufPos || pos >= bufEnd) {
+        if (pos == bufEnd) {
+            state->readSize = std::min(state->readSize * 2, (size_t)ISTREAM_MAX_READ_SIZE);
+        } else {
+            state->readSize = ISTREAM_MIN_READ_SIZE;
+        }
+        if (state->readSize > state->bufSize) {
+            state->buf = (unsigned char*)fz_realloc(ctx, state->buf, state->readSize);
+            state->bufSize = state->readSize;
+        }
+        // invalidate the buffer in case reading fails
+        state->bufLen = 0;
+        if (state->streamPos != pos) {
+            LARGE_INTEGER off;
+            off.QuadPart = pos;
+            HRESULT res = state->stream->Seek(off, STREAM_SEEK_SET, nullptr);
+            if (FAILED(res))
+                fz_throw(ctx, FZ_ERROR_GENERIC, "IStream seek error: %x", res);
+            state->streamPos = pos;
+        }
+        ULONG cbRead = 0;
+        HRESULT res = state->stream->Read(state->buf, (ULONG)state->readSize, &cbRead);
+        if (FAILED(res))
+            fz_throw(ctx, FZ_ERROR_GENERIC, "IStream read error: %x", res);
+        state->streamPos += cbRead;
+        state->bufPos = pos;
+        state->bufLen = cbRead;
+        bufEnd = pos + cbRead;
+        if (0 == cbRead) {
+            stm->rp = stm->wp = state->buf;
+            return EOF;
+        }
+    }
+    stm->rp = state->buf + (pos - state->bufPos);
+    stm->wp = state->buf + state->bufLen;
+    stm->pos = bufEnd;
 
-    return cbRead > 0 ? *stm->rp++ : EOF;
+    return *stm->rp++;
 }
 
 extern "C" static void seek_istream(fz_context* ctx, fz_stream* stm, i64 offset, int whence) {
     istream_filter* state = (istream_filter*)stm->state;
-    LARGE_INTEGER off;
-    ULARGE_INTEGER n;
-    off.QuadPart = offset;
-    HRESULT res = state->stream->Seek(off, whence, &n);
-    if (FAILED(res))
-        fz_throw(ctx, FZ_ERROR_GENERIC, "IStream seek error: %x", res);
-    if (n.HighPart != 0 || n.LowPart > INT_MAX)
+    // fz_seek converts whence 1 into 0
+    i64 pos = offset;
+    if (2 == whence) {
+        if (state->size < 0) {
+            LARGE_INTEGER off;
+            ULARGE_INTEGER n;
+            off.QuadPart = offset;
+            HRESULT res = state->stream->Seek(off, STREAM_SEEK_END, &n);
+            if (FAILED(res))
+                fz_throw(ctx, FZ_ERROR_GENERIC, "IStream seek error: %x", res);
+            state->streamPos = (i64)n.QuadPart;
+            pos = state->streamPos;
+        } else {
+            pos += state->size;
+        }
+    }
+    if (pos < 0)
+        pos = 0;
+    if (pos > INT_MAX)
         fz_throw(ctx, FZ_ERROR_GENERIC, "documents beyond 2GB aren't supported");
-    stm->pos = n.LowPart;
+    stm->pos = pos;
     stm->rp = stm->wp = state->buf;
 }
 
 extern "C" static void drop_istream(fz_context* ctx, void* state_) {
     istream_filter* state = (istream_filter*)state_;
     state->stream->Release();
+    fz_free(ctx, state->buf);
     fz_free(ctx, state);
 }
 
@@ -147,7 +447,22 @@ fz_stream* fz_open_istream(fz_context* ctx, IStream* stream) {
     }
 
     istream_filter* state = fz_malloc_struct(ctx, istream_filter);
+    fz_try(ctx) {
+        state->buf = (unsigned char*)fz_malloc(ctx, ISTREAM_MIN_READ_SIZE);
+    }
+    fz_catch(ctx) {
+        fz_free(ctx, state);
+        fz_rethrow(ctx);
+    }
     state->stream = stream;
+    state->bufSize = ISTREAM_MIN_READ_SIZE;
+    // so that the first (sequential) read is ISTREAM_MIN_READ_SIZE
+    state->readSize = ISTREAM_MIN_READ_SIZE / 2;
+    state->size = -1;
+    STATSTG stat;
+    if (SUCCEEDED(stream->Stat(&stat, STATFLAG_NONAME))) {
+        state->size = (i64)stat.cbSize.QuadPart;
+    }
     stream->AddRef();
 
     fz_stream* stm = fz_new_stream(ctx, state, next_istream, drop_istream);
@@ -212,6 +527,124 @@ fz_stream* fz_open_file2(fz_context* ctx, const WCHAR* filePath) {
     return stm;
 }
 
+struct progressive_file {
+    HANDLE hFile;
+    HANDLE thread;
+    u8* data;
+    i64 size;
+    // number of bytes read so far (only ever grows)
+    volatile LONG64 available;
+    volatile LONG failed;
+    volatile LONG abort;
+};
+
+static DWORD WINAPI ReadProgressiveFileThread(LPVOID data) {
+    progressive_file* state = (progressive_file*)data;
+    i64 available = 0;
+    while (available < state->size && !state->abort) {
+        DWORD toRead = (DWORD)std::min((i64)PROGRESSIVE_READ_CHUNK_SIZE, state->size - available);
+        DWORD nRead = 0;
+        BOOL ok = ReadFile(state->hFile, state->data + available, toRead, &nRead, nullptr);
+        if (!ok || nRead == 0) {
+            InterlockedExchange(&state->failed, 1);
+            break;
+        }
+        // the data must have been written before it's made available
+        available = InterlockedAdd64(&state->available, nRead);
+    }
+    return 0;
+}
+
+extern "C" static int next_progressive(fz_context* ctx, fz_stream* stm, size_t max) {
+    UNUSED(max);
+    progressive_file* state = (progressive_file*)stm->state;
+    if (stm->pos >= state->size) {
+        return EOF;
+    }
+    i64 available = InterlockedCompareExchange64(&state->available, 0, 0);
+    if (stm->pos >= available) {
+        if (state->failed) {
+            fz_throw(ctx, FZ_ERROR_GENERIC, "read error at offset %d", (int)stm->pos);
+        }
+        fz_throw(ctx, FZ_ERROR_TRYLATER, "offset %d hasn't been read yet", (int)stm->pos);
+    }
+    stm->rp = state->data + stm->pos;
+    stm->wp = state->data + available;
+    stm->pos = available;
+    return *stm->rp++;
+}
+
+// fz_seek converts whence 1 into 0
+extern "C" static void seek_progressive(fz_context* ctx, fz_stream* stm, i64 offset, int whence) {
+    UNUSED(ctx);
+    progressive_file* state = (progressive_file*)stm->state;
+    if (2 == whence) {
+        offset += state->size;
+    }
+    stm->pos = std::max(std::min(offset, state->size), (i64)0);
+    stm->rp = stm->wp = state->data;
+}
+
+extern "C" static void drop_progressive(fz_context* ctx, void* state_) {
+    progressive_file* state = (progressive_file*)state_;
+    if (state->thread) {
+        InterlockedExchange(&state->abort, 1);
+        WaitForSingleObject(state->thread, INFINITE);
+        CloseHandle(state->thread);
+    }
+    CloseHandle(state->hFile);
+    fz_free(ctx, state->data);
+    fz_free(ctx, state);
+}
+
+fz_stream* fz_open_file_progressive(fz_context* ctx, const WCHAR* filePath) {
+    HANDLE hFile = file::OpenReadOnly(filePath);
+    LARGE_INTEGER size{};
+    if (hFile == INVALID_HANDLE_VALUE || !GetFileSizeEx(hFile, &size) || size.QuadPart <= 0 ||
+        size.QuadPart > MAX_PROGRESSIVE_FILE_SIZE) {
+        if (hFile != INVALID_HANDLE_VALUE) {
+            CloseHandle(hFile);
+        }
+        return fz_open_file2(ctx, filePath);
+    }
+
+    progressive_file* state = (progressive_file*)fz_calloc_no_throw(ctx, 1, sizeof(progressive_file));
+    if (!state) {
+        CloseHandle(hFile);
+        return nullptr;
+    }
+    state->hFile = hFile;
+    state->size = size.QuadPart;
+    state->data = (u8*)fz_malloc_no_throw(ctx, (size_t)state->size);
+    if (state->data) {
+        state->thread = CreateThread(nullptr, 0, ReadProgressiveFileThread, state, 0, nullptr);
+    }
+    if (!state->thread) {
+        drop_progressive(ctx, state);
+        return fz_open_file2(ctx, filePath);
+    }
+
+    fz_stream* stm = nullptr;
+    fz_try(ctx) {
+        // drops the state on failure
+        stm = fz_new_stream(ctx, state, next_progressive, drop_progressive);
+    }
+    fz_catch(ctx) {
+        return nullptr;
+    }
+    stm->seek = seek_progressive;
+    stm->progressive = 1;
+    return stm;
+}
+
+bool FzWaitForProgressiveData(fz_stream* stm, DWORD timeoutMs) {
+    if (!stm || stm->next != next_progressive) {
+        return true;
+    }
+    progressive_file* state = (progressive_file*)stm->state;
+    return WaitForSingleObject(state->thread, timeoutMs) == WAIT_OBJECT_0;
+}
+
 std::string_view fz_extract_stream_data(fz_context* ctx, fz_stream* stream) {
     fz_seek(ctx, stream, 0, 2);
     i64 fileLen = fz_tell(ctx, stream);
@@ -260,57 +693,20 @@ void fz_stream_fingerprint(fz_context* ctx, fz_stream* stm, unsigned char digest
 }
 
 // try to produce an 8-bit palette for saving some memory
-static RenderedBitmap* try_render_as_palette_image(fz_pixmap* pixmap) {
+// (samples are either in RGBA or, if isBgr is true, in BGRA order)
+static RenderedBitmap* try_render_as_palette_image(fz_pixmap* pixmap, bool isBgr = false) {
     int w = pixmap->w;
     int h = pixmap->h;
-    int rows8 = ((w + 3) / 4) * 4;
-    unsigned char* bmpData = (unsigned char*)calloc(rows8, h);
-    if (!bmpData)
+    // bail out early (before creating a DIB section) for most pixmaps with too many colors
+    if (!MayConvertToPalette(pixmap->samples, w, h, isBgr)) {
         return nullptr;
+    }
 
+    int rows8 = ((w + 3) / 4) * 4;
     ScopedMem<BITMAPINFO> bmi((BITMAPINFO*)calloc(1, sizeof(BITMAPINFO) + 255 * sizeof(RGBQUAD)));
-
-    unsigned char* dest = bmpData;
-    unsigned char* source = pixmap->samples;
-    uint32_t* palette = (uint32_t*)bmi.Get()->bmiColors;
-    BYTE grayIdxs[256] = {0};
-
-    int paletteSize = 0;
-    RGBQUAD c;
-    for (int j = 0; j < h; j++) {
-        for (int i = 0; i < w; i++) {
-            c.rgbRed = *source++;
-            c.rgbGreen = *source++;
-            c.rgbBlue = *source++;
-            c.rgbReserved = 0;
-            source++;
-
-            /* find this color in the palette */
-            int k;
-            bool isGray = c.rgbRed == c.rgbGreen && c.rgbRed == c.rgbBlue;
-            if (isGray) {
-                k = grayIdxs[c.rgbRed] || palette[0] == *(uint32_t*)&c ? grayIdxs[c.rgbRed] : paletteSize;
-            } else {
-                for (k = 0; k < paletteSize && palette[k] != *(uint32_t*)&c; k++)
-                    ;
-            }
-            /* add it to the palette if it isn't in there and if there's still space left */
-            if (k == paletteSize) {
-                if (++paletteSize > 256) {
-                    free(bmpData);
-                    return nullptr;
-                }
-                if (isGray) {
-                    grayIdxs[c.rgbRed] = (BYTE)k;
-                }
-                palette[k] = *(uint32_t*)&c;
-            }
-            /* 8-bit data consists of indices into the color palette */
-            *dest++ = k;
-        }
-        dest += rows8 - w;
+    if (!bmi) {
+        return nullptr;
     }
-
     BITMAPINFOHEADER* bmih = &bmi.Get()->bmiHeader;
     bmih->biSize = sizeof(*bmih);
     bmih->biWidth = w;
@@ -319,17 +715,37 @@ static RenderedBitmap* try_render_as_palette_image(fz_pixmap* pixmap) {
     bmih->biCompression = BI_RGB;
     bmih->biBitCount = 8;
     bmih->biSizeImage = h * rows8;
-    bmih->biClrUsed = paletteSize;
+    bmih->biClrUsed = 256;
 
+    // the palette indices are written directly into the DIB section
+    // and the palette is updated once it's complete
     void* data = nullptr;
     HANDLE hMap = CreateFileMapping(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, bmih->biSizeImage, nullptr);
     HBITMAP hbmp = CreateDIBSection(nullptr, bmi, DIB_RGB_COLORS, &data, hMap, 0);
-    if (!hbmp) {
-        free(bmpData);
+    if (!hbmp || !data) {
+        if (hbmp) {
+            DeleteObject(hbmp);
+        }
+        if (hMap) {
+            CloseHandle(hMap);
+        }
+        return nullptr;
+    }
+
+    RGBQUAD* palette = bmi.Get()->bmiColors;
+    int paletteSize = ConvertToPalette(pixmap->samples, w, h, isBgr, (u8*)data, rows8, palette);
+    if (paletteSize < 0) {
+        DeleteObject(hbmp);
+        if (hMap) {
+            CloseHandle(hMap);
+        }
         return nullptr;
     }
-    memcpy(data, bmpData, bmih->biSizeImage);
-    free(bmpData);
+    HDC hdc = CreateCompatibleDC(nullptr);
+    HGDIOBJ prev = SelectObject(hdc, hbmp);
+    SetDIBColorTable(hdc, 0, paletteSize, palette);
+    SelectObject(hdc, prev);
+    DeleteDC(hdc);
     return new RenderedBitmap(hbmp, Size(w, h), hMap);
 }
 
@@ -364,6 +780,7 @@ fz_pixmap* fz_convert_pixmap2(fz_context* ctx, fz_pixmap* pix, fz_colorspace* ds
 }
 
 RenderedBitmap* new_rendered_fz_pixmap(fz_context* ctx, fz_pixmap* pixmap) {
+    TraceSpan span("new_rendered_fz_pixmap");
     if (pixmap->n == 4 && fz_colorspace_is_rgb(ctx, pixmap->colorspace)) {
         RenderedBitmap* res = try_render_as_palette_image(pixmap);
         if (res) {
@@ -428,6 +845,57 @@ RenderedBitmap* new_rendered_fz_pixmap(fz_context* ctx, fz_pixmap* pixmap) {
     return new RenderedBitmap(hbmp, Size(w, h), hMap);
 }
 
+// creates a BGRA pixmap whose samples live in a DIB section so that
+// it can be rendered into and then turned into a RenderedBitmap
+// without an intermediary conversion and copy (cf. new_rendered_fz_dib_pixmap)
+// throws if the DIB section can't be created
+fz_pixmap* new_dib_fz_pixmap(fz_context* ctx, fz_irect bbox, HBITMAP* hbmpOut, HANDLE* hMapOut) {
+    int w = bbox.x1 - bbox.x0;
+    int h = bbox.y1 - bbox.y0;
+    if (w <= 0 || h <= 0) {
+        fz_throw(ctx, FZ_ERROR_GENERIC, "invalid pixmap size %d x %d", w, h);
+    }
+
+    // rows of 32-bit DIBs are always DWORD aligned, so they match the pixmap's stride.
+    // a re-used bitmap contains the previous pixels, callers clear the pixmap anyway
+    void* data = nullptr;
+    HANDLE hMap = nullptr;
+    HBITMAP hbmp = CreatePooledMemoryBitmap(Size(w, h), &hMap, &data);
+    if (!hbmp) {
+        fz_throw(ctx, FZ_ERROR_GENERIC, "couldn't create a %d x %d DIB section", w, h);
+    }
+
+    fz_pixmap* pix = nullptr;
+    fz_try(ctx) {
+        pix = fz_new_pixmap_with_bbox_and_data(ctx, fz_device_bgr(ctx), bbox, nullptr, 1, (u8*)data);
+    }
+    fz_catch(ctx) {
+        DeleteObject(hbmp);
+        CloseHandle(hMap);
+        fz_rethrow(ctx);
+    }
+    *hbmpOut = hbmp;
+    *hMapOut = hMap;
+    return pix;
+}
+
+// takes ownership of hbmp and hMap as created by new_dib_fz_pixmap
+// (pixmap must still be dropped by the caller)
+// if tryPalette is false, the attempt to save memory with an 8-bit palette
+// is skipped (because the pixmap is known to contain too many colors)
+RenderedBitmap* new_rendered_fz_dib_pixmap(fz_context* ctx, fz_pixmap* pixmap, HBITMAP hbmp, HANDLE hMap,
+                                           bool tryPalette) {
+    RenderedBitmap* res = tryPalette ? try_render_as_palette_image(pixmap, true) : nullptr;
+    if (res) {
+        if (!ReturnToBitmapPool(hbmp, hMap)) {
+            DeleteObject(hbmp);
+            CloseHandle(hMap);
+        }
+        return res;
+    }
+    return new RenderedBitmap(hbmp, Size(pixmap->w, pixmap->h), hMap);
+}
+
 static inline int wchars_per_rune(int rune) {
     if (rune & 0x1F0000) {
         return 2;
@@ -492,10 +960,14 @@ WCHAR* fz_text_page_to_str(fz_stext_page* text, Rect** coordsOut) {
     const WCHAR* lineSep = L"\n";
 
     size_t lineSepLen = str::Len(lineSep);
-    str::WStr content;
+    // the text and coordinates are collected in the thread's arena (where they
+    // grow in place) and then copied into exactly sized results
+    ArenaAllocator* arena = GetThreadArena();
+    ScopedArenaMark arenaMark(arena);
+    str::WStr content(0, arena);
     // coordsOut is optional but we ask for it by default so we simplify the code
     // by always calculating it
-    Vec<Rect> rects;
+    Vec<Rect> rects(0, arena);
 
     fz_stext_block* block = text->first_block;
     while (block) {
@@ -520,10 +992,11 @@ WCHAR* fz_text_page_to_str(fz_stext_page* text, Rect** coordsOut) {
     CrashIf(content.size() != rects.size());
 
     if (coordsOut) {
-        *coordsOut = rects.StealData();
+        // including the zero padding, like Vec::StealData
+        *coordsOut = (Rect*)memdup(rects.LendData(), (rects.size() + 1) * sizeof(Rect));
     }
 
-    return content.StealData();
+    return str::DupN(content.Get(), content.size());
 }
 
 // copy of fz_is_external_link without ctx
@@ -637,14 +1110,22 @@ static const WCHAR* LinkifyMultilineText(LinkRectList* list, const WCHAR* pageTe
     return end;
 }
 
+// iswalnum is a comparatively expensive call and most page text is ASCII
+inline bool IsAlnumFast(WCHAR c) {
+    if (c < 0x80) {
+        return '0' <= c && c <= '9' || 'a' <= (c | 0x20) && (c | 0x20) <= 'z';
+    }
+    return iswalnum(c);
+}
+
 // cf. http://weblogs.mozillazine.org/gerv/archives/2011/05/html5_email_address_regexp.html
 inline bool IsEmailUsernameChar(WCHAR c) {
     // explicitly excluding the '/' from the list, as it is more
     // often part of a URL or path than of an email address
-    return iswalnum(c) || c && str::FindChar(L".!#$%&'*+=?^_`{|}~-", c);
+    return IsAlnumFast(c) || c > ' ' && c < 0x80 && str::FindChar(L".!#$%&'*+=?^_`{|}~-", c);
 }
 inline bool IsEmailDomainChar(WCHAR c) {
-    return iswalnum(c) || '-' == c;
+    return IsAlnumFast(c) || '-' == c;
 }
 
 static const WCHAR* LinkifyFindEmail(const WCHAR* pageText, const WCHAR* at) {
@@ -677,36 +1158,63 @@ static const WCHAR* LinkifyEmailAddress(const WCHAR* start) {
 LinkRectList* LinkifyText(const WCHAR* pageText, Rect* coords) {
     LinkRectList* list = new LinkRectList;
 
+    // most pages don't contain any links at all, so check for
+    // the substrings all links need before scanning character by character
+    if (!str::FindChar(pageText, '@') && !str::Find(pageText, L"://") && !str::Find(pageText, L"www.")) {
+        return list;
+    }
+
+    // start of the run of e-mail username characters right before start, so that
+    // it doesn't have to be searched backwards from every '@'
+    // (nullptr if unknown, which happens after skipping over a link)
+    const WCHAR* usernameStart = pageText;
     for (const WCHAR* start = pageText; *start; start++) {
+        WCHAR c = *start;
+        if ('@' != c && 'h' != c && 'w' != c && 'm' != c) {
+            if (!IsEmailUsernameChar(c)) {
+                usernameStart = start + 1;
+            }
+            continue;
+        }
+
         const WCHAR* end = nullptr;
         bool multiline = false;
         const WCHAR* protocol = nullptr;
 
-        if ('@' == *start) {
+        if ('@' == c) {
             // potential email address without mailto:
-            const WCHAR* email = LinkifyFindEmail(pageText, start);
+            const WCHAR* email = usernameStart;
+            if (!email) {
+                email = LinkifyFindEmail(pageText, start);
+            } else if (email == start) {
+                email = nullptr;
+            }
             end = email ? LinkifyEmailAddress(email) : nullptr;
             protocol = L"mailto:";
             if (end != nullptr)
                 start = email;
-        } else if (start > pageText && ('/' == start[-1] || iswalnum(start[-1]))) {
+        } else if (start > pageText && ('/' == start[-1] || IsAlnumFast(start[-1]))) {
             // hyperlinks must not be preceded by a slash (indicates a different protocol)
             // or an alphanumeric character (indicates part of a different protocol)
-        } else if ('h' == *start && str::Parse(start, L"http%?s://")) {
+        } else if ('h' == c && str::Parse(start, L"http%?s://")) {
             end = LinkifyFindEnd(start, start > pageText ? start[-1] : ' ');
             multiline = LinkifyCheckMultiline(pageText, end, coords);
-        } else if ('w' == *start && str::StartsWith(start, L"www.")) {
+        } else if ('w' == c && str::StartsWith(start, L"www.")) {
             end = LinkifyFindEnd(start, start > pageText ? start[-1] : ' ');
             multiline = LinkifyCheckMultiline(pageText, end, coords);
             protocol = L"http://";
             // ignore www. links without a top-level domain
             if (end - start <= 4 || !multiline && (!wcschr(start + 5, '.') || wcschr(start + 5, '.') >= end))
                 end = nullptr;
-        } else if ('m' == *start && str::StartsWith(start, L"mailto:")) {
+        } else if ('m' == c && str::StartsWith(start, L"mailto:")) {
             end = LinkifyEmailAddress(start + 7);
         }
-        if (!end)
+        if (!end) {
+            if ('@' == c) {
+                usernameStart = start + 1;
+            }
             continue;
+        }
 
         AutoFreeWstr part(str::DupN(start, end - start));
         WCHAR* uri = protocol ? str::Join(protocol, part) : part.StealData();
@@ -717,6 +1225,10 @@ LinkRectList* LinkifyText(const WCHAR* pageText, Rect* coords) {
             end = LinkifyMultilineText(list, pageText, start, end + 1, coords);
 
         start = end;
+        usernameStart = nullptr;
+        if (!*start) {
+            break;
+        }
     }
 
     return list;
@@ -1048,39 +1560,171 @@ PageElement* makePdfCommentFromPdfAnnot(fz_context* ctx, int pageNo, pdf_annot*
     return newFzComment(ws, pageNo, rd);
 }
 
-PageElement* FzGetElementAtPos(FzPageInfo* pageInfo, PointD pt) {
-    if (!pageInfo) {
-        return nullptr;
+// kinds of grid items, in the order in which they're hit-tested
+enum {
+    GridItemLink = 0,
+    GridItemAutoLink,
+    GridItemComment,
+    GridItemImage,
+};
+
+#define GRID_ITEM(kind, idx) (((kind) << 24) | (idx))
+#define GRID_ITEM_KIND(item) ((item) >> 24)
+#define GRID_ITEM_IDX(item) ((item)&0xffffff)
+
+// the grid has about one cell per element, up to this many cells per side
+#define GRID_MAX_CELLS_PER_SIDE 64
+
+struct GridItemRect {
+    int item;
+    fz_rect rect;
+};
+
+void FzElementsGrid::Reset() {
+    bounds = {};
+    cols = 0;
+    rows = 0;
+    cellStart.Reset();
+    cellItems.Reset();
+    links.Reset();
+}
+
+static int GridCellIdx(float v, float v0, float v1, int n) {
+    float f = v1 > v0 ? (v - v0) / (v1 - v0) * n : 0;
+    if (f < 0) {
+        return 0;
     }
-    int pageNo = pageInfo->pageNo;
-    fz_link* link = pageInfo->links;
-    fz_point p = {(float)pt.x, (float)pt.y};
-    while (link) {
-        if (fz_is_pt_in_rect(link->rect, p)) {
-            return newFzLink(pageNo, link, nullptr);
-        }
-        link = link->next;
+    if (f >= n) {
+        return n - 1;
     }
+    return (int)f;
+}
 
-    for (auto* pel : pageInfo->autoLinks) {
-        if (pel->rect.Contains(pt)) {
-            return clonePageElement(pel);
-        }
+static void AppendGridItem(Vec<GridItemRect>& items, int kind, size_t idx, RectD r) {
+    // a rect with negative size contains no point and ends up in no cell
+    items.Append({GRID_ITEM(kind, (int)idx), RectD_to_fz_rect(r)});
+}
+
+void FzBuildElementsGrid(FzPageInfo* pageInfo) {
+    FzElementsGrid& grid = pageInfo->elementsGrid;
+    grid.Reset();
+
+    Vec<GridItemRect> items;
+    for (fz_link* link = pageInfo->links; link; link = link->next) {
+        AppendGridItem(items, GridItemLink, grid.links.size(), fz_rect_to_RectD(link->rect));
+        grid.links.Append(link);
+    }
+    for (size_t i = 0; i < pageInfo->autoLinks.size(); i++) {
+        AppendGridItem(items, GridItemAutoLink, i, pageInfo->autoLinks.at(i)->rect);
+    }
+    for (size_t i = 0; i < pageInfo->comments.size(); i++) {
+        AppendGridItem(items, GridItemComment, i, pageInfo->comments.at(i)->rect);
+    }
+    for (size_t i = 0; i < pageInfo->images.size(); i++) {
+        AppendGridItem(items, GridItemImage, i, fz_rect_to_RectD(pageInfo->images.at(i).rect));
+    }
+    if (items.size() == 0 || items.size() > 0xffffff) {
+        return;
     }
 
-    for (auto* pel : pageInfo->comments) {
-        if (pel->rect.Contains(pt)) {
-            return clonePageElement(pel);
+    // unlike fz_union_rect, this includes zero-sized rects (which contain their edges)
+    fz_rect bounds = items.at(0).rect;
+    for (auto& it : items) {
+        bounds.x0 = std::min(bounds.x0, it.rect.x0);
+        bounds.y0 = std::min(bounds.y0, it.rect.y0);
+        bounds.x1 = std::max(bounds.x1, it.rect.x1);
+        bounds.y1 = std::max(bounds.y1, it.rect.y1);
+    }
+    int side = (int)sqrt((double)items.size()) + 1;
+    side = std::min(side, GRID_MAX_CELLS_PER_SIDE);
+    grid.bounds = bounds;
+    grid.cols = side;
+    grid.rows = side;
+
+    // count the items per cell, then fill them in (in the same order)
+    int nCells = grid.cols * grid.rows;
+    grid.cellStart.AppendBlanks(nCells + 1);
+    for (int pass = 0; pass < 2; pass++) {
+        Vec<int> fill;
+        if (pass == 1) {
+            for (int i = 0; i < nCells; i++) {
+                grid.cellStart.at(i + 1) += grid.cellStart.at(i);
+            }
+            grid.cellItems.AppendBlanks(grid.cellStart.at(nCells));
+            fill.Append(grid.cellStart.LendData(), nCells);
+        }
+        for (auto& it : items) {
+            int col0 = GridCellIdx(it.rect.x0, bounds.x0, bounds.x1, grid.cols);
+            int col1 = GridCellIdx(it.rect.x1, bounds.x0, bounds.x1, grid.cols);
+            int row0 = GridCellIdx(it.rect.y0, bounds.y0, bounds.y1, grid.rows);
+            int row1 = GridCellIdx(it.rect.y1, bounds.y0, bounds.y1, grid.rows);
+            for (int row = row0; row <= row1; row++) {
+                for (int col = col0; col <= col1; col++) {
+                    int cell = row * grid.cols + col;
+                    if (pass == 0) {
+                        grid.cellStart.at(cell + 1)++;
+                    } else {
+                        grid.cellItems.at(fill.at(cell)++) = it.item;
+                    }
+                }
+            }
         }
     }
+}
 
-    size_t imageIdx = 0;
-    for (auto& img : pageInfo->images) {
-        fz_rect ir = img.rect;
-        if (fz_is_pt_in_rect(ir, p)) {
-            return newFzImage(pageNo, ir, imageIdx);
+// returns the same element as checking all links, auto-detected links,
+// comments and images in this order, but only looks at those near pt
+// and only allocates the element that has been hit
+PageElement* FzGetElementAtPos(FzPageInfo* pageInfo, PointD pt) {
+    if (!pageInfo) {
+        return nullptr;
+    }
+    FzElementsGrid& grid = pageInfo->elementsGrid;
+    if (grid.cols == 0) {
+        return nullptr;
+    }
+    fz_point p = {(float)pt.x, (float)pt.y};
+    if (!fz_is_pt_in_rect(grid.bounds, p)) {
+        return nullptr;
+    }
+
+    int col = GridCellIdx(p.x, grid.bounds.x0, grid.bounds.x1, grid.cols);
+    int row = GridCellIdx(p.y, grid.bounds.y0, grid.bounds.y1, grid.rows);
+    int cell = row * grid.cols + col;
+    int pageNo = pageInfo->pageNo;
+    for (int i = grid.cellStart.at(cell); i < grid.cellStart.at(cell + 1); i++) {
+        int item = grid.cellItems.at(i);
+        int idx = GRID_ITEM_IDX(item);
+        switch (GRID_ITEM_KIND(item)) {
+            case GridItemLink: {
+                fz_link* link = grid.links.at(idx);
+                if (fz_is_pt_in_rect(link->rect, p)) {
+                    return newFzLink(pageNo, link, nullptr);
+                }
+                break;
+            }
+            case GridItemAutoLink: {
+                PageElement* pel = pageInfo->autoLinks.at(idx);
+                if (pel->rect.Contains(pt)) {
+                    return clonePageElement(pel);
+                }
+                break;
+            }
+            case GridItemComment: {
+                PageElement* pel = pageInfo->comments.at(idx);
+                if (pel->rect.Contains(pt)) {
+                    return clonePageElement(pel);
+                }
+                break;
+            }
+            case GridItemImage: {
+                fz_rect ir = pageInfo->images.at(idx).rect;
+                if (fz_is_pt_in_rect(ir, p)) {
+                    return newFzImage(pageNo, ir, (size_t)idx);
+                }
+                break;
+            }
         }
-        imageIdx++;
     }
     return nullptr;
 }
@@ -1124,6 +1768,71 @@ void FzGetElements(Vec<PageElement*>* els, FzPageInfo* pageInfo) {
     els->Reverse();
 }
 
+static size_t EstimateStextPageSize(fz_stext_page* stext) {
+    size_t size = sizeof(fz_stext_page);
+    for (fz_stext_block* block = stext->first_block; block; block = block->next) {
+        size += sizeof(fz_stext_block);
+        if (block->type != FZ_STEXT_BLOCK_TEXT) {
+            continue;
+        }
+        for (fz_stext_line* line = block->u.t.first_line; line; line = line->next) {
+            size += sizeof(fz_stext_line);
+            for (fz_stext_char* c = line->first_char; c; c = c->next) {
+                size += sizeof(fz_stext_char);
+            }
+        }
+    }
+    return size;
+}
+
+// returns the (cached) structured text of a page, so that text is only extracted
+// once for link detection, image positions and ExtractPageText. textCache holds
+// the pages with cached text, most recently used first
+// the result is owned by pageInfo and is only valid until the next call
+// Note: make sure to only call with ctxAccess
+fz_stext_page* FzGetStextPage(fz_context* ctx, FzPageInfo* pageInfo, Vec<FzPageInfo*>& textCache) {
+    if (pageInfo->stext) {
+        if (pageInfo != textCache.at(0)) {
+            textCache.Remove(pageInfo);
+            textCache.InsertAt(0, pageInfo);
+        }
+        return pageInfo->stext;
+    }
+    if (!pageInfo->page) {
+        return nullptr;
+    }
+
+    fz_stext_page* stext = nullptr;
+    fz_var(stext);
+    fz_stext_options opts{};
+    opts.flags = FZ_STEXT_PRESERVE_IMAGES;
+    fz_try(ctx) {
+        stext = fz_new_stext_page_from_page(ctx, pageInfo->page, &opts);
+    }
+    fz_catch(ctx) {
+        return nullptr;
+    }
+
+    pageInfo->stext = stext;
+    pageInfo->stextSizeEst = EstimateStextPageSize(stext);
+    textCache.InsertAt(0, pageInfo);
+
+    // evict least recently used text pages (but always keep the newest one)
+    size_t memUsed = 0;
+    for (auto* pi : textCache) {
+        memUsed += pi->stextSizeEst;
+    }
+    while (textCache.size() > 1 && (textCache.size() > MAX_PAGE_TEXT_CACHE || memUsed > MAX_PAGE_TEXT_MEMORY)) {
+        FzPageInfo* pi = textCache.Pop();
+        memUsed -= pi->stextSizeEst;
+        fz_drop_stext_page(ctx, pi->stext);
+        pi->stext = nullptr;
+        pi->stextSizeEst = 0;
+    }
+
+    return stext;
+}
+
 void FzLinkifyPageText(FzPageInfo* pageInfo, fz_stext_page* stext) {
     if (!pageInfo || !stext) {
         return;
@@ -1243,6 +1952,29 @@ void fz_run_user_page_annots(fz_context* ctx, Vec<Annotation*>* annots, fz_devic
     }
 }
 
+// records user annotations into a display list (they might be backed by
+// pdf_annot and therefore require ctxAccess as well)
+fz_display_list* NewUserAnnotsDisplayList(fz_context* ctx, Vec<Annotation*>* annots) {
+    fz_display_list* list = fz_new_display_list(ctx, fz_infinite_rect);
+    fz_device* dev = nullptr;
+    fz_var(dev);
+    fz_try(ctx) {
+        dev = fz_new_list_device(ctx, list);
+        fz_run_user_page_annots(ctx, annots, dev, fz_identity, fz_infinite_rect, nullptr);
+        fz_close_device(ctx, dev);
+    }
+    fz_always(ctx) {
+        if (dev) {
+            fz_drop_device(ctx, dev);
+        }
+    }
+    fz_catch(ctx) {
+        fz_drop_display_list(ctx, list);
+        fz_rethrow(ctx);
+    }
+    return list;
+}
+
 void fz_run_page_transparency(fz_context* ctx, Vec<Annotation*>* annots, fz_device* dev, const fz_rect cliprect,
                               bool endGroup, bool hasTransparency) {
     if (!annots) {
@@ -1285,47 +2017,49 @@ void fz_find_image_positions(fz_context* ctx, Vec<FitzImagePos>& images, fz_stex
             // fz_convert_pixmap_samples doesn't handle src without colorspace
             // TODO: this is probably not right
             FitzImagePos img = {block->bbox, block->u.i.transform};
+            img.hasColor = !fz_colorspace_is_gray(ctx, image->colorspace);
             images.Append(img);
         }
         block = block->next;
     }
 }
 
-fz_image* fz_find_image_at_idx(fz_context* ctx, FzPageInfo* pageInfo, int idx) {
-    fz_stext_options opts{};
-    opts.flags = FZ_STEXT_PRESERVE_IMAGES;
-    fz_stext_page* stext = nullptr;
-    fz_var(stext);
-    fz_try(ctx) {
-        stext = fz_new_stext_page_from_page(ctx, pageInfo->page, &opts);
-    }
-    fz_catch(ctx) {
+// true if a color image is visible within cliprect (after transforming
+// the page by ctm), which makes it unlikely to fit into an 8-bit palette
+bool FzHasColorImagesInRect(FzPageInfo* pageInfo, fz_matrix ctm, fz_rect cliprect) {
+    for (auto& img : pageInfo->images) {
+        if (!img.hasColor) {
+            continue;
+        }
+        fz_rect r = fz_intersect_rect(fz_transform_rect(img.rect, ctm), cliprect);
+        if (!fz_is_empty_rect(r)) {
+            return true;
+        }
     }
+    return false;
+}
+
+// returns the idx-th image in the same order as fz_find_image_positions
+// (stext should be the page's cached text, cf. FzGetStextPage)
+// the image is owned by stext and is only valid while ctxAccess is held
+fz_image* fz_find_image_at_idx(fz_context* ctx, fz_stext_page* stext, int idx) {
     if (!stext) {
         return nullptr;
     }
-    fz_stext_block* block = stext->first_block;
-    while (block) {
+    for (fz_stext_block* block = stext->first_block; block; block = block->next) {
         if (block->type != FZ_STEXT_BLOCK_IMAGE) {
-            block = block->next;
             continue;
         }
         fz_image* image = block->u.i.image;
-        if (image->colorspace != nullptr) {
-            // https://github.com/sumatrapdfreader/sumatrapdf/issues/1480
-            // fz_convert_pixmap_samples doesn't handle src without colorspace
-            // TODO: this is probably not right
-            if (idx == 0) {
-                // TODO: or maybe get pixmap here
-                image = fz_keep_image(ctx, image);
-                fz_drop_stext_page(ctx, stext);
-                return image;
-            }
-            idx--;
+        // skip the same images as fz_find_image_positions
+        if (image->colorspace == nullptr) {
+            continue;
         }
-        block = block->next;
+        if (idx == 0) {
+            return image;
+        }
+        idx--;
     }
-    fz_drop_stext_page(ctx, stext);
     return nullptr;
 }
 
@@ -1380,3 +2114,539 @@ int ToPdfRgba(COLORREF c, float col[4]) {
     }
     return 4;
 }
+
+// a device drawing vector graphics to a GDI device context (used for printing, so that
+// text documents don't have to be sent to the printer as bitmaps). transparency, blend
+// modes, soft masks, stencil masks, tiling patterns and Type 3 fonts aren't supported.
+// without hdc, the device only checks whether all the content run on it is supported
+
+// GDI coordinates are integers, so paths are drawn with subpixel precision
+#define GDI_SUBPIXELS 16
+// shadings are rasterized with at most this many pixels
+#define GDI_MAX_SHADE_PIXELS (4 * 1024 * 1024)
+
+struct fz_gdi_device {
+    fz_device super;
+    HDC hdc;
+    fz_irect clip;
+    int savedDC;
+    bool unsupported;
+};
+
+struct GdiPathWalker {
+    HDC hdc;
+    fz_matrix ctm;
+};
+
+static POINT GdiPoint(fz_matrix ctm, float x, float y) {
+    fz_point pt = fz_transform_point_xy(x, y, ctm);
+    return {(LONG)floorf(pt.x * GDI_SUBPIXELS + 0.5f), (LONG)floorf(pt.y * GDI_SUBPIXELS + 0.5f)};
+}
+
+static void GdiMoveTo(fz_context*, void* arg, float x, float y) {
+    GdiPathWalker* w = (GdiPathWalker*)arg;
+    POINT pt = GdiPoint(w->ctm, x, y);
+    MoveToEx(w->hdc, pt.x, pt.y, nullptr);
+}
+
+static void GdiLineTo(fz_context*, void* arg, float x, float y) {
+    GdiPathWalker* w = (GdiPathWalker*)arg;
+    POINT pt = GdiPoint(w->ctm, x, y);
+    LineTo(w->hdc, pt.x, pt.y);
+}
+
+static void GdiCurveTo(fz_context*, void* arg, float x1, float y1, float x2, float y2, float x3, float y3) {
+    GdiPathWalker* w = (GdiPathWalker*)arg;
+    POINT pts[3] = {GdiPoint(w->ctm, x1, y1), GdiPoint(w->ctm, x2, y2), GdiPoint(w->ctm, x3, y3)};
+    PolyBezierTo(w->hdc, pts, 3);
+}
+
+static void GdiClosePath(fz_context*, void* arg) {
+    GdiPathWalker* w = (GdiPathWalker*)arg;
+    CloseFigure(w->hdc);
+}
+
+static const fz_path_walker gGdiPathWalker = {GdiMoveTo, GdiLineTo, GdiCurveTo, GdiClosePath};
+
+// adds the path's figures to the path currently being built in hdc
+static void GdiAddPath(fz_context* ctx, HDC hdc, const fz_path* path, fz_matrix ctm) {
+    GdiPathWalker w = {hdc, ctm};
+    fz_walk_path(ctx, path, &gGdiPathWalker, &w);
+}
+
+static void GdiAddText(fz_context* ctx, HDC hdc, const fz_text* text, fz_matrix ctm) {
+    for (fz_text_span* span = text->head; span; span = span->next) {
+        for (int i = 0; i < span->len; i++) {
+            if (span->items[i].gid < 0) {
+                continue;
+            }
+            fz_matrix trm = span->trm;
+            trm.e = span->items[i].x;
+            trm.f = span->items[i].y;
+            fz_path* outline = fz_outline_glyph(ctx, span->font, span->items[i].gid, fz_concat(trm, ctm));
+            if (outline) {
+                GdiAddPath(ctx, hdc, outline, fz_identity);
+                fz_drop_path(ctx, outline);
+            }
+        }
+    }
+}
+
+static COLORREF GdiColor(fz_context* ctx, fz_colorspace* cs, const float* color, fz_color_params cp) {
+    float rgb[3] = {0, 0, 0};
+    if (cs) {
+        fz_convert_color(ctx, cs, color, fz_device_rgb(ctx), rgb, nullptr, cp);
+    }
+    return MkRgbFloat(rgb[0], rgb[1], rgb[2]);
+}
+
+static HPEN GdiCreatePen(const fz_stroke_state* stroke, fz_matrix ctm, COLORREF color) {
+    float expansion = fz_matrix_expansion(ctm) * GDI_SUBPIXELS;
+    // lines are at least one device pixel wide (as in the draw device)
+    DWORD width = (DWORD)std::max(stroke->linewidth * expansion, (float)GDI_SUBPIXELS);
+
+    DWORD style = PS_GEOMETRIC;
+    switch (stroke->start_cap) {
+        case FZ_LINECAP_ROUND:
+            style |= PS_ENDCAP_ROUND;
+            break;
+        case FZ_LINECAP_SQUARE:
+            style |= PS_ENDCAP_SQUARE;
+            break;
+        default:
+            style |= PS_ENDCAP_FLAT;
+    }
+    switch (stroke->linejoin) {
+        case FZ_LINEJOIN_ROUND:
+            style |= PS_JOIN_ROUND;
+            break;
+        case FZ_LINEJOIN_BEVEL:
+            style |= PS_JOIN_BEVEL;
+            break;
+        default:
+            style |= PS_JOIN_MITER;
+    }
+
+    // GDI supports at most 16 dash lengths (and doesn't support a dash phase)
+    DWORD dashes[16];
+    int nDashes = std::min(stroke->dash_len, (int)dimof(dashes));
+    for (int i = 0; i < nDashes; i++) {
+        dashes[i] = std::max((DWORD)(stroke->dash_list[i] * expansion), (DWORD)1);
+    }
+    // an odd number of dash lengths is repeated with dashes and gaps swapped
+    if (nDashes % 2 == 1 && nDashes * 2 <= (int)dimof(dashes)) {
+        memcpy(dashes + nDashes, dashes, nDashes * sizeof(DWORD));
+        nDashes *= 2;
+    }
+    style |= nDashes > 0 ? PS_USERSTYLE : PS_SOLID;
+
+    LOGBRUSH lb = {BS_SOLID, color, 0};
+    return ExtCreatePen(style, width, &lb, nDashes, nDashes > 0 ? dashes : nullptr);
+}
+
+static void GdiFillPath(HDC hdc, COLORREF color, bool evenOdd) {
+    SetPolyFillMode(hdc, evenOdd ? ALTERNATE : WINDING);
+    HBRUSH brush = CreateSolidBrush(color);
+    HGDIOBJ prev = SelectObject(hdc, brush);
+    FillPath(hdc);
+    SelectObject(hdc, prev);
+    DeleteObject(brush);
+}
+
+static void GdiStrokePath(HDC hdc, const fz_stroke_state* stroke, fz_matrix ctm, COLORREF color) {
+    HPEN pen = GdiCreatePen(stroke, ctm, color);
+    HGDIOBJ prev = SelectObject(hdc, pen);
+    SetMiterLimit(hdc, stroke->miterlimit, nullptr);
+    StrokePath(hdc);
+    SelectObject(hdc, prev);
+    DeleteObject(pen);
+}
+
+// intersects the clip region with the path currently being built in hdc
+static void GdiClipToPath(HDC hdc, bool evenOdd) {
+    SetPolyFillMode(hdc, evenOdd ? ALTERNATE : WINDING);
+    if (!SelectClipPath(hdc, RGN_AND)) {
+        // an empty path clips everything
+        IntersectClipRect(hdc, 0, 0, 0, 0);
+    }
+}
+
+static bool GdiIsOpaque(fz_pixmap* pix) {
+    if (!pix->alpha) {
+        return true;
+    }
+    for (int y = 0; y < pix->h; y++) {
+        const u8* alpha = pix->samples + y * pix->stride + pix->n - 1;
+        for (int x = 0; x < pix->w; x++, alpha += pix->n) {
+            if (*alpha != 0xff) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// draws an opaque RGB pixmap into the unit square transformed by ctm
+static void GdiDrawPixmap(HDC hdc, fz_pixmap* pix, fz_matrix ctm) {
+    int w = pix->w, h = pix->h;
+    ScopedMem<u8> bits(AllocArray<u8>((size_t)w * h * 4));
+    if (!bits || w == 0 || h == 0) {
+        return;
+    }
+    for (int y = 0; y < h; y++) {
+        const u8* src = pix->samples + y * pix->stride;
+        u8* dst = bits.Get() + (size_t)y * w * 4;
+        for (int x = 0; x < w; x++, src += pix->n, dst += 4) {
+            dst[0] = src[2];
+            dst[1] = src[1];
+            dst[2] = src[0];
+            dst[3] = 0xff;
+        }
+    }
+
+    BITMAPINFO bmi{};
+    bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    bmi.bmiHeader.biWidth = w;
+    bmi.bmiHeader.biHeight = -h;
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+
+    XFORM prev;
+    GetWorldTransform(hdc, &prev);
+    XFORM xf = {ctm.a / w, ctm.b / w, ctm.c / h, ctm.d / h, ctm.e, ctm.f};
+    SetWorldTransform(hdc, &xf);
+    StretchDIBits(hdc, 0, 0, w, h, 0, 0, w, h, bits, &bmi, DIB_RGB_COLORS, SRCCOPY);
+    SetWorldTransform(hdc, &prev);
+}
+
+// returns true if content with the given alpha is to be drawn
+static bool GdiShouldDraw(fz_gdi_device* gdev, float alpha) {
+    if (alpha > 0 && alpha < 1) {
+        gdev->unsupported = true;
+    }
+    return gdev->hdc && alpha >= 1;
+}
+
+static bool GdiHasType3Font(fz_context* ctx, fz_gdi_device* gdev, const fz_text* text) {
+    for (fz_text_span* span = text->head; span; span = span->next) {
+        if (fz_font_t3_procs(ctx, span->font)) {
+            gdev->unsupported = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void fz_gdi_fill_path(fz_context* ctx, fz_device* dev, const fz_path* path, int even_odd, fz_matrix ctm,
+                             fz_colorspace* cs, const float* color, float alpha, fz_color_params cp) {
+    fz_gdi_device* gdev = (fz_gdi_device*)dev;
+    if (!GdiShouldDraw(gdev, alpha)) {
+        return;
+    }
+    BeginPath(gdev->hdc);
+    GdiAddPath(ctx, gdev->hdc, path, ctm);
+    EndPath(gdev->hdc);
+    GdiFillPath(gdev->hdc, GdiColor(ctx, cs, color, cp), even_odd);
+}
+
+static void fz_gdi_stroke_path(fz_context* ctx, fz_device* dev, const fz_path* path, const fz_stroke_state* stroke,
+                               fz_matrix ctm, fz_colorspace* cs, const float* color, float alpha,
+                               fz_color_params cp) {
+    fz_gdi_device* gdev = (fz_gdi_device*)dev;
+    if (!GdiShouldDraw(gdev, alpha)) {
+        return;
+    }
+    BeginPath(gdev->hdc);
+    GdiAddPath(ctx, gdev->hdc, path, ctm);
+    EndPath(gdev->hdc);
+    GdiStrokePath(gdev->hdc, stroke, ctm, GdiColor(ctx, cs, color, cp));
+}
+
+static void fz_gdi_clip_path(fz_context* ctx, fz_device* dev, const fz_path* path, int even_odd, fz_matrix ctm,
+                             fz_rect) {
+    fz_gdi_device* gdev = (fz_gdi_device*)dev;
+    if (!gdev->hdc) {
+        return;
+    }
+    SaveDC(gdev->hdc);
+    BeginPath(gdev->hdc);
+    GdiAddPath(ctx, gdev->hdc, path, ctm);
+    EndPath(gdev->hdc);
+    GdiClipToPath(gdev->hdc, even_odd);
+}
+
+static void fz_gdi_clip_stroke_path(fz_context* ctx, fz_device* dev, const fz_path* path,
+                                    const fz_stroke_state* stroke, fz_matrix ctm, fz_rect) {
+    fz_gdi_device* gdev = (fz_gdi_device*)dev;
+    if (!gdev->hdc) {
+        return;
+    }
+    SaveDC(gdev->hdc);
+    HPEN pen = GdiCreatePen(stroke, ctm, 0);
+    HGDIOBJ prev = SelectObject(gdev->hdc, pen);
+    BeginPath(gdev->hdc);
+    GdiAddPath(ctx, gdev->hdc, path, ctm);
+    EndPath(gdev->hdc);
+    WidenPath(gdev->hdc);
+    GdiClipToPath(gdev->hdc, false);
+    SelectObject(gdev->hdc, prev);
+    DeleteObject(pen);
+}
+
+static void fz_gdi_fill_text(fz_context* ctx, fz_device* dev, const fz_text* text, fz_matrix ctm, fz_colorspace* cs,
+                             const float* color, float alpha, fz_color_params cp) {
+    fz_gdi_device* gdev = (fz_gdi_device*)dev;
+    if (GdiHasType3Font(ctx, gdev, text) || !GdiShouldDraw(gdev, alpha)) {
+        return;
+    }
+    BeginPath(gdev->hdc);
+    GdiAddText(ctx, gdev->hdc, text, ctm);
+    EndPath(gdev->hdc);
+    GdiFillPath(gdev->hdc, GdiColor(ctx, cs, color, cp), false);
+}
+
+static void fz_gdi_stroke_text(fz_context* ctx, fz_device* dev, const fz_text* text, const fz_stroke_state* stroke,
+                               fz_matrix ctm, fz_colorspace* cs, const float* color, float alpha,
+                               fz_color_params cp) {
+    fz_gdi_device* gdev = (fz_gdi_device*)dev;
+    if (GdiHasType3Font(ctx, gdev, text) || !GdiShouldDraw(gdev, alpha)) {
+        return;
+    }
+    BeginPath(gdev->hdc);
+    GdiAddText(ctx, gdev->hdc, text, ctm);
+    EndPath(gdev->hdc);
+    GdiStrokePath(gdev->hdc, stroke, ctm, GdiColor(ctx, cs, color, cp));
+}
+
+static void fz_gdi_clip_text(fz_context* ctx, fz_device* dev, const fz_text* text, fz_matrix ctm, fz_rect) {
+    fz_gdi_device* gdev = (fz_gdi_device*)dev;
+    GdiHasType3Font(ctx, gdev, text);
+    if (!gdev->hdc) {
+        return;
+    }
+    SaveDC(gdev->hdc);
+    BeginPath(gdev->hdc);
+    GdiAddText(ctx, gdev->hdc, text, ctm);
+    EndPath(gdev->hdc);
+    GdiClipToPath(gdev->hdc, false);
+}
+
+static void fz_gdi_clip_stroke_text(fz_context* ctx, fz_device* dev, const fz_text* text,
+                                    const fz_stroke_state* stroke, fz_matrix ctm, fz_rect) {
+    fz_gdi_device* gdev = (fz_gdi_device*)dev;
+    GdiHasType3Font(ctx, gdev, text);
+    if (!gdev->hdc) {
+        return;
+    }
+    SaveDC(gdev->hdc);
+    HPEN pen = GdiCreatePen(stroke, ctm, 0);
+    HGDIOBJ prev = SelectObject(gdev->hdc, pen);
+    BeginPath(gdev->hdc);
+    GdiAddText(ctx, gdev->hdc, text, ctm);
+    EndPath(gdev->hdc);
+    WidenPath(gdev->hdc);
+    GdiClipToPath(gdev->hdc, false);
+    SelectObject(gdev->hdc, prev);
+    DeleteObject(pen);
+}
+
+// shadings are rasterized into an opaque pixmap (which is only
+// supported if the shading covers the whole area it's drawn to)
+static void fz_gdi_fill_shade(fz_context* ctx, fz_device* dev, fz_shade* shade, fz_matrix ctm, float alpha,
+                              fz_color_params cp) {
+    fz_gdi_device* gdev = (fz_gdi_device*)dev;
+    bool draw = GdiShouldDraw(gdev, alpha);
+    if (gdev->unsupported || alpha <= 0) {
+        return;
+    }
+    fz_irect bbox = fz_intersect_irect(fz_irect_from_rect(fz_bound_shade(ctx, shade, ctm)), gdev->clip);
+    if (fz_is_empty_irect(bbox)) {
+        return;
+    }
+    float nPixels = (float)(bbox.x1 - bbox.x0) * (float)(bbox.y1 - bbox.y0);
+    float scale = nPixels > GDI_MAX_SHADE_PIXELS ? sqrtf(GDI_MAX_SHADE_PIXELS / nPixels) : 1.f;
+    fz_irect sbox = fz_round_rect(fz_transform_rect(fz_rect_from_irect(bbox), fz_scale(scale, scale)));
+
+    fz_pixmap* pix = fz_new_pixmap_with_bbox(ctx, fz_device_rgb(ctx), sbox, nullptr, 1);
+    fz_try(ctx) {
+        fz_clear_pixmap(ctx, pix);
+        fz_paint_shade(ctx, shade, nullptr, fz_concat(ctm, fz_scale(scale, scale)), pix, cp, sbox, nullptr);
+        if (!GdiIsOpaque(pix)) {
+            gdev->unsupported = true;
+        } else if (draw) {
+            fz_matrix dst = fz_make_matrix((float)(bbox.x1 - bbox.x0), 0, 0, (float)(bbox.y1 - bbox.y0),
+                                           (float)bbox.x0, (float)bbox.y0);
+            GdiDrawPixmap(gdev->hdc, pix, dst);
+        }
+    }
+    fz_always(ctx) {
+        fz_drop_pixmap(ctx, pix);
+    }
+    fz_catch(ctx) {
+        fz_rethrow(ctx);
+    }
+}
+
+static void fz_gdi_fill_image(fz_context* ctx, fz_device* dev, fz_image* image, fz_matrix ctm, float alpha,
+                              fz_color_params cp) {
+    fz_gdi_device* gdev = (fz_gdi_device*)dev;
+    if (image->mask || image->use_colorkey) {
+        gdev->unsupported = true;
+    }
+    bool draw = GdiShouldDraw(gdev, alpha);
+    if (gdev->unsupported || alpha <= 0) {
+        return;
+    }
+
+    fz_matrix local = ctm;
+    fz_pixmap* pix = fz_get_pixmap_from_image(ctx, image, nullptr, &local, nullptr, nullptr);
+    fz_pixmap* rgb = nullptr;
+    fz_var(rgb);
+    fz_try(ctx) {
+        if (!pix->colorspace || !GdiIsOpaque(pix)) {
+            gdev->unsupported = true;
+        } else if (draw) {
+            if (pix->colorspace != fz_device_rgb(ctx)) {
+                rgb = fz_convert_pixmap(ctx, pix, fz_device_rgb(ctx), nullptr, nullptr, cp, pix->alpha);
+            }
+            GdiDrawPixmap(gdev->hdc, rgb ? rgb : pix, ctm);
+        }
+    }
+    fz_always(ctx) {
+        fz_drop_pixmap(ctx, rgb);
+        fz_drop_pixmap(ctx, pix);
+    }
+    fz_catch(ctx) {
+        fz_rethrow(ctx);
+    }
+}
+
+static void fz_gdi_fill_image_mask(fz_context*, fz_device* dev, fz_image*, fz_matrix, fz_colorspace*, const float*,
+                                   float, fz_color_params) {
+    ((fz_gdi_device*)dev)->unsupported = true;
+}
+
+static void fz_gdi_clip_image_mask(fz_context*, fz_device* dev, fz_image*, fz_matrix, fz_rect) {
+    fz_gdi_device* gdev = (fz_gdi_device*)dev;
+    gdev->unsupported = true;
+    if (gdev->hdc) {
+        SaveDC(gdev->hdc);
+    }
+}
+
+static void fz_gdi_pop_clip(fz_context*, fz_device* dev) {
+    fz_gdi_device* gdev = (fz_gdi_device*)dev;
+    if (gdev->hdc) {
+        RestoreDC(gdev->hdc, -1);
+    }
+}
+
+static void fz_gdi_begin_mask(fz_context*, fz_device* dev, fz_rect, int, fz_colorspace*, const float*,
+                              fz_color_params) {
+    fz_gdi_device* gdev = (fz_gdi_device*)dev;
+    gdev->unsupported = true;
+    if (gdev->hdc) {
+        SaveDC(gdev->hdc);
+    }
+}
+
+static void fz_gdi_begin_group(fz_context*, fz_device* dev, fz_rect, fz_colorspace*, int, int, int blendmode,
+                               float alpha) {
+    // opaque groups without blending look the same when drawn directly
+    if (blendmode != FZ_BLEND_NORMAL || alpha < 1) {
+        ((fz_gdi_device*)dev)->unsupported = true;
+    }
+}
+
+static int fz_gdi_begin_tile(fz_context*, fz_device* dev, fz_rect, fz_rect, float, float, fz_matrix, int) {
+    ((fz_gdi_device*)dev)->unsupported = true;
+    // pretend that the tile is cached so that its content isn't run
+    return 1;
+}
+
+static void fz_gdi_close_device(fz_context*, fz_device* dev) {
+    fz_gdi_device* gdev = (fz_gdi_device*)dev;
+    if (gdev->hdc && gdev->savedDC) {
+        RestoreDC(gdev->hdc, gdev->savedDC);
+        gdev->savedDC = 0;
+    }
+}
+
+static fz_device* fz_new_gdi_device(fz_context* ctx, HDC hdc, fz_irect clip) {
+    fz_gdi_device* dev = fz_new_derived_device(ctx, fz_gdi_device);
+    dev->super.close_device = fz_gdi_close_device;
+    dev->super.drop_device = fz_gdi_close_device;
+    dev->super.fill_path = fz_gdi_fill_path;
+    dev->super.stroke_path = fz_gdi_stroke_path;
+    dev->super.clip_path = fz_gdi_clip_path;
+    dev->super.clip_stroke_path = fz_gdi_clip_stroke_path;
+    dev->super.fill_text = fz_gdi_fill_text;
+    dev->super.stroke_text = fz_gdi_stroke_text;
+    dev->super.clip_text = fz_gdi_clip_text;
+    dev->super.clip_stroke_text = fz_gdi_clip_stroke_text;
+    dev->super.fill_shade = fz_gdi_fill_shade;
+    dev->super.fill_image = fz_gdi_fill_image;
+    dev->super.fill_image_mask = fz_gdi_fill_image_mask;
+    dev->super.clip_image_mask = fz_gdi_clip_image_mask;
+    dev->super.pop_clip = fz_gdi_pop_clip;
+    dev->super.begin_mask = fz_gdi_begin_mask;
+    dev->super.begin_group = fz_gdi_begin_group;
+    dev->super.begin_tile = fz_gdi_begin_tile;
+
+    dev->hdc = hdc;
+    dev->clip = clip;
+    dev->savedDC = 0;
+    dev->unsupported = false;
+    if (hdc) {
+        dev->savedDC = SaveDC(hdc);
+        IntersectClipRect(hdc, clip.x0, clip.y0, clip.x1, clip.y1);
+        SetGraphicsMode(hdc, GM_ADVANCED);
+        XFORM xf = {1.f / GDI_SUBPIXELS, 0, 0, 1.f / GDI_SUBPIXELS, 0, 0};
+        SetWorldTransform(hdc, &xf);
+    }
+    return &dev->super;
+}
+
+bool fz_run_display_lists_to_dc(fz_context* ctx, HDC hdc, fz_display_list** lists, int nLists, fz_matrix ctm,
+                                fz_irect clip, fz_cookie* cookie) {
+    fz_rect cliprect = fz_rect_from_irect(clip);
+    fz_device* dev = nullptr;
+    bool ok = false;
+    fz_var(dev);
+    fz_var(ok);
+    fz_try(ctx) {
+        // check all the content first, so that nothing is drawn
+        // for pages that have to be printed as bitmaps instead
+        dev = fz_new_gdi_device(ctx, nullptr, clip);
+        for (int i = 0; i < nLists; i++) {
+            if (lists[i]) {
+                fz_run_display_list(ctx, lists[i], dev, ctm, cliprect, cookie);
+            }
+        }
+        fz_close_device(ctx, dev);
+        ok = !((fz_gdi_device*)dev)->unsupported;
+        fz_drop_device(ctx, dev);
+        dev = nullptr;
+
+        if (ok) {
+            dev = fz_new_gdi_device(ctx, hdc, clip);
+            for (int i = 0; i < nLists; i++) {
+                if (lists[i]) {
+                    fz_run_display_list(ctx, lists[i], dev, ctm, cliprect, cookie);
+                }
+            }
+            fz_close_device(ctx, dev);
+        }
+        if (cookie && cookie->abort) {
+            ok = false;
+        }
+    }
+    fz_always(ctx) {
+        fz_drop_device(ctx, dev);
+    }
+    fz_catch(ctx) {
+        ok = false;
+    }
+    return ok;
+}
@@ -3,12 +3,16 @@
 
 // Common for EnginePdf.cpp and EngineXps.cpp
 
-// maximum amount of memory that MuPDF should use per fz_context store
+// maximum amount of memory that MuPDF should use for the store shared by all documents
 #define MAX_CONTEXT_MEMORY (256 * 1024 * 1024)
 // number of page content trees to cache for quicker rendering
 #define MAX_PAGE_RUN_CACHE 8
 // maximum estimated memory requirement allowed for the run cache of one document
 #define MAX_PAGE_RUN_MEMORY (40 * 1024 * 1024)
+// number of structured text pages to cache for link detection, image positions and text extraction
+#define MAX_PAGE_TEXT_CACHE 8
+// maximum estimated memory requirement allowed for the text cache of one document
+#define MAX_PAGE_TEXT_MEMORY (16 * 1024 * 1024)
 
 class FitzAbortCookie : public AbortCookie {
   public:
@@ -24,6 +28,25 @@ class FitzAbortCookie : public AbortCookie {
 struct FitzImagePos {
     fz_rect rect = fz_unit_rect;
     fz_matrix transform;
+    // false for grayscale images (which are likely scans)
+    bool hasColor = true;
+};
+
+// a uniform grid over the rects of a page's links, comments and images
+// so that hit-testing only has to check the elements near a point
+// (built by FzBuildElementsGrid once a page is fully loaded)
+struct FzElementsGrid {
+    fz_rect bounds = {};
+    int cols = 0;
+    int rows = 0;
+    // the elements overlapping cell i are cellItems[cellStart[i]] to cellItems[cellStart[i + 1] - 1]
+    // and are encoded as (kind << 24) | index, in the order in which they're hit-tested
+    Vec<int> cellStart;
+    Vec<int> cellItems;
+    // FzPageInfo::links for lookup by index
+    Vec<fz_link*> links;
+
+    void Reset();
 };
 
 struct FzPageInfo {
@@ -38,11 +61,29 @@ struct FzPageInfo {
     Vec<PageElement*> comments;
 
     RectD mediabox = {};
+    // true if mediabox is only a guess because the page's size
+    // hasn't been determined yet (cf. EnginePdf::ResolvePageSizes)
+    bool mediaboxEstimated = false;
     Vec<FitzImagePos> images;
+    FzElementsGrid elementsGrid;
+
+    // cached page content (without annotations) for quicker re-rendering
+    // and its estimated memory requirement (cf. MAX_PAGE_RUN_MEMORY)
+    fz_display_list* list = nullptr;
+    size_t listSizeEst = 0;
+
+    // cached structured text (cf. FzGetStextPage)
+    // and its estimated memory requirement (cf. MAX_PAGE_TEXT_MEMORY)
+    fz_stext_page* stext = nullptr;
+    size_t stextSizeEst = 0;
 
     // if false, only loaded page (fast)
     // if true, loaded expensive info (extracted text etc.)
     bool fullyLoaded = false;
+
+    // cf. EngineBase::GetPageFingerprint (only valid if hasFingerprint)
+    u8 fingerprint[16] = {};
+    bool hasFingerprint = false;
 };
 
 struct LinkRectList {
@@ -50,6 +91,19 @@ struct LinkRectList {
     Vec<fz_rect> coords;
 };
 
+// allocator for fz_new_context() which keeps gFzMem up to date
+extern fz_alloc_context fz_alloc_counted;
+// memory allocated by all fitz contexts using fz_alloc_counted
+extern MemCounter gFzMem;
+// allocator to use for new contexts: either fz_alloc_counted or a scalable one
+// with per-thread caches (cf. EnableScalableFzAllocator), which also keeps gFzMem up to date.
+// note: both must be thread-safe, as fz_malloc/fz_free only take FZ_LOCK_ALLOC for scavenging
+fz_alloc_context* GetFzAllocator();
+// returns a new context for a document, cloned from a process-wide base context.
+// all such contexts share the locks, the store (cf. SetFzStoreSizeMB),
+// the glyph cache and loaded system fonts. free with fz_drop_context()
+fz_context* NewFzContext();
+
 fz_rect RectD_to_fz_rect(RectD rect);
 RectD fz_rect_to_RectD(fz_rect rect);
 fz_matrix fz_create_view_ctm(fz_rect mediabox, float zoom, int rotation);
@@ -62,10 +116,19 @@ WCHAR* pdf_clean_string(WCHAR* string);
 
 fz_stream* fz_open_istream(fz_context* ctx, IStream* stream);
 fz_stream* fz_open_file2(fz_context* ctx, const WCHAR* filePath);
+// reads the file sequentially on a background thread. reading beyond what has
+// arrived so far throws FZ_ERROR_TRYLATER (cf. fz_stream::progressive)
+fz_stream* fz_open_file_progressive(fz_context* ctx, const WCHAR* filePath);
+// returns true once a stream from fz_open_file_progressive has been read completely
+// (or reading has failed), waiting up to timeoutMs. always true for other streams
+bool FzWaitForProgressiveData(fz_stream* stm, DWORD timeoutMs);
 void fz_stream_fingerprint(fz_context* ctx, fz_stream* stm, unsigned char digest[16]);
 std::string_view fz_extract_stream_data(fz_context* ctx, fz_stream* stream);
 
 RenderedBitmap* new_rendered_fz_pixmap(fz_context* ctx, fz_pixmap* pixmap);
+fz_pixmap* new_dib_fz_pixmap(fz_context* ctx, fz_irect bbox, HBITMAP* hbmpOut, HANDLE* hMapOut);
+RenderedBitmap* new_rendered_fz_dib_pixmap(fz_context* ctx, fz_pixmap* pixmap, HBITMAP hbmp, HANDLE hMap,
+                                           bool tryPalette = true);
 
 WCHAR* fz_text_page_to_str(fz_stext_page* text, Rect** coordsOut);
 
@@ -77,18 +140,26 @@ PageElement* newFzComment(const WCHAR* comment, int pageNo, RectD rect);
 PageElement* newFzImage(int pageNo, fz_rect rect, size_t imageIdx);
 PageElement* newFzLink(int pageNo, fz_link* link, fz_outline* outline);
 PageDestination* newFzDestination(fz_outline*);
+void FzBuildElementsGrid(FzPageInfo* pageInfo);
 PageElement* FzGetElementAtPos(FzPageInfo* pageInfo, PointD pt);
 void FzGetElements(Vec<PageElement*>* els, FzPageInfo* pageInfo);
 PageElement* makePdfCommentFromPdfAnnot(fz_context* ctx, int pageNo, pdf_annot* annot);
 void FzLinkifyPageText(FzPageInfo* pageInfo, fz_stext_page* stext);
+fz_stext_page* FzGetStextPage(fz_context* ctx, FzPageInfo* pageInfo, Vec<FzPageInfo*>& textCache);
 void fz_run_page_transparency(fz_context* ctx, Vec<Annotation*>* annots, fz_device* dev, const fz_rect cliprect,
                               bool endGroup, bool hasTransparency = false);
 void fz_run_user_page_annots(fz_context* ctx, Vec<Annotation*>* annots, fz_device* dev, fz_matrix ctm,
                              const fz_rect cliprect, fz_cookie* cookie);
+fz_display_list* NewUserAnnotsDisplayList(fz_context* ctx, Vec<Annotation*>* annots);
+// draws the display lists (entries may be nullptr) to hdc as vector graphics. nothing is
+// drawn and false is returned if any of the content can't be drawn with GDI (e.g. transparency)
+bool fz_run_display_lists_to_dc(fz_context* ctx, HDC hdc, fz_display_list** lists, int nLists, fz_matrix ctm,
+                                fz_irect clip, fz_cookie* cookie);
 fz_pixmap* fz_convert_pixmap2(fz_context* ctx, fz_pixmap* pix, fz_colorspace* ds, fz_colorspace* prf,
                               fz_default_colorspaces* default_cs, fz_color_params color_params, int keep_alpha);
-fz_image* fz_find_image_at_idx(fz_context* ctx, FzPageInfo* pageInfo, int idx);
+fz_image* fz_find_image_at_idx(fz_context* ctx, fz_stext_page* stext, int idx);
 void fz_find_image_positions(fz_context* ctx, Vec<FitzImagePos>& images, fz_stext_page* stext);
+bool FzHasColorImagesInRect(FzPageInfo* pageInfo, fz_matrix ctm, fz_rect cliprect);
 
 // float is in range 0...1
 COLORREF FromPdfColor(fz_context* ctx, int n, float color[4]);
@@ -6,11 +6,13 @@
 #include "utils/ScopedWin.h"
 
 #include "utils/FileUtil.h"
+#include "utils/FileTypeSniff.h"
 #include "utils/GdiPlusUtil.h"
 #include "utils/HtmlParserLookup.h"
 #include "utils/HtmlPullParser.h"
 #include "utils/JsonParser.h"
 #include "utils/WinUtil.h"
+#include "utils/ThreadUtil.h"
 #include "utils/Timer.h"
 #include "utils/Log.h"
 
@@ -70,8 +72,23 @@ Kind kindEngineImage = "engineImage";
 Kind kindEngineImageDir = "engineImageDir";
 Kind kindEngineComicBooks = "engineComicBooks";
 
-// number of decoded bitmaps to cache for quicker rendering
+// number of pages to decode while determining the page sizes
+// (so that the first few pages don't have to be decoded twice)
 #define MAX_IMAGE_PAGE_CACHE 10
+// memory used for caching decoded bitmaps for quicker rendering
+#ifdef _WIN64
+#define MAX_IMAGE_PAGE_CACHE_SIZE (512 * 1024 * 1024)
+#else
+#define MAX_IMAGE_PAGE_CACHE_SIZE (192 * 1024 * 1024)
+#endif
+// number of pages following a rendered page to decode in the background
+// (in addition to the preceding page)
+#define IMAGE_DECODE_AHEAD_PAGES 2
+#define IMAGE_DECODE_AHEAD_THREADS 2
+// pages shown at less than half their size are drawn from copies reduced by
+// a power of 2 (up to 2^MAX_IMAGE_REDUCTION), so that drawing doesn't have
+// to go through all the pixels of large scans
+#define MAX_IMAGE_REDUCTION 3
 
 ///// EngineImages methods apply to all types of engines handling full-page images /////
 
@@ -80,6 +97,12 @@ struct ImagePage {
     Bitmap* bmp = nullptr;
     bool ownBmp = true;
     int refs = 1;
+    // true while the bitmap is being decoded (without holding cacheAccess)
+    bool decoding = false;
+    // memory taken up by the decoded bitmaps
+    size_t size = 0;
+    // reduced[i] is bmp reduced by 2^(i + 1) (created on demand)
+    Bitmap* reduced[MAX_IMAGE_REDUCTION] = {};
 
     ImagePage(int pageNo, Bitmap* bmp) {
         this->pageNo = pageNo;
@@ -123,20 +146,54 @@ class EngineImages : public EngineBase {
         return page != nullptr;
     }
 
+    void FreeCachedPages() override;
+
+    // runs on the decode ahead threads
+    void DecodeAheadPages();
+
   protected:
     ScopedComPtr<IStream> fileStream;
 
     CRITICAL_SECTION cacheAccess;
+    // most recently used first
     Vec<ImagePage*> pageCache;
+    size_t pageCacheSize = 0;
     Vec<RectD> mediaboxes;
 
+    // set by engines whose LoadBitmapForPage can run on several threads at once,
+    // which allows decoding pages in parallel and ahead of time
+    bool decodeInParallel = false;
+    CONDITION_VARIABLE pageDecoded;
+    CONDITION_VARIABLE decodeAheadQueued;
+    Vec<int> decodeAheadQueue;
+    HANDLE decodeAheadThreads[IMAGE_DECODE_AHEAD_THREADS] = {};
+    int nDecodeAheadThreads = 0;
+    bool stopDecodingAhead = false;
+    // reduction level of the page rendered last, for the pages decoded ahead
+    int decodeAheadReduction = 0;
+
     void GetTransform(Matrix& m, int pageNo, float zoom, int rotation);
 
     virtual Bitmap* LoadBitmapForPage(int pageNo, bool& deleteAfterUse) = 0;
     virtual RectD LoadMediabox(int pageNo) = 0;
+    // engines which have the image data at hand can decode a page directly
+    // at a reduced size (reduced by 2^level in each dimension)
+    virtual Bitmap* LoadReducedBitmapForPage(int pageNo, int level) {
+        UNUSED(pageNo);
+        UNUSED(level);
+        return nullptr;
+    }
 
     ImagePage* GetPage(int pageNo, bool tryOnly = false);
     void DropPage(ImagePage* page, bool forceRemove);
+    bool IsPageCacheFull();
+    void DecodePage(ImagePage* page);
+    Bitmap* GetReducedBitmap(ImagePage* page, int level);
+    void TrimPageCache();
+    void DecodeAhead(int pageNo);
+    // must be called by the destructors of engines that set decodeInParallel
+    // (before freeing what LoadBitmapForPage uses)
+    void StopDecodingAhead();
 };
 
 EngineImages::EngineImages() {
@@ -148,9 +205,12 @@ EngineImages::EngineImages() {
     isImageCollection = true;
 
     InitializeCriticalSection(&cacheAccess);
+    InitializeConditionVariable(&pageDecoded);
+    InitializeConditionVariable(&decodeAheadQueued);
 }
 
 EngineImages::~EngineImages() {
+    StopDecodingAhead();
     EnterCriticalSection(&cacheAccess);
     while (pageCache.size() > 0) {
         ImagePage* lastPage = pageCache.Last();
@@ -216,11 +276,33 @@ RenderedBitmap* EngineImages::RenderPage(RenderPageArgs& args) {
     Rect pageRcI = PageMediabox(pageNo).Round();
     ImageAttributes imgAttrs;
     imgAttrs.SetWrapMode(WrapModeTileFlipXY);
-    Status ok = g.DrawImage(page->bmp, pageRcI.ToGdipRect(), 0, 0, pageRcI.dx, pageRcI.dy, UnitPixel, &imgAttrs);
+    // the page's pixels are scaled by zoom (cf. GetBaseTransform)
+    int level = 0;
+    while (level < MAX_IMAGE_REDUCTION && zoom * (2 << level) <= 1.f) {
+        level++;
+    }
+    Status ok;
+    {
+        // a GDI+ Bitmap can't be drawn from several rendering threads at once
+        ScopedCritSec scope(&cacheAccess);
+        Bitmap* bmp = page->bmp;
+        Gdiplus::Size srcSize(pageRcI.dx, pageRcI.dy);
+        Bitmap* reduced = level > 0 ? GetReducedBitmap(page, level) : nullptr;
+        if (reduced) {
+            bmp = reduced;
+            srcSize = Gdiplus::Size(reduced->GetWidth(), reduced->GetHeight());
+        }
+        ok = g.DrawImage(bmp, pageRcI.ToGdipRect(), 0, 0, srcSize.Width, srcSize.Height, UnitPixel, &imgAttrs);
+    }
 
     DropPage(page, false);
     DeleteDC(hDC);
 
+    if (decodeInParallel && args.target == RenderTarget::View) {
+        decodeAheadReduction = level;
+        DecodeAhead(pageNo);
+    }
+
     if (ok != Ok) {
         DeleteObject(hbmp);
         CloseHandle(hMap);
@@ -327,46 +409,250 @@ bool EngineImages::SaveFileAs(const char* copyFileName, bool includeUserAnnots)
     return file::WriteFile(dstPath, d.as_view());
 }
 
+static ImagePage* FindCachedPage(Vec<ImagePage*>& pageCache, int pageNo) {
+    for (ImagePage* page : pageCache) {
+        if (page->pageNo == pageNo) {
+            return page;
+        }
+    }
+    return nullptr;
+}
+
 ImagePage* EngineImages::GetPage(int pageNo, bool tryOnly) {
     ScopedCritSec scope(&cacheAccess);
 
-    ImagePage* result = nullptr;
-
-    for (size_t i = 0; i < pageCache.size(); i++) {
-        if (pageCache.at(i)->pageNo == pageNo) {
-            result = pageCache.at(i);
-            break;
-        }
-    }
+    ImagePage* result = FindCachedPage(pageCache, pageNo);
     if (!result && tryOnly) {
         return nullptr;
     }
 
     if (!result) {
-        // TODO: drop most memory intensive pages first
-        // (i.e. formats which aren't IsGdiPlusNativeFormat)?
-        if (pageCache.size() >= MAX_IMAGE_PAGE_CACHE) {
-            CrashIf(pageCache.size() != MAX_IMAGE_PAGE_CACHE);
-            DropPage(pageCache.Last(), true);
-        }
         result = new ImagePage(pageNo, nullptr);
-        result->bmp = LoadBitmapForPage(pageNo, result->ownBmp);
-        pageCache.InsertAt(0, result);
-    } else if (result != pageCache.at(0)) {
-        // keep the list Most Recently Used first
-        pageCache.Remove(result);
         pageCache.InsertAt(0, result);
+        result->refs++;
+        DecodePage(result);
+    } else {
+        if (result != pageCache.at(0)) {
+            // keep the list Most Recently Used first
+            pageCache.Remove(result);
+            pageCache.InsertAt(0, result);
+        }
+        result->refs++;
+        // the page might be being decoded ahead
+        while (result->decoding) {
+            SleepConditionVariableCS(&pageDecoded, &cacheAccess, INFINITE);
+        }
     }
     // return nullptr if a page failed to load
-    if (result && !result->bmp) {
+    if (!result->bmp) {
+        DropPage(result, false);
         return nullptr;
     }
-    if (!result) {
+    return result;
+}
+
+bool EngineImages::IsPageCacheFull() {
+    ScopedCritSec scope(&cacheAccess);
+    return pageCache.size() >= MAX_IMAGE_PAGE_CACHE || pageCacheSize >= MAX_IMAGE_PAGE_CACHE_SIZE;
+}
+
+// Note: make sure to only call with cacheAccess and a reference to page
+void EngineImages::DecodePage(ImagePage* page) {
+    page->decoding = true;
+    if (decodeInParallel) {
+        // decoding a large image takes a while, so don't hold up the other pages
+        LeaveCriticalSection(&cacheAccess);
+    }
+    bool ownBmp = true;
+    Bitmap* bmp = LoadBitmapForPage(page->pageNo, ownBmp);
+    if (bmp && decodeInParallel && 0 == decodeAheadReduction) {
+        // GDI+ only decodes the pixels when a bitmap is first used,
+        // which would happen while drawing (and thus holding cacheAccess)
+        // pages shown reduced are decoded separately (cf. GetReducedBitmap)
+        Gdiplus::Rect r(0, 0, 1, 1);
+        Gdiplus::BitmapData bmpData;
+        if (bmp->LockBits(&r, Gdiplus::ImageLockModeRead, PixelFormat32bppARGB, &bmpData) == Ok) {
+            bmp->UnlockBits(&bmpData);
+        }
+    }
+    if (decodeInParallel) {
+        EnterCriticalSection(&cacheAccess);
+    }
+
+    page->bmp = bmp;
+    page->ownBmp = ownBmp;
+    page->decoding = false;
+    if (bmp) {
+        page->size = BitmapSize(bmp);
+    }
+    // the page might have been dropped from the cache in the meantime
+    if (pageCache.Contains(page)) {
+        pageCacheSize += page->size;
+    }
+    WakeAllConditionVariable(&pageDecoded);
+    TrimPageCache();
+}
+
+static size_t BitmapSize(Bitmap* bmp) {
+    return (size_t)bmp->GetWidth() * bmp->GetHeight() * Gdiplus::GetPixelFormatSize(bmp->GetPixelFormat()) / 8;
+}
+
+// halves a bitmap in each dimension
+static Bitmap* HalveBitmap(Bitmap* bmp) {
+    int dx = (int)bmp->GetWidth(), dy = (int)bmp->GetHeight();
+    int halfDx = std::max((dx + 1) / 2, 1), halfDy = std::max((dy + 1) / 2, 1);
+    Bitmap* half = new Bitmap(halfDx, halfDy, PixelFormat32bppARGB);
+    if (half->GetLastStatus() != Ok) {
+        delete half;
         return nullptr;
     }
+    Graphics g(half);
+    g.SetInterpolationMode(Gdiplus::InterpolationModeHighQualityBilinear);
+    g.SetPixelOffsetMode(Gdiplus::PixelOffsetModeHalf);
+    ImageAttributes imgAttrs;
+    imgAttrs.SetWrapMode(WrapModeTileFlipXY);
+    Status ok = g.DrawImage(bmp, Gdiplus::Rect(0, 0, halfDx, halfDy), 0, 0, dx, dy, UnitPixel, &imgAttrs);
+    if (ok != Ok) {
+        delete half;
+        return nullptr;
+    }
+    return half;
+}
 
-    result->refs++;
-    return result;
+// returns the page's bitmap reduced by 2^level (owned by the page)
+// Note: make sure to only call with cacheAccess and a reference to page
+Bitmap* EngineImages::GetReducedBitmap(ImagePage* page, int level) {
+    CrashIf(level < 1 || level > MAX_IMAGE_REDUCTION);
+    if (page->reduced[level - 1]) {
+        return page->reduced[level - 1];
+    }
+
+    // prefer decoding at the reduced size, so that the full-size pixels
+    // don't have to be decoded at all
+    Bitmap* reduced = nullptr;
+    if (decodeInParallel) {
+        LeaveCriticalSection(&cacheAccess);
+        reduced = LoadReducedBitmapForPage(page->pageNo, level);
+        EnterCriticalSection(&cacheAccess);
+    } else {
+        reduced = LoadReducedBitmapForPage(page->pageNo, level);
+    }
+    if (reduced && page->reduced[level - 1]) {
+        // the page has been reduced concurrently
+        delete reduced;
+        return page->reduced[level - 1];
+    }
+    if (!reduced) {
+        // otherwise halve the next larger bitmap (i.e. build a mipmap pyramid)
+        Bitmap* larger = level > 1 ? GetReducedBitmap(page, level - 1) : page->bmp;
+        if (!larger) {
+            return nullptr;
+        }
+        reduced = HalveBitmap(larger);
+        if (!reduced) {
+            return nullptr;
+        }
+    }
+
+    page->reduced[level - 1] = reduced;
+    size_t size = BitmapSize(reduced);
+    page->size += size;
+    if (pageCache.Contains(page)) {
+        pageCacheSize += size;
+    }
+    return reduced;
+}
+
+// drops the least recently used pages until the decoded bitmaps fit into
+// MAX_IMAGE_PAGE_CACHE_SIZE (pages being used or decoded are kept)
+// Note: make sure to only call with cacheAccess
+void EngineImages::TrimPageCache() {
+    for (size_t i = pageCache.size(); i > 1 && pageCacheSize > MAX_IMAGE_PAGE_CACHE_SIZE; i--) {
+        ImagePage* page = pageCache.at(i - 1);
+        if (page->refs == 1 && !page->decoding) {
+            DropPage(page, true);
+        }
+    }
+}
+
+static DWORD WINAPI DecodeAheadThread(LPVOID data) {
+    EngineImages* engine = (EngineImages*)data;
+    engine->DecodeAheadPages();
+    return 0;
+}
+
+void EngineImages::DecodeAhead(int pageNo) {
+    ScopedCritSec scope(&cacheAccess);
+    if (stopDecodingAhead) {
+        return;
+    }
+    // pages which haven't been decoded for a previously rendered page
+    // are less likely to be needed than the ones around this page
+    decodeAheadQueue.Reset();
+    for (int i = 1; i <= IMAGE_DECODE_AHEAD_PAGES && pageNo + i <= pageCount; i++) {
+        decodeAheadQueue.Append(pageNo + i);
+    }
+    if (pageNo > 1) {
+        decodeAheadQueue.Append(pageNo - 1);
+    }
+
+    for (; nDecodeAheadThreads < IMAGE_DECODE_AHEAD_THREADS; nDecodeAheadThreads++) {
+        HANDLE thread = CreateThread(nullptr, 0, DecodeAheadThread, this, 0, nullptr);
+        if (!thread) {
+            break;
+        }
+        decodeAheadThreads[nDecodeAheadThreads] = thread;
+    }
+    WakeAllConditionVariable(&decodeAheadQueued);
+}
+
+void EngineImages::DecodeAheadPages() {
+    ScopedCritSec scope(&cacheAccess);
+    while (!stopDecodingAhead) {
+        if (decodeAheadQueue.size() == 0) {
+            SleepConditionVariableCS(&decodeAheadQueued, &cacheAccess, INFINITE);
+            continue;
+        }
+        int pageNo = decodeAheadQueue.PopAt(0);
+        if (FindCachedPage(pageCache, pageNo)) {
+            continue;
+        }
+        ImagePage* page = new ImagePage(pageNo, nullptr);
+        // keep the most recently rendered page in front
+        pageCache.InsertAt(pageCache.size() > 0 ? 1 : 0, page);
+        page->refs++;
+        DecodePage(page);
+        if (page->bmp && decodeAheadReduction > 0) {
+            GetReducedBitmap(page, decodeAheadReduction);
+        }
+        DropPage(page, false);
+    }
+}
+
+void EngineImages::StopDecodingAhead() {
+    EnterCriticalSection(&cacheAccess);
+    stopDecodingAhead = true;
+    WakeAllConditionVariable(&decodeAheadQueued);
+    LeaveCriticalSection(&cacheAccess);
+
+    for (int i = 0; i < nDecodeAheadThreads; i++) {
+        WaitForSingleObject(decodeAheadThreads[i], INFINITE);
+        CloseHandle(decodeAheadThreads[i]);
+        decodeAheadThreads[i] = nullptr;
+    }
+    nDecodeAheadThreads = 0;
+}
+
+// pages being used or decoded are kept
+void EngineImages::FreeCachedPages() {
+    ScopedCritSec scope(&cacheAccess);
+    decodeAheadQueue.Reset();
+    for (size_t i = pageCache.size(); i > 0; i--) {
+        ImagePage* page = pageCache.at(i - 1);
+        if (page->refs == 1 && !page->decoding) {
+            DropPage(page, true);
+        }
+    }
 }
 
 void EngineImages::DropPage(ImagePage* page, bool forceRemove) {
@@ -375,13 +661,18 @@ void EngineImages::DropPage(ImagePage* page, bool forceRemove) {
     CrashIf(page->refs < 0);
 
     if (0 == page->refs || forceRemove) {
-        pageCache.Remove(page);
+        if (pageCache.Remove(page) != -1) {
+            pageCacheSize -= page->size;
+        }
     }
 
     if (0 == page->refs) {
         if (page->ownBmp) {
             delete page->bmp;
         }
+        for (Bitmap* reduced : page->reduced) {
+            delete reduced;
+        }
         delete page;
     }
 }
@@ -448,10 +739,11 @@ bool EngineImage::LoadSingleFile(const WCHAR* file) {
     }
     SetFileName(file);
 
-    AutoFree data = file::ReadFile(file);
-    fileExt = GfxFileExtFromData(data.data, data.size());
+    file::MappedFile mappedFile(file);
+    std::string_view data = mappedFile.Data();
+    fileExt = GfxFileExtFromData(data.data(), data.size());
     defaultFileExt = fileExt;
-    image = BitmapFromData(data.data, data.size());
+    image = BitmapFromData(data.data(), data.size());
     return FinishLoading();
 }
 
@@ -580,7 +872,7 @@ RectD EngineImage::LoadMediabox(int pageNo) {
     }
 
     // fill the cache to prevent the first few frames from being unpacked twice
-    ImagePage* page = GetPage(pageNo, MAX_IMAGE_PAGE_CACHE == pageCache.size());
+    ImagePage* page = GetPage(pageNo, IsPageCacheFull());
     if (page) {
         RectD mbox(0, 0, page->bmp->GetWidth(), page->bmp->GetHeight());
         DropPage(page, false);
@@ -608,8 +900,9 @@ bool EngineImage::SaveFileAsPDF(const char* pdfFileName, bool includeUserAnnots)
     PdfCreator* c = new PdfCreator();
     auto dpi = GetFileDPI();
     if (FileName()) {
-        AutoFree data = file::ReadFile(FileName());
-        ok = c->AddPageFromImageData(data.data, data.size(), dpi);
+        file::MappedFile mappedFile(FileName());
+        std::string_view data = mappedFile.Data();
+        ok = c->AddPageFromImageData(data.data(), data.size(), dpi);
     } else {
         AutoFree data = GetDataFromStream(fileStream, nullptr);
         ok = c->AddPageFromImageData(data.data, data.size(), dpi);
@@ -658,9 +951,8 @@ bool IsImageEngineSupportedFile(const char* fileName) {
 bool IsImageEngineSupportedFile(const WCHAR* fileName, bool sniff) {
     const WCHAR* ext = path::GetExtNoFree(fileName);
     if (sniff) {
-        char header[32] = {0};
-        file::ReadN(fileName, header, sizeof(header));
-        const WCHAR* ext2 = GfxFileExtFromData(header, sizeof(header));
+        std::string_view header = ReadFileHeader(fileName);
+        const WCHAR* ext2 = GfxFileExtFromData(header.data(), header.size());
         if (ext2 != nullptr) {
             ext = ext2;
         }
@@ -682,6 +974,9 @@ EngineBase* CreateImageEngineFromStream(IStream* stream) {
 
 ///// ImageDirEngine handles a directory full of image files /////
 
+// number of page sizes read in parallel (which mostly helps for network drives)
+#define IMAGE_DIR_MEDIABOX_READERS 8
+
 class EngineImageDir : public EngineImages {
   public:
     EngineImageDir() {
@@ -691,12 +986,22 @@ class EngineImageDir : public EngineImages {
         // TODO: is there a better place to expose pageFileNames
         // than through page labels?
         hasPageLabels = true;
+        InitializeCriticalSection(&mediaboxAccess);
     }
 
     virtual ~EngineImageDir() {
+        if (mediaboxesToken) {
+            mediaboxesToken->Cancel();
+            mediaboxesToken->Wait();
+            mediaboxesToken->Release();
+        }
+        DeleteCriticalSection(&mediaboxAccess);
         delete tocTree;
     }
 
+    RectD PageMediabox(int pageNo) override;
+    bool HasPendingPageSizes() override;
+
     EngineBase* Clone() override {
         if (FileName()) {
             return CreateFromFile(FileName());
@@ -728,9 +1033,21 @@ class EngineImageDir : public EngineImages {
 
     Bitmap* LoadBitmapForPage(int pageNo, bool& deleteAfterUse) override;
     RectD LoadMediabox(int pageNo) override;
+    void SetMediabox(int pageNo, RectD mbox);
+    void LoadEstimatedMediaboxes();
 
     WStrVec pageFileNames;
     TocTree* tocTree = nullptr;
+
+    // reading the image headers of thousands of pages takes a while, so
+    // all pages but the first are assumed to be as large as the first one
+    // until their sizes have been read on the thread pool (or they're loaded)
+    CRITICAL_SECTION mediaboxAccess;
+    Vec<bool> mediaboxEstimated;
+    int nEstimatedMediaboxes = 0;
+    // index of the next page for LoadEstimatedMediaboxes
+    LONG nextMediabox = 0;
+    CancelToken* mediaboxesToken = nullptr;
 };
 
 bool EngineImageDir::LoadImageDir(const WCHAR* dirName) {
@@ -761,6 +1078,23 @@ bool EngineImageDir::LoadImageDir(const WCHAR* dirName) {
     mediaboxes.AppendBlanks(pageFileNames.size());
     pageCount = (int)mediaboxes.size();
 
+    mediaboxes.at(0) = LoadMediabox(1);
+    mediaboxEstimated.AppendBlanks(pageCount);
+    for (int i = 1; i < pageCount; i++) {
+        mediaboxes.at(i) = mediaboxes.at(0);
+        mediaboxEstimated.at(i) = true;
+    }
+    nEstimatedMediaboxes = pageCount - 1;
+    if (nEstimatedMediaboxes > 0) {
+        nextMediabox = 1;
+        mediaboxesToken = new CancelToken();
+        int nReaders = std::min(nEstimatedMediaboxes, IMAGE_DIR_MEDIABOX_READERS);
+        for (int i = 0; i < nReaders; i++) {
+            QueueWork(
+                WorkPriority::Prefetch, [this] { LoadEstimatedMediaboxes(); }, mediaboxesToken);
+        }
+    }
+
     // TODO: better handle the case where images have different resolutions
     ImagePage* page = GetPage(1);
     if (page) {
@@ -829,18 +1163,64 @@ bool EngineImageDir::SaveFileAs(const char* copyFileName, bool includeUserAnnots
 }
 
 Bitmap* EngineImageDir::LoadBitmapForPage(int pageNo, bool& deleteAfterUse) {
-    AutoFree bmpData(file::ReadFile(pageFileNames.at(pageNo - 1)));
-    if (bmpData.data) {
+    file::MappedFile mappedFile(pageFileNames.at(pageNo - 1));
+    std::string_view bmpData = mappedFile.Data();
+    if (bmpData.data()) {
         deleteAfterUse = true;
-        return BitmapFromData(bmpData.data, bmpData.size());
+        Bitmap* bmp = BitmapFromData(bmpData.data(), bmpData.size());
+        if (bmp) {
+            SetMediabox(pageNo, RectD(0, 0, bmp->GetWidth(), bmp->GetHeight()));
+        }
+        return bmp;
     }
     return nullptr;
 }
 
+RectD EngineImageDir::PageMediabox(int pageNo) {
+    CrashIf((pageNo < 1) || (pageNo > pageCount));
+    ScopedCritSec scope(&mediaboxAccess);
+    return mediaboxes.at(pageNo - 1);
+}
+
+bool EngineImageDir::HasPendingPageSizes() {
+    ScopedCritSec scope(&mediaboxAccess);
+    return nEstimatedMediaboxes > 0;
+}
+
+// replaces the estimated size of a page
+void EngineImageDir::SetMediabox(int pageNo, RectD mbox) {
+    ScopedCritSec scope(&mediaboxAccess);
+    int n = pageNo - 1;
+    if (mediaboxEstimated.at(n)) {
+        mediaboxes.at(n) = mbox;
+        mediaboxEstimated.at(n) = false;
+        nEstimatedMediaboxes--;
+    }
+}
+
+// runs on several threads of the thread pool at once
+void EngineImageDir::LoadEstimatedMediaboxes() {
+    while (!mediaboxesToken->IsCanceled()) {
+        int n = (int)InterlockedIncrement(&nextMediabox) - 1;
+        if (n >= pageCount) {
+            return;
+        }
+        {
+            ScopedCritSec scope(&mediaboxAccess);
+            if (!mediaboxEstimated.at(n)) {
+                continue;
+            }
+        }
+        SetMediabox(n + 1, LoadMediabox(n + 1));
+    }
+}
+
 RectD EngineImageDir::LoadMediabox(int pageNo) {
-    AutoFree bmpData(file::ReadFile(pageFileNames.at(pageNo - 1)));
-    if (bmpData.data) {
-        Gdiplus::Size size = BitmapSizeFromData(bmpData.data, bmpData.size());
+    // usually only the (first few KB of the) mapped file are read from disk
+    file::MappedFile mappedFile(pageFileNames.at(pageNo - 1));
+    std::string_view bmpData = mappedFile.Data();
+    if (bmpData.data()) {
+        Gdiplus::Size size = BitmapSizeFromData(bmpData.data(), bmpData.size());
         return RectD(0, 0, size.Width, size.Height);
     }
     return RectD();
@@ -851,8 +1231,9 @@ bool EngineImageDir::SaveFileAsPDF(const char* pdfFileName, bool includeUserAnno
     bool ok = true;
     PdfCreator* c = new PdfCreator();
     for (int i = 1; i <= PageCount() && ok; i++) {
-        AutoFree data = file::ReadFile(pageFileNames.at(i - 1));
-        ok = c->AddPageFromImageData(data.data, data.size(), GetFileDPI());
+        file::MappedFile mappedFile(pageFileNames.at(i - 1));
+        std::string_view data = mappedFile.Data();
+        ok = c->AddPageFromImageData(data.data(), data.size(), GetFileDPI());
     }
     if (ok) {
         ok = c->SaveToFile(pdfFileName);
@@ -910,16 +1291,20 @@ class EngineCbx : public EngineImages, public json::ValueVisitor {
   protected:
     Bitmap* LoadBitmapForPage(int pageNo, bool& deleteAfterUse) override;
     RectD LoadMediabox(int pageNo) override;
+    Bitmap* LoadReducedBitmapForPage(int pageNo, int level) override;
 
     bool LoadFromFile(const WCHAR* fileName);
     bool LoadFromStream(IStream* stream);
     bool FinishLoading();
 
     ImageData GetImageData(int pageNo);
+    Gdiplus::Size GetImageSizeFromHeader(int pageNo);
     void ParseComicInfoXml(const char* xmlData);
 
-    // access to cbxFile must be protected after initialization (with cacheAccess)
+    // archives allowing random access remain open so that pages can be
+    // extracted on demand (access to cbxFile and images is protected by archiveAccess)
     MultiFormatArchive* cbxFile = nullptr;
+    CRITICAL_SECTION archiveAccess;
     Vec<MultiFormatArchive::FileInfo*> files;
     TocTree* tocTree = nullptr;
 
@@ -941,18 +1326,23 @@ class EngineCbx : public EngineImages, public json::ValueVisitor {
 EngineCbx::EngineCbx(MultiFormatArchive* arch) {
     cbxFile = arch;
     kind = kindEngineComicBooks;
+    // the images are decoded from memory (cf. GetImageData)
+    decodeInParallel = true;
+    InitializeCriticalSection(&archiveAccess);
 }
 
 EngineCbx::~EngineCbx() {
+    StopDecodingAhead();
     delete tocTree;
 
-    // can be set in error conditions but generally is
-    // deleted in FinishLoading
+    // only remains open for archives allowing random access
+    // (or in error conditions)
     delete cbxFile;
 
     for (auto&& img : images) {
         free(img.data);
     }
+    DeleteCriticalSection(&archiveAccess);
 }
 
 EngineBase* EngineCbx::Clone() {
@@ -1078,7 +1468,7 @@ bool EngineCbx::FinishLoading() {
     TocItem* root = nullptr;
     TocItem* curr = nullptr;
     for (int i = 0; i < pageCount; i++) {
-        std::string_view fname = pageFiles[i]->name;
+        std::string_view fname = files[i]->name;
         AutoFreeWstr name = strconv::Utf8ToWstr(fname);
         const WCHAR* baseName = path::GetBaseNameNoFree(name.get());
         TocItem* ti = new TocItem(nullptr, baseName, i + 1);
@@ -1092,14 +1482,30 @@ bool EngineCbx::FinishLoading() {
     }
     tocTree = new TocTree(root);
 
+    images.AppendBlanks(nFiles);
+    if (cbxFile->HasRandomAccess()) {
+        // only the pages being displayed are extracted (cf. GetImageData)
+        // and only the image headers are needed for layout (cf. LoadMediabox)
+        return true;
+    }
+
+    // for solid archives, extracting the pages in name order might require
+    // decompressing the archive from the start for every page, so all pages
+    // are extracted in a single pass in the order they're stored in
+    Vec<size_t> fileIds;
+    Vec<int> pageIdxForFileId;
+    pageIdxForFileId.AppendBlanks(fileInfos.size());
     for (int i = 0; i < pageCount; i++) {
         size_t fileId = files[i]->fileId;
-        std::string_view sv = cbxFile->GetFileDataById(fileId);
-        ImageData img;
-        img.data = (char*)sv.data();
-        img.len = sv.size();
-        images.Append(img);
+        fileIds.Append(fileId);
+        pageIdxForFileId[fileId] = i;
     }
+    cbxFile->ExtractFiles(fileIds, [&](size_t fileId, std::string_view data) {
+        ImageData& img = images[pageIdxForFileId[fileId]];
+        img.data = (char*)data.data();
+        img.len = data.size();
+        return true;
+    });
 
     delete cbxFile;
     cbxFile = nullptr;
@@ -1113,7 +1519,14 @@ TocTree* EngineCbx::GetToc() {
 
 ImageData EngineCbx::GetImageData(int pageNo) {
     CrashIf((pageNo < 1) || (pageNo > PageCount()));
-    return images[pageNo - 1];
+    ScopedCritSec scope(&archiveAccess);
+    ImageData& img = images[pageNo - 1];
+    if (!img.data && cbxFile) {
+        std::string_view data = cbxFile->GetFileDataById(files[pageNo - 1]->fileId);
+        img.data = (char*)data.data();
+        img.len = data.size();
+    }
+    return img;
 }
 
 static char* GetTextContent(HtmlPullParser& parser) {
@@ -1257,23 +1670,65 @@ Bitmap* EngineCbx::LoadBitmapForPage(int pageNo, bool& deleteAfterUse) {
     return nullptr;
 }
 
+Bitmap* EngineCbx::LoadReducedBitmapForPage(int pageNo, int level) {
+    ImageData img = GetImageData(pageNo);
+    if (!img.data) {
+        return nullptr;
+    }
+    return BitmapFromDataReduced(img.data, img.size(), 1 << level);
+}
+
 RectD EngineCbx::LoadMediabox(int pageNo) {
     // fill the cache to prevent the first few images from being unpacked twice
-    ImagePage* page = GetPage(pageNo, MAX_IMAGE_PAGE_CACHE == pageCache.size());
+    ImagePage* page = GetPage(pageNo, IsPageCacheFull());
     if (page) {
         RectD mbox(0, 0, page->bmp->GetWidth(), page->bmp->GetHeight());
         DropPage(page, false);
         return mbox;
     }
 
+    Gdiplus::Size size = GetImageSizeFromHeader(pageNo);
+    if (size.Width > 0 && size.Height > 0) {
+        return RectD(0, 0, size.Width, size.Height);
+    }
+
     ImageData img = GetImageData(pageNo);
     if (img.data) {
-        Gdiplus::Size size = BitmapSizeFromData(img.data, img.size());
+        size = BitmapSizeFromData(img.data, img.size());
         return RectD(0, 0, size.Width, size.Height);
     }
     return RectD();
 }
 
+// the size of most images can be determined from the first few KB
+// (without having to extract the entire file from the archive)
+#define CBX_IMAGE_HEADER_SIZE (64 * 1024)
+
+Gdiplus::Size EngineCbx::GetImageSizeFromHeader(int pageNo) {
+    std::string_view header;
+    {
+        ScopedCritSec scope(&archiveAccess);
+        if (!cbxFile || images[pageNo - 1].data) {
+            return {};
+        }
+        MultiFormatArchive::FileInfo* fileInfo = files[pageNo - 1];
+        header = cbxFile->GetFileDataPartById(fileInfo->fileId, CBX_IMAGE_HEADER_SIZE);
+        if (header.data() && header.size() == fileInfo->fileSizeUncompressed) {
+            // the entire image has been extracted
+            ImageData& img = images[pageNo - 1];
+            img.data = (char*)header.data();
+            img.len = header.size();
+            return BitmapSizeFromData(img.data, img.size());
+        }
+    }
+    Gdiplus::Size size;
+    if (header.data()) {
+        size = BitmapSizeFromData(header.data(), header.size());
+    }
+    str::Free(header.data());
+    return size;
+}
+
 #define RAR_SIGNATURE "Rar!\x1A\x07\x00"
 #define RAR_SIGNATURE_LEN 7
 #define RAR5_SIGNATURE "Rar!\x1A\x07\x01\x00"
@@ -1377,9 +1832,12 @@ bool IsCbxEngineSupportedFile(const WCHAR* fileName, bool sniff) {
         // we don't also sniff for ZIP files, as these could also
         // be broken XPS files for which failure is expected
         // TODO: add TAR format sniffing
-        return file::StartsWithN(fileName, RAR_SIGNATURE, RAR_SIGNATURE_LEN) ||
-               file::StartsWithN(fileName, RAR5_SIGNATURE, RAR5_SIGNATURE_LEN) ||
-               file::StartsWith(fileName, "7z\xBC\xAF\x27\x1C");
+        std::string_view header = ReadFileHeader(fileName);
+        auto startsWith = [header](const char* sig, size_t len) {
+            return header.size() >= len && memcmp(header.data(), sig, len) == 0;
+        };
+        return startsWith(RAR_SIGNATURE, RAR_SIGNATURE_LEN) || startsWith(RAR5_SIGNATURE, RAR5_SIGNATURE_LEN) ||
+               str::StartsWith(header, "7z\xBC\xAF\x27\x1C");
     }
     if (str::EndsWithI(fileName, L".fb2.zip")) {
         return false;
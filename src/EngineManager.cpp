@@ -3,6 +3,8 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
+#include "utils/FileTypeSniff.h"
+#include "utils/Trace.h"
 #include "utils/WinUtil.h"
 
 #include "wingui/TreeModel.h"
@@ -21,6 +23,7 @@
 namespace EngineManager {
 
 bool IsSupportedFile(const WCHAR* filePath, bool sniff, bool enableEngineEbooks) {
+    ScopedFileHeaderCache headerCache;
     if (IsEnginePdfSupportedFile(filePath, sniff)) {
         return true;
     }
@@ -76,7 +79,10 @@ bool IsSupportedFile(const WCHAR* filePath, bool sniff, bool enableEngineEbooks)
 
 EngineBase* CreateEngine(const WCHAR* filePath, PasswordUI* pwdUI, bool enableChmEngine, bool enableEngineEbooks) {
     CrashIf(!filePath);
+    TraceSpan span("CreateEngine");
 
+    // the engines only read the file's header once between them
+    ScopedFileHeaderCache headerCache;
     EngineBase* engine = nullptr;
     bool sniff = false;
 RetrySniffing:
@@ -1,6 +1,26 @@
 /* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
    License: GPLv3 */
 
+// if enabled, fitz contexts created afterwards use an allocator with per-thread caches
+// (implemented in EngineFzUtil.cpp)
+void EnableScalableFzAllocator(bool enable);
+// sets the size of the store shared by all fitz contexts (decoded images, fonts, etc.)
+// only has an effect before the first document is loaded, non-positive values use the default
+void SetFzStoreSizeMB(int sizeMB);
+// the results of repairing broken PDF documents are cached in this directory, so that
+// they open quickly the next time (implemented in EnginePdf.cpp, nullptr disables caching)
+void SetPdfRepairCacheDir(const WCHAR* dir);
+
+struct FzStoreStats {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;
+    size_t size = 0;
+    size_t maxSize = 0;
+};
+
+void GetFzStoreStats(FzStoreStats* stats);
+
 namespace EngineManager {
 
 bool IsSupportedFile(const WCHAR* filePath, bool sniff = false, bool enableEngineEbooks = true);
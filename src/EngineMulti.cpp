@@ -28,16 +28,78 @@ extern "C" {
 #include "ParseBKM.h"
 #include "EngineMulti.h"
 
+// engines are only opened once one of their pages is needed
+// (if the number of pages is known from the .vbkm file)
 struct EngineInfo {
     TocItem* tocRoot = nullptr;
     EngineBase* engine = nullptr;
+    WCHAR* filePath = nullptr;
+    int nPages = 0;
+    // number of the file's first page in the combined document
+    // (0 if its pages aren't shown, cf. UpdatePagesForEngines)
+    int firstPageNo = 0;
+    // set if the file couldn't be opened when it was needed
+    bool openFailed = false;
 };
 
+// pageToEngine has one of these for each page, so that PageToEngine
+// (which is called for almost everything done with a page) is a lookup
 struct EnginePage {
     int pageNoInEngine = 0;
-    EngineBase* engine = nullptr;
+    int engineIdx = 0;
+};
+
+// upper limit for the number of threads opening the files of a document in parallel
+#define MAX_OPEN_ENGINE_THREADS 8
+
+// files to be opened on several threads by OpenEngines
+struct EnginesToOpen {
+    Vec<const WCHAR*> filePaths;
+    // same order as filePaths (nullptr if a file couldn't be opened)
+    Vec<EngineBase*> engines;
+    LONG next = 0;
 };
 
+static DWORD WINAPI OpenEnginesThread(LPVOID data) {
+    EnginesToOpen* toOpen = (EnginesToOpen*)data;
+    for (;;) {
+        int idx = (int)InterlockedIncrement(&toOpen->next) - 1;
+        if (idx >= toOpen->filePaths.isize()) {
+            break;
+        }
+        toOpen->engines[idx] = EngineManager::CreateEngine(toOpen->filePaths[idx]);
+    }
+    return 0;
+}
+
+static void OpenEngines(EnginesToOpen& toOpen) {
+    int n = toOpen.filePaths.isize();
+    toOpen.engines.AppendBlanks(n);
+    toOpen.next = 0;
+    if (n == 0) {
+        return;
+    }
+
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    int nThreads = limitValue((int)si.dwNumberOfProcessors, 1, MAX_OPEN_ENGINE_THREADS);
+    nThreads = std::min(nThreads, n);
+    // the calling thread opens files as well
+    HANDLE threads[MAX_OPEN_ENGINE_THREADS] = {};
+    int nStarted = 0;
+    for (int i = 1; i < nThreads; i++) {
+        HANDLE thread = CreateThread(nullptr, 0, OpenEnginesThread, &toOpen, 0, nullptr);
+        if (thread) {
+            threads[nStarted++] = thread;
+        }
+    }
+    OpenEnginesThread(&toOpen);
+    for (int i = 0; i < nStarted; i++) {
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+    }
+}
+
 Kind kindEngineMulti = "enginePdfMulti";
 
 class EngineMulti : public EngineBase {
@@ -48,8 +110,11 @@ class EngineMulti : public EngineBase {
 
     RectD PageMediabox(int pageNo) override;
     RectD PageContentBox(int pageNo, RenderTarget target = RenderTarget::View) override;
+    bool HasPendingPageSizes() override;
+    bool WaitForPageData(int pageNo, DWORD timeoutMs) override;
 
     RenderedBitmap* RenderPage(RenderPageArgs& args) override;
+    bool RenderPageToDC(HDC hdc, RenderPageArgs& args, Point offset) override;
 
     RectD Transform(RectD rect, int pageNo, float zoom, int rotation, bool inverse = false) override;
 
@@ -77,17 +142,44 @@ class EngineMulti : public EngineBase {
     bool LoadFromFiles(std::string_view dir, VecStr& files);
     void UpdatePagesForEngines(Vec<EngineInfo>& enginesInfo);
 
-    EngineBase* PageToEngine(int& pageNo) const;
+    EngineBase* GetEngine(EngineInfo& ei);
+    // returns nullptr if the page's file can't be opened
+    // (or hasn't been opened yet, if !open)
+    EngineBase* PageToEngine(int& pageNo, bool open = true);
     VbkmFile vbkm;
     Vec<EnginePage> pageToEngine;
     Vec<EngineInfo> enginesInfo;
     TocTree* tocTree = nullptr;
+    // protects opening the engines in enginesInfo
+    CRITICAL_SECTION enginesAccess;
 };
 
-EngineBase* EngineMulti::PageToEngine(int& pageNo) const {
+// opens the engine when it's needed for the first time
+EngineBase* EngineMulti::GetEngine(EngineInfo& ei) {
+    ScopedCritSec scope(&enginesAccess);
+    if (!ei.engine && !ei.openFailed) {
+        ei.engine = EngineManager::CreateEngine(ei.filePath);
+        ei.openFailed = !ei.engine;
+    }
+    return ei.engine;
+}
+
+EngineBase* EngineMulti::PageToEngine(int& pageNo, bool open) {
     EnginePage& ep = pageToEngine[pageNo - 1];
     pageNo = ep.pageNoInEngine;
-    return ep.engine;
+    EngineInfo& ei = enginesInfo[ep.engineIdx];
+    EngineBase* e = nullptr;
+    if (open) {
+        e = GetEngine(ei);
+    } else {
+        ScopedCritSec scope(&enginesAccess);
+        e = ei.engine;
+    }
+    // the file might have fewer pages than recorded in the .vbkm file
+    if (e && pageNo > e->PageCount()) {
+        return nullptr;
+    }
+    return e;
 }
 
 EngineMulti::EngineMulti() {
@@ -96,13 +188,16 @@ EngineMulti::EngineMulti() {
     fileDPI = 72.0f;
     supportsAnnotations = false;
     supportsAnnotationsForSaving = false;
+    InitializeCriticalSection(&enginesAccess);
 }
 
 EngineMulti::~EngineMulti() {
     for (auto&& ei : enginesInfo) {
         delete ei.engine;
+        free(ei.filePath);
     }
     delete tocTree;
+    DeleteCriticalSection(&enginesAccess);
 }
 
 EngineBase* EngineMulti::Clone() {
@@ -112,23 +207,66 @@ EngineBase* EngineMulti::Clone() {
     return CreateEngineMultiFromFile(fileName, nullptr);
 }
 
+// the pages of files that haven't been opened yet get the default size
+// (and their actual size is picked up once they're being rendered)
 RectD EngineMulti::PageMediabox(int pageNo) {
-    EngineBase* e = PageToEngine(pageNo);
+    EngineBase* e = PageToEngine(pageNo, false);
+    if (!e) {
+        return RectD();
+    }
     return e->PageMediabox(pageNo);
 }
 
 RectD EngineMulti::PageContentBox(int pageNo, RenderTarget target) {
     EngineBase* e = PageToEngine(pageNo);
+    if (!e) {
+        return RectD();
+    }
     return e->PageContentBox(pageNo, target);
 }
 
+bool EngineMulti::HasPendingPageSizes() {
+    ScopedCritSec scope(&enginesAccess);
+    for (auto&& ei : enginesInfo) {
+        if (!ei.engine && !ei.openFailed && !ei.tocRoot->isUnchecked) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool EngineMulti::WaitForPageData(int pageNo, DWORD timeoutMs) {
+    EngineBase* e = PageToEngine(pageNo);
+    if (!e) {
+        return false;
+    }
+    return e->WaitForPageData(pageNo, timeoutMs);
+}
+
 RenderedBitmap* EngineMulti::RenderPage(RenderPageArgs& args) {
-    EngineBase* e = PageToEngine(args.pageNo);
-    return e->RenderPage(args);
+    RenderPageArgs args2 = args;
+    EngineBase* e = PageToEngine(args2.pageNo);
+    if (!e) {
+        return nullptr;
+    }
+    return e->RenderPage(args2);
+}
+
+bool EngineMulti::RenderPageToDC(HDC hdc, RenderPageArgs& args, Point offset) {
+    RenderPageArgs args2 = args;
+    EngineBase* e = PageToEngine(args2.pageNo);
+    if (!e) {
+        return false;
+    }
+    return e->RenderPageToDC(hdc, args2, offset);
 }
 
 RectD EngineMulti::Transform(RectD rect, int pageNo, float zoom, int rotation, bool inverse) {
     EngineBase* e = PageToEngine(pageNo);
+    if (!e) {
+        // nothing is shown for pages of files that couldn't be opened
+        return rect;
+    }
     return e->Transform(rect, pageNo, zoom, rotation, inverse);
 }
 
@@ -146,11 +284,17 @@ bool EngineMulti::SaveFileAsPdf(const char* pdfFileName, bool includeUserAnnots)
 
 WCHAR* EngineMulti::ExtractPageText(int pageNo, Rect** coordsOut) {
     EngineBase* e = PageToEngine(pageNo);
+    if (!e) {
+        return nullptr;
+    }
     return e->ExtractPageText(pageNo, coordsOut);
 }
 
 bool EngineMulti::HasClipOptimizations(int pageNo) {
     EngineBase* e = PageToEngine(pageNo);
+    if (!e) {
+        return false;
+    }
     return e->HasClipOptimizations(pageNo);
 }
 
@@ -160,30 +304,50 @@ WCHAR* EngineMulti::GetProperty(DocumentProperty prop) {
 
 bool EngineMulti::BenchLoadPage(int pageNo) {
     EngineBase* e = PageToEngine(pageNo);
+    if (!e) {
+        return false;
+    }
     return e->BenchLoadPage(pageNo);
 }
 
 Vec<PageElement*>* EngineMulti::GetElements(int pageNo) {
     EngineBase* e = PageToEngine(pageNo);
+    if (!e) {
+        return nullptr;
+    }
     return e->GetElements(pageNo);
 }
 
 PageElement* EngineMulti::GetElementAtPos(int pageNo, PointD pt) {
     EngineBase* e = PageToEngine(pageNo);
+    if (!e) {
+        return nullptr;
+    }
     return e->GetElementAtPos(pageNo, pt);
 }
 
 RenderedBitmap* EngineMulti::GetImageForPageElement(PageElement* pel) {
     EngineBase* e = PageToEngine(pel->pageNo);
+    if (!e) {
+        return nullptr;
+    }
     return e->GetImageForPageElement(pel);
 }
 
 PageDestination* EngineMulti::GetNamedDest(const WCHAR* name) {
-    for (auto&& pe : pageToEngine) {
-        EngineBase* e = pe.engine;
+    for (auto&& ei : enginesInfo) {
+        if (ei.tocRoot->isUnchecked) {
+            continue;
+        }
+        EngineBase* e = GetEngine(ei);
+        if (!e) {
+            continue;
+        }
         auto dest = e->GetNamedDest(name);
         if (dest) {
-            // TODO: fix up page number in returned destination
+            if (dest->pageNo > 0) {
+                dest->pageNo += ei.firstPageNo - 1;
+            }
             return dest;
         }
     }
@@ -233,17 +397,25 @@ WCHAR* EngineMulti::GetPageLabel(int pageNo) const {
         return nullptr;
     }
 
-    EngineBase* e = PageToEngine(pageNo);
-    return e->GetPageLabel(pageNo);
+    // only the labels of files that have already been opened are known
+    // (engines are only ever set once, so this doesn't need enginesAccess)
+    const EnginePage& ep = pageToEngine[pageNo - 1];
+    EngineBase* e = enginesInfo[ep.engineIdx].engine;
+    if (!e || ep.pageNoInEngine > e->PageCount()) {
+        return EngineBase::GetPageLabel(pageNo);
+    }
+    return e->GetPageLabel(ep.pageNoInEngine);
 }
 
 int EngineMulti::GetPageByLabel(const WCHAR* label) const {
-    for (auto&& pe : pageToEngine) {
-        EngineBase* e = pe.engine;
+    for (auto&& ei : enginesInfo) {
+        EngineBase* e = ei.engine;
+        if (!e || ei.firstPageNo == 0) {
+            continue;
+        }
         int pageNo = e->GetPageByLabel(label);
-        if (pageNo != -1) {
-            // TODO: fixup page number
-            return pageNo;
+        if (pageNo > 0 && pageNo <= ei.nPages) {
+            return ei.firstPageNo + pageNo - 1;
         }
     }
     return -1;
@@ -362,14 +534,20 @@ TocItem* CreateWrapperItem(EngineBase* engine) {
     return tocWrapper;
 }
 
+// the ToC of the files is needed right away, so they're all opened (in parallel)
 bool EngineMulti::LoadFromFiles(std::string_view dir, VecStr& files) {
     int n = files.size();
+    EnginesToOpen toOpen;
+    for (int i = 0; i < n; i++) {
+        toOpen.filePaths.Append(strconv::Utf8ToWstr(files.at(i)));
+    }
+    OpenEngines(toOpen);
+
     TocItem* tocFiles = nullptr;
     for (int i = 0; i < n; i++) {
-        std::string_view path = files.at(i);
-        AutoFreeWstr pathW = strconv::Utf8ToWstr(path);
-        EngineBase* engine = EngineManager::CreateEngine(pathW);
+        EngineBase* engine = toOpen.engines[i];
         if (!engine) {
+            free((void*)toOpen.filePaths[i]);
             continue;
         }
 
@@ -383,6 +561,8 @@ bool EngineMulti::LoadFromFiles(std::string_view dir, VecStr& files) {
         EngineInfo ei;
         ei.engine = engine;
         ei.tocRoot = wrapper;
+        ei.filePath = (WCHAR*)toOpen.filePaths[i];
+        ei.nPages = engine->PageCount();
         enginesInfo.Append(ei);
     }
     if (tocFiles == nullptr) {
@@ -402,13 +582,17 @@ bool EngineMulti::LoadFromFiles(std::string_view dir, VecStr& files) {
 }
 
 void EngineMulti::UpdatePagesForEngines(Vec<EngineInfo>& enginesInfo) {
+    pageToEngine.Reset();
     int nTotalPages = 0;
-    for (auto&& ei : enginesInfo) {
+    for (int engineIdx = 0; engineIdx < enginesInfo.isize(); engineIdx++) {
+        EngineInfo& ei = enginesInfo[engineIdx];
+        ei.firstPageNo = 0;
         TocItem* root = ei.tocRoot;
         if (root->isUnchecked) {
             continue;
         }
-        int nPages = ei.engine->PageCount();
+        ei.firstPageNo = nTotalPages + 1;
+        int nPages = ei.nPages;
 #if 0
         Vec<bool> visiblePages;
         for (int i = 0; i < nPages; i++) {
@@ -420,7 +604,7 @@ void EngineMulti::UpdatePagesForEngines(Vec<EngineInfo>& enginesInfo) {
             if (!visiblePages[i]) {
                 continue;
             }
-            EnginePage ep{i + 1, ei.engine};
+            EnginePage ep{i + 1, engineIdx};
             pageToEngine.Append(ep);
             nPage++;
         }
@@ -428,7 +612,7 @@ void EngineMulti::UpdatePagesForEngines(Vec<EngineInfo>& enginesInfo) {
         nTotalPages += nPage;
 #else
         for (int i = 1; i <= nPages; i++) {
-            EnginePage ep{i, ei.engine};
+            EnginePage ep{i, engineIdx};
             pageToEngine.Append(ep);
         }
         updateTocItemsPageNo(ei.tocRoot, nTotalPages, true);
@@ -467,8 +651,9 @@ bool EngineMulti::Load(const WCHAR* fileName, PasswordUI* pwdUI) {
     delete vbkm.tree;
     vbkm.tree = nullptr;
 
-    // load all referenced files
-    auto loadEngines = [this, &filePath](TocItem* ti) -> bool {
+    // find all referenced files. files with a known number of pages
+    // are only opened once one of their pages is needed
+    auto findEngines = [this, &filePath](TocItem* ti) -> bool {
         if (ti->engineFilePath == nullptr) {
             return true;
         }
@@ -476,24 +661,42 @@ bool EngineMulti::Load(const WCHAR* fileName, PasswordUI* pwdUI) {
             return true;
         }
 
-        EngineBase* engine = nullptr;
         AutoFreeStr path = FindEnginePath(filePath.as_view(), ti->engineFilePath);
         if (path.empty()) {
             return false;
         }
-        AutoFreeWstr pathW = strconv::Utf8ToWstr(path.as_view());
-        engine = EngineManager::CreateEngine(pathW, nullptr);
-        if (!engine) {
-            return false;
-        }
         EngineInfo ei;
-        ei.engine = engine;
+        ei.filePath = strconv::Utf8ToWstr(path.as_view());
         ei.tocRoot = ti;
+        ei.nPages = ti->nPages;
         this->enginesInfo.Append(ei);
         return true;
     };
 
-    ok = VisitTocTree(tocRoot, loadEngines);
+    ok = VisitTocTree(tocRoot, findEngines);
+
+    // the other files are opened right away (in parallel)
+    EnginesToOpen toOpen;
+    for (auto&& ei : enginesInfo) {
+        if (ei.nPages <= 0) {
+            toOpen.filePaths.Append(ei.filePath);
+        }
+    }
+    if (ok) {
+        OpenEngines(toOpen);
+    }
+    for (int i = 0, j = 0; ok && i < enginesInfo.isize(); i++) {
+        EngineInfo& ei = enginesInfo[i];
+        if (ei.nPages > 0) {
+            continue;
+        }
+        ei.engine = toOpen.engines[j++];
+        if (!ei.engine) {
+            ok = false;
+            break;
+        }
+        ei.nPages = ei.engine->PageCount();
+    }
     if (!ok) {
         delete tocRoot;
         return false;
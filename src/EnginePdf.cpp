@@ -8,8 +8,14 @@ extern "C" {
 
 #include "utils/BaseUtil.h"
 #include "utils/Archive.h"
+#include "utils/CryptoUtil.h"
+#include "utils/Dict.h"
 #include "utils/ScopedWin.h"
 #include "utils/FileUtil.h"
+#include "utils/FileTypeSniff.h"
+#include "utils/Timer.h"
+#include "utils/Trace.h"
+#include "utils/ThreadUtil.h"
 #include "utils/HtmlParserLookup.h"
 #include "utils/HtmlPullParser.h"
 #include "utils/TrivialHtmlParser.h"
@@ -25,12 +31,36 @@ extern "C" {
 #include "EngineBase.h"
 #include "EngineFzUtil.h"
 #include "EnginePdf.h"
+#include "EngineManager.h"
 
 // in mupdf_load_system_font.c
-extern "C" void drop_cached_fonts_for_ctx(fz_context*);
 
 Kind kindEnginePdf = "enginePdf";
 
+// total time all threads have spent waiting for the ctxAccess or pagesAccess
+// of any EnginePdf (in microseconds, only contended locks are timed)
+static volatile LONG64 gLockWaitUs = 0;
+
+struct ScopedEngineLock {
+    CRITICAL_SECTION* cs = nullptr;
+
+    explicit ScopedEngineLock(CRITICAL_SECTION* cs) : cs(cs) {
+        if (TryEnterCriticalSection(cs)) {
+            return;
+        }
+        auto t = TimeGet();
+        EnterCriticalSection(cs);
+        InterlockedAdd64(&gLockWaitUs, (LONG64)(TimeSinceInMs(t) * 1000));
+    }
+    ~ScopedEngineLock() {
+        LeaveCriticalSection(cs);
+    }
+};
+
+double EnginePdfLockWaitMs() {
+    return (double)InterlockedAdd64(&gLockWaitUs, 0) / 1000;
+}
+
 static fz_link* FixupPageLinks(fz_link* root) {
     // Links in PDF documents are added from bottom-most to top-most,
     // i.e. links that appear later in the list should be preferred
@@ -187,6 +217,81 @@ void BuildPageLabelRec(fz_context* ctx, pdf_obj* node, int pageCount, Vec<PageLa
     }
 }
 
+// resolving a named destination means looking it up in the name tree and finding
+// its page object among all pages, which adds up for large documents whose
+// navigation is scripted through DDE ([GotoNamedDest]), so they're resolved once
+struct NamedDestTarget {
+    int pageNo;
+    float x, y;
+};
+
+struct NamedDestsIndex {
+    // the destination's name (in the document's encoding) -> index into targets
+    dict::MapStrToInt names;
+    Vec<NamedDestTarget> targets;
+};
+
+struct NamedDestToResolve {
+    char* name;
+    pdf_obj* dest;
+};
+
+// collects the same destinations as pdf_lookup_dest would find
+static void CollectNamedDestsRec(fz_context* ctx, pdf_obj* node, Vec<NamedDestToResolve>& dests) {
+    pdf_obj* kids = pdf_dict_get(ctx, node, PDF_NAME(Kids));
+    if (kids && !pdf_mark_obj(ctx, node)) {
+        fz_try(ctx) {
+            int n = pdf_array_len(ctx, kids);
+            for (int i = 0; i < n; i++) {
+                CollectNamedDestsRec(ctx, pdf_array_get(ctx, kids, i), dests);
+            }
+        }
+        fz_always(ctx) {
+            pdf_unmark_obj(ctx, node);
+        }
+        fz_catch(ctx) {
+            fz_rethrow(ctx);
+        }
+    }
+
+    pdf_obj* names = pdf_dict_get(ctx, node, PDF_NAME(Names));
+    int n = pdf_array_len(ctx, names);
+    for (int i = 0; i + 1 < n; i += 2) {
+        pdf_obj* key = pdf_array_get(ctx, names, i);
+        if (!pdf_is_string(ctx, key)) {
+            continue;
+        }
+        const char* s = pdf_to_str_buf(ctx, key);
+        size_t len = pdf_to_str_len(ctx, key);
+        // names with embedded zeros can't be looked up by GetNamedDest anyway
+        if (str::Len(s) != len) {
+            continue;
+        }
+        NamedDestToResolve d = {str::Dup(s), pdf_keep_obj(ctx, pdf_array_get(ctx, names, i + 1))};
+        dests.Append(d);
+    }
+}
+
+static void CollectNamedDests(fz_context* ctx, pdf_document* doc, Vec<NamedDestToResolve>& dests) {
+    pdf_obj* root = pdf_dict_get(ctx, pdf_trailer(ctx, doc), PDF_NAME(Root));
+    // PDF 1.1 has destinations in a dictionary
+    pdf_obj* destsDict = pdf_dict_get(ctx, root, PDF_NAME(Dests));
+    if (destsDict) {
+        int n = pdf_dict_len(ctx, destsDict);
+        for (int i = 0; i < n; i++) {
+            const char* name = pdf_to_name(ctx, pdf_dict_get_key(ctx, destsDict, i));
+            NamedDestToResolve d = {str::Dup(name), pdf_keep_obj(ctx, pdf_dict_get_val(ctx, destsDict, i))};
+            dests.Append(d);
+        }
+        return;
+    }
+    // PDF 1.2 has destinations in a name tree
+    pdf_obj* tree = pdf_dict_getp(ctx, root, "Names/Dests");
+    if (tree) {
+        CollectNamedDestsRec(ctx, tree, dests);
+    }
+}
+
 WStrVec* BuildPageLabelVec(fz_context* ctx, pdf_obj* root, int pageCount) {
     Vec<PageLabelInfo> data;
     BuildPageLabelRec(ctx, root, pageCount, data);
@@ -298,8 +403,12 @@ class EnginePdf : public EngineBase {
 
     RectD PageMediabox(int pageNo) override;
     RectD PageContentBox(int pageNo, RenderTarget target = RenderTarget::View) override;
+    bool HasPendingPageSizes() override;
+    int FinalPageSizesCount() override;
+    bool WaitForPageData(int pageNo, DWORD timeoutMs) override;
 
     RenderedBitmap* RenderPage(RenderPageArgs& args) override;
+    bool RenderPageToDC(HDC hdc, RenderPageArgs& args, Point offset) override;
 
     RectD Transform(RectD rect, int pageNo, float zoom, int rotation, bool inverse = false) override;
 
@@ -312,6 +421,8 @@ class EnginePdf : public EngineBase {
     WCHAR* GetProperty(DocumentProperty prop) override;
 
     bool BenchLoadPage(int pageNo) override;
+    bool GetPageFingerprint(int pageNo, u8 digestOut[16]) override;
+    void FreeCachedPages() override;
 
     Vec<PageElement*>* GetElements(int pageNo) override;
     PageElement* GetElementAtPos(int pageNo, PointD pt) override;
@@ -332,22 +443,63 @@ class EnginePdf : public EngineBase {
     // protected critical section in order to avoid deadlocks
     CRITICAL_SECTION* ctxAccess;
     CRITICAL_SECTION pagesAccess;
-
-    CRITICAL_SECTION mutexes[FZ_LOCK_MAX];
+    // protects ctx and _doc. this is distinct from MuPDF's own FZ_LOCK_ALLOC
+    // so that pages can be rasterized on cloned contexts (which allocate
+    // memory) while ctxAccess is held by another thread
+    CRITICAL_SECTION docAccess;
+    // protects FzPageInfo::mediabox while page sizes are being determined
+    // in the background. never acquire another lock while holding it
+    CRITICAL_SECTION mediaboxAccess;
 
     RenderedBitmap* GetPageImage(int pageNo, RectD rect, int imageIx);
 
     fz_context* ctx = nullptr;
-    fz_locks_context fz_locks_ctx;
     fz_document* _doc = nullptr;
     fz_stream* _docStream = nullptr;
     Vec<FzPageInfo*> _pages;
+    // pages with a cached display list, most recently used first
+    // (protected by ctxAccess)
+    Vec<FzPageInfo*> runCache;
+    // pages with cached structured text, most recently used first
+    // (protected by ctxAccess)
+    Vec<FzPageInfo*> textCache;
     fz_outline* outline = nullptr;
     fz_outline* attachments = nullptr;
     pdf_obj* _info = nullptr;
     WStrVec* _pageLabels = nullptr;
+    // label -> first page with that label, for GetPageByLabel
+    dict::MapWStrToInt* _pageLabelsIndex = nullptr;
+
+    // set once all named destinations have been resolved in the background
+    // (protected by ctxAccess)
+    NamedDestsIndex* namedDests = nullptr;
+    CancelToken* namedDestsToken = nullptr;
 
     TocTree* tocTree = nullptr;
+    // hashes of the raw data of streams by object number (0 if not yet known),
+    // so that e.g. fonts used on all pages are only hashed once
+    // (protected by ctxAccess)
+    Vec<u32> streamHashes;
+
+    // set once Annotation objects have been created, as these
+    // refer to the loaded pages (which then can't be freed anymore)
+    bool annotsHandedOut = false;
+
+    HANDLE pageSizesThread = nullptr;
+    bool pageSizesPending = false;
+    bool abortPageSizes = false;
+    // the sizes of the first nFinalPageSizes pages have been determined
+    // (protected by mediaboxAccess)
+    int nFinalPageSizes = 0;
+
+    // set while a linearized document is still being read progressively
+    // (cf. fz_open_file_progressive). until then only pages with complete
+    // content are used and FinishProgressiveLoading runs on pageSizesThread
+    // (protected by ctxAccess)
+    bool loadingProgressively = false;
+
+    // the last background save started by EnginePdfSaveUpdatedAsync
+    HANDLE saveThread = nullptr;
 
     bool Load(const WCHAR* fileName, PasswordUI* pwdUI = nullptr);
     bool Load(IStream* stream, PasswordUI* pwdUI = nullptr);
@@ -355,17 +507,26 @@ class EnginePdf : public EngineBase {
     // bool Load(fz_stream* stm, PasswordUI* pwdUI = nullptr);
     bool LoadFromStream(fz_stream* stm, PasswordUI* pwdUI = nullptr);
     bool FinishLoading();
+    void LoadDocumentInfo();
+    void BuildNamedDestsIndex();
+    bool FinishProgressiveLoading();
+    void ResolvePageSizes();
+    void ResolvePageSize(FzPageInfo* pageInfo);
 
     FzPageInfo* GetFzPageInfoFast(int pageNo);
     FzPageInfo* GetFzPageInfo(int pageNo, bool loadQuick);
+    fz_display_list* GetDisplayList(FzPageInfo* pageInfo);
     fz_matrix viewctm(int pageNo, float zoom, int rotation);
     fz_matrix viewctm(fz_page* page, float zoom, int rotation);
     TocItem* BuildTocTree(TocItem* parent, fz_outline* entry, int& idCounter, bool isAttachment);
     void MakePageElementCommentsFromAnnotations(FzPageInfo* pageInfo);
+    void AppendFingerprint(pdf_obj* obj, str::Str& fp, int depth);
     WCHAR* ExtractFontList();
     bool IsLinearizedFile();
 
     bool SaveUserAnnots(const char* fileName);
+    bool SaveUpdated(const char* filePath);
+    void WaitForSave();
 };
 
 // https://github.com/sumatrapdfreader/sumatrapdf/issues/1336
@@ -373,25 +534,12 @@ class EnginePdf : public EngineBase {
 bool PdfLink::SaveEmbedded(LinkSaverUI& saveUI) {
     CrashIf(!outline || !isAttachment);
 
-    ScopedCritSec scope(engine->ctxAccess);
+    ScopedEngineLock scope(engine->ctxAccess);
     // TODO: hack, we stored stream number in outline->page
     return engine->SaveEmbedded(saveUI, outline->page);
 }
 #endif
 
-// in mupdf_load_system_font.c
-extern "C" void pdf_install_load_system_font_funcs(fz_context* ctx);
-
-static void fz_lock_context_cs(void* user, int lock) {
-    EnginePdf* e = (EnginePdf*)user;
-    EnterCriticalSection(&e->mutexes[lock]);
-}
-
-static void fz_unlock_context_cs(void* user, int lock) {
-    EnginePdf* e = (EnginePdf*)user;
-    LeaveCriticalSection(&e->mutexes[lock]);
-}
-
 static void fz_print_cb(void* user, const char* msg) {
     log(msg);
     if (!str::EndsWith(msg, "\n")) {
@@ -411,28 +559,41 @@ EnginePdf::EnginePdf() {
     defaultFileExt = L".pdf";
     fileDPI = 72.0f;
 
-    for (size_t i = 0; i < dimof(mutexes); i++) {
-        InitializeCriticalSection(&mutexes[i]);
-    }
     InitializeCriticalSection(&pagesAccess);
-    ctxAccess = &mutexes[FZ_LOCK_ALLOC];
+    InitializeCriticalSection(&docAccess);
+    InitializeCriticalSection(&mediaboxAccess);
+    ctxAccess = &docAccess;
 
-    fz_locks_ctx.user = this;
-    fz_locks_ctx.lock = fz_lock_context_cs;
-    fz_locks_ctx.unlock = fz_unlock_context_cs;
-    ctx = fz_new_context(nullptr, &fz_locks_ctx, FZ_STORE_DEFAULT);
+    ctx = NewFzContext();
     installFitzErrorCallbacks(ctx);
-
-    pdf_install_load_system_font_funcs(ctx);
 }
 
 EnginePdf::~EnginePdf() {
+    WaitForSave();
+    if (pageSizesThread) {
+        abortPageSizes = true;
+        WaitForSingleObject(pageSizesThread, INFINITE);
+        CloseHandle(pageSizesThread);
+    }
+    // (queued by LoadDocumentInfo which might run on pageSizesThread)
+    if (namedDestsToken) {
+        namedDestsToken->Cancel();
+        namedDestsToken->Wait();
+        namedDestsToken->Release();
+    }
+
     EnterCriticalSection(&pagesAccess);
 
     // TODO: remove this lock and see what happens
     EnterCriticalSection(ctxAccess);
 
     for (auto* pi : _pages) {
+        if (pi->list) {
+            fz_drop_display_list(ctx, pi->list);
+        }
+        if (pi->stext) {
+            fz_drop_stext_page(ctx, pi->stext);
+        }
         if (pi->links) {
             fz_drop_link(ctx, pi->links);
         }
@@ -450,16 +611,16 @@ EnginePdf::~EnginePdf() {
     pdf_drop_obj(ctx, _info);
 
     fz_drop_document(ctx, _doc);
-    drop_cached_fonts_for_ctx(ctx);
     fz_drop_context(ctx);
 
     delete _pageLabels;
+    delete _pageLabelsIndex;
+    delete namedDests;
     delete tocTree;
 
-    for (size_t i = 0; i < dimof(mutexes); i++) {
-        LeaveCriticalSection(&mutexes[i]);
-        DeleteCriticalSection(&mutexes[i]);
-    }
+    LeaveCriticalSection(ctxAccess);
+    DeleteCriticalSection(&docAccess);
+    DeleteCriticalSection(&mediaboxAccess);
     LeaveCriticalSection(&pagesAccess);
     DeleteCriticalSection(&pagesAccess);
 }
@@ -483,7 +644,7 @@ class PasswordCloner : public PasswordUI {
 };
 
 EngineBase* EnginePdf::Clone() {
-    ScopedCritSec scope(ctxAccess);
+    ScopedEngineLock scope(ctxAccess);
     if (!FileName()) {
         // before port we could clone streams but it's no longer possible
         return nullptr;
@@ -540,6 +701,126 @@ static const WCHAR* findEmbedMarks(const WCHAR* fileName) {
     return nullptr;
 }
 
+// how long to wait for more data of a progressively read document
+// before trying again to load what's needed
+#define PROGRESSIVE_RETRY_DELAY_MS 100
+
+#define PDF_REPAIR_CACHE_MAX_FILES 256
+
+static WCHAR* gPdfRepairCacheDir = nullptr;
+
+void SetPdfRepairCacheDir(const WCHAR* dir) {
+    str::ReplacePtr(&gPdfRepairCacheDir, dir);
+}
+
+// the name of a cached repair is the file's fingerprint (cf. CalcFileFingerprint)
+// caller must free() the result
+static WCHAR* GetPdfRepairCachePath(const WCHAR* filePath) {
+    if (!gPdfRepairCacheDir) {
+        return nullptr;
+    }
+    unsigned char digest[16];
+    if (!CalcFileFingerprint(filePath, digest)) {
+        return nullptr;
+    }
+    AutoFree fingerPrint(_MemToHex(&digest));
+    AutoFreeWstr fileName(strconv::FromAnsi(fingerPrint));
+    fileName.Set(str::Join(fileName, L".repair"));
+    return path::Join(gPdfRepairCacheDir, fileName);
+}
+
+struct PdfRepairCacheFile {
+    WCHAR* name;
+    FILETIME lastWrite;
+};
+
+static int cmpCacheFileNewestFirst(const void* a, const void* b) {
+    const PdfRepairCacheFile* fa = (const PdfRepairCacheFile*)a;
+    const PdfRepairCacheFile* fb = (const PdfRepairCacheFile*)b;
+    return CompareFileTime(&fb->lastWrite, &fa->lastWrite);
+}
+
+// only keeps the data of the most recently repaired documents
+static void CleanUpPdfRepairCache() {
+    Vec<PdfRepairCacheFile> files;
+    AutoFreeWstr pattern(path::Join(gPdfRepairCacheDir, L"*.repair"));
+    WIN32_FIND_DATA fdata;
+    HANDLE hfind = FindFirstFile(pattern, &fdata);
+    if (INVALID_HANDLE_VALUE == hfind) {
+        return;
+    }
+    do {
+        files.Append({str::Dup(fdata.cFileName), fdata.ftLastWriteTime});
+    } while (FindNextFile(hfind, &fdata));
+    FindClose(hfind);
+
+    files.Sort(cmpCacheFileNewestFirst);
+    for (int i = 0; i < files.isize(); i++) {
+        if (i >= PDF_REPAIR_CACHE_MAX_FILES) {
+            AutoFreeWstr path(path::Join(gPdfRepairCacheDir, files.at(i).name));
+            file::Delete(path);
+        }
+        free(files.at(i).name);
+    }
+}
+
+// state for the pdf_repair_hooks used while loading a document
+struct PdfRepairState {
+    // nullptr if the repair isn't to be cached
+    const WCHAR* cachePath = nullptr;
+    PasswordUI* pwdUI = nullptr;
+    int percent = -1;
+};
+
+static void PdfRepairProgress(fz_context* ctx, void* opaque, int64_t pos, int64_t len) {
+    PdfRepairState* state = (PdfRepairState*)opaque;
+    if (!state->pwdUI || len <= 0) {
+        return;
+    }
+    int percent = (int)(std::min(pos, len) * 100 / len);
+    if (percent == state->percent) {
+        return;
+    }
+    state->percent = percent;
+    if (!state->pwdUI->UpdateRepairProgress(percent)) {
+        fz_throw(ctx, FZ_ERROR_ABORT, "loading has been canceled");
+    }
+}
+
+static fz_buffer* PdfRepairLoad(fz_context* ctx, void* opaque) {
+    PdfRepairState* state = (PdfRepairState*)opaque;
+    if (!state->cachePath) {
+        return nullptr;
+    }
+    AutoFree data = file::ReadFile(state->cachePath);
+    if (!data.Get()) {
+        return nullptr;
+    }
+    fz_buffer* buf = nullptr;
+    fz_try(ctx) {
+        buf = fz_new_buffer_from_copied_data(ctx, (u8*)data.Get(), data.size());
+    }
+    fz_catch(ctx) {
+        buf = nullptr;
+    }
+    return buf;
+}
+
+static void PdfRepairSave(fz_context* ctx, void* opaque, fz_buffer* data) {
+    PdfRepairState* state = (PdfRepairState*)opaque;
+    if (!state->cachePath) {
+        return;
+    }
+    u8* d = nullptr;
+    size_t len = fz_buffer_storage(ctx, data, &d);
+    if (!dir::CreateAll(gPdfRepairCacheDir)) {
+        return;
+    }
+    if (file::WriteFile(state->cachePath, {(char*)d, len})) {
+        CleanUpPdfRepairCache();
+    }
+}
+
 bool EnginePdf::Load(const WCHAR* fileName, PasswordUI* pwdUI) {
     CrashIf(FileName() || _doc || !ctx);
     SetFileName(fileName);
@@ -556,7 +837,13 @@ bool EnginePdf::Load(const WCHAR* fileName, PasswordUI* pwdUI) {
         *embedMarks = '\0';
     }
     fz_try(ctx) {
-        file = fz_open_file2(ctx, fnCopy);
+        if (!embedMarks && !path::IsOnFixedDrive(fnCopy)) {
+            // so that linearized documents on network drives can be
+            // displayed before they've been read completely
+            file = fz_open_file_progressive(ctx, fnCopy);
+        } else {
+            file = fz_open_file2(ctx, fnCopy);
+        }
     }
     fz_catch(ctx) {
         file = nullptr;
@@ -631,18 +918,38 @@ bool EnginePdf::LoadFromStream(fz_stream* stm, PasswordUI* pwdUI) {
         return false;
     }
 
-    fz_try(ctx) {
-        pdf_document* doc = pdf_open_document_with_stream(ctx, stm);
-        _doc = (fz_document*)doc;
-    }
-    fz_always(ctx) {
-        fz_drop_stream(ctx, stm);
+    // repairing broken documents requires scanning them completely, so the
+    // result is cached and progress is reported (which allows canceling)
+    AutoFreeWstr repairCachePath(GetPdfRepairCachePath(FileName()));
+    PdfRepairState repairState;
+    repairState.cachePath = repairCachePath;
+    repairState.pwdUI = pwdUI;
+    pdf_repair_hooks repairHooks = {PdfRepairProgress, PdfRepairLoad, PdfRepairSave, &repairState};
+
+    // for progressively read files, this has to wait for the first part
+    // of linearized documents and until all of any other document has arrived
+    for (;;) {
+        bool complete = FzWaitForProgressiveData(stm, 0);
+        bool tryLater = false;
+        fz_try(ctx) {
+            pdf_document* doc = pdf_open_document_with_stream_and_repair_hooks(ctx, stm, &repairHooks);
+            _doc = (fz_document*)doc;
+        }
+        fz_catch(ctx) {
+            tryLater = fz_caught(ctx) == FZ_ERROR_TRYLATER;
+        }
+        if (_doc || !tryLater || complete) {
+            break;
+        }
+        FzWaitForProgressiveData(stm, PROGRESSIVE_RETRY_DELAY_MS);
     }
-    fz_catch(ctx) {
+    fz_drop_stream(ctx, stm);
+    if (!_doc) {
         return false;
     }
 
     _docStream = stm;
+    loadingProgressively = ((pdf_document*)_doc)->file_reading_linearly;
 
     isPasswordProtected = fz_needs_password(ctx, _doc);
     if (!isPasswordProtected) {
@@ -730,7 +1037,50 @@ static PageLayoutType GetPreferredLayout(fz_context* ctx, pdf_document* doc) {
     return layout;
 }
 
+// documents with more pages only have the sizes of their first
+// PAGE_SIZES_ON_LOAD pages determined before they're displayed
+#define LAZY_PAGE_SIZES_MIN_PAGES 2000
+#define PAGE_SIZES_ON_LOAD 64
+// number of pages sized at once in the background (under ctxAccess)
+#define PAGE_SIZES_CHUNK 256
+
+// this does the job of pdf_bound_page but without doing pdf_load_page()
+// tryLater is set if the page object hasn't been read yet (cf. loadingProgressively)
+// Note: make sure to only call with ctxAccess
+static fz_rect PageObjMediabox(fz_context* ctx, pdf_document* doc, int pageIdx, bool* tryLater = nullptr) {
+    fz_rect mbox = {};
+    fz_matrix page_ctm;
+
+    fz_try(ctx) {
+        // the page tree of linearized documents can't be used until they've been read completely
+        pdf_obj* pageref = doc->file_reading_linearly ? pdf_progressive_advance(ctx, doc, pageIdx)
+                                                      : pdf_lookup_page_obj(ctx, doc, pageIdx);
+        pdf_page_obj_transform(ctx, pageref, &mbox, &page_ctm);
+        mbox = fz_transform_rect(mbox, page_ctm);
+    }
+    fz_catch(ctx) {
+        if (tryLater) {
+            *tryLater = fz_caught(ctx) == FZ_ERROR_TRYLATER;
+        }
+    }
+    if (fz_is_empty_rect(mbox)) {
+        fz_warn(ctx, "cannot find page size for page %d", pageIdx);
+        mbox.x0 = 0;
+        mbox.y0 = 0;
+        mbox.x1 = 612;
+        mbox.y1 = 792;
+    }
+    return mbox;
+}
+
+static DWORD WINAPI ResolvePageSizesThread(LPVOID data) {
+    EnginePdf* engine = (EnginePdf*)data;
+    engine->ResolvePageSizes();
+    return 0;
+}
+
 bool EnginePdf::FinishLoading() {
+    TraceSpan span("EnginePdf::FinishLoading");
     pageCount = 0;
     fz_try(ctx) {
         // this call might throw the first time
@@ -750,34 +1100,136 @@ bool EnginePdf::FinishLoading() {
     allowsPrinting = fz_has_permission(ctx, _doc, FZ_PERMISSION_PRINT);
     allowsCopyingText = fz_has_permission(ctx, _doc, FZ_PERMISSION_COPY);
 
-    ScopedCritSec scope(ctxAccess);
-
-    // this does the job of pdf_bound_page but without doing pdf_load_page()
-    // TODO: time pdf_load_page(), maybe it's not slow?
+    ScopedEngineLock scope(ctxAccess);
+
+    // e.g. smaller files might have arrived completely already
+    if (loadingProgressively && FzWaitForProgressiveData(_docStream, 0)) {
+        FinishProgressiveLoading();
+    }
+
+    // looking up all page objects takes seconds for documents with tens of
+    // thousands of pages, so for these the other pages are assumed to be as
+    // large as the first one until their sizes have been determined
+    // in the background (or the page is loaded)
+    int nSized = pageCount;
+    if (pageCount >= LAZY_PAGE_SIZES_MIN_PAGES) {
+        nSized = PAGE_SIZES_ON_LOAD;
+    }
+    if (loadingProgressively) {
+        // the first page is displayed right away, so at least its page
+        // object (though not necessarily its content) has to have been read
+        for (;;) {
+            bool complete = FzWaitForProgressiveData(_docStream, 0);
+            bool tryLater = false;
+            PageObjMediabox(ctx, doc, 0, &tryLater);
+            if (!tryLater || complete) {
+                break;
+            }
+            FzWaitForProgressiveData(_docStream, PROGRESSIVE_RETRY_DELAY_MS);
+        }
+        nSized = 1;
+    }
     for (int i = 0; i < pageCount; i++) {
-        fz_rect mbox;
-        fz_matrix page_ctm;
+        FzPageInfo* pageInfo = new FzPageInfo();
+        if (i < nSized) {
+            pageInfo->mediabox = fz_rect_to_RectD(PageObjMediabox(ctx, doc, i));
+        } else {
+            pageInfo->mediabox = _pages[0]->mediabox;
+            pageInfo->mediaboxEstimated = true;
+        }
+        pageInfo->pageNo = i + 1;
+        _pages.Append(pageInfo);
+    }
+    nFinalPageSizes = nSized;
+
+    // of progressively read documents, mostly the first page is available so far
+    // (this is done on pageSizesThread once they've arrived completely)
+    if (!loadingProgressively) {
+        LoadDocumentInfo();
+    }
+
+    // TODO: support javascript
+    CrashIf(pdf_js_supported(ctx, doc));
+
+    if (nSized < pageCount || loadingProgressively) {
+        pageSizesPending = true;
+        pageSizesThread = CreateThread(nullptr, 0, ResolvePageSizesThread, this, 0, 0);
+        if (!pageSizesThread) {
+            pageSizesPending = false;
+            if (loadingProgressively) {
+                FinishProgressiveLoading();
+                LoadDocumentInfo();
+            }
+        }
+    }
+    return true;
+}
 
+// number of destinations resolved at a time, so that rendering
+// isn't blocked by ctxAccess while all of them are resolved
+#define NAMED_DESTS_RESOLVE_CHUNK 256
+
+void EnginePdf::BuildNamedDestsIndex() {
+    pdf_document* doc = (pdf_document*)_doc;
+    Vec<NamedDestToResolve> dests;
+    bool ok = true;
+    {
+        ScopedEngineLock scope(ctxAccess);
         fz_try(ctx) {
-            pdf_obj* pageref = pdf_lookup_page_obj(ctx, doc, i);
-            pdf_page_obj_transform(ctx, pageref, &mbox, &page_ctm);
-            mbox = fz_transform_rect(mbox, page_ctm);
+            CollectNamedDests(ctx, doc, dests);
         }
         fz_catch(ctx) {
+            fz_warn(ctx, "Couldn't load named destinations");
+            ok = false;
+        }
+    }
+
+    auto* index = new NamedDestsIndex();
+    size_t n = dests.size();
+    for (size_t i = 0; i < n; i += NAMED_DESTS_RESOLVE_CHUNK) {
+        ok = ok && !namedDestsToken->IsCanceled();
+        ScopedEngineLock scope(ctxAccess);
+        size_t end = std::min(i + NAMED_DESTS_RESOLVE_CHUNK, n);
+        for (size_t j = i; j < end; j++) {
+            NamedDestToResolve& d = dests.at(j);
+            char* uri = nullptr;
+            fz_var(uri);
+            fz_try(ctx) {
+                if (ok) {
+                    uri = pdf_parse_link_dest(ctx, doc, d.dest);
+                }
+            }
+            fz_catch(ctx) {
+                uri = nullptr;
+            }
+            if (uri) {
+                NamedDestTarget target;
+                target.pageNo = resolve_link(uri, &target.x, &target.y);
+                fz_free(ctx, uri);
+                // like pdf_lookup_dest, use the first destination of a given name
+                if (index->names.Insert(d.name, index->targets.isize())) {
+                    index->targets.Append(target);
+                }
+            }
+            pdf_drop_obj(ctx, d.dest);
+            str::Free(d.name);
         }
-        if (fz_is_empty_rect(mbox)) {
-            fz_warn(ctx, "cannot find page size for page %d", i);
-            mbox.x0 = 0;
-            mbox.y0 = 0;
-            mbox.x1 = 612;
-            mbox.y1 = 792;
-        }
-        FzPageInfo* pageInfo = new FzPageInfo();
-        pageInfo->mediabox = fz_rect_to_RectD(mbox);
-        pageInfo->pageNo = i + 1;
-        _pages.Append(pageInfo);
     }
 
+    ScopedEngineLock scope(ctxAccess);
+    if (!ok) {
+        delete index;
+        return;
+    }
+    namedDests = index;
+}
+
+// the outline, properties, etc. might be loaded on pageSizesThread (cf. FinishProgressiveLoading)
+// and are only published once they're complete, as they're accessed without locking
+// Note: make sure to only call with ctxAccess
+void EnginePdf::LoadDocumentInfo() {
+    pdf_document* doc = (pdf_document*)_doc;
+
     fz_try(ctx) {
         outline = fz_load_outline(ctx, _doc);
     }
@@ -797,6 +1249,8 @@ bool EnginePdf::FinishLoading() {
     }
 
     pdf_obj* orig_info = nullptr;
+    pdf_obj* info = nullptr;
+    fz_var(info);
     fz_try(ctx) {
         // keep a copy of the Info dictionary, as accessing the original
         // isn't thread safe and we don't want to block for this when
@@ -804,20 +1258,20 @@ bool EnginePdf::FinishLoading() {
         orig_info = pdf_dict_gets(ctx, pdf_trailer(ctx, doc), "Info");
 
         if (orig_info) {
-            _info = pdf_copy_str_dict(ctx, doc, orig_info);
+            info = pdf_copy_str_dict(ctx, doc, orig_info);
         }
-        if (!_info) {
-            _info = pdf_new_dict(ctx, doc, 4);
+        if (!info) {
+            info = pdf_new_dict(ctx, doc, 4);
         }
         // also remember linearization and tagged states at this point
         if (IsLinearizedFile()) {
-            pdf_dict_puts_drop(ctx, _info, "Linearized", PDF_TRUE);
+            pdf_dict_puts_drop(ctx, info, "Linearized", PDF_TRUE);
         }
         pdf_obj* trailer = pdf_trailer(ctx, doc);
         pdf_obj* marked = pdf_dict_getp(ctx, trailer, "Root/MarkInfo/Marked");
         bool isMarked = pdf_to_bool(ctx, marked);
         if (isMarked) {
-            pdf_dict_puts_drop(ctx, _info, "Marked", PDF_TRUE);
+            pdf_dict_puts_drop(ctx, info, "Marked", PDF_TRUE);
         }
         // also remember known output intents (PDF/X, etc.)
         pdf_obj* intents = pdf_dict_getp(ctx, trailer, "Root/OutputIntents");
@@ -830,35 +1284,149 @@ bool EnginePdf::FinishLoading() {
                     str::StartsWith(pdf_to_name(ctx, intent), "GTS_PDF"))
                     pdf_array_push(ctx, list, intent);
             }
-            pdf_dict_puts_drop(ctx, _info, "OutputIntents", list);
+            pdf_dict_puts_drop(ctx, info, "OutputIntents", list);
         }
         // also note common unsupported features (such as XFA forms)
         pdf_obj* xfa = pdf_dict_getp(ctx, pdf_trailer(ctx, doc), "Root/AcroForm/XFA");
         if (pdf_is_array(ctx, xfa)) {
-            pdf_dict_puts_drop(ctx, _info, "Unsupported_XFA", PDF_TRUE);
+            pdf_dict_puts_drop(ctx, info, "Unsupported_XFA", PDF_TRUE);
         }
     }
     fz_catch(ctx) {
         fz_warn(ctx, "Couldn't load document properties");
-        pdf_drop_obj(ctx, _info);
-        _info = nullptr;
+        pdf_drop_obj(ctx, info);
+        info = nullptr;
     }
+    _info = info;
 
+    WStrVec* labels = nullptr;
+    fz_var(labels);
     fz_try(ctx) {
         pdf_obj* pageLabels = pdf_dict_getp(ctx, pdf_trailer(ctx, doc), "Root/PageLabels");
         if (pageLabels) {
-            _pageLabels = BuildPageLabelVec(ctx, pageLabels, PageCount());
+            labels = BuildPageLabelVec(ctx, pageLabels, PageCount());
         }
     }
     fz_catch(ctx) {
         fz_warn(ctx, "Couldn't load page labels");
     }
-    if (_pageLabels) {
+    if (labels) {
+        auto* labelsIndex = new dict::MapWStrToInt(labels->size());
+        for (int i = 0; i < labels->isize(); i++) {
+            const WCHAR* label = labels->at(i);
+            if (label) {
+                labelsIndex->Insert(label, i + 1, nullptr);
+            }
+        }
+        _pageLabelsIndex = labelsIndex;
+        _pageLabels = labels;
         hasPageLabels = true;
     }
 
-    // TODO: support javascript
-    CrashIf(pdf_js_supported(ctx, doc));
+    namedDestsToken = new CancelToken();
+    QueueWork(
+        WorkPriority::Index, [this] { BuildNamedDestsIndex(); }, namedDestsToken);
+}
+
+// waits until a progressively read document has arrived completely and then
+// reads the rest of it. returns false if aborted
+bool EnginePdf::FinishProgressiveLoading() {
+    while (!FzWaitForProgressiveData(_docStream, PROGRESSIVE_RETRY_DELAY_MS)) {
+        if (abortPageSizes) {
+            return false;
+        }
+    }
+
+    ScopedEngineLock scope(ctxAccess);
+    pdf_document* doc = (pdf_document*)_doc;
+    fz_try(ctx) {
+        // reads all remaining objects and the complete xref
+        pdf_progressive_advance(ctx, doc, pageCount - 1);
+        // so that pages are looked up in the page tree from now on
+        doc->file_reading_linearly = 0;
+    }
+    fz_catch(ctx) {
+        fz_warn(ctx, "Couldn't read the rest of the document");
+    }
+    loadingProgressively = false;
+    return true;
+}
+
+// determines the sizes of the pages which were only estimated in FinishLoading
+void EnginePdf::ResolvePageSizes() {
+    if (loadingProgressively) {
+        if (!FinishProgressiveLoading()) {
+            return;
+        }
+        ScopedEngineLock scope(ctxAccess);
+        LoadDocumentInfo();
+    }
+    pdf_document* doc = (pdf_document*)_doc;
+    int first;
+    {
+        ScopedCritSec scope(&mediaboxAccess);
+        first = nFinalPageSizes;
+    }
+    fz_rect mboxes[PAGE_SIZES_CHUNK];
+    for (int start = first; start < pageCount && !abortPageSizes; start += PAGE_SIZES_CHUNK) {
+        int end = std::min(start + PAGE_SIZES_CHUNK, pageCount);
+        // release ctxAccess after every chunk so that rendering isn't held up
+        {
+            ScopedEngineLock scope(ctxAccess);
+            for (int i = start; i < end; i++) {
+                mboxes[i - start] = PageObjMediabox(ctx, doc, i);
+            }
+        }
+        ScopedCritSec scope(&mediaboxAccess);
+        for (int i = start; i < end; i++) {
+            FzPageInfo* pageInfo = _pages[i];
+            if (pageInfo->mediaboxEstimated) {
+                pageInfo->mediabox = fz_rect_to_RectD(mboxes[i - start]);
+                pageInfo->mediaboxEstimated = false;
+            }
+        }
+        nFinalPageSizes = end;
+    }
+
+    ScopedCritSec scope(&mediaboxAccess);
+    pageSizesPending = false;
+}
+
+// Note: make sure to only call with ctxAccess
+void EnginePdf::ResolvePageSize(FzPageInfo* pageInfo) {
+    {
+        ScopedCritSec scope(&mediaboxAccess);
+        if (!pageInfo->mediaboxEstimated) {
+            return;
+        }
+    }
+    RectD mbox = fz_rect_to_RectD(PageObjMediabox(ctx, (pdf_document*)_doc, pageInfo->pageNo - 1));
+    ScopedCritSec scope(&mediaboxAccess);
+    pageInfo->mediabox = mbox;
+    pageInfo->mediaboxEstimated = false;
+}
+
+bool EnginePdf::HasPendingPageSizes() {
+    ScopedCritSec scope(&mediaboxAccess);
+    return pageSizesPending;
+}
+
+int EnginePdf::FinalPageSizesCount() {
+    ScopedCritSec scope(&mediaboxAccess);
+    return pageSizesPending ? nFinalPageSizes : pageCount;
+}
+
+bool EnginePdf::WaitForPageData(int pageNo, DWORD timeoutMs) {
+    {
+        ScopedEngineLock scope(ctxAccess);
+        if (!loadingProgressively) {
+            return false;
+        }
+    }
+    if (GetFzPageInfo(pageNo, true)) {
+        return false;
+    }
+    FzWaitForProgressiveData(_docStream, timeoutMs);
     return true;
 }
 
@@ -964,12 +1532,22 @@ TocTree* EnginePdf::GetToc() {
 }
 
 PageDestination* EnginePdf::GetNamedDest(const WCHAR* name) {
-    ScopedCritSec scope1(&pagesAccess);
-    ScopedCritSec scope2(ctxAccess);
+    ScopedEngineLock scope1(&pagesAccess);
+    ScopedEngineLock scope2(ctxAccess);
 
     pdf_document* doc = (pdf_document*)_doc;
 
     AutoFree name_utf8(strconv::WstrToUtf8(name));
+    if (namedDests) {
+        int idx;
+        if (!namedDests->names.Get(name_utf8.Get(), &idx)) {
+            return nullptr;
+        }
+        NamedDestTarget& target = namedDests->targets.at(idx);
+        RectD r{target.x, target.y, 0, 0};
+        return newSimpleDest(target.pageNo, r);
+    }
+
     pdf_obj* dest = nullptr;
 
     fz_var(dest);
@@ -1012,7 +1590,7 @@ PageDestination* EnginePdf::GetNamedDest(const WCHAR* name) {
 
 // return a page but only if is fully loaded
 FzPageInfo* EnginePdf::GetFzPageInfoFast(int pageNo) {
-    ScopedCritSec scope(&pagesAccess);
+    ScopedEngineLock scope(&pagesAccess);
     CrashIf(pageNo < 1 || pageNo > pageCount);
     auto pageInfo = _pages[pageNo - 1];
     if (!pageInfo->page || !pageInfo->fullyLoaded) {
@@ -1021,25 +1599,33 @@ FzPageInfo* EnginePdf::GetFzPageInfoFast(int pageNo) {
     return pageInfo;
 }
 
-// Maybe: handle FZ_ERROR_TRYLATER, which can happen when parsing from network.
-// (I don't think we read from network now).
-// Maybe: when loading fully, cache extracted text in FzPageInfo
-// so that we don't have to re-do fz_new_stext_page_from_page() when doing search
+// returns nullptr for pages of progressively read documents which haven't
+// arrived completely yet (FZ_ERROR_TRYLATER, cf. WaitForPageData)
 FzPageInfo* EnginePdf::GetFzPageInfo(int pageNo, bool loadQuick) {
+    TraceSpan span("EnginePdf::GetFzPageInfo");
     // TODO: minimize time spent under pagesAccess when fully loading
-    ScopedCritSec scope(&pagesAccess);
+    ScopedEngineLock scope(&pagesAccess);
 
     CrashIf(pageNo < 1 || pageNo > pageCount);
     int pageIdx = pageNo - 1;
     FzPageInfo* pageInfo = _pages[pageIdx];
 
-    ScopedCritSec ctxScope(ctxAccess);
+    ScopedEngineLock ctxScope(ctxAccess);
     if (!pageInfo->page) {
         fz_try(ctx) {
             pageInfo->page = fz_load_page(ctx, _doc, pageIdx);
         }
         fz_catch(ctx) {
         }
+        // the annotations might not have been read yet
+        if (pageInfo->page && pageInfo->page->incomplete) {
+            fz_drop_page(ctx, pageInfo->page);
+            pageInfo->page = nullptr;
+        }
+        // a loaded page needs its actual size
+        if (pageInfo->page || !loadingProgressively) {
+            ResolvePageSize(pageInfo);
+        }
     }
 
     fz_page* page = pageInfo->page;
@@ -1047,6 +1633,15 @@ FzPageInfo* EnginePdf::GetFzPageInfo(int pageNo, bool loadQuick) {
         return nullptr;
     }
 
+    // the content has to be complete as well (the display list is cached, so it's only built once)
+    if (loadingProgressively && !pageInfo->list) {
+        fz_display_list* list = GetDisplayList(pageInfo);
+        if (!list) {
+            return nullptr;
+        }
+        fz_drop_display_list(ctx, list);
+    }
+
     if (loadQuick || pageInfo->fullyLoaded) {
         return pageInfo;
     }
@@ -1055,39 +1650,114 @@ FzPageInfo* EnginePdf::GetFzPageInfo(int pageNo, bool loadQuick) {
 
     pageInfo->fullyLoaded = true;
 
-    fz_stext_page* stext = nullptr;
-    fz_var(stext);
-    fz_stext_options opts{};
-    opts.flags = FZ_STEXT_PRESERVE_IMAGES;
-    fz_try(ctx) {
-        stext = fz_new_stext_page_from_page(ctx, page, &opts);
-    }
-    fz_catch(ctx) {
-    }
+    // the extracted text is cached for ExtractPageText
+    fz_stext_page* stext = FzGetStextPage(ctx, pageInfo, textCache);
 
     auto links = fz_load_links(ctx, page);
 
     pageInfo->links = FixupPageLinks(links);
     MakePageElementCommentsFromAnnotations(pageInfo);
-    if (!stext) {
-        return pageInfo;
+    if (stext) {
+        FzLinkifyPageText(pageInfo, stext);
+        fz_find_image_positions(ctx, pageInfo->images, stext);
     }
-
-    FzLinkifyPageText(pageInfo, stext);
-    fz_find_image_positions(ctx, pageInfo->images, stext);
-    fz_drop_stext_page(ctx, stext);
+    FzBuildElementsGrid(pageInfo);
     return pageInfo;
 }
 
-RectD EnginePdf::PageMediabox(int pageNo) {
-    FzPageInfo* pi = _pages[pageNo - 1];
-    return pi->mediabox;
+// the size of a display list roughly corresponds to the size of a page's
+// content streams, so use their (compressed) length for an estimate
+static size_t EstimateDisplayListSize(fz_context* ctx, fz_page* page) {
+    pdf_page* pdfpage = pdf_page_from_fz_page(ctx, page);
+    size_t size = 4096;
+    fz_try(ctx) {
+        pdf_obj* contents = pdf_page_contents(ctx, pdfpage);
+        if (pdf_is_array(ctx, contents)) {
+            int n = pdf_array_len(ctx, contents);
+            for (int i = 0; i < n; i++) {
+                pdf_obj* stm = pdf_array_get(ctx, contents, i);
+                size += (size_t)pdf_dict_get_int(ctx, stm, PDF_NAME(Length)) * 4;
+            }
+        } else if (contents) {
+            size += (size_t)pdf_dict_get_int(ctx, contents, PDF_NAME(Length)) * 4;
+        }
+    }
+    fz_catch(ctx) {
+    }
+    return size;
 }
 
-RectD EnginePdf::PageContentBox(int pageNo, RenderTarget target) {
-    FzPageInfo* pageInfo = GetFzPageInfo(pageNo, false);
-
-    ScopedCritSec scope(ctxAccess);
+// returns the (cached) display list for a page's content. annotations
+// aren't cached as they can be modified and must be run separately
+// caller must call fz_drop_display_list on the result
+// Note: make sure to only call with ctxAccess
+fz_display_list* EnginePdf::GetDisplayList(FzPageInfo* pageInfo) {
+    if (pageInfo->list) {
+        if (pageInfo != runCache.at(0)) {
+            runCache.Remove(pageInfo);
+            runCache.InsertAt(0, pageInfo);
+        }
+        return fz_keep_display_list(ctx, pageInfo->list);
+    }
+
+    fz_display_list* list = nullptr;
+    fz_device* dev = nullptr;
+    fz_cookie cookie = {};
+    fz_var(list);
+    fz_var(dev);
+    fz_try(ctx) {
+        list = fz_new_display_list(ctx, fz_bound_page(ctx, pageInfo->page));
+        dev = fz_new_list_device(ctx, list);
+        fz_run_page_contents(ctx, pageInfo->page, dev, fz_identity, &cookie);
+        fz_close_device(ctx, dev);
+    }
+    fz_always(ctx) {
+        fz_drop_device(ctx, dev);
+    }
+    fz_catch(ctx) {
+        fz_drop_display_list(ctx, list);
+        return nullptr;
+    }
+    // parts of the content of progressively read documents might not have
+    // arrived yet, such (incomplete) display lists must not be cached
+    if (cookie.incomplete) {
+        fz_drop_display_list(ctx, list);
+        return nullptr;
+    }
+
+    pageInfo->list = list;
+    pageInfo->listSizeEst = EstimateDisplayListSize(ctx, pageInfo->page);
+    runCache.InsertAt(0, pageInfo);
+
+    // evict least recently used display lists (but always keep the newest one)
+    size_t memUsed = 0;
+    for (auto* pi : runCache) {
+        memUsed += pi->listSizeEst;
+    }
+    while (runCache.size() > 1 && (runCache.size() > MAX_PAGE_RUN_CACHE || memUsed > MAX_PAGE_RUN_MEMORY)) {
+        FzPageInfo* pi = runCache.Pop();
+        memUsed -= pi->listSizeEst;
+        fz_drop_display_list(ctx, pi->list);
+        pi->list = nullptr;
+        pi->listSizeEst = 0;
+    }
+
+    return fz_keep_display_list(ctx, list);
+}
+
+RectD EnginePdf::PageMediabox(int pageNo) {
+    FzPageInfo* pi = _pages[pageNo - 1];
+    ScopedCritSec scope(&mediaboxAccess);
+    return pi->mediabox;
+}
+
+RectD EnginePdf::PageContentBox(int pageNo, RenderTarget target) {
+    FzPageInfo* pageInfo = GetFzPageInfo(pageNo, false);
+    if (!pageInfo) {
+        return PageMediabox(pageNo);
+    }
+
+    ScopedEngineLock scope(ctxAccess);
 
     fz_cookie fzcookie = {};
     fz_rect rect = fz_empty_rect;
@@ -1102,9 +1772,14 @@ RectD EnginePdf::PageContentBox(int pageNo, RenderTarget target) {
     RectD mediabox = pageInfo->mediabox;
 
     fz_try(ctx) {
-        list = fz_new_display_list_from_page(ctx, pageInfo->page);
+        list = GetDisplayList(pageInfo);
+        if (!list) {
+            fz_throw(ctx, FZ_ERROR_GENERIC, "couldn't load page contents");
+        }
         dev = fz_new_bbox_device(ctx, &rect);
         fz_run_display_list(ctx, list, dev, fz_identity, pagerect, &fzcookie);
+        fz_run_page_annots(ctx, pageInfo->page, dev, fz_identity, &fzcookie);
+        fz_run_page_widgets(ctx, pageInfo->page, dev, fz_identity, &fzcookie);
         fz_close_device(ctx, dev);
     }
     fz_always(ctx) {
@@ -1145,7 +1820,169 @@ RectD EnginePdf::Transform(RectD rect, int pageNo, float zoom, int rotation, boo
     return fz_rect_to_RectD(rect2);
 }
 
+// records a page's annotations and form fields into a display list
+// Note: make sure to only call with ctxAccess
+static fz_display_list* NewPageAnnotsDisplayList(fz_context* ctx, fz_page* page) {
+    fz_display_list* list = fz_new_display_list(ctx, fz_infinite_rect);
+    fz_device* dev = nullptr;
+    fz_var(dev);
+    fz_try(ctx) {
+        dev = fz_new_list_device(ctx, list);
+        fz_run_page_annots(ctx, page, dev, fz_identity, nullptr);
+        fz_run_page_widgets(ctx, page, dev, fz_identity, nullptr);
+        fz_close_device(ctx, dev);
+    }
+    fz_always(ctx) {
+        if (dev) {
+            fz_drop_device(ctx, dev);
+        }
+    }
+    fz_catch(ctx) {
+        fz_drop_display_list(ctx, list);
+        fz_rethrow(ctx);
+    }
+    return list;
+}
+
+// huge pages (e.g. posters at high zoom levels) are split into horizontal bands
+// which are rasterized in parallel (each on its own cloned context)
+#define RENDER_BANDS_MIN_PIXELS (8 * 1024 * 1024)
+#define RENDER_BANDS_MIN_DY 512
+#define RENDER_BANDS_MAX 8
+
+// what RasterizePage draws into a pixmap
+struct PageRasterArgs {
+    fz_display_list* list = nullptr;
+    fz_display_list* annotsList = nullptr;
+    fz_display_list* userAnnotsList = nullptr;
+    Vec<Annotation*>* annots = nullptr;
+    int transparency = 0;
+    fz_matrix ctm = fz_identity;
+    fz_cookie* cookie = nullptr;
+};
+
+// throws on failure
+static void RasterizePage(fz_context* ctx, fz_pixmap* pix, PageRasterArgs* args) {
+    fz_rect cliprect = fz_rect_from_irect(fz_pixmap_bbox(ctx, pix));
+    fz_device* dev = nullptr;
+    fz_var(dev);
+    fz_try(ctx) {
+        // TODO: in printing different style. old code use pdf_run_page_with_usage(), with usage ="View"
+        // or "Print". "Export" is not used
+        dev = fz_new_draw_device(ctx, fz_identity, pix);
+        // TODO: use fz_infinite_rect instead of cliprect?
+        fz_run_page_transparency(ctx, args->annots, dev, cliprect, false, args->transparency);
+        fz_run_display_list(ctx, args->list, dev, args->ctm, cliprect, args->cookie);
+        fz_run_display_list(ctx, args->annotsList, dev, args->ctm, cliprect, args->cookie);
+        fz_run_page_transparency(ctx, args->annots, dev, cliprect, true, args->transparency);
+        fz_run_display_list(ctx, args->userAnnotsList, dev, args->ctm, cliprect, args->cookie);
+        fz_close_device(ctx, dev);
+    }
+    fz_always(ctx) {
+        fz_drop_device(ctx, dev);
+    }
+    fz_catch(ctx) {
+        fz_rethrow(ctx);
+    }
+}
+
+struct RenderBand {
+    fz_context* ctx = nullptr;
+    // shares its samples with the page's pixmap
+    fz_pixmap* pix = nullptr;
+    PageRasterArgs* args = nullptr;
+    bool ok = false;
+};
+
+static DWORD WINAPI RenderBandThreadProc(LPVOID data) {
+    RenderBand* band = (RenderBand*)data;
+    fz_try(band->ctx) {
+        RasterizePage(band->ctx, band->pix, band->args);
+        band->ok = true;
+    }
+    fz_catch(band->ctx) {
+        band->ok = false;
+    }
+    return 0;
+}
+
+static int GetRenderBandsCount(fz_irect bbox) {
+    int dx = bbox.x1 - bbox.x0;
+    int dy = bbox.y1 - bbox.y0;
+    if ((i64)dx * dy < RENDER_BANDS_MIN_PIXELS) {
+        return 1;
+    }
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    int n = std::min((int)si.dwNumberOfProcessors, RENDER_BANDS_MAX);
+    return limitValue(dy / RENDER_BANDS_MIN_DY, 1, n);
+}
+
+// rasterizes pix in nBands horizontal bands, the first one on this thread,
+// the others on threads of their own. the band pixmaps point into the samples
+// of pix, so nothing has to be copied afterwards. throws on failure
+static void RasterizePageInBands(fz_context* ctx, fz_pixmap* pix, PageRasterArgs* args, int nBands) {
+    fz_irect bbox = fz_pixmap_bbox(ctx, pix);
+    int dy = bbox.y1 - bbox.y0;
+    RenderBand bands[RENDER_BANDS_MAX];
+    HANDLE threads[RENDER_BANDS_MAX];
+    int nThreads = 0;
+    bool ok = true;
+
+    for (int i = 0; i < nBands; i++) {
+        fz_irect bandBox = bbox;
+        bandBox.y0 = bbox.y0 + dy * i / nBands;
+        bandBox.y1 = bbox.y0 + dy * (i + 1) / nBands;
+        RenderBand& band = bands[i];
+        band.args = args;
+        band.ctx = i == 0 ? ctx : fz_clone_context(ctx);
+        if (!band.ctx) {
+            ok = false;
+            break;
+        }
+        u8* samples = pix->samples + (size_t)(bandBox.y0 - bbox.y0) * pix->stride;
+        fz_try(band.ctx) {
+            band.pix = fz_new_pixmap_with_bbox_and_data(band.ctx, pix->colorspace, bandBox, nullptr, pix->alpha,
+                                                        samples);
+        }
+        fz_catch(band.ctx) {
+            ok = false;
+            break;
+        }
+        if (i == 0) {
+            continue;
+        }
+        HANDLE h = CreateThread(nullptr, 0, RenderBandThreadProc, &band, 0, nullptr);
+        if (!h) {
+            ok = false;
+            break;
+        }
+        threads[nThreads++] = h;
+    }
+
+    if (ok) {
+        RenderBandThreadProc(&bands[0]);
+    }
+    if (nThreads > 0) {
+        WaitForMultipleObjects(nThreads, threads, TRUE, INFINITE);
+    }
+    for (int i = 0; i < nThreads; i++) {
+        CloseHandle(threads[i]);
+    }
+    for (int i = 0; i < nBands && bands[i].ctx; i++) {
+        ok = ok && bands[i].ok;
+        fz_drop_pixmap(bands[i].ctx, bands[i].pix);
+        if (i > 0) {
+            fz_drop_context(bands[i].ctx);
+        }
+    }
+    if (!ok) {
+        fz_throw(ctx, FZ_ERROR_GENERIC, "couldn't render all the bands of a page");
+    }
+}
+
 RenderedBitmap* EnginePdf::RenderPage(RenderPageArgs& args) {
+    TraceSpan span("EnginePdf::RenderPage");
     auto pageNo = args.pageNo;
 
     FzPageInfo* pageInfo = GetFzPageInfo(pageNo, false);
@@ -1165,69 +2002,195 @@ RenderedBitmap* EnginePdf::RenderPage(RenderPageArgs& args) {
         fzcookie = &cookie->cookie;
     }
 
-    // TODO(port): I don't see why this lock is needed
-    ScopedCritSec cs(ctxAccess);
-
     auto pageRect = args.pageRect;
     auto zoom = args.zoom;
     auto rotation = args.rotation;
-    fz_rect pRect;
-    if (pageRect) {
-        pRect = RectD_to_fz_rect(*pageRect);
-    } else {
-        // TODO(port): use pageInfo->mediabox?
-        pRect = fz_bound_page(ctx, page);
+    fz_matrix ctm;
+    fz_irect bbox;
+    bool tryPalette = true;
+
+    Vec<Annotation*> annots = FilterAnnotationsForPage(args.skipUserAnnots ? nullptr : userAnnotsIndex, pageNo);
+
+    fz_display_list* list = nullptr;
+    fz_display_list* annotsList = nullptr;
+    fz_display_list* userAnnotsList = nullptr;
+    fz_var(list);
+    fz_var(annotsList);
+    fz_var(userAnnotsList);
+
+    // only the display lists are created under ctxAccess. they're rasterized
+    // on a cloned context so that text extraction, hit-testing, etc. for
+    // this document don't have to wait until rendering has finished
+    {
+        ScopedEngineLock cs(ctxAccess);
+
+        fz_rect pRect;
+        if (pageRect) {
+            pRect = RectD_to_fz_rect(*pageRect);
+        } else {
+            // TODO(port): use pageInfo->mediabox?
+            pRect = fz_bound_page(ctx, page);
+        }
+        ctm = viewctm(page, zoom, rotation);
+        bbox = fz_round_rect(fz_transform_rect(pRect, ctm));
+        // rendered color images almost never fit into an 8-bit palette
+        tryPalette = !FzHasColorImagesInRect(pageInfo, ctm, fz_rect_from_irect(bbox));
+
+        fz_try(ctx) {
+            list = GetDisplayList(pageInfo);
+            if (!list) {
+                fz_throw(ctx, FZ_ERROR_GENERIC, "couldn't load page contents");
+            }
+            annotsList = NewPageAnnotsDisplayList(ctx, page);
+            userAnnotsList = NewUserAnnotsDisplayList(ctx, &annots);
+        }
+        fz_catch(ctx) {
+            fz_drop_display_list(ctx, list);
+            fz_drop_display_list(ctx, annotsList);
+            return nullptr;
+        }
+    }
+
+    fz_context* renderCtx = fz_clone_context(ctx);
+    if (!renderCtx) {
+        ScopedEngineLock cs(ctxAccess);
+        fz_drop_display_list(ctx, list);
+        fz_drop_display_list(ctx, annotsList);
+        fz_drop_display_list(ctx, userAnnotsList);
+        return nullptr;
+    }
+    bool isDraft = args.quality == RenderQuality::Draft;
+    if (isDraft) {
+        // the anti-aliasing level is per context, so this doesn't affect other renderings
+        fz_set_aa_level(renderCtx, 0);
     }
-    fz_matrix ctm = viewctm(page, zoom, rotation);
-    fz_irect bbox = fz_round_rect(fz_transform_rect(pRect, ctm));
 
-    fz_colorspace* colorspace = fz_device_rgb(ctx);
     fz_irect ibounds = bbox;
-    fz_rect cliprect = fz_rect_from_irect(bbox);
 
     fz_pixmap* pix = nullptr;
-    fz_device* dev = nullptr;
     RenderedBitmap* bitmap = nullptr;
-    fz_display_list* list = nullptr;
+    HBITMAP hbmp = nullptr;
+    HANDLE hMap = nullptr;
 
-    fz_var(dev);
     fz_var(pix);
     fz_var(bitmap);
-    fz_var(list);
+    fz_var(hbmp);
+    fz_var(hMap);
+
+    PageRasterArgs rasterArgs;
+    rasterArgs.list = list;
+    rasterArgs.annotsList = annotsList;
+    rasterArgs.userAnnotsList = userAnnotsList;
+    rasterArgs.annots = &annots;
+    // drafts are rendered without transparency groups
+    rasterArgs.transparency = transparency || isDraft;
+    rasterArgs.ctm = ctm;
+    rasterArgs.cookie = fzcookie;
+
+    fz_try(renderCtx) {
+        // render directly into the memory of the resulting bitmap
+        pix = new_dib_fz_pixmap(renderCtx, ibounds, &hbmp, &hMap);
+        // initialize with white background
+        fz_clear_pixmap_with_value(renderCtx, pix, 0xff);
 
-    Vec<Annotation*> annots = FilterAnnotationsForPage(userAnnots, pageNo);
+        int nBands = GetRenderBandsCount(ibounds);
+        if (nBands > 1) {
+            RasterizePageInBands(renderCtx, pix, &rasterArgs, nBands);
+        } else {
+            RasterizePage(renderCtx, pix, &rasterArgs);
+        }
+        bitmap = new_rendered_fz_dib_pixmap(renderCtx, pix, hbmp, hMap, tryPalette);
+        hbmp = nullptr;
+        hMap = nullptr;
+    }
+    fz_always(renderCtx) {
+        fz_drop_pixmap(renderCtx, pix);
+        fz_drop_display_list(renderCtx, list);
+        fz_drop_display_list(renderCtx, annotsList);
+        fz_drop_display_list(renderCtx, userAnnotsList);
+    }
+    fz_catch(renderCtx) {
+        delete bitmap;
+        bitmap = nullptr;
+        if (hbmp) {
+            DeleteObject(hbmp);
+        }
+        if (hMap) {
+            CloseHandle(hMap);
+        }
+    }
+    fz_drop_context(renderCtx);
+    return bitmap;
+}
 
-    fz_try(ctx) {
-        list = fz_new_display_list_from_page(ctx, page);
-        pix = fz_new_pixmap_with_bbox(ctx, colorspace, ibounds, nullptr, 1);
-        // initialize with white background
-        fz_clear_pixmap_with_value(ctx, pix, 0xff);
+bool EnginePdf::RenderPageToDC(HDC hdc, RenderPageArgs& args, Point offset) {
+    auto pageNo = args.pageNo;
 
-        // TODO: in printing different style. old code use pdf_run_page_with_usage(), with usage ="View"
-        // or "Print". "Export" is not used
-        dev = fz_new_draw_device(ctx, fz_identity, pix);
-        // TODO: use fz_infinite_rect instead of cliprect?
-        fz_run_page_transparency(ctx, &annots, dev, cliprect, false, transparency);
-        fz_run_display_list(ctx, list, dev, ctm, cliprect, fzcookie);
-        fz_run_page_transparency(ctx, &annots, dev, cliprect, true, transparency);
-        fz_run_user_page_annots(ctx, &annots, dev, ctm, cliprect, fzcookie);
-        bitmap = new_rendered_fz_pixmap(ctx, pix);
-        fz_close_device(ctx, dev);
+    FzPageInfo* pageInfo = GetFzPageInfo(pageNo, false);
+    if (!pageInfo || !pageInfo->page) {
+        return false;
     }
-    fz_always(ctx) {
-        if (dev) {
-            fz_drop_device(ctx, dev);
+    fz_page* page = pageInfo->page;
+    pdf_page* pdfpage = pdf_page_from_fz_page(ctx, page);
+    if (pdfpage->transparency) {
+        // GDI can't draw transparent content
+        return false;
+    }
+
+    fz_cookie* fzcookie = nullptr;
+    if (args.cookie_out) {
+        FitzAbortCookie* cookie = new FitzAbortCookie();
+        *args.cookie_out = cookie;
+        fzcookie = &cookie->cookie;
+    }
+
+    Vec<Annotation*> annots = FilterAnnotationsForPage(userAnnotsIndex, pageNo);
+
+    fz_display_list* lists[3] = {};
+    fz_matrix ctm;
+    fz_irect bbox;
+    {
+        ScopedEngineLock cs(ctxAccess);
+
+        fz_rect pRect = args.pageRect ? RectD_to_fz_rect(*args.pageRect) : fz_bound_page(ctx, page);
+        ctm = viewctm(page, args.zoom, args.rotation);
+        bbox = fz_round_rect(fz_transform_rect(pRect, ctm));
+
+        fz_try(ctx) {
+            lists[0] = GetDisplayList(pageInfo);
+            if (!lists[0]) {
+                fz_throw(ctx, FZ_ERROR_GENERIC, "couldn't load page contents");
+            }
+            lists[1] = NewPageAnnotsDisplayList(ctx, page);
+            lists[2] = NewUserAnnotsDisplayList(ctx, &annots);
         }
-        fz_drop_pixmap(ctx, pix);
-        if (list) {
-            fz_drop_display_list(ctx, list);
+        fz_catch(ctx) {
+            for (fz_display_list* list : lists) {
+                fz_drop_display_list(ctx, list);
+            }
+            return false;
         }
     }
-    fz_catch(ctx) {
-        delete bitmap;
-        return nullptr;
+
+    // move the rendered area to offset
+    int dx = offset.x - bbox.x0, dy = offset.y - bbox.y0;
+    ctm = fz_concat(ctm, fz_translate((float)dx, (float)dy));
+    bbox = fz_make_irect(bbox.x0 + dx, bbox.y0 + dy, bbox.x1 + dx, bbox.y1 + dy);
+
+    // the page is drawn on a cloned context (cf. RenderPage)
+    fz_context* renderCtx = fz_clone_context(ctx);
+    bool ok = false;
+    if (renderCtx) {
+        ok = fz_run_display_lists_to_dc(renderCtx, hdc, lists, dimof(lists), ctm, bbox, fzcookie);
     }
-    return bitmap;
+    {
+        ScopedEngineLock cs(ctxAccess);
+        for (fz_display_list* list : lists) {
+            fz_drop_display_list(ctx, list);
+        }
+    }
+    fz_drop_context(renderCtx);
+    return ok;
 }
 
 PageElement* EnginePdf::GetElementAtPos(int pageNo, PointD pt) {
@@ -1261,6 +2224,153 @@ bool EnginePdf::BenchLoadPage(int pageNo) {
     return GetFzPageInfo(pageNo, false) != nullptr;
 }
 
+// keys which don't affect how a page or its annotations look
+// (most of them point to other pages or to the page tree)
+static const char* gFingerprintIgnoredKeys =
+    "Parent\0P\0Popup\0IRT\0StructParents\0StructParent\0Thumb\0PieceInfo\0Metadata\0B\0Dest\0A\0AA\0";
+
+// appends obj to fp with the data of streams replaced by a hash. indirect objects
+// are followed instead of appending their object numbers, as these usually
+// change for all objects when a document is regenerated
+// Note: make sure to only call with ctxAccess
+void EnginePdf::AppendFingerprint(pdf_obj* obj, str::Str& fp, int depth) {
+    if (depth > 32 || pdf_obj_marked(ctx, obj)) {
+        // very deeply nested or a reference cycle
+        fp.Append("^ ");
+        return;
+    }
+
+    if (pdf_is_stream(ctx, obj)) {
+        int num = pdf_to_num(ctx, obj);
+        if (num >= streamHashes.isize()) {
+            streamHashes.AppendBlanks(num + 1 - streamHashes.size());
+        }
+        if (streamHashes.at(num) == 0) {
+            fz_buffer* buf = nullptr;
+            fz_var(buf);
+            u32 hash = 1;
+            fz_try(ctx) {
+                buf = pdf_load_raw_stream(ctx, obj);
+                unsigned char* data = nullptr;
+                size_t len = fz_buffer_storage(ctx, buf, &data);
+                hash = MurmurHash2(data, len) | 1;
+            }
+            fz_always(ctx) {
+                fz_drop_buffer(ctx, buf);
+            }
+            fz_catch(ctx) {
+                // a broken stream can't be compared
+                hash = 1;
+            }
+            streamHashes.at(num) = hash;
+        }
+        // a hash of 1 marks unreadable streams
+        if (streamHashes.at(num) == 1) {
+            fp.AppendFmt("stream:%d ", num);
+        } else {
+            fp.AppendFmt("stream:%x ", streamHashes.at(num));
+        }
+    }
+
+    pdf_obj* resolved = pdf_resolve_indirect(ctx, obj);
+    if (pdf_is_dict(ctx, resolved)) {
+        pdf_mark_obj(ctx, resolved);
+        fp.Append("<< ");
+        int n = pdf_dict_len(ctx, resolved);
+        for (int i = 0; i < n; i++) {
+            const char* key = pdf_to_name(ctx, pdf_dict_get_key(ctx, resolved, i));
+            if (seqstrings::StrToIdx(gFingerprintIgnoredKeys, key) >= 0) {
+                continue;
+            }
+            fp.AppendFmt("/%s ", key);
+            AppendFingerprint(pdf_dict_get_val(ctx, resolved, i), fp, depth + 1);
+        }
+        fp.Append(">> ");
+        pdf_unmark_obj(ctx, resolved);
+    } else if (pdf_is_array(ctx, resolved)) {
+        pdf_mark_obj(ctx, resolved);
+        fp.Append("[ ");
+        int n = pdf_array_len(ctx, resolved);
+        for (int i = 0; i < n; i++) {
+            AppendFingerprint(pdf_array_get(ctx, resolved, i), fp, depth + 1);
+        }
+        fp.Append("] ");
+        pdf_unmark_obj(ctx, resolved);
+    } else {
+        char buf[64];
+        size_t len = 0;
+        char* s = pdf_sprint_obj(ctx, buf, sizeof(buf), &len, resolved, 1, 0);
+        fp.Append(s, len);
+        fp.Append(" ");
+        if (s != buf) {
+            fz_free(ctx, s);
+        }
+    }
+}
+
+bool EnginePdf::GetPageFingerprint(int pageNo, u8 digestOut[16]) {
+    CrashIf(pageNo < 1 || pageNo > pageCount);
+    ScopedEngineLock scope(ctxAccess);
+    FzPageInfo* pageInfo = _pages[pageNo - 1];
+    if (pageInfo->hasFingerprint) {
+        memcpy(digestOut, pageInfo->fingerprint, sizeof(pageInfo->fingerprint));
+        return true;
+    }
+
+    pdf_document* doc = pdf_document_from_fz_document(ctx, _doc);
+    str::Str fp;
+    bool ok = true;
+    fz_try(ctx) {
+        pdf_obj* page = pdf_lookup_page_obj(ctx, doc, pageNo - 1);
+        // Parent is ignored, so inherited attributes are added explicitly
+        AppendFingerprint(pdf_dict_get_inheritable(ctx, page, PDF_NAME(Resources)), fp, 0);
+        AppendFingerprint(pdf_dict_get_inheritable(ctx, page, PDF_NAME(MediaBox)), fp, 0);
+        AppendFingerprint(pdf_dict_get_inheritable(ctx, page, PDF_NAME(CropBox)), fp, 0);
+        AppendFingerprint(pdf_dict_get_inheritable(ctx, page, PDF_NAME(Rotate)), fp, 0);
+        AppendFingerprint(page, fp, 0);
+    }
+    fz_catch(ctx) {
+        ok = false;
+    }
+    if (!ok) {
+        return false;
+    }
+
+    CalcMD5Digest((const unsigned char*)fp.Get(), fp.size(), pageInfo->fingerprint);
+    pageInfo->hasFingerprint = true;
+    memcpy(digestOut, pageInfo->fingerprint, sizeof(pageInfo->fingerprint));
+    return true;
+}
+
+void EnginePdf::FreeCachedPages() {
+    ScopedEngineLock scope(&pagesAccess);
+    ScopedEngineLock ctxScope(ctxAccess);
+    if (annotsHandedOut) {
+        return;
+    }
+
+    for (auto* pi : _pages) {
+        fz_drop_display_list(ctx, pi->list);
+        pi->list = nullptr;
+        pi->listSizeEst = 0;
+        fz_drop_stext_page(ctx, pi->stext);
+        pi->stext = nullptr;
+        pi->stextSizeEst = 0;
+        fz_drop_link(ctx, pi->links);
+        pi->links = nullptr;
+        fz_drop_page(ctx, pi->page);
+        pi->page = nullptr;
+        DeleteVecMembers(pi->autoLinks);
+        DeleteVecMembers(pi->comments);
+        pi->images.Reset();
+        pi->elementsGrid.Reset();
+        // the page sizes (and fingerprints) remain valid
+        pi->fullyLoaded = false;
+    }
+    runCache.Reset();
+    textCache.Reset();
+}
+
 fz_matrix EnginePdf::viewctm(int pageNo, float zoom, int rotation) {
     const fz_rect tmpRc = RectD_to_fz_rect(PageMediabox(pageNo));
     return fz_create_view_ctm(tmpRc, zoom, rotation);
@@ -1337,7 +2447,7 @@ void EnginePdf::MakePageElementCommentsFromAnnotations(FzPageInfo* pageInfo) {
 
 RenderedBitmap* EnginePdf::GetPageImage(int pageNo, RectD rect, int imageIdx) {
     FzPageInfo* pageInfo = GetFzPageInfo(pageNo, false);
-    if (!pageInfo->page) {
+    if (!pageInfo || !pageInfo->page) {
         return nullptr;
     }
     auto& images = pageInfo->images;
@@ -1350,9 +2460,12 @@ RenderedBitmap* EnginePdf::GetPageImage(int pageNo, RectD rect, int imageIdx) {
         return nullptr;
     }
 
-    ScopedCritSec scope(ctxAccess);
+    ScopedEngineLock scope(ctxAccess);
 
-    fz_image* image = fz_find_image_at_idx(ctx, pageInfo, imageIdx);
+    // the image is taken from the cached structured text, which is usually
+    // already there (it's needed for images, links and text selection)
+    fz_stext_page* stext = FzGetStextPage(ctx, pageInfo, textCache);
+    fz_image* image = fz_find_image_at_idx(ctx, stext, imageIdx);
     CrashIf(!image);
     if (!image) {
         return nullptr;
@@ -1364,7 +2477,8 @@ RenderedBitmap* EnginePdf::GetPageImage(int pageNo, RectD rect, int imageIdx) {
     fz_var(bmp);
 
     fz_try(ctx) {
-        // TODO(port): not sure if should provide subarea, w and h
+        // rect covers the whole image, so it's decoded at its native size
+        // (without subarea and subsampling)
         pixmap = fz_get_pixmap_from_image(ctx, image, nullptr, nullptr, nullptr, nullptr);
         bmp = new_rendered_fz_pixmap(ctx, pixmap);
     }
@@ -1380,27 +2494,21 @@ RenderedBitmap* EnginePdf::GetPageImage(int pageNo, RectD rect, int imageIdx) {
 
 WCHAR* EnginePdf::ExtractPageText(int pageNo, Rect** coordsOut) {
     FzPageInfo* pageInfo = GetFzPageInfo(pageNo, true);
+    if (!pageInfo) {
+        return nullptr;
+    }
 
-    ScopedCritSec scope(ctxAccess);
+    ScopedEngineLock scope(ctxAccess);
 
-    fz_stext_page* stext = nullptr;
-    fz_var(stext);
-    fz_stext_options opts{};
-    fz_try(ctx) {
-        stext = fz_new_stext_page_from_page(ctx, pageInfo->page, &opts);
-    }
-    fz_catch(ctx) {
-    }
+    fz_stext_page* stext = FzGetStextPage(ctx, pageInfo, textCache);
     if (!stext) {
         return nullptr;
     }
-    WCHAR* text = fz_text_page_to_str(stext, coordsOut);
-    fz_drop_stext_page(ctx, stext);
-    return text;
+    return fz_text_page_to_str(stext, coordsOut);
 }
 
 bool EnginePdf::IsLinearizedFile() {
-    ScopedCritSec scope(ctxAccess);
+    ScopedEngineLock scope(ctxAccess);
     // determine the object number of the very first object in the file
     pdf_document* doc = pdf_document_from_fz_document(ctx, _doc);
     fz_seek(ctx, doc->file, 0, 0);
@@ -1493,7 +2601,7 @@ WCHAR* EnginePdf::ExtractFontList() {
             continue;
         }
 
-        ScopedCritSec scope(ctxAccess);
+        ScopedEngineLock scope(ctxAccess);
         pdf_page* page = pdf_page_from_fz_page(ctx, fzpage);
         fz_try(ctx) {
             pdf_obj* resources = pdf_page_resources(ctx, page);
@@ -1514,7 +2622,7 @@ WCHAR* EnginePdf::ExtractFontList() {
 
     // start ctxAccess scope here so that we don't also have to
     // ask for pagesAccess (as is required for GetFzPage)
-    ScopedCritSec scope(ctxAccess);
+    ScopedEngineLock scope(ctxAccess);
 
     for (pdf_obj* res : resList) {
         pdf_unmark_obj(ctx, res);
@@ -1690,7 +2798,7 @@ WCHAR* EnginePdf::GetProperty(DocumentProperty prop) {
 
 std::string_view EnginePdf::GetFileData() {
     std::string_view res;
-    ScopedCritSec scope(ctxAccess);
+    ScopedEngineLock scope(ctxAccess);
 
     pdf_document* doc = pdf_document_from_fz_document(ctx, _doc);
 
@@ -1929,6 +3037,43 @@ const pdf_write_options pdf_default_write_options2 = {
     "", /* upwd_utf8[128] */
 };
 
+bool EnginePdf::SaveUpdated(const char* filePath) {
+    ScopedEngineLock scope1(&pagesAccess);
+    ScopedEngineLock scope2(ctxAccess);
+
+    pdf_document* doc = pdf_document_from_fz_document(ctx, _doc);
+
+    pdf_write_options save_opts;
+    save_opts = pdf_default_write_options2;
+    save_opts.do_incremental = 1;
+    // only the modified objects are appended to the file, so only
+    // e.g. new appearance streams get compressed (and nothing gets
+    // recompressed, as images and fonts aren't changed by editing annotations)
+    save_opts.do_compress = 1;
+    if (doc->redacted) {
+        save_opts.do_garbage = 1;
+    }
+
+    bool ok = true;
+    fz_try(ctx) {
+        pdf_save_document(ctx, doc, filePath, &save_opts);
+    }
+    fz_catch(ctx) {
+        const char* errMsg = fz_caught_message(ctx);
+        logf("Pdf save of '%s' failed with '%s'\n", filePath, errMsg);
+        ok = false;
+    }
+    return ok;
+}
+
+void EnginePdf::WaitForSave() {
+    if (saveThread) {
+        WaitForSingleObject(saveThread, INFINITE);
+        CloseHandle(saveThread);
+        saveThread = nullptr;
+    }
+}
+
 // re-save current pdf document using mupdf (as opposed to just saving the data)
 // this is used after the PDF was modified by the user (e.g. by adding / changing
 // annotations).
@@ -1944,30 +3089,53 @@ bool EnginePdfSaveUpdated(EngineBase* engine, std::string_view filePath) {
     if (filePath.empty()) {
         filePath = {currPath.Get()};
     }
-    fz_context* ctx = enginePdf->ctx;
-    pdf_document* doc = pdf_document_from_fz_document(ctx, enginePdf->_doc);
+    enginePdf->WaitForSave();
+    return enginePdf->SaveUpdated(filePath.data());
+}
 
-    pdf_write_options save_opts;
-    save_opts = pdf_default_write_options2;
-    save_opts.do_incremental = 1;
-    save_opts.do_compress = 1;
-    save_opts.do_compress_images = 1;
-    save_opts.do_compress_fonts = 1;
-    if (doc->redacted) {
-        save_opts.do_garbage = 1;
+struct PdfSaveData {
+    EnginePdf* engine = nullptr;
+    AutoFree filePath;
+    std::function<void(bool)> onDone;
+};
+
+static DWORD WINAPI PdfSaveThread(LPVOID data) {
+    PdfSaveData* sd = (PdfSaveData*)data;
+    bool ok = sd->engine->SaveUpdated(sd->filePath);
+    // the engine's destructor waits for this thread to finish
+    if (sd->onDone) {
+        sd->onDone(ok);
     }
+    delete sd;
+    return 0;
+}
 
-    bool ok = true;
-    fz_try(ctx) {
-        pdf_save_document(ctx, doc, filePath.data(), &save_opts);
+void EnginePdfSaveUpdatedAsync(EngineBase* engine, std::string_view filePath, const std::function<void(bool)>& onDone) {
+    CrashIf(!engine);
+    if (!engine) {
+        return;
     }
-    fz_catch(ctx) {
-        const char* errMsg = fz_caught_message(enginePdf->ctx);
-        logf("Pdf save of '%s' failed with '%s'\n", filePath.data(), errMsg);
-        // TODO: show error message
-        ok = false;
+    EnginePdf* enginePdf = (EnginePdf*)engine;
+    // saves of the same document can't overlap
+    enginePdf->WaitForSave();
+
+    PdfSaveData* sd = new PdfSaveData();
+    sd->engine = enginePdf;
+    if (filePath.empty()) {
+        sd->filePath.Set(strconv::WstrToUtf8(engine->FileName()).data());
+    } else {
+        sd->filePath.Set(str::Dup(filePath.data()));
+    }
+    sd->onDone = onDone;
+    enginePdf->saveThread = CreateThread(nullptr, 0, PdfSaveThread, sd, 0, 0);
+    if (!enginePdf->saveThread) {
+        // fall back to saving synchronously
+        bool ok = enginePdf->SaveUpdated(sd->filePath);
+        if (onDone) {
+            onDone(ok);
+        }
+        delete sd;
     }
-    return ok;
 }
 
 bool EnginePdf::SaveUserAnnots(const char* pathUtf8) {
@@ -1980,8 +3148,8 @@ bool EnginePdf::SaveUserAnnots(const char* pathUtf8) {
         return true;
     }
 
-    ScopedCritSec scope1(&pagesAccess);
-    ScopedCritSec scope2(ctxAccess);
+    ScopedEngineLock scope1(&pagesAccess);
+    ScopedEngineLock scope2(ctxAccess);
 
     bool ok = true;
     Vec<Annotation*> pageAnnots;
@@ -1994,7 +3162,7 @@ bool EnginePdf::SaveUserAnnots(const char* pathUtf8) {
             FzPageInfo* pageInfo = GetFzPageInfo(pageNo, false);
             pdf_page* page = pdf_page_from_fz_page(ctx, pageInfo->page);
 
-            pageAnnots = FilterAnnotationsForPage(userAnnots, pageNo);
+            pageAnnots = FilterAnnotationsForPage(userAnnotsIndex, pageNo);
             if (pageAnnots.size() == 0) {
                 continue;
             }
@@ -2020,7 +3188,7 @@ bool EnginePdf::SaveUserAnnots(const char* pathUtf8) {
 // https://github.com/sumatrapdfreader/sumatrapdf/issues/1336
 #if 0
 bool EnginePdf::SaveEmbedded(LinkSaverUI& saveUI, int num) {
-    ScopedCritSec scope(ctxAccess);
+    ScopedEngineLock scope(ctxAccess);
     pdf_document* doc = pdf_document_from_fz_document(ctx, _doc);
 
     fz_buffer* buf = nullptr;
@@ -2067,8 +3235,8 @@ WCHAR* EnginePdf::GetPageLabel(int pageNo) const {
 
 int EnginePdf::GetPageByLabel(const WCHAR* label) const {
     int pageNo = 0;
-    if (_pageLabels) {
-        pageNo = _pageLabels->Find(label) + 1;
+    if (_pageLabelsIndex && !_pageLabelsIndex->Get(label, &pageNo)) {
+        pageNo = 0;
     }
 
     if (!pageNo) {
@@ -2083,6 +3251,7 @@ extern Annotation* MakeAnnotationPdf(fz_context* ctx, pdf_page* page, pdf_annot*
 
 int EnginePdf::GetAnnotations(Vec<Annotation*>* annotsOut) {
     int nAnnots = 0;
+    annotsHandedOut = true;
     for (int i = 1; i <= pageCount; i++) {
         auto pi = GetFzPageInfo(i, false);
         pdf_page* pdfpage = pdf_page_from_fz_page(ctx, pi->page);
@@ -2122,11 +3291,11 @@ EngineBase* EnginePdf::CreateFromStream(IStream* stream, PasswordUI* pwdUI) {
 
 bool IsEnginePdfSupportedFile(const WCHAR* fileName, bool sniff) {
     if (sniff) {
-        char header[1024] = {0};
-        file::ReadN(fileName, header, sizeof(header));
-
-        for (int i = 0; i < sizeof(header) - 4; i++) {
-            if (str::EqN(header + i, "%PDF", 4))
+        // the signature must be within the first 1024 bytes
+        std::string_view header = ReadFileHeader(fileName);
+        size_t n = std::min(header.size(), (size_t)1024);
+        for (size_t i = 0; i + 4 <= n; i++) {
+            if (str::EqN(header.data() + i, "%PDF", 4))
                 return true;
         }
         return false;
@@ -2142,3 +3311,240 @@ EngineBase* CreateEnginePdfFromFile(const WCHAR* fileName, PasswordUI* pwdUI) {
 EngineBase* CreateEnginePdfFromStream(IStream* stream, PasswordUI* pwdUI) {
     return EnginePdf::CreateFromStream(stream, pwdUI);
 }
+
+// fonts and images are evicted from the store as necessary
+// (this is enough for extracting text from all practical documents)
+#define PDF_TEXT_EXTRACTOR_STORE_SIZE (32 << 20)
+
+// opens a document that isn't password protected from an in-memory copy
+// (which must outlive the document), returns nullptr on failure
+static fz_document* OpenPdfFromMemory(fz_context* ctx, std::string_view data) {
+    fz_document* doc = nullptr;
+    fz_stream* stm = nullptr;
+    fz_var(doc);
+    fz_var(stm);
+    fz_try(ctx) {
+        stm = fz_open_memory(ctx, (const u8*)data.data(), data.size());
+        doc = (fz_document*)pdf_open_document_with_stream(ctx, stm);
+        if (fz_needs_password(ctx, doc) && !fz_authenticate_password(ctx, doc, "")) {
+            fz_throw(ctx, FZ_ERROR_GENERIC, "document is password protected");
+        }
+    }
+    fz_always(ctx) {
+        fz_drop_stream(ctx, stm);
+    }
+    fz_catch(ctx) {
+        fz_drop_document(ctx, doc);
+        return nullptr;
+    }
+    return doc;
+}
+
+PdfTextExtractor* PdfTextExtractor::CreateFromStream(IStream* stream) {
+    PdfTextExtractor* res = new PdfTextExtractor();
+    // reading from an in-memory copy is much faster than seeking within the IStream
+    res->data = GetDataFromStream(stream, nullptr);
+    if (res->data.empty()) {
+        delete res;
+        return nullptr;
+    }
+    res->ctx = fz_new_context(GetFzAllocator(), nullptr, PDF_TEXT_EXTRACTOR_STORE_SIZE);
+    if (!res->ctx) {
+        delete res;
+        return nullptr;
+    }
+    installFitzErrorCallbacks(res->ctx);
+
+    fz_context* ctx = res->ctx;
+    res->doc = OpenPdfFromMemory(ctx, {res->data.Get(), res->data.size()});
+    if (!res->doc) {
+        delete res;
+        return nullptr;
+    }
+    fz_try(ctx) {
+        res->pageCount = fz_count_pages(ctx, res->doc);
+    }
+    fz_catch(ctx) {
+        delete res;
+        return nullptr;
+    }
+    return res;
+}
+
+PdfTextExtractor::~PdfTextExtractor() {
+    if (ctx) {
+        fz_drop_document(ctx, doc);
+        fz_drop_context(ctx);
+    }
+}
+
+WCHAR* PdfTextExtractor::GetProperty(DocumentProperty prop) {
+    static struct {
+        DocumentProperty prop;
+        const char* name;
+    } pdfPropNames[] = {
+        {DocumentProperty::Title, "Title"},
+        {DocumentProperty::Author, "Author"},
+        {DocumentProperty::Subject, "Subject"},
+        {DocumentProperty::CreationDate, "CreationDate"},
+        {DocumentProperty::ModificationDate, "ModDate"},
+    };
+    pdf_document* pdfDoc = pdf_document_from_fz_document(ctx, doc);
+    WCHAR* res = nullptr;
+    fz_var(res);
+    for (int i = 0; i < dimof(pdfPropNames); i++) {
+        if (pdfPropNames[i].prop != prop) {
+            continue;
+        }
+        fz_try(ctx) {
+            pdf_obj* info = pdf_dict_gets(ctx, pdf_trailer(ctx, pdfDoc), "Info");
+            pdf_obj* obj = pdf_dict_gets(ctx, info, pdfPropNames[i].name);
+            if (obj) {
+                res = pdf_clean_string(pdf_to_wstr(ctx, obj));
+            }
+        }
+        fz_catch(ctx) {
+            res = nullptr;
+        }
+        break;
+    }
+    return res;
+}
+
+// as opposed to EnginePdf, neither pages nor their text are kept
+// and images aren't kept in the structured text
+WCHAR* PdfTextExtractor::ExtractPageText(int pageNo) {
+    if (pageNo < 1 || pageNo > pageCount) {
+        return nullptr;
+    }
+    fz_page* page = nullptr;
+    fz_stext_page* stext = nullptr;
+    fz_var(page);
+    fz_var(stext);
+    fz_stext_options opts{};
+    fz_try(ctx) {
+        page = fz_load_page(ctx, doc, pageNo - 1);
+        stext = fz_new_stext_page_from_page(ctx, page, &opts);
+    }
+    fz_always(ctx) {
+        fz_drop_page(ctx, page);
+    }
+    fz_catch(ctx) {
+        fz_drop_stext_page(ctx, stext);
+        return nullptr;
+    }
+    WCHAR* res = fz_text_page_to_str(stext, nullptr);
+    fz_drop_stext_page(ctx, stext);
+    return res;
+}
+
+// embedded thumbnails tend to be small, so only use them if they
+// don't have to be scaled up for the requested size
+static fz_image* LoadEmbeddedThumbnail(fz_context* ctx, fz_document* doc, fz_irect bbox) {
+    pdf_document* pdfDoc = pdf_document_from_fz_document(ctx, doc);
+    fz_image* image = nullptr;
+    fz_var(image);
+    fz_try(ctx) {
+        pdf_obj* pageObj = pdf_lookup_page_obj(ctx, pdfDoc, 0);
+        pdf_obj* thumb = pdf_dict_gets(ctx, pageObj, "Thumb");
+        if (pdf_is_stream(ctx, thumb)) {
+            image = pdf_load_image(ctx, pdfDoc, thumb);
+        }
+    }
+    fz_catch(ctx) {
+        fz_drop_image(ctx, image);
+        return nullptr;
+    }
+    if (image && (image->w < bbox.x1 - bbox.x0 || image->h < bbox.y1 - bbox.y0)) {
+        fz_drop_image(ctx, image);
+        return nullptr;
+    }
+    return image;
+}
+
+RenderedBitmap* RenderPdfThumbnailFromStream(IStream* stream, int cx) {
+    if (cx <= 0) {
+        return nullptr;
+    }
+    AutoFree data(GetDataFromStream(stream, nullptr));
+    if (data.empty()) {
+        return nullptr;
+    }
+    fz_context* ctx = fz_new_context(GetFzAllocator(), nullptr, PDF_TEXT_EXTRACTOR_STORE_SIZE);
+    if (!ctx) {
+        return nullptr;
+    }
+    installFitzErrorCallbacks(ctx);
+    fz_document* doc = OpenPdfFromMemory(ctx, {data.Get(), data.size()});
+    if (!doc) {
+        fz_drop_context(ctx);
+        return nullptr;
+    }
+
+    fz_page* page = nullptr;
+    fz_image* image = nullptr;
+    fz_pixmap* pix = nullptr;
+    fz_device* dev = nullptr;
+    RenderedBitmap* bitmap = nullptr;
+    HBITMAP hbmp = nullptr;
+    HANDLE hMap = nullptr;
+
+    fz_var(page);
+    fz_var(image);
+    fz_var(pix);
+    fz_var(dev);
+    fz_var(bitmap);
+    fz_var(hbmp);
+    fz_var(hMap);
+
+    fz_try(ctx) {
+        page = fz_load_page(ctx, doc, 0);
+        // same size as PreviewBase::GetThumbnail would render with a full engine
+        fz_rect bounds = fz_bound_page(ctx, page);
+        float dx = bounds.x1 - bounds.x0, dy = bounds.y1 - bounds.y0;
+        if (dx <= 0 || dy <= 0) {
+            fz_throw(ctx, FZ_ERROR_GENERIC, "empty page");
+        }
+        float zoom = std::min(cx / dx, cx / dy) - 0.001f;
+        fz_matrix ctm = fz_scale(zoom, zoom);
+        fz_irect bbox = fz_round_rect(fz_transform_rect(bounds, ctm));
+
+        pix = new_dib_fz_pixmap(ctx, bbox, &hbmp, &hMap);
+        fz_clear_pixmap_with_value(ctx, pix, 0xff);
+        // no anti-aliasing is needed at thumbnail size
+        fz_set_aa_level(ctx, 0);
+        dev = fz_new_draw_device(ctx, fz_identity, pix);
+        image = LoadEmbeddedThumbnail(ctx, doc, bbox);
+        if (image) {
+            fz_matrix imgCtm = fz_make_matrix((float)(bbox.x1 - bbox.x0), 0, 0, (float)(bbox.y1 - bbox.y0),
+                                              (float)bbox.x0, (float)bbox.y0);
+            fz_fill_image(ctx, dev, image, imgCtm, 1.f, fz_default_color_params);
+        } else {
+            // annotations and links aren't needed for a thumbnail
+            fz_run_page_contents(ctx, page, dev, ctm, nullptr);
+        }
+        fz_close_device(ctx, dev);
+        bitmap = new_rendered_fz_dib_pixmap(ctx, pix, hbmp, hMap);
+        hbmp = nullptr;
+        hMap = nullptr;
+    }
+    fz_always(ctx) {
+        fz_drop_device(ctx, dev);
+        fz_drop_pixmap(ctx, pix);
+        fz_drop_image(ctx, image);
+        fz_drop_page(ctx, page);
+    }
+    fz_catch(ctx) {
+        delete bitmap;
+        bitmap = nullptr;
+        if (hbmp) {
+            DeleteObject(hbmp);
+        }
+        if (hMap) {
+            CloseHandle(hMap);
+        }
+    }
+    fz_drop_document(ctx, doc);
+    fz_drop_context(ctx);
+    return bitmap;
+}
@@ -6,3 +6,41 @@ EngineBase* CreateEnginePdfFromFile(const WCHAR* fileName, PasswordUI* pwdUI = n
 EngineBase* CreateEnginePdfFromStream(IStream* stream, PasswordUI* pwdUI = nullptr);
 
 bool EnginePdfSaveUpdated(EngineBase*, std::string_view filePath);
+// saves on a background thread (rendering and other uses of the engine wait for it
+// to finish meanwhile). onDone is called on that thread once the file has been written
+void EnginePdfSaveUpdatedAsync(EngineBase*, std::string_view filePath, const std::function<void(bool ok)>& onDone);
+// time all threads have spent waiting for locks of any EnginePdf (for benchmarking)
+double EnginePdfLockWaitMs();
+
+struct fz_context;
+struct fz_document;
+
+// extracts the text of a PDF document one page at a time without loading
+// it as an engine (i.e. without outline, links, attachments, images or
+// page sizes) and with bounded memory use (used by the search filter)
+class PdfTextExtractor {
+    fz_context* ctx = nullptr;
+    fz_document* doc = nullptr;
+    AutoFree data;
+    int pageCount = 0;
+
+    PdfTextExtractor() = default;
+
+  public:
+    ~PdfTextExtractor();
+
+    int PageCount() const {
+        return pageCount;
+    }
+    // only supports the properties of the document's Info dictionary
+    WCHAR* GetProperty(DocumentProperty prop);
+    // caller must free() the result
+    WCHAR* ExtractPageText(int pageNo);
+
+    static PdfTextExtractor* CreateFromStream(IStream* stream);
+};
+
+// renders the first page to fit into a cx * cx square without loading the
+// document as an engine (for thumbnails, so without annotations), using
+// the page's embedded /Thumb image if it's large enough
+RenderedBitmap* RenderPdfThumbnailFromStream(IStream* stream, int cx);
@@ -5,7 +5,9 @@
 #include <zlib.h>
 #include "utils/ByteReader.h"
 #include "utils/ScopedWin.h"
+#include "utils/CryptoUtil.h"
 #include "utils/FileUtil.h"
+#include "utils/FileTypeSniff.h"
 #include "utils/WinUtil.h"
 #include "utils/Log.h"
 
@@ -18,6 +20,101 @@
 
 Kind kindEnginePostScript = "enginePostScript";
 
+/* PDF files converted from previously opened PostScript documents */
+
+// bump whenever the Ghostscript command line changes
+#define PS_PDF_CACHE_VERSION 1
+#define PS_PDF_CACHE_MAX_FILES 8
+
+static AutoFreeWstr gPdfCacheDir;
+
+void SetPsConversionCacheDir(const WCHAR* dir) {
+    if (!str::Eq(gPdfCacheDir, dir)) {
+        gPdfCacheDir.SetCopy(dir);
+    }
+}
+
+// the name of a converted file depends on the PostScript
+// file's fingerprint (cf. CalcFileFingerprint)
+static WCHAR* GetPdfCachePath(const WCHAR* filePath) {
+    if (!gPdfCacheDir) {
+        return nullptr;
+    }
+    unsigned char fileDigest[16];
+    if (!CalcFileFingerprint(filePath, fileDigest)) {
+        return nullptr;
+    }
+    AutoFree fileFingerPrint(_MemToHex(&fileDigest));
+    str::Str key;
+    key.Append(fileFingerPrint.Get());
+    key.AppendFmt("|%d", PS_PDF_CACHE_VERSION);
+    unsigned char digest[16];
+    CalcMD5Digest((unsigned char*)key.Get(), key.size(), digest);
+    AutoFree fingerPrint(_MemToHex(&digest));
+
+    AutoFreeWstr fileName(strconv::FromAnsi(fingerPrint));
+    fileName.Set(str::Join(fileName, L".pdf"));
+    return path::Join(gPdfCacheDir, fileName);
+}
+
+struct PdfCacheFileInfo {
+    WCHAR* name;
+    FILETIME lastWrite;
+};
+
+static int cmpPdfCacheFileInfoNewestFirst(const void* a, const void* b) {
+    const PdfCacheFileInfo* fa = (const PdfCacheFileInfo*)a;
+    const PdfCacheFileInfo* fb = (const PdfCacheFileInfo*)b;
+    return CompareFileTime(&fb->lastWrite, &fa->lastWrite);
+}
+
+// keeps the conversions of the most recently opened documents
+static void CleanUpPdfCache() {
+    Vec<PdfCacheFileInfo> files;
+    AutoFreeWstr pattern(path::Join(gPdfCacheDir, L"*.pdf"));
+    WIN32_FIND_DATA fdata;
+    HANDLE hfind = FindFirstFile(pattern, &fdata);
+    if (INVALID_HANDLE_VALUE == hfind) {
+        return;
+    }
+    do {
+        files.Append(PdfCacheFileInfo{str::Dup(fdata.cFileName), fdata.ftLastWriteTime});
+    } while (FindNextFile(hfind, &fdata));
+    FindClose(hfind);
+
+    files.Sort(cmpPdfCacheFileInfoNewestFirst);
+    for (size_t i = 0; i < files.size(); i++) {
+        if (i >= PS_PDF_CACHE_MAX_FILES) {
+            // fails for files still opened by another instance
+            AutoFreeWstr path(path::Join(gPdfCacheDir, files[i].name));
+            file::Delete(path);
+        }
+        free(files[i].name);
+    }
+}
+
+static void SaveCachedPdf(const WCHAR* path, std::string_view pdfData) {
+    if (!dir::CreateAll(gPdfCacheDir)) {
+        return;
+    }
+    file::WriteFile(path, pdfData);
+    CleanUpPdfCache();
+}
+
+static EngineBase* LoadCachedPdf(const WCHAR* path) {
+    if (!file::Exists(path)) {
+        return nullptr;
+    }
+    EngineBase* engine = CreateEnginePdfFromFile(path);
+    if (engine) {
+        // so that CleanUpPdfCache keeps the file
+        FILETIME now;
+        GetSystemTimeAsFileTime(&now);
+        file::SetModificationTime(path, now);
+    }
+    return engine;
+}
+
 static WCHAR* GetGhostscriptPath() {
     const WCHAR* gsProducts[] = {
         L"AFPL Ghostscript",
@@ -131,14 +228,47 @@ static Rect ExtractDSCPageSize(const WCHAR* fileName) {
     return Rect();
 }
 
-static EngineBase* ps2pdf(const WCHAR* fileName) {
-    // TODO: read from gswin32c's stdout instead of using a TEMP file
+struct PipeReader {
+    HANDLE pipe = nullptr;
+    str::Str data;
+};
+
+static DWORD WINAPI ReadPipeThread(LPVOID arg) {
+    PipeReader* reader = (PipeReader*)arg;
+    char buffer[64 * 1024];
+    DWORD nRead = 0;
+    // fails with ERROR_BROKEN_PIPE once the process has exited
+    while (ReadFile(reader->pipe, buffer, sizeof(buffer), &nRead, nullptr) && nRead > 0) {
+        reader->data.Append(buffer, nRead);
+    }
+    return 0;
+}
+
+// like LaunchProcess but with the process' stdout redirected to stdoutPipe
+static HANDLE LaunchProcessWithStdout(const WCHAR* cmdLine, HANDLE stdoutPipe) {
+    PROCESS_INFORMATION pi = {0};
+    STARTUPINFOW si = {0};
+    si.cb = sizeof(si);
+    si.dwFlags = STARTF_USESTDHANDLES;
+    si.hStdOutput = stdoutPipe;
+
+    AutoFreeWstr cmdLineCopy(str::Dup(cmdLine));
+    if (!CreateProcessW(nullptr, cmdLineCopy, nullptr, nullptr, TRUE, CREATE_NO_WINDOW, nullptr, nullptr, &si,
+                        &pi)) {
+        return nullptr;
+    }
+    CloseHandle(pi.hThread);
+    return pi.hProcess;
+}
+
+// Ghostscript writes the PDF document to its stdout which is read on a separate
+// thread while it runs (instead of having it written to a temporary file first)
+// caller must free() the result
+static std::string_view ps2pdf(const WCHAR* fileName) {
     AutoFreeWstr shortPath(path::ShortPath(fileName));
-    AutoFreeWstr tmpFile(path::GetTempPath(L"PsE"));
-    ScopedFile tmpFileScope(tmpFile);
     AutoFreeWstr gswin32c(GetGhostscriptPath());
-    if (!shortPath || !tmpFile || !gswin32c) {
-        return nullptr;
+    if (!shortPath || !gswin32c) {
+        return {};
     }
 
     // try to help Ghostscript determine the intended page size
@@ -149,25 +279,43 @@ static EngineBase* ps2pdf(const WCHAR* fileName) {
     }
 
     const WCHAR* psSetupStr = psSetup ? psSetup.Get() : L"";
+    // -sstdout=%stderr keeps the output of PostScript's print operators out of the PDF document
     AutoFreeWstr cmdLine = str::Format(
-        L"\"%s\" -q -dSAFER -dNOPAUSE -dBATCH -dEPSCrop -sOutputFile=\"%s\" -sDEVICE=pdfwrite -c "
+        L"\"%s\" -q -dSAFER -dNOPAUSE -dBATCH -dEPSCrop -sstdout=%%stderr -sOutputFile=- -sDEVICE=pdfwrite -c "
         L"\".setpdfwrite%s\" -f \"%s\"",
-        gswin32c.Get(), tmpFile.Get(), psSetupStr, shortPath.Get());
+        gswin32c.Get(), psSetupStr, shortPath.Get());
 
     {
         const char* fileName = path::GetBaseNameNoFree(__FILE__);
         AutoFree gswin = strconv::WstrToUtf8(gswin32c.get());
-        AutoFree tmpFileName = strconv::WstrToUtf8(path::GetBaseNameNoFree(tmpFile));
-        logf("- %s:%d: using '%s' for creating '%%TEMP%%\\%s'\n", fileName, __LINE__, gswin.get(), tmpFileName.get());
-    }
-
-    // TODO: the PS-to-PDF conversion can hang the UI for several seconds
-    HANDLE process = LaunchProcess(cmdLine, nullptr, CREATE_NO_WINDOW);
+        logf("- %s:%d: using '%s' for converting to PDF\n", fileName, __LINE__, gswin.get());
+    }
+
+    SECURITY_ATTRIBUTES sa = {sizeof(sa), nullptr, TRUE};
+    HANDLE readPipe = nullptr, writePipe = nullptr;
+    if (!CreatePipe(&readPipe, &writePipe, &sa, 0)) {
+        return {};
+    }
+    PipeReader reader;
+    reader.pipe = readPipe;
+    AutoCloseHandle readPipeScope(readPipe);
+    // only the pipe's write end is inherited by Ghostscript
+    SetHandleInformation(readPipe, HANDLE_FLAG_INHERIT, 0);
+    HANDLE process = LaunchProcessWithStdout(cmdLine, writePipe);
+    // the pipe breaks once the write end is closed by Ghostscript as well
+    CloseHandle(writePipe);
     if (!process) {
-        return nullptr;
+        return {};
+    }
+    HANDLE thread = CreateThread(nullptr, 0, ReadPipeThread, &reader, 0, nullptr);
+    if (!thread) {
+        TerminateProcess(process, 1);
+        CloseHandle(process);
+        return {};
     }
 
-    // TODO: should show a message box and do it in a background thread
+    // documents are loaded on a background thread (cf. LoadDocumentAsync),
+    // so the timeout only is a safety net for Ghostscript hanging
     DWORD timeoutInMs = 40000;
     // allow to disable the timeout
     if (GetEnvironmentVariable(L"SUMATRAPDF_NO_GHOSTSCRIPT_TIMEOUT", nullptr, 0)) {
@@ -178,40 +326,31 @@ static EngineBase* ps2pdf(const WCHAR* fileName) {
     GetExitCodeProcess(process, &exitCode);
     TerminateProcess(process, 1);
     CloseHandle(process);
-    if (exitCode != EXIT_SUCCESS) {
-        return nullptr;
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+    if (exitCode != EXIT_SUCCESS || reader.data.size() == 0) {
+        return {};
     }
-
-    AutoFree pdfData = file::ReadFile(tmpFile);
-    if (pdfData.empty()) {
-        return nullptr;
-    }
-
-    auto strm = CreateStreamFromData(pdfData.as_view());
-    ScopedComPtr<IStream> stream(strm);
-    if (!stream) {
-        return nullptr;
-    }
-
-    return CreateEnginePdfFromStream(stream);
+    return reader.data.StealAsView();
 }
 
-static EngineBase* psgz2pdf(const WCHAR* fileName) {
+// caller must free() the result
+static std::string_view psgz2pdf(const WCHAR* fileName) {
     AutoFreeWstr tmpFile(path::GetTempPath(L"PsE"));
     ScopedFile tmpFileScope(tmpFile);
     if (!tmpFile) {
-        return nullptr;
+        return {};
     }
 
     gzFile inFile = gzopen_w(fileName, "rb");
     if (!inFile) {
-        return nullptr;
+        return {};
     }
     FILE* outFile = nullptr;
     errno_t err = _wfopen_s(&outFile, tmpFile, L"wb");
     if (err != 0 || !outFile) {
         gzclose(inFile);
-        return nullptr;
+        return {};
     }
 
     char buffer[12 * 1024];
@@ -228,6 +367,18 @@ static EngineBase* psgz2pdf(const WCHAR* fileName) {
     return ps2pdf(tmpFile);
 }
 
+static EngineBase* CreateEnginePdfFromData(std::string_view pdfData) {
+    if (pdfData.empty()) {
+        return nullptr;
+    }
+    auto strm = CreateStreamFromData(pdfData);
+    ScopedComPtr<IStream> stream(strm);
+    if (!stream) {
+        return nullptr;
+    }
+    return CreateEnginePdfFromStream(stream);
+}
+
 // EnginePs is mostly a proxy for a PdfEngine that's fed whatever
 // the ps2pdf conversion from Ghostscript returns
 class EnginePs : public EngineBase {
@@ -268,6 +419,10 @@ class EnginePs : public EngineBase {
         return pdfEngine->RenderPage(args);
     }
 
+    bool RenderPageToDC(HDC hdc, RenderPageArgs& args, Point offset) override {
+        return pdfEngine->RenderPageToDC(hdc, args, offset);
+    }
+
     RectD Transform(RectD rect, int pageNo, float zoom, int rotation, bool inverse = false) override {
         return pdfEngine->Transform(rect, pageNo, zoom, rotation, inverse);
     }
@@ -340,10 +495,17 @@ class EnginePs : public EngineBase {
             return false;
         }
         SetFileName(fileName);
-        if (file::StartsWith(fileName, "\x1F\x8B")) {
-            pdfEngine = psgz2pdf(fileName);
-        } else {
-            pdfEngine = ps2pdf(fileName);
+        AutoFreeWstr cachePath(GetPdfCachePath(fileName));
+        if (cachePath) {
+            pdfEngine = LoadCachedPdf(cachePath);
+        }
+        if (!pdfEngine) {
+            bool isGzipped = file::StartsWith(fileName, "\x1F\x8B");
+            AutoFree pdfData(isGzipped ? psgz2pdf(fileName) : ps2pdf(fileName));
+            pdfEngine = CreateEnginePdfFromData(pdfData.as_view());
+            if (pdfEngine && cachePath) {
+                SaveCachedPdf(cachePath, pdfData.as_view());
+            }
         }
 
         if (str::EndsWithI(FileName(), L".eps")) {
@@ -385,12 +547,13 @@ bool IsPsEngineSupportedFile(const WCHAR* fileName, bool sniff) {
     }
 
     if (sniff) {
-        char header[2048];
-        file::ReadN(fileName, header, sizeof(header) - 1);
+        // the header is zero-padded to FILE_SNIFF_HEADER_SIZE
+        std::string_view headerData = ReadFileHeader(fileName);
+        const char* header = headerData.data();
         if (str::StartsWith(header, "\xC5\xD0\xD3\xC6")) {
             // Windows-format EPS file - cf. http://partners.adobe.com/public/developer/en/ps/5002.EPSF_Spec.pdf
-            DWORD psStart = ByteReader(header, sizeof(header)).DWordLE(4);
-            return psStart >= sizeof(header) - 12 || str::StartsWith(header + psStart, "%!PS-Adobe-");
+            DWORD psStart = ByteReader(headerData).DWordLE(4);
+            return psStart >= FILE_SNIFF_HEADER_SIZE - 12 || str::StartsWith(header + psStart, "%!PS-Adobe-");
         }
         return str::StartsWith(header, "%!") ||
                // also sniff PJL (Printer Job Language) files containing Postscript data
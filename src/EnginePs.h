@@ -4,3 +4,7 @@
 bool IsPsEngineAvailable();
 bool IsPsEngineSupportedFile(const WCHAR* fileName, bool sniff = false);
 EngineBase* CreatePsEngineFromFile(const WCHAR* fileName);
+// the PDF documents converted by Ghostscript are kept in this directory,
+// so that reopening a document doesn't require converting it again
+// (nullptr disables keeping them)
+void SetPsConversionCacheDir(const WCHAR* dir);
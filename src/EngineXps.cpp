@@ -11,6 +11,7 @@ extern "C" {
 #include "utils/Archive.h"
 #include "utils/ScopedWin.h"
 #include "utils/FileUtil.h"
+#include "utils/FileTypeSniff.h"
 #include "utils/HtmlParserLookup.h"
 #include "utils/HtmlPullParser.h"
 #include "utils/TrivialHtmlParser.h"
@@ -31,53 +32,67 @@ Kind kindEngineXps = "engineXps";
 // TODO: use http://schemas.openxps.org/oxps/v1.0 as well once NS actually matters
 #define NS_XPS_MICROSOFT "http://schemas.microsoft.com/xps/2005/06"
 
-#if 0
-fz_rect xps_bound_page_quick(xps_document* doc, int number) {
-    fz_rect bounds = fz_empty_rect;
-    fz_page* page = doc->first_page;
-    for (int n = 0; n < number && page; n++)
-        page = page->next;
+// upper limit for the number of pages that keep their parsed FixedPage markup
+// (it's only needed for creating a page's display list and text)
+#define MAX_PAGE_XML_CACHE 16
 
-    xps_part* part = page ? xps_read_part(doc, page->name) : nullptr;
-    if (!part)
+// reads the size from the attributes of a FixedPage's root element
+// without parsing the rest of the page
+static fz_rect xps_bound_page_quick(fz_context* ctx, xps_document* doc, xps_fixpage* fix) {
+    fz_rect bounds = fz_empty_rect;
+    xps_part* part = nullptr;
+    fz_var(part);
+    fz_try(ctx) {
+        part = xps_read_part(ctx, doc, fix->name);
+    }
+    fz_catch(ctx) {
         return fz_empty_rect;
+    }
 
-    const char* data = (const char*)part->data;
-    size_t data_size = part->size;
+    unsigned char* partData = nullptr;
+    size_t partLen = fz_buffer_storage(ctx, part->data, &partData);
+    const char* data = (const char*)partData;
+    size_t dataLen = partLen;
 
     AutoFree dataUtf8;
-    if (str::StartsWith(data, UTF16BE_BOM)) {
-        for (int i = 0; i + 1 < part->size; i += 2) {
-            std::swap(part->data[i], part->data[i + 1]);
+    if (partLen >= 2 && str::StartsWith(data, UTF16BE_BOM)) {
+        for (size_t i = 0; i + 1 < partLen; i += 2) {
+            std::swap(partData[i], partData[i + 1]);
         }
     }
-    if (str::StartsWith(data, UTF16_BOM)) {
-        const WCHAR* s = (const WCHAR*)(part->data + 2);
-        size_t n = (part->size - 2) / 2;
-        auto tmp = strconv::ToUtf8(s, n);
-        dataUtf8.Set(tmp.StealData());
-        data = dataUtf8;
-        data_size = str::Len(dataUtf8);
-    } else if (str::StartsWith(data, UTF8_BOM)) {
+    if (partLen >= 2 && str::StartsWith(data, UTF16_BOM)) {
+        dataUtf8 = strconv::WstrToUtf8((const WCHAR*)(partData + 2), (partLen - 2) / 2);
+        data = dataUtf8.Get();
+        dataLen = dataUtf8.size();
+    } else if (partLen >= 3 && str::StartsWith(data, UTF8_BOM)) {
         data += 3;
-        data_size -= 3;
+        dataLen -= 3;
     }
 
-    HtmlPullParser p(data, data_size);
-    HtmlToken* tok = p.Next();
-    if (tok && tok->IsStartTag() && tok->NameIsNS("FixedPage", NS_XPS_MICROSOFT)) {
-        AttrInfo* attr = tok->GetAttrByNameNS("Width", NS_XPS_MICROSOFT);
-        if (attr)
-            bounds.x1 = fz_atof(attr->val) * 72.0f / 96.0f;
-        attr = tok->GetAttrByNameNS("Height", NS_XPS_MICROSOFT);
-        if (attr)
-            bounds.y1 = fz_atof(attr->val) * 72.0f / 96.0f;
+    HtmlPullParser p(data, dataLen);
+    HtmlToken* tok;
+    while ((tok = p.Next()) != nullptr && !tok->IsError()) {
+        if (!tok->IsStartTag() && !tok->IsEmptyElementEndTag()) {
+            continue;
+        }
+        // AlternateContent roots are left to MuPDF
+        if (tok->NameIsNS("FixedPage", NS_XPS_MICROSOFT)) {
+            AttrInfo* width = tok->GetAttrByNameNS("Width", NS_XPS_MICROSOFT);
+            AttrInfo* height = tok->GetAttrByNameNS("Height", NS_XPS_MICROSOFT);
+            if (width && height) {
+                AutoFree w(str::DupN(width->val, width->valLen));
+                AutoFree h(str::DupN(height->val, height->valLen));
+                fix->width = atoi(w);
+                fix->height = atoi(h);
+                bounds = fz_make_rect(0, 0, fix->width * 72.0f / 96.0f, fix->height * 72.0f / 96.0f);
+            }
+        }
+        break;
     }
 
     xps_drop_part(ctx, doc, part);
     return bounds;
 }
-#endif
 
 class xps_doc_props {
   public:
@@ -198,6 +213,7 @@ class EngineXps : public EngineBase {
     RectD PageContentBox(int pageNo, RenderTarget target = RenderTarget::View) override;
 
     RenderedBitmap* RenderPage(RenderPageArgs& args) override;
+    bool RenderPageToDC(HDC hdc, RenderPageArgs& args, Point offset) override;
 
     RectD Transform(RectD rect, int pageNo, float zoom, int rotation, bool inverse = false) override;
 
@@ -228,13 +244,22 @@ class EngineXps : public EngineBase {
     // protected critical section in order to avoid deadlocks
     CRITICAL_SECTION* ctxAccess;
     CRITICAL_SECTION pagesAccess;
-    CRITICAL_SECTION mutexes[FZ_LOCK_MAX];
+    // protects ctx and _doc
+    CRITICAL_SECTION docAccess;
 
     fz_context* ctx = nullptr;
-    fz_locks_context fz_locks_ctx;
     fz_document* _doc = nullptr;
     fz_stream* _docStream = nullptr;
     Vec<FzPageInfo*> _pages;
+    // pages with a cached display list, most recently used first
+    // (protected by ctxAccess)
+    Vec<FzPageInfo*> runCache;
+    // pages with cached structured text, most recently used first
+    // (protected by ctxAccess)
+    Vec<FzPageInfo*> textCache;
+    // loaded pages which still have their parsed FixedPage, most recently used first
+    // (protected by ctxAccess)
+    Vec<FzPageInfo*> xmlCache;
     fz_outline* _outline = nullptr;
     xps_doc_props* _info = nullptr;
     fz_rect** imageRects = nullptr;
@@ -248,6 +273,9 @@ class EngineXps : public EngineBase {
     bool LoadFromStream(fz_stream* stm);
 
     FzPageInfo* GetFzPageInfo(int pageNo, bool failIfBusy);
+    bool LoadPageXml(FzPageInfo* pageInfo);
+    void CachePageXml(FzPageInfo* pageInfo);
+    fz_display_list* GetDisplayList(FzPageInfo* pageInfo);
     int GetPageNo(fz_page* page);
     fz_matrix viewctm(int pageNo, float zoom, int rotation) {
         const fz_rect tmpRect = RectD_to_fz_rect(PageMediabox(pageNo));
@@ -263,16 +291,6 @@ class EngineXps : public EngineBase {
     WCHAR* ExtractFontList();
 };
 
-static void fz_lock_context_cs(void* user, int lock) {
-    EngineXps* e = (EngineXps*)user;
-    EnterCriticalSection(&e->mutexes[lock]);
-}
-
-static void fz_unlock_context_cs(void* user, int lock) {
-    EngineXps* e = (EngineXps*)user;
-    LeaveCriticalSection(&e->mutexes[lock]);
-}
-
 static void fz_print_cb(void* user, const char* msg) {
     log(msg);
 }
@@ -289,16 +307,11 @@ EngineXps::EngineXps() {
     supportsAnnotations = true;
     supportsAnnotationsForSaving = false;
 
-    for (size_t i = 0; i < dimof(mutexes); i++) {
-        InitializeCriticalSection(&mutexes[i]);
-    }
     InitializeCriticalSection(&pagesAccess);
-    ctxAccess = &mutexes[FZ_LOCK_ALLOC];
+    InitializeCriticalSection(&docAccess);
+    ctxAccess = &docAccess;
 
-    fz_locks_ctx.user = this;
-    fz_locks_ctx.lock = fz_lock_context_cs;
-    fz_locks_ctx.unlock = fz_unlock_context_cs;
-    ctx = fz_new_context(nullptr, &fz_locks_ctx, FZ_STORE_DEFAULT);
+    ctx = NewFzContext();
     installFitzErrorCallbacks(ctx);
 }
 
@@ -307,6 +320,10 @@ EngineXps::~EngineXps() {
     EnterCriticalSection(ctxAccess);
 
     for (auto* pi : _pages) {
+        fz_drop_display_list(ctx, pi->list);
+        if (pi->stext) {
+            fz_drop_stext_page(ctx, pi->stext);
+        }
         if (pi->links) {
             fz_drop_link(ctx, pi->links);
         }
@@ -330,10 +347,8 @@ EngineXps::~EngineXps() {
     fz_drop_document(ctx, _doc);
     fz_drop_context(ctx);
 
-    for (size_t i = 0; i < dimof(mutexes); i++) {
-        LeaveCriticalSection(&mutexes[i]);
-        DeleteCriticalSection(&mutexes[i]);
-    }
+    LeaveCriticalSection(ctxAccess);
+    DeleteCriticalSection(&docAccess);
     LeaveCriticalSection(&pagesAccess);
     DeleteCriticalSection(&pagesAccess);
 }
@@ -420,18 +435,32 @@ bool EngineXps::LoadFromStream(fz_stream* stm) {
         return false;
     }
 
-    // TODO: this might be slow. Try port xps_bound_page_quick
-    for (int i = 0; i < pageCount; i++) {
+    // pages are only loaded (and their FixedPage parsed) when needed. Their sizes
+    // come from the Width and Height of the FixedDocument's PageContent elements
+    // (already parsed by MuPDF) and only pages without these have (the root
+    // element of) their FixedPage read
+    xps_document* xpsdoc = xps_document_from_fz_document(_doc);
+    xps_fixpage* fix = xpsdoc->first_page;
+    for (int i = 0; i < pageCount; i++, fix = fix ? fix->next : nullptr) {
         FzPageInfo* pageInfo = new FzPageInfo();
         pageInfo->pageNo = i + 1;
 
-        fz_rect mbox{};
-
-        fz_try(ctx) {
-            pageInfo->page = fz_load_page(ctx, _doc, i);
-            mbox = fz_bound_page(ctx, pageInfo->page);
+        fz_rect mbox = fz_empty_rect;
+        if (fix && fix->width > 0 && fix->height > 0) {
+            mbox = fz_make_rect(0, 0, fix->width * 72.0f / 96.0f, fix->height * 72.0f / 96.0f);
+        } else if (fix) {
+            mbox = xps_bound_page_quick(ctx, xpsdoc, fix);
         }
-        fz_catch(ctx) {
+        if (fz_is_empty_rect(mbox)) {
+            fz_page* page = nullptr;
+            fz_var(page);
+            fz_try(ctx) {
+                page = fz_load_page(ctx, _doc, i);
+                mbox = fz_bound_page(ctx, page);
+            }
+            fz_catch(ctx) {
+            }
+            fz_drop_page(ctx, page);
         }
         if (fz_is_empty_rect(mbox)) {
             fz_warn(ctx, "cannot find page size for page %d", i);
@@ -473,73 +502,142 @@ FzPageInfo* EngineXps::GetFzPageInfo(int pageNo, bool failIfBusy) {
 
     ScopedCritSec ctxScope(ctxAccess);
 
-#if 0
-    // was loaded in LoadFromStream
+    fz_page* page = nullptr;
     fz_var(page);
     fz_try(ctx) {
-        page = fz_load_page(ctx, _doc, pageNo - 1);
-        pageInfo->page = page;
+        page = fz_load_page(ctx, _doc, pageIdx);
     }
     fz_catch(ctx) {
     }
-#endif
+    if (!page) {
+        return pageInfo;
+    }
+    // loading a page updates the size of its xps_fixpage from the FixedPage,
+    // so restore the size the page has been laid out with in LoadFromStream
+    xps_page* xpspage = (xps_page*)page;
+    xpspage->fix->width = (int)(pageInfo->mediabox.dx * 96.0 / 72.0 + 0.5);
+    xpspage->fix->height = (int)(pageInfo->mediabox.dy * 96.0 / 72.0 + 0.5);
+    pageInfo->page = page;
+    CachePageXml(pageInfo);
 
-    fz_page* page = pageInfo->page;
-    fz_rect bounds;
-    fz_display_list* list = NULL;
-    fz_device* dev = NULL;
-    fz_cookie cookie = {0};
-    fz_var(list);
-    fz_var(dev);
+    fz_try(ctx) {
+        pageInfo->links = fz_load_links(ctx, page);
+    }
+    fz_catch(ctx) {
+    }
 
-    /* TODO: handle try later?
-        if (fz_caught(ctx) != FZ_ERROR_TRYLATER) {
-            return nullptr;
-        }
-    */
+    // the extracted text is cached for ExtractPageText
+    fz_stext_page* stext = FzGetStextPage(ctx, pageInfo, textCache);
+    if (stext) {
+        FzLinkifyPageText(pageInfo, stext);
+        fz_find_image_positions(ctx, pageInfo->images, stext);
+    }
+    FzBuildElementsGrid(pageInfo);
 
-    // TODO: use fz_new_display_list_from_page
-    fz_try(ctx) {
-        bounds = fz_bound_page(ctx, page);
-        list = fz_new_display_list(ctx, bounds);
-        dev = fz_new_list_device(ctx, list);
-        // TODO(port): should this be just fz_run_page_contents?
-        fz_run_page(ctx, page, dev, fz_identity, &cookie);
-        fz_close_device(ctx, dev);
+    return pageInfo;
+}
+
+// keeps the parsed FixedPage of a newly loaded page and
+// frees the ones of the least recently used pages
+// Note: make sure to only call with ctxAccess
+void EngineXps::CachePageXml(FzPageInfo* pageInfo) {
+    xmlCache.InsertAt(0, pageInfo);
+    while (xmlCache.size() > MAX_PAGE_XML_CACHE) {
+        FzPageInfo* pi = xmlCache.Pop();
+        xps_page* xpspage = (xps_page*)pi->page;
+        fz_drop_xml(ctx, xpspage->xml);
+        xpspage->xml = nullptr;
     }
-    fz_always(ctx) {
-        fz_drop_device(ctx, dev);
-        if (list) {
-            fz_drop_display_list(ctx, list);
+}
+
+// makes sure that a loaded page has its parsed FixedPage, which is needed
+// for running the page (e.g. for its display list or its text)
+// Note: make sure to only call with ctxAccess
+bool EngineXps::LoadPageXml(FzPageInfo* pageInfo) {
+    xps_page* xpspage = (xps_page*)pageInfo->page;
+    if (!xpspage) {
+        return false;
+    }
+    if (xpspage->xml) {
+        if (pageInfo != xmlCache.at(0)) {
+            xmlCache.Remove(pageInfo);
+            xmlCache.InsertAt(0, pageInfo);
         }
-        dev = NULL;
+        return true;
+    }
+
+    // have MuPDF parse the FixedPage again and take over the result
+    int width = xpspage->fix->width, height = xpspage->fix->height;
+    xps_page* tmp = nullptr;
+    fz_var(tmp);
+    fz_try(ctx) {
+        tmp = (xps_page*)fz_load_page(ctx, _doc, pageInfo->pageNo - 1);
     }
     fz_catch(ctx) {
-        fz_drop_display_list(ctx, list);
-        // fz_drop_separations(ctx, seps);
+        return false;
     }
-    if (!list) {
-        return pageInfo;
+    xpspage->xml = tmp->xml;
+    tmp->xml = nullptr;
+    fz_drop_page(ctx, &tmp->super);
+    xpspage->fix->width = width;
+    xpspage->fix->height = height;
+    CachePageXml(pageInfo);
+    return true;
+}
+
+// XPS content is mostly made of path and glyph elements
+// which take roughly as much space in a display list
+static size_t EstimateDisplayListSize(fz_xml* node) {
+    size_t size = 0;
+    for (; node; node = fz_xml_next(node)) {
+        size += 256 + EstimateDisplayListSize(fz_xml_down(node));
     }
-    pageInfo->links = fz_load_links(ctx, page);
+    return size;
+}
 
-    fz_stext_page* stext = nullptr;
-    fz_var(stext);
+// returns the (cached) display list for a page's content
+// caller must call fz_drop_display_list on the result
+// Note: make sure to only call with ctxAccess
+fz_display_list* EngineXps::GetDisplayList(FzPageInfo* pageInfo) {
+    if (pageInfo->list) {
+        if (pageInfo != runCache.at(0)) {
+            runCache.Remove(pageInfo);
+            runCache.InsertAt(0, pageInfo);
+        }
+        return fz_keep_display_list(ctx, pageInfo->list);
+    }
+    if (!LoadPageXml(pageInfo)) {
+        return nullptr;
+    }
 
+    fz_display_list* list = nullptr;
+    fz_var(list);
     fz_try(ctx) {
-        stext = fz_new_stext_page_from_page(ctx, page, nullptr);
+        list = fz_new_display_list_from_page_contents(ctx, pageInfo->page);
     }
     fz_catch(ctx) {
+        return nullptr;
     }
 
-    if (!stext) {
-        return pageInfo;
+    xps_page* xpspage = (xps_page*)pageInfo->page;
+    pageInfo->list = list;
+    pageInfo->listSizeEst = 4096 + EstimateDisplayListSize(fz_xml_root(xpspage->xml));
+    runCache.InsertAt(0, pageInfo);
+
+    // evict least recently used display lists (but always keep the newest one)
+    size_t memUsed = 0;
+    for (auto* pi : runCache) {
+        memUsed += pi->listSizeEst;
+    }
+    while (runCache.size() > 1 && (runCache.size() > MAX_PAGE_RUN_CACHE || memUsed > MAX_PAGE_RUN_MEMORY)) {
+        FzPageInfo* pi = runCache.Pop();
+        memUsed -= pi->listSizeEst;
+        fz_drop_display_list(ctx, pi->list);
+        pi->list = nullptr;
+        pi->listSizeEst = 0;
     }
-    FzLinkifyPageText(pageInfo, stext);
-    fz_find_image_positions(ctx, pageInfo->images, stext);
-    fz_drop_stext_page(ctx, stext);
 
-    return pageInfo;
+    return fz_keep_display_list(ctx, list);
 }
 
 int EngineXps::GetPageNo(fz_page* page) {
@@ -559,6 +657,9 @@ RectD EngineXps::PageMediabox(int pageNo) {
 RectD EngineXps::PageContentBox(int pageNo, RenderTarget target) {
     UNUSED(target);
     FzPageInfo* pageInfo = GetFzPageInfo(pageNo, false);
+    if (!pageInfo->page) {
+        return pageInfo->mediabox;
+    }
 
     ScopedCritSec scope(ctxAccess);
 
@@ -575,8 +676,11 @@ RectD EngineXps::PageContentBox(int pageNo, RenderTarget target) {
     RectD mediabox = pageInfo->mediabox;
 
     fz_try(ctx) {
+        list = GetDisplayList(pageInfo);
+        if (!list) {
+            fz_throw(ctx, FZ_ERROR_GENERIC, "couldn't load page contents");
+        }
         dev = fz_new_bbox_device(ctx, &rect);
-        list = fz_new_display_list_from_page(ctx, pageInfo->page);
         fz_run_display_list(ctx, list, dev, fz_identity, pagerect, &fzcookie);
         fz_close_device(ctx, dev);
     }
@@ -636,7 +740,6 @@ RenderedBitmap* EngineXps::RenderPage(RenderPageArgs& args) {
     fz_matrix ctm = viewctm(page, args.zoom, args.rotation);
     fz_irect bbox = fz_round_rect(fz_transform_rect(pRect, ctm));
 
-    fz_colorspace* colorspace = fz_device_rgb(ctx);
     fz_irect ibounds = bbox;
     fz_rect cliprect = fz_rect_from_irect(bbox);
 
@@ -644,17 +747,32 @@ RenderedBitmap* EngineXps::RenderPage(RenderPageArgs& args) {
     fz_device* dev = nullptr;
     fz_display_list* list = nullptr;
     RenderedBitmap* bitmap = nullptr;
+    HBITMAP hbmp = nullptr;
+    HANDLE hMap = nullptr;
 
     fz_var(dev);
     fz_var(list);
     fz_var(pix);
     fz_var(bitmap);
+    fz_var(hbmp);
+    fz_var(hMap);
+
+    AnnotationsIndex* annotsIndex = args.skipUserAnnots ? nullptr : userAnnotsIndex;
+    Vec<Annotation*> pageAnnots = FilterAnnotationsForPage(annotsIndex, args.pageNo);
 
-    Vec<Annotation*> pageAnnots = FilterAnnotationsForPage(userAnnots, args.pageNo);
+    int aaLevel = fz_aa_level(ctx);
+    bool isDraft = args.quality == RenderQuality::Draft;
+    if (isDraft) {
+        fz_set_aa_level(ctx, 0);
+    }
 
     fz_try(ctx) {
-        list = fz_new_display_list_from_page(ctx, page);
-        pix = fz_new_pixmap_with_bbox(ctx, colorspace, ibounds, nullptr, 1);
+        list = GetDisplayList(pageInfo);
+        if (!list) {
+            fz_throw(ctx, FZ_ERROR_GENERIC, "couldn't load page contents");
+        }
+        // render directly into the memory of the resulting bitmap
+        pix = new_dib_fz_pixmap(ctx, ibounds, &hbmp, &hMap);
         // initialize with white background
         fz_clear_pixmap_with_value(ctx, pix, 0xff);
 
@@ -662,14 +780,20 @@ RenderedBitmap* EngineXps::RenderPage(RenderPageArgs& args) {
         // or "Print". "Export" is not used
         dev = fz_new_draw_device(ctx, fz_identity, pix);
         // TODO: use fz_infinite_rect instead of cliprect?
-        fz_run_page_transparency(ctx, &pageAnnots, dev, cliprect, false, false);
+        // drafts are rendered without transparency groups
+        fz_run_page_transparency(ctx, &pageAnnots, dev, cliprect, false, isDraft);
         fz_run_display_list(ctx, list, dev, ctm, cliprect, fzcookie);
-        fz_run_page_transparency(ctx, &pageAnnots, dev, cliprect, true, false);
+        fz_run_page_transparency(ctx, &pageAnnots, dev, cliprect, true, isDraft);
         fz_run_user_page_annots(ctx, &pageAnnots, dev, ctm, cliprect, fzcookie);
-        bitmap = new_rendered_fz_pixmap(ctx, pix);
         fz_close_device(ctx, dev);
+        // rendered color images almost never fit into an 8-bit palette
+        bool tryPalette = !FzHasColorImagesInRect(pageInfo, ctm, cliprect);
+        bitmap = new_rendered_fz_dib_pixmap(ctx, pix, hbmp, hMap, tryPalette);
+        hbmp = nullptr;
+        hMap = nullptr;
     }
     fz_always(ctx) {
+        fz_set_aa_level(ctx, aaLevel);
         if (dev) {
             fz_drop_device(ctx, dev);
         }
@@ -680,11 +804,66 @@ RenderedBitmap* EngineXps::RenderPage(RenderPageArgs& args) {
     }
     fz_catch(ctx) {
         delete bitmap;
+        if (hbmp) {
+            DeleteObject(hbmp);
+        }
+        if (hMap) {
+            CloseHandle(hMap);
+        }
         return nullptr;
     }
     return bitmap;
 }
 
+bool EngineXps::RenderPageToDC(HDC hdc, RenderPageArgs& args, Point offset) {
+    FzPageInfo* pageInfo = GetFzPageInfo(args.pageNo, false);
+    fz_page* page = pageInfo ? pageInfo->page : nullptr;
+    if (!page) {
+        return false;
+    }
+
+    fz_cookie* fzcookie = nullptr;
+    if (args.cookie_out) {
+        FitzAbortCookie* cookie = new FitzAbortCookie();
+        *args.cookie_out = cookie;
+        fzcookie = &cookie->cookie;
+    }
+
+    ScopedCritSec cs(ctxAccess);
+
+    fz_rect pRect = args.pageRect ? RectD_to_fz_rect(*args.pageRect) : fz_bound_page(ctx, page);
+    fz_matrix ctm = viewctm(page, args.zoom, args.rotation);
+    fz_irect bbox = fz_round_rect(fz_transform_rect(pRect, ctm));
+
+    // move the rendered area to offset
+    int dx = offset.x - bbox.x0, dy = offset.y - bbox.y0;
+    ctm = fz_concat(ctm, fz_translate((float)dx, (float)dy));
+    bbox = fz_make_irect(bbox.x0 + dx, bbox.y0 + dy, bbox.x1 + dx, bbox.y1 + dy);
+
+    Vec<Annotation*> pageAnnots = FilterAnnotationsForPage(userAnnotsIndex, args.pageNo);
+
+    fz_display_list* lists[2] = {};
+    bool ok = false;
+    fz_var(ok);
+    fz_try(ctx) {
+        lists[0] = GetDisplayList(pageInfo);
+        if (!lists[0]) {
+            fz_throw(ctx, FZ_ERROR_GENERIC, "couldn't load page contents");
+        }
+        lists[1] = NewUserAnnotsDisplayList(ctx, &pageAnnots);
+        ok = fz_run_display_lists_to_dc(ctx, hdc, lists, dimof(lists), ctm, bbox, fzcookie);
+    }
+    fz_always(ctx) {
+        for (fz_display_list* list : lists) {
+            fz_drop_display_list(ctx, list);
+        }
+    }
+    fz_catch(ctx) {
+        ok = false;
+    }
+    return ok;
+}
+
 std::string_view EngineXps::GetFileData() {
     std::string_view res;
     ScopedCritSec scope(ctxAccess);
@@ -726,6 +905,9 @@ bool EngineXps::SaveFileAs(const char* copyFileName, bool includeUserAnnots) {
 }
 
 WCHAR* EngineXps::ExtractFontList() {
+    // collect a list of all included fonts
+    WStrVec fonts;
+#if 0
     // load and parse all pages
     for (int i = 1; i <= PageCount(); i++) {
         GetFzPageInfo(i, false);
@@ -733,9 +915,6 @@ WCHAR* EngineXps::ExtractFontList() {
 
     ScopedCritSec scope(ctxAccess);
 
-    // collect a list of all included fonts
-    WStrVec fonts;
-#if 0
     for (xps_font_cache* font = _doc->font_table; font; font = font->next) {
         AutoFreeWstr path(strconv::FromUtf8(font->name));
         AutoFreeWstr name(strconv::FromUtf8(font->font->name));
@@ -830,23 +1009,19 @@ RenderedBitmap* EngineXps::GetImageForPageElement(PageElement* pel) {
 }
 
 WCHAR* EngineXps::ExtractPageText(int pageNo, Rect** coordsOut) {
-    // TODO: optimize by extracting text in GetFzPageInfo()
     FzPageInfo* pageInfo = GetFzPageInfo(pageNo, false);
-    ScopedCritSec scope(ctxAccess);
-    fz_stext_page* stext = nullptr;
-    fz_var(stext);
-
-    fz_try(ctx) {
-        stext = fz_new_stext_page_from_page(ctx, pageInfo->page, nullptr);
+    if (!pageInfo) {
+        return nullptr;
     }
-    fz_catch(ctx) {
+    ScopedCritSec scope(ctxAccess);
+    if (!pageInfo->stext && !LoadPageXml(pageInfo)) {
+        return nullptr;
     }
+    fz_stext_page* stext = FzGetStextPage(ctx, pageInfo, textCache);
     if (!stext) {
         return nullptr;
     }
-    WCHAR* content = fz_text_page_to_str(stext, coordsOut);
-    fz_drop_stext_page(ctx, stext);
-    return content;
+    return fz_text_page_to_str(stext, coordsOut);
 }
 
 RenderedBitmap* EngineXps::GetPageImage(int pageNo, RectD rect, int imageIdx) {
@@ -855,23 +1030,25 @@ RenderedBitmap* EngineXps::GetPageImage(int pageNo, RectD rect, int imageIdx) {
         return nullptr;
     }
 
-    Vec<FitzImagePos> positions;
-
-    if (imageIdx >= positions.isize() || fz_rect_to_RectD(positions.at(imageIdx).rect) != rect) {
+    auto& images = pageInfo->images;
+    if (imageIdx >= images.isize() || fz_rect_to_RectD(images.at(imageIdx).rect) != rect) {
         CrashIf(true);
         return nullptr;
     }
 
     ScopedCritSec scope(ctxAccess);
-    fz_image* image = fz_find_image_at_idx(ctx, pageInfo, imageIdx);
+    if (!pageInfo->stext && !LoadPageXml(pageInfo)) {
+        return nullptr;
+    }
+    fz_stext_page* stext = FzGetStextPage(ctx, pageInfo, textCache);
+    fz_image* image = fz_find_image_at_idx(ctx, stext, imageIdx);
     CrashIf(!image);
     if (!image) {
         return nullptr;
     }
     fz_pixmap* pixmap = nullptr;
     fz_try(ctx) {
-        // SubmitCrashIf(true);
-        // TODO(port): not sure if should provide subarea, w and h
+        // rect covers the whole image, so it's decoded at its native size
         pixmap = fz_get_pixmap_from_image(ctx, image, nullptr, nullptr, nullptr, nullptr);
     }
     fz_catch(ctx) {
@@ -999,6 +1176,10 @@ bool IsXpsEngineSupportedFile(const WCHAR* fileName, bool sniff) {
         return file::Exists(relsPath) || dir::Exists(relsPath);
     }
 
+    // don't try to open files that aren't ZIP archives
+    if (!str::StartsWith(ReadFileHeader(fileName), "PK\x03\x04")) {
+        return false;
+    }
     MultiFormatArchive* archive = OpenZipArchive(fileName, true);
     if (!archive) {
         return false;
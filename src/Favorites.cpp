@@ -113,24 +113,56 @@ TreeItem* FavTreeModel::RootAt(int n) {
     return children[n];
 }
 
-Favorite* Favorites::GetByMenuId(int menuId, DisplayState** dsOut) {
+static int SortByBaseFileName(const void* a, const void* b) {
+    DisplayState* dsA = *(DisplayState**)a;
+    DisplayState* dsB = *(DisplayState**)b;
+    const WCHAR* baseA = path::GetBaseNameNoFree(dsA->filePath);
+    const WCHAR* baseB = path::GetBaseNameNoFree(dsB->filePath);
+    return str::CmpNatural(baseA, baseB);
+}
+
+void Favorites::UpdateIndexIfNeeded() {
+    if (isIndexValid && indexedHistoryChangeCount == gFileHistory.changeCount) {
+        return;
+    }
+    filesIndex.Reset();
     DisplayState* ds;
     for (size_t i = 0; (ds = gFileHistory.Get(i)) != nullptr; i++) {
-        for (size_t j = 0; j < ds->favorites->size(); j++) {
-            if (menuId == ds->favorites->at(j)->menuId) {
-                if (dsOut) {
-                    *dsOut = ds;
-                }
-                return ds->favorites->at(j);
-            }
+        if (ds->favorites->size() > 0) {
+            filesIndex.Append(ds);
         }
     }
-    return nullptr;
+    filesIndex.Sort(SortByBaseFileName);
+    menuFavorites.Reset();
+    menuFiles.Reset();
+    isIndexValid = true;
+    indexedHistoryChangeCount = gFileHistory.changeCount;
+}
+
+void Favorites::InvalidateIndex() {
+    isIndexValid = false;
+}
+
+Vec<DisplayState*>& Favorites::GetFilesWithFavorites() {
+    UpdateIndexIfNeeded();
+    return filesIndex;
+}
+
+Favorite* Favorites::GetByMenuId(int menuId, DisplayState** dsOut) {
+    // if favorites have changed since the menu was built, the menu is outdated
+    UpdateIndexIfNeeded();
+    int idx = menuId - IDM_FAV_FIRST;
+    if (idx < 0 || idx >= menuFavorites.isize()) {
+        return nullptr;
+    }
+    if (dsOut) {
+        *dsOut = menuFiles.at(idx);
+    }
+    return menuFavorites.at(idx);
 }
 
 DisplayState* Favorites::GetByFavorite(Favorite* fn) {
-    DisplayState* ds;
-    for (size_t i = 0; (ds = gFileHistory.Get(i)) != nullptr; i++) {
+    for (DisplayState* ds : GetFilesWithFavorites()) {
         if (ds->favorites->Contains(fn)) {
             return ds;
         }
@@ -139,12 +171,19 @@ DisplayState* Favorites::GetByFavorite(Favorite* fn) {
 }
 
 void Favorites::ResetMenuIds() {
-    DisplayState* ds;
-    for (size_t i = 0; (ds = gFileHistory.Get(i)) != nullptr; i++) {
-        for (size_t j = 0; j < ds->favorites->size(); j++) {
-            ds->favorites->at(j)->menuId = 0;
-        }
+    for (Favorite* fn : menuFavorites) {
+        fn->menuId = 0;
     }
+    menuFavorites.Reset();
+    menuFiles.Reset();
+}
+
+int Favorites::AddMenuId(DisplayState* ds, Favorite* fn) {
+    UpdateIndexIfNeeded();
+    fn->menuId = IDM_FAV_FIRST + menuFavorites.isize();
+    menuFavorites.Append(fn);
+    menuFiles.Append(ds);
+    return fn->menuId;
 }
 
 DisplayState* Favorites::GetFavByFilePath(const WCHAR* filePath) {
@@ -209,6 +248,7 @@ void Favorites::AddOrReplace(const WCHAR* filePath, int pageNo, const WCHAR* nam
         fn = NewFavorite(pageNo, name, pageLabel);
         fav->favorites->Append(fn);
         fav->favorites->Sort(SortByPageNo);
+        InvalidateIndex();
     }
 }
 
@@ -224,6 +264,7 @@ void Favorites::Remove(const WCHAR* filePath, int pageNo) {
 
     fav->favorites->Remove(fn);
     DeleteFavorite(fn);
+    InvalidateIndex();
 
     if (!gGlobalPrefs->rememberOpenedFiles && 0 == fav->favorites->size()) {
         gFileHistory.Remove(fav);
@@ -241,6 +282,7 @@ void Favorites::RemoveAllForFile(const WCHAR* filePath) {
         DeleteFavorite(fav->favorites->at(i));
     }
     fav->favorites->Reset();
+    InvalidateIndex();
 
     if (!gGlobalPrefs->rememberOpenedFiles) {
         gFileHistory.Remove(fav);
@@ -260,13 +302,7 @@ MenuDef menuDefFavContext[] = {
 // clang-format on
 
 bool HasFavorites() {
-    DisplayState* ds;
-    for (size_t i = 0; (ds = gFileHistory.Get(i)) != nullptr; i++) {
-        if (ds->favorites->size() > 0) {
-            return true;
-        }
-    }
-    return false;
+    return gFavorites.GetFilesWithFavorites().size() > 0;
 }
 
 // caller has to free() the result
@@ -290,13 +326,13 @@ static WCHAR* FavCompactReadableName(DisplayState* fav, Favorite* fn, bool isCur
     return str::Format(L"%s : %s", fp, rn.Get());
 }
 
-static void AppendFavMenuItems(HMENU m, DisplayState* f, UINT& idx, bool combined, bool isCurrent) {
+static void AppendFavMenuItems(HMENU m, DisplayState* f, bool combined, bool isCurrent) {
     for (size_t i = 0; i < f->favorites->size(); i++) {
         if (i >= MAX_FAV_MENUS) {
             return;
         }
         Favorite* fn = f->favorites->at(i);
-        fn->menuId = idx++;
+        gFavorites.AddMenuId(f, fn);
         AutoFreeWstr s;
         if (combined) {
             s.Set(FavCompactReadableName(f, fn, isCurrent));
@@ -308,24 +344,6 @@ static void AppendFavMenuItems(HMENU m, DisplayState* f, UINT& idx, bool combine
     }
 }
 
-static int SortByBaseFileName(const void* a, const void* b) {
-    const WCHAR* filePathA = *(const WCHAR**)a;
-    const WCHAR* filePathB = *(const WCHAR**)b;
-    const WCHAR* baseA = path::GetBaseNameNoFree(filePathA);
-    const WCHAR* baseB = path::GetBaseNameNoFree(filePathB);
-    return str::CmpNatural(baseA, baseB);
-}
-
-static void GetSortedFilePaths(Vec<const WCHAR*>& filePathsSortedOut, DisplayState* toIgnore = nullptr) {
-    DisplayState* ds;
-    for (size_t i = 0; (ds = gFileHistory.Get(i)) != nullptr; i++) {
-        if (ds->favorites->size() > 0 && ds != toIgnore) {
-            filePathsSortedOut.Append(ds->filePath);
-        }
-    }
-    filePathsSortedOut.Sort(SortByBaseFileName);
-}
-
 // For easy access, we try to show favorites in the menu, similar to a list of
 // recently opened files.
 // The first menu items are for currently opened file (up to MAX_FAV_MENUS), based
@@ -345,40 +363,39 @@ static void AppendFavMenus(HMENU m, const WCHAR* currFilePath) {
         currFileFav = gFavorites.GetFavByFilePath(currFilePath);
     }
 
-    // sort the files with favorites by base file name of file path
-    Vec<const WCHAR*> filePathsSorted;
+    // the files with favorites are sorted by base file name of file path
+    Vec<DisplayState*> filesSorted;
+    if (currFileFav && currFileFav->favorites->size() > 0) {
+        filesSorted.Append(currFileFav);
+    }
     if (HasPermission(Perm_DiskAccess)) {
         // only show favorites for other files, if we're allowed to open them
-        GetSortedFilePaths(filePathsSorted, currFileFav);
-    }
-    if (currFileFav && currFileFav->favorites->size() > 0) {
-        filePathsSorted.InsertAt(0, currFileFav->filePath);
+        for (DisplayState* ds : gFavorites.GetFilesWithFavorites()) {
+            if (filesSorted.size() >= MAX_FAV_MENUS) {
+                break;
+            }
+            if (ds != currFileFav) {
+                filesSorted.Append(ds);
+            }
+        }
     }
 
-    if (filePathsSorted.size() == 0) {
+    if (filesSorted.size() == 0) {
         return;
     }
 
     AppendMenu(m, MF_SEPARATOR, 0, nullptr);
 
     gFavorites.ResetMenuIds();
-    UINT menuId = IDM_FAV_FIRST;
-
-    size_t menusCount = filePathsSorted.size();
-    if (menusCount > MAX_FAV_MENUS) {
-        menusCount = MAX_FAV_MENUS;
-    }
 
-    for (size_t i = 0; i < menusCount; i++) {
-        const WCHAR* filePath = filePathsSorted.at(i);
-        DisplayState* f = gFavorites.GetFavByFilePath(filePath);
-        CrashIf(!f);
+    for (DisplayState* f : filesSorted) {
+        const WCHAR* filePath = f->filePath;
         HMENU sub = m;
         bool combined = (f->favorites->size() == 1);
         if (!combined) {
             sub = CreateMenu();
         }
-        AppendFavMenuItems(sub, f, menuId, combined, f == currFileFav);
+        AppendFavMenuItems(sub, f, combined, f == currFileFav);
         if (!combined) {
             if (f == currFileFav) {
                 AppendMenu(m, MF_POPUP | MF_STRING, (UINT_PTR)sub, _TR("Current file"));
@@ -551,10 +568,7 @@ static void MakeFavSecondLevel(FavTreeItem* parent, DisplayState* f) {
 
 static FavTreeModel* BuildFavTreeModel(WindowInfo* win) {
     auto* res = new FavTreeModel();
-    Vec<const WCHAR*> filePathsSorted;
-    GetSortedFilePaths(filePathsSorted);
-    for (size_t i = 0; i < filePathsSorted.size(); i++) {
-        DisplayState* f = gFavorites.GetFavByFilePath(filePathsSorted.at(i));
+    for (DisplayState* f : gFavorites.GetFilesWithFavorites()) {
         bool isExpanded = win->expandedFavorites.Contains(f);
         FavTreeItem* ti = MakeFavTopLevelItem(f, isExpanded);
         res->children.Append(ti);
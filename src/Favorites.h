@@ -23,11 +23,28 @@ per-file basis in FileHistory.
 class Favorites {
     size_t idxCache = (size_t)-1;
 
+    // the files which have favorites, sorted by base file name. only rebuilt
+    // after favorites have been added or removed or gFileHistory has changed
+    // (instead of walking all of gFileHistory whenever the menu is shown)
+    Vec<DisplayState*> filesIndex;
+    bool isIndexValid = false;
+    u32 indexedHistoryChangeCount = 0;
+    // the favorites currently in the menu, at their menuId - IDM_FAV_FIRST
+    // (reset together with filesIndex, as the pointers might no longer be valid)
+    Vec<Favorite*> menuFavorites;
+    Vec<DisplayState*> menuFiles;
+
+    void UpdateIndexIfNeeded();
+
   public:
     Favorites() = default;
 
     Favorite* GetByMenuId(int menuId, DisplayState** dsOut = nullptr);
     void ResetMenuIds();
+    int AddMenuId(DisplayState* ds, Favorite* fn);
+    Vec<DisplayState*>& GetFilesWithFavorites();
+    // must be called after file paths of DisplayStates with favorites have changed
+    void InvalidateIndex();
     DisplayState* GetFavByFilePath(const WCHAR* filePath);
     DisplayState* GetByFavorite(Favorite* fn);
     bool IsPageInFavorites(const WCHAR* filePath, int pageNo);
@@ -62,14 +62,17 @@ static int cmpOpenCount(const void* a, const void* b) {
 void FileHistory::Append(DisplayState* state) {
     CrashIf(!state->filePath);
     states->Append(state);
+    changeCount++;
 }
 
 void FileHistory::Remove(DisplayState* state) {
     states->Remove(state);
+    changeCount++;
 }
 
 void FileHistory::UpdateStatesSource(Vec<DisplayState*>* states) {
     this->states = states;
+    changeCount++;
 }
 
 void FileHistory::Clear(bool keepFavorites) {
@@ -86,6 +89,7 @@ void FileHistory::Clear(bool keepFavorites) {
         }
     }
     *states = keep;
+    changeCount++;
 }
 
 DisplayState* FileHistory::Get(size_t index) const {
@@ -116,6 +120,7 @@ DisplayState* FileHistory::MarkFileLoaded(const WCHAR* filePath) {
     if (!state) {
         state = NewDisplayState(filePath);
         state->useDefaultState = true;
+        changeCount++;
     } else {
         states->Remove(state);
         state->isMissing = false;
@@ -206,5 +211,6 @@ void FileHistory::Purge(bool alwaysUseDefaultState) {
             continue;
         }
         DeleteDisplayState(state);
+        changeCount++;
     }
 }
@@ -13,6 +13,9 @@
 struct FileHistory {
     // owned by gGlobalPrefs->fileStates
     Vec<DisplayState*>* states = nullptr;
+    // incremented whenever states are added, removed or replaced
+    // (so that e.g. the index in Favorites can tell when it's outdated)
+    u32 changeCount = 0;
 
     FileHistory() = default;
     ~FileHistory() = default;
@@ -6,6 +6,8 @@
 #include "utils/CryptoUtil.h"
 #include "utils/FileUtil.h"
 #include "utils/GdiPlusUtil.h"
+#include "utils/ThreadUtil.h"
+#include "utils/UITask.h"
 #include "utils/WinUtil.h"
 
 #include "wingui/TreeModel.h"
@@ -19,72 +21,231 @@
 #include "FileThumbnails.h"
 
 #define THUMBNAILS_DIR_NAME L"sumatrapdfcache"
+#define THUMBNAILS_FILE_NAME L"sumatrapdfcache\\thumbnails.bin"
+#define THUMBNAILS_FILE_MAGIC 0x314E5053 // "SPN1"
+
+// All thumbnails are stored in a single file: their PNG data one after
+// the other, followed by an index of all thumbnails and a trailer which
+// points to the index. New thumbnails are written over the index after
+// which the updated index is appended. Space of replaced thumbnails is
+// only reclaimed by CleanUpThumbnailCache.
+// (thumbnails used to be saved as one .png file per document)
+struct ThumbnailIndexEntry {
+    // MD5 of the (normalized) path of the document
+    u8 fingerPrint[16];
+    // modification time of the document when the thumbnail was saved
+    FILETIME fileTime;
+    u32 offset;
+    u32 size;
+};
+
+struct ThumbnailsTrailer {
+    u32 indexOffset;
+    u32 count;
+    u32 magic;
+};
+
+struct ThumbnailCache {
+    // thumbnails are loaded on a background thread, so the index
+    // (and the file) is only accessed while holding this
+    CRITICAL_SECTION access;
+    bool indexLoaded = false;
+    Vec<ThumbnailIndexEntry> index;
+    // the index follows the data of the last thumbnail
+    u32 dataEnd = 0;
+
+    ThumbnailCache() {
+        InitializeCriticalSection(&access);
+    }
+};
+
+static ThumbnailCache& GetThumbnailCache() {
+    static ThumbnailCache cache;
+    return cache;
+}
 
-// TODO: create in TEMP directory instead?
-static WCHAR* GetThumbnailPath(const WCHAR* filePath) {
-    // create a fingerprint of a (normalized) path for the file name
+static bool GetFingerPrint(const WCHAR* filePath, u8 digest[16]) {
     // I'd have liked to also include the file's last modification time
     // in the fingerprint (much quicker than hashing the entire file's
     // content), but that's too expensive for files on slow drives
-    unsigned char digest[16];
     // TODO: why is this happening? Seen in crash reports e.g. 35043
     if (!filePath) {
-        return nullptr;
+        return false;
     }
     AutoFree pathU(strconv::WstrToUtf8(filePath));
     if (!pathU.Get()) {
-        return nullptr;
+        return false;
     }
     if (path::HasVariableDriveLetter(filePath)) {
         pathU.Get()[0] = '?'; // ignore the drive letter, if it might change
     }
     CalcMD5Digest((unsigned char*)pathU.Get(), str::Len(pathU.Get()), digest);
-    AutoFree fingerPrint(_MemToHex(&digest));
+    return true;
+}
 
-    AutoFreeWstr thumbsPath(AppGenDataFilename(THUMBNAILS_DIR_NAME));
-    if (!thumbsPath) {
-        return nullptr;
+static bool ReadAt(HANDLE h, u32 offset, void* buf, u32 size) {
+    LARGE_INTEGER off;
+    off.QuadPart = offset;
+    if (!SetFilePointerEx(h, off, nullptr, FILE_BEGIN)) {
+        return false;
+    }
+    DWORD nRead = 0;
+    return ReadFile(h, buf, size, &nRead, nullptr) && nRead == size;
+}
+
+static bool WriteAt(HANDLE h, u32 offset, const void* buf, u32 size) {
+    LARGE_INTEGER off;
+    off.QuadPart = offset;
+    if (!SetFilePointerEx(h, off, nullptr, FILE_BEGIN)) {
+        return false;
+    }
+    DWORD nWritten = 0;
+    return WriteFile(h, buf, size, &nWritten, nullptr) && nWritten == size;
+}
+
+// Note: make sure to only call with access
+static void EnsureIndexLoaded(ThumbnailCache& cache) {
+    if (cache.indexLoaded) {
+        return;
+    }
+    cache.indexLoaded = true;
+    AutoFreeWstr path(AppGenDataFilename(THUMBNAILS_FILE_NAME));
+    if (!path) {
+        return;
+    }
+    AutoCloseHandle h(file::OpenReadOnly(path));
+    if (!h.IsValid()) {
+        return;
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(h, &fileSize) || fileSize.QuadPart < sizeof(ThumbnailsTrailer) ||
+        fileSize.QuadPart > UINT32_MAX) {
+        return;
+    }
+    u32 trailerOffset = (u32)fileSize.QuadPart - sizeof(ThumbnailsTrailer);
+    ThumbnailsTrailer trailer;
+    if (!ReadAt(h, trailerOffset, &trailer, sizeof(trailer)) || trailer.magic != THUMBNAILS_FILE_MAGIC) {
+        return;
+    }
+    if (trailer.indexOffset > trailerOffset ||
+        trailerOffset - trailer.indexOffset != trailer.count * sizeof(ThumbnailIndexEntry)) {
+        return;
+    }
+    Vec<ThumbnailIndexEntry> index;
+    ThumbnailIndexEntry* entries = index.AppendBlanks(trailer.count);
+    if (!entries || !ReadAt(h, trailer.indexOffset, entries, trailer.count * sizeof(ThumbnailIndexEntry))) {
+        return;
+    }
+    for (ThumbnailIndexEntry& e : index) {
+        if (e.offset > trailer.indexOffset || e.size > trailer.indexOffset - e.offset) {
+            return;
+        }
+    }
+    cache.index = std::move(index);
+    cache.dataEnd = trailer.indexOffset;
+}
+
+// Note: make sure to only call with access
+static int FindIndexEntry(ThumbnailCache& cache, const u8 fingerPrint[16]) {
+    for (int i = 0; i < cache.index.isize(); i++) {
+        if (memcmp(cache.index.at(i).fingerPrint, fingerPrint, 16) == 0) {
+            return i;
+        }
     }
-    AutoFreeWstr fname(strconv::FromAnsi(fingerPrint));
+    return -1;
+}
+
+static HANDLE OpenThumbnailsFileForWriting() {
+    AutoFreeWstr path(AppGenDataFilename(THUMBNAILS_FILE_NAME));
+    if (!path) {
+        return INVALID_HANDLE_VALUE;
+    }
+    AutoFreeWstr dir(path::GetDir(path));
+    dir::Create(dir);
+    return CreateFileW(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+}
 
-    return str::Format(L"%s\\%s.png", thumbsPath.Get(), fname.Get());
+// Note: make sure to only call with access
+static bool WriteIndex(HANDLE h, ThumbnailCache& cache) {
+    u32 indexSize = (u32)(cache.index.size() * sizeof(ThumbnailIndexEntry));
+    ThumbnailsTrailer trailer{cache.dataEnd, (u32)cache.index.size(), THUMBNAILS_FILE_MAGIC};
+    bool ok = WriteAt(h, cache.dataEnd, cache.index.LendData(), indexSize);
+    ok = ok && WriteAt(h, cache.dataEnd + indexSize, &trailer, sizeof(trailer));
+    return ok && SetEndOfFile(h);
 }
 
 // removes thumbnails that don't belong to any frequently used item in file history
 void CleanUpThumbnailCache(const FileHistory& fileHistory) {
     AutoFreeWstr thumbsPath(AppGenDataFilename(THUMBNAILS_DIR_NAME));
-    if (!thumbsPath)
+    if (!thumbsPath) {
         return;
-    AutoFreeWstr pattern(path::Join(thumbsPath, L"*.png"));
+    }
 
-    WStrVec files;
+    // thumbnails from before they were packed into a single file
+    AutoFreeWstr pattern(path::Join(thumbsPath, L"*.png"));
     WIN32_FIND_DATA fdata;
-
     HANDLE hfind = FindFirstFile(pattern, &fdata);
-    if (INVALID_HANDLE_VALUE == hfind)
-        return;
-    do {
-        if (!(fdata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
-            files.Append(str::Dup(fdata.cFileName));
-    } while (FindNextFile(hfind, &fdata));
-    FindClose(hfind);
+    if (INVALID_HANDLE_VALUE != hfind) {
+        do {
+            if (!(fdata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+                AutoFreeWstr bmpPath(path::Join(thumbsPath, fdata.cFileName));
+                file::Delete(bmpPath);
+            }
+        } while (FindNextFile(hfind, &fdata));
+        FindClose(hfind);
+    }
 
     Vec<DisplayState*> list;
     fileHistory.GetFrequencyOrder(list);
+
+    ThumbnailCache& cache = GetThumbnailCache();
+    ScopedCritSec scope(&cache.access);
+    EnsureIndexLoaded(cache);
+    if (cache.index.size() == 0) {
+        return;
+    }
+
+    Vec<ThumbnailIndexEntry> keep;
     for (size_t i = 0; i < list.size() && i < FILE_HISTORY_MAX_FREQUENT * 2; i++) {
-        AutoFreeWstr bmpPath(GetThumbnailPath(list.at(i)->filePath));
-        if (!bmpPath)
+        u8 fingerPrint[16];
+        if (!GetFingerPrint(list.at(i)->filePath, fingerPrint)) {
             continue;
-        int idx = files.Find(path::GetBaseNameNoFree(bmpPath));
+        }
+        int idx = FindIndexEntry(cache, fingerPrint);
         if (idx != -1) {
-            CrashIf(idx < 0 || files.size() <= (size_t)idx);
-            free(files.PopAt(idx));
+            keep.Append(cache.index.at(idx));
         }
     }
+    u32 usedSize = 0;
+    for (ThumbnailIndexEntry& e : keep) {
+        usedSize += e.size;
+    }
+    if (keep.size() == cache.index.size() && usedSize == cache.dataEnd) {
+        return;
+    }
 
-    for (size_t i = 0; i < files.size(); i++) {
-        AutoFreeWstr bmpPath(path::Join(thumbsPath, files.at(i)));
-        file::Delete(bmpPath);
+    // move the data of the remaining thumbnails to the start of the file
+    AutoCloseHandle h(OpenThumbnailsFileForWriting());
+    if (!h.IsValid()) {
+        return;
+    }
+    ScopedMem<u8> data((u8*)malloc(usedSize ? usedSize : 1));
+    if (!data) {
+        return;
+    }
+    cache.index.Reset();
+    cache.dataEnd = 0;
+    for (ThumbnailIndexEntry& e : keep) {
+        if (ReadAt(h, e.offset, data.Get() + cache.dataEnd, e.size)) {
+            e.offset = cache.dataEnd;
+            cache.dataEnd += e.size;
+            cache.index.Append(e);
+        }
+    }
+    if (!WriteAt(h, 0, data.Get(), cache.dataEnd) || !WriteIndex(h, cache)) {
+        cache.index.Reset();
+        cache.dataEnd = 0;
+        WriteIndex(h, cache);
     }
 }
 
@@ -123,12 +284,8 @@ using Gdiplus::PointF;
 using Gdiplus::RectF;
 using Gdiplus::SizeF;
 
-static RenderedBitmap* LoadRenderedBitmap(const WCHAR* filePath) {
-    AutoFree data(file::ReadFile(filePath));
-    if (!data.data) {
-        return nullptr;
-    }
-    Gdiplus::Bitmap* bmp = BitmapFromData(data.data, data.size());
+static RenderedBitmap* LoadRenderedBitmap(std::string_view data) {
+    Gdiplus::Bitmap* bmp = BitmapFromData(data.data(), data.size());
     if (!bmp) {
         return nullptr;
     }
@@ -143,43 +300,90 @@ static RenderedBitmap* LoadRenderedBitmap(const WCHAR* filePath) {
     return rendered;
 }
 
-bool LoadThumbnail(DisplayState& ds) {
-    delete ds.thumbnail;
-    ds.thumbnail = nullptr;
+// reading and decoding the thumbnail and checking whether the document
+// has changed since can take a while (e.g. for documents on network drives)
+static RenderedBitmap* LoadThumbnail(const WCHAR* filePath) {
+    u8 fingerPrint[16];
+    if (!GetFingerPrint(filePath, fingerPrint)) {
+        return nullptr;
+    }
 
-    AutoFreeWstr bmpPath(GetThumbnailPath(ds.filePath));
-    if (!bmpPath) {
-        return false;
+    ThumbnailIndexEntry entry;
+    AutoFree data;
+    {
+        ThumbnailCache& cache = GetThumbnailCache();
+        ScopedCritSec scope(&cache.access);
+        EnsureIndexLoaded(cache);
+        int idx = FindIndexEntry(cache, fingerPrint);
+        if (idx == -1) {
+            return nullptr;
+        }
+        entry = cache.index.at(idx);
+        AutoFreeWstr path(AppGenDataFilename(THUMBNAILS_FILE_NAME));
+        AutoCloseHandle h(file::OpenReadOnly(path));
+        char* d = (char*)malloc(entry.size);
+        if (!h.IsValid() || !d || !ReadAt(h, entry.offset, d, entry.size)) {
+            free(d);
+            return nullptr;
+        }
+        data.data = d;
+        data.len = entry.size;
+    }
+
+    // the thumbnail is outdated if the file is newer than the thumbnail
+    // (which can't be checked while the file's network drive is unreachable)
+    if (path::IsVolumeReachable(filePath)) {
+        FILETIME fileTime = file::GetModificationTime(filePath);
+        if (FileTimeDiffInSecs(fileTime, entry.fileTime) > 0) {
+            return nullptr;
+        }
     }
 
-    RenderedBitmap* bmp = LoadRenderedBitmap(bmpPath);
-    if (!bmp || bmp->Size().IsEmpty()) {
+    RenderedBitmap* bmp = LoadRenderedBitmap({data.Get(), data.size()});
+    if (bmp && bmp->Size().IsEmpty()) {
         delete bmp;
-        return false;
+        bmp = nullptr;
     }
+    return bmp;
+}
 
-    ds.thumbnail = bmp;
-    return true;
+void LoadThumbnailAsync(const WCHAR* filePath, const std::function<void(RenderedBitmap*)>& onLoaded) {
+    WCHAR* path = str::Dup(filePath);
+    QueueWork(WorkPriority::Background, [path, onLoaded] {
+        RenderedBitmap* bmp = LoadThumbnail(path);
+        free(path);
+        uitask::Post([bmp, onLoaded] { onLoaded(bmp); });
+    });
 }
 
 bool HasThumbnail(DisplayState& ds) {
-    if (!ds.thumbnail && !LoadThumbnail(ds)) {
-        return false;
+    u8 fingerPrint[16];
+    if (!GetFingerPrint(ds.filePath, fingerPrint)) {
+        return ds.thumbnail != nullptr;
     }
-
-    AutoFreeWstr bmpPath(GetThumbnailPath(ds.filePath));
-    if (!bmpPath) {
+    FILETIME thumbTime;
+    {
+        ThumbnailCache& cache = GetThumbnailCache();
+        ScopedCritSec scope(&cache.access);
+        EnsureIndexLoaded(cache);
+        int idx = FindIndexEntry(cache, fingerPrint);
+        if (idx == -1) {
+            return ds.thumbnail != nullptr;
+        }
+        thumbTime = cache.index.at(idx).fileTime;
+    }
+    if (!path::IsVolumeReachable(ds.filePath)) {
         return true;
     }
-    FILETIME bmpTime = file::GetModificationTime(bmpPath);
+
     FILETIME fileTime = file::GetModificationTime(ds.filePath);
     // delete the thumbnail if the file is newer than the thumbnail
-    if (FileTimeDiffInSecs(fileTime, bmpTime) > 0) {
+    if (FileTimeDiffInSecs(fileTime, thumbTime) > 0) {
         delete ds.thumbnail;
         ds.thumbnail = nullptr;
+        return false;
     }
-
-    return ds.thumbnail != nullptr;
+    return true;
 }
 
 void SetThumbnail(DisplayState* ds, RenderedBitmap* bmp) {
@@ -193,33 +397,74 @@ void SetThumbnail(DisplayState* ds, RenderedBitmap* bmp) {
     SaveThumbnail(*ds);
 }
 
+static std::string_view EncodeThumbnailAsPng(RenderedBitmap* thumbnail) {
+    IStream* stream = nullptr;
+    if (FAILED(CreateStreamOnHGlobal(nullptr, TRUE, &stream))) {
+        return {};
+    }
+    Gdiplus::Bitmap bmp(thumbnail->GetBitmap(), nullptr);
+    CLSID tmpClsid = GetEncoderClsid(L"image/png");
+    std::string_view data;
+    if (bmp.Save(stream, &tmpClsid, nullptr) == Gdiplus::Ok) {
+        data = GetDataFromStream(stream, nullptr);
+    }
+    stream->Release();
+    return data;
+}
+
 void SaveThumbnail(DisplayState& ds) {
-    if (!ds.thumbnail) {
+    u8 fingerPrint[16];
+    if (!ds.thumbnail || !GetFingerPrint(ds.filePath, fingerPrint)) {
+        return;
+    }
+    AutoFree data(EncodeThumbnailAsPng(ds.thumbnail));
+    if (!data.Get()) {
         return;
     }
 
-    AutoFreeWstr bmpPath(GetThumbnailPath(ds.filePath));
-    if (!bmpPath) {
+    ThumbnailIndexEntry entry;
+    memcpy(entry.fingerPrint, fingerPrint, sizeof(fingerPrint));
+    entry.fileTime = file::GetModificationTime(ds.filePath);
+    entry.size = (u32)data.size();
+
+    ThumbnailCache& cache = GetThumbnailCache();
+    ScopedCritSec scope(&cache.access);
+    EnsureIndexLoaded(cache);
+    AutoCloseHandle h(OpenThumbnailsFileForWriting());
+    if (!h.IsValid()) {
         return;
     }
-    AutoFreeWstr thumbsPath(path::GetDir(bmpPath));
-    if (dir::Create(thumbsPath)) {
-        CrashIf(!str::EndsWithI(bmpPath, L".png"));
-        Gdiplus::Bitmap bmp(ds.thumbnail->GetBitmap(), nullptr);
-        CLSID tmpClsid = GetEncoderClsid(L"image/png");
-        bmp.Save(bmpPath.Get(), &tmpClsid, nullptr);
+    entry.offset = cache.dataEnd;
+    if (!WriteAt(h, entry.offset, data.Get(), entry.size)) {
+        return;
     }
+    int idx = FindIndexEntry(cache, fingerPrint);
+    if (idx != -1) {
+        cache.index.RemoveAt(idx);
+    }
+    cache.index.Append(entry);
+    cache.dataEnd += entry.size;
+    WriteIndex(h, cache);
 }
 
 void RemoveThumbnail(DisplayState& ds) {
-    if (!HasThumbnail(ds)) {
+    delete ds.thumbnail;
+    ds.thumbnail = nullptr;
+
+    u8 fingerPrint[16];
+    if (!GetFingerPrint(ds.filePath, fingerPrint)) {
         return;
     }
-
-    AutoFreeWstr bmpPath(GetThumbnailPath(ds.filePath));
-    if (bmpPath) {
-        file::Delete(bmpPath);
+    ThumbnailCache& cache = GetThumbnailCache();
+    ScopedCritSec scope(&cache.access);
+    EnsureIndexLoaded(cache);
+    int idx = FindIndexEntry(cache, fingerPrint);
+    if (idx == -1) {
+        return;
+    }
+    cache.index.RemoveAt(idx);
+    AutoCloseHandle h(OpenThumbnailsFileForWriting());
+    if (h.IsValid()) {
+        WriteIndex(h, cache);
     }
-    delete ds.thumbnail;
-    ds.thumbnail = nullptr;
 }
@@ -7,7 +7,10 @@
 
 void CleanUpThumbnailCache(const FileHistory& fileHistory);
 
-bool LoadThumbnail(DisplayState& ds);
+// loads the thumbnail on a background thread. onLoaded is called on the ui thread
+// with the thumbnail or nullptr if there's none (or it's outdated). onLoaded
+// takes ownership of the thumbnail
+void LoadThumbnailAsync(const WCHAR* filePath, const std::function<void(RenderedBitmap*)>& onLoaded);
 bool HasThumbnail(DisplayState& ds);
 // takes ownership of bmp
 void SetThumbnail(DisplayState* ds, RenderedBitmap* bmp);
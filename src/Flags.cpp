@@ -3,6 +3,7 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/CmdLineParser.h"
+#include "utils/FileUtil.h"
 #include "utils/WinUtil.h"
 #include "utils/Log.h"
 
@@ -76,7 +77,24 @@ static const char* argNames =
     "new-window\0"
     "log\0"
     "s\0"
-    "silent\0";
+    "silent\0"
+    "bench-format\0"
+    "bench-repeat\0"
+    "bench-warmup\0"
+    "bench-zoom\0"
+    "bench-dpi\0"
+    "bench-rotation\0"
+    "bench-parallel\0"
+    "trace\0"
+    "memstats\0"
+    "print-list\0"
+    "render-pages\0"
+    "render-dpi\0"
+    "render-threads\0"
+    "stress-jobs\0"
+    "stress-list\0"
+    "stress-report\0"
+    "render-worker\0";
 
 enum {
     RegisterForPdf,
@@ -141,11 +159,34 @@ enum {
     NewWindow,
     Log,
     Silent2,
-    Silent
+    Silent,
+    BenchFormat,
+    BenchRepeat,
+    BenchWarmup,
+    BenchZoom,
+    BenchDpi,
+    BenchRotation,
+    BenchParallel,
+    Trace,
+    MemStats,
+    PrintList,
+    RenderPages,
+    RenderDpi,
+    RenderThreads,
+    StressJobs,
+    StressList,
+    StressReport,
+    RenderWorker,
 };
 
 Flags::~Flags() {
     free(printerName);
+    free(benchFormat);
+    free(benchParallelPath);
+    free(renderPagesPattern);
+    free(renderPagesRanges);
+    free(tracePath);
+    free(memStatsPath);
     free(printSettings);
     free(forwardSearchOrigin);
     free(destName);
@@ -155,6 +196,7 @@ Flags::~Flags() {
     free(stressTestPath);
     free(stressTestFilter);
     free(stressTestRanges);
+    free(stressReportPath);
     free(lang);
 }
 
@@ -293,6 +335,27 @@ static void ParseScrollValue(Point* scroll, const WCHAR* txt) {
         *scroll = Point(x, y);
 }
 
+// adds the paths listed in a (UTF-8) text file, one per line
+static void AddFileNamesFromList(WStrVec& fileNames, const WCHAR* listPath) {
+    AutoFree data(file::ReadFile(listPath));
+    if (!data.data) {
+        return;
+    }
+    const char* s = data.data;
+    if (str::StartsWith(s, UTF8_BOM)) {
+        s += 3;
+    }
+    AutoFreeWstr text(strconv::Utf8ToWstr(s));
+    WStrVec lines;
+    lines.Split(text, L"\n", true);
+    for (WCHAR* line : lines) {
+        str::TrimWS(line, TrimOpt::Both);
+        if (!str::IsEmpty(line)) {
+            fileNames.Append(str::Dup(line));
+        }
+    }
+}
+
 static int GetArgNo(const WCHAR* argName) {
     if (*argName == '-' || *argName == '/') {
         argName++;
@@ -421,6 +484,20 @@ void ParseCommandLine(const WCHAR* cmdLine, Flags& i) {
             }
         } else if (is_arg_with_param(ArgN)) {
             handle_int_param(i.stressParallelCount);
+        } else if (is_arg_with_param(StressJobs)) {
+            // -stress-test <dir> -stress-jobs <n> splits the files among n processes
+            handle_int_param(i.stressJobs);
+        } else if (is_arg_with_param(StressList)) {
+            // -stress-list <file> stress tests the files listed in a text file
+            // (used for the processes started by -stress-jobs)
+            AddFileNamesFromList(i.stressTestFiles, param);
+            str::ReplacePtr(&i.stressTestPath, param);
+            ++n;
+        } else if (is_arg_with_param(StressReport)) {
+            handle_string_param(i.stressReportPath);
+        } else if (RenderWorker == arg) {
+            // used for the processes started by RenderWorker
+            i.renderWorker = true;
         } else if (is_arg_with_param(Render)) {
             handle_int_param(i.pageNumber);
             i.testRenderPage = true;
@@ -467,6 +544,55 @@ void ParseCommandLine(const WCHAR* cmdLine, Flags& i) {
             }
             i.pathsToBenchmark.Append(s);
             i.exitImmediately = true;
+        } else if (is_arg_with_param(BenchFormat)) {
+            // -bench-format [json|csv]
+            handle_string_param(i.benchFormat);
+        } else if (is_arg_with_param(BenchRepeat)) {
+            handle_int_param(i.benchRepeat);
+        } else if (is_arg_with_param(BenchWarmup)) {
+            handle_int_param(i.benchWarmup);
+        } else if (is_arg_with_param(BenchZoom)) {
+            // -bench-zoom n (in percent, fit modes aren't supported)
+            str::Parse(param, L"%f", &i.benchZoom);
+            if (i.benchZoom <= 0) {
+                i.benchZoom = 100.f;
+            }
+            ++n;
+        } else if (is_arg_with_param(BenchDpi)) {
+            str::Parse(param, L"%f", &i.benchDpi);
+            ++n;
+        } else if (is_arg_with_param(BenchRotation)) {
+            handle_int_param(i.benchRotation);
+        } else if (is_arg_with_param(BenchParallel)) {
+            // -bench-parallel <path> [<max thread count>] (defaults to the number of processors)
+            handle_string_param(i.benchParallelPath);
+            if (has_additional_param() && str::IsDigit(*additional_param())) {
+                handle_int_param(i.benchParallelThreads);
+            }
+            i.exitImmediately = true;
+        } else if (is_arg_with_param(RenderPages)) {
+            // -render-pages <output pattern> [<page ranges>] e.g.
+            // -render-pages "out\%s-%03d.png" 1-3,7 *.pdf
+            // %s is replaced with the file's name and %d with the page number
+            handle_string_param(i.renderPagesPattern);
+            if (has_additional_param() && IsValidPageRange(additional_param())) {
+                handle_string_param(i.renderPagesRanges);
+            }
+            i.exitImmediately = true;
+        } else if (is_arg_with_param(RenderDpi)) {
+            str::Parse(param, L"%f", &i.renderPagesDpi);
+            ++n;
+        } else if (is_arg_with_param(RenderThreads)) {
+            handle_int_param(i.renderPagesThreads);
+        } else if (is_arg_with_param(Trace)) {
+            handle_string_param(i.tracePath);
+        } else if (is_arg_with_param(MemStats)) {
+            handle_string_param(i.memStatsPath);
+        } else if (is_arg_with_param(PrintList)) {
+            // -print-list <file> adds the files listed in a text file (e.g. for
+            // batch printing with -print-to, together with files and directories)
+            AddFileNamesFromList(i.fileNames, param);
+            ++n;
         } else if (CrashOnOpen == arg) {
             // to make testing of crash reporting system in pre-release/release
             // builds possible
@@ -16,6 +16,26 @@ class Flags {
     //   to benchmark. It can also be a string "loadonly" which means we'll
     //   only benchmark loading of the catalog
     WStrVec pathsToBenchmark;
+    // -bench-format json|csv writes results to stdout instead of only logging them
+    WCHAR* benchFormat = nullptr;
+    // how often each page is rendered and timed (for min/median/p95)
+    int benchRepeat = 1;
+    // how often each page is rendered before it's timed
+    int benchWarmup = 0;
+    // in percent (like -zoom), -bench-dpi overrides it if set
+    float benchZoom = 100.f;
+    float benchDpi = 0;
+    int benchRotation = 0;
+    // -bench-parallel <path> [<max thread count>]
+    WCHAR* benchParallelPath = nullptr;
+    int benchParallelThreads = 0;
+    // -render-pages <output pattern> [<page ranges>] renders fileNames to image files
+    WCHAR* renderPagesPattern = nullptr;
+    WCHAR* renderPagesRanges = nullptr;
+    // defaults to the file's DPI (i.e. 100% zoom)
+    float renderPagesDpi = 0;
+    // defaults to the number of processors
+    int renderPagesThreads = 0;
     bool exitWhenDone = false;
     bool printDialog = false;
     WCHAR* printerName = nullptr;
@@ -54,6 +74,18 @@ class Flags {
     int stressTestCycles = 1;
     int stressParallelCount = 1;
     bool stressRandomizeFiles = false;
+    // -stress-jobs <n> runs the stress test in n processes (restarting them
+    // on crashes and hangs) and merges their results (cf. RunStressTestJobs)
+    int stressJobs = 0;
+    // files from -stress-list <file> (in which case that's also stressTestPath)
+    WStrVec stressTestFiles;
+    // -stress-report <file> appends the result for every file to it
+    // (for -stress-jobs, the merged results are written there)
+    WCHAR* stressReportPath = nullptr;
+
+    // -render-worker renders the pages requested through stdin
+    // (cf. RenderWorker and GlobalPrefs::renderInSeparateProcess)
+    bool renderWorker = false;
 
     // related to testing
     bool testRenderPage = false;
@@ -63,6 +95,14 @@ class Flags {
 
     bool crashOnOpen = false;
 
+    // -trace <path> records timing spans of hot code paths to a
+    // chrome://tracing JSON file, -trace etw emits them as ETW events
+    WCHAR* tracePath = nullptr;
+
+    // -memstats <path> writes a memory usage report (cf. MemStats.h)
+    // when exiting, i.e. after all documents have been closed
+    WCHAR* memStatsPath = nullptr;
+
     // deprecated flags
     char* lang = nullptr;
     WStrVec globalPrefArgs;
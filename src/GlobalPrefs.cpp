@@ -71,6 +71,14 @@ char* SerializeGlobalPrefs(GlobalPrefs* gp, const char* prevData, size_t* sizeOu
     return serialized;
 }
 
+GlobalPrefs* NewGlobalPrefsFromBin(std::string_view data) {
+    return (GlobalPrefs*)DeserializeStructBin(&gGlobalPrefsInfo, data);
+}
+
+char* SerializeGlobalPrefsBin(GlobalPrefs* gp, size_t* sizeOut) {
+    return SerializeStructBin(&gGlobalPrefsInfo, gp, sizeOut);
+}
+
 void DeleteGlobalPrefs(GlobalPrefs* gp) {
     if (!gp) {
         return;
@@ -99,6 +107,26 @@ TabState* NewTabState(DisplayState* ds) {
     return state;
 }
 
+TabState* CloneTabState(TabState* state) {
+    TabState* clone = (TabState*)DeserializeStruct(&gTabStateInfo, nullptr);
+    str::ReplacePtr(&clone->filePath, state->filePath);
+    str::ReplacePtr(&clone->displayMode, state->displayMode);
+    clone->pageNo = state->pageNo;
+    str::ReplacePtr(&clone->zoom, state->zoom);
+    clone->rotation = state->rotation;
+    clone->scrollPos = state->scrollPos;
+    clone->showToc = state->showToc;
+    *clone->tocState = *state->tocState;
+    return clone;
+}
+
+void DeleteTabState(TabState* state) {
+    if (!state) {
+        return;
+    }
+    FreeStruct(&gTabStateInfo, state);
+}
+
 void ResetSessionState(Vec<SessionData*>* sessionData) {
     CrashIf(!sessionData);
     for (SessionData* data : *sessionData) {
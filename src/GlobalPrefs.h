@@ -20,10 +20,14 @@ void DeleteFavorite(Favorite* fav);
 
 GlobalPrefs* NewGlobalPrefs(const char* data);
 char* SerializeGlobalPrefs(GlobalPrefs* gp, const char* prevData, size_t* sizeOut);
+GlobalPrefs* NewGlobalPrefsFromBin(std::string_view data);
+char* SerializeGlobalPrefsBin(GlobalPrefs* gp, size_t* sizeOut);
 void DeleteGlobalPrefs(GlobalPrefs* gp);
 
 SessionData* NewSessionData();
 TabState* NewTabState(DisplayState* ds);
+TabState* CloneTabState(TabState* state);
+void DeleteTabState(TabState* state);
 void ResetSessionState(Vec<SessionData*>* sessionData);
 
 // TODO: those are actually defined in SettingsStructs.cpp
@@ -2,6 +2,7 @@
    License: Simplified BSD (see COPYING.BSD) */
 
 #include "utils/BaseUtil.h"
+#include "utils/ScopedWin.h"
 #include "utils/GdiPlusUtil.h"
 #include "utils/HtmlParserLookup.h"
 #include "utils/CssParser.h"
@@ -9,6 +10,7 @@
 #include "utils/Log.h"
 #include "mui/Mui.h"
 #include "utils/Timer.h"
+#include "utils/Trace.h"
 
 // rendering engines
 #include "EbookBase.h"
@@ -160,6 +162,46 @@ void StyleRule::Merge(StyleRule& source) {
     }
 }
 
+ReparseData::ReparseData(const ReparseData& other) {
+    *this = other;
+}
+
+ReparseData& ReparseData::operator=(const ReparseData& other) {
+    if (this == &other) {
+        return *this;
+    }
+    reparseIdx = other.reparseIdx;
+    defaultFont = other.defaultFont;
+    styleStack = other.styleStack;
+    nextPageStyle = other.nextPageStyle;
+    listDepth = other.listDepth;
+    preFormatted = other.preFormatted;
+    dirRtl = other.dirRtl;
+    tagNesting = other.tagNesting;
+    if (styleRules != other.styleRules) {
+        if (styleRules) {
+            styleRules->Release();
+        }
+        styleRules = other.styleRules ? other.styleRules->AddRef() : nullptr;
+    }
+    // this is copied for every line, so avoid re-allocating the path
+    if (!str::Eq(pagePath, other.pagePath)) {
+        pagePath.SetCopy(other.pagePath);
+    }
+    hiddenDepth = other.hiddenDepth;
+    section = other.section;
+    titleCount = other.titleCount;
+    return *this;
+}
+
+ReparseData::~ReparseData() {
+    if (styleRules) {
+        styleRules->Release();
+    }
+}
+
+static void AppendIndexedRule(Vec<StyleRule>& rules, Vec<int>& index, StyleRule& rule);
+
 HtmlFormatter::HtmlFormatter(HtmlFormatterArgs* args)
     : pageDx(args->pageDx),
       pageDy(args->pageDy),
@@ -175,14 +217,17 @@ HtmlFormatter::HtmlFormatter(HtmlFormatterArgs* args)
       currPage(nullptr),
       finishedParsing(false),
       pageCount(0),
-      keepTagNesting(false) {
+      keepTagNesting(false),
+      sharedStyleRules(nullptr) {
     currReparseIdx = args->reparseIdx;
+    currLineReparseIdx = currReparseIdx;
     htmlParser = new HtmlPullParser(args->htmlStr.data(), args->htmlStr.size());
     htmlParser->SetCurrPosOff(currReparseIdx);
     CrashIf(!ValidReparseIdx(currReparseIdx, htmlParser));
 
     gfx = mui::AllocGraphicsForMeasureText();
     textMeasure = CreateTextRender(args->textRenderMethod, gfx, 10, 10);
+    textMeasure->measureCache = new mui::TextMeasureCache();
     defaultFontName.SetCopy(args->GetFontName());
     defaultFontSize = args->fontSize;
 
@@ -201,6 +246,26 @@ HtmlFormatter::HtmlFormatter(HtmlFormatterArgs* args)
     if (spaceDx2 < spaceDx)
         spaceDx = spaceDx2;
 
+    tokenState.defaultFont = CurrFont();
+    ReparseData* rd = GetReparseData(args);
+    if (rd) {
+        styleStack = rd->styleStack;
+        nextPageStyle = rd->nextPageStyle;
+        listDepth = rd->listDepth;
+        preFormatted = rd->preFormatted;
+        dirRtl = rd->dirRtl;
+        tagNesting = rd->tagNesting;
+        if (rd->styleRules) {
+            for (StyleRule& rule : rd->styleRules->rules) {
+                AppendIndexedRule(styleRules, styleRulesIndex, rule);
+            }
+            sharedStyleRules = rd->styleRules->AddRef();
+        }
+        textMeasure->SetFont(CurrFont());
+    }
+    SaveTokenState();
+    lineStartState = tokenState;
+
     EmitNewPage();
 }
 
@@ -211,6 +276,54 @@ HtmlFormatter::~HtmlFormatter() {
     delete textMeasure;
     mui::FreeGraphicsForMeasureText(gfx);
     delete htmlParser;
+    if (sharedStyleRules) {
+        sharedStyleRules->Release();
+    }
+}
+
+// returns the state to restart formatting at args->reparseIdx with
+// (or nullptr if there's none or it doesn't fit the formatter's args)
+ReparseData* HtmlFormatter::GetReparseData(HtmlFormatterArgs* args) {
+    ReparseData* rd = args->reparseData;
+    if (!rd || rd->reparseIdx != args->reparseIdx || rd->styleStack.size() == 0) {
+        return nullptr;
+    }
+    if (rd->defaultFont != tokenState.defaultFont) {
+        return nullptr;
+    }
+    return rd;
+}
+
+// derived formatters must call this from their constructor after having
+// restored their state (virtual methods can't be called from ours)
+void HtmlFormatter::UpdateInitialReparseData() {
+    SaveReparseData(&tokenState);
+    lineStartState = tokenState;
+    SaveReparseData(currPage->reparseData);
+}
+
+void HtmlFormatter::SaveTokenState() {
+    CrashIf(currReparseIdx > INT_MAX);
+    tokenState.reparseIdx = (int)currReparseIdx;
+    tokenState.styleStack = styleStack;
+    tokenState.nextPageStyle = nextPageStyle;
+    tokenState.listDepth = listDepth;
+    tokenState.preFormatted = preFormatted;
+    tokenState.dirRtl = dirRtl;
+    tokenState.tagNesting = tagNesting;
+    SaveReparseData(&tokenState);
+}
+
+ReparseData* HtmlFormatter::CreateReparseData(ReparseData& state) {
+    ReparseData* rd = new ReparseData(state);
+    // style rules rarely change, so pages share a single copy of them
+    if (!sharedStyleRules) {
+        sharedStyleRules = new SharedStyleRules();
+        sharedStyleRules->rules = styleRules;
+    }
+    CrashIf(rd->styleRules);
+    rd->styleRules = sharedStyleRules->AddRef();
+    return rd;
 }
 
 void HtmlFormatter::AppendInstr(DrawInstr di) {
@@ -218,6 +331,7 @@ void HtmlFormatter::AppendInstr(DrawInstr di) {
     if (-1 == currLineReparseIdx) {
         currLineReparseIdx = currReparseIdx;
         CrashIf(!ValidReparseIdx(currReparseIdx, htmlParser));
+        lineStartState = tokenState;
     }
 }
 
@@ -521,6 +635,8 @@ bool HtmlFormatter::FlushCurrLine(bool isParagraphBreak) {
         EmitNewPage();
         CrashIf(currLineReparseIdx > INT_MAX);
         currPage->reparseIdx = (int)currLineReparseIdx;
+        delete currPage->reparseData;
+        currPage->reparseData = CreateReparseData(lineStartState);
         createdPage = true;
     }
     SetYPos(currLineInstr, currY + currLineTopPadding);
@@ -548,6 +664,7 @@ bool HtmlFormatter::FlushCurrLine(bool isParagraphBreak) {
 void HtmlFormatter::EmitNewPage() {
     CrashIf(currReparseIdx > INT_MAX);
     currPage = new HtmlPage((int)currReparseIdx);
+    currPage->reparseData = CreateReparseData(tokenState);
     currPage->instructions.Append(DrawInstr::SetFont(nextPageStyle.font));
     currY = 0.f;
 }
@@ -939,37 +1056,103 @@ void HtmlFormatter::HandleTagPre(HtmlToken* t) {
     }
 }
 
-StyleRule* HtmlFormatter::FindStyleRule(HtmlTag tag, const char* clazz, size_t clazzLen) {
-    uint32_t classHash = clazz ? MurmurHash2(clazz, clazzLen) : 0;
-    for (size_t i = 0; i < styleRules.size(); i++) {
-        StyleRule& rule = styleRules.at(i);
-        if (tag == rule.tag && classHash == rule.classHash)
+// style sheets can contain thousands of rules (e.g. one per class),
+// so they're looked up through an open addressing hash index
+static size_t StyleRuleSlot(const Vec<int>& index, HtmlTag tag, uint32_t classHash) {
+    uint32_t h = classHash ^ ((uint32_t)tag * 0x9E3779B9);
+    return (h ^ (h >> 16)) & (index.size() - 1);
+}
+
+static StyleRule* FindIndexedRule(Vec<StyleRule>& rules, Vec<int>& index, HtmlTag tag, uint32_t classHash) {
+    if (index.size() == 0) {
+        return nullptr;
+    }
+    for (size_t slot = StyleRuleSlot(index, tag, classHash);; slot = (slot + 1) & (index.size() - 1)) {
+        int idx = index.at(slot);
+        if (0 == idx) {
+            return nullptr;
+        }
+        StyleRule& rule = rules.at(idx - 1);
+        if (tag == rule.tag && classHash == rule.classHash) {
             return &rule;
+        }
+    }
+}
+
+static void AppendIndexedRule(Vec<StyleRule>& rules, Vec<int>& index, StyleRule& rule) {
+    rules.Append(rule);
+    // keep the index at most half full
+    if (rules.size() * 2 > index.size()) {
+        size_t newSize = std::max(index.size() * 2, (size_t)64);
+        index.Reset();
+        index.AppendBlanks(newSize);
+        for (size_t i = 0; i + 1 < rules.size(); i++) {
+            size_t slot = StyleRuleSlot(index, rules.at(i).tag, rules.at(i).classHash);
+            while (index.at(slot) != 0) {
+                slot = (slot + 1) & (index.size() - 1);
+            }
+            index.at(slot) = (int)i + 1;
+        }
+    }
+    size_t slot = StyleRuleSlot(index, rule.tag, rule.classHash);
+    while (index.at(slot) != 0) {
+        slot = (slot + 1) & (index.size() - 1);
+    }
+    index.at(slot) = (int)rules.size();
+}
+
+void HtmlFormatter::ResetStyleRules() {
+    if (sharedStyleRules) {
+        sharedStyleRules->Release();
+        sharedStyleRules = nullptr;
     }
-    return nullptr;
+    styleRules.Reset();
+    styleRulesIndex.Reset();
+    computedRules.Reset();
+    computedRulesIndex.Reset();
+}
+
+StyleRule* HtmlFormatter::FindStyleRule(HtmlTag tag, uint32_t classHash) {
+    return FindIndexedRule(styleRules, styleRulesIndex, tag, classHash);
+}
+
+StyleRule* HtmlFormatter::FindStyleRule(HtmlTag tag, const char* clazz, size_t clazzLen) {
+    uint32_t classHash = clazz ? MurmurHash2(clazz, clazzLen) : 0;
+    return FindStyleRule(tag, classHash);
 }
 
 StyleRule HtmlFormatter::ComputeStyleRule(HtmlToken* t) {
-    StyleRule rule;
-    // get style rules ordered by specificity
-    StyleRule* prevRule = FindStyleRule(Tag_Body, nullptr, 0);
-    if (prevRule)
-        rule.Merge(*prevRule);
-    prevRule = FindStyleRule(Tag_Any, nullptr, 0);
-    if (prevRule)
-        rule.Merge(*prevRule);
-    prevRule = FindStyleRule(t->tag, nullptr, 0);
-    if (prevRule)
-        rule.Merge(*prevRule);
     // TODO: support multiple class names
     AttrInfo* attr = t->GetAttrByName("class");
-    if (attr) {
-        prevRule = FindStyleRule(Tag_Any, attr->val, attr->valLen);
+    uint32_t classHash = attr ? MurmurHash2(attr->val, attr->valLen) : 0;
+    StyleRule* computed = FindIndexedRule(computedRules, computedRulesIndex, t->tag, classHash);
+    StyleRule rule;
+    if (computed) {
+        rule.Merge(*computed);
+    } else {
+        // get style rules ordered by specificity
+        StyleRule* prevRule = FindStyleRule(Tag_Body, 0);
+        if (prevRule)
+            rule.Merge(*prevRule);
+        prevRule = FindStyleRule(Tag_Any, 0);
         if (prevRule)
             rule.Merge(*prevRule);
-        prevRule = FindStyleRule(t->tag, attr->val, attr->valLen);
+        prevRule = FindStyleRule(t->tag, 0);
         if (prevRule)
             rule.Merge(*prevRule);
+        if (attr) {
+            prevRule = FindStyleRule(Tag_Any, classHash);
+            if (prevRule)
+                rule.Merge(*prevRule);
+            prevRule = FindStyleRule(t->tag, classHash);
+            if (prevRule)
+                rule.Merge(*prevRule);
+        }
+        rule.tag = t->tag;
+        rule.classHash = classHash;
+        AppendIndexedRule(computedRules, computedRulesIndex, rule);
+        rule.tag = Tag_NotFound;
+        rule.classHash = 0;
     }
     attr = t->GetAttrByName("style");
     if (attr) {
@@ -993,10 +1176,17 @@ void HtmlFormatter::ParseStyleSheet(const char* data, size_t len) {
             } else {
                 rule.tag = sel->tag;
                 rule.classHash = sel->clazz ? MurmurHash2(sel->clazz, sel->clazzLen) : 0;
-                styleRules.Append(rule);
+                AppendIndexedRule(styleRules, styleRulesIndex, rule);
             }
         }
     }
+    // the rules in effect have to be re-computed
+    computedRules.Reset();
+    computedRulesIndex.Reset();
+    if (sharedStyleRules) {
+        sharedStyleRules->Release();
+        sharedStyleRules = nullptr;
+    }
 }
 
 void HtmlFormatter::HandleTagStyle(HtmlToken* t) {
@@ -1277,6 +1467,7 @@ static bool IsEmptyPage(HtmlPage* p) {
 // or more pages, which we remeber and send to the caller
 // if we detect accumulated pages.
 HtmlPage* HtmlFormatter::Next(bool skipEmptyPages) {
+    TraceSpan span("HtmlFormatter::Next");
     for (;;) {
         // send out all pages accumulated so far
         while (pagesToSend.size() > 0) {
@@ -1298,6 +1489,7 @@ HtmlPage* HtmlFormatter::Next(bool skipEmptyPages) {
 
         currReparseIdx = t->GetReparsePoint() - htmlParser->Start();
         CrashIf(!ValidReparseIdx(currReparseIdx, htmlParser));
+        SaveTokenState();
         if (t->IsTag())
             HandleHtmlTag(t);
         else if (!IgnoreText())
@@ -1324,6 +1516,156 @@ Vec<HtmlPage*>* HtmlFormatter::FormatAllPages(bool skipEmptyPages) {
     return pages;
 }
 
+// limit for the memory used by decoded images
+#define MAX_IMAGE_CACHE_SIZE (64 * 1024 * 1024)
+
+// decoded image, scaled down to the size it's displayed at
+struct CachedImage {
+    const char* data = nullptr;
+    size_t len = 0;
+    // guards against data having been freed and reallocated for another image
+    u32 hash = 0;
+    // size the image was requested at (empty for its own size)
+    Size size;
+    Bitmap* bmp = nullptr;
+    size_t bmpSize = 0;
+};
+
+// images of ebook pages are drawn both by EbookController and by EngineEbook,
+// so that both can share their decoded images (and a single memory limit)
+struct ImageCache {
+    // pages are also drawn on rendering threads and GDI+ bitmaps can't be used
+    // by several threads at once, so entries are only used while holding this
+    CRITICAL_SECTION access;
+    // most recently used image first
+    Vec<CachedImage> images;
+    size_t totalSize = 0;
+
+    ImageCache() {
+        InitializeCriticalSection(&access);
+    }
+};
+
+static ImageCache& GetImageCache() {
+    static ImageCache cache;
+    return cache;
+}
+
+// hashing the beginning and the end is enough to tell images apart
+static u32 HashImageData(const ImageData& img) {
+    size_t n = std::min(img.len, (size_t)1024);
+    u32 hash = MurmurHash2(img.data, n);
+    if (img.len > n) {
+        hash ^= MurmurHash2(img.data + img.len - n, n);
+    }
+    return hash;
+}
+
+// scaling an image down once is much cheaper than decoding it
+// and having GDI+ scale it on every repaint
+static Bitmap* DecodeImage(const ImageData& img, Size size) {
+    Bitmap* bmp = BitmapFromData(img.data, img.len);
+    if (!bmp || bmp->GetLastStatus() != Ok) {
+        delete bmp;
+        return nullptr;
+    }
+    int dx = (int)bmp->GetWidth();
+    int dy = (int)bmp->GetHeight();
+    if (size.IsEmpty() || (i64)size.dx * size.dy >= (i64)dx * dy) {
+        return bmp;
+    }
+    Bitmap* scaled = new Bitmap(size.dx, size.dy, PixelFormat32bppPARGB);
+    Status status = scaled->GetLastStatus();
+    if (Ok == status) {
+        Graphics g(scaled);
+        g.SetInterpolationMode(InterpolationModeHighQualityBicubic);
+        g.SetPixelOffsetMode(Gdiplus::PixelOffsetModeHalf);
+        RectF r(0, 0, (float)size.dx, (float)size.dy);
+        status = g.DrawImage(bmp, r, 0, 0, (float)dx, (float)dy, UnitPixel);
+    }
+    delete bmp;
+    if (status != Ok) {
+        delete scaled;
+        return nullptr;
+    }
+    return scaled;
+}
+
+// must be called while holding ImageCache::access (the returned bitmap
+// may only be used until then). Images are decoded while holding the
+// lock so that two threads never decode the same image
+static Bitmap* GetCachedImage(ImageCache& cache, const ImageData& img, Size size) {
+    u32 hash = HashImageData(img);
+    for (size_t i = 0; i < cache.images.size(); i++) {
+        CachedImage& ci = cache.images.at(i);
+        if (ci.data == img.data && ci.len == img.len && ci.hash == hash && ci.size == size) {
+            CachedImage found = cache.images.PopAt(i);
+            cache.images.InsertAt(0, found);
+            return found.bmp;
+        }
+    }
+
+    Bitmap* bmp = DecodeImage(img, size);
+    if (!bmp) {
+        return nullptr;
+    }
+    CachedImage ci;
+    ci.data = img.data;
+    ci.len = img.len;
+    ci.hash = hash;
+    ci.size = size;
+    ci.bmp = bmp;
+    ci.bmpSize = (size_t)bmp->GetWidth() * bmp->GetHeight() * 4;
+    cache.images.InsertAt(0, ci);
+    cache.totalSize += ci.bmpSize;
+    // always keep the image just decoded, even if it alone exceeds the limit
+    while (cache.totalSize > MAX_IMAGE_CACHE_SIZE && cache.images.size() > 1) {
+        CachedImage last = cache.images.Pop();
+        cache.totalSize -= last.bmpSize;
+        delete last.bmp;
+    }
+    return bmp;
+}
+
+static Status DrawCachedImage(Graphics* g, const ImageData& img, RectF bbox) {
+    // decode at the size the image ends up at on the screen
+    Matrix m;
+    g->GetTransform(&m);
+    PointF v[2] = {PointF(bbox.Width, 0), PointF(0, bbox.Height)};
+    m.TransformVectors(v, 2);
+    Size size((int)ceilf(hypotf(v[0].X, v[0].Y)), (int)ceilf(hypotf(v[1].X, v[1].Y)));
+
+    ImageCache& cache = GetImageCache();
+    ScopedCritSec scope(&cache.access);
+    Bitmap* bmp = GetCachedImage(cache, img, size);
+    if (!bmp) {
+        return Ok;
+    }
+    return g->DrawImage(bmp, bbox, 0, 0, (float)bmp->GetWidth(), (float)bmp->GetHeight(), UnitPixel);
+}
+
+HBITMAP GetCachedImageAsHBITMAP(const ImageData& img, Size* sizeOut) {
+    ImageCache& cache = GetImageCache();
+    ScopedCritSec scope(&cache.access);
+    Bitmap* bmp = GetCachedImage(cache, img, Size());
+    HBITMAP hbmp = nullptr;
+    if (!bmp || bmp->GetHBITMAP((ARGB)Color::White, &hbmp) != Ok) {
+        return nullptr;
+    }
+    *sizeOut = Size(bmp->GetWidth(), bmp->GetHeight());
+    return hbmp;
+}
+
+void FreeCachedImages() {
+    ImageCache& cache = GetImageCache();
+    ScopedCritSec scope(&cache.access);
+    for (CachedImage& ci : cache.images) {
+        delete ci.bmp;
+    }
+    cache.images.Reset();
+    cache.totalSize = 0;
+}
+
 // TODO: draw link in the appropriate format (blue text, underlined, should show hand cursor when
 // mouse is over a link. There's a slight complication here: we only get explicit information about
 // strings, not about the whitespace and we should underline the whitespace as well. Also the text
@@ -1377,14 +1719,9 @@ void DrawHtmlPage(Graphics* g, mui::ITextRender* textDraw, Vec<DrawInstr>* drawI
             status = g->DrawLine(&linePen, p1, p2);
             CrashIf(status != Ok);
         } else if (DrawInstrType::Image == i.type) {
-            // TODO: cache the bitmap somewhere (?)
-            Bitmap* bmp = BitmapFromData(i.img.data, i.img.len);
-            if (bmp) {
-                status = g->DrawImage(bmp, bbox, 0, 0, (float)bmp->GetWidth(), (float)bmp->GetHeight(), UnitPixel);
-                // GDI+ sometimes seems to succeed in loading an image because it lazily decodes it
-                CrashIf(status != Ok && status != Win32Error);
-            }
-            delete bmp;
+            status = DrawCachedImage(g, i.img, bbox);
+            // GDI+ sometimes seems to succeed in loading an image because it lazily decodes it
+            CrashIf(status != Ok && status != Win32Error);
         } else if (DrawInstrType::LinkStart == i.type) {
             // TODO: set text color to blue
             float y = floorf(bbox.Y + bbox.Height + 0.5f);
@@ -131,19 +131,68 @@ struct DrawStyle {
     bool dirRtl;
 };
 
+// CSS rules are shared by the ReparseData of all pages they apply to
+// (pages are deleted on a different thread than they're created on)
+struct SharedStyleRules {
+    Vec<StyleRule> rules;
+    LONG refCount = 1;
+
+    SharedStyleRules* AddRef() {
+        InterlockedIncrement(&refCount);
+        return this;
+    }
+    void Release() {
+        if (0 == InterlockedDecrement(&refCount)) {
+            delete this;
+        }
+    }
+};
+
+// the state of HtmlFormatter at a reparse point, so that formatting
+// can be restarted there instead of at the beginning of the document.
+// The state doesn't depend on the page size, but it's only valid
+// for the default font (and size) it has been created with.
+struct ReparseData {
+    int reparseIdx = 0;
+    mui::CachedFont* defaultFont = nullptr;
+    Vec<DrawStyle> styleStack;
+    DrawStyle nextPageStyle{};
+    int listDepth = 0;
+    bool preFormatted = false;
+    bool dirRtl = false;
+    Vec<HtmlTag> tagNesting;
+    SharedStyleRules* styleRules = nullptr;
+
+    // state of EpubFormatter
+    AutoFree pagePath;
+    size_t hiddenDepth = 0;
+    // state of Fb2Formatter
+    int section = 1;
+    int titleCount = 0;
+
+    ReparseData() = default;
+    ReparseData(const ReparseData& other);
+    ReparseData& operator=(const ReparseData& other);
+    ~ReparseData();
+};
+
 class HtmlPage {
   public:
     explicit HtmlPage(int reparseIdx = 0) : reparseIdx(reparseIdx) {
         instructions.allowFailure = true;
     }
+    ~HtmlPage() {
+        delete reparseData;
+    }
 
     Vec<DrawInstr> instructions;
     // if we start parsing html again from reparseIdx, we should
     // get the same instructions. reparseIdx is an offset within
     // html data
-    // TODO: reparsing from reparseIdx can lead to different styling
-    // due to internal state of HtmlFormatter not being properly set
     int reparseIdx;
+    // the formatter's state at reparseIdx, needed for getting
+    // the same styling when reparsing (owned by the page)
+    ReparseData* reparseData = nullptr;
 };
 
 // just to pack args to HtmlFormatter
@@ -176,6 +225,8 @@ class HtmlFormatterArgs {
 
     // we start parsing from htmlStr + reparseIdx
     int reparseIdx = 0;
+    // the formatter's state at reparseIdx (optional, not owned)
+    ReparseData* reparseData = nullptr;
 
   private:
     AutoFreeWstr fontName;
@@ -214,6 +265,10 @@ class HtmlFormatter {
     virtual void HandleTagLink(HtmlToken* t) {
         UNUSED(t);
     }
+    // for saving the state of derived formatters
+    virtual void SaveReparseData(ReparseData* rd) {
+        UNUSED(rd);
+    }
 
     float CurrLineDx();
     float CurrLineDy();
@@ -247,9 +302,16 @@ class HtmlFormatter {
     void RevertStyleChange();
 
     void ParseStyleSheet(const char* data, size_t len);
+    void ResetStyleRules();
+    StyleRule* FindStyleRule(HtmlTag tag, uint32_t classHash);
     StyleRule* FindStyleRule(HtmlTag tag, const char* clazz, size_t clazzLen);
     StyleRule ComputeStyleRule(HtmlToken* t);
 
+    void SaveTokenState();
+    ReparseData* CreateReparseData(ReparseData& state);
+    ReparseData* GetReparseData(HtmlFormatterArgs* args);
+    void UpdateInitialReparseData();
+
     void AppendInstr(DrawInstr di);
     bool IsCurrLineEmpty();
     virtual bool IgnoreText();
@@ -286,7 +348,20 @@ class HtmlFormatter {
     Vec<HtmlTag> tagNesting;
     bool keepTagNesting;
     // set from CSS and to be checked by the individual tag handlers
+    // (must be reset with ResetStyleRules so that the indices stay in sync)
     Vec<StyleRule> styleRules;
+    // hash index into styleRules by (tag, classHash) (entries are index + 1)
+    Vec<int> styleRulesIndex;
+    // rules in effect for a (tag, classHash) pair, as computed by ComputeStyleRule
+    Vec<StyleRule> computedRules;
+    Vec<int> computedRulesIndex;
+    // copy of styleRules for the pages' ReparseData (nullptr if outdated)
+    SharedStyleRules* sharedStyleRules;
+
+    // state before the current HtmlToken and before the first
+    // instruction of the current line (for restarting formatting there)
+    ReparseData tokenState;
+    ReparseData lineStartState;
 
     // isntructions for the current line
     Vec<DrawInstr> currLineInstr;
@@ -322,6 +397,9 @@ class HtmlFormatter {
 
 void DrawHtmlPage(Graphics* g, mui::ITextRender* textRender, Vec<DrawInstr>* drawInstructions, float offX, float offY,
                   bool showBbox, Color textColor, bool* abortCookie = nullptr);
+// returns a copy of a (cached) image at its own size
+HBITMAP GetCachedImageAsHBITMAP(const ImageData& img, Size* sizeOut);
+void FreeCachedImages();
 
 mui::TextRenderMethod GetTextRenderMethod();
 void SetTextRenderMethod(mui::TextRenderMethod method);
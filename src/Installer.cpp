@@ -19,6 +19,7 @@
 #include "utils/ByteOrderDecoder.h"
 #include "utils/LzmaSimpleArchive.h"
 #include "utils/RegistryPaths.h"
+#include "utils/ThreadUtil.h"
 
 #include "wingui/WinGui.h"
 #include "wingui/Layout.h"
@@ -77,15 +78,16 @@ static bool success = false;
 static bool gWasSearchFilterInstalled = false;
 static bool gWasPreviewInstaller = false;
 
-int currProgress = 0;
+LONG currProgress = 0;
 static void ProgressStep() {
     if (gIsRaMicroBuild) {
         return;
     }
-    currProgress++;
+    // called from several threads while files are being extracted
+    LONG n = InterlockedIncrement(&currProgress);
     if (gProgressBar) {
         // possibly dangerous as is called on a thread
-        gProgressBar->SetCurrent(currProgress);
+        gProgressBar->SetCurrent(n);
     }
 }
 
@@ -106,38 +108,53 @@ static void CreateButtonExit(HWND hwndParent) {
     gButtonExit->onClicked = OnButtonExit;
 }
 
+// the files are independent of each other, so they're decompressed in parallel
+// on the thread pool, each directly into its destination file
 bool ExtractFiles(lzma::SimpleArchive* archive, const WCHAR* destDir) {
-    lzma::FileInfo* fi;
-    char* uncompressed;
-
     int nFiles = archive->filesCount;
+    Vec<WCHAR*> filePaths;
+    // ok, corrupted or couldn't be written
+    Vec<int> results;
+    results.AppendBlanks(nFiles);
 
+    CancelToken* token = new CancelToken();
     for (int i = 0; i < nFiles; i++) {
-        fi = &archive->files[i];
-        uncompressed = lzma::GetFileDataByIdx(archive, i, nullptr);
+        AutoFreeWstr fileName = strconv::Utf8ToWstr(archive->files[i].name);
+        WCHAR* filePath = path::Join(destDir, fileName);
+        filePaths.Append(filePath);
+        int* res = &results.at(i);
+        QueueWork(
+            WorkPriority::Background,
+            [archive, i, filePath, res] {
+                bool corrupted = false;
+                bool ok = lzma::ExtractFileToPath(archive, i, filePath, &corrupted);
+                *res = ok ? 0 : corrupted ? 1 : 2;
+                if (ok) {
+                    ProgressStep();
+                }
+            },
+            token);
+    }
+    token->Wait();
+    token->Release();
 
-        if (!uncompressed) {
+    bool ok = true;
+    for (int i = 0; i < nFiles && ok; i++) {
+        if (results.at(i) == 0) {
+            continue;
+        }
+        ok = false;
+        if (results.at(i) == 1) {
             NotifyFailed(
                 _TR("The installer has been corrupted. Please download it again.\nSorry for the inconvenience!"));
-            return false;
-        }
-        AutoFreeWstr fileName = strconv::Utf8ToWstr(fi->name);
-        AutoFreeWstr filePath = path::Join(destDir, fileName);
-
-        std::string_view d = {uncompressed, fi->uncompressedSize};
-        bool ok = file::WriteFile(filePath, d);
-        free(uncompressed);
-
-        if (!ok) {
-            WCHAR* msg = str::Format(_TR("Couldn't write %s to disk"), filePath.data);
-            NotifyFailed(msg);
-            free(msg);
-            return false;
+            break;
         }
-        ProgressStep();
+        WCHAR* msg = str::Format(_TR("Couldn't write %s to disk"), filePaths.at(i));
+        NotifyFailed(msg);
+        free(msg);
     }
-
-    return true;
+    filePaths.FreeMembers();
+    return ok;
 }
 
 static bool CreateInstallationDirectory() {
@@ -0,0 +1,99 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+extern "C" {
+#include <mupdf/fitz.h>
+}
+
+#include "utils/BaseUtil.h"
+#include <psapi.h>
+#include "utils/ScopedWin.h"
+#include "utils/FileUtil.h"
+#include "utils/GdiPlusUtil.h"
+#include "utils/Log.h"
+#include "utils/WinUtil.h"
+#include "mui/Mui.h"
+
+#include "wingui/TreeModel.h"
+
+#include "Annotation.h"
+#include "EngineBase.h"
+#include "EngineFzUtil.h"
+#include "Doc.h"
+#include "SettingsStructs.h"
+#include "GlobalPrefs.h"
+#include "FileHistory.h"
+#include "Controller.h"
+#include "DisplayModel.h"
+#include "RenderCache.h"
+#include "TextSelection.h"
+#include "SumatraPDF.h"
+#include "WindowInfo.h"
+#include "TabInfo.h"
+#include "MemStats.h"
+
+static void AppendCounter(str::Str& s, const char* name, MemCounter& c) {
+    s.AppendFmt("%s: %lld allocations, %.2f MB\n", name, c.count, c.bytes / (1024.0 * 1024.0));
+}
+
+void GetMemStats(str::Str& s) {
+    PROCESS_MEMORY_COUNTERS pmc{};
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) {
+        s.AppendFmt("working set: %.2f MB (peak: %.2f MB)\n", pmc.WorkingSetSize / (1024.0 * 1024.0),
+                    pmc.PeakWorkingSetSize / (1024.0 * 1024.0));
+        s.AppendFmt("private bytes: %.2f MB\n", pmc.PagefileUsage / (1024.0 * 1024.0));
+    }
+    HANDLE proc = GetCurrentProcess();
+    s.AppendFmt("gdi objects: %d (peak: %d, limit: %d)\n", (int)GetGuiResources(proc, GR_GDIOBJECTS),
+                (int)GetGuiResources(proc, GR_GDIOBJECTS_PEAK), gGlobalPrefs->gdiObjectsLimit);
+    s.AppendFmt("user objects: %d\n", (int)GetGuiResources(proc, GR_USEROBJECTS));
+    // the biggest users of gdi objects (DIB sections and fonts)
+    int nPooled = 0;
+    size_t pooledBytes = 0;
+    GetBitmapPoolStats(&nPooled, &pooledBytes);
+    s.AppendFmt("bitmap pool: %d bitmaps, %.2f MB\n", nPooled, pooledBytes / (1024.0 * 1024.0));
+    int nFonts = 0, nHFonts = 0;
+    mui::GetCachedFontsCount(&nFonts, &nHFonts);
+    s.AppendFmt("cached fonts: %d (%d HFONTs)\n", nFonts, nHFonts);
+    int nThumbnails = 0;
+    DisplayState* ds;
+    for (size_t i = 0; (ds = gFileHistory.Get(i)) != nullptr; i++) {
+        if (ds->thumbnail) {
+            nThumbnails++;
+        }
+    }
+    s.AppendFmt("thumbnails: %d\n", nThumbnails);
+
+    AppendCounter(s, "mupdf", gFzMem);
+    AppendCounter(s, "rendered bitmaps", gRenderedBitmapMem);
+    AppendCounter(s, "pool allocators", gPoolAllocatorMem);
+    AppendCounter(s, "heap allocators", gHeapAllocatorMem);
+    AppendCounter(s, "arena allocators", gArenaAllocatorMem);
+
+    {
+        RenderCache& rc = gRenderCache;
+        ScopedCritSec scope(&rc.cacheAccess);
+        s.AppendFmt("render cache: %d bitmaps, %.2f MB\n", rc.cacheCount, rc.cacheSize / (1024.0 * 1024.0));
+    }
+
+    for (WindowInfo* win : gWindows) {
+        for (TabInfo* tab : win->tabs) {
+            DisplayModel* dm = tab->ctrl ? tab->ctrl->AsFixed() : nullptr;
+            if (!dm || !dm->textCache) {
+                continue;
+            }
+            AutoFree path(strconv::WstrToUtf8(tab->filePath));
+            s.AppendFmt("text cache: %.2f MB, %s\n", dm->textCache->cachedSize / (1024.0 * 1024.0), path.Get());
+        }
+    }
+}
+
+bool SaveMemStats(const WCHAR* path) {
+    str::Str s;
+    GetMemStats(s);
+    if (!path) {
+        log(s.AsView());
+        return true;
+    }
+    return file::WriteFile(path, s.AsView());
+}
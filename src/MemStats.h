@@ -0,0 +1,10 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+// a summary of which subsystems use how much memory, meant for finding
+// out what's growing on machines where SumatraPDF runs for a long time
+
+// appends a human-readable report (one "name: value" line per counter)
+void GetMemStats(str::Str& s);
+// writes the report to a file or, if path is nullptr, to the log
+bool SaveMemStats(const WCHAR* path);
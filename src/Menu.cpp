@@ -155,6 +155,7 @@ static MenuDef menuDefGoTo[] = {
     { _TRN("F&orward\tAlt+Right Arrow"),    IDM_GOTO_NAV_FORWARD,       0 },
     { SEP_ITEM,                             0,                          MF_NOT_FOR_EBOOK_UI },
     { _TRN("Fin&d...\tCtrl+F"),             IDM_FIND_FIRST,             MF_NOT_FOR_EBOOK_UI },
+    { _TRN("Find &All\tCtrl+Shift+F"),      IDM_FIND_ALL,               MF_NOT_FOR_EBOOK_UI },
     { 0, 0, 0 },
 };
 //] ACCESSKEY_GROUP GoTo Menu
@@ -222,6 +223,8 @@ static MenuDef menuDefHelp[] = {
 //[ ACCESSKEY_GROUP Debug Menu
 static MenuDef menuDefDebug[] = {
     { "Highlight links",                    IDM_DEBUG_SHOW_LINKS,       MF_NO_TRANSLATE },
+    { "Show performance overlay",           IDM_DEBUG_SHOW_PERF_HUD,    MF_NO_TRANSLATE },
+    { "Log memory statistics",              IDM_DEBUG_MEM_STATS,        MF_NO_TRANSLATE },
     { "Toggle ebook UI",                    IDM_DEBUG_EBOOK_UI,         MF_NO_TRANSLATE },
     { "Mui debug paint",                    IDM_DEBUG_MUI,              MF_NO_TRANSLATE },
     { "Annotation from Selection",          IDM_DEBUG_ANNOTATION,       MF_NO_TRANSLATE },
@@ -515,6 +518,7 @@ static void MenuUpdateStateForWindow(WindowInfo* win) {
         IDM_GOTO_NAV_FORWARD,
         IDM_GOTO_PAGE,
         IDM_FIND_FIRST,
+        IDM_FIND_ALL,
         IDM_SAVEAS,
         IDM_SAVEAS_BOOKMARK,
         IDM_SEND_BY_EMAIL,
@@ -588,6 +592,7 @@ static void MenuUpdateStateForWindow(WindowInfo* win) {
     EngineBase* engine = dm ? dm->GetEngine() : nullptr;
     if (engine) {
         win::menu::SetEnabled(win->menu, IDM_FIND_FIRST, !engine->IsImageCollection());
+        win::menu::SetEnabled(win->menu, IDM_FIND_ALL, !engine->IsImageCollection());
     }
 
     if (win->IsDocLoaded() && !fileExists) {
@@ -600,6 +605,7 @@ static void MenuUpdateStateForWindow(WindowInfo* win) {
 #endif
 
     win::menu::SetChecked(win->menu, IDM_DEBUG_SHOW_LINKS, gDebugShowLinks);
+    win::menu::SetChecked(win->menu, IDM_DEBUG_SHOW_PERF_HUD, gShowPerfHud);
     win::menu::SetChecked(win->menu, IDM_DEBUG_EBOOK_UI, gGlobalPrefs->ebookUI.useFixedPageUI);
     win::menu::SetChecked(win->menu, IDM_DEBUG_MUI, mui::IsDebugPaint());
     win::menu::SetEnabled(win->menu, IDM_DEBUG_ANNOTATION,
@@ -634,7 +640,7 @@ void OnAboutContextMenu(WindowInfo* win, int x, int y) {
 
     if (IDM_OPEN_SELECTED_DOCUMENT == cmd) {
         LoadArgs args(filePath, win);
-        LoadDocument(args);
+        LoadDocumentAsync(args);
         return;
     }
 
@@ -1163,6 +1169,35 @@ void MenuOwnerDrawnDrawItem(HWND hwnd, DRAWITEMSTRUCT* dis) {
     SelectObject(hdc, prevFont);
 }
 
+// the File and Favorites menus have items that change often (recently opened
+// files, favorites), so they're only populated right before they're shown
+// (in UpdateAppMenu). they're identified by their menu data
+enum class DynamicMenu {
+    None = 0,
+    File,
+    Favorites,
+};
+
+static HMENU CreateDynamicMenu(DynamicMenu kind) {
+    HMENU m = CreateMenu();
+    MENUINFO mi = {0};
+    mi.cbSize = sizeof(mi);
+    mi.fMask = MIM_MENUDATA;
+    mi.dwMenuData = (ULONG_PTR)kind;
+    SetMenuInfo(m, &mi);
+    return m;
+}
+
+static DynamicMenu GetDynamicMenuKind(HMENU m) {
+    MENUINFO mi = {0};
+    mi.cbSize = sizeof(mi);
+    mi.fMask = MIM_MENUDATA;
+    if (!GetMenuInfo(m, &mi)) {
+        return DynamicMenu::None;
+    }
+    return (DynamicMenu)mi.dwMenuData;
+}
+
 //[ ACCESSKEY_GROUP Main Menubar
 HMENU BuildMenu(WindowInfo* win) {
     TabInfo* tab = win->currentTab;
@@ -1178,8 +1213,7 @@ HMENU BuildMenu(WindowInfo* win) {
         filter |= MF_CBX_ONLY;
     }
 
-    HMENU m = CreateMenu();
-    RebuildFileMenu(tab, m);
+    HMENU m = CreateDynamicMenu(DynamicMenu::File);
     AppendMenu(mainMenu, MF_POPUP | MF_STRING, (UINT_PTR)m, _TR("&File"));
     m = BuildMenuFromMenuDef(menuDefView, CreateMenu(), filter);
     AppendMenu(mainMenu, MF_POPUP | MF_STRING, (UINT_PTR)m, _TR("&View"));
@@ -1194,8 +1228,7 @@ HMENU BuildMenu(WindowInfo* win) {
     if (HasPermission(Perm_SavePreferences) && !win->AsEbook()) {
         // I think it makes sense to disable favorites in restricted mode
         // because they wouldn't be persisted, anyway
-        m = BuildMenuFromMenuDef(menuDefFavorites, CreateMenu());
-        RebuildFavMenu(win, m);
+        m = CreateDynamicMenu(DynamicMenu::Favorites);
         AppendMenu(mainMenu, MF_POPUP | MF_STRING, (UINT_PTR)m, _TR("F&avorites"));
     }
 
@@ -1241,18 +1274,21 @@ HMENU BuildMenu(WindowInfo* win) {
 }
 //] ACCESSKEY_GROUP Main Menubar
 
+// called for WM_INITMENUPOPUP i.e. right before menu m is shown
 void UpdateAppMenu(WindowInfo* win, HMENU m) {
     CrashIf(!win);
-    UINT id = GetMenuItemID(m, 0);
-    if (id == menuDefFile[0].id) {
+    DynamicMenu kind = GetDynamicMenuKind(m);
+    if (kind == DynamicMenu::File) {
         RebuildFileMenu(win->currentTab, m);
-    } else if (id == menuDefFavorites[0].id) {
+    } else if (kind == DynamicMenu::Favorites) {
         win::menu::Empty(m);
         BuildMenuFromMenuDef(menuDefFavorites, m);
         RebuildFavMenu(win, m);
     }
     MenuUpdateStateForWindow(win);
-    MarkMenuOwnerDraw(win->menu);
+    // every (sub)menu gets here before being shown, so there's
+    // no need to update the owner-draw data of the whole menu bar
+    MarkMenuOwnerDraw(m);
 }
 
 // show/hide top-level menu bar. This doesn't persist across launches
@@ -6,6 +6,7 @@
 #include "utils/ByteOrderDecoder.h"
 #include "utils/ScopedWin.h"
 #include "utils/FileUtil.h"
+#include "utils/FileTypeSniff.h"
 #include "utils/GdiPlusUtil.h"
 #include "utils/HtmlParserLookup.h"
 #include "utils/HtmlPullParser.h"
@@ -195,6 +196,9 @@ static_assert(kCdicHeaderLen == sizeof(CdicHeader), "wrong size of CdicHeader st
 
 #define kCdicsMax 32
 
+// codes of up to that many bits are decoded with a single table lookup
+#define kFastTableBits 12
+
 class HuffDicDecompressor {
     uint32_t cacheTable[kCacheItemCount] = {};
     uint32_t baseTable[kBaseTableItemCount] = {};
@@ -206,8 +210,24 @@ class HuffDicDecompressor {
 
     uint32_t codeLength = 0;
 
+    // (code << 5) | codeLen for all codes of up to kFastTableBits bits,
+    // indexed by the next kFastTableBits bits of input (0 if the code is longer)
+    uint32_t fastTable[1 << kFastTableBits] = {};
+
+    // dictionary entries that refer to other entries are expanded only once
+    // and the result is kept in expanded (indexed by the full code)
+    struct ExpandedEntry {
+        uint32_t start; // offset into expanded + 1, 0 if not yet expanded
+        uint32_t len;
+    };
+    Vec<ExpandedEntry> expandedEntries;
+    str::Str expanded;
+
     Vec<uint32_t> recursionGuard;
 
+    bool DecodeCode(uint32_t bits, uint32_t* codeOut, uint32_t* codeLenOut) const;
+    void BuildFastTable();
+
   public:
     HuffDicDecompressor();
 
@@ -226,6 +246,12 @@ bool HuffDicDecompressor::DecodeOne(uint32_t code, str::Str& dst) {
         logf("invalid dict value\n");
         return false;
     }
+    uint32_t fullCode = code;
+    if (expandedEntries.size() > fullCode && expandedEntries.at(fullCode).start != 0) {
+        ExpandedEntry& e = expandedEntries.at(fullCode);
+        dst.Append(expanded.Get() + e.start - 1, e.len);
+        return true;
+    }
     code &= ((1 << (codeLength)) - 1);
     uint16_t offset = UInt16BE(dicts[dict] + code * 2);
 
@@ -246,10 +272,18 @@ bool HuffDicDecompressor::DecodeOne(uint32_t code, str::Str& dst) {
             return false;
         }
         recursionGuard.Append(code);
+        size_t dstStart = dst.size();
         if (!Decompress(p, symLen, dst)) {
             return false;
         }
         recursionGuard.Pop();
+        if (expandedEntries.size() <= fullCode) {
+            expandedEntries.AppendBlanks(dictsCount << codeLength);
+        }
+        ExpandedEntry& e = expandedEntries.at(fullCode);
+        e.start = (uint32_t)expanded.size() + 1;
+        e.len = (uint32_t)(dst.size() - dstStart);
+        expanded.Append(dst.Get() + dstStart, e.len);
     } else {
         symLen &= 0x7fff;
         if (symLen > 127) {
@@ -279,30 +313,14 @@ bool HuffDicDecompressor::Decompress(uint8_t* src, size_t srcSize, str::Str& dst
         bits = br.Peek(32);
         if (br.BitsLeft() < 8 && 0 == bits)
             break;
-        uint32_t v = cacheTable[bits >> 24];
-        uint32_t codeLen = v & 0x1f;
-        if (!codeLen) {
-            logf("corrupted table, zero code len\n");
-            return false;
-        }
-        bool isTerminal = (v & 0x80) != 0;
-
         uint32_t code;
-        if (isTerminal) {
-            code = (v >> 8) - (bits >> (32 - codeLen));
-        } else {
-            uint32_t baseVal;
-            codeLen -= 1;
-            do {
-                codeLen++;
-                if (codeLen > 32) {
-                    logf("code len > 32 bits\n");
-                    return false;
-                }
-                baseVal = baseTable[codeLen * 2 - 2];
-                code = (bits >> (32 - codeLen));
-            } while (baseVal > code);
-            code = baseTable[codeLen * 2 - 1] - (bits >> (32 - codeLen));
+        uint32_t codeLen;
+        uint32_t fast = fastTable[bits >> (32 - kFastTableBits)];
+        if (fast != 0) {
+            code = fast >> 5;
+            codeLen = fast & 0x1f;
+        } else if (!DecodeCode(bits, &code, &codeLen)) {
+            return false;
         }
 
         if (!DecodeOne(code, dst))
@@ -316,6 +334,54 @@ bool HuffDicDecompressor::Decompress(uint8_t* src, size_t srcSize, str::Str& dst
     return true;
 }
 
+// decodes the code at the start of bits
+bool HuffDicDecompressor::DecodeCode(uint32_t bits, uint32_t* codeOut, uint32_t* codeLenOut) const {
+    uint32_t v = cacheTable[bits >> 24];
+    uint32_t codeLen = v & 0x1f;
+    if (!codeLen) {
+        logf("corrupted table, zero code len\n");
+        return false;
+    }
+    bool isTerminal = (v & 0x80) != 0;
+
+    uint32_t code;
+    if (isTerminal) {
+        code = (v >> 8) - (bits >> (32 - codeLen));
+    } else {
+        uint32_t baseVal;
+        codeLen -= 1;
+        do {
+            codeLen++;
+            if (codeLen > 32) {
+                logf("code len > 32 bits\n");
+                return false;
+            }
+            baseVal = baseTable[codeLen * 2 - 2];
+            code = (bits >> (32 - codeLen));
+        } while (baseVal > code);
+        code = baseTable[codeLen * 2 - 1] - (bits >> (32 - codeLen));
+    }
+    *codeOut = code;
+    *codeLenOut = codeLen;
+    return true;
+}
+
+// a code only depends on its own bits, so all the codes that fit
+// into kFastTableBits can be decoded upfront
+void HuffDicDecompressor::BuildFastTable() {
+    for (uint32_t i = 0; i < dimof(fastTable); i++) {
+        fastTable[i] = 0;
+        if (0 == (cacheTable[i >> (kFastTableBits - 8)] & 0x1f)) {
+            continue;
+        }
+        uint32_t code, codeLen;
+        bool ok = DecodeCode(i << (32 - kFastTableBits), &code, &codeLen);
+        if (ok && codeLen <= kFastTableBits && code < (1u << 27)) {
+            fastTable[i] = (code << 5) | codeLen;
+        }
+    }
+}
+
 bool HuffDicDecompressor::SetHuffData(uint8_t* huffData, size_t huffDataLen) {
     // for now catch cases where we don't have both big endian and little endian
     // versions of the data
@@ -352,6 +418,7 @@ bool HuffDicDecompressor::SetHuffData(uint8_t* huffData, size_t huffDataLen) {
         baseTable[i] = d.UInt32();
     }
     CrashIf(d.Offset() != kHuffRecordMinLen);
+    BuildFastTable();
     return true;
 }
 
@@ -458,11 +525,14 @@ static bool IsValidCompression(int comprType) {
 MobiDoc::MobiDoc(const WCHAR* filePath) {
     docTocIndex = kInvalidSize;
     fileName = str::Dup(filePath);
+    InitializeCriticalSection(&imagesAccess);
 }
 
 MobiDoc::~MobiDoc() {
     free(fileName);
     free(images);
+    free(imagesChecked);
+    DeleteCriticalSection(&imagesAccess);
     delete huffDic;
     delete doc;
     delete pdbReader;
@@ -711,61 +781,67 @@ static bool KnownImageFormat(const char* data, size_t dataLen) {
     return nullptr != GfxFileExtFromData(data, dataLen);
 }
 
-// return false if we should stop loading images (because we
-// encountered eof record or ran out of memory)
-bool MobiDoc::LoadImage(size_t imageNo) {
-    size_t imageRec = imageFirstRec + imageNo;
-
-    std::string_view rec = pdbReader->GetRecord(imageRec);
-    const char* imgData = rec.data();
-    size_t imgDataLen = rec.size();
-    if (!imgData || (0 == imgDataLen))
-        return true;
-    if (IsEofRecord((uint8_t*)imgData, imgDataLen))
-        return false;
-    if (KnownNonImageRec((uint8_t*)imgData, imgDataLen))
-        return true;
-    if (!KnownImageFormat(imgData, imgDataLen)) {
-        logf("MobiDoc::LoadImage: unknown image format\n");
-        return true;
+// checks whether an image record contains an image we can display
+// (the record's data is only touched when the image is needed)
+ImageData* MobiDoc::LoadImage(size_t imageNo) {
+    ScopedCritSec scope(&imagesAccess);
+    ImageData* img = &images[imageNo];
+    if (!imagesChecked[imageNo]) {
+        imagesChecked[imageNo] = true;
+        std::string_view rec = pdbReader->GetRecord(imageFirstRec + imageNo);
+        const char* imgData = rec.data();
+        size_t imgDataLen = rec.size();
+        if (!imgData || (0 == imgDataLen))
+            return nullptr;
+        if (KnownNonImageRec((uint8_t*)imgData, imgDataLen))
+            return nullptr;
+        if (!KnownImageFormat(imgData, imgDataLen)) {
+            logf("MobiDoc::LoadImage: unknown image format\n");
+            return nullptr;
+        }
+        img->data = (char*)imgData;
+        img->len = imgDataLen;
     }
-    images[imageNo].data = (char*)imgData;
-    if (!images[imageNo].data)
-        return false;
-    images[imageNo].len = imgDataLen;
-    return true;
+    if (!img->data || (0 == img->len))
+        return nullptr;
+    return img;
 }
 
 void MobiDoc::LoadImages() {
+    // images after the eof record are ignored (IsEofRecord compares the
+    // size first, so this doesn't touch the data of all image records)
+    for (size_t i = 0; i < imagesCount; i++) {
+        std::string_view rec = pdbReader->GetRecord(imageFirstRec + i);
+        if (IsEofRecord((uint8_t*)rec.data(), rec.size())) {
+            imagesCount = i;
+            break;
+        }
+    }
     if (0 == imagesCount)
         return;
     images = AllocArray<ImageData>(imagesCount);
-    for (size_t i = 0; i < imagesCount; i++) {
-        if (!LoadImage(i))
-            return;
-    }
+    imagesChecked = AllocArray<bool>(imagesCount);
+    // the cover is needed right away for thumbnails and previews
+    GetCoverImage();
 }
 
 // imgRecIndex corresponds to recindex attribute of <img> tag
 // as far as I can tell, this means: it starts at 1
 // returns nullptr if there is no image (e.g. it's not a format we
 // recognize)
-ImageData* MobiDoc::GetImage(size_t imgRecIndex) const {
+ImageData* MobiDoc::GetImage(size_t imgRecIndex) {
     if ((imgRecIndex > imagesCount) || (imgRecIndex < 1))
         return nullptr;
-    --imgRecIndex;
-    if (!images[imgRecIndex].data || (0 == images[imgRecIndex].len))
-        return nullptr;
-    return &images[imgRecIndex];
+    return LoadImage(imgRecIndex - 1);
 }
 
 ImageData* MobiDoc::GetCoverImage() {
     if (!coverImageRec || coverImageRec < imageFirstRec)
         return nullptr;
     size_t imageNo = coverImageRec - imageFirstRec;
-    if (imageNo >= imagesCount || !images[imageNo].data)
+    if (imageNo >= imagesCount)
         return nullptr;
-    return &images[imageNo];
+    return LoadImage(imageNo);
 }
 
 // each record can have extra data at the end, which we must discard
@@ -846,6 +922,32 @@ bool MobiDoc::LoadDocRecordIntoBuffer(size_t recNo, str::Str& strOut) {
     return false;
 }
 
+// returns the length of the part of text that doesn't end in the middle
+// of a double-byte character (which must be converted along with the next record)
+static size_t CompleteCharsLen(const char* s, size_t len, UINT codePage) {
+    size_t i = 0;
+    while (i < len) {
+        i += IsDBCSLeadByteEx(codePage, (BYTE)s[i]) ? 2 : 1;
+    }
+    return i > len ? len - 1 : len;
+}
+
+static bool AppendAsUtf8(str::Str& out, const char* s, size_t len, UINT codePage) {
+    if (len == 0) {
+        return true;
+    }
+    AutoFreeWstr ws(strconv::ToWideChar(s, codePage, (int)len));
+    if (!ws) {
+        return false;
+    }
+    AutoFree utf8(strconv::WstrToUtf8(ws.Get()));
+    if (!utf8.Get()) {
+        return false;
+    }
+    out.Append(utf8.Get(), utf8.size());
+    return true;
+}
+
 bool MobiDoc::LoadDocument(PdbReader* pdbReader) {
     logToDebugger = true;
     this->pdbReader = pdbReader;
@@ -855,11 +957,32 @@ bool MobiDoc::LoadDocument(PdbReader* pdbReader) {
 
     CrashIf(doc != nullptr);
     doc = new str::Str(docUncompressedSize);
+    bool convert = textEncoding != CP_UTF8;
+    CPINFO cpInfo{};
+    bool multiByteCP = convert && GetCPInfo(textEncoding, &cpInfo) && cpInfo.MaxCharSize > 1;
+    // records are decompressed and converted one at a time, which avoids
+    // keeping several copies of the entire text in memory while loading
+    str::Str rec;
     size_t nFailed = 0;
     for (size_t i = 1; i <= docRecCount; i++) {
-        if (!LoadDocRecordIntoBuffer(i, *doc)) {
+        if (!LoadDocRecordIntoBuffer(i, convert ? rec : *doc)) {
             nFailed++;
         }
+        if (!convert) {
+            continue;
+        }
+        size_t len = multiByteCP && i < docRecCount ? CompleteCharsLen(rec.Get(), rec.size(), textEncoding) : rec.size();
+        // replace unexpected \0 with spaces (see below)
+        char* s = rec.Get();
+        char* end = s + len;
+        while ((s = (char*)memchr(s, '\0', end - s)) != nullptr) {
+            *s = ' ';
+        }
+        if (!AppendAsUtf8(*doc, rec.Get(), len, textEncoding)) {
+            doc->Append(rec.Get(), len);
+        }
+        // keep an incomplete double-byte character for the next record
+        rec.RemoveAt(0, len);
     }
 
     // TODO: this is a heuristic for https://github.com/sumatrapdfreader/sumatrapdf/issues/1314
@@ -870,6 +993,9 @@ bool MobiDoc::LoadDocument(PdbReader* pdbReader) {
         return false;
     }
 
+    if (convert) {
+        return true;
+    }
     // replace unexpected \0 with spaces
     // cf. https://code.google.com/p/sumatrapdf/issues/detail?id=2529
     char* s = doc->Get();
@@ -877,13 +1003,6 @@ bool MobiDoc::LoadDocument(PdbReader* pdbReader) {
     while ((s = (char*)memchr(s, '\0', end - s)) != nullptr) {
         *s = ' ';
     }
-    if (textEncoding != CP_UTF8) {
-        const char* docUtf8 = strconv::ToMultiByte(doc->Get(), textEncoding, CP_UTF8).data();
-        if (docUtf8) {
-            doc->Reset();
-            doc->AppendAndFree(docUtf8);
-        }
-    }
     return true;
 }
 
@@ -989,15 +1108,14 @@ bool MobiDoc::IsSupportedFile(const WCHAR* fileName, bool sniff) {
         return isMobi || isPrc || isAzw || isAzw1 || isAzw3;
     }
 
-    PdbReader pdbReader;
-    auto data = file::ReadFile(fileName);
-    if (!pdbReader.Parse(data)) {
+    PdbHeader hdr;
+    if (!PdbReader::ParseHeaderOnly(ReadFileHeader(fileName), &hdr)) {
         return false;
     }
     // in most cases, we're only interested in Mobipocket files
     // (PalmDoc uses MobiDoc for loading other formats based on MOBI,
     // but implements sniffing itself in PalmDoc::IsSupportedFile)
-    PdbDocType kind = GetPdbDocType(pdbReader.GetDbType());
+    PdbDocType kind = GetPdbDocType(hdr.typeCreator);
     return PdbDocType::Mobipocket == kind;
 }
 
@@ -23,7 +23,12 @@ class MobiDoc {
     size_t imageFirstRec = 0; // 0 if no images
     size_t coverImageRec = 0; // 0 if no cover image
 
+    // image records are only checked when an image is first requested
+    // (cf. GetImage); access to them must be serialized for multi-threaded
+    // users (such as EbookController)
+    CRITICAL_SECTION imagesAccess;
     ImageData* images = nullptr;
+    bool* imagesChecked = nullptr;
 
     HuffDicDecompressor* huffDic = nullptr;
 
@@ -38,7 +43,7 @@ class MobiDoc {
     bool ParseHeader();
     bool LoadDocRecordIntoBuffer(size_t recNo, str::Str& strOut);
     void LoadImages();
-    bool LoadImage(size_t imageNo);
+    ImageData* LoadImage(size_t imageNo);
     bool LoadDocument(PdbReader* pdbReader);
     bool DecodeExthHeader(const char* data, size_t dataLen);
 
@@ -54,7 +59,7 @@ class MobiDoc {
         return doc->size();
     }
     ImageData* GetCoverImage();
-    ImageData* GetImage(size_t imgRecIndex) const;
+    ImageData* GetImage(size_t imgRecIndex);
     const WCHAR* GetFileName() const {
         return fileName;
     }
@@ -0,0 +1,192 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+extern "C" {
+#include "../ext/mujs/regexp.h"
+}
+
+#include "utils/BaseUtil.h"
+#include "utils/AhoCorasick.h"
+
+#include "wingui/TreeModel.h"
+
+#include "Annotation.h"
+#include "EngineBase.h"
+#include "ProgressUpdateUI.h"
+#include "TextSelection.h"
+#include "TextSearch.h"
+#include "MultiTextSearch.h"
+
+MultiTextSearch::MultiTextSearch(DocumentTextCache* textCache) : textCache(textCache) {
+    nPages = textCache->engine->PageCount();
+}
+
+MultiTextSearch::~MultiTextSearch() {
+    delete terms;
+    if (regex) {
+        regfree(regex);
+    }
+}
+
+void MultiTextSearch::SetTerms(const WCHAR* s, bool caseSensitive) {
+    CrashIf(terms || regex);
+    this->caseSensitive = caseSensitive;
+
+    terms = new AhoCorasick();
+    WStrVec parts;
+    parts.Split(s, L"|", true);
+    for (WCHAR* term : parts) {
+        str::TrimWS(term, TrimOpt::Both);
+        if (!caseSensitive) {
+            // the same folding as for DocumentTextCache::GetFoldedTextForPage
+            CharLowerBuffW(term, (DWORD)str::Len(term));
+        }
+        terms->AddPattern(term);
+    }
+    terms->Build();
+}
+
+bool MultiTextSearch::SetRegex(const WCHAR* pattern, bool caseSensitive) {
+    CrashIf(terms || regex);
+    this->caseSensitive = caseSensitive;
+
+    AutoFree patternU(strconv::WstrToUtf8(pattern));
+    const char* error = nullptr;
+    int flags = REG_NEWLINE | (caseSensitive ? 0 : REG_ICASE);
+    regex = regcomp(patternU.Get(), flags, &error);
+    return regex != nullptr;
+}
+
+static int cmpHitsByStart(const void* a, const void* b) {
+    const TextSearchHit* ha = (const TextSearchHit*)a;
+    const TextSearchHit* hb = (const TextSearchHit*)b;
+    if (ha->startGlyph != hb->startGlyph) {
+        return ha->startGlyph - hb->startGlyph;
+    }
+    // longer terms first
+    return hb->endGlyph - ha->endGlyph;
+}
+
+void MultiTextSearch::FindTermsInPage(int pageNo, Vec<TextSearchHit>& hitsOut) {
+    PageTextPin pin(textCache, pageNo);
+    int len = 0;
+    const WCHAR* text = nullptr;
+    if (caseSensitive) {
+        text = textCache->GetTextForPage(pageNo, &len);
+    } else {
+        text = textCache->GetFoldedTextForPage(pageNo, &len);
+    }
+    if (!text) {
+        return;
+    }
+
+    Vec<TextSearchHit> hits;
+    terms->FindAll(text, len, [&](int pattern, int start) {
+        TextSearchHit hit;
+        hit.startPage = hit.endPage = pageNo;
+        hit.startGlyph = start;
+        hit.endGlyph = start + terms->PatternLen(pattern);
+        hits.Append(hit);
+    });
+    // matches are reported in the order they end
+    hits.Sort(cmpHitsByStart);
+    for (auto& hit : hits) {
+        hitsOut.Append(hit);
+    }
+}
+
+void MultiTextSearch::FindRegexInPage(int pageNo, Vec<TextSearchHit>& hitsOut) {
+    PageTextPin pin(textCache, pageNo);
+    int len = 0;
+    const WCHAR* text = textCache->GetTextForPage(pageNo, &len);
+    if (!text || len == 0) {
+        return;
+    }
+
+    // the regular expression matches UTF-8, so we need the glyph
+    // index of each byte for reporting the position of a match
+    AutoFree textU(strconv::WstrToUtf8(text, len));
+    if (!textU.Get()) {
+        return;
+    }
+    int nBytes = (int)textU.size();
+    Vec<int> glyphAt;
+    glyphAt.SetSize(nBytes + 1);
+    int glyph = 0;
+    for (int i = 0; i < nBytes;) {
+        u8 c = (u8)textU.Get()[i];
+        int n = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+        for (int k = 0; k < n && i < nBytes; k++) {
+            glyphAt[i++] = glyph;
+        }
+        // characters outside the BMP take two WCHARs
+        glyph += n == 4 ? 2 : 1;
+    }
+    glyphAt[nBytes] = std::min(glyph, len);
+
+    const char* s = textU.Get();
+    const char* sp = s;
+    int flags = 0;
+    Resub m;
+    while (sp < s + nBytes && 0 == regexec(regex, sp, &m, flags)) {
+        const char* matchStart = m.sub[0].sp;
+        const char* matchEnd = m.sub[0].ep;
+        if (matchEnd > matchStart) {
+            TextSearchHit hit;
+            hit.startPage = hit.endPage = pageNo;
+            hit.startGlyph = glyphAt[(int)(matchStart - s)];
+            hit.endGlyph = glyphAt[(int)(matchEnd - s)];
+            hitsOut.Append(hit);
+            sp = matchEnd;
+        } else {
+            // skip an empty match (by a whole character)
+            sp = matchStart + 1;
+            while (sp < s + nBytes && ((u8)*sp & 0xC0) == 0x80) {
+                sp++;
+            }
+        }
+        flags = REG_NOTBOL;
+    }
+}
+
+bool MultiTextSearch::FindAll(Vec<TextSearchHit>& hitsOut, ProgressUpdateUI* tracker) {
+    if (!regex && (!terms || terms->PatternsCount() == 0)) {
+        return true;
+    }
+
+    textCache->PrefetchRange(1, nPages, GetTextPrefetchThreads());
+
+    int lastPercent = -1;
+    for (int pageNo = 1; pageNo <= nPages; pageNo++) {
+        if (tracker) {
+            if (tracker->WasCanceled()) {
+                textCache->StopPrefetching();
+                return false;
+            }
+            int percent = pageNo * 100 / nPages;
+            if (percent != lastPercent) {
+                tracker->UpdateProgress(pageNo, nPages);
+                lastPercent = percent;
+            }
+        }
+        int firstHit = hitsOut.isize();
+        if (regex) {
+            FindRegexInPage(pageNo, hitsOut);
+        } else {
+            FindTermsInPage(pageNo, hitsOut);
+        }
+        if (hitsOut.isize() == firstHit) {
+            continue;
+        }
+        // the position of the hits is needed for painting their marks
+        int len = 0;
+        ScopedMem<Rect> coords(textCache->GetCoordsForPage(pageNo, &len));
+        for (int i = firstHit; i < hitsOut.isize(); i++) {
+            int glyph = hitsOut[i].startGlyph;
+            if (glyph < len) {
+                hitsOut[i].rect = coords[glyph];
+            }
+        }
+    }
+    return true;
+}
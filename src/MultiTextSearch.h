@@ -0,0 +1,35 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+class AhoCorasick;
+struct Reprog;
+
+// finds all occurrences of several terms at once or of a regular
+// expression in a document, with a single pass over each page's text.
+// unlike TextSearch, matches never span pages and whitespace
+// must match exactly
+class MultiTextSearch {
+  public:
+    explicit MultiTextSearch(DocumentTextCache* textCache);
+    ~MultiTextSearch();
+
+    // terms are separated by '|'
+    void SetTerms(const WCHAR* terms, bool caseSensitive);
+    // uses JavaScript syntax. returns false if the expression is invalid
+    bool SetRegex(const WCHAR* pattern, bool caseSensitive);
+
+    // appends the matches (ordered by their position) to hitsOut.
+    // returns false if the search was canceled
+    bool FindAll(Vec<TextSearchHit>& hitsOut, ProgressUpdateUI* tracker = nullptr);
+
+  private:
+    DocumentTextCache* textCache = nullptr;
+    int nPages = 0;
+    bool caseSensitive = false;
+
+    AhoCorasick* terms = nullptr;
+    Reprog* regex = nullptr;
+
+    void FindTermsInPage(int pageNo, Vec<TextSearchHit>& hitsOut);
+    void FindRegexInPage(int pageNo, Vec<TextSearchHit>& hitsOut);
+};
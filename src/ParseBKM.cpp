@@ -81,8 +81,30 @@ static std::string_view getIndentStr(int n) {
     return {maxIndentStr, (size_t)n * 2};
 }
 
-static void SerializeBookmarksRec(TocItem* node, int level, str::Str& s) {
+// the serialized bookmarks are written out in chunks so that
+// exporting huge outlines doesn't build the whole file in memory
+struct BookmarksWriter {
+    HANDLE h = nullptr;
+    str::Str s;
+    bool ok = true;
+
+    void Flush();
+};
+
+constexpr size_t kBookmarksFlushSize = 64 * 1024;
+
+void BookmarksWriter::Flush() {
+    if (ok && s.size() > 0) {
+        DWORD nWritten = 0;
+        BOOL res = WriteFile(h, s.Get(), (DWORD)s.size(), &nWritten, nullptr);
+        ok = res && nWritten == (DWORD)s.size();
+    }
+    s.Reset();
+}
+
+static void SerializeBookmarksRec(TocItem* node, int level, BookmarksWriter& w) {
     std::string_view indentStr = getIndentStr(level);
+    str::Str& s = w.s;
     while (node) {
         if (node->engineFilePath) {
             s.AppendView(indentStr);
@@ -131,8 +153,11 @@ static void SerializeBookmarksRec(TocItem* node, int level, str::Str& s) {
         CrashIf(!node->PageNumbersMatch());
         SerializeDest(node->GetPageDestination(), s);
         s.Append("\n");
+        if (s.size() >= kBookmarksFlushSize) {
+            w.Flush();
+        }
 
-        SerializeBookmarksRec(node->child, level + 1, s);
+        SerializeBookmarksRec(node->child, level + 1, w);
         node = node->next;
     }
 }
@@ -396,14 +421,24 @@ bool LoadAlterenativeBookmarks(std::string_view baseFileName, VbkmFile& vbkm) {
 }
 
 bool ExportBookmarksToFile(TocTree* bookmarks, const char* name, const char* bkmPath) {
-    str::Str s;
-    s.AppendFmt("version: %s\n", kBkmVersion);
+    AutoFreeWstr pathW = strconv::Utf8ToWstr(bkmPath);
+    HANDLE fh = CreateFileW(pathW, GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL,
+                            nullptr);
+    if (INVALID_HANDLE_VALUE == fh) {
+        return false;
+    }
+    AutoCloseHandle h(fh);
+
+    BookmarksWriter w;
+    w.h = fh;
+    w.s.AppendFmt("version: %s\n", kBkmVersion);
     if (str::IsEmpty(name)) {
         name = "default view";
     }
-    s.AppendFmt("name: %s\n", name);
-    SerializeBookmarksRec(bookmarks->root, 0, s);
-    return file::WriteFile(bkmPath, s.as_view());
+    w.s.AppendFmt("name: %s\n", name);
+    SerializeBookmarksRec(bookmarks->root, 0, w);
+    w.Flush();
+    return w.ok;
 }
 
 bool ParseVbkmFile(std::string_view sv, VbkmFile& vbkm) {
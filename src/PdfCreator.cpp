@@ -7,8 +7,10 @@ extern "C" {
 }
 
 #include "utils/BaseUtil.h"
+#include <zlib.h>
 #include "utils/ScopedWin.h"
 #include "utils/GdiplusUtil.h"
+#include "utils/WinUtil.h"
 #include "utils/Log.h"
 
 #include "wingui/TreeModel.h"
@@ -169,6 +171,69 @@ pdf_obj* add_image_res(fz_context* ctx, pdf_document* doc, pdf_obj* resources, c
     return ref;
 }
 
+// adds JPEG, JPEG 2000 and (unpredicted) Flate images with their compressed data
+// embedded as is (pdf_add_image would fully decode them, only to look for an already
+// embedded copy of the same image); returns nullptr for images that need re-encoding
+static pdf_obj* AddCompressedImage(fz_context* ctx, pdf_document* doc, fz_image* image) {
+    fz_compressed_buffer* cbuf = fz_compressed_image_buffer(ctx, image);
+    if (!cbuf || image->mask || image->imagemask || image->use_decode) {
+        return nullptr;
+    }
+    int type = cbuf->params.type;
+    bool isFlate = type == FZ_IMAGE_FLATE && cbuf->params.u.flate.predictor <= 1;
+    pdf_obj* cs = nullptr;
+    if (type == FZ_IMAGE_JPEG || isFlate) {
+        switch (fz_colorspace_type(ctx, image->colorspace)) {
+            case FZ_COLORSPACE_GRAY:
+                cs = PDF_NAME(DeviceGray);
+                break;
+            case FZ_COLORSPACE_RGB:
+                cs = PDF_NAME(DeviceRGB);
+                break;
+            case FZ_COLORSPACE_CMYK:
+                cs = PDF_NAME(DeviceCMYK);
+                break;
+            default:
+                return nullptr;
+        }
+    } else if (type != FZ_IMAGE_JPX) {
+        return nullptr;
+    }
+
+    pdf_obj* ref = nullptr;
+    pdf_obj* imobj = pdf_new_dict(ctx, doc, 8);
+    fz_try(ctx) {
+        pdf_dict_put(ctx, imobj, PDF_NAME(Type), PDF_NAME(XObject));
+        pdf_dict_put(ctx, imobj, PDF_NAME(Subtype), PDF_NAME(Image));
+        pdf_dict_put_int(ctx, imobj, PDF_NAME(Width), image->w);
+        pdf_dict_put_int(ctx, imobj, PDF_NAME(Height), image->h);
+        if (type == FZ_IMAGE_JPEG) {
+            pdf_dict_put(ctx, imobj, PDF_NAME(Filter), PDF_NAME(DCTDecode));
+            if (cbuf->params.u.jpeg.color_transform != -1) {
+                pdf_obj* dp = pdf_dict_put_dict(ctx, imobj, PDF_NAME(DecodeParms), 1);
+                pdf_dict_put_int(ctx, dp, PDF_NAME(ColorTransform), cbuf->params.u.jpeg.color_transform);
+            }
+        } else if (isFlate) {
+            pdf_dict_put(ctx, imobj, PDF_NAME(Filter), PDF_NAME(FlateDecode));
+        }
+        if (cs) {
+            pdf_dict_put_int(ctx, imobj, PDF_NAME(BitsPerComponent), image->bpc);
+            pdf_dict_put(ctx, imobj, PDF_NAME(ColorSpace), cs);
+        } else {
+            // a JPX stream carries its own bit depth and color space
+            pdf_dict_put(ctx, imobj, PDF_NAME(Filter), PDF_NAME(JPXDecode));
+        }
+        ref = pdf_add_stream(ctx, doc, cbuf->buffer, imobj, 1);
+    }
+    fz_always(ctx) {
+        pdf_drop_obj(ctx, imobj);
+    }
+    fz_catch(ctx) {
+        fz_rethrow(ctx);
+    }
+    return ref;
+}
+
 // based on create_page in pdfcreate.c
 bool PdfCreator::AddPageFromFzImage(fz_image* image, float imgDpi) {
     CrashIf(!ctx || !doc);
@@ -179,10 +244,12 @@ bool PdfCreator::AddPageFromFzImage(fz_image* image, float imgDpi) {
     pdf_obj* resources = nullptr;
     fz_buffer* contents = nullptr;
     fz_device* dev = nullptr;
+    pdf_obj* imref = nullptr;
 
     fz_var(contents);
     fz_var(resources);
     fz_var(dev);
+    fz_var(imref);
 
     fz_try(ctx) {
         float zoom = 1.0f;
@@ -193,16 +260,26 @@ bool PdfCreator::AddPageFromFzImage(fz_image* image, float imgDpi) {
         fz_rect bounds = fz_unit_rect;
         bounds = fz_transform_rect(bounds, ctm);
 
-        dev = pdf_page_write(ctx, doc, bounds, &resources, &contents);
-        fz_fill_image(ctx, dev, image, ctm, 1.0f, fz_default_color_params);
-        fz_drop_device(ctx, dev);
-        dev = nullptr;
+        imref = AddCompressedImage(ctx, doc, image);
+        if (imref) {
+            resources = pdf_new_dict(ctx, doc, 1);
+            pdf_obj* xobjs = pdf_dict_put_dict(ctx, resources, PDF_NAME(XObject), 1);
+            pdf_dict_puts(ctx, xobjs, "Im0", imref);
+            contents = fz_new_buffer(ctx, 64);
+            fz_append_printf(ctx, contents, "q %g 0 0 %g 0 0 cm /Im0 Do Q\n", ctm.a, ctm.d);
+        } else {
+            dev = pdf_page_write(ctx, doc, bounds, &resources, &contents);
+            fz_fill_image(ctx, dev, image, ctm, 1.0f, fz_default_color_params);
+            fz_drop_device(ctx, dev);
+            dev = nullptr;
+        }
 
         pdf_obj* page = pdf_add_page(ctx, doc, bounds, 0, resources, contents);
         pdf_insert_page(ctx, doc, -1, page);
         pdf_drop_obj(ctx, page);
     }
     fz_always(ctx) {
+        pdf_drop_obj(ctx, imref);
         pdf_drop_obj(ctx, resources);
         fz_drop_buffer(ctx, contents);
         fz_drop_device(ctx, dev);
@@ -251,12 +328,17 @@ bool PdfCreator::AddPageFromImageData(const char* data, size_t len, float imgDpi
     }
 
     fz_image* img = nullptr;
+    fz_buffer* buf = nullptr;
     fz_var(img);
+    fz_var(buf);
 
     fz_try(ctx) {
-        fz_buffer* buf = fz_new_buffer_from_copied_data(ctx, (u8*)data, len);
+        buf = fz_new_buffer_from_copied_data(ctx, (u8*)data, len);
         img = fz_new_image_from_buffer(ctx, buf);
     }
+    fz_always(ctx) {
+        fz_drop_buffer(ctx, buf);
+    }
     fz_catch(ctx) {
         return false;
     }
@@ -383,20 +465,287 @@ bool PdfCreator::SaveToFile(const char* filePath) {
     return true;
 }
 
+// upper limit for the number of threads rendering pages for RenderToFile
+#define MAX_RENDER_TO_FILE_THREADS 4
+// how many pages a thread may render ahead of the page to be added next
+#define RENDER_TO_FILE_PAGES_AHEAD 2
+#define RENDER_TO_FILE_JPEG_QUALITY 85
+
+// a rendered page's pixels, compressed for being added to the PDF document as they are
+struct CompressedPage {
+    Size size;
+    // JPEG or Flate compressed RGB pixels (nullptr if rendering failed)
+    char* data = nullptr;
+    size_t len = 0;
+    bool isJpeg = false;
+    bool done = false;
+};
+
+// returns the pixels as RGB without any row padding
+// caller must free() the result
+static u8* GetRgbPixels(HBITMAP hbmp, Size size) {
+    int w = size.dx;
+    int h = size.dy;
+    int stride = ((w * 3 + 3) / 4) * 4;
+    u8* data = (u8*)malloc((size_t)stride * h);
+    if (!data) {
+        return nullptr;
+    }
+
+    BITMAPINFO bmi = {0};
+    bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
+    bmi.bmiHeader.biWidth = w;
+    bmi.bmiHeader.biHeight = -h;
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 24;
+    bmi.bmiHeader.biCompression = BI_RGB;
+
+    HDC hDC = GetDC(nullptr);
+    int res = GetDIBits(hDC, hbmp, 0, h, data, &bmi, DIB_RGB_COLORS);
+    ReleaseDC(nullptr, hDC);
+    if (res == 0) {
+        free(data);
+        return nullptr;
+    }
+
+    // convert BGR to RGB and remove the padding (in place, row by row)
+    u8* dst = data;
+    for (int y = 0; y < h; y++) {
+        u8* src = data + (size_t)y * stride;
+        for (int x = 0; x < w; x++) {
+            u8 b = src[0];
+            dst[0] = src[2];
+            dst[1] = src[1];
+            dst[2] = b;
+            src += 3;
+            dst += 3;
+        }
+    }
+    return data;
+}
+
+static bool CompressPageAsFlate(RenderedBitmap* bmp, CompressedPage& page) {
+    ScopedMem<u8> rgb(GetRgbPixels(bmp->GetBitmap(), bmp->Size()));
+    if (!rgb) {
+        return false;
+    }
+    uLong rgbLen = (uLong)bmp->Size().dx * bmp->Size().dy * 3;
+    uLongf len = compressBound(rgbLen);
+    page.data = (char*)malloc(len);
+    if (!page.data || compress2((Bytef*)page.data, &len, rgb.Get(), rgbLen, Z_DEFAULT_COMPRESSION) != Z_OK) {
+        free(page.data);
+        page.data = nullptr;
+        return false;
+    }
+    page.len = len;
+    return true;
+}
+
+static bool CompressPageAsJpeg(RenderedBitmap* bmp, CompressedPage& page) {
+    Gdiplus::Bitmap gbmp(bmp->GetBitmap(), nullptr);
+    CLSID jpgEncId = GetEncoderClsid(L"image/jpeg");
+    ULONG quality = RENDER_TO_FILE_JPEG_QUALITY;
+    Gdiplus::EncoderParameters params;
+    params.Count = 1;
+    params.Parameter[0].Guid = Gdiplus::EncoderQuality;
+    params.Parameter[0].Type = Gdiplus::EncoderParameterValueTypeLong;
+    params.Parameter[0].NumberOfValues = 1;
+    params.Parameter[0].Value = &quality;
+
+    ScopedComPtr<IStream> stream;
+    if (FAILED(CreateStreamOnHGlobal(nullptr, TRUE, &stream))) {
+        return false;
+    }
+    if (gbmp.Save(stream, &jpgEncId, &params) != Ok) {
+        return false;
+    }
+    std::string_view data = GetDataFromStream(stream, nullptr);
+    page.data = (char*)data.data();
+    page.len = data.size();
+    page.isJpeg = true;
+    return page.data != nullptr;
+}
+
+// pages of image based documents are compressed as JPEG (as their images
+// most likely have been), all others losslessly
+static CompressedPage RenderCompressedPage(EngineBase* engine, int pageNo, float zoom, bool asJpeg) {
+    CompressedPage page;
+    RenderPageArgs args(pageNo, zoom, 0, nullptr, RenderTarget::Export);
+    RenderedBitmap* bmp = engine->RenderPage(args);
+    if (bmp) {
+        page.size = bmp->Size();
+        bool ok = asJpeg && CompressPageAsJpeg(bmp, page);
+        if (!ok) {
+            CompressPageAsFlate(bmp, page);
+        }
+    }
+    delete bmp;
+    return page;
+}
+
+static bool AddCompressedPage(PdfCreator* c, CompressedPage& page, float imgDpi) {
+    if (!c->ctx || !c->doc || !page.data) {
+        return false;
+    }
+    fz_context* ctx = c->ctx;
+    fz_image* image = nullptr;
+    fz_var(image);
+    fz_try(ctx) {
+        fz_compressed_buffer* cbuf = fz_malloc_struct(ctx, fz_compressed_buffer);
+        fz_try(ctx) {
+            cbuf->buffer = fz_new_buffer_from_copied_data(ctx, (u8*)page.data, page.len);
+        }
+        fz_catch(ctx) {
+            fz_free(ctx, cbuf);
+            fz_rethrow(ctx);
+        }
+        if (page.isJpeg) {
+            cbuf->params.type = FZ_IMAGE_JPEG;
+            cbuf->params.u.jpeg.color_transform = -1;
+        } else {
+            cbuf->params.type = FZ_IMAGE_FLATE;
+            cbuf->params.u.flate.columns = page.size.dx;
+            cbuf->params.u.flate.colors = 3;
+            cbuf->params.u.flate.bpc = 8;
+        }
+        // takes ownership of cbuf
+        image = fz_new_image_from_compressed_buffer(ctx, page.size.dx, page.size.dy, 8, fz_device_rgb(ctx),
+                                                    (int)imgDpi, (int)imgDpi, 0, 0, nullptr, nullptr, cbuf, nullptr);
+    }
+    fz_catch(ctx) {
+        return false;
+    }
+    bool ok = c->AddPageFromFzImage(image, imgDpi);
+    fz_drop_image(ctx, image);
+    return ok;
+}
+
+// pages are rendered and compressed on several threads (each with its own clone
+// of the engine) and added to the PDF document in page order. Threads may only
+// render a few pages ahead of the next page to be added, so that the number of
+// rendered pages kept in memory doesn't depend on the number of pages
+struct RenderToFileData {
+    CRITICAL_SECTION access;
+    CONDITION_VARIABLE changed;
+    float zoom = 0;
+    bool asJpeg = false;
+    int nPages = 0;
+    int nextToRender = 1;
+    int nextToAdd = 1;
+    // number of pages rendered ahead and of slots in pages
+    int window = 0;
+    // pageNo is rendered into pages[(pageNo - 1) % window]
+    CompressedPage* pages = nullptr;
+    bool aborted = false;
+};
+
+struct RenderToFileThreadData {
+    RenderToFileData* data;
+    EngineBase* engine;
+};
+
+static DWORD WINAPI RenderToFileThread(LPVOID arg) {
+    RenderToFileThreadData* td = (RenderToFileThreadData*)arg;
+    RenderToFileData* data = td->data;
+    for (;;) {
+        int pageNo;
+        {
+            ScopedCritSec scope(&data->access);
+            while (!data->aborted && data->nextToRender <= data->nPages &&
+                   data->nextToRender >= data->nextToAdd + data->window) {
+                SleepConditionVariableCS(&data->changed, &data->access, INFINITE);
+            }
+            if (data->aborted || data->nextToRender > data->nPages) {
+                return 0;
+            }
+            pageNo = data->nextToRender++;
+        }
+
+        CompressedPage page = RenderCompressedPage(td->engine, pageNo, data->zoom, data->asJpeg);
+
+        ScopedCritSec scope(&data->access);
+        page.done = true;
+        data->pages[(pageNo - 1) % data->window] = page;
+        WakeAllConditionVariable(&data->changed);
+    }
+}
+
 bool PdfCreator::RenderToFile(const char* pdfFileName, EngineBase* engine, int dpi) {
+    RenderToFileData data;
+    data.zoom = dpi / engine->GetFileDPI();
+    data.asJpeg = engine->kind == kindEngineImage || engine->kind == kindEngineImageDir ||
+                  engine->kind == kindEngineComicBooks;
+    data.nPages = engine->PageCount();
+
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    int nThreads = limitValue((int)si.dwNumberOfProcessors, 1, MAX_RENDER_TO_FILE_THREADS);
+    nThreads = std::min(nThreads, data.nPages);
+    RenderToFileThreadData threadData[MAX_RENDER_TO_FILE_THREADS] = {};
+    HANDLE threads[MAX_RENDER_TO_FILE_THREADS] = {};
+    int nStarted = 0;
+    // with a single thread, the pages are rendered with engine itself
+    if (nThreads > 1) {
+        InitializeCriticalSection(&data.access);
+        InitializeConditionVariable(&data.changed);
+        data.window = nThreads * RENDER_TO_FILE_PAGES_AHEAD;
+        data.pages = new CompressedPage[data.window];
+        for (int i = 0; i < nThreads; i++) {
+            EngineBase* clone = engine->Clone();
+            if (!clone) {
+                break;
+            }
+            threadData[i] = {&data, clone};
+            HANDLE thread = CreateThread(nullptr, 0, RenderToFileThread, &threadData[i], 0, nullptr);
+            if (!thread) {
+                delete clone;
+                threadData[i].engine = nullptr;
+                break;
+            }
+            threads[nStarted++] = thread;
+        }
+    }
+
     PdfCreator* c = new PdfCreator();
     bool ok = true;
-    // render all pages to images
-    float zoom = dpi / engine->GetFileDPI();
-    for (int i = 1; ok && i <= engine->PageCount(); i++) {
-        RenderPageArgs args(i, zoom, 0, nullptr, RenderTarget::Export);
-        RenderedBitmap* bmp = engine->RenderPage(args);
-        ok = false;
-        if (bmp) {
-            ok = AddPageFromHBITMAP(c, bmp->GetBitmap(), bmp->Size(), dpi);
+    for (int pageNo = 1; ok && pageNo <= data.nPages; pageNo++) {
+        CompressedPage page;
+        if (nStarted == 0) {
+            page = RenderCompressedPage(engine, pageNo, data.zoom, data.asJpeg);
+        } else {
+            ScopedCritSec scope(&data.access);
+            CompressedPage& slot = data.pages[(pageNo - 1) % data.window];
+            while (!slot.done) {
+                SleepConditionVariableCS(&data.changed, &data.access, INFINITE);
+            }
+            page = slot;
+            slot = CompressedPage();
+            data.nextToAdd++;
+            WakeAllConditionVariable(&data.changed);
+        }
+        ok = AddCompressedPage(c, page, (float)dpi);
+        free(page.data);
+    }
+
+    if (data.pages) {
+        EnterCriticalSection(&data.access);
+        data.aborted = true;
+        WakeAllConditionVariable(&data.changed);
+        LeaveCriticalSection(&data.access);
+        for (int i = 0; i < nStarted; i++) {
+            WaitForSingleObject(threads[i], INFINITE);
+            CloseHandle(threads[i]);
         }
-        delete bmp;
+        for (int i = 0; i < nThreads; i++) {
+            delete threadData[i].engine;
+        }
+        for (int i = 0; i < data.window; i++) {
+            free(data.pages[i].data);
+        }
+        delete[] data.pages;
+        DeleteCriticalSection(&data.access);
     }
+
     if (!ok) {
         delete c;
         return false;
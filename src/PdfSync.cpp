@@ -3,8 +3,10 @@
 
 #include "utils/BaseUtil.h"
 #include <synctex_parser.h>
+#include <algorithm>
 #include "utils/ScopedWin.h"
 #include "utils/FileUtil.h"
+#include "utils/ThreadUtil.h"
 
 #include "wingui/TreeModel.h"
 
@@ -25,6 +27,9 @@
 
 #define SYNCTEX_EXTENSION L".synctex"
 #define SYNCTEXGZ_EXTENSION L".synctex.gz"
+// synctex_display_query looks at most this many lines past the requested one
+// (the number of its lists of friends)
+#define SYNCTEX_MAX_LINE_DISTANCE 1024
 
 struct PdfsyncFileIndex {
     size_t start, end; // first and one-after-last index of lines associated with a file
@@ -41,18 +46,27 @@ struct PdfsyncPoint {
     UINT page, x, y;
 };
 
+// a node that synctex_display_query would consider for a source line
+struct SyncTexLineNode {
+    int tag, line;
+    synctex_node_t node;
+};
+
 // Synchronizer based on .pdfsync file generated with the pdfsync tex package
 class Pdfsync : public Synchronizer {
   public:
     Pdfsync(const WCHAR* syncfilename, EngineBase* engine) : Synchronizer(syncfilename), engine(engine) {
         AssertCrash(str::EndsWithI(syncfilename, PDFSYNC_EXTENSION));
     }
+    virtual ~Pdfsync() {
+        WaitForIndexing();
+    }
 
     virtual int DocToSource(UINT pageNo, Point pt, AutoFreeWstr& filename, UINT* line, UINT* col);
     virtual int SourceToDoc(const WCHAR* srcfilename, UINT line, UINT col, UINT* page, Vec<Rect>& rects);
 
   private:
-    int RebuildIndex();
+    virtual int RebuildIndex();
     UINT SourceToRecord(const WCHAR* srcfilename, UINT line, UINT col, Vec<size_t>& records);
 
     EngineBase* engine;              // needed for converting between coordinate systems
@@ -61,6 +75,8 @@ class Pdfsync : public Synchronizer {
     Vec<PdfsyncPoint> points;        // record-to-point mapping
     Vec<PdfsyncFileIndex> fileIndex; // start and end of entries for a file in <lines>
     Vec<size_t> sheetIndex;          // start of entries for a sheet in <points>
+    Vec<size_t> lineIndex;           // indices into <lines> sorted by file, line and record
+    Vec<size_t> pointIndex;          // indices into <points> sorted by record
 };
 
 // Synchronizer based on .synctex file generated with SyncTex
@@ -71,6 +87,7 @@ class SyncTex : public Synchronizer {
         AssertCrash(str::EndsWithI(syncfilename, SYNCTEX_EXTENSION));
     }
     virtual ~SyncTex() {
+        WaitForIndexing();
         synctex_scanner_free(scanner);
     }
 
@@ -78,14 +95,50 @@ class SyncTex : public Synchronizer {
     virtual int SourceToDoc(const WCHAR* srcfilename, UINT line, UINT col, UINT* page, Vec<Rect>& rects);
 
   private:
-    int RebuildIndex();
+    virtual int RebuildIndex();
+    int SourceToTag(const WCHAR* srcfilepath);
 
     EngineBase* engine; // needed for converting between coordinate systems
     synctex_scanner_t scanner;
+    // the scanner's nodes sorted by tag and line (and declaration order)
+    // for binary searching in SourceToDoc
+    Vec<SyncTexLineNode> lineNodes;
 };
 
 Synchronizer::Synchronizer(const WCHAR* syncfilepath) : indexDiscarded(true), syncfilepath(str::Dup(syncfilepath)) {
     _wstat(syncfilepath, &syncfileTimestamp);
+    InitializeCriticalSection(&indexAccess);
+}
+
+Synchronizer::~Synchronizer() {
+    WaitForIndexing();
+    DeleteCriticalSection(&indexAccess);
+}
+
+// parsing the sync file of larger documents takes long enough to be
+// noticeable, so this is started as soon as a document has been loaded
+void Synchronizer::BuildIndexAsync() {
+    if (indexToken) {
+        return;
+    }
+    indexToken = new CancelToken();
+    QueueWork(
+        WorkPriority::Index,
+        [this] {
+            ScopedCritSec scope(&indexAccess);
+            if (IsIndexDiscarded()) {
+                RebuildIndex();
+            }
+        },
+        indexToken);
+}
+
+void Synchronizer::WaitForIndexing() {
+    if (indexToken) {
+        indexToken->Wait();
+        indexToken->Release();
+        indexToken = nullptr;
+    }
 }
 
 bool Synchronizer::IsIndexDiscarded() const {
@@ -135,7 +188,8 @@ int Synchronizer::Create(const WCHAR* pdffilename, EngineBase* engine, Synchroni
     AutoFreeWstr syncFile(str::Join(baseName, PDFSYNC_EXTENSION));
     if (file::Exists(syncFile)) {
         *sync = new Pdfsync(syncFile, engine);
-        return *sync ? PDFSYNCERR_SUCCESS : PDFSYNCERR_OUTOFMEMORY;
+        (*sync)->BuildIndexAsync();
+        return PDFSYNCERR_SUCCESS;
     }
 
     // check if SYNCTEX or compressed SYNCTEX file is present
@@ -146,7 +200,8 @@ int Synchronizer::Create(const WCHAR* pdffilename, EngineBase* engine, Synchroni
         // due to a bug with synctex_parser.c, this must always be
         // the path to the .synctex file (even if a .synctex.gz file is used instead)
         *sync = new SyncTex(texFile, engine);
-        return *sync ? PDFSYNCERR_SUCCESS : PDFSYNCERR_OUTOFMEMORY;
+        (*sync)->BuildIndexAsync();
+        return PDFSYNCERR_SUCCESS;
     }
 
     return PDFSYNCERR_SYNCFILE_NOTFOUND;
@@ -310,6 +365,32 @@ int Pdfsync::RebuildIndex() {
     fileIndex.at(0).end = lines.size();
     SubmitCrashIf(filestack.size() != 1);
 
+    // sorted indices for binary searching in SourceToRecord and SourceToDoc
+    lineIndex.Reset();
+    for (size_t i = 0; i < lines.size(); i++) {
+        lineIndex.Append(i);
+    }
+    std::sort(lineIndex.begin(), lineIndex.end(), [this](size_t a, size_t b) {
+        PdfsyncLine& la = lines.at(a);
+        PdfsyncLine& lb = lines.at(b);
+        if (la.file != lb.file) {
+            return la.file < lb.file;
+        }
+        if (la.line != lb.line) {
+            return la.line < lb.line;
+        }
+        return a < b;
+    });
+    pointIndex.Reset();
+    for (size_t i = 0; i < points.size(); i++) {
+        pointIndex.Append(i);
+    }
+    std::sort(pointIndex.begin(), pointIndex.end(), [this](size_t a, size_t b) {
+        UINT ra = points.at(a).record;
+        UINT rb = points.at(b).record;
+        return ra != rb ? ra < rb : a < b;
+    });
+
     return Synchronizer::RebuildIndex();
 }
 
@@ -321,6 +402,7 @@ static int cmpLineRecords(const void* a, const void* b) {
 }
 
 int Pdfsync::DocToSource(UINT pageNo, Point pt, AutoFreeWstr& filename, UINT* line, UINT* col) {
+    ScopedCritSec scope(&indexAccess);
     if (IsIndexDiscarded())
         if (RebuildIndex() != PDFSYNCERR_SUCCESS)
             return PDFSYNCERR_SYNCFILE_CANNOT_BE_OPENED;
@@ -416,22 +498,38 @@ UINT Pdfsync::SourceToRecord(const WCHAR* srcfilename, UINT line, UINT col, Vec<
     if (fileIndex.at(isrc).start == fileIndex.at(isrc).end)
         return PDFSYNCERR_NORECORD_IN_SOURCEFILE; // there is not any record declaration for that particular source file
 
-    // look for sections belonging to the specified file
-    // starting with the first section that is declared within the scope of the file.
+    // find the first record of the file for the requested line or the line after it
+    size_t lo = 0, hi = lineIndex.size();
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        PdfsyncLine& l = lines.at(lineIndex.at(mid));
+        if (l.file < isrc || l.file == isrc && l.line < line)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    // of the closest lines before and after the requested one, pick the
+    // nearer one (or the one declared first, if they're equally distant)
     UINT min_distance = EPSILON_LINE; // distance to the closest record
     size_t lineIx = (size_t)-1;       // closest record-line index
-
-    for (size_t isec = fileIndex.at(isrc).start; isec < fileIndex.at(isrc).end; isec++) {
-        // does this section belong to the desired file?
-        if (lines.at(isec).file != isrc)
-            continue;
-
-        UINT d = abs((int)lines.at(isec).line - (int)line);
+    if (lo < lineIndex.size() && lines.at(lineIndex.at(lo)).file == isrc) {
+        UINT d = lines.at(lineIndex.at(lo)).line - line;
         if (d < min_distance) {
             min_distance = d;
-            lineIx = isec;
-            if (0 == d)
-                break; // We have found a record for the requested line!
+            lineIx = lineIndex.at(lo);
+        }
+    }
+    if (min_distance > 0 && lo > 0 && lines.at(lineIndex.at(lo - 1)).file == isrc) {
+        size_t i = lo - 1;
+        UINT prevLine = lines.at(lineIndex.at(i)).line;
+        for (; i > 0 && lines.at(lineIndex.at(i - 1)).file == isrc && lines.at(lineIndex.at(i - 1)).line == prevLine;
+             i--)
+            ;
+        UINT d = line - prevLine;
+        if (d < min_distance || d == min_distance && lineIndex.at(i) < lineIx) {
+            min_distance = d;
+            lineIx = lineIndex.at(i);
         }
     }
     if (lineIx == (size_t)-1)
@@ -446,6 +544,7 @@ UINT Pdfsync::SourceToRecord(const WCHAR* srcfilename, UINT line, UINT col, Vec<
 }
 
 int Pdfsync::SourceToDoc(const WCHAR* srcfilename, UINT line, UINT col, UINT* page, Vec<Rect>& rects) {
+    ScopedCritSec scope(&indexAccess);
     if (IsIndexDiscarded())
         if (RebuildIndex() != PDFSYNCERR_SUCCESS)
             return PDFSYNCERR_SYNCFILE_CANNOT_BE_OPENED;
@@ -458,11 +557,26 @@ int Pdfsync::SourceToDoc(const WCHAR* srcfilename, UINT line, UINT col, UINT* pa
     rects.Reset();
 
     // records have been found for the desired source position:
-    // we now find the page and positions in the PDF corresponding to these found records
+    // we now find the points in the PDF corresponding to these found records
+    Vec<size_t> found_points;
+    for (size_t record : found_records) {
+        size_t lo = 0, hi = pointIndex.size();
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (points.at(pointIndex.at(mid)).record < record)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        for (; lo < pointIndex.size() && points.at(pointIndex.at(lo)).record == record; lo++) {
+            found_points.Append(pointIndex.at(lo));
+        }
+    }
+    // and only use the ones on the page declared first
+    std::sort(found_points.begin(), found_points.end());
+
     UINT firstPage = UINT_MAX;
-    for (size_t i = 0; i < points.size(); i++) {
-        if (!found_records.Contains(points.at(i).record))
-            continue;
+    for (size_t i : found_points) {
         if (firstPage != UINT_MAX && firstPage != points.at(i).page)
             continue;
         firstPage = *page = points.at(i).page;
@@ -481,7 +595,25 @@ int Pdfsync::SourceToDoc(const WCHAR* srcfilename, UINT line, UINT col, UINT* pa
 
 // SYNCTEX synchronizer
 
+// collects the nodes in the order in which synctex_display_query would find them
+// (boxes with children are only found through their descendants)
+static void CollectSyncTexLineNodes(synctex_node_t node, Vec<SyncTexLineNode>& nodes) {
+    for (; node; node = synctex_node_sibling(node)) {
+        synctex_node_t child = synctex_node_child(node);
+        synctex_node_type_t type = synctex_node_type(node);
+        bool isBox = synctex_node_type_vbox == type || synctex_node_type_hbox == type;
+        if (!isBox || !child) {
+            SyncTexLineNode ln = {synctex_node_tag(node), synctex_node_line(node), node};
+            nodes.Append(ln);
+        }
+        if (child) {
+            CollectSyncTexLineNodes(child, nodes);
+        }
+    }
+}
+
 int SyncTex::RebuildIndex() {
+    lineNodes.Reset();
     synctex_scanner_free(scanner);
     scanner = nullptr;
 
@@ -495,10 +627,21 @@ int SyncTex::RebuildIndex() {
         return PDFSYNCERR_SYNCFILE_NOTFOUND; // cannot rebuild the index
     }
 
+    // synctex_display_query walks a long list of nodes for every line it tries,
+    // which is slow for large documents, so SourceToDoc uses a sorted copy instead
+    int nPages = engine->PageCount();
+    for (int pageNo = 1; pageNo <= nPages; pageNo++) {
+        CollectSyncTexLineNodes(synctex_sheet_content(scanner, pageNo), lineNodes);
+    }
+    std::stable_sort(lineNodes.begin(), lineNodes.end(), [](const SyncTexLineNode& a, const SyncTexLineNode& b) {
+        return a.tag != b.tag ? a.tag < b.tag : a.line < b.line;
+    });
+
     return Synchronizer::RebuildIndex();
 }
 
 int SyncTex::DocToSource(UINT pageNo, Point pt, AutoFreeWstr& filename, UINT* line, UINT* col) {
+    ScopedCritSec scope(&indexAccess);
     if (IsIndexDiscarded()) {
         if (RebuildIndex() != PDFSYNCERR_SUCCESS)
             return PDFSYNCERR_SYNCFILE_CANNOT_BE_OPENED;
@@ -544,6 +687,8 @@ TryAgainAnsi:
 }
 
 int SyncTex::SourceToDoc(const WCHAR* srcfilename, UINT line, UINT col, UINT* page, Vec<Rect>& rects) {
+    UNUSED(col);
+    ScopedCritSec scope(&indexAccess);
     if (IsIndexDiscarded()) {
         if (RebuildIndex() != PDFSYNCERR_SUCCESS)
             return PDFSYNCERR_SYNCFILE_CANNOT_BE_OPENED;
@@ -559,30 +704,56 @@ int SyncTex::SourceToDoc(const WCHAR* srcfilename, UINT line, UINT col, UINT* pa
     if (!srcfilepath)
         return PDFSYNCERR_OUTOFMEMORY;
 
-    bool isUtf8 = true;
-    const char* mb_srcfilepath = strconv::WstrToUtf8(srcfilepath).data();
-TryAgainAnsi:
-    if (!mb_srcfilepath)
-        return PDFSYNCERR_OUTOFMEMORY;
-    int ret = synctex_display_query(this->scanner, mb_srcfilepath, line, col);
-    str::Free(mb_srcfilepath);
-    // recent SyncTeX versions encode in UTF-8 instead of ANSI
-    if (isUtf8 && -1 == ret) {
-        isUtf8 = false;
-        mb_srcfilepath = (char*)strconv::WstrToAnsi(srcfilepath).data();
-        goto TryAgainAnsi;
-    }
-
-    if (-1 == ret)
+    int tag = SourceToTag(srcfilepath);
+    if (tag <= 0)
         return PDFSYNCERR_UNKNOWN_SOURCEFILE;
-    if (0 == ret)
+
+    // this matches the results of synctex_display_query (where the column is ignored as well):
+    // find the first line at or after the requested one which has any nodes
+    size_t lo = 0, hi = lineNodes.size();
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        SyncTexLineNode& ln = lineNodes.at(mid);
+        if (ln.tag < tag || ln.tag == tag && (UINT)ln.line < line)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == lineNodes.size() || lineNodes.at(lo).tag != tag ||
+        (UINT)lineNodes.at(lo).line >= line + SYNCTEX_MAX_LINE_DISTANCE)
         return PDFSYNCERR_NOSYNCPOINT_FOR_LINERECORD;
+    int foundLine = lineNodes.at(lo).line;
+    for (hi = lo; hi < lineNodes.size() && lineNodes.at(hi).tag == tag && lineNodes.at(hi).line == foundLine; hi++)
+        ;
+
+    // prefer boundaries, then kerns, glues and math nodes and only then boxes
+    Vec<synctex_node_t> found;
+    synctex_node_type_t minTypes[] = {synctex_node_type_boundary, synctex_node_type_kern, synctex_node_type_error};
+    for (size_t i = 0; i < dimof(minTypes) && found.size() == 0; i++) {
+        for (size_t j = lo; j < hi; j++) {
+            if (synctex_node_type(lineNodes.at(j).node) >= minTypes[i])
+                found.Append(lineNodes.at(j).node);
+        }
+    }
+
+    // only keep the nodes that aren't descendants of their predecessor's parent
+    Vec<synctex_node_t> results;
+    for (synctex_node_t node : found) {
+        if (results.size() > 0) {
+            synctex_node_t prevParent = synctex_node_parent(results.Last());
+            synctex_node_t ancestor = node;
+            while ((ancestor = synctex_node_parent(ancestor)) != nullptr && ancestor != prevParent)
+                ;
+            if (ancestor)
+                continue;
+        }
+        results.Append(node);
+    }
 
-    synctex_node_t node;
     int firstpage = -1;
     rects.Reset();
 
-    while ((node = synctex_next_result(this->scanner)) != nullptr) {
+    for (synctex_node_t node : results) {
         if (firstpage == -1) {
             firstpage = synctex_node_page(node);
             if (firstpage <= 0 || firstpage > engine->PageCount())
@@ -604,3 +775,15 @@ TryAgainAnsi:
         return PDFSYNCERR_NOSYNCPOINT_FOR_LINERECORD;
     return PDFSYNCERR_SUCCESS;
 }
+
+// returns the scanner's tag for a source file or 0 if it's unknown
+int SyncTex::SourceToTag(const WCHAR* srcfilepath) {
+    AutoFree name(strconv::WstrToUtf8(srcfilepath));
+    int tag = name ? synctex_scanner_get_tag(this->scanner, name) : 0;
+    // recent SyncTeX versions encode in UTF-8 instead of ANSI
+    if (0 == tag) {
+        name.Set(strconv::WstrToAnsi(srcfilepath).data());
+        tag = name ? synctex_scanner_get_tag(this->scanner, name) : 0;
+    }
+    return tag;
+}
@@ -19,12 +19,12 @@ enum {
 };
 
 class EngineBase;
+class CancelToken;
 
 class Synchronizer {
   public:
     explicit Synchronizer(const WCHAR* syncfilepath);
-    virtual ~Synchronizer() {
-    }
+    virtual ~Synchronizer();
 
     // Inverse-search:
     //  - pageNo: page number in the PDF (starting from 1)
@@ -42,17 +42,26 @@ class Synchronizer {
     // the caller must free() the command line
     WCHAR* PrepareCommandline(const WCHAR* pattern, const WCHAR* filename, UINT line, UINT col);
 
+    // builds the index on a background thread so that it's ready
+    // by the time the first search happens (e.g. right after a reload)
+    void BuildIndexAsync();
+
   private:
     bool indexDiscarded; // true if the index needs to be recomputed (needs to be set to true when a change to the
                          // pdfsync file is detected)
     struct _stat syncfileTimestamp; // time stamp of sync file when index was last built
+    CancelToken* indexToken = nullptr;
 
   protected:
     bool IsIndexDiscarded() const;
-    int RebuildIndex();
+    virtual int RebuildIndex();
+    // must be called first thing in the destructor of classes overriding RebuildIndex
+    void WaitForIndexing();
     WCHAR* PrependDir(const WCHAR* filename) const;
 
     AutoFreeWstr syncfilepath; // path to the synchronization file
+    // must be held while building or using the index
+    CRITICAL_SECTION indexAccess;
 
   public:
     static int Create(const WCHAR* pdffilename, EngineBase* engine, Synchronizer** sync);
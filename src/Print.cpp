@@ -110,153 +110,255 @@ static RectD BoundSelectionOnPage(const Vec<SelectionOnPage>& sel, int pageNo) {
     return bounds;
 }
 
-static bool PrintToDevice(const PrintData& pd, ProgressUpdateUI* progressUI = nullptr,
-                          AbortCookieManager* abortCookie = nullptr) {
-    CrashIf(!pd.engine);
-    if (!pd.engine) {
-        return false;
-    }
-    CrashIf(!pd.printerName);
-    if (!pd.printerName) {
-        return false;
-    }
+// pages are rendered in horizontal bands of at most this many bytes, so that
+// the memory needed for printing doesn't grow with the printer's resolution
+#define PRINT_BAND_MAX_BYTES (16 * 1024 * 1024)
+// how many rendered bands may wait for being sent to the printer
+#define PRINT_MAX_QUEUED_BANDS 3
+
+struct PrintBand {
+    RenderedBitmap* bmp = nullptr; // nullptr if rendering failed
+    Rect rc;                       // where to draw bmp on the printer DC
+    bool endsPage = false;
+
+    // pages printed as vector graphics are drawn by the print thread
+    // (with the top-left corner of clip at rc.TL())
+    bool isVector = false;
+    int pageNo = 0;
+    float zoom = 0;
+    int rotation = 0;
+    RectD clip;
+};
 
-    EngineBase& engine = *pd.engine;
-    AutoFreeWstr fileName;
+// the bands are rendered on a separate thread while the print thread sends
+// the previous ones to the printer, so that rendering the next page overlaps
+// with spooling the current one
+class PrintBandQueue {
+    CRITICAL_SECTION access;
+    CONDITION_VARIABLE bandQueued;
+    CONDITION_VARIABLE bandRemoved;
+    Vec<PrintBand> bands;
+    bool finished = false; // no more bands will be queued
+    bool aborted = false;  // no more bands will be printed
 
-    DOCINFO di = {0};
-    di.cbSize = sizeof(DOCINFO);
-    if (gPluginMode) {
-        fileName.Set(url::GetFileName(gPluginURL));
-        // fall back to a generic "filename" instead of the more confusing temporary filename
-        di.lpszDocName = fileName ? fileName.get() : L"filename";
-    } else {
-        di.lpszDocName = engine.FileName();
+  public:
+    PrintBandQueue() {
+        InitializeCriticalSection(&access);
+        InitializeConditionVariable(&bandQueued);
+        InitializeConditionVariable(&bandRemoved);
+    }
+    ~PrintBandQueue() {
+        for (PrintBand& band : bands) {
+            delete band.bmp;
+        }
+        DeleteCriticalSection(&access);
     }
 
-    int current = 1, total = 0;
-    if (pd.sel.size() == 0) {
-        for (size_t i = 0; i < pd.ranges.size(); i++) {
-            if (pd.ranges.at(i).nToPage < pd.ranges.at(i).nFromPage) {
-                total += pd.ranges.at(i).nFromPage - pd.ranges.at(i).nToPage + 1;
-            } else {
-                total += pd.ranges.at(i).nToPage - pd.ranges.at(i).nFromPage + 1;
-            }
+    // blocks while too many bands are waiting for the printer.
+    // returns false (and deletes the band) if printing has been aborted
+    bool Push(const PrintBand& band) {
+        ScopedCritSec scope(&access);
+        while (bands.size() >= PRINT_MAX_QUEUED_BANDS && !aborted) {
+            SleepConditionVariableCS(&bandRemoved, &access, INFINITE);
         }
-    } else {
-        for (int pageNo = 1; pageNo <= engine.PageCount(); pageNo++) {
-            if (!BoundSelectionOnPage(pd.sel, pageNo).IsEmpty()) {
-                total++;
-            }
+        if (aborted) {
+            delete band.bmp;
+            return false;
         }
-    }
-    AssertCrash(total > 0);
-    if (0 == total) {
-        return false;
+        bands.Append(band);
+        WakeConditionVariable(&bandQueued);
+        return true;
     }
 
-    if (progressUI) {
-        progressUI->UpdateProgress(current, total);
+    // blocks until the next band has been rendered.
+    // returns false once all bands have been handed out
+    bool Pop(PrintBand& band) {
+        ScopedCritSec scope(&access);
+        while (bands.size() == 0 && !finished) {
+            SleepConditionVariableCS(&bandQueued, &access, INFINITE);
+        }
+        if (bands.size() == 0) {
+            return false;
+        }
+        band = bands.at(0);
+        bands.RemoveAt(0);
+        WakeConditionVariable(&bandRemoved);
+        return true;
     }
 
-    // cf. http://blogs.msdn.com/b/oldnewthing/archive/2012/11/09/10367057.aspx
-    AutoDeleteDC hdc(CreateDC(nullptr, pd.printerName, nullptr, pd.devMode));
-    if (!hdc) {
-        return false;
+    void Finish() {
+        ScopedCritSec scope(&access);
+        finished = true;
+        WakeConditionVariable(&bandQueued);
     }
 
-    if (StartDoc(hdc, &di) <= 0) {
-        return false;
+    void Abort() {
+        ScopedCritSec scope(&access);
+        aborted = true;
+        WakeConditionVariable(&bandRemoved);
     }
+};
 
-    // MM_TEXT: Each logical unit is mapped to one device pixel.
-    // Positive x is to the right; positive y is down.
-    SetMapMode(hdc, MM_TEXT);
+// state of the thread rendering the pages to print (using the print job's engine,
+// which the print thread only uses for pages printed as vector graphics, but then
+// the render thread doesn't render any pages itself)
+struct PrintRenderer {
+    const PrintData& pd;
+    ProgressUpdateUI* progressUI = nullptr;
+    AbortCookieManager* abortCookie = nullptr;
+    PrintBandQueue queue;
 
-    const Size paperSize(GetDeviceCaps(hdc, PHYSICALWIDTH), GetDeviceCaps(hdc, PHYSICALHEIGHT));
-    const Rect printable(GetDeviceCaps(hdc, PHYSICALOFFSETX), GetDeviceCaps(hdc, PHYSICALOFFSETY),
-                         GetDeviceCaps(hdc, HORZRES), GetDeviceCaps(hdc, VERTRES));
-    float fileDPI = engine.GetFileDPI();
-    float px = (float)GetDeviceCaps(hdc, LOGPIXELSX);
-    float py = (float)GetDeviceCaps(hdc, LOGPIXELSY);
-    float dpiFactor = std::min(px / fileDPI, py / fileDPI);
-    bool bPrintPortrait = paperSize.dx < paperSize.dy;
-    if (pd.devMode && (pd.devMode.Get()->dmFields & DM_ORIENTATION))
-        bPrintPortrait = DMORIENT_PORTRAIT == pd.devMode.Get()->dmOrientation;
-    if (pd.advData.rotation == PrintRotationAdv::Portrait) {
-        bPrintPortrait = true;
-    } else if (pd.advData.rotation == PrintRotationAdv::Landscape) {
-        bPrintPortrait = false;
+    Size paperSize;
+    Rect printable;
+    float dpiFactor = 1.f;
+    bool bPrintPortrait = true;
+
+    PrintRenderer(const PrintData& pd, ProgressUpdateUI* progressUI, AbortCookieManager* abortCookie)
+        : pd(pd), progressUI(progressUI), abortCookie(abortCookie) {
     }
 
-    if (pd.sel.size() > 0) {
-        for (int pageNo = 1; pageNo <= engine.PageCount(); pageNo++) {
-            RectD bounds = BoundSelectionOnPage(pd.sel, pageNo);
-            if (bounds.IsEmpty()) {
-                continue;
-            }
+    bool WasCanceled() {
+        return progressUI && progressUI->WasCanceled();
+    }
+};
 
-            if (progressUI) {
-                progressUI->UpdateProgress(current, total);
+// renders the part clip of a page in bands to be printed starting at offset
+// and passes them on to emit. returns false if printing has been aborted
+static bool RenderPrintBands(PrintRenderer& r, int pageNo, float zoom, int rotation, RectD clip, Point offset,
+                             bool endsPage, const std::function<bool(const PrintBand&)>& emit) {
+    EngineBase& engine = *r.pd.engine;
+    Rect full = engine.Transform(clip, pageNo, zoom, rotation).Round();
+    int bandDy = std::max(PRINT_BAND_MAX_BYTES / std::max(full.dx * 4, 1), 1);
+
+    int y = 0;
+    do {
+        int dy = std::min(bandDy, full.dy - y);
+        RectD bandRc(full.x, full.y + y, full.dx, dy);
+        RectD bandClip = engine.Transform(bandRc, pageNo, zoom, rotation, true).Intersect(clip);
+
+        PrintBand band;
+        band.endsPage = endsPage && y + dy >= full.dy;
+        short shrink = 1;
+        while (dy > 0 && !bandClip.IsEmpty() && shrink < 32 && !r.WasCanceled()) {
+            RenderPageArgs args(pageNo, zoom / shrink, rotation, &bandClip, RenderTarget::Print);
+            if (r.abortCookie) {
+                args.cookie_out = &r.abortCookie->cookie;
+            }
+            band.bmp = engine.RenderPage(args);
+            if (r.abortCookie) {
+                r.abortCookie->Clear();
             }
+            if (band.bmp && band.bmp->GetBitmap()) {
+                Size size = band.bmp->Size();
+                band.rc = Rect(offset.x, offset.y + y, size.dx * shrink, size.dy * shrink);
+                break;
+            }
+            delete band.bmp;
+            band.bmp = nullptr;
+            shrink *= 2;
+        }
+        // TODO: abort if !band.bmp?
 
-            StartPage(hdc);
+        if (!emit(band)) {
+            return false;
+        }
+        y += dy;
+    } while (y < full.dy);
+    return !r.WasCanceled();
+}
 
-            geomutil::SizeT<float> bSize = bounds.Size().Convert<float>();
-            float zoom = std::min((float)printable.dx / bSize.dx, (float)printable.dy / bSize.dy);
-            // use the correct zoom values, if the page fits otherwise
-            // and the user didn't ask for anything else (default setting)
-            if (PrintScaleAdv::Shrink == pd.advData.scale) {
-                zoom = std::min(dpiFactor, zoom);
-            } else if (PrintScaleAdv::None == pd.advData.scale) {
-                zoom = dpiFactor;
-            }
+static bool QueuePrintPage(PrintRenderer& r, int pageNo, float zoom, int rotation, RectD clip, Point offset,
+                           bool endsPage) {
+    if (r.pd.advData.printAsVector) {
+        PrintBand band;
+        band.isVector = true;
+        band.pageNo = pageNo;
+        band.zoom = zoom;
+        band.rotation = rotation;
+        band.clip = clip;
+        band.rc = Rect(offset.x, offset.y, 0, 0);
+        band.endsPage = endsPage;
+        return r.queue.Push(band) && !r.WasCanceled();
+    }
+    return RenderPrintBands(r, pageNo, zoom, rotation, clip, offset, endsPage,
+                            [&r](const PrintBand& band) { return r.queue.Push(band); });
+}
 
-            for (size_t i = 0; i < pd.sel.size(); i++) {
-                if (pd.sel.at(i).pageNo != pageNo) {
-                    continue;
-                }
+// draws a page as vector graphics, if the engine supports that for the page,
+// and otherwise as bitmaps (which are then rendered on the print thread)
+static void PrintVectorPage(PrintRenderer& r, HDC hdc, const PrintBand& band) {
+    RectD clip = band.clip;
+    RenderPageArgs args(band.pageNo, band.zoom, band.rotation, &clip, RenderTarget::Print);
+    if (r.abortCookie) {
+        args.cookie_out = &r.abortCookie->cookie;
+    }
+    bool ok = r.pd.engine->RenderPageToDC(hdc, args, band.rc.TL());
+    if (r.abortCookie) {
+        r.abortCookie->Clear();
+    }
+    if (ok || r.WasCanceled()) {
+        return;
+    }
+    RenderPrintBands(r, band.pageNo, band.zoom, band.rotation, band.clip, band.rc.TL(), false,
+                     [hdc](const PrintBand& bmpBand) {
+                         if (bmpBand.bmp) {
+                             bmpBand.bmp->StretchDIBits(hdc, bmpBand.rc);
+                             delete bmpBand.bmp;
+                         }
+                         return true;
+                     });
+}
 
-                RectD* clipRegion = &pd.sel.at(i).rect;
-                Point offset((int)((clipRegion->x - bounds.x) * zoom), (int)((clipRegion->y - bounds.y) * zoom));
-                if (pd.advData.scale != PrintScaleAdv::None) {
-                    // center the selection on the physical paper
-                    offset.x += (int)(printable.dx - bSize.dx * zoom) / 2;
-                    offset.y += (int)(printable.dy - bSize.dy * zoom) / 2;
-                }
+static void RenderSelectionForPrint(PrintRenderer& r) {
+    const PrintData& pd = r.pd;
+    EngineBase& engine = *pd.engine;
+    for (int pageNo = 1; pageNo <= engine.PageCount(); pageNo++) {
+        RectD bounds = BoundSelectionOnPage(pd.sel, pageNo);
+        if (bounds.IsEmpty()) {
+            continue;
+        }
 
-                bool ok = false;
-                short shrink = 1;
-                do {
-                    RenderPageArgs args(pd.sel.at(i).pageNo, zoom / shrink, pd.rotation, clipRegion,
-                                        RenderTarget::Print);
-                    if (abortCookie) {
-                        args.cookie_out = &abortCookie->cookie;
-                    }
-                    RenderedBitmap* bmp = engine.RenderPage(args);
-                    if (abortCookie) {
-                        abortCookie->Clear();
-                    }
-                    if (bmp && bmp->GetBitmap()) {
-                        Rect rc(offset.x, offset.y, bmp->Size().dx * shrink, bmp->Size().dy * shrink);
-                        ok = bmp->StretchDIBits(hdc, rc);
-                    }
-                    delete bmp;
-                    shrink *= 2;
-                } while (!ok && shrink < 32 && !(progressUI && progressUI->WasCanceled()));
-            }
-            // TODO: abort if !ok?
+        geomutil::SizeT<float> bSize = bounds.Size().Convert<float>();
+        float zoom = std::min((float)r.printable.dx / bSize.dx, (float)r.printable.dy / bSize.dy);
+        // use the correct zoom values, if the page fits otherwise
+        // and the user didn't ask for anything else (default setting)
+        if (PrintScaleAdv::Shrink == pd.advData.scale) {
+            zoom = std::min(r.dpiFactor, zoom);
+        } else if (PrintScaleAdv::None == pd.advData.scale) {
+            zoom = r.dpiFactor;
+        }
 
-            if (EndPage(hdc) <= 0 || progressUI && progressUI->WasCanceled()) {
-                AbortDoc(hdc);
-                return false;
+        size_t last = 0;
+        for (size_t i = 0; i < pd.sel.size(); i++) {
+            if (pd.sel.at(i).pageNo == pageNo) {
+                last = i;
             }
-            current++;
         }
+        for (size_t i = 0; i <= last; i++) {
+            if (pd.sel.at(i).pageNo != pageNo) {
+                continue;
+            }
 
-        EndDoc(hdc);
-        return false;
+            RectD clipRegion = pd.sel.at(i).rect;
+            Point offset((int)((clipRegion.x - bounds.x) * zoom), (int)((clipRegion.y - bounds.y) * zoom));
+            if (pd.advData.scale != PrintScaleAdv::None) {
+                // center the selection on the physical paper
+                offset.x += (int)(r.printable.dx - bSize.dx * zoom) / 2;
+                offset.y += (int)(r.printable.dy - bSize.dy * zoom) / 2;
+            }
+
+            if (!QueuePrintPage(r, pageNo, zoom, pd.rotation, clipRegion, offset, i == last)) {
+                return;
+            }
+        }
     }
+}
+
+static void RenderPageRangesForPrint(PrintRenderer& r) {
+    const PrintData& pd = r.pd;
+    EngineBase& engine = *pd.engine;
+    const Size& paperSize = r.paperSize;
+    const Rect& printable = r.printable;
 
     // print all the pages the user requested
     for (size_t i = 0; i < pd.ranges.size(); i++) {
@@ -266,13 +368,9 @@ static bool PrintToDevice(const PrintData& pd, ProgressUpdateUI* progressUI = nu
                 (PrintRangeAdv::Odd == pd.advData.range && pageNo % 2 == 0)) {
                 continue;
             }
-            if (progressUI) {
-                progressUI->UpdateProgress(current, total);
-            }
 
-            StartPage(hdc);
-
-            geomutil::SizeT<float> pSize = engine.PageMediabox(pageNo).Size().Convert<float>();
+            RectD mediabox = engine.PageMediabox(pageNo);
+            geomutil::SizeT<float> pSize = mediabox.Size().Convert<float>();
             int rotation = 0;
             // Turn the document by 90 deg if it isn't in portrait mode
             if (pSize.dx > pSize.dy) {
@@ -282,13 +380,13 @@ static bool PrintToDevice(const PrintData& pd, ProgressUpdateUI* progressUI = nu
             // make sure not to print upside-down
             rotation = (rotation % 180) == 0 ? 0 : 270;
             // finally turn the page by (another) 90 deg in landscape mode
-            if (!bPrintPortrait) {
+            if (!r.bPrintPortrait) {
                 rotation = (rotation + 90) % 360;
                 std::swap(pSize.dx, pSize.dy);
             }
 
             // dpiFactor means no physical zoom
-            float zoom = dpiFactor;
+            float zoom = r.dpiFactor;
             // offset of the top-left corner of the page from the printable area
             // (negative values move the page into the left/top margins, etc.);
             // offset adjustments are needed because the GDI coordinate system
@@ -308,8 +406,8 @@ static bool PrintToDevice(const PrintData& pd, ProgressUpdateUI* progressUI = nu
                                          std::min((float)paperSize.dx / pSize.dx, (float)paperSize.dy / pSize.dy)));
                 // use the correct zoom values, if the page fits otherwise
                 // and the user didn't ask for anything else (default setting)
-                if (PrintScaleAdv::Shrink == pd.advData.scale && dpiFactor < zoom)
-                    zoom = dpiFactor;
+                if (PrintScaleAdv::Shrink == pd.advData.scale && r.dpiFactor < zoom)
+                    zoom = r.dpiFactor;
                 // center the page on the physical paper
                 offset.x += (int)(paperSize.dx - pSize.dx * zoom) / 2;
                 offset.y += (int)(paperSize.dy - pSize.dy * zoom) / 2;
@@ -328,35 +426,154 @@ static bool PrintToDevice(const PrintData& pd, ProgressUpdateUI* progressUI = nu
                 }
             }
 
-            bool ok = false;
-            short shrink = 1;
-            do {
-                RenderPageArgs args(pageNo, zoom / shrink, rotation, nullptr, RenderTarget::Print);
-                if (abortCookie) {
-                    args.cookie_out = &abortCookie->cookie;
-                }
-                RenderedBitmap* bmp = engine.RenderPage(args);
-                if (abortCookie) {
-                    abortCookie->Clear();
-                }
-                if (bmp && bmp->GetBitmap()) {
-                    auto size = bmp->Size();
-                    Rect rc(offset.x, offset.y, size.dx * shrink, size.dy * shrink);
-                    ok = bmp->StretchDIBits(hdc, rc);
-                }
-                delete bmp;
-                shrink *= 2;
-            } while (!ok && shrink < 32 && !(progressUI && progressUI->WasCanceled()));
-            // TODO: abort if !ok?
-
-            if (EndPage(hdc) <= 0 || progressUI && progressUI->WasCanceled()) {
-                AbortDoc(hdc);
-                return false;
+            if (!QueuePrintPage(r, pageNo, zoom, rotation, mediabox, offset, true)) {
+                return;
+            }
+        }
+    }
+}
+
+static DWORD WINAPI PrintRenderThread(LPVOID data) {
+    PrintRenderer* r = (PrintRenderer*)data;
+    if (r->pd.sel.size() > 0) {
+        RenderSelectionForPrint(*r);
+    } else {
+        RenderPageRangesForPrint(*r);
+    }
+    r->queue.Finish();
+    return 0;
+}
+
+// hdcReuse is a DC for pd.printerName that is kept across several print jobs
+// (it's reset to pd.devMode instead of creating a new one)
+static bool PrintToDevice(const PrintData& pd, ProgressUpdateUI* progressUI = nullptr,
+                          AbortCookieManager* abortCookie = nullptr, HDC hdcReuse = nullptr) {
+    CrashIf(!pd.engine);
+    if (!pd.engine) {
+        return false;
+    }
+    CrashIf(!pd.printerName);
+    if (!pd.printerName) {
+        return false;
+    }
+
+    EngineBase& engine = *pd.engine;
+    AutoFreeWstr fileName;
+
+    DOCINFO di = {0};
+    di.cbSize = sizeof(DOCINFO);
+    if (gPluginMode) {
+        fileName.Set(url::GetFileName(gPluginURL));
+        // fall back to a generic "filename" instead of the more confusing temporary filename
+        di.lpszDocName = fileName ? fileName.get() : L"filename";
+    } else {
+        di.lpszDocName = engine.FileName();
+    }
+
+    int current = 1, total = 0;
+    if (pd.sel.size() == 0) {
+        for (size_t i = 0; i < pd.ranges.size(); i++) {
+            if (pd.ranges.at(i).nToPage < pd.ranges.at(i).nFromPage) {
+                total += pd.ranges.at(i).nFromPage - pd.ranges.at(i).nToPage + 1;
+            } else {
+                total += pd.ranges.at(i).nToPage - pd.ranges.at(i).nFromPage + 1;
+            }
+        }
+    } else {
+        for (int pageNo = 1; pageNo <= engine.PageCount(); pageNo++) {
+            if (!BoundSelectionOnPage(pd.sel, pageNo).IsEmpty()) {
+                total++;
+            }
+        }
+    }
+    AssertCrash(total > 0);
+    if (0 == total) {
+        return false;
+    }
+
+    if (progressUI) {
+        progressUI->UpdateProgress(current, total);
+    }
+
+    // cf. http://blogs.msdn.com/b/oldnewthing/archive/2012/11/09/10367057.aspx
+    AutoDeleteDC hdcCreated(hdcReuse ? nullptr : CreateDC(nullptr, pd.printerName, nullptr, pd.devMode));
+    HDC hdc = hdcReuse ? hdcReuse : hdcCreated;
+    if (!hdc) {
+        return false;
+    }
+    if (hdcReuse && pd.devMode && !ResetDC(hdc, pd.devMode)) {
+        return false;
+    }
+
+    if (StartDoc(hdc, &di) <= 0) {
+        return false;
+    }
+
+    // MM_TEXT: Each logical unit is mapped to one device pixel.
+    // Positive x is to the right; positive y is down.
+    SetMapMode(hdc, MM_TEXT);
+
+    PrintRenderer r(pd, progressUI, abortCookie);
+    r.paperSize = Size(GetDeviceCaps(hdc, PHYSICALWIDTH), GetDeviceCaps(hdc, PHYSICALHEIGHT));
+    r.printable = Rect(GetDeviceCaps(hdc, PHYSICALOFFSETX), GetDeviceCaps(hdc, PHYSICALOFFSETY),
+                       GetDeviceCaps(hdc, HORZRES), GetDeviceCaps(hdc, VERTRES));
+    float fileDPI = engine.GetFileDPI();
+    float px = (float)GetDeviceCaps(hdc, LOGPIXELSX);
+    float py = (float)GetDeviceCaps(hdc, LOGPIXELSY);
+    r.dpiFactor = std::min(px / fileDPI, py / fileDPI);
+    r.bPrintPortrait = r.paperSize.dx < r.paperSize.dy;
+    if (pd.devMode && (pd.devMode.Get()->dmFields & DM_ORIENTATION))
+        r.bPrintPortrait = DMORIENT_PORTRAIT == pd.devMode.Get()->dmOrientation;
+    if (pd.advData.rotation == PrintRotationAdv::Portrait) {
+        r.bPrintPortrait = true;
+    } else if (pd.advData.rotation == PrintRotationAdv::Landscape) {
+        r.bPrintPortrait = false;
+    }
+
+    HANDLE renderThread = CreateThread(nullptr, 0, PrintRenderThread, &r, 0, nullptr);
+    if (!renderThread) {
+        AbortDoc(hdc);
+        return false;
+    }
+
+    bool ok = true;
+    bool inPage = false;
+    PrintBand band;
+    while (r.queue.Pop(band)) {
+        if (!inPage) {
+            if (progressUI) {
+                progressUI->UpdateProgress(current, total);
+            }
+            StartPage(hdc);
+            inPage = true;
+        }
+        if (band.isVector) {
+            PrintVectorPage(r, hdc, band);
+        } else if (band.bmp) {
+            band.bmp->StretchDIBits(hdc, band.rc);
+            delete band.bmp;
+        }
+        if (band.endsPage) {
+            inPage = false;
+            if (EndPage(hdc) <= 0 || r.WasCanceled()) {
+                ok = false;
+                break;
             }
             current++;
         }
     }
 
+    r.queue.Abort();
+    WaitForSingleObject(renderThread, INFINITE);
+    CloseHandle(renderThread);
+
+    if (!ok || r.WasCanceled()) {
+        AbortDoc(hdc);
+        return false;
+    }
+    if (inPage) {
+        EndPage(hdc);
+    }
     EndDoc(hdc);
     return true;
 }
@@ -569,6 +786,7 @@ void OnMenuPrint(WindowInfo* win, bool waitForCompletion) {
     pd.nStartPage = START_PAGE_GENERAL;
 
     Print_Advanced_Data advanced(PrintRangeAdv::All, defaultScaleAdv);
+    advanced.printAsVector = gGlobalPrefs->printerDefaults.printAsVector;
     ScopedMem<DLGTEMPLATE> dlgTemplate; // needed for RTL languages
     HPROPSHEETPAGE hPsp = CreatePrintAdvancedPropSheet(&advanced, dlgTemplate);
     pd.lphPropertyPages = &hPsp;
@@ -787,6 +1005,10 @@ static void ApplyPrintSettings(const WCHAR* printerName, const WCHAR* settings,
             advanced.rotation = PrintRotationAdv::Portrait;
         } else if (str::EqI(rangeList.at(i), L"landscape")) {
             advanced.rotation = PrintRotationAdv::Landscape;
+        } else if (str::EqI(rangeList.at(i), L"vector")) {
+            advanced.printAsVector = true;
+        } else if (str::EqI(rangeList.at(i), L"bitmap")) {
+            advanced.printAsVector = false;
         } else if (str::Parse(rangeList.at(i), L"%dx%$", &val) && 0 < val && val < 1000) {
             devMode->dmCopies = (short)val;
             devMode->dmFields |= DM_COPIES;
@@ -820,12 +1042,7 @@ static void ApplyPrintSettings(const WCHAR* printerName, const WCHAR* settings,
     }
 }
 
-bool PrintFile(EngineBase* engine, WCHAR* printerName, bool displayErrors, const WCHAR* settings) {
-    bool ok = false;
-    if (!HasPermission(Perm_PrinterAccess)) {
-        return false;
-    }
-
+static bool CanPrintEngine(EngineBase* engine, bool displayErrors) {
 #ifndef DISABLE_DOCUMENT_RESTRICTIONS
     if (engine && !engine->AllowsPrinting()) {
         engine = nullptr;
@@ -838,15 +1055,27 @@ bool PrintFile(EngineBase* engine, WCHAR* printerName, bool displayErrors, const
         }
         return false;
     }
+    return true;
+}
 
-    AutoFreeWstr defaultPrinter;
-    if (!printerName) {
-        defaultPrinter.Set(GetDefaultPrinterName());
-        printerName = defaultPrinter;
+// a printer and its default settings, used for printing files without showing a dialog
+struct FilePrinter {
+    AutoFreeWstr name;
+    ScopedMem<PRINTER_INFO_2> info;
+    ScopedMem<DEVMODEW> devMode;
+    LONG devModeSize = 0;
+};
+
+// uses the default printer if printerName is nullptr
+static bool LoadFilePrinter(FilePrinter& printer, const WCHAR* printerName, bool displayErrors) {
+    if (printerName) {
+        printer.name.SetCopy(printerName);
+    } else {
+        printer.name.Set(GetDefaultPrinterName());
     }
 
-    HANDLE printer;
-    BOOL res = OpenPrinterW(printerName, &printer, nullptr);
+    HANDLE hPrinter;
+    BOOL res = OpenPrinterW(printer.name, &hPrinter, nullptr);
     if (!res) {
         if (displayErrors) {
             MessageBoxWarning(nullptr, _TR("Printer with given name doesn't exist"), _TR("Printing problem."));
@@ -854,80 +1083,272 @@ bool PrintFile(EngineBase* engine, WCHAR* printerName, bool displayErrors, const
         return false;
     }
 
-    LONG structSize = 0;
-    LPDEVMODE devMode = nullptr;
-
+    bool ok = false;
     DWORD needed = 0;
-    GetPrinterW(printer, 2, nullptr, 0, &needed);
-    ScopedMem<PRINTER_INFO_2> infoData((PRINTER_INFO_2*)AllocArray<BYTE>(needed));
-    if (infoData) {
-        res = GetPrinterW(printer, 2, (LPBYTE)infoData.Get(), needed, &needed);
-    }
-    if (!res || !infoData || needed <= sizeof(PRINTER_INFO_2)) {
-        goto Exit;
-    }
-
-    /* ask for the size of DEVMODE struct */
-    structSize = DocumentPropertiesW(nullptr, printer, printerName, nullptr, nullptr, 0);
-    if (structSize < sizeof(DEVMODEW)) {
-        if (displayErrors) {
-            MessageBoxWarning(nullptr, _TR("Could not obtain Printer properties"), _TR("Printing problem."));
+    GetPrinterW(hPrinter, 2, nullptr, 0, &needed);
+    printer.info.Set((PRINTER_INFO_2*)AllocArray<BYTE>(needed));
+    if (printer.info) {
+        res = GetPrinterW(hPrinter, 2, (LPBYTE)printer.info.Get(), needed, &needed);
+    }
+    if (res && printer.info && needed > sizeof(PRINTER_INFO_2)) {
+        /* ask for the size of DEVMODE struct */
+        printer.devModeSize = DocumentPropertiesW(nullptr, hPrinter, printer.name, nullptr, nullptr, 0);
+        if (printer.devModeSize >= (LONG)sizeof(DEVMODEW)) {
+            printer.devMode.Set((DEVMODEW*)Allocator::AllocZero(nullptr, printer.devModeSize));
+            // Get the default DevMode for the printer
+            LONG ret = DocumentPropertiesW(nullptr, hPrinter, printer.name, printer.devMode, nullptr, DM_OUT_BUFFER);
+            ok = IDOK == ret;
         }
-        goto Exit;
-    }
-    devMode = (DEVMODEW*)Allocator::AllocZero(nullptr, structSize);
-
-    // Get the default DevMode for the printer and modify it for your needs.
-    LONG ret = DocumentPropertiesW(nullptr, printer, printerName, devMode, nullptr, DM_OUT_BUFFER);
-    if (IDOK != ret) {
-        if (displayErrors) {
+        if (!ok && displayErrors) {
             MessageBoxWarning(nullptr, _TR("Could not obtain Printer properties"), _TR("Printing problem."));
         }
-        goto Exit;
     }
 
-    ClosePrinter(printer);
-    printer = nullptr;
+    ClosePrinter(hPrinter);
+    return ok;
+}
 
+// takes ownership of engine (which is used for printing without being cloned)
+static bool PrintEngineWithPrinter(EngineBase* engine, FilePrinter& printer, bool displayErrors,
+                                   const WCHAR* settings, HDC hdcReuse = nullptr) {
+    ScopedMem<DEVMODEW> devMode((DEVMODEW*)memdup(printer.devMode, printer.devModeSize));
     // set paper size to match the size of the document's first page
     // (will be overridden by any paper= value in -print-settings)
     devMode->dmPaperSize = GetPaperSize(engine);
 
-    {
-        Print_Advanced_Data advanced;
-        Vec<PRINTPAGERANGE> ranges;
+    Print_Advanced_Data advanced;
+    advanced.printAsVector = gGlobalPrefs->printerDefaults.printAsVector;
+    Vec<PRINTPAGERANGE> ranges;
 
-        ApplyPrintSettings(printerName, settings, engine->PageCount(), ranges, advanced, devMode);
+    ApplyPrintSettings(printer.name, settings, engine->PageCount(), ranges, advanced, devMode);
 
-        PrintData pd(engine, infoData, devMode, ranges, advanced);
-        ok = PrintToDevice(pd);
-        if (!ok && displayErrors) {
-            MessageBoxWarning(nullptr, _TR("Couldn't initialize printer"), _TR("Printing problem."));
-        }
+    PrintData pd(nullptr, printer.info, devMode, ranges, advanced);
+    pd.engine = engine;
+    bool ok = PrintToDevice(pd, nullptr, nullptr, hdcReuse);
+    if (!ok && displayErrors) {
+        MessageBoxWarning(nullptr, _TR("Couldn't initialize printer"), _TR("Printing problem."));
     }
+    return ok;
+}
 
-Exit:
-    free(devMode);
-    if (printer) {
-        ClosePrinter(printer);
+bool PrintFile(EngineBase* engine, WCHAR* printerName, bool displayErrors, const WCHAR* settings) {
+    if (!HasPermission(Perm_PrinterAccess)) {
+        return false;
     }
-    return ok;
+    if (!CanPrintEngine(engine, displayErrors)) {
+        return false;
+    }
+
+    FilePrinter printer;
+    if (!LoadFilePrinter(printer, printerName, displayErrors)) {
+        return false;
+    }
+    EngineBase* clone = engine->Clone();
+    if (!clone) {
+        return false;
+    }
+    return PrintEngineWithPrinter(clone, printer, displayErrors, settings);
+}
+
+static EngineBase* CreateEngineForPrinting(const WCHAR* fileName, bool displayErrors) {
+    AutoFreeWstr fileName2(path::Normalize(fileName));
+    EngineBase* engine = EngineManager::CreateEngine(fileName2);
+    if (!engine && displayErrors) {
+        AutoFreeWstr msg(str::Format(L"Couldn't open file '%s' for printing", fileName));
+        MessageBoxWarning(nullptr, msg, L"Error");
+    }
+    return engine;
 }
 
 bool PrintFile(const WCHAR* fileName, WCHAR* printerName, bool displayErrors, const WCHAR* settings) {
     logf(L"PrintFile: file: '%s', printer: '%s'\n", fileName, printerName);
-    WCHAR* fileName2 = path::Normalize(fileName);
-    EngineBase* engine = EngineManager::CreateEngine(fileName2);
+    EngineBase* engine = CreateEngineForPrinting(fileName, displayErrors);
     if (!engine) {
-        if (displayErrors) {
-            WCHAR* msg = str::Format(L"Couldn't open file '%s' for printing", fileName);
-            MessageBoxWarning(nullptr, msg, L"Error");
-            free(msg);
-        }
         return false;
     }
     bool ok = PrintFile(engine, printerName, displayErrors, settings);
     delete engine;
-    free(fileName2);
     return ok;
 }
+
+// upper limit for the number of threads loading files for PrintFiles
+#define MAX_PRINT_FILES_THREADS 4
+// how many files are loaded ahead of the one being printed
+// (more would only use up memory while the printer is busy)
+#define PRINT_FILES_LOAD_AHEAD 4
+
+// loads the files to print on background threads, so that the next
+// document is ready as soon as the current one has been spooled
+class PrintFilesLoader {
+    CRITICAL_SECTION access;
+    CONDITION_VARIABLE changed;
+    WStrVec& filePaths;
+    // same order as filePaths (nullptr if a file couldn't be loaded)
+    Vec<EngineBase*> engines;
+    Vec<bool> loaded;
+    size_t nextToLoad = 0;
+    size_t nextToPrint = 0;
+    bool aborted = false;
+    HANDLE threads[MAX_PRINT_FILES_THREADS] = {};
+    int nThreads = 0;
+
+    static DWORD WINAPI LoadThread(LPVOID data);
+
+  public:
+    explicit PrintFilesLoader(WStrVec& filePaths);
+    ~PrintFilesLoader();
+
+    // waits for the file at idx to be loaded (files must be taken in order);
+    // the caller takes ownership of the returned engine
+    EngineBase* Take(size_t idx);
+};
+
+PrintFilesLoader::PrintFilesLoader(WStrVec& filePaths) : filePaths(filePaths) {
+    InitializeCriticalSection(&access);
+    InitializeConditionVariable(&changed);
+    engines.AppendBlanks(filePaths.size());
+    loaded.AppendBlanks(filePaths.size());
+
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    int n = std::min((int)si.dwNumberOfProcessors - 1, MAX_PRINT_FILES_THREADS);
+    // with a single file, Take loads it directly
+    n = std::min(n, (int)filePaths.size() - 1);
+    for (int i = 0; i < n; i++) {
+        HANDLE thread = CreateThread(nullptr, 0, LoadThread, this, 0, nullptr);
+        if (thread) {
+            threads[nThreads++] = thread;
+        }
+    }
+}
+
+PrintFilesLoader::~PrintFilesLoader() {
+    EnterCriticalSection(&access);
+    aborted = true;
+    WakeAllConditionVariable(&changed);
+    LeaveCriticalSection(&access);
+    for (int i = 0; i < nThreads; i++) {
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+    }
+    DeleteVecMembers(engines);
+    DeleteCriticalSection(&access);
+}
+
+DWORD WINAPI PrintFilesLoader::LoadThread(LPVOID data) {
+    PrintFilesLoader* self = (PrintFilesLoader*)data;
+    for (;;) {
+        size_t idx;
+        {
+            ScopedCritSec scope(&self->access);
+            while (!self->aborted && self->nextToLoad < self->filePaths.size() &&
+                   self->nextToLoad >= self->nextToPrint + PRINT_FILES_LOAD_AHEAD) {
+                SleepConditionVariableCS(&self->changed, &self->access, INFINITE);
+            }
+            if (self->aborted || self->nextToLoad >= self->filePaths.size()) {
+                return 0;
+            }
+            idx = self->nextToLoad++;
+        }
+
+        AutoFreeWstr path(path::Normalize(self->filePaths.at(idx)));
+        EngineBase* engine = EngineManager::CreateEngine(path);
+
+        ScopedCritSec scope(&self->access);
+        self->engines.at(idx) = engine;
+        self->loaded.at(idx) = true;
+        WakeAllConditionVariable(&self->changed);
+    }
+}
+
+EngineBase* PrintFilesLoader::Take(size_t idx) {
+    EnterCriticalSection(&access);
+    nextToPrint = idx;
+    WakeAllConditionVariable(&changed);
+    if (idx >= nextToLoad) {
+        // no thread is loading this file (yet), so don't wait for one
+        nextToLoad = idx + 1;
+        LeaveCriticalSection(&access);
+        AutoFreeWstr path(path::Normalize(filePaths.at(idx)));
+        return EngineManager::CreateEngine(path);
+    }
+    while (!loaded.at(idx)) {
+        SleepConditionVariableCS(&changed, &access, INFINITE);
+    }
+    EngineBase* engine = engines.at(idx);
+    engines.at(idx) = nullptr;
+    // allow loading another file ahead
+    nextToPrint = idx + 1;
+    WakeAllConditionVariable(&changed);
+    LeaveCriticalSection(&access);
+    return engine;
+}
+
+// directories are replaced with the supported files they contain (in natural order)
+static void CollectFilesToPrint(WStrVec& fileNames, WStrVec& filePathsOut) {
+    for (const WCHAR* fileName : fileNames) {
+        if (!dir::Exists(fileName)) {
+            filePathsOut.Append(str::Dup(fileName));
+            continue;
+        }
+        WStrVec dirFiles;
+        AutoFreeWstr pattern(path::Join(fileName, L"*"));
+        WIN32_FIND_DATA fdata;
+        HANDLE hfind = FindFirstFile(pattern, &fdata);
+        if (INVALID_HANDLE_VALUE == hfind) {
+            continue;
+        }
+        do {
+            if (fdata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+                continue;
+            }
+            AutoFreeWstr path(path::Join(fileName, fdata.cFileName));
+            if (IsSupportedFile(path)) {
+                dirFiles.Append(path.StealData());
+            }
+        } while (FindNextFile(hfind, &fdata));
+        FindClose(hfind);
+        dirFiles.SortNatural();
+        for (const WCHAR* path : dirFiles) {
+            filePathsOut.Append(str::Dup(path));
+        }
+    }
+}
+
+int PrintFiles(WStrVec& fileNames, WCHAR* printerName, bool displayErrors, const WCHAR* settings) {
+    WStrVec filePaths;
+    CollectFilesToPrint(fileNames, filePaths);
+    int nFailed = filePaths.isize();
+    if (nFailed == 0 || !HasPermission(Perm_PrinterAccess)) {
+        return nFailed;
+    }
+
+    FilePrinter printer;
+    if (!LoadFilePrinter(printer, printerName, displayErrors)) {
+        return nFailed;
+    }
+    // the same DC is used for all print jobs (if it can't be created,
+    // PrintToDevice tries again for every file)
+    AutoDeleteDC hdc(CreateDC(nullptr, printer.name, nullptr, printer.devMode));
+
+    PrintFilesLoader loader(filePaths);
+    for (size_t i = 0; i < filePaths.size(); i++) {
+        logf(L"PrintFiles: file: '%s', printer: '%s'\n", filePaths.at(i), printer.name.Get());
+        EngineBase* engine = loader.Take(i);
+        if (!engine) {
+            if (displayErrors) {
+                AutoFreeWstr msg(str::Format(L"Couldn't open file '%s' for printing", filePaths.at(i)));
+                MessageBoxWarning(nullptr, msg, L"Error");
+            }
+            continue;
+        }
+        if (!CanPrintEngine(engine, displayErrors)) {
+            delete engine;
+            continue;
+        }
+        if (PrintEngineWithPrinter(engine, printer, displayErrors, settings, hdc)) {
+            nFailed--;
+        }
+    }
+    return nFailed;
+}
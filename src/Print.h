@@ -5,5 +5,9 @@ bool PrintFile(const WCHAR* fileName, WCHAR* printerName = nullptr, bool display
                const WCHAR* settings = nullptr);
 bool PrintFile(EngineBase* engine, WCHAR* printerName = nullptr, bool displayErrors = true,
                const WCHAR* settings = nullptr);
+// prints the files (and the supported files of directories) as separate print jobs,
+// loading the next files in the background; returns the number of files that failed to print
+int PrintFiles(WStrVec& fileNames, WCHAR* printerName = nullptr, bool displayErrors = true,
+               const WCHAR* settings = nullptr);
 void OnMenuPrint(WindowInfo* win, bool waitForCompletion = false);
 void AbortPrinting(WindowInfo* win);
@@ -5,6 +5,7 @@
 #include "utils/ScopedWin.h"
 #include "utils/WinUtil.h"
 #include "utils/Timer.h"
+#include "utils/Trace.h"
 #include "utils/Log.h"
 
 #include "wingui/TreeModel.h"
@@ -17,7 +18,10 @@
 #include "DisplayModel.h"
 #include "GlobalPrefs.h"
 #include "RenderCache.h"
+#include "RenderWorker.h"
 #include "TextSelection.h"
+#include "TileCache.h"
+#include "TileCompositor.h"
 
 #pragma warning(disable : 28159) // silence /analyze: Consider using 'GetTickCount64' instead of 'GetTickCount'
 
@@ -40,17 +44,17 @@ RenderCache::RenderCache() {
     InitializeCriticalSection(&requestAccess);
 
     startRendering = CreateEvent(nullptr, FALSE, FALSE, nullptr);
-    renderThread = CreateThread(nullptr, 0, RenderCacheThread, this, 0, 0);
-    CrashIf(nullptr == renderThread);
 }
 
 RenderCache::~RenderCache() {
     EnterCriticalSection(&requestAccess);
     EnterCriticalSection(&cacheAccess);
 
-    CloseHandle(renderThread);
+    for (int i = 0; i < nRenderThreads; i++) {
+        CloseHandle(renderThreads[i].hThread);
+    }
     CloseHandle(startRendering);
-    CrashIf(curReq || 0 != requestCount || 0 != cacheCount);
+    CrashIf(IsRendering(nullptr) || 0 != requests.size() || 0 != cacheCount);
 
     LeaveCriticalSection(&cacheAccess);
     DeleteCriticalSection(&cacheAccess);
@@ -58,24 +62,108 @@ RenderCache::~RenderCache() {
     DeleteCriticalSection(&requestAccess);
 }
 
+static int GetBucketIdx(DisplayModel* dm, int pageNo) {
+    uintptr_t h = (uintptr_t)dm;
+    h = (h >> 4) ^ (h >> 12) ^ ((uintptr_t)pageNo * 2654435761u);
+    return (int)(h & (BITMAP_CACHE_BUCKETS - 1));
+}
+
+// adds the entry as most recently used
+void RenderCache::LinkCacheEntry(BitmapCacheEntry* entry) {
+    entry->lruPrev = nullptr;
+    entry->lruNext = lruFirst;
+    if (lruFirst) {
+        lruFirst->lruPrev = entry;
+    } else {
+        lruLast = entry;
+    }
+    lruFirst = entry;
+
+    int idx = GetBucketIdx(entry->dm, entry->pageNo);
+    entry->bucketNext = buckets[idx];
+    buckets[idx] = entry;
+}
+
+void RenderCache::UnlinkCacheEntry(BitmapCacheEntry* entry) {
+    if (entry->lruPrev) {
+        entry->lruPrev->lruNext = entry->lruNext;
+    } else {
+        lruFirst = entry->lruNext;
+    }
+    if (entry->lruNext) {
+        entry->lruNext->lruPrev = entry->lruPrev;
+    } else {
+        lruLast = entry->lruPrev;
+    }
+    entry->lruPrev = entry->lruNext = nullptr;
+
+    BitmapCacheEntry** prev = &buckets[GetBucketIdx(entry->dm, entry->pageNo)];
+    while (*prev != entry) {
+        CrashIf(!*prev);
+        prev = &(*prev)->bucketNext;
+    }
+    *prev = entry->bucketNext;
+    entry->bucketNext = nullptr;
+}
+
 /* Find a bitmap for a page defined by <dm> and <pageNo> and optionally also
    <rotation> and <zoom> in the cache - call DropCacheEntry when you
    no longer need a found entry. */
 BitmapCacheEntry* RenderCache::Find(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition* tile) {
     ScopedCritSec scope(&cacheAccess);
     rotation = NormalizeRotation(rotation);
-    for (int i = 0; i < cacheCount; i++) {
-        BitmapCacheEntry* e = cache[i];
+    BitmapCacheEntry* e = buckets[GetBucketIdx(dm, pageNo)];
+    for (; e; e = e->bucketNext) {
         if ((dm == e->dm) && (pageNo == e->pageNo) && (rotation == e->rotation) &&
             (INVALID_ZOOM == zoom || zoom == e->zoom) && (!tile || e->tile == *tile)) {
             e->refs++;
-            CrashIf(i != e->cacheIdx);
+            // mark as most recently used
+            if (e != lruFirst) {
+                UnlinkCacheEntry(e);
+                LinkCacheEntry(e);
+            }
             return e;
         }
     }
     return nullptr;
 }
 
+// returns the tile rendered at the zoom level closest to zoom, if scaling
+// it wouldn't noticeably lose quality (cf. MAX_TILE_UPSCALE)
+// (avoids rendering all pages anew when e.g. Fit Width changes the zoom
+// by a fraction of a percent because the window has been resized)
+BitmapCacheEntry* RenderCache::FindReusable(DisplayModel* dm, int pageNo, int rotation, float zoom,
+                                            TilePosition tile) {
+    ScopedCritSec scope(&cacheAccess);
+    rotation = NormalizeRotation(rotation);
+    BitmapCacheEntry* best = nullptr;
+    float bestDiff = 0;
+    BitmapCacheEntry* e = buckets[GetBucketIdx(dm, pageNo)];
+    for (; e; e = e->bucketNext) {
+        if (dm != e->dm || pageNo != e->pageNo || rotation != e->rotation || !(e->tile == tile) || e->isPreview ||
+            e->outOfDate || e->zoom == INVALID_ZOOM || e->zoom <= 0) {
+            continue;
+        }
+        float scale = e->zoom / zoom;
+        if (scale * MAX_TILE_UPSCALE < 1.0f || scale > MAX_TILE_DOWNSCALE) {
+            continue;
+        }
+        float diff = fabsf(scale - 1.0f);
+        if (!best || diff < bestDiff) {
+            best = e;
+            bestDiff = diff;
+        }
+    }
+    if (best) {
+        best->refs++;
+        if (best != lruFirst) {
+            UnlinkCacheEntry(best);
+            LinkCacheEntry(best);
+        }
+    }
+    return best;
+}
+
 bool RenderCache::Exists(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition* tile) {
     BitmapCacheEntry* entry = Find(dm, pageNo, rotation, zoom, tile);
     if (entry) {
@@ -90,56 +178,135 @@ bool RenderCache::DropCacheEntry(BitmapCacheEntry* entry) {
     if (!entry) {
         return false;
     }
-    CrashIf(entry->cacheIdx < 0);
-    CrashIf(entry->cacheIdx >= cacheCount);
     CrashIf(entry->refs <= 0);
     --entry->refs;
     if (entry->refs > 0) {
         return false;
     }
     CrashIf(entry->refs != 0);
-    int idx = entry->cacheIdx;
-    CrashIf(cache[idx] != entry);
 
-    delete entry;
-    cache[idx] = nullptr;
-    int lastIdx = cacheCount - 1;
-    if (idx != lastIdx) {
-        cache[idx] = cache[lastIdx];
-        cache[lastIdx] = nullptr;
-        cache[idx]->cacheIdx = idx;
-    }
+    UnlinkCacheEntry(entry);
+    CrashIf(cacheSize < entry->size);
+    cacheSize -= entry->size;
     cacheCount--;
     CrashIf(cacheCount < 0);
+    delete entry;
     return true;
 }
 
-static bool FreeIfFull(RenderCache* rc, PageRenderRequest& req) {
-    int n = rc->cacheCount;
-    if (n < MAX_BITMAPS_CACHED) {
-        return true;
+// memory used by the pixels of a rendered bitmap
+static size_t GetBitmapMemorySize(RenderedBitmap* bmp) {
+    HBITMAP hbmp = bmp ? bmp->GetBitmap() : nullptr;
+    if (!hbmp) {
+        return 0;
     }
+    BITMAP info{};
+    if (GetObject(hbmp, sizeof(info), &info)) {
+        return (size_t)info.bmWidthBytes * abs(info.bmHeight);
+    }
+    Size size = bmp->Size();
+    return (size_t)size.dx * size.dy * 4;
+}
 
-    // free an invisible page of the same DisplayModel ...
-    for (int i = 0; i < n; i++) {
-        auto entry = rc->cache[i];
-        if (entry->dm == req.dm && !req.dm->PageVisibleNearby(entry->pageNo)) {
-            bool didDrop = rc->DropCacheEntry(entry);
-            if (didDrop) {
-                return true;
+// how much memory cached bitmaps may use (in bytes)
+static size_t GetCacheBudget() {
+    int sizeMB = gGlobalPrefs ? gGlobalPrefs->renderCacheSizeMB : 0;
+    if (sizeMB > 0) {
+        return (size_t)sizeMB * 1024 * 1024;
+    }
+
+    // by default, cache a few screens' worth of pixels for all monitors ...
+    size_t screenSize =
+        (size_t)GetSystemMetrics(SM_CXVIRTUALSCREEN) * (size_t)GetSystemMetrics(SM_CYVIRTUALSCREEN) * 4;
+    size_t budget = 6 * screenSize;
+    // ... but only a small part of the physical memory ...
+    MEMORYSTATUSEX ms{};
+    ms.dwLength = sizeof(ms);
+    if (GlobalMemoryStatusEx(&ms)) {
+        budget = std::min(budget, (size_t)(ms.ullTotalPhys / 16));
+    }
+#if !defined(_WIN64)
+    // ... and not too much of the address space
+    budget = std::min(budget, (size_t)256 * 1024 * 1024);
+#endif
+    // ... while always having room for more than what's currently visible
+    return std::max(budget, 2 * screenSize);
+}
+
+// the higher, the better a candidate an entry is for being evicted from the cache
+// (0 for visible pages, 1 for prefetched ones such as the next pages of a
+// presentation, growing with the distance to the current page otherwise)
+static int GetEvictionScore(BitmapCacheEntry* entry) {
+    DisplayModel* dm = entry->dm;
+    if (dm->PageVisibleNearby(entry->pageNo)) {
+        return 0;
+    }
+    if (dm->PagePrefetched(entry->pageNo)) {
+        return 1;
+    }
+    return 2 + abs(entry->pageNo - dm->CurrentPageNo());
+}
+
+// free the least useful cached bitmaps so that a bitmap of the given size fits into
+// the cache: first those farthest away from the visible pages, then the least recently used
+bool RenderCache::FreeForSpace(size_t size) {
+    size_t budget = GetCacheBudget();
+    while (cacheCount >= MAX_BITMAPS_CACHED || (cacheCount > 0 && cacheSize + size > budget)) {
+        BitmapCacheEntry* toFree = nullptr;
+        int maxScore = -1;
+        for (BitmapCacheEntry* e = lruLast; e; e = e->lruPrev) {
+            // don't touch bitmaps that are currently being painted
+            if (e->refs > 1) {
+                continue;
             }
+            int score = GetEvictionScore(e);
+            if (score > maxScore) {
+                toFree = e;
+                maxScore = score;
+            }
+        }
+        if (!toFree) {
+            return false;
         }
+        DropCacheEntry(toFree);
+    }
+    return true;
+}
+
+bool IsNearGdiObjectsLimit() {
+    int limit = gGlobalPrefs ? gGlobalPrefs->gdiObjectsLimit : 0;
+    if (limit <= 0) {
+        return false;
     }
+    return (int)GetGuiResources(GetCurrentProcess(), GR_GDIOBJECTS) > limit;
+}
 
-    // ... or just the oldest cached page
-    for (int i = 0; i < n; i++) {
-        auto entry = rc->cache[i];
-        bool didDrop = rc->DropCacheEntry(entry);
-        if (didDrop) {
-            return true;
+// when running out of GDI objects, give up the pooled bitmaps and then the cached
+// bitmaps that aren't visible instead of having the next pages render blank
+// (the ui thread frees the caches of background tabs, cf. OnPaintDocument)
+void RenderCache::FreeForGdiObjects() {
+    if (!IsNearGdiObjectsLimit()) {
+        return;
+    }
+    TrimBitmapPool();
+    while (IsNearGdiObjectsLimit()) {
+        BitmapCacheEntry* toFree = nullptr;
+        int maxScore = 0;
+        for (BitmapCacheEntry* e = lruLast; e; e = e->lruPrev) {
+            if (e->refs > 1) {
+                continue;
+            }
+            int score = GetEvictionScore(e);
+            if (score > maxScore) {
+                toFree = e;
+                maxScore = score;
+            }
+        }
+        if (!toFree) {
+            return;
         }
+        DropCacheEntry(toFree);
     }
-    return false;
 }
 
 void RenderCache::Add(PageRenderRequest& req, RenderedBitmap* bmp) {
@@ -147,19 +314,27 @@ void RenderCache::Add(PageRenderRequest& req, RenderedBitmap* bmp) {
     CrashIf(!req.dm);
 
     req.rotation = NormalizeRotation(req.rotation);
-    CrashIf(cacheCount > MAX_BITMAPS_CACHED);
+
+    // a preview is no longer needed if the page has been rendered in the meantime
+    if (req.isPreview && Exists(req.dm, req.pageNo, req.rotation, INVALID_ZOOM, &req.tile)) {
+        delete bmp;
+        return;
+    }
 
     /* It's possible there still is a cached bitmap with different zoom/rotation */
     FreePage(req.dm, req.pageNo, &req.tile);
 
-    bool hasSpace = FreeIfFull(this, req);
-    CrashIf(!hasSpace);
-    CrashIf(cacheCount > MAX_BITMAPS_CACHED);
+    size_t size = GetBitmapMemorySize(bmp);
+    // if all other bitmaps are in use, we're temporarily over budget
+    FreeForSpace(size);
+    FreeForGdiObjects();
 
     // Copy the PageRenderRequest as it will be reused
     auto entry = new BitmapCacheEntry(req.dm, req.pageNo, req.rotation, req.zoom, req.tile, bmp);
-    entry->cacheIdx = cacheCount;
-    cache[cacheCount] = entry;
+    entry->size = size;
+    entry->isPreview = req.isPreview;
+    LinkCacheEntry(entry);
+    cacheSize += size;
     cacheCount++;
 }
 
@@ -222,9 +397,10 @@ static bool IsTileVisible(DisplayModel* dm, int pageNo, TilePosition tile, float
 void RenderCache::FreePage(DisplayModel* dm, int pageNo, TilePosition* tile) {
     ScopedCritSec scope(&cacheAccess);
 
-    // must go from end becaues freeing changes the cache
-    for (int i = cacheCount - 1; i >= 0; i--) {
-        BitmapCacheEntry* entry = cache[i];
+    BitmapCacheEntry* next = nullptr;
+    for (BitmapCacheEntry* entry = lruFirst; entry; entry = next) {
+        // freeing removes the entry from the list
+        next = entry->lruNext;
         bool shouldFree;
         if (dm && pageNo != INVALID_PAGE_NO) {
             // a specific page
@@ -235,14 +411,15 @@ void RenderCache::FreePage(DisplayModel* dm, int pageNo, TilePosition* tile) {
                 shouldFree =
                     shouldFree && (entry->tile == *tile ||
                                    tile->row == (USHORT)-1 && entry->tile.res > 0 && entry->tile.res != tile->res ||
-                                   tile->row == (USHORT)-1 && entry->tile.res == 0 && entry->outOfDate);
+                                   tile->row == (USHORT)-1 && entry->tile.res == 0 && entry->outOfDate ||
+                                   tile->row == (USHORT)-1 && entry->isPreview);
             }
         } else if (dm) {
             // all pages of this DisplayModel
             shouldFree = (entry->dm == dm);
         } else {
             // all invisible pages resp. page tiles
-            shouldFree = !entry->dm->PageVisibleNearby(entry->pageNo);
+            shouldFree = !entry->dm->PageVisibleNearby(entry->pageNo) && !entry->dm->PagePrefetched(entry->pageNo);
             if (!shouldFree && entry->tile.res > 1) {
                 shouldFree = !IsTileVisible(entry->dm, entry->pageNo, entry->tile, 2.0);
             }
@@ -256,18 +433,113 @@ void RenderCache::FreePage(DisplayModel* dm, int pageNo, TilePosition* tile) {
 // keep the cached bitmaps for visible pages to avoid flickering during a reload.
 // mark invisible pages as out-of-date to prevent inconsistencies
 void RenderCache::KeepForDisplayModel(DisplayModel* oldDm, DisplayModel* newDm) {
+    // the fingerprints are determined without holding cacheAccess,
+    // as that requires the engines' locks
+    Vec<int> pages;
+    {
+        ScopedCritSec scope(&cacheAccess);
+        for (BitmapCacheEntry* entry = lruLast; entry; entry = entry->lruPrev) {
+            if (entry->dm == oldDm && !pages.Contains(entry->pageNo)) {
+                pages.Append(entry->pageNo);
+            }
+        }
+    }
+    Vec<int> unchangedPages;
+    for (int pageNo : pages) {
+        if (IsPageUnchanged(oldDm->GetEngine(), newDm->GetEngine(), pageNo)) {
+            unchangedPages.Append(pageNo);
+        }
+    }
+
     ScopedCritSec scope(&cacheAccess);
-    for (int i = 0; i < cacheCount; i++) {
-        BitmapCacheEntry* entry = cache[i];
-        if (entry->dm != oldDm) {
-            continue;
+    Vec<BitmapCacheEntry*> entries;
+    for (BitmapCacheEntry* entry = lruLast; entry; entry = entry->lruPrev) {
+        if (entry->dm == oldDm) {
+            entries.Append(entry);
         }
-        if (oldDm->PageVisible(entry->pageNo)) {
+    }
+    for (BitmapCacheEntry* entry : entries) {
+        // the bitmaps of unchanged pages remain valid
+        bool isUnchanged = unchangedPages.Contains(entry->pageNo);
+        if (isUnchanged || oldDm->PageVisible(entry->pageNo)) {
+            // the bucket depends on the DisplayModel
+            UnlinkCacheEntry(entry);
             entry->dm = newDm;
+            LinkCacheEntry(entry);
+        }
+        if (!isUnchanged) {
+            // make sure that the page is rerendered eventually
+            entry->zoom = INVALID_ZOOM;
+            entry->outOfDate = true;
+        }
+    }
+}
+
+// saves the visible tiles of a document about to be closed to the tile cache
+void RenderCache::SaveToTileCache(DisplayModel* dm) {
+    AutoFreeWstr dir(GetTileCacheDir(dm->GetEngine()->FileName()));
+    if (!dir) {
+        return;
+    }
+
+    Vec<BitmapCacheEntry*> entries;
+    Vec<CachedTile> tiles;
+    {
+        ScopedCritSec scope(&cacheAccess);
+        for (BitmapCacheEntry* e = lruFirst; e; e = e->lruNext) {
+            if (e->dm != dm || !e->bitmap || e->outOfDate || e->isPreview || e->zoom == INVALID_ZOOM) {
+                continue;
+            }
+            if (!dm->PageVisible(e->pageNo) || e->tile.res != GetTileRes(dm, e->pageNo) ||
+                !IsTileVisible(dm, e->pageNo, e->tile)) {
+                continue;
+            }
+            // keep the bitmap alive while it's being saved
+            e->refs++;
+            entries.Append(e);
+            CachedTile tile;
+            tile.pageNo = e->pageNo;
+            tile.rotation = e->rotation;
+            tile.zoom = e->zoom;
+            tile.tile = e->tile;
+            tile.bitmap = e->bitmap;
+            tiles.Append(tile);
+        }
+    }
+
+    SaveCachedTiles(dir, tiles, textColor, backgroundColor);
+    for (BitmapCacheEntry* e : entries) {
+        DropCacheEntry(e);
+    }
+}
+
+// adds the tiles saved in the tile cache when the document was last closed,
+// if they match the current view. They're only shown until the tiles have
+// been rendered anew (like previews)
+void RenderCache::LoadFromTileCache(DisplayModel* dm) {
+    AutoFreeWstr dir(GetTileCacheDir(dm->GetEngine()->FileName()));
+    if (!dir) {
+        return;
+    }
+
+    Vec<CachedTile> tiles;
+    LoadCachedTiles(dir, textColor, backgroundColor, tiles);
+    int rotation = NormalizeRotation(dm->GetRotation());
+    for (CachedTile& tile : tiles) {
+        bool matches = dm->ValidPageNo(tile.pageNo) && dm->ShouldCacheRendering(tile.pageNo) &&
+                       tile.rotation == rotation && fabsf(tile.zoom - dm->GetZoomReal(tile.pageNo)) < 0.001f * tile.zoom;
+        if (!matches) {
+            delete tile.bitmap;
+            continue;
         }
-        // make sure that the page is rerendered eventually
-        entry->zoom = INVALID_ZOOM;
-        entry->outOfDate = true;
+        PageRenderRequest req;
+        req.dm = dm;
+        req.pageNo = tile.pageNo;
+        req.rotation = rotation;
+        req.zoom = INVALID_ZOOM;
+        req.tile = tile.tile;
+        req.isPreview = true;
+        Add(req, tile.bitmap);
     }
 }
 
@@ -276,15 +548,13 @@ void RenderCache::Invalidate(DisplayModel* dm, int pageNo, RectD rect) {
     ScopedCritSec scopeReq(&requestAccess);
 
     ClearQueueForDisplayModel(dm, pageNo);
-    if (curReq && curReq->dm == dm && curReq->pageNo == pageNo) {
-        AbortCurrentRequest();
-    }
+    AbortCurrentRequests(dm, pageNo);
 
     ScopedCritSec scopeCache(&cacheAccess);
 
     RectD mediabox = dm->GetEngine()->PageMediabox(pageNo);
-    for (int i = 0; i < cacheCount; i++) {
-        auto e = cache[i];
+    BitmapCacheEntry* e = buckets[GetBucketIdx(dm, pageNo)];
+    for (; e; e = e->bucketNext) {
         if (e->dm == dm && e->pageNo == pageNo && !GetTileRect(mediabox, e->tile).Intersect(rect).IsEmpty()) {
             e->zoom = INVALID_ZOOM;
             e->outOfDate = true;
@@ -292,13 +562,68 @@ void RenderCache::Invalidate(DisplayModel* dm, int pageNo, RectD rect) {
     }
 }
 
+// pages cheaper than this to render (e.g. a single image) are split into fewer tiles
+#define CHEAP_RENDER_MS_PER_MPX 15.f
+// pages more expensive than this (e.g. dense vector graphics) are split into
+// more tiles, so that they're rendered in parallel by all render threads
+#define EXPENSIVE_RENDER_MS_PER_MPX 150.f
+
+void RenderCache::UpdateRenderCost(DisplayModel* dm, int pageNo, float zoom, Size size, double ms) {
+    float mpx = (float)size.dx * size.dy / (1024.f * 1024.f);
+    if (mpx < 0.01f) {
+        return;
+    }
+    float cost = (float)ms / mpx;
+    ScopedCritSec scope(&cacheAccess);
+    PageRenderCost& c = renderCosts[GetBucketIdx(dm, pageNo)];
+    if (c.dm != dm || c.pageNo != pageNo) {
+        // the tiles at this zoom level have already been requested without adjustment
+        c = PageRenderCost();
+        c.dm = dm;
+        c.pageNo = pageNo;
+        c.adjustZoom = zoom;
+    }
+    if (c.msPerMegaPixel == 0) {
+        c.msPerMegaPixel = cost;
+    } else {
+        c.msPerMegaPixel = 0.7f * c.msPerMegaPixel + 0.3f * cost;
+    }
+}
+
+// returns by how much to increase (or decrease) the tile resolution of a page
+// based on how long it took to render it so far
+int RenderCache::GetTileResAdjust(DisplayModel* dm, int pageNo, float zoom) {
+    ScopedCritSec scope(&cacheAccess);
+    PageRenderCost& c = renderCosts[GetBucketIdx(dm, pageNo)];
+    if (c.dm != dm || c.pageNo != pageNo) {
+        // not rendered yet, decide at the next zoom change once the cost is known
+        c = PageRenderCost();
+        c.dm = dm;
+        c.pageNo = pageNo;
+        c.adjustZoom = zoom;
+        return 0;
+    }
+    if (c.adjustZoom != zoom && c.msPerMegaPixel != 0) {
+        // the page has to be rendered anew anyway
+        c.adjustZoom = zoom;
+        c.resAdjust = 0;
+        if (c.msPerMegaPixel < CHEAP_RENDER_MS_PER_MPX) {
+            c.resAdjust = -1;
+        } else if (c.msPerMegaPixel > EXPENSIVE_RENDER_MS_PER_MPX && nRenderThreads > 1 &&
+                   dm->GetEngine()->HasClipOptimizations(pageNo)) {
+            c.resAdjust = 1;
+        }
+    }
+    return c.resAdjust;
+}
+
 // determine the count of tiles required for a page at a given zoom level
 USHORT RenderCache::GetTileRes(DisplayModel* dm, int pageNo) {
     auto engine = dm->GetEngine();
     RectD mediabox = engine->PageMediabox(pageNo);
     float zoom = dm->GetZoomReal(pageNo);
     float zoomVirt = dm->GetZoomVirtual();
-    Rect viewPort = dm->GetViewPort();
+    CanvasRect viewPort = dm->GetViewPort();
     int rotation = dm->GetRotation();
     RectD pixelbox = engine->Transform(mediabox, pageNo, zoom, rotation);
 
@@ -321,6 +646,13 @@ USHORT RenderCache::GetTileRes(DisplayModel* dm, int pageNo) {
     if (factorAvg > 1.5) {
         res = (USHORT)ceilf(log(factorAvg) / log(2.0f));
     }
+    int adjust = GetTileResAdjust(dm, pageNo, zoom);
+    if (adjust < 0 && res > 0) {
+        res--;
+    } else if (adjust > 0 && res < 2) {
+        // splitting a page into more than 16 tiles costs more than it gains
+        res++;
+    }
     // limit res to 30, so that (1 << res) doesn't overflow for 32-bit signed int
     return std::min(res, (USHORT)30);
 }
@@ -329,8 +661,8 @@ USHORT RenderCache::GetTileRes(DisplayModel* dm, int pageNo) {
 USHORT RenderCache::GetMaxTileRes(DisplayModel* dm, int pageNo, int rotation) {
     ScopedCritSec scope(&cacheAccess);
     USHORT maxRes = 0;
-    for (int i = 0; i < cacheCount; i++) {
-        auto e = cache[i];
+    BitmapCacheEntry* e = buckets[GetBucketIdx(dm, pageNo)];
+    for (; e; e = e->bucketNext) {
         if (e->dm == dm && e->pageNo == pageNo && e->rotation == rotation) {
             maxRes = std::max(e->tile.res, maxRes);
         }
@@ -356,12 +688,12 @@ bool RenderCache::ReduceTileSize() {
 
     // invalidate all rendered bitmaps and all requests
     while (cacheCount > 0) {
-        FreeForDisplayModel(cache[0]->dm);
+        FreeForDisplayModel(lruFirst->dm);
     }
-    while (requestCount > 0) {
-        ClearQueueForDisplayModel(requests[0].dm);
+    while (requests.size() > 0) {
+        ClearQueueForDisplayModel(requests.at(0).dm);
     }
-    AbortCurrentRequest();
+    AbortCurrentRequests();
 
     return true;
 }
@@ -377,12 +709,59 @@ void RenderCache::RequestRendering(DisplayModel* dm, int pageNo) {
     RequestRendering(dm, pageNo, tile);
     // render both tiles of the first row when splitting a page in four
     // (which always happens on larger displays for Fit Width)
-    if (tile.res == 1 && !IsRenderQueueFull()) {
+    if (tile.res == 1) {
         tile.col = 1;
         RequestRendering(dm, pageNo, tile, false);
     }
 }
 
+// request rendering of a page that will likely be scrolled into view soon,
+// unless it's <distance> pages away and all prefetched pages together
+// wouldn't comfortably fit into the cache anymore
+void RenderCache::Prefetch(DisplayModel* dm, int pageNo, int distance) {
+    TilePosition tile(GetTileRes(dm, pageNo), 0, 0);
+    if (tile.res > 1) {
+        return;
+    }
+    float zoom = dm->GetZoomReal(pageNo);
+    Rect pixelbox = GetTileRectDevice(dm->GetEngine(), pageNo, dm->GetRotation(), zoom, TilePosition());
+    size_t size = (size_t)pixelbox.dx * pixelbox.dy * 4;
+    if (size * distance > GetCacheBudget() / 2) {
+        return;
+    }
+    RequestRendering(dm, pageNo);
+}
+
+// request a quick rendering of the whole page at a fraction of the zoom level
+// (and without anti-aliasing), to be shown scaled up until the actual tiles
+// have been rendered (which for complex pages might take several seconds)
+void RenderCache::RequestPreview(DisplayModel* dm, int pageNo) {
+    ScopedCritSec scope(&requestAccess);
+    for (int i = 0; i < nRenderThreads; i++) {
+        PageRenderRequest* curReq = renderThreads[i].curReq;
+        if (curReq && curReq->isPreview && curReq->dm == dm && curReq->pageNo == pageNo) {
+            return;
+        }
+    }
+    for (PageRenderRequest& req : requests) {
+        if (req.isPreview && req.dm == dm && req.pageNo == pageNo) {
+            return;
+        }
+    }
+
+    int rotation = NormalizeRotation(dm->GetRotation());
+    float zoom = dm->GetZoomReal(pageNo) * PREVIEW_ZOOM_FACTOR;
+    // the preview is a single bitmap of the whole page, so keep it within the size
+    // of a tile (at high zoom levels, it'd otherwise take up hundreds of MB)
+    EngineBase* engine = dm->GetEngine();
+    RectD pixelbox = engine->Transform(engine->PageMediabox(pageNo), pageNo, zoom, rotation);
+    if (pixelbox.dx > maxTileSize.dx || pixelbox.dy > maxTileSize.dy) {
+        zoom *= (float)std::min(maxTileSize.dx / pixelbox.dx, maxTileSize.dy / pixelbox.dy);
+    }
+    TilePosition tile(0, 0, 0);
+    Render(dm, pageNo, rotation, zoom, &tile, nullptr, nullptr, true);
+}
+
 /* Render a bitmap for page <pageNo> in <dm>. */
 void RenderCache::RequestRendering(DisplayModel* dm, int pageNo, TilePosition tile, bool clearQueueForPage) {
     ScopedCritSec scope(&requestAccess);
@@ -394,14 +773,22 @@ void RenderCache::RequestRendering(DisplayModel* dm, int pageNo, TilePosition ti
     int rotation = NormalizeRotation(dm->GetRotation());
     float zoom = dm->GetZoomReal(pageNo);
 
-    if (curReq && (curReq->pageNo == pageNo) && (curReq->dm == dm) && (curReq->tile == tile)) {
+    for (int i = 0; i < nRenderThreads; i++) {
+        PageRenderRequest* curReq = renderThreads[i].curReq;
+        if (!curReq || curReq->isPreview || (curReq->pageNo != pageNo) || (curReq->dm != dm) ||
+            !(curReq->tile == tile)) {
+            continue;
+        }
         if ((curReq->zoom == zoom) && (curReq->rotation == rotation)) {
             /* we're already rendering exactly the same page */
             return;
         }
         /* Currently rendered page is for the same page but with different zoom
         or rotation, so abort it */
-        AbortCurrentRequest();
+        if (curReq->abortCookie) {
+            curReq->abortCookie->Abort();
+        }
+        curReq->abort = true;
     }
 
     // clear requests for tiles of different resolution and invisible tiles
@@ -409,30 +796,23 @@ void RenderCache::RequestRendering(DisplayModel* dm, int pageNo, TilePosition ti
         ClearQueueForDisplayModel(dm, pageNo, &tile);
     }
 
-    for (int i = 0; i < requestCount; i++) {
-        PageRenderRequest* req = &(requests[i]);
-        if ((req->pageNo == pageNo) && (req->dm == dm) && (req->tile == tile)) {
-            if ((req->zoom == zoom) && (req->rotation == rotation)) {
-                /* Request with exactly the same parameters already queued for
-                   rendering. Move it to the top of the queue so that it'll
-                   be rendered faster. */
-                PageRenderRequest tmp;
-                tmp = requests[requestCount - 1];
-                requests[requestCount - 1] = *req;
-                *req = tmp;
-            } else {
-                /* There was a request queued for the same page but with different
-                   zoom or rotation, so only replace this request */
-                req->zoom = zoom;
-                req->rotation = rotation;
-            }
+    for (PageRenderRequest& req : requests) {
+        if (!req.isPreview && (req.pageNo == pageNo) && (req.dm == dm) && (req.tile == tile)) {
+            /* If the request is already queued with exactly the same
+               parameters, there's nothing to do (GetNextRequest decides
+               what to render first). If it's been queued for the same page
+               but with different zoom or rotation, only replace this request */
+            req.zoom = zoom;
+            req.rotation = rotation;
             return;
         }
     }
 
-    if (Exists(dm, pageNo, rotation, zoom, &tile)) {
-        /* This page has already been rendered in the correct dimensions
+    BitmapCacheEntry* reusable = FindReusable(dm, pageNo, rotation, zoom, tile);
+    if (reusable) {
+        /* This page has already been rendered in (nearly) the correct dimensions
            and isn't about to be rerendered in different dimensions */
+        DropCacheEntry(reusable);
         return;
     }
 
@@ -448,7 +828,7 @@ void RenderCache::Render(DisplayModel* dm, int pageNo, int rotation, float zoom,
 }
 
 bool RenderCache::Render(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition* tile, RectD* pageRect,
-                         RenderingCallback* renderCb) {
+                         RenderingCallback* renderCb, bool isPreview) {
     CrashIf(!dm);
     if (!dm || dm->dontRenderFlag) {
         return false;
@@ -460,40 +840,32 @@ bool RenderCache::Render(DisplayModel* dm, int pageNo, int rotation, float zoom,
     }
 
     ScopedCritSec scope(&requestAccess);
-    PageRenderRequest* newRequest;
 
-    /* add request to the queue */
-    if (requestCount == MAX_PAGE_REQUESTS) {
-        /* queue is full -> remove the oldest items on the queue */
-        if (requests[0].renderCb) {
-            requests[0].renderCb->Callback();
-        }
-        memmove(&(requests[0]), &(requests[1]), sizeof(PageRenderRequest) * (MAX_PAGE_REQUESTS - 1));
-        newRequest = &(requests[MAX_PAGE_REQUESTS - 1]);
-    } else {
-        newRequest = &(requests[requestCount]);
-        requestCount++;
+    if (nRenderThreads == 0) {
+        StartRenderThreads();
     }
-    CrashIf(requestCount > MAX_PAGE_REQUESTS);
 
-    newRequest->dm = dm;
-    newRequest->pageNo = pageNo;
-    newRequest->rotation = rotation;
-    newRequest->zoom = zoom;
+    PageRenderRequest newRequest;
+    newRequest.dm = dm;
+    newRequest.pageNo = pageNo;
+    newRequest.rotation = rotation;
+    newRequest.zoom = zoom;
     if (tile) {
-        newRequest->pageRect = GetTileRectUser(dm->GetEngine(), pageNo, rotation, zoom, *tile);
-        newRequest->tile = *tile;
+        newRequest.pageRect = GetTileRectUser(dm->GetEngine(), pageNo, rotation, zoom, *tile);
+        newRequest.tile = *tile;
     } else if (pageRect) {
-        newRequest->pageRect = *pageRect;
+        newRequest.pageRect = *pageRect;
         // can't cache bitmaps that aren't for a given tile
         CrashIf(!renderCb);
     } else {
         CrashMe();
     }
-    newRequest->abort = false;
-    newRequest->abortCookie = nullptr;
-    newRequest->timestamp = GetTickCount();
-    newRequest->renderCb = renderCb;
+    newRequest.isPreview = isPreview;
+    newRequest.abort = false;
+    newRequest.abortCookie = nullptr;
+    newRequest.timestamp = GetTickCount();
+    newRequest.renderCb = renderCb;
+    requests.Append(newRequest);
 
     SetEvent(startRendering);
 
@@ -503,45 +875,119 @@ bool RenderCache::Render(DisplayModel* dm, int pageNo, int rotation, float zoom,
 UINT RenderCache::GetRenderDelay(DisplayModel* dm, int pageNo, TilePosition tile) {
     ScopedCritSec scope(&requestAccess);
 
-    if (curReq && curReq->pageNo == pageNo && curReq->dm == dm && curReq->tile == tile) {
-        return GetTickCount() - curReq->timestamp;
+    for (int i = 0; i < nRenderThreads; i++) {
+        PageRenderRequest* curReq = renderThreads[i].curReq;
+        if (curReq && !curReq->isPreview && curReq->pageNo == pageNo && curReq->dm == dm && curReq->tile == tile) {
+            return GetTickCount() - curReq->timestamp;
+        }
     }
 
-    for (int i = 0; i < requestCount; i++) {
-        if (requests[i].pageNo == pageNo && requests[i].dm == dm && requests[i].tile == tile) {
-            return GetTickCount() - requests[i].timestamp;
+    for (PageRenderRequest& req : requests) {
+        if (!req.isPreview && req.pageNo == pageNo && req.dm == dm && req.tile == tile) {
+            return GetTickCount() - req.timestamp;
         }
     }
 
     return RENDER_DELAY_UNDEFINED;
 }
 
-bool RenderCache::GetNextRequest(PageRenderRequest* req) {
+struct RenderPriority {
+    // 0: preview of a visible page, 1: visible tile, 2: page visible nearby or
+    // prefetched, 3: any other page (such requests are usually not rendered at all)
+    int visibility = 0;
+    // distance from the center of the screen (for visible tiles) or from
+    // the current page (for all other pages)
+    int distance = 0;
+    USHORT res = 0;
+    DWORD timestamp = 0;
+};
+
+// priority is determined whenever a request is picked because which
+// tiles are visible changes while the requests are waiting
+static RenderPriority GetRenderPriority(PageRenderRequest& req) {
+    RenderPriority prio;
+    prio.res = req.tile.res;
+    prio.timestamp = req.timestamp;
+    // bitmaps explicitly asked for (e.g. thumbnails) are always needed
+    if (req.renderCb) {
+        prio.visibility = 1;
+        return prio;
+    }
+
+    DisplayModel* dm = req.dm;
+    PageInfo* pageInfo = dm->GetPageInfo(req.pageNo);
+    if (pageInfo && pageInfo->visibleRatio > 0.0 && IsTileVisible(dm, req.pageNo, req.tile)) {
+        if (req.isPreview) {
+            prio.visibility = 0;
+            return prio;
+        }
+        prio.visibility = 1;
+        Rect r = GetTileOnScreen(dm->GetEngine(), req.pageNo, req.rotation, req.zoom, req.tile,
+                                 pageInfo->pageOnScreen);
+        Size screen = dm->GetViewPort().Size();
+        prio.distance = abs(r.x + r.dx / 2 - screen.dx / 2) + abs(r.y + r.dy / 2 - screen.dy / 2);
+        return prio;
+    }
+
+    bool isNearby = dm->PageVisibleNearby(req.pageNo) || dm->PagePrefetched(req.pageNo);
+    prio.visibility = isNearby ? 2 : 3;
+    prio.distance = abs(req.pageNo - dm->CurrentPageNo());
+    return prio;
+}
+
+static bool IsHigherPriority(const RenderPriority& a, const RenderPriority& b) {
+    if (a.visibility != b.visibility) {
+        return a.visibility < b.visibility;
+    }
+    if (a.distance != b.distance) {
+        return a.distance < b.distance;
+    }
+    // lower resolution tiles cover more of the page
+    if (a.res != b.res) {
+        return a.res < b.res;
+    }
+    // as a last resort, the most recent request wins
+    return (int)(a.timestamp - b.timestamp) > 0;
+}
+
+bool RenderCache::GetNextRequest(RenderThread* thread, PageRenderRequest* req) {
     ScopedCritSec scope(&requestAccess);
 
-    if (requestCount == 0) {
+    if (requests.size() == 0) {
         return false;
     }
 
-    CrashIf(requestCount < 0);
-    CrashIf(requestCount > MAX_PAGE_REQUESTS);
-    requestCount--;
-    *req = requests[requestCount];
-    curReq = req;
-    CrashIf(requestCount < 0);
+    size_t bestIdx = 0;
+    RenderPriority best = GetRenderPriority(requests.at(0));
+    for (size_t i = 1; i < requests.size(); i++) {
+        RenderPriority prio = GetRenderPriority(requests.at(i));
+        if (IsHigherPriority(prio, best)) {
+            best = prio;
+            bestIdx = i;
+        }
+    }
+    *req = requests.at(bestIdx);
+    requests.RemoveAt(bestIdx);
+    thread->curReq = req;
     CrashIf(req->abort);
 
+    // startRendering only wakes up a single thread, so
+    // pass on the remaining work to another idle thread
+    if (requests.size() > 0) {
+        SetEvent(startRendering);
+    }
+
     return true;
 }
 
-bool RenderCache::ClearCurrentRequest() {
+bool RenderCache::ClearCurrentRequest(RenderThread* thread) {
     ScopedCritSec scope(&requestAccess);
-    if (curReq) {
-        delete curReq->abortCookie;
+    if (thread->curReq) {
+        delete thread->curReq->abortCookie;
     }
-    curReq = nullptr;
+    thread->curReq = nullptr;
 
-    bool isQueueEmpty = requestCount == 0;
+    bool isQueueEmpty = requests.size() == 0;
     return isQueueEmpty;
 }
 
@@ -553,14 +999,14 @@ void RenderCache::CancelRendering(DisplayModel* dm) {
 
     for (;;) {
         EnterCriticalSection(&requestAccess);
-        if (!curReq || (curReq->dm != dm)) {
+        if (!IsRendering(dm)) {
             // to be on the safe side
             ClearQueueForDisplayModel(dm);
             LeaveCriticalSection(&requestAccess);
             return;
         }
 
-        AbortCurrentRequest();
+        AbortCurrentRequests(dm);
         LeaveCriticalSection(&requestAccess);
 
         /* TODO: busy loop is not good, but I don't have a better idea */
@@ -570,39 +1016,105 @@ void RenderCache::CancelRendering(DisplayModel* dm) {
 
 void RenderCache::ClearQueueForDisplayModel(DisplayModel* dm, int pageNo, TilePosition* tile) {
     ScopedCritSec scope(&requestAccess);
-    int reqCount = requestCount;
-    int curPos = 0;
-    for (int i = 0; i < reqCount; i++) {
-        PageRenderRequest* req = &(requests[i]);
-        bool shouldRemove = req->dm == dm && (pageNo == INVALID_PAGE_NO || req->pageNo == pageNo) &&
-                            (!tile || req->tile.res != tile->res || !IsTileVisible(dm, req->pageNo, *tile, 0.5));
-        if (i != curPos)
-            requests[curPos] = requests[i];
+    for (size_t i = requests.size(); i > 0; i--) {
+        PageRenderRequest* req = &requests.at(i - 1);
+        // previews of the page are kept when clearing the queue for a given tile resolution
+        bool shouldRemove =
+            req->dm == dm && (pageNo == INVALID_PAGE_NO || req->pageNo == pageNo) &&
+            (!tile || !req->isPreview && (req->tile.res != tile->res || !IsTileVisible(dm, req->pageNo, *tile, 0.5)));
         if (shouldRemove) {
-            if (req->renderCb)
+            if (req->renderCb) {
                 req->renderCb->Callback();
-            requestCount--;
-        } else
-            curPos++;
+            }
+            requests.RemoveAt(i - 1);
+        }
+    }
+}
+
+// the number of rendering threads is configurable through
+// GlobalPrefs::renderThreads (0 means: depending on the number of cores)
+static int GetRenderThreadsCount() {
+    int n = gGlobalPrefs ? gGlobalPrefs->renderThreads : 0;
+    if (n <= 0) {
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+        // leave a core for the UI thread and limit the memory needed
+        // for bitmaps being rendered at the same time
+        n = std::min((int)si.dwNumberOfProcessors - 1, 4);
     }
+    return std::max(1, std::min(n, MAX_RENDER_THREADS));
 }
 
-void RenderCache::AbortCurrentRequest() {
+void RenderCache::StartRenderThreads() {
     ScopedCritSec scope(&requestAccess);
-    if (!curReq)
+    if (nRenderThreads > 0) {
         return;
-    if (curReq->abortCookie)
-        curReq->abortCookie->Abort();
-    curReq->abort = true;
+    }
+    int n = GetRenderThreadsCount();
+    for (int i = 0; i < n; i++) {
+        RenderThread* thread = &renderThreads[i];
+        thread->cache = this;
+        thread->hThread = CreateThread(nullptr, 0, RenderCacheThread, thread, 0, 0);
+        CrashIf(nullptr == thread->hThread);
+        if (!thread->hThread) {
+            break;
+        }
+        nRenderThreads++;
+    }
+}
+
+// returns true if any thread is currently rendering a page of <dm>
+// (or any page at all if <dm> is nullptr)
+bool RenderCache::IsRendering(DisplayModel* dm, int pageNo) {
+    ScopedCritSec scope(&requestAccess);
+    for (int i = 0; i < nRenderThreads; i++) {
+        PageRenderRequest* curReq = renderThreads[i].curReq;
+        if (!curReq) {
+            continue;
+        }
+        if (!dm || curReq->dm == dm && (pageNo == INVALID_PAGE_NO || curReq->pageNo == pageNo)) {
+            return true;
+        }
+    }
+    return false;
 }
 
+int RenderCache::QueueDepth() {
+    ScopedCritSec scope(&requestAccess);
+    return requests.isize();
+}
+
+// aborts all requests currently being rendered (optionally
+// only those belonging to <dm> resp. to its page <pageNo>)
+void RenderCache::AbortCurrentRequests(DisplayModel* dm, int pageNo) {
+    ScopedCritSec scope(&requestAccess);
+    for (int i = 0; i < nRenderThreads; i++) {
+        PageRenderRequest* curReq = renderThreads[i].curReq;
+        if (!curReq) {
+            continue;
+        }
+        if (dm && (curReq->dm != dm || pageNo != INVALID_PAGE_NO && curReq->pageNo != pageNo)) {
+            continue;
+        }
+        if (curReq->abortCookie) {
+            curReq->abortCookie->Abort();
+        }
+        curReq->abort = true;
+    }
+}
+
+// how long a render thread waits for more of a document that's still
+// being read before the page that isn't available yet is requested again
+#define PAGE_DATA_RETRY_DELAY_MS 100
+
 DWORD WINAPI RenderCache::RenderCacheThread(LPVOID data) {
-    RenderCache* cache = (RenderCache*)data;
+    RenderThread* thread = (RenderThread*)data;
+    RenderCache* cache = thread->cache;
     PageRenderRequest req;
     RenderedBitmap* bmp;
 
     for (;;) {
-        if (cache->ClearCurrentRequest()) {
+        if (cache->ClearCurrentRequest(thread)) {
             DWORD waitResult = WaitForSingleObject(cache->startRendering, INFINITE);
             // Is it not a page render request?
             if (WAIT_OBJECT_0 != waitResult) {
@@ -610,11 +1122,11 @@ DWORD WINAPI RenderCache::RenderCacheThread(LPVOID data) {
             }
         }
 
-        if (!cache->GetNextRequest(&req)) {
+        if (!cache->GetNextRequest(thread, &req)) {
             continue;
         }
 
-        if (!req.dm->PageVisibleNearby(req.pageNo) && !req.renderCb) {
+        if (!req.dm->PageVisibleNearby(req.pageNo) && !req.dm->PagePrefetched(req.pageNo) && !req.renderCb) {
             continue;
         }
 
@@ -625,6 +1137,18 @@ DWORD WINAPI RenderCache::RenderCacheThread(LPVOID data) {
             continue;
         }
 
+        EngineBase* engine = req.dm->GetEngine();
+        // the page is requested again when it's painted next
+        // (which happens right away for visible pages)
+        if (engine->WaitForPageData(req.pageNo, PAGE_DATA_RETRY_DELAY_MS)) {
+            if (req.renderCb) {
+                req.renderCb->Callback(nullptr);
+            } else {
+                req.dm->RepaintDisplay();
+            }
+            continue;
+        }
+
         // make sure that we have extracted page text for
         // all rendered pages to allow text selection and
         // searching without any further delays
@@ -633,9 +1157,31 @@ DWORD WINAPI RenderCache::RenderCacheThread(LPVOID data) {
         }
 
         CrashIf(req.abortCookie != nullptr);
-        EngineBase* engine = req.dm->GetEngine();
-        RenderPageArgs args(req.pageNo, req.zoom, req.rotation, &req.pageRect, RenderTarget::View, &req.abortCookie);
-        bmp = engine->RenderPage(args);
+        RenderTarget target = req.isPreview ? RenderTarget::Preview : RenderTarget::View;
+        RenderPageArgs args(req.pageNo, req.zoom, req.rotation, &req.pageRect, target, &req.abortCookie);
+        args.skipUserAnnots = true;
+        if (req.isPreview) {
+            args.quality = RenderQuality::Draft;
+        }
+        auto timeStart = TimeGet();
+        bool renderedInWorker = false;
+        bmp = nullptr;
+        if (gGlobalPrefs->renderInSeparateProcess) {
+            if (!thread->worker) {
+                thread->worker = new RenderWorker();
+            }
+            renderedInWorker = thread->worker->RenderPage(engine, args, &bmp);
+        } else if (thread->worker) {
+            delete thread->worker;
+            thread->worker = nullptr;
+        }
+        if (!renderedInWorker) {
+            bmp = engine->RenderPage(args);
+        }
+        cache->lastRenderMs = TimeSinceInMs(timeStart);
+        if (bmp && !req.isPreview && !req.renderCb && !req.abort) {
+            cache->UpdateRenderCost(req.dm, req.pageNo, req.zoom, bmp->Size(), cache->lastRenderMs);
+        }
         if (req.abort) {
             delete bmp;
             if (req.renderCb) {
@@ -654,7 +1200,21 @@ DWORD WINAPI RenderCache::RenderCacheThread(LPVOID data) {
                 UpdateBitmapColors(bmp->GetBitmap(), cache->textColor, cache->backgroundColor);
             }
             cache->Add(req, bmp);
-            req.dm->RepaintDisplay();
+            // only the area covered by the new tile has to be repainted (unless
+            // the layout has changed in the meantime or a page preview was rendered)
+            DisplayModel* dm = req.dm;
+            PageInfo* pageInfo = dm->GetPageInfo(req.pageNo);
+            Rect area;
+            if (pageInfo && !req.isPreview && req.zoom == dm->GetZoomReal(req.pageNo) &&
+                req.rotation == dm->GetRotation()) {
+                area = GetTileOnScreen(engine, req.pageNo, req.rotation, req.zoom, req.tile, pageInfo->pageOnScreen);
+                area.Inflate(1, 1);
+            }
+            if (area.IsEmpty()) {
+                dm->RepaintDisplay();
+            } else {
+                dm->RepaintDisplayArea(area);
+            }
         }
     }
 }
@@ -662,12 +1222,19 @@ DWORD WINAPI RenderCache::RenderCacheThread(LPVOID data) {
 // TODO: conceptually, RenderCache is not the right place for code that paints
 //       (this is the only place that knows about Tiles, though)
 UINT RenderCache::PaintTile(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, TilePosition tile, Rect tileOnScreen,
-                            bool renderMissing, bool* renderOutOfDateCue, bool* renderedReplacement) {
+                            bool renderMissing, bool* renderOutOfDateCue, bool* renderedReplacement,
+                            TileCompositor* compositor) {
     float zoom = dm->GetZoomReal(pageNo);
     BitmapCacheEntry* entry = Find(dm, pageNo, dm->GetRotation(), zoom, &tile);
     UINT renderDelay = 0;
 
     if (!entry) {
+        entry = FindReusable(dm, pageNo, dm->GetRotation(), zoom, tile);
+    }
+    if (entry) {
+        tileCacheHits++;
+    } else {
+        tileCacheMisses++;
         if (!isRemoteSession) {
             if (renderedReplacement) {
                 *renderedReplacement = true;
@@ -675,7 +1242,7 @@ UINT RenderCache::PaintTile(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo,
             entry = Find(dm, pageNo, dm->GetRotation(), INVALID_ZOOM, &tile);
         }
         renderDelay = GetRenderDelay(dm, pageNo, tile);
-        if (renderMissing && RENDER_DELAY_UNDEFINED == renderDelay && !IsRenderQueueFull()) {
+        if (renderMissing && RENDER_DELAY_UNDEFINED == renderDelay) {
             RequestRendering(dm, pageNo, tile);
         }
     }
@@ -695,13 +1262,22 @@ UINT RenderCache::PaintTile(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo,
         return renderDelay;
     }
 
-    HDC bmpDC = CreateCompatibleDC(hdc);
-    if (bmpDC) {
-        Size bmpSize = renderedBmp->Size();
-        int xSrc = -std::min(tileOnScreen.x, 0);
-        int ySrc = -std::min(tileOnScreen.y, 0);
-        float factor = std::min(1.0f * bmpSize.dx / tileOnScreen.dx, 1.0f * bmpSize.dy / tileOnScreen.dy);
+    Size bmpSize = renderedBmp->Size();
+    // bounds can start anywhere within the tile (it's clipped to the area to repaint)
+    int xSrc = bounds.x - tileOnScreen.x;
+    int ySrc = bounds.y - tileOnScreen.y;
+    float factor = std::min(1.0f * bmpSize.dx / tileOnScreen.dx, 1.0f * bmpSize.dy / tileOnScreen.dy);
+
+    if (compositor) {
+        RectD src(xSrc * factor, ySrc * factor, bounds.dx * factor, bounds.dy * factor);
+        if (!compositor->DrawTile(entry, bounds, src)) {
+            DropCacheEntry(entry);
+            return RENDER_DELAY_FAILED;
+        }
+    }
 
+    HDC bmpDC = compositor ? nullptr : CreateCompatibleDC(hdc);
+    if (bmpDC) {
         HGDIOBJ prevBmp = SelectObject(bmpDC, hbmp);
         int xDst = bounds.x;
         int yDst = bounds.y;
@@ -745,8 +1321,9 @@ static int cmpTilePosition(const void* a, const void* b) {
 }
 
 UINT RenderCache::Paint(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, PageInfo* pageInfo,
-                        bool* renderOutOfDateCue) {
+                        bool* renderOutOfDateCue, TileCompositor* compositor) {
     CrashIf(!pageInfo->shown || 0.0 == pageInfo->visibleRatio);
+    TraceSpan span("RenderCache::Paint");
 
 #if 0
     auto timeStart = TimeGet();
@@ -767,8 +1344,12 @@ UINT RenderCache::Paint(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, Page
         area = dm->GetEngine()->Transform(area, pageNo, zoom, rotation, true);
 
         RenderPageArgs args(pageNo, zoom, rotation, &area);
+        args.skipUserAnnots = true;
         RenderedBitmap* bmp = dm->GetEngine()->RenderPage(args);
-        bool success = bmp && bmp->GetBitmap() && bmp->StretchDIBits(hdc, bounds);
+        bool success = bmp && bmp->GetBitmap();
+        if (success) {
+            success = compositor ? compositor->DrawBitmap(bmp, bounds) : bmp->StretchDIBits(hdc, bounds);
+        }
         delete bmp;
 
         return success ? 0 : RENDER_DELAY_FAILED;
@@ -782,6 +1363,7 @@ UINT RenderCache::Paint(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, Page
         maxRes = targetRes;
     }
 
+    bool renderingDeferred = dm->IsRenderingDeferred();
     Vec<TilePosition> queue;
     queue.Append(TilePosition(0, 0, 0));
     UINT renderDelayMin = RENDER_DELAY_UNDEFINED;
@@ -802,8 +1384,10 @@ UINT RenderCache::Paint(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, Page
         }
 
         bool isTargetRes = tile.res == targetRes;
-        UINT renderDelay = PaintTile(hdc, isect, dm, pageNo, tile, tileOnScreen, isTargetRes, renderOutOfDateCue,
-                                     isTargetRes ? &neededScaling : nullptr);
+        // while rendering is deferred, only scale the tiles rendered at other zoom levels
+        bool renderMissing = isTargetRes && !renderingDeferred;
+        UINT renderDelay = PaintTile(hdc, isect, dm, pageNo, tile, tileOnScreen, renderMissing, renderOutOfDateCue,
+                                     isTargetRes ? &neededScaling : nullptr, compositor);
         if (!(isTargetRes && 0 == renderDelay) && tile.res < maxRes) {
             queue.Append(TilePosition(tile.res + 1, tile.row * 2, tile.col * 2));
             queue.Append(TilePosition(tile.res + 1, tile.row * 2, tile.col * 2 + 1));
@@ -820,6 +1404,14 @@ UINT RenderCache::Paint(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, Page
         }
     }
 
+    // show a quick preview if nothing at all has been rendered for this page yet
+    // (also while rendering is deferred, since previews are rendered as drafts and
+    // the page at its final quality is requested once the view has settled)
+    TilePosition previewTile(0, 0, 0);
+    if (neededScaling && !Exists(dm, pageNo, rotation, INVALID_ZOOM, &previewTile)) {
+        RequestPreview(dm, pageNo);
+    }
+
 #ifdef CONSERVE_MEMORY
     if (!neededScaling) {
         if (renderOutOfDateCue) {
@@ -5,10 +5,24 @@
 #define RENDER_DELAY_FAILED ((UINT)-2)
 #define INVALID_TILE_RES ((USHORT)-1)
 
-#define MAX_PAGE_REQUESTS 8
-// keep this value reasonably low, else we'll run out of
-// GDI resources/memory when caching many larger bitmaps
-#define MAX_BITMAPS_CACHED 64
+// upper limit for the number of threads rendering pages concurrently
+#define MAX_RENDER_THREADS 16
+// the cache is limited by the memory used by the bitmaps (cf. GetCacheBudget),
+// this additionally limits the number of GDI objects we hold on to
+#define MAX_BITMAPS_CACHED 512
+// number of buckets for looking up cached bitmaps by DisplayModel and page
+// (must be a power of 2)
+#define BITMAP_CACHE_BUCKETS 256
+// zoom of the quickly rendered previews relative to the actual zoom
+#define PREVIEW_ZOOM_FACTOR 0.25f
+// tiles rendered at a zoom level this close to the one needed are scaled
+// instead of being rendered anew (scaling up blurs sooner than scaling down)
+#define MAX_TILE_UPSCALE 1.03f
+#define MAX_TILE_DOWNSCALE 1.1f
+
+// true if the process uses more GDI objects than GlobalPrefs::gdiObjectsLimit
+// (CreateDIBSection starts failing once Windows' per-process limit is reached)
+bool IsNearGdiObjectsLimit();
 
 class RenderingCallback {
   public:
@@ -44,12 +58,27 @@ struct BitmapCacheEntry {
     int rotation = 0;
     float zoom = 0.f;
     TilePosition tile;
-    int cacheIdx = -1; // index within RenderCache.cache
 
     // owned by the BitmapCacheEntry
     RenderedBitmap* bitmap = nullptr;
+    // memory used by bitmap (in bytes)
+    size_t size = 0;
     bool outOfDate = false;
+    // a low resolution bitmap of the whole page, only shown until the page
+    // has been rendered at the current zoom (cf. RenderCache::RequestPreview)
+    bool isPreview = false;
     int refs = 1;
+    // the bitmap uploaded by a TileCompositor (an ID2D1Bitmap, owned by the
+    // BitmapCacheEntry) and the render target it has been uploaded to
+    IUnknown* gpuBitmap = nullptr;
+    LONG gpuTargetId = 0;
+
+    // all entries are in a list ordered by most recent use
+    // (RenderCache.lruFirst is the most recently used)
+    BitmapCacheEntry* lruPrev = nullptr;
+    BitmapCacheEntry* lruNext = nullptr;
+    // next entry in the same RenderCache.buckets chain
+    BitmapCacheEntry* bucketNext = nullptr;
 
     BitmapCacheEntry(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition tile,
                      RenderedBitmap* bitmap) {
@@ -61,6 +90,9 @@ struct BitmapCacheEntry {
         this->bitmap = bitmap;
     }
     ~BitmapCacheEntry() {
+        if (gpuBitmap) {
+            gpuBitmap->Release();
+        }
         delete bitmap;
     }
 };
@@ -76,6 +108,7 @@ struct PageRenderRequest {
     TilePosition tile;
 
     RectD pageRect; // calculated from TilePosition
+    bool isPreview = false;
     bool abort = false;
     AbortCookie* abortCookie = nullptr;
     DWORD timestamp = 0;
@@ -84,74 +117,134 @@ struct PageRenderRequest {
     RenderingCallback* renderCb = nullptr;
 };
 
+class RenderCache;
+class TileCompositor;
+
+/* Each rendering thread pulls the next PageRenderRequest from the
+   shared queue and keeps track of the request it's currently rendering */
+class RenderWorker;
+
+struct RenderThread {
+    RenderCache* cache = nullptr;
+    HANDLE hThread = nullptr;
+    PageRenderRequest* curReq = nullptr;
+    // cf. GlobalPrefs::renderInSeparateProcess
+    RenderWorker* worker = nullptr;
+};
+
 class RenderCache {
   public:
-    BitmapCacheEntry* cache[MAX_BITMAPS_CACHED]{};
+    BitmapCacheEntry* lruFirst = nullptr;
+    BitmapCacheEntry* lruLast = nullptr;
+    BitmapCacheEntry* buckets[BITMAP_CACHE_BUCKETS]{};
     int cacheCount = 0;
+    // total size of all cached bitmaps (in bytes)
+    size_t cacheSize = 0;
     // make sure to never ask for requestAccess in a cacheAccess
     // protected critical section in order to avoid deadlocks
     CRITICAL_SECTION cacheAccess;
 
-    PageRenderRequest requests[MAX_PAGE_REQUESTS]{};
-    int requestCount = 0;
-    PageRenderRequest* curReq = nullptr;
+    // pending requests, rendered in the order of GetRenderPriority
+    Vec<PageRenderRequest> requests;
     CRITICAL_SECTION requestAccess;
-    HANDLE renderThread = nullptr;
+    RenderThread renderThreads[MAX_RENDER_THREADS]{};
+    // rendering threads are started on the first rendering request
+    int nRenderThreads = 0;
 
     Size maxTileSize{};
     bool isRemoteSession = false;
 
+    // how expensive a page has been to render, for adjusting its tile size
+    // (a direct mapped table like buckets, collisions just replace older pages)
+    struct PageRenderCost {
+        DisplayModel* dm = nullptr;
+        int pageNo = 0;
+        // exponentially weighted moving average of the rendering time per megapixel
+        float msPerMegaPixel = 0;
+        // the tile resolution adjustment decided for the page at adjustZoom
+        // (kept while the zoom doesn't change, so that tiles don't get re-rendered)
+        float adjustZoom = 0;
+        int resAdjust = 0;
+    };
+    PageRenderCost renderCosts[BITMAP_CACHE_BUCKETS];
+
     COLORREF textColor = 0;
     COLORREF backgroundColor = 0;
 
+    // statistics shown by the performance overlay (gShowPerfHud)
+    // tiles painted from a bitmap at the right zoom vs. not
+    int tileCacheHits = 0;
+    int tileCacheMisses = 0;
+    // how long the most recently rendered tile took
+    double lastRenderMs = 0;
+
     RenderCache();
     ~RenderCache();
 
     void RequestRendering(DisplayModel* dm, int pageNo);
+    void Prefetch(DisplayModel* dm, int pageNo, int distance);
+    void RequestPreview(DisplayModel* dm, int pageNo);
     void Render(DisplayModel* dm, int pageNo, int rotation, float zoom, RectD pageRect, RenderingCallback& callback);
     void CancelRendering(DisplayModel* dm);
     bool Exists(DisplayModel* dm, int pageNo, int rotation, float zoom = INVALID_ZOOM, TilePosition* tile = nullptr);
     void FreeForDisplayModel(DisplayModel* dm) {
         FreePage(dm);
     }
+    // moves the bitmaps of a document to the DisplayModel of its reloaded version.
+    // bitmaps of unchanged pages (cf. IsPageUnchanged) remain up to date,
+    // the others are only shown until the page has been rendered again
     void KeepForDisplayModel(DisplayModel* oldDm, DisplayModel* newDm);
+    void SaveToTileCache(DisplayModel* dm);
+    void LoadFromTileCache(DisplayModel* dm);
     void Invalidate(DisplayModel* dm, int pageNo, RectD rect);
     // returns how much time in ms has past since the most recent rendering
     // request for the visible part of the page if nothing at all could be
     // painted, 0 if something has been painted and RENDER_DELAY_FAILED on failure
-    UINT Paint(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, PageInfo* pageInfo, bool* renderOutOfDateCue);
+    // (the tiles are drawn by compositor instead of into hdc if it's given)
+    UINT Paint(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, PageInfo* pageInfo, bool* renderOutOfDateCue,
+               TileCompositor* compositor = nullptr);
+
+    // number of pending rendering requests
+    int QueueDepth();
 
     /* Interface for page rendering thread */
     HANDLE startRendering = nullptr;
 
-    bool ClearCurrentRequest();
-    bool GetNextRequest(PageRenderRequest* req);
+    bool ClearCurrentRequest(RenderThread* thread);
+    bool GetNextRequest(RenderThread* thread, PageRenderRequest* req);
     void Add(PageRenderRequest& req, RenderedBitmap* bitmap);
 
     USHORT GetTileRes(DisplayModel* dm, int pageNo);
+    int GetTileResAdjust(DisplayModel* dm, int pageNo, float zoom);
+    void UpdateRenderCost(DisplayModel* dm, int pageNo, float zoom, Size size, double ms);
     USHORT GetMaxTileRes(DisplayModel* dm, int pageNo, int rotation);
     bool ReduceTileSize();
 
-    bool IsRenderQueueFull() const {
-        return requestCount == MAX_PAGE_REQUESTS;
-    }
     UINT GetRenderDelay(DisplayModel* dm, int pageNo, TilePosition tile);
     void RequestRendering(DisplayModel* dm, int pageNo, TilePosition tile, bool clearQueueForPage = true);
     bool Render(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition* tile = nullptr,
-                RectD* pageRect = nullptr, RenderingCallback* callback = nullptr);
+                RectD* pageRect = nullptr, RenderingCallback* callback = nullptr, bool isPreview = false);
     void ClearQueueForDisplayModel(DisplayModel* dm, int pageNo = INVALID_PAGE_NO, TilePosition* tile = nullptr);
-    void AbortCurrentRequest();
+    void StartRenderThreads();
+    bool IsRendering(DisplayModel* dm, int pageNo = INVALID_PAGE_NO);
+    void AbortCurrentRequests(DisplayModel* dm = nullptr, int pageNo = INVALID_PAGE_NO);
 
     static DWORD WINAPI RenderCacheThread(LPVOID data);
 
     BitmapCacheEntry* Find(DisplayModel* dm, int pageNo, int rotation, float zoom = INVALID_ZOOM,
                            TilePosition* tile = nullptr);
+    BitmapCacheEntry* FindReusable(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition tile);
     bool DropCacheEntry(BitmapCacheEntry* entry);
+    void LinkCacheEntry(BitmapCacheEntry* entry);
+    void UnlinkCacheEntry(BitmapCacheEntry* entry);
+    bool FreeForSpace(size_t size);
+    void FreeForGdiObjects();
     void FreePage(DisplayModel* dm = nullptr, int pageNo = -1, TilePosition* tile = nullptr);
     void FreeNotVisible() {
         FreePage();
     }
 
     UINT PaintTile(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, TilePosition tile, Rect tileOnScreen,
-                   bool renderMissing, bool* renderOutOfDateCue, bool* renderedReplacement);
+                   bool renderMissing, bool* renderOutOfDateCue, bool* renderedReplacement,
+                   TileCompositor* compositor);
 };
@@ -0,0 +1,380 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#include "utils/BaseUtil.h"
+#include "utils/ScopedWin.h"
+#include "utils/FileUtil.h"
+#include "utils/Timer.h"
+#include "utils/WinUtil.h"
+#include "utils/Log.h"
+
+#include "wingui/TreeModel.h"
+
+#include "Annotation.h"
+#include "EngineBase.h"
+#include "EngineManager.h"
+
+#include "RenderWorker.h"
+
+#define RENDER_WORKER_MAGIC 0x57525053 // "SPRW"
+
+// a request is followed by filePathLen WCHARs (without a terminating zero)
+struct RenderWorkerRequest {
+    u32 magic;
+    int pageNo;
+    float zoom;
+    int rotation;
+    BOOL hasPageRect;
+    RectD pageRect;
+    int target;
+    int quality;
+    BOOL skipUserAnnots;
+    u32 filePathLen;
+};
+
+enum class RenderWorkerStatus { Ok, LoadFailed, RenderFailed };
+
+// the pixels of a rendered page are a 32-bit top-down DIB at the start of
+// the file mapping hMap, whose handle is valid in the worker process
+// until the worker reads the next request
+struct RenderWorkerReply {
+    u32 magic;
+    RenderWorkerStatus status;
+    u64 hMap;
+    int dx;
+    int dy;
+};
+
+static bool ReadAll(HANDLE h, void* data, DWORD size) {
+    char* s = (char*)data;
+    while (size > 0) {
+        DWORD nRead = 0;
+        if (!ReadFile(h, s, size, &nRead, nullptr) || nRead == 0) {
+            return false;
+        }
+        s += nRead;
+        size -= nRead;
+    }
+    return true;
+}
+
+static bool WriteAll(HANDLE h, const void* data, DWORD size) {
+    DWORD nWritten = 0;
+    return WriteFile(h, data, size, &nWritten, nullptr) && nWritten == size;
+}
+
+// a low integrity level process can still read the documents but write
+// neither to most of the file system nor to the registry
+static HANDLE CreateLowIntegrityToken() {
+    HANDLE token = nullptr;
+    DWORD access = TOKEN_DUPLICATE | TOKEN_QUERY | TOKEN_ADJUST_DEFAULT | TOKEN_ASSIGN_PRIMARY;
+    if (!OpenProcessToken(GetCurrentProcess(), access, &token)) {
+        return nullptr;
+    }
+    HANDLE restricted = nullptr;
+    BOOL ok = CreateRestrictedToken(token, DISABLE_MAX_PRIVILEGE, 0, nullptr, 0, nullptr, 0, nullptr, &restricted);
+    CloseHandle(token);
+    if (!ok) {
+        return nullptr;
+    }
+
+    SID_IDENTIFIER_AUTHORITY labelAuthority = SECURITY_MANDATORY_LABEL_AUTHORITY;
+    PSID sid = nullptr;
+    ok = AllocateAndInitializeSid(&labelAuthority, 1, SECURITY_MANDATORY_LOW_RID, 0, 0, 0, 0, 0, 0, 0, &sid);
+    if (ok) {
+        TOKEN_MANDATORY_LABEL label{};
+        label.Label.Attributes = SE_GROUP_INTEGRITY;
+        label.Label.Sid = sid;
+        ok = SetTokenInformation(restricted, TokenIntegrityLevel, &label, sizeof(label) + GetLengthSid(sid));
+        FreeSid(sid);
+    }
+    if (!ok) {
+        CloseHandle(restricted);
+        return nullptr;
+    }
+    return restricted;
+}
+
+static HANDLE LaunchWorkerProcess(const WCHAR* cmdLine, HANDLE hStdin, HANDLE hStdout) {
+    PROCESS_INFORMATION pi = {0};
+    STARTUPINFOW si = {0};
+    si.cb = sizeof(si);
+    si.dwFlags = STARTF_USESTDHANDLES;
+    si.hStdInput = hStdin;
+    si.hStdOutput = hStdout;
+
+    AutoFreeWstr cmdLineCopy(str::Dup(cmdLine));
+    BOOL ok = FALSE;
+    HANDLE token = CreateLowIntegrityToken();
+    if (token) {
+        ok = CreateProcessAsUserW(token, nullptr, cmdLineCopy, nullptr, nullptr, TRUE, 0, nullptr, nullptr, &si, &pi);
+        CloseHandle(token);
+    }
+    if (!ok) {
+        // e.g. on systems without integrity levels
+        ok = CreateProcessW(nullptr, cmdLineCopy, nullptr, nullptr, TRUE, 0, nullptr, nullptr, &si, &pi);
+    }
+    if (!ok) {
+        return nullptr;
+    }
+    CloseHandle(pi.hThread);
+    return pi.hProcess;
+}
+
+// documents loaded from a stream (e.g. embedded ones) can't be loaded by the worker
+static bool CanRenderInWorker(EngineBase* engine) {
+    if (engine->kind != kindEnginePdf && engine->kind != kindEngineXps) {
+        return false;
+    }
+    const WCHAR* filePath = engine->FileName();
+    return filePath && file::Exists(filePath);
+}
+
+RenderWorker::~RenderWorker() {
+    Stop();
+}
+
+bool RenderWorker::Start() {
+    // the host's ends of the pipes are not inherited, so that
+    // they break once either process goes away
+    HANDLE requestsRead = nullptr;
+    HANDLE repliesWrite = nullptr;
+    if (!CreatePipe(&requestsRead, &hRequests, nullptr, 0)) {
+        return false;
+    }
+    if (!CreatePipe(&hReplies, &repliesWrite, nullptr, 0)) {
+        CloseHandle(requestsRead);
+        Stop();
+        return false;
+    }
+    SetHandleInformation(requestsRead, HANDLE_FLAG_INHERIT, HANDLE_FLAG_INHERIT);
+    SetHandleInformation(repliesWrite, HANDLE_FLAG_INHERIT, HANDLE_FLAG_INHERIT);
+
+    AutoFreeWstr exePath(GetExePath());
+    AutoFreeWstr cmdLine(str::Format(L"\"%s\" -render-worker", exePath.Get()));
+    hProcess = LaunchWorkerProcess(cmdLine, requestsRead, repliesWrite);
+    CloseHandle(requestsRead);
+    CloseHandle(repliesWrite);
+    if (!hProcess) {
+        Stop();
+        return false;
+    }
+    return true;
+}
+
+void RenderWorker::Stop() {
+    if (hProcess) {
+        TerminateProcess(hProcess, 1);
+        CloseHandle(hProcess);
+        hProcess = nullptr;
+    }
+    if (hRequests) {
+        CloseHandle(hRequests);
+        hRequests = nullptr;
+    }
+    if (hReplies) {
+        CloseHandle(hReplies);
+        hReplies = nullptr;
+    }
+}
+
+// anonymous pipes can't be read with a timeout, so poll for the reply
+bool RenderWorker::WaitForReply(RenderWorkerReply* reply) {
+    auto timeStart = TimeGet();
+    for (;;) {
+        DWORD available = 0;
+        if (!PeekNamedPipe(hReplies, nullptr, 0, nullptr, &available, nullptr)) {
+            return false;
+        }
+        if (available >= sizeof(RenderWorkerReply)) {
+            return ReadAll(hReplies, reply, sizeof(RenderWorkerReply)) && reply->magic == RENDER_WORKER_MAGIC;
+        }
+        if (TimeSinceInMs(timeStart) > RENDER_WORKER_TIMEOUT_MS) {
+            logf("RenderWorker: killing the worker after %d ms\n", RENDER_WORKER_TIMEOUT_MS);
+            return false;
+        }
+        // the worker only exits before replying if it crashed
+        if (WaitForSingleObject(hProcess, 10) == WAIT_OBJECT_0) {
+            log("RenderWorker: the worker crashed\n");
+            return false;
+        }
+    }
+}
+
+bool RenderWorker::RenderPage(EngineBase* engine, RenderPageArgs& args, RenderedBitmap** bmpOut) {
+    *bmpOut = nullptr;
+    if (!CanRenderInWorker(engine)) {
+        return false;
+    }
+    const WCHAR* filePath = engine->FileName();
+    if (str::Eq(filePath, loadFailedPath)) {
+        return false;
+    }
+    if (!hProcess && !Start()) {
+        return false;
+    }
+
+    RenderWorkerRequest req{};
+    req.magic = RENDER_WORKER_MAGIC;
+    req.pageNo = args.pageNo;
+    req.zoom = args.zoom;
+    req.rotation = args.rotation;
+    req.hasPageRect = args.pageRect != nullptr;
+    if (args.pageRect) {
+        req.pageRect = *args.pageRect;
+    }
+    req.target = (int)args.target;
+    req.quality = (int)args.quality;
+    req.skipUserAnnots = args.skipUserAnnots;
+    req.filePathLen = (u32)str::Len(filePath);
+    if (!WriteAll(hRequests, &req, sizeof(req)) ||
+        !WriteAll(hRequests, filePath, req.filePathLen * sizeof(WCHAR))) {
+        // the worker went away after its last reply, so this page isn't to blame
+        Stop();
+        return false;
+    }
+
+    RenderWorkerReply reply{};
+    if (!WaitForReply(&reply)) {
+        // don't risk crashing or hanging the whole application by rendering this page in-process
+        Stop();
+        return true;
+    }
+    if (reply.status == RenderWorkerStatus::LoadFailed) {
+        loadFailedPath.SetCopy(filePath);
+        return false;
+    }
+    if (reply.status != RenderWorkerStatus::Ok) {
+        return true;
+    }
+
+    HANDLE hMap = nullptr;
+    HANDLE hMapWorker = (HANDLE)(uintptr_t)reply.hMap;
+    if (!DuplicateHandle(hProcess, hMapWorker, GetCurrentProcess(), &hMap, 0, FALSE, DUPLICATE_SAME_ACCESS)) {
+        return true;
+    }
+    BITMAPINFO bmi{};
+    bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    bmi.bmiHeader.biWidth = reply.dx;
+    bmi.bmiHeader.biHeight = -reply.dy;
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+    void* data = nullptr;
+    HBITMAP hbmp = CreateDIBSection(nullptr, &bmi, DIB_RGB_COLORS, &data, hMap, 0);
+    if (!hbmp) {
+        CloseHandle(hMap);
+        return true;
+    }
+    *bmpOut = new RenderedBitmap(hbmp, Size(reply.dx, reply.dy), hMap);
+    return true;
+}
+
+// returns a bitmap in the format described at RenderWorkerReply
+// (the bitmaps rendered by the engines usually already are, others are copied)
+static RenderedBitmap* ToSharedBitmap(RenderedBitmap* bmp) {
+    if (!bmp) {
+        return nullptr;
+    }
+    DIBSECTION info{};
+    if (bmp->hMap && GetObject(bmp->hbmp, sizeof(info), &info) == sizeof(info) && info.dsOffset == 0 &&
+        info.dsBm.bmBitsPixel == 32 && info.dsBmih.biHeight < 0) {
+        return bmp;
+    }
+    Size size = bmp->Size();
+    HANDLE hMap = nullptr;
+    HBITMAP hbmp = CreateMemoryBitmap(size, &hMap);
+    if (!hbmp) {
+        CloseHandle(hMap);
+        delete bmp;
+        return nullptr;
+    }
+    HDC hdcSrc = CreateCompatibleDC(nullptr);
+    HDC hdcDst = CreateCompatibleDC(nullptr);
+    HGDIOBJ oldSrc = SelectObject(hdcSrc, bmp->hbmp);
+    HGDIOBJ oldDst = SelectObject(hdcDst, hbmp);
+    BitBlt(hdcDst, 0, 0, size.dx, size.dy, hdcSrc, 0, 0, SRCCOPY);
+    SelectObject(hdcSrc, oldSrc);
+    SelectObject(hdcDst, oldDst);
+    DeleteDC(hdcSrc);
+    DeleteDC(hdcDst);
+    delete bmp;
+    return new RenderedBitmap(hbmp, size, hMap);
+}
+
+static void FreeSharedBitmap(RenderedBitmap* bmp) {
+    if (!bmp) {
+        return;
+    }
+    // the host keeps using the pixels, so the next page mustn't
+    // be rendered into them from the bitmap pool
+    DeleteObject(bmp->hbmp);
+    bmp->hbmp = nullptr;
+    delete bmp;
+}
+
+int RunRenderWorker() {
+    // a crash only has to end this process (the host starts a new worker)
+    SetErrorMode(GetErrorMode() | SEM_NOGPFAULTERRORBOX);
+    SetUnhandledExceptionFilter(nullptr);
+
+    HANDLE hRequests = GetStdHandle(STD_INPUT_HANDLE);
+    HANDLE hReplies = GetStdHandle(STD_OUTPUT_HANDLE);
+    EngineBase* engine = nullptr;
+    AutoFreeWstr enginePath;
+    FILETIME engineModified{};
+    RenderedBitmap* lastBmp = nullptr;
+
+    for (;;) {
+        RenderWorkerRequest req;
+        if (!ReadAll(hRequests, &req, sizeof(req)) || req.magic != RENDER_WORKER_MAGIC) {
+            break;
+        }
+        if (req.filePathLen == 0 || req.filePathLen > 32 * 1024) {
+            break;
+        }
+        AutoFreeWstr filePath(AllocArray<WCHAR>(req.filePathLen + 1));
+        if (!ReadAll(hRequests, filePath.Get(), req.filePathLen * sizeof(WCHAR))) {
+            break;
+        }
+        // the host has duplicated the handle to the previous page by now
+        FreeSharedBitmap(lastBmp);
+        lastBmp = nullptr;
+
+        // the host reloads documents that have changed on disk
+        FILETIME modified = file::GetModificationTime(filePath);
+        if (!str::Eq(filePath, enginePath) || CompareFileTime(&modified, &engineModified) != 0) {
+            delete engine;
+            engine = EngineManager::CreateEngine(filePath, nullptr, false, false);
+            enginePath.SetCopy(filePath);
+            engineModified = modified;
+        }
+
+        RenderWorkerReply reply{};
+        reply.magic = RENDER_WORKER_MAGIC;
+        reply.status = RenderWorkerStatus::RenderFailed;
+        if (!engine) {
+            reply.status = RenderWorkerStatus::LoadFailed;
+        } else if (req.pageNo >= 1 && req.pageNo <= engine->PageCount()) {
+            RectD pageRect = req.pageRect;
+            RenderPageArgs args(req.pageNo, req.zoom, req.rotation, req.hasPageRect ? &pageRect : nullptr,
+                                (RenderTarget)req.target);
+            args.quality = (RenderQuality)req.quality;
+            args.skipUserAnnots = req.skipUserAnnots;
+            lastBmp = ToSharedBitmap(engine->RenderPage(args));
+            if (lastBmp) {
+                reply.status = RenderWorkerStatus::Ok;
+                reply.hMap = (u64)(uintptr_t)(HANDLE)lastBmp->hMap;
+                reply.dx = lastBmp->Size().dx;
+                reply.dy = lastBmp->Size().dy;
+            }
+        }
+        if (!WriteAll(hReplies, &reply, sizeof(reply))) {
+            break;
+        }
+    }
+
+    FreeSharedBitmap(lastBmp);
+    delete engine;
+    return 0;
+}
@@ -0,0 +1,42 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+// With GlobalPrefs::renderInSeparateProcess, the render threads of the RenderCache
+// have the pages of PDF and XPS documents rendered by a helper process (this
+// executable started with -render-worker) which runs with a low integrity level.
+// A document which crashes or hangs the renderer then only takes down the helper,
+// which is started anew for the next page.
+
+// a worker which doesn't reply within this time is considered to hang and is killed
+#define RENDER_WORKER_TIMEOUT_MS (20 * 1000)
+
+struct RenderWorkerReply;
+
+// each render thread uses its own worker so that pages are still rendered in parallel
+class RenderWorker {
+  public:
+    RenderWorker() = default;
+    ~RenderWorker();
+
+    // returns false if the page has to be rendered in-process instead (e.g. for
+    // documents that aren't PDF or XPS files or that need a password). Otherwise
+    // *bmpOut is the rendered page or nullptr if rendering failed, the worker
+    // crashed or it had to be killed after RENDER_WORKER_TIMEOUT_MS
+    bool RenderPage(EngineBase* engine, RenderPageArgs& args, RenderedBitmap** bmpOut);
+
+  private:
+    HANDLE hProcess = nullptr;
+    // write end of the worker's stdin
+    HANDLE hRequests = nullptr;
+    // read end of the worker's stdout
+    HANDLE hReplies = nullptr;
+    // the last document the worker failed to load
+    AutoFreeWstr loadFailedPath;
+
+    bool Start();
+    void Stop();
+    bool WaitForReply(RenderWorkerReply* reply);
+};
+
+// renders the pages requested through stdin until it's closed (for -render-worker)
+int RunRenderWorker();
@@ -27,25 +27,6 @@ extern "C" {
 
 // based on pdfmerge.c in mupdf
 
-const pdf_write_options pdf_default_write_options2 = {
-    0,  /* do_incremental */
-    0,  /* do_pretty */
-    0,  /* do_ascii */
-    0,  /* do_compress */
-    0,  /* do_compress_images */
-    0,  /* do_compress_fonts */
-    0,  /* do_decompress */
-    0,  /* do_garbage */
-    0,  /* do_linear */
-    0,  /* do_clean */
-    0,  /* do_sanitize */
-    0,  /* do_appearance */
-    0,  /* do_encrypt */
-    ~0, /* permissions */
-    "", /* opwd_utf8[128] */
-    "", /* upwd_utf8[128] */
-};
-
 /* Copy as few key/value pairs as we can. Do not include items that reference other pages. */
 // clang-format off
 static pdf_obj* const copy_list[] = {
@@ -61,56 +42,237 @@ static pdf_obj* const copy_list[] = {
 };
 // clang-format on
 
+#define CATALOG_OBJ_NUM 1
+#define PAGES_OBJ_NUM 2
+
+// embedded fonts that have already been written, so that source files
+// using the same font only get a single copy of it in the output
+struct MergedFontFile {
+    u8 digest[16];
+    int num;
+};
+
+// Instead of grafting all pages into a single pdf_document and saving that
+// at the end (which requires all source files' objects in memory at once),
+// the source files are merged one after the other, with every object being
+// written to the output as soon as it's been renumbered. Only the currently
+// merged source file is kept open.
 struct PdfMerger {
     fz_context* ctx = nullptr;
+    fz_output* out = nullptr;
+    // only holds the renumbered copies of objects while they're being written
     pdf_document* doc_des = nullptr;
     pdf_document* doc_src = nullptr;
     VecStr filePaths;
 
+    // file offsets of the written objects, indexed by the object number
+    Vec<i64> offsets;
+    Vec<int> pageNums;
+    Vec<MergedFontFile> fontFiles;
+    // maps doc_src's object numbers to the output's (0 for not yet copied)
+    Vec<int> srcToDes;
+    // objects of doc_src that have a number in the output but haven't been written yet
+    Vec<int> pending;
+
     PdfMerger() = default;
     ~PdfMerger();
     bool MergeAndSave(TocItem*, char* dstPath);
     bool MergePdfFile(std::string_view);
-    void MergePdfPage(int page_from, int page_to, pdf_graft_map* graft_map);
+    void MergePdfPage(int pageNo);
+
+    int AllocObjNum();
+    int MapObjNum(int srcNum);
+    int MapFontFile(int srcNum);
+    pdf_obj* CopyObj(pdf_obj* obj, bool skipLength = false);
+    void WriteObject(int num, pdf_obj* obj, fz_buffer* stream);
+    void WritePendingObjects();
+    void WriteTrailer();
 };
 
 PdfMerger::~PdfMerger() {
+    fz_drop_output(ctx, out);
+    pdf_drop_document(ctx, doc_src);
     pdf_drop_document(ctx, doc_des);
     fz_flush_warnings(ctx);
     fz_drop_context(ctx);
 }
 
-void PdfMerger::MergePdfPage(int page_from, int page_to, pdf_graft_map* graft_map) {
-    pdf_obj* page_ref = nullptr;
-    pdf_obj* page_dict = nullptr;
+int PdfMerger::AllocObjNum() {
+    offsets.Append(0);
+    return offsets.isize() - 1;
+}
+
+int PdfMerger::MapObjNum(int srcNum) {
+    if (srcNum <= 0 || srcNum >= srcToDes.isize()) {
+        return 0;
+    }
+    if (!srcToDes.at(srcNum)) {
+        srcToDes.at(srcNum) = AllocObjNum();
+        pending.Append(srcNum);
+    }
+    return srcToDes.at(srcNum);
+}
+
+// identical font files are very likely to be used e.g. by the chapters
+// of a book that have been produced separately
+int PdfMerger::MapFontFile(int srcNum) {
+    if (srcNum <= 0 || srcNum >= srcToDes.isize() || srcToDes.at(srcNum)) {
+        return MapObjNum(srcNum);
+    }
+    if (!pdf_obj_num_is_stream(ctx, doc_src, srcNum)) {
+        return MapObjNum(srcNum);
+    }
+
+    MergedFontFile font;
+    fz_buffer* data = pdf_load_raw_stream_number(ctx, doc_src, srcNum);
+    u8* bytes = nullptr;
+    size_t len = fz_buffer_storage(ctx, data, &bytes);
+    fz_md5 md5;
+    fz_md5_init(&md5);
+    fz_md5_update(&md5, bytes, len);
+    fz_md5_final(&md5, font.digest);
+    fz_drop_buffer(ctx, data);
+
+    for (MergedFontFile& f : fontFiles) {
+        if (memeq(f.digest, font.digest, sizeof(font.digest))) {
+            srcToDes.at(srcNum) = f.num;
+            return f.num;
+        }
+    }
+    font.num = MapObjNum(srcNum);
+    fontFiles.Append(font);
+    return font.num;
+}
+
+// copies obj into doc_des with all references renumbered for the output
+pdf_obj* PdfMerger::CopyObj(pdf_obj* obj, bool skipLength) {
+    if (pdf_is_indirect(ctx, obj)) {
+        int num = MapObjNum(pdf_to_num(ctx, obj));
+        return num ? pdf_new_indirect(ctx, doc_des, num, 0) : PDF_NULL;
+    }
+    if (pdf_is_array(ctx, obj)) {
+        int n = pdf_array_len(ctx, obj);
+        pdf_obj* copy = pdf_new_array(ctx, doc_des, n);
+        fz_try(ctx) {
+            for (int i = 0; i < n; i++) {
+                pdf_array_push_drop(ctx, copy, CopyObj(pdf_array_get(ctx, obj, i)));
+            }
+        }
+        fz_catch(ctx) {
+            pdf_drop_obj(ctx, copy);
+            fz_rethrow(ctx);
+        }
+        return copy;
+    }
+    if (pdf_is_dict(ctx, obj)) {
+        int n = pdf_dict_len(ctx, obj);
+        pdf_obj* copy = pdf_new_dict(ctx, doc_des, n);
+        fz_try(ctx) {
+            for (int i = 0; i < n; i++) {
+                pdf_obj* key = pdf_dict_get_key(ctx, obj, i);
+                pdf_obj* val = pdf_dict_get_val(ctx, obj, i);
+                if (skipLength && pdf_name_eq(ctx, key, PDF_NAME(Length))) {
+                    continue;
+                }
+                bool isFontFile = pdf_name_eq(ctx, key, PDF_NAME(FontFile)) ||
+                                  pdf_name_eq(ctx, key, PDF_NAME(FontFile2)) ||
+                                  pdf_name_eq(ctx, key, PDF_NAME(FontFile3));
+                if (isFontFile && pdf_is_indirect(ctx, val)) {
+                    int num = MapFontFile(pdf_to_num(ctx, val));
+                    pdf_dict_put_drop(ctx, copy, key, num ? pdf_new_indirect(ctx, doc_des, num, 0) : PDF_NULL);
+                } else {
+                    pdf_dict_put_drop(ctx, copy, key, CopyObj(val));
+                }
+            }
+        }
+        fz_catch(ctx) {
+            pdf_drop_obj(ctx, copy);
+            fz_rethrow(ctx);
+        }
+        return copy;
+    }
+    // names, numbers and strings don't depend on their document
+    return pdf_keep_obj(ctx, obj);
+}
+
+void PdfMerger::WriteObject(int num, pdf_obj* obj, fz_buffer* stream) {
+    offsets.at(num) = fz_tell_output(ctx, out);
+    fz_write_printf(ctx, out, "%d 0 obj\n", num);
+    pdf_print_obj(ctx, out, obj, 1, 0);
+    if (stream) {
+        u8* data = nullptr;
+        size_t len = fz_buffer_storage(ctx, stream, &data);
+        fz_write_string(ctx, out, "\nstream\n");
+        fz_write_data(ctx, out, data, len);
+        fz_write_string(ctx, out, "\nendstream");
+    }
+    fz_write_string(ctx, out, "\nendobj\n\n");
+}
+
+void PdfMerger::WritePendingObjects() {
     pdf_obj* obj = nullptr;
-    pdf_obj* ref = nullptr;
-    int i;
+    pdf_obj* copy = nullptr;
+    fz_buffer* stream = nullptr;
+
+    fz_var(obj);
+    fz_var(copy);
+    fz_var(stream);
+
+    while (pending.size() > 0) {
+        int srcNum = pending.Pop();
+        int num = srcToDes.at(srcNum);
+        fz_try(ctx) {
+            obj = pdf_load_object(ctx, doc_src, srcNum);
+            bool isStream = pdf_obj_num_is_stream(ctx, doc_src, srcNum);
+            copy = CopyObj(obj, isStream);
+            if (isStream) {
+                // the data is copied as is, i.e. still compressed
+                stream = pdf_load_raw_stream_number(ctx, doc_src, srcNum);
+                pdf_dict_put_int(ctx, copy, PDF_NAME(Length), (i64)fz_buffer_storage(ctx, stream, nullptr));
+            }
+            WriteObject(num, copy, stream);
+        }
+        fz_always(ctx) {
+            fz_drop_buffer(ctx, stream);
+            pdf_drop_obj(ctx, copy);
+            pdf_drop_obj(ctx, obj);
+            stream = nullptr;
+            copy = nullptr;
+            obj = nullptr;
+        }
+        fz_catch(ctx) {
+            fz_rethrow(ctx);
+        }
+    }
+}
+
+void PdfMerger::MergePdfPage(int pageNo) {
+    pdf_obj* page_dict = nullptr;
 
-    fz_var(ref);
     fz_var(page_dict);
 
     fz_try(ctx) {
-        page_ref = pdf_lookup_page_obj(ctx, doc_src, page_from - 1);
+        pdf_obj* page_ref = pdf_lookup_page_obj(ctx, doc_src, pageNo - 1);
         pdf_flatten_inheritable_page_items(ctx, page_ref);
 
         page_dict = pdf_new_dict(ctx, doc_des, 4);
 
         pdf_dict_put(ctx, page_dict, PDF_NAME(Type), PDF_NAME(Page));
-        for (i = 0; i < (int)nelem(copy_list); i++) {
-            obj = pdf_dict_get(ctx, page_ref, copy_list[i]);
+        pdf_dict_put_drop(ctx, page_dict, PDF_NAME(Parent), pdf_new_indirect(ctx, doc_des, PAGES_OBJ_NUM, 0));
+        for (int i = 0; i < (int)nelem(copy_list); i++) {
+            pdf_obj* obj = pdf_dict_get(ctx, page_ref, copy_list[i]);
             if (obj != nullptr) {
-                pdf_dict_put_drop(ctx, page_dict, copy_list[i], pdf_graft_mapped_object(ctx, graft_map, obj));
+                pdf_dict_put_drop(ctx, page_dict, copy_list[i], CopyObj(obj));
             }
         }
 
-        ref = pdf_add_object(ctx, doc_des, page_dict);
-
-        pdf_insert_page(ctx, doc_des, page_to - 1, ref);
+        int num = AllocObjNum();
+        WriteObject(num, page_dict, nullptr);
+        pageNums.Append(num);
+        WritePendingObjects();
     }
     fz_always(ctx) {
         pdf_drop_obj(ctx, page_dict);
-        pdf_drop_obj(ctx, ref);
     }
     fz_catch(ctx) {
         fz_rethrow(ctx);
@@ -118,30 +280,58 @@ void PdfMerger::MergePdfPage(int page_from, int page_to, pdf_graft_map* graft_ma
 }
 
 bool PdfMerger::MergePdfFile(std::string_view path) {
-    doc_src = pdf_open_document(ctx, path.data());
+    fz_try(ctx) {
+        doc_src = pdf_open_document(ctx, path.data());
+    }
+    fz_catch(ctx) {
+        doc_src = nullptr;
+    }
     if (!doc_src) {
         return false;
     }
 
-    int nPages = 0;
-    pdf_graft_map* graft_map = nullptr;
-
+    bool ok = true;
     fz_try(ctx) {
-        nPages = pdf_count_pages(ctx, doc_src);
-        graft_map = pdf_new_graft_map(ctx, doc_des);
+        srcToDes.SetSize(pdf_xref_len(ctx, doc_src));
+        pending.Reset();
+        int nPages = pdf_count_pages(ctx, doc_src);
         for (int i = 1; i <= nPages; i++) {
-            MergePdfPage(i, -1, graft_map);
+            MergePdfPage(i);
         }
     }
     fz_always(ctx) {
-        pdf_drop_graft_map(ctx, graft_map);
         pdf_drop_document(ctx, doc_src);
+        doc_src = nullptr;
     }
     fz_catch(ctx) {
         // TODO: show error message
-        return false;
+        ok = false;
     }
-    return true;
+    return ok;
+}
+
+void PdfMerger::WriteTrailer() {
+    offsets.at(PAGES_OBJ_NUM) = fz_tell_output(ctx, out);
+    fz_write_printf(ctx, out, "%d 0 obj\n<</Type/Pages/Count %d/Kids[", PAGES_OBJ_NUM, pageNums.isize());
+    for (int num : pageNums) {
+        fz_write_printf(ctx, out, "%d 0 R ", num);
+    }
+    fz_write_string(ctx, out, "]>>\nendobj\n\n");
+
+    offsets.at(CATALOG_OBJ_NUM) = fz_tell_output(ctx, out);
+    fz_write_printf(ctx, out, "%d 0 obj\n<</Type/Catalog/Pages %d 0 R>>\nendobj\n\n", CATALOG_OBJ_NUM,
+                    PAGES_OBJ_NUM);
+
+    i64 startxref = fz_tell_output(ctx, out);
+    int nObjs = offsets.isize();
+    fz_write_printf(ctx, out, "xref\n0 %d\n0000000000 65535 f \n", nObjs);
+    for (int i = 1; i < nObjs; i++) {
+        // objects of broken references are never written and must be marked as free
+        i64 offset = offsets.at(i);
+        fz_write_printf(ctx, out, "%010ld 00000 %c \n", offset, offset ? 'n' : 'f');
+    }
+    fz_write_printf(ctx, out, "trailer\n<</Size %d/Root %d 0 R>>\nstartxref\n%ld\n%%%%EOF\n", nObjs,
+                    CATALOG_OBJ_NUM, startxref);
 }
 
 bool PdfMerger::MergeAndSave(TocItem* root, char* dstPath) {
@@ -165,38 +355,41 @@ bool PdfMerger::MergeAndSave(TocItem* root, char* dstPath) {
     // TODO: install warnigngs redirect
     fz_try(ctx) {
         doc_des = pdf_create_document(ctx);
+        out = fz_new_output_with_path(ctx, dstPath, 0);
+        fz_write_string(ctx, out, "%PDF-1.7\n%\xC2\xB5\xC2\xB6\n\n");
     }
     fz_catch(ctx) {
-        doc_des = nullptr;
-    }
-    if (doc_des == nullptr) {
         return false;
     }
+    // the catalog and the page tree are written last
+    for (int i = 0; i <= PAGES_OBJ_NUM; i++) {
+        offsets.Append(0);
+    }
 
-    bool ok;
-    for (int i = 0; i < nFiles; i++) {
+    bool ok = true;
+    for (int i = 0; ok && i < nFiles; i++) {
         std::string_view path = filePaths.at(i);
         ok = MergePdfFile(path);
-        if (!ok) {
-            // TODO: show error message
-            return false;
-        }
     }
 
-    pdf_write_options opts = pdf_default_write_options2;
-    // TODO: compare results with and without compression
-    opts.do_compress = 1;
-    opts.do_compress_images = 1;
-    opts.do_compress_fonts = 1;
-
     fz_try(ctx) {
-        pdf_save_document(ctx, doc_des, dstPath, &opts);
+        if (ok) {
+            WriteTrailer();
+        }
+        fz_close_output(ctx, out);
     }
     fz_catch(ctx) {
         // TODO: show an error message?
-        return false;
+        ok = false;
+    }
+    if (!ok) {
+        // don't leave a partial file behind
+        fz_drop_output(ctx, out);
+        out = nullptr;
+        AutoFreeWstr path(strconv::Utf8ToWstr(dstPath));
+        file::Delete(path);
     }
-    return true;
+    return ok;
 }
 
 bool SaveVirtualAsPdf(TocItem* root, char* dstPath) {
@@ -11,6 +11,7 @@
 #include "utils/FileUtil.h"
 #include "utils/UITask.h"
 #include "utils/WinUtil.h"
+#include "utils/Dpi.h"
 #include "utils/Log.h"
 
 #include "wingui/TreeModel.h"
@@ -27,6 +28,7 @@
 #include "ProgressUpdateUI.h"
 #include "TextSelection.h"
 #include "TextSearch.h"
+#include "MultiTextSearch.h"
 #include "Notifications.h"
 #include "SumatraPDF.h"
 #include "WindowInfo.h"
@@ -34,6 +36,8 @@
 #include "resource.h"
 #include "AppTools.h"
 #include "SearchAndDDE.h"
+#include "MemStats.h"
+#include "SearchResults.h"
 #include "Selection.h"
 #include "SumatraDialogs.h"
 #include "Translations.h"
@@ -217,6 +221,12 @@ struct FindThreadData : public ProgressUpdateUI {
     // can be deleted before the notification times out
     NotificationWnd* wnd;
     HANDLE thread;
+    // only used by Find All (FindTextOnThread uses dm->textSearch's setting)
+    bool matchCase = false;
+    // the latest progress, shown by a coalesced UpdateFindStatusTask
+    LONG progressCurrent = 0;
+    LONG progressTotal = 0;
+    LONG progressPending = 0;
 
     FindThreadData(WindowInfo* win, TextSearchDirection direction, HWND findBox)
         : win(win),
@@ -273,11 +283,36 @@ struct FindThreadData : public ProgressUpdateUI {
         }
     }
 
+    void HideUIFoundAll(size_t nHits, bool canceled, bool invalidRegex) {
+        LPARAM enable = (LPARAM)MAKELONG(1, 0);
+
+        SendMessage(win->hwndToolbar, TB_ENABLEBUTTON, IDM_FIND_PREV, enable);
+        SendMessage(win->hwndToolbar, TB_ENABLEBUTTON, IDM_FIND_NEXT, enable);
+        SendMessage(win->hwndToolbar, TB_ENABLEBUTTON, IDM_FIND_MATCH, enable);
+
+        if (!win->notifications->Contains(wnd)) {
+            /* our notification has been replaced or closed (or never created) */;
+        } else if (canceled) {
+            win->notifications->RemoveNotification(wnd);
+        } else if (invalidRegex) {
+            wnd->UpdateMessage(_TR("Invalid regular expression"), 3000, true);
+        } else if (0 == nHits) {
+            wnd->UpdateMessage(_TR("No matches were found"), 3000);
+        } else {
+            AutoFreeWstr buf(str::Format(_TR("Found %d matches"), (int)nHits));
+            wnd->UpdateMessage(buf, 3000);
+        }
+    }
+
     void UpdateProgress(int current, int total) override {
         if (!wnd || WasCanceled()) {
             return;
         }
-        uitask::Post([=] { UpdateFindStatusTask(win, wnd, current, total); });
+        InterlockedExchange(&progressCurrent, current);
+        InterlockedExchange(&progressTotal, total);
+        // FindEndTask (which deletes this) is always posted after this task
+        uitask::PostCoalesced(&progressPending,
+                              [this] { UpdateFindStatusTask(win, wnd, progressCurrent, progressTotal); });
     }
 
     bool WasCanceled() override {
@@ -303,6 +338,9 @@ static void FindEndTask(WindowInfo* win, FindThreadData* ftd, TextSel* textSel,
     } else if (textSel) {
         ShowSearchResult(win, textSel, wasModifiedCanceled);
         ftd->HideUI(true, loopedAround);
+    } else if (win->findAsYouTypePending) {
+        // canceled by typing: keep showing the last result until the next search is done
+        ftd->HideUI(false, false);
     } else {
         // nothing found or search canceled
         ClearSearchResult(win);
@@ -354,6 +392,10 @@ static DWORD WINAPI FindThread(LPVOID data) {
 }
 
 void AbortFinding(WindowInfo* win, bool hideMessage) {
+    if (win->findAsYouTypePending) {
+        KillTimer(win->hwndCanvas, FIND_AS_YOU_TYPE_TIMER_ID);
+        win->findAsYouTypePending = false;
+    }
     if (win->findThread) {
         win->findCanceled = true;
         WaitForSingleObject(win->findThread, INFINITE);
@@ -382,6 +424,179 @@ void FindTextOnThread(WindowInfo* win, TextSearchDirection direction, bool showP
     ftd->thread = win->findThread; // safe because only accesssed on ui thread
 }
 
+// only searches once the user has stopped typing for a moment, but
+// tells a search that's still running to stop right away, so that
+// the next one doesn't have to wait for it (cf. AbortFinding)
+// note: TextSearch remembers which pages can't contain the text when
+// the text is only being extended, so the next search can skip them
+void FindTextAsYouType(WindowInfo* win) {
+    if (win->findThread) {
+        win->findCanceled = true;
+    }
+    win->findAsYouTypePending = true;
+    SetTimer(win->hwndCanvas, FIND_AS_YOU_TYPE_TIMER_ID, FIND_AS_YOU_TYPE_DELAY_IN_MS, nullptr);
+}
+
+void OnFindAsYouTypeTimer(WindowInfo* win) {
+    if (!win->IsDocLoaded() || !win->AsFixed()) {
+        AbortFinding(win, true);
+        return;
+    }
+    // searching starts at the current page, so that hits on
+    // the visible pages are highlighted first
+    FindTextOnThread(win, TextSearchDirection::Forward, false);
+}
+
+static void FindAllEndTask(WindowInfo* win, FindThreadData* ftd, Vec<TextSearchHit>* hits, bool canceled,
+                           bool invalidRegex) {
+    if (!WindowInfoStillValid(win) || win->findThread != ftd->thread) {
+        // see FindEndTask
+        delete hits;
+        delete ftd;
+        return;
+    }
+    if (!win->IsDocLoaded()) {
+        // the UI has already been disabled and hidden
+        delete hits;
+    } else {
+        ftd->HideUIFoundAll(hits->size(), canceled, invalidRegex);
+        TabInfo* tab = win->currentTab;
+        if (canceled || hits->size() == 0) {
+            delete hits;
+        } else {
+            delete tab->searchHits;
+            tab->searchHits = hits;
+            ShowSearchResults(tab);
+            win->RepaintAsync();
+        }
+    }
+    win->findThread = nullptr;
+    delete ftd;
+}
+
+// Find All searches for a regular expression if the text is enclosed in
+// slashes (e.g. "/clause \d+\.\d+/") or for several terms at once if
+// they're separated by '|' (e.g. "X-1234 | X-5678")
+static bool FindAllHits(DisplayModel* dm, FindThreadData* ftd, Vec<TextSearchHit>& hits, bool* invalidRegex) {
+    const WCHAR* text = ftd->text;
+    size_t len = str::Len(text);
+    if (len > 2 && text[0] == '/' && text[len - 1] == '/') {
+        AutoFreeWstr pattern(str::DupN(text + 1, len - 2));
+        MultiTextSearch search(dm->textCache);
+        if (!search.SetRegex(pattern, ftd->matchCase)) {
+            *invalidRegex = true;
+            return true;
+        }
+        return search.FindAll(hits, ftd);
+    }
+    if (str::FindChar(text, '|')) {
+        MultiTextSearch search(dm->textCache);
+        search.SetTerms(text, ftd->matchCase);
+        return search.FindAll(hits, ftd);
+    }
+    return dm->textSearch->FindAll(text, hits, ftd);
+}
+
+// collects all the hits and only hands them over to the UI once
+static DWORD WINAPI FindAllThread(LPVOID data) {
+    FindThreadData* ftd = (FindThreadData*)data;
+    AssertCrash(ftd && ftd->win && ftd->win->ctrl && ftd->win->ctrl->AsFixed());
+    WindowInfo* win = ftd->win;
+    DisplayModel* dm = win->AsFixed();
+
+    Vec<TextSearchHit>* hits = new Vec<TextSearchHit>();
+    bool invalidRegex = false;
+    bool completed = FindAllHits(dm, ftd, *hits, &invalidRegex);
+
+    // wait for OnMenuFindAll to return (cf. FindThread)
+    while (!win->findThread) {
+        Sleep(1);
+    }
+
+    bool canceled = !completed || win->findCanceled;
+    uitask::Post([=] { FindAllEndTask(win, ftd, hits, canceled, invalidRegex); });
+    return 0;
+}
+
+void OnMenuFindAll(WindowInfo* win) {
+    if (!win->IsDocLoaded() || !win->AsFixed() || !NeedsFindUI(win)) {
+        return;
+    }
+    if (Edit_GetTextLength(win->hwndFindBox) == 0) {
+        OnMenuFind(win);
+        return;
+    }
+
+    AbortFinding(win, true);
+
+    FindThreadData* ftd = new FindThreadData(win, TextSearchDirection::Forward, win->hwndFindBox);
+    Edit_SetModify(win->hwndFindBox, FALSE);
+    if (str::IsEmpty(ftd->text.Get())) {
+        delete ftd;
+        return;
+    }
+    WORD state = (WORD)SendMessage(win->hwndToolbar, TB_GETSTATE, IDM_FIND_MATCH, 0);
+    ftd->matchCase = (state & TBSTATE_CHECKED) != 0;
+
+    ftd->ShowUI(true);
+    win->findThread = nullptr;
+    win->findThread = CreateThread(nullptr, 0, FindAllThread, ftd, 0, 0);
+    ftd->thread = win->findThread; // safe because only accesssed on ui thread
+}
+
+void ShowSearchHit(WindowInfo* win, const TextSearchHit& hit) {
+    DisplayModel* dm = win->AsFixed();
+    if (!dm || !dm->ValidPageNo(hit.startPage) || !dm->ValidPageNo(hit.endPage)) {
+        return;
+    }
+    // textSearch mustn't be used by a find thread at the same time
+    AbortFinding(win, true);
+    dm->textSearch->StartAt(hit.startPage, hit.startGlyph);
+    dm->textSearch->SelectUpTo(hit.endPage, hit.endGlyph);
+    if (dm->textSearch->result.len > 0) {
+        ShowSearchResult(win, &dm->textSearch->result, true);
+    }
+}
+
+// marks the positions of all hits along the right edge of the canvas
+// (next to the vertical scrollbar)
+void PaintSearchHitMarks(WindowInfo* win, HDC hdc) {
+    CrashIf(!win->AsFixed());
+    DisplayModel* dm = win->AsFixed();
+    Vec<TextSearchHit>* hits = win->currentTab->searchHits;
+    CanvasSize canvasSize = dm->GetCanvasSize();
+    CanvasRect viewPort = dm->GetViewPort();
+    if (!hits || canvasSize.dy <= 0 || viewPort.dy <= 0) {
+        return;
+    }
+
+    int dx = DpiScale(win->hwndCanvas, 8);
+    int dy = std::max(DpiScale(win->hwndCanvas, 2), 1);
+    Vec<Rect> rects;
+    int lastY = -1;
+    for (auto& hit : *hits) {
+        PageInfo* pageInfo = dm->GetPageInfo(hit.startPage);
+        if (!pageInfo || !pageInfo->shown) {
+            continue;
+        }
+        if (hit.rect.IsEmpty()) {
+            continue;
+        }
+        Rect rc = dm->CvtToScreen(hit.startPage, hit.rect.Convert<double>());
+        // from the position within the canvas to the position along the scrollbar
+        i64 canvasY = (i64)rc.y + viewPort.y;
+        int y = (int)(canvasY * viewPort.dy / canvasSize.dy);
+        if (y == lastY) {
+            // hits on the same line only need a single mark
+            continue;
+        }
+        lastY = y;
+        rects.Append(Rect(viewPort.dx - dx, y, dx, dy));
+    }
+
+    PaintTransparentRectangles(hdc, win->canvasRc, rects, gGlobalPrefs->fixedPageUI.selectionColor, 0xcf, 0);
+}
+
 void PaintForwardSearchMark(WindowInfo* win, HDC hdc) {
     CrashIf(!win->AsFixed());
     DisplayModel* dm = win->AsFixed();
@@ -579,6 +794,56 @@ LRESULT OnDDEInitiate(HWND hwnd, WPARAM wparam, LPARAM lparam) {
 //  eg: [ForwardSearch("c:\file.pdf","c:\folder\source.tex",298,0)]
 // Synchronization command format:
 // [ForwardSearch(["<pdffile>",]"<srcfile>",<line>,<col>[,<newwindow>,<setfocus>])]
+// editors send a forward search for every cursor movement, so forward searches
+// are executed after the DDE message has been acknowledged, and while one is
+// waiting to be executed, newer ones only replace its arguments (so that
+// a burst of them only updates the view once)
+struct PendingForwardSearch {
+    WindowInfo* win = nullptr;
+    AutoFreeWstr srcFile;
+    UINT line = 0;
+    UINT col = 0;
+    bool setFocus = false;
+};
+
+static PendingForwardSearch* gPendingForwardSearch = nullptr;
+
+static void ExecutePendingForwardSearch() {
+    PendingForwardSearch* fs = gPendingForwardSearch;
+    gPendingForwardSearch = nullptr;
+    if (!fs) {
+        return;
+    }
+    WindowInfo* win = fs->win;
+    if (WindowInfoStillValid(win) && win->AsFixed() && win->AsFixed()->pdfSync) {
+        UINT page;
+        Vec<Rect> rects;
+        int ret = win->AsFixed()->pdfSync->SourceToDoc(fs->srcFile, fs->line, fs->col, &page, rects);
+        ShowForwardSearchResult(win, fs->srcFile, fs->line, fs->col, ret, page, rects);
+        if (fs->setFocus) {
+            win->Focus();
+        }
+    }
+    delete fs;
+}
+
+static void QueueForwardSearch(WindowInfo* win, const WCHAR* srcFile, UINT line, UINT col, bool setFocus) {
+    bool isQueued = gPendingForwardSearch != nullptr;
+    if (!isQueued) {
+        gPendingForwardSearch = new PendingForwardSearch();
+    }
+    PendingForwardSearch* fs = gPendingForwardSearch;
+    fs->win = win;
+    fs->srcFile.SetCopy(srcFile);
+    fs->line = line;
+    fs->col = col;
+    // a coalesced request for focus must not get lost
+    fs->setFocus |= setFocus;
+    if (!isQueued) {
+        uitask::Post(ExecutePendingForwardSearch);
+    }
+}
+
 static const WCHAR* HandleSyncCmd(const WCHAR* cmd, DDEACK& ack) {
     AutoFreeWstr pdfFile, srcFile;
     BOOL line = 0, col = 0, newWindow = 0, setFocus = 0;
@@ -630,14 +895,7 @@ static const WCHAR* HandleSyncCmd(const WCHAR* cmd, DDEACK& ack) {
     }
 
     ack.fAck = 1;
-    UINT page;
-    Vec<Rect> rects;
-    int ret = dm->pdfSync->SourceToDoc(srcFile, line, col, &page, rects);
-    ShowForwardSearchResult(win, srcFile, line, col, ret, page, rects);
-    if (setFocus) {
-        win->Focus();
-    }
-
+    QueueForwardSearch(win, srcFile, line, col, setFocus != 0);
     return next;
 }
 
@@ -820,6 +1078,55 @@ static const WCHAR* HandleSetViewCmd(const WCHAR* cmd, DDEACK& ack) {
     return next;
 }
 
+// DDE command: find all occurrences of a text, of several terms or of a regular expression
+// and show them in the search results list (see FindAllHits for the format of the text)
+// Format:
+// [FindAll("<pdffilepath>","<text>")]
+//  eg:
+// [FindAll("c:\file.pdf","X-1234|X-5678")]
+static const WCHAR* HandleFindAllCmd(const WCHAR* cmd, DDEACK& ack) {
+    AutoFreeWstr pdfFile, text;
+    const WCHAR* next = str::Parse(cmd, L"[FindAll(\"%S\",%? \"%S\")]", &pdfFile, &text);
+    if (!next) {
+        return nullptr;
+    }
+
+    WindowInfo* win = FindWindowInfoByFile(pdfFile, true);
+    if (!win) {
+        return next;
+    }
+    if (!win->IsDocLoaded()) {
+        ReloadDocument(win);
+        if (!win->IsDocLoaded()) {
+            return next;
+        }
+    }
+    if (!win->AsFixed() || !NeedsFindUI(win) || str::IsEmpty(text.Get())) {
+        return next;
+    }
+
+    win::SetText(win->hwndFindBox, text);
+    OnMenuFindAll(win);
+    ack.fAck = 1;
+    win->Focus();
+    return next;
+}
+
+// writes a memory usage report (see MemStats.h) to a file
+// Format:
+// [MemStats("<reportfilepath>")]
+static const WCHAR* HandleMemStatsCmd(const WCHAR* cmd, DDEACK& ack) {
+    AutoFreeWstr reportFile;
+    const WCHAR* next = str::Parse(cmd, L"[MemStats(\"%S\")]", &reportFile);
+    if (!next) {
+        return nullptr;
+    }
+    if (SaveMemStats(reportFile)) {
+        ack.fAck = 1;
+    }
+    return next;
+}
+
 static void HandleDdeCmds(HWND hwnd, const WCHAR* cmd, DDEACK& ack) {
     if (str::IsEmpty(cmd)) {
         return;
@@ -836,6 +1143,8 @@ static void HandleDdeCmds(HWND hwnd, const WCHAR* cmd, DDEACK& ack) {
             nextCmd = HandleSyncCmd(cmd, ack);
         }
         if (!nextCmd) {
+            // other commands must see the result of a preceding forward search
+            ExecutePendingForwardSearch();
             nextCmd = HandleOpenCmd(cmd, ack);
         }
         if (!nextCmd) {
@@ -847,6 +1156,12 @@ static void HandleDdeCmds(HWND hwnd, const WCHAR* cmd, DDEACK& ack) {
         if (!nextCmd) {
             nextCmd = HandleSetViewCmd(cmd, ack);
         }
+        if (!nextCmd) {
+            nextCmd = HandleFindAllCmd(cmd, ack);
+        }
+        if (!nextCmd) {
+            nextCmd = HandleMemStatsCmd(cmd, ack);
+        }
         if (!nextCmd) {
             AutoFreeWstr tmp;
             nextCmd = str::Parse(cmd, L"%S]", &tmp);
@@ -893,9 +1208,124 @@ LRESULT OnDDETerminate(HWND hwnd, WPARAM wparam, LPARAM lparam) {
     return 0;
 }
 
+// returns a bitmap whose pixels live in a file mapping that can be shared
+// (the bitmaps rendered by the engines usually already are, others are copied)
+static RenderedBitmap* EnsureSharedBitmap(RenderedBitmap* bmp) {
+    DIBSECTION info{};
+    if (bmp->hMap && GetObject(bmp->hbmp, sizeof(info), &info) == sizeof(info)) {
+        return bmp;
+    }
+    Size size = bmp->Size();
+    HANDLE hMap = nullptr;
+    HBITMAP hbmp = CreateMemoryBitmap(size, &hMap);
+    if (!hbmp) {
+        CloseHandle(hMap);
+        delete bmp;
+        return nullptr;
+    }
+    HDC hdcSrc = CreateCompatibleDC(nullptr);
+    HDC hdcDst = CreateCompatibleDC(nullptr);
+    HGDIOBJ oldSrc = SelectObject(hdcSrc, bmp->hbmp);
+    HGDIOBJ oldDst = SelectObject(hdcDst, hbmp);
+    BitBlt(hdcDst, 0, 0, size.dx, size.dy, hdcSrc, 0, 0, SRCCOPY);
+    SelectObject(hdcSrc, oldSrc);
+    SelectObject(hdcDst, oldDst);
+    DeleteDC(hdcSrc);
+    DeleteDC(hdcDst);
+    delete bmp;
+    return new RenderedBitmap(hbmp, size, hMap);
+}
+
+// renders a page of a loaded document and hands the pixels to another process
+// without copying them: the section backing the rendered bitmap is duplicated
+// into the requesting process, which is identified by its window
+// Format (sent with COPYDATA_RENDER_PAGE_REQUEST and the requesting window as wparam):
+// [RenderPage("<pdffilepath>",<page>,<zoom>[,<rotation>])]
+//  eg:
+// [RenderPage("c:\file.pdf",3,150)]
+// zoom is in percent (100 = the page's actual size at 72 dpi)
+// On success, a RenderedPageReply is sent back to the requesting window using
+// WM_COPYDATA with COPYDATA_RENDER_PAGE_REPLY before this message returns
+static bool HandleRenderPageRequest(HWND hwnd, HWND hwndClient, const WCHAR* cmd) {
+    AutoFreeWstr pdfFile;
+    int pageNo = 0;
+    float zoom = 0;
+    int rotation = 0;
+    const WCHAR* next = str::Parse(cmd, L"[RenderPage(\"%S\",%d,%f)]", &pdfFile, &pageNo, &zoom);
+    if (!next) {
+        next = str::Parse(cmd, L"[RenderPage(\"%S\",%d,%f,%d)]", &pdfFile, &pageNo, &zoom, &rotation);
+    }
+    if (!next || !IsWindow(hwndClient) || zoom <= 0 || zoom > ZOOM_MAX) {
+        return false;
+    }
+
+    WindowInfo* win = FindWindowInfoByFile(pdfFile, true);
+    if (!win || !win->IsDocLoaded() || !win->AsFixed()) {
+        return false;
+    }
+    EngineBase* engine = win->AsFixed()->GetEngine();
+    if (pageNo < 1 || pageNo > engine->PageCount()) {
+        return false;
+    }
+
+    DWORD clientPid = 0;
+    GetWindowThreadProcessId(hwndClient, &clientPid);
+    AutoCloseHandle hProcess(OpenProcess(PROCESS_DUP_HANDLE, FALSE, clientPid));
+    if (!hProcess.IsValid()) {
+        return false;
+    }
+
+    RenderPageArgs args(pageNo, zoom / 100.f, rotation);
+    RenderedBitmap* bmp = engine->RenderPage(args);
+    if (!bmp) {
+        return false;
+    }
+    bmp = EnsureSharedBitmap(bmp);
+    if (!bmp) {
+        return false;
+    }
+
+    DIBSECTION info{};
+    GetObject(bmp->hbmp, sizeof(info), &info);
+    HANDLE hMapClient = nullptr;
+    BOOL ok = DuplicateHandle(GetCurrentProcess(), bmp->hMap, hProcess, &hMapClient, FILE_MAP_READ, FALSE, 0);
+    // the section outlives our bitmap for as long as the client keeps its handle open
+    // (but it must not be handed to the bitmap pool, as the client reads from it)
+    DeleteObject(bmp->hbmp);
+    bmp->hbmp = nullptr;
+    delete bmp;
+    if (!ok) {
+        return false;
+    }
+
+    RenderedPageReply reply{};
+    reply.hMap = (u64)(uintptr_t)hMapClient;
+    reply.offset = info.dsOffset;
+    reply.dx = info.dsBm.bmWidth;
+    reply.dy = std::abs(info.dsBm.bmHeight);
+    reply.stride = info.dsBm.bmWidthBytes;
+    reply.bitsPerPixel = info.dsBm.bmBitsPixel;
+    reply.topDown = info.dsBmih.biHeight < 0;
+
+    COPYDATASTRUCT cds = {COPYDATA_RENDER_PAGE_REPLY, sizeof(reply), &reply};
+    LRESULT res = SendMessage(hwndClient, WM_COPYDATA, (WPARAM)hwnd, (LPARAM)&cds);
+    if (!res) {
+        // the client didn't take the handle, so close it on its behalf
+        DuplicateHandle(hProcess, hMapClient, nullptr, nullptr, 0, FALSE, DUPLICATE_CLOSE_SOURCE);
+        return false;
+    }
+    return true;
+}
+
 LRESULT OnCopyData(HWND hwnd, WPARAM wparam, LPARAM lparam) {
-    UNUSED(hwnd);
     COPYDATASTRUCT* cds = (COPYDATASTRUCT*)lparam;
+    if (cds && cds->dwData == COPYDATA_RENDER_PAGE_REQUEST && wparam) {
+        const WCHAR* cmd = (const WCHAR*)cds->lpData;
+        if (cds->cbData < sizeof(WCHAR) || cmd[cds->cbData / sizeof(WCHAR) - 1]) {
+            return FALSE;
+        }
+        return HandleRenderPageRequest(hwnd, (HWND)wparam, cmd) ? TRUE : FALSE;
+    }
     if (!cds || cds->dwData != 0x44646557 /* DdeW */ || wparam) {
         return FALSE;
     }
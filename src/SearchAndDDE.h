@@ -9,11 +9,33 @@ LRESULT OnDDExecute(HWND hwnd, WPARAM wparam, LPARAM lparam);
 LRESULT OnDDETerminate(HWND hwnd, WPARAM wparam, LPARAM lparam);
 LRESULT OnCopyData(HWND hwnd, WPARAM wparam, LPARAM lparam);
 
+// WM_COPYDATA ids for sharing rendered pages with other processes (see HandleRenderPageRequest)
+#define COPYDATA_RENDER_PAGE_REQUEST 0x526E6451 /* RndQ */
+#define COPYDATA_RENDER_PAGE_REPLY 0x526E6452 /* RndR */
+
+// sent back to the requesting window; hMap is a read-only handle to a file
+// mapping which is valid in the requesting process (which has to close it)
+struct RenderedPageReply {
+    u64 hMap;
+    // offset of the first pixel row in the mapping
+    u32 offset;
+    int dx;
+    int dy;
+    // bytes per row (rows are padded to a multiple of 4 bytes)
+    int stride;
+    int bitsPerPixel;
+    // if false, the rows are stored bottom-up
+    BOOL topDown;
+};
+
 #define HIDE_FWDSRCHMARK_TIMER_ID 4
 #define HIDE_FWDSRCHMARK_DELAY_IN_MS 400
 #define HIDE_FWDSRCHMARK_DECAYINTERVAL_IN_MS 100
 #define HIDE_FWDSRCHMARK_STEPS 5
 
+#define FIND_AS_YOU_TYPE_TIMER_ID 9
+#define FIND_AS_YOU_TYPE_DELAY_IN_MS 150
+
 bool NeedsFindUI(WindowInfo* win);
 void ClearSearchResult(WindowInfo* win);
 bool OnInverseSearch(WindowInfo* win, int x, int y);
@@ -23,10 +45,15 @@ void PaintForwardSearchMark(WindowInfo* win, HDC hdc);
 void OnMenuFindPrev(WindowInfo* win);
 void OnMenuFindNext(WindowInfo* win);
 void OnMenuFind(WindowInfo* win);
+void OnMenuFindAll(WindowInfo* win);
 void OnMenuFindMatchCase(WindowInfo* win);
 void OnMenuFindSel(WindowInfo* win, TextSearchDirection direction);
 void AbortFinding(WindowInfo* win, bool hideMessage);
 void FindTextOnThread(WindowInfo* win, TextSearchDirection direction, bool showProgress);
+void FindTextAsYouType(WindowInfo* win);
+void OnFindAsYouTypeTimer(WindowInfo* win);
+void ShowSearchHit(WindowInfo* win, const TextSearchHit& hit);
+void PaintSearchHitMarks(WindowInfo* win, HDC hdc);
 
 extern bool gIsStartup;
 extern WStrVec gDdeOpenOnStartup;
@@ -0,0 +1,201 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#include "utils/BaseUtil.h"
+#include "utils/ScopedWin.h"
+#include "utils/WinUtil.h"
+#include "utils/Dpi.h"
+
+#include "wingui/WinGui.h"
+#include "wingui/TreeModel.h"
+#include "wingui/Layout.h"
+#include "wingui/Window.h"
+#include "wingui/ListBoxCtrl.h"
+
+#include "Annotation.h"
+#include "EngineBase.h"
+#include "SettingsStructs.h"
+#include "Controller.h"
+#include "DisplayModel.h"
+#include "ProgressUpdateUI.h"
+#include "TextSelection.h"
+#include "TextSearch.h"
+#include "Notifications.h"
+#include "SumatraPDF.h"
+#include "WindowInfo.h"
+#include "TabInfo.h"
+#include "SearchAndDDE.h"
+#include "Translations.h"
+#include "SearchResults.h"
+
+using std::placeholders::_1;
+
+// number of characters shown before and after a hit
+#define HIT_CONTEXT_CHARS 30
+
+struct SearchResultsWindow {
+    TabInfo* tab = nullptr;
+    Window* mainWindow = nullptr;
+    LayoutBase* mainLayout = nullptr;
+
+    ListBoxCtrl* listBox = nullptr;
+    ListBoxModel* lbModel = nullptr;
+
+    ~SearchResultsWindow();
+};
+
+SearchResultsWindow::~SearchResultsWindow() {
+    delete mainWindow;
+    delete mainLayout;
+    delete lbModel;
+}
+
+void DeleteSearchResultsWindow(SearchResultsWindow* w) {
+    delete w;
+}
+
+void CloseSearchResults(TabInfo* tab) {
+    DeleteSearchResultsWindow(tab->searchResultsWindow);
+    tab->searchResultsWindow = nullptr;
+    if (!tab->searchHits) {
+        return;
+    }
+    delete tab->searchHits;
+    tab->searchHits = nullptr;
+    // remove the marks next to the scrollbar
+    if (tab->win->currentTab == tab) {
+        tab->win->RepaintAsync();
+    }
+}
+
+static void WndCloseHandler(SearchResultsWindow* w, WindowCloseEvent* ev) {
+    UNUSED(ev);
+    CloseSearchResults(w->tab);
+}
+
+static void WndSizeHandler(SearchResultsWindow* w, SizeEvent* ev) {
+    int dx = ev->dx;
+    int dy = ev->dy;
+    if (dx == 0 || dy == 0) {
+        return;
+    }
+    ev->didHandle = true;
+    InvalidateRect(ev->hwnd, nullptr, false);
+    LayoutToSize(w->mainLayout, {dx, dy});
+}
+
+static void ListBoxSelectionChanged(SearchResultsWindow* w, ListBoxSelectionChangedEvent* ev) {
+    TabInfo* tab = w->tab;
+    int itemNo = ev->idx;
+    if (!tab->searchHits || itemNo < 0 || itemNo >= tab->searchHits->isize()) {
+        return;
+    }
+    // the hits can only be shown while their document is visible
+    if (tab->win->currentTab != tab || !tab->AsFixed()) {
+        return;
+    }
+    ShowSearchHit(tab->win, tab->searchHits->at(itemNo));
+}
+
+// "page <label>: <text around the hit>"
+static void AppendHitDescription(str::Str& s, DisplayModel* dm, const TextSearchHit& hit) {
+    AutoFreeWstr label(dm->GetPageLabel(hit.startPage));
+    AutoFree labelU(strconv::WstrToUtf8(label));
+    s.AppendFmt("page %s: ", labelU.Get());
+
+    int len = 0;
+    PageTextPin pin(dm->textCache, hit.startPage);
+    const WCHAR* text = dm->textCache->GetTextForPage(hit.startPage, &len);
+    if (!text) {
+        return;
+    }
+    int start = std::max(hit.startGlyph - HIT_CONTEXT_CHARS, 0);
+    int end = hit.endPage == hit.startPage ? hit.endGlyph : len;
+    end = limitValue(end + HIT_CONTEXT_CHARS, start, len);
+    AutoFreeWstr context(str::DupN(text + start, end - start));
+    str::NormalizeWS(context);
+    AutoFree contextU(strconv::WstrToUtf8(context));
+    s.Append(contextU.Get());
+}
+
+static void RebuildSearchResults(SearchResultsWindow* w) {
+    auto model = new ListBoxModelStrings();
+    DisplayModel* dm = w->tab->AsFixed();
+    str::Str s;
+    if (dm && w->tab->searchHits) {
+        for (auto& hit : *w->tab->searchHits) {
+            s.Reset();
+            AppendHitDescription(s, dm, hit);
+            model->strings.Append(s.AsView());
+        }
+    }
+
+    w->listBox->SetModel(model);
+    delete w->lbModel;
+    w->lbModel = model;
+}
+
+static void CreateMainLayout(SearchResultsWindow* sw) {
+    HWND parent = sw->mainWindow->hwnd;
+    auto vbox = new VBox();
+    vbox->alignMain = MainAxisAlign::MainStart;
+    vbox->alignCross = CrossAxisAlign::Stretch;
+
+    {
+        auto w = new ListBoxCtrl(parent);
+        w->idealSizeLines = 20;
+        bool ok = w->Create();
+        CrashIf(!ok);
+        sw->listBox = w;
+        w->onSelectionChanged = std::bind(ListBoxSelectionChanged, sw, _1);
+        vbox->AddChild(w, 1);
+    }
+
+    auto padding = new Padding(vbox, DpiScaledInsets(parent, 4, 8));
+    sw->mainLayout = padding;
+}
+
+void ShowSearchResults(TabInfo* tab) {
+    if (tab->searchResultsWindow) {
+        SearchResultsWindow* w = tab->searchResultsWindow;
+        RebuildSearchResults(w);
+        BringWindowToTop(w->mainWindow->hwnd);
+        return;
+    }
+
+    auto win = new SearchResultsWindow();
+    win->tab = tab;
+    tab->searchResultsWindow = win;
+
+    auto w = new Window();
+    HMODULE h = GetModuleHandleW(nullptr);
+    LPCWSTR iconName = MAKEINTRESOURCEW(GetAppIconID());
+    w->hIcon = LoadIconW(h, iconName);
+
+    w->isDialog = true;
+    w->backgroundColor = MkRgb((u8)0xee, (u8)0xee, (u8)0xee);
+    AutoFree title(strconv::WstrToUtf8(_TR("Search results")));
+    w->SetTitle(title.as_view());
+    bool ok = w->Create();
+    CrashIf(!ok);
+
+    win->mainWindow = w;
+
+    w->onClose = std::bind(WndCloseHandler, win, _1);
+    w->onSize = std::bind(WndSizeHandler, win, _1);
+    CreateMainLayout(win);
+    RebuildSearchResults(win);
+
+    // make the list as tall as the document
+    int minDy = 720;
+    auto rc = ClientRect(tab->win->hwndCanvas);
+    if (rc.Dy() > 0) {
+        minDy = rc.Dy();
+    }
+    LayoutAndSizeToContent(win->mainLayout, 480, minDy, w->hwnd);
+    HwndPositionToTheRightOf(w->hwnd, tab->win->hwndFrame);
+
+    // important to call this after hooking up onSize to ensure
+    // first layout is triggered
+    w->SetIsVisible(true);
+}
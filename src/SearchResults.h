@@ -0,0 +1,10 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+struct SearchResultsWindow;
+
+// shows tab->searchHits in a list (creating the window if needed)
+void ShowSearchResults(TabInfo* tab);
+// closes the list and forgets tab->searchHits
+void CloseSearchResults(TabInfo* tab);
+void DeleteSearchResultsWindow(SearchResultsWindow*);
@@ -6,6 +6,7 @@
 #include <UIAutomationCoreApi.h>
 #include "utils/ScopedWin.h"
 #include "utils/Dpi.h"
+#include "utils/UITask.h"
 #include "utils/WinUtil.h"
 
 #include "wingui/TreeModel.h"
@@ -18,6 +19,7 @@
 #include "GlobalPrefs.h"
 #include "ChmModel.h"
 #include "DisplayModel.h"
+#include "RenderCache.h"
 #include "TextSelection.h"
 #include "ProgressUpdateUI.h"
 #include "Notifications.h"
@@ -242,6 +244,329 @@ void ZoomToSelection(WindowInfo* win, float factor, bool scrollToFit, bool relat
     UpdateToolbarState(win);
 }
 
+// zooms in/out by one step (towards ZOOM_MAX resp. ZOOM_MIN), showing the
+// intermediate zoom levels by scaling the already rendered tiles
+void ZoomToSelectionAnimated(WindowInfo* win, float towards) {
+    DisplayModel* dm = win->AsFixed();
+    if (!dm || gRenderCache.isRemoteSession) {
+        ZoomToSelection(win, win->ctrl->GetNextZoomStep(towards), false);
+        return;
+    }
+    if (win->zoomAnimFrame > 0) {
+        // continue from where the running animation would have ended
+        dm->DeferRendering(ZOOM_ANIMATION_FRAMES * ZOOM_ANIMATION_FRAME_IN_MS * 2);
+        ZoomToSelection(win, win->zoomAnimTo, false);
+    }
+    win->zoomAnimFrom = dm->GetZoomVirtual(true);
+    win->zoomAnimTo = win->ctrl->GetNextZoomStep(towards);
+    if (win->zoomAnimFrom == win->zoomAnimTo) {
+        return;
+    }
+    win->zoomAnimFrame = 1;
+    SetTimer(win->hwndCanvas, ZOOM_ANIMATION_TIMER_ID, ZOOM_ANIMATION_FRAME_IN_MS, nullptr);
+    OnZoomAnimationTimer(win);
+}
+
+void OnZoomAnimationTimer(WindowInfo* win) {
+    DisplayModel* dm = win->AsFixed();
+    if (!dm || win->zoomAnimFrame <= 0) {
+        KillTimer(win->hwndCanvas, ZOOM_ANIMATION_TIMER_ID);
+        win->zoomAnimFrame = 0;
+        return;
+    }
+
+    if (win->zoomAnimFrame >= ZOOM_ANIMATION_FRAMES) {
+        KillTimer(win->hwndCanvas, ZOOM_ANIMATION_TIMER_ID);
+        win->zoomAnimFrame = 0;
+        ZoomToSelection(win, win->zoomAnimTo, false);
+        dm->StopDeferringRendering();
+        return;
+    }
+
+    // ease out, so that the zoom level reacts immediately
+    float t = (float)win->zoomAnimFrame / ZOOM_ANIMATION_FRAMES;
+    t = 1 - (1 - t) * (1 - t);
+    float zoom = win->zoomAnimFrom + (win->zoomAnimTo - win->zoomAnimFrom) * t;
+    win->zoomAnimFrame++;
+    // the deferral expires on its own if the animation is aborted (e.g. by switching tabs)
+    dm->DeferRendering(ZOOM_ANIMATION_FRAMES * ZOOM_ANIMATION_FRAME_IN_MS * 2);
+    ZoomToSelection(win, zoom, false);
+}
+
+// copying the text of more pages than this is done on a thread
+// (showing the progress and allowing to cancel)
+#define COPY_TEXT_ON_THREAD_MIN_PAGES 32
+
+static NotificationGroupId NG_COPY_TEXT_PROGRESS = "copyTextProgress";
+
+// collects text right in memory that can be handed to the clipboard
+// (instead of in a string which would have to be copied once more)
+class ClipboardTextWriter {
+    HGLOBAL handle = nullptr;
+    // in WCHARs, not counting the terminating zero
+    size_t len = 0;
+    size_t cap = 0;
+
+  public:
+    ~ClipboardTextWriter() {
+        if (handle) {
+            GlobalFree(handle);
+        }
+    }
+
+    bool Append(const WCHAR* s, size_t n) {
+        if (len + n + 1 > cap) {
+            size_t newCap = std::max(std::max(cap * 2, len + n + 1), (size_t)64 * 1024);
+            HGLOBAL h = nullptr;
+            if (handle) {
+                h = GlobalReAlloc(handle, newCap * sizeof(WCHAR), GMEM_MOVEABLE);
+            } else {
+                h = GlobalAlloc(GMEM_MOVEABLE, newCap * sizeof(WCHAR));
+            }
+            if (!h) {
+                return false;
+            }
+            handle = h;
+            cap = newCap;
+        }
+        WCHAR* dst = (WCHAR*)GlobalLock(handle);
+        if (!dst) {
+            return false;
+        }
+        memcpy(dst + len, s, n * sizeof(WCHAR));
+        len += n;
+        dst[len] = '\0';
+        GlobalUnlock(handle);
+        return true;
+    }
+
+    size_t size() const {
+        return len;
+    }
+
+    // the caller takes ownership (e.g. by passing it to SetClipboardData)
+    HGLOBAL StealHandle() {
+        HGLOBAL h = handle;
+        if (h && cap > len + 1) {
+            // don't keep the unused space allocated for as long as the text is in the clipboard
+            HGLOBAL trimmed = GlobalReAlloc(h, (len + 1) * sizeof(WCHAR), GMEM_MOVEABLE);
+            if (trimmed) {
+                h = trimmed;
+            }
+        }
+        handle = nullptr;
+        len = cap = 0;
+        return h;
+    }
+};
+
+static void UpdateCopyTextStatusTask(WindowInfo* win, NotificationWnd* wnd, int current, int total) {
+    if (!WindowInfoStillValid(win) || win->copyTextCanceled) {
+        return;
+    }
+    if (win->notifications->Contains(wnd)) {
+        wnd->UpdateProgress(current, total);
+    } else {
+        // copying has been canceled by closing the notification
+        win->copyTextCanceled = true;
+    }
+}
+
+// extracts the text of a selection spanning many pages (cf. CopySelectionToClipboard)
+struct CopyTextThreadData : public ProgressUpdateUI {
+    WindowInfo* win = nullptr;
+    DisplayModel* dm = nullptr;
+    // for text selections
+    bool isTextSelection = false;
+    int fromPage = 0;
+    int fromGlyph = 0;
+    int toPage = 0;
+    int toGlyph = 0;
+    // for rectangular selections
+    Vec<SelectionOnPage> selections;
+
+    ClipboardTextWriter text;
+    bool canceled = false;
+
+    // owned by win->notifications
+    NotificationWnd* wnd = nullptr;
+    HANDLE thread = nullptr;
+    // the latest progress, shown by a coalesced UpdateCopyTextStatusTask
+    LONG progressCurrent = 0;
+    LONG progressTotal = 0;
+    LONG progressPending = 0;
+
+    ~CopyTextThreadData() {
+        CloseHandle(thread);
+    }
+
+    void ShowUI() {
+        auto notificationsInCb = win->notifications;
+        wnd = new NotificationWnd(win->hwndCanvas, 0);
+        wnd->wndRemovedCb = [notificationsInCb](NotificationWnd* wnd) { notificationsInCb->RemoveNotification(wnd); };
+        wnd->Create(L"", _TR("Copying text of page %d of %d..."));
+        win->notifications->Add(wnd, NG_COPY_TEXT_PROGRESS);
+    }
+
+    void UpdateProgress(int current, int total) override {
+        InterlockedExchange(&progressCurrent, current);
+        InterlockedExchange(&progressTotal, total);
+        // CopyTextEndTask (which deletes this) is always posted after this task
+        uitask::PostCoalesced(
+            &progressPending, [this] { UpdateCopyTextStatusTask(win, wnd, progressCurrent, progressTotal); });
+    }
+
+    bool WasCanceled() override {
+        return !WindowInfoStillValid(win) || win->copyTextCanceled;
+    }
+
+    // returns false if canceled or out of memory
+    bool ExtractText() {
+        if (isTextSelection) {
+            // same as TextSelection::ExtractText, one page at a time
+            TextSelection sel(dm->GetEngine(), dm->textCache);
+            for (int pageNo = fromPage; pageNo <= toPage; pageNo++) {
+                if (WasCanceled()) {
+                    return false;
+                }
+                UpdateProgress(pageNo - fromPage + 1, toPage - fromPage + 1);
+                int textLen;
+                dm->textCache->GetTextForPage(pageNo, &textLen);
+                int glyph = pageNo == fromPage ? fromGlyph : 0;
+                int end = pageNo == toPage ? toGlyph : textLen;
+                if (end <= glyph) {
+                    continue;
+                }
+                sel.StartAt(pageNo, glyph);
+                sel.SelectUpTo(pageNo, end);
+                AutoFreeWstr pageText(sel.ExtractText(L"\r\n"));
+                if (!AppendPageText(pageText, L"\r\n")) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        for (int i = 0; i < selections.isize(); i++) {
+            if (WasCanceled()) {
+                return false;
+            }
+            UpdateProgress(i + 1, selections.isize());
+            SelectionOnPage& sel = selections.at(i);
+            AutoFreeWstr pageText(dm->GetTextInRegion(sel.pageNo, sel.rect));
+            if (!AppendPageText(pageText, nullptr)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool AppendPageText(const WCHAR* pageText, const WCHAR* sep) {
+        if (str::IsEmpty(pageText)) {
+            return true;
+        }
+        if (sep && text.size() > 0 && !text.Append(sep, str::Len(sep))) {
+            return false;
+        }
+        return text.Append(pageText, str::Len(pageText));
+    }
+};
+
+/* also copy a screenshot of the current selection to the clipboard */
+static void CopySelectionImageToClipboard(WindowInfo* win) {
+    DisplayModel* dm = win->AsFixed();
+    SelectionOnPage* selOnPage = &win->currentTab->selectionOnPage->at(0);
+    float zoom = dm->GetZoomReal(selOnPage->pageNo);
+    int rotation = dm->GetRotation();
+    RenderPageArgs args(selOnPage->pageNo, zoom, rotation, &selOnPage->rect, RenderTarget::Export);
+    RenderedBitmap* bmp = dm->GetEngine()->RenderPage(args);
+    if (bmp) {
+        CopyImageToClipboard(bmp->GetBitmap(), true);
+    }
+    delete bmp;
+}
+
+static void CopyTextEndTask(CopyTextThreadData* ctd) {
+    WindowInfo* win = ctd->win;
+    if (!WindowInfoStillValid(win) || win->copyTextThread != ctd->thread) {
+        // cf. FindEndTask
+        delete ctd;
+        return;
+    }
+    win->copyTextThread = nullptr;
+    win->notifications->RemoveForGroup(NG_COPY_TEXT_PROGRESS);
+
+    bool isSameSelection = win->AsFixed() == ctd->dm && win->currentTab->selectionOnPage &&
+                           win->currentTab->selectionOnPage->size() > 0;
+    if (!ctd->canceled && ctd->text.size() > 0 && OpenClipboard(nullptr)) {
+        EmptyClipboard();
+        HGLOBAL handle = ctd->text.StealHandle();
+        if (!SetClipboardData(CF_UNICODETEXT, handle)) {
+            GlobalFree(handle);
+        }
+        if (!ctd->isTextSelection && isSameSelection) {
+            CopySelectionImageToClipboard(win);
+        }
+        CloseClipboard();
+    }
+    delete ctd;
+}
+
+static DWORD WINAPI CopyTextThread(LPVOID data) {
+    CopyTextThreadData* ctd = (CopyTextThreadData*)data;
+    WindowInfo* win = ctd->win;
+    ctd->canceled = !ctd->ExtractText();
+
+    // wait for CopySelectionToClipboard to return (cf. FindThread)
+    while (!win->copyTextThread) {
+        Sleep(1);
+    }
+    uitask::Post([=] { CopyTextEndTask(ctd); });
+    return 0;
+}
+
+// returns false if the selection is small enough for copying it right away
+static bool CopySelectionTextOnThread(WindowInfo* win) {
+    DisplayModel* dm = win->AsFixed();
+    CopyTextThreadData* ctd = new CopyTextThreadData();
+    ctd->win = win;
+    ctd->dm = dm;
+    ctd->isTextSelection = dm->textSelection->result.len > 0;
+    int nPages = 0;
+    if (ctd->isTextSelection) {
+        dm->textSelection->GetGlyphRange(&ctd->fromPage, &ctd->fromGlyph, &ctd->toPage, &ctd->toGlyph);
+        nPages = ctd->toPage - ctd->fromPage + 1;
+    } else {
+        for (SelectionOnPage& sel : *win->currentTab->selectionOnPage) {
+            ctd->selections.Append(sel);
+        }
+        nPages = ctd->selections.isize();
+    }
+    if (nPages < COPY_TEXT_ON_THREAD_MIN_PAGES) {
+        delete ctd;
+        return false;
+    }
+
+    AbortCopying(win);
+    ctd->ShowUI();
+    win->copyTextThread = CreateThread(nullptr, 0, CopyTextThread, ctd, 0, 0);
+    ctd->thread = win->copyTextThread; // safe because only accesssed on ui thread
+    if (!win->copyTextThread) {
+        win->notifications->RemoveForGroup(NG_COPY_TEXT_PROGRESS);
+        delete ctd;
+        return false;
+    }
+    return true;
+}
+
+void AbortCopying(WindowInfo* win) {
+    if (win->copyTextThread) {
+        win->copyTextCanceled = true;
+        WaitForSingleObject(win->copyTextThread, INFINITE);
+        win->notifications->RemoveForGroup(NG_COPY_TEXT_PROGRESS);
+    }
+    win->copyTextCanceled = false;
+}
+
 void CopySelectionToClipboard(WindowInfo* win) {
     if (!win->currentTab || !win->currentTab->selectionOnPage)
         return;
@@ -252,11 +577,22 @@ void CopySelectionToClipboard(WindowInfo* win) {
     if (!win->AsFixed())
         return;
 
+    DisplayModel* dm = win->AsFixed();
+#ifndef DISABLE_DOCUMENT_RESTRICTIONS
+    bool mayCopyText = dm->GetEngine()->AllowsCopyingText();
+#else
+    bool mayCopyText = true;
+#endif
+    // don't block the UI while extracting e.g. the text of all pages
+    if (mayCopyText && !dm->GetEngine()->IsImageCollection() && CopySelectionTextOnThread(win)) {
+        return;
+    }
+
     if (!OpenClipboard(nullptr))
         return;
     EmptyClipboard();
 
-    DisplayModel* dm = win->AsFixed();
+
 #ifndef DISABLE_DOCUMENT_RESTRICTIONS
     if (!dm->GetEngine()->AllowsCopyingText())
         win->ShowNotification(_TR("Copying text was denied (copying as image only)"));
@@ -290,16 +626,7 @@ void CopySelectionToClipboard(WindowInfo* win) {
         }
     }
 
-    /* also copy a screenshot of the current selection to the clipboard */
-    SelectionOnPage* selOnPage = &win->currentTab->selectionOnPage->at(0);
-    float zoom = dm->GetZoomReal(selOnPage->pageNo);
-    int rotation = dm->GetRotation();
-    RenderPageArgs args(selOnPage->pageNo, zoom, rotation, &selOnPage->rect, RenderTarget::Export);
-    RenderedBitmap* bmp = dm->GetEngine()->RenderPage(args);
-    if (bmp) {
-        CopyImageToClipboard(bmp->GetBitmap(), true);
-    }
-    delete bmp;
+    CopySelectionImageToClipboard(win);
 
     CloseClipboard();
 }
@@ -366,11 +693,11 @@ void OnSelectionEdgeAutoscroll(WindowInfo* win, int x, int y) {
     if (dx != 0 || dy != 0) {
         CrashIf(!win->AsFixed());
         DisplayModel* dm = win->AsFixed();
-        Point oldOffset = dm->GetViewPort().TL();
+        CanvasRect oldViewPort = dm->GetViewPort();
         win->MoveDocBy(dx, dy);
 
-        dx = dm->GetViewPort().x - oldOffset.x;
-        dy = dm->GetViewPort().y - oldOffset.y;
+        dx = dm->GetViewPort().x - oldViewPort.x;
+        dy = (int)(dm->GetViewPort().y - oldViewPort.y);
         win->selectionRect.x -= dx;
         win->selectionRect.y -= dy;
         win->selectionRect.dx += dx;
@@ -5,6 +5,10 @@
 #define SMOOTHSCROLL_DELAY_IN_MS 20
 #define SMOOTHSCROLL_SLOW_DOWN_FACTOR 10
 
+#define ZOOM_ANIMATION_TIMER_ID 6
+#define ZOOM_ANIMATION_FRAME_IN_MS 16
+#define ZOOM_ANIMATION_FRAMES 8
+
 /* Represents selected area on given page */
 struct SelectionOnPage {
     explicit SelectionOnPage(int pageNo = 0, RectD* rect = nullptr);
@@ -25,7 +29,10 @@ void PaintTransparentRectangles(HDC hdc, Rect screenRc, Vec<Rect>& rects, COLORR
 void PaintSelection(WindowInfo* win, HDC hdc);
 void UpdateTextSelection(WindowInfo* win, bool select = true);
 void ZoomToSelection(WindowInfo* win, float factor, bool scrollToFit = true, bool relative = false);
+void ZoomToSelectionAnimated(WindowInfo* win, float towards);
+void OnZoomAnimationTimer(WindowInfo* win);
 void CopySelectionToClipboard(WindowInfo* win);
+void AbortCopying(WindowInfo* win);
 void OnSelectAll(WindowInfo* win, bool textOnly = false);
 bool NeedsSelectionEdgeAutoscroll(WindowInfo* win, int x, int y);
 void OnSelectionEdgeAutoscroll(WindowInfo* win, int x, int y);
@@ -115,6 +115,10 @@ struct ExternalViewer {
 struct PrinterDefaults {
     // default value for scaling (shrink, fit, none)
     char* printScale;
+    // if true, PDF and XPS documents are sent to the printer as vector
+    // graphics instead of bitmaps (pages with transparency are still
+    // printed as bitmaps)
+    bool printAsVector;
 };
 
 // customization options for how we show forward search results (used
@@ -319,6 +323,45 @@ struct GlobalPrefs {
     // actual resolution of the main screen in DPI (if this value isn't
     // positive, the system's UI setting is used)
     int customScreenDPI;
+    // number of threads used for rendering pages in the background (if
+    // this value isn't positive, it's derived from the number of CPU
+    // cores)
+    int renderThreads;
+    // maximum memory (in MB) used for caching rendered pages (if this
+    // value isn't positive, it's derived from the size of the screens and
+    // the amount of installed memory)
+    int renderCacheSizeMB;
+    // maximum disk space (in MB) used for keeping the pages that were
+    // visible when a document was closed, so that they can be shown
+    // immediately when it's reopened (0 disables this)
+    int tileCacheSizeMB;
+    // if true, the text of longer documents is indexed in the background
+    // so that searching them is faster
+    bool indexTextInBackground;
+    // maximum memory (in MB) used for caching the text of a document's
+    // pages (text that has been dropped from the cache is extracted again
+    // when needed; 0 means no limit)
+    int textCacheSizeMB;
+    // if true, documents are rendered with a memory allocator that keeps
+    // freed memory in per-thread caches, so that rendering on several
+    // threads doesn't wait for the shared heap
+    bool scalableAllocator;
+    // maximum memory (in MB) used for caching the decoded images and
+    // loaded fonts of PDF and XPS documents, which is shared by all open
+    // documents (if this value isn't positive, 256 MB are used)
+    int imageCacheSizeMB;
+    // when the process uses more GDI objects than this, rendered pages
+    // that aren't visible and the caches of background tabs are freed
+    // right away (Windows allows 10000 per process; 0 disables this)
+    int gdiObjectsLimit;
+    // if true, the pages of PDF and XPS documents are rendered in a
+    // separate process, so that a document which crashes or hangs the
+    // renderer doesn't take down the whole application
+    bool renderInSeparateProcess;
+    // if true, the rendered pages are composited on the GPU with Direct2D,
+    // which makes scrolling and zooming smoother on high resolution
+    // displays (not used in remote sessions)
+    bool gpuCompositing;
     // if true, we store display settings for each document separately
     // (i.e. everything after UseDefaultState in FileStates)
     bool rememberStatePerDocument;
@@ -381,6 +424,15 @@ struct GlobalPrefs {
     Vec<WCHAR*>* reopenOnce;
     // timestamp of the last update check
     FILETIME timeOfLastUpdateCheck;
+    // ETag of the update information received by the last update check
+    char* updateCheckETag;
+    // Last-Modified date of the update information received by the last
+    // update check
+    char* updateCheckLastModified;
+    // latest version offered according to the last update check
+    char* updateCheckLatest;
+    // stable version according to the last update check
+    char* updateCheckStable;
     // week count since 2011-01-01 needed to "age" openCount values in file
     // history
     int openCountWeek;
@@ -468,8 +520,10 @@ static const StructInfo gExternalViewerInfo = {sizeof(ExternalViewer), 3, gExter
 
 static const FieldInfo gPrinterDefaultsFields[] = {
     {offsetof(PrinterDefaults, printScale), Type_Utf8String, (intptr_t) "shrink"},
+    {offsetof(PrinterDefaults, printAsVector), Type_Bool, false},
 };
-static const StructInfo gPrinterDefaultsInfo = {sizeof(PrinterDefaults), 1, gPrinterDefaultsFields, "PrintScale"};
+static const StructInfo gPrinterDefaultsInfo = {sizeof(PrinterDefaults), 2, gPrinterDefaultsFields,
+                                                "PrintScale\0PrintAsVector"};
 
 static const FieldInfo gForwardSearchFields[] = {
     {offsetof(ForwardSearch, highlightOffset), Type_Int, 0},
@@ -614,6 +668,16 @@ static const FieldInfo gGlobalPrefsFields[] = {
     {offsetof(GlobalPrefs, annotationDefaults), Type_Prerelease, (intptr_t)&gAnnotationDefaultsInfo},
     {offsetof(GlobalPrefs, defaultPasswords), Type_StringArray, 0},
     {offsetof(GlobalPrefs, customScreenDPI), Type_Int, 0},
+    {offsetof(GlobalPrefs, renderThreads), Type_Int, 0},
+    {offsetof(GlobalPrefs, renderCacheSizeMB), Type_Int, 0},
+    {offsetof(GlobalPrefs, tileCacheSizeMB), Type_Int, 200},
+    {offsetof(GlobalPrefs, indexTextInBackground), Type_Bool, true},
+    {offsetof(GlobalPrefs, textCacheSizeMB), Type_Int, 64},
+    {offsetof(GlobalPrefs, scalableAllocator), Type_Bool, true},
+    {offsetof(GlobalPrefs, imageCacheSizeMB), Type_Int, 256},
+    {offsetof(GlobalPrefs, gdiObjectsLimit), Type_Int, 8000},
+    {offsetof(GlobalPrefs, renderInSeparateProcess), Type_Bool, false},
+    {offsetof(GlobalPrefs, gpuCompositing), Type_Bool, false},
     {(size_t)-1, Type_Comment, 0},
     {offsetof(GlobalPrefs, rememberStatePerDocument), Type_Bool, true},
     {offsetof(GlobalPrefs, uiLanguage), Type_Utf8String, 0},
@@ -640,18 +704,24 @@ static const FieldInfo gGlobalPrefsFields[] = {
     {offsetof(GlobalPrefs, sessionData), Type_Array, (intptr_t)&gSessionDataInfo},
     {offsetof(GlobalPrefs, reopenOnce), Type_StringArray, 0},
     {offsetof(GlobalPrefs, timeOfLastUpdateCheck), Type_Compact, (intptr_t)&gFILETIMEInfo},
+    {offsetof(GlobalPrefs, updateCheckETag), Type_Utf8String, 0},
+    {offsetof(GlobalPrefs, updateCheckLastModified), Type_Utf8String, 0},
+    {offsetof(GlobalPrefs, updateCheckLatest), Type_Utf8String, 0},
+    {offsetof(GlobalPrefs, updateCheckStable), Type_Utf8String, 0},
     {offsetof(GlobalPrefs, openCountWeek), Type_Int, 0},
     {(size_t)-1, Type_Comment, 0},
     {(size_t)-1, Type_Comment, (intptr_t) "Settings after this line have not been recognized by the current version"},
 };
 static const StructInfo gGlobalPrefsInfo = {
-    sizeof(GlobalPrefs), 54, gGlobalPrefsFields,
+    sizeof(GlobalPrefs), 68, gGlobalPrefsFields,
     "\0\0MainWindowBackground\0EscToExit\0ReuseInstance\0UseSysColors\0RestoreSession\0TabWidth\0\0FixedPageUI\0EbookUI"
     "\0ComicBookUI\0ChmUI\0ExternalViewers\0ShowMenubar\0ReloadModifiedDocuments\0FullPathInTitle\0ZoomLevels\0ZoomIncr"
-    "ement\0\0PrinterDefaults\0ForwardSearch\0AnnotationDefaults\0DefaultPasswords\0CustomScreenDPI\0\0RememberStatePer"
-    "Document\0UiLanguage\0ShowToolbar\0ShowFavorites\0AssociatedExtensions\0AssociateSilently\0CheckForUpdates\0Versio"
-    "nToSkip\0RememberOpenedFiles\0InverseSearchCmdLine\0EnableTeXEnhancements\0DefaultDisplayMode\0DefaultZoom\0Window"
-    "State\0WindowPos\0ShowToc\0SidebarDx\0TocDy\0ShowStartPage\0UseTabs\0\0FileStates\0SessionData\0ReopenOnce\0TimeOf"
-    "LastUpdateCheck\0OpenCountWeek\0\0"};
+    "ement\0\0PrinterDefaults\0ForwardSearch\0AnnotationDefaults\0DefaultPasswords\0CustomScreenDPI\0RenderThreads\0Ren"
+    "derCacheSizeMB\0TileCacheSizeMB\0IndexTextInBackground\0TextCacheSizeMB\0ScalableAllocator\0ImageCacheSizeMB\0GdiO"
+    "bjectsLimit\0RenderInSeparateProcess\0GpuCompositing\0\0RememberStatePerDocument\0UiLanguage\0ShowToolbar\0ShowFav"
+    "orites\0AssociatedExtensions\0AssociateSilently\0CheckForUpdates\0VersionToSkip\0RememberOpenedFiles\0InverseSearc"
+    "hCmdLine\0EnableTeXEnhancements\0DefaultDisplayMode\0DefaultZoom\0WindowState\0WindowPos\0ShowToc\0SidebarDx\0TocD"
+    "y\0ShowStartPage\0UseTabs\0\0FileStates\0SessionData\0ReopenOnce\0TimeOfLastUpdateCheck\0UpdateCheckETag\0UpdateCh"
+    "eckLastModified\0UpdateCheckLatest\0UpdateCheckStable\0OpenCountWeek\0\0"};
 
 #endif
@@ -1,7 +1,12 @@
 /* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
    License: GPLv3 */
 
+extern "C" {
+#include <mupdf/fitz.h>
+}
+
 #include "utils/BaseUtil.h"
+#include <psapi.h>
 #include "utils/ScopedWin.h"
 #include "utils/DirIter.h"
 #include "utils/FileUtil.h"
@@ -18,6 +23,7 @@
 #include "Annotation.h"
 #include "EngineBase.h"
 #include "EngineManager.h"
+#include "EnginePdf.h"
 #include "EbookBase.h"
 #include "HtmlFormatter.h"
 #include "EbookFormatter.h"
@@ -60,28 +66,198 @@ static bool IsInRange(Vec<PageRange>& ranges, int pageNo) {
     return false;
 }
 
-static void BenchLoadRender(EngineBase* engine, int pagenum) {
+enum class BenchFormat {
+    Log,
+    Json,
+    Csv,
+};
+
+// parameters of -bench (set from -bench-* flags)
+struct BenchParams {
+    // Json and Csv are written to stdout (the log still goes to stderr)
+    BenchFormat format = BenchFormat::Log;
+    // how often rendering and text extraction are timed per page
+    int repeat = 1;
+    // how often a page is rendered before it's timed
+    int warmup = 0;
+    float zoom = 1.f;
+    // if > 0, overrides zoom (converted with the engine's file DPI)
+    float dpi = 0;
+    int rotation = 0;
+};
+
+static BenchParams gBench;
+// whether a file has already been written to stdout (for separators)
+static bool gBenchWroteFile = false;
+
+struct BenchStats {
+    double min = 0;
+    double median = 0;
+    double p95 = 0;
+};
+
+static int cmpDouble(const void* a, const void* b) {
+    double d1 = *(const double*)a;
+    double d2 = *(const double*)b;
+    return d1 < d2 ? -1 : d1 > d2 ? 1 : 0;
+}
+
+static BenchStats CalcBenchStats(Vec<double>& samples) {
+    BenchStats res;
+    size_t n = samples.size();
+    if (n == 0) {
+        return res;
+    }
+    samples.Sort(cmpDouble);
+    res.min = samples.at(0);
+    res.median = (n % 2 == 1) ? samples.at(n / 2) : (samples.at(n / 2 - 1) + samples.at(n / 2)) / 2;
+    size_t p95Idx = (n * 95 + 99) / 100 - 1;
+    res.p95 = samples.at(p95Idx);
+    return res;
+}
+
+struct BenchPageResult {
+    int pageNo = 0;
+    bool ok = false;
+    double loadMs = 0;
+    BenchStats render;
+    BenchStats text;
+    // the process' peak working set after the page has been benchmarked
+    // (it never decreases, so it shows which pages increase it)
+    size_t peakMemKb = 0;
+};
+
+static size_t GetPeakMemKb() {
+    PROCESS_MEMORY_COUNTERS pmc{};
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) {
+        return 0;
+    }
+    return pmc.PeakWorkingSetSize / 1024;
+}
+
+static void AppendJsonStr(str::Str& s, const char* v) {
+    s.AppendChar('"');
+    for (const char* c = v; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            s.AppendChar('\\');
+            s.AppendChar(*c);
+        } else if ((u8)*c < 0x20) {
+            s.AppendFmt("\\u%04x", (u8)*c);
+        } else {
+            s.AppendChar(*c);
+        }
+    }
+    s.AppendChar('"');
+}
+
+static void AppendCsvStr(str::Str& s, const char* v) {
+    s.AppendChar('"');
+    for (const char* c = v; *c; c++) {
+        if (*c == '"') {
+            s.AppendChar('"');
+        }
+        s.AppendChar(*c);
+    }
+    s.AppendChar('"');
+}
+
+static void AppendJsonStats(str::Str& s, const char* name, BenchStats& stats) {
+    s.AppendFmt("\"%s\":{\"min\":%.3f,\"median\":%.3f,\"p95\":%.3f}", name, stats.min, stats.median, stats.p95);
+}
+
+static void WriteBenchFileResult(const WCHAR* filePath, EngineBase* engine, double loadMs,
+                                 Vec<BenchPageResult>& pages) {
+    if (gBench.format == BenchFormat::Log) {
+        return;
+    }
+    AutoFree path(strconv::WstrToUtf8(filePath));
+    const char* kind = engine ? engine->kind : "";
+    int pageCount = engine ? engine->PageCount() : 0;
+
+    str::Str s;
+    if (gBench.format == BenchFormat::Csv) {
+        for (BenchPageResult& page : pages) {
+            AppendCsvStr(s, path.Get());
+            s.AppendFmt(",%s,%.3f,%d,%d,%d,%.3f", kind, loadMs, pageCount, page.pageNo, page.ok ? 1 : 0, page.loadMs);
+            s.AppendFmt(",%.3f,%.3f,%.3f", page.render.min, page.render.median, page.render.p95);
+            s.AppendFmt(",%.3f,%.3f,%.3f", page.text.min, page.text.median, page.text.p95);
+            s.AppendFmt(",%d\n", (int)page.peakMemKb);
+        }
+        if (pages.size() == 0) {
+            AppendCsvStr(s, path.Get());
+            s.AppendFmt(",%s,%.3f,%d,,,,,,,,,,\n", kind, loadMs, pageCount);
+        }
+    } else {
+        s.Append(gBenchWroteFile ? ",\n" : "\n");
+        s.Append("{\"file\":");
+        AppendJsonStr(s, path.Get());
+        s.AppendFmt(",\"engine\":\"%s\",\"ok\":%s,\"loadMs\":%.3f,\"pageCount\":%d,\"pages\":[", kind,
+                    engine ? "true" : "false", loadMs, pageCount);
+        for (size_t i = 0; i < pages.size(); i++) {
+            BenchPageResult& page = pages.at(i);
+            s.AppendFmt("%s\n{\"page\":%d,\"ok\":%s,\"loadMs\":%.3f,", i > 0 ? "," : "", page.pageNo,
+                        page.ok ? "true" : "false", page.loadMs);
+            AppendJsonStats(s, "renderMs", page.render);
+            s.AppendChar(',');
+            AppendJsonStats(s, "textMs", page.text);
+            s.AppendFmt(",\"peakMemKb\":%d}", (int)page.peakMemKb);
+        }
+        s.Append("]}");
+    }
+    fwrite(s.Get(), 1, s.size(), stdout);
+    fflush(stdout);
+    gBenchWroteFile = true;
+}
+
+static void BenchLoadRender(EngineBase* engine, int pagenum, Vec<BenchPageResult>& results) {
+    BenchPageResult res;
+    res.pageNo = pagenum;
     auto t = TimeGet();
     bool ok = engine->BenchLoadPage(pagenum);
 
     if (!ok) {
         logf(L"Error: failed to load page %d", pagenum);
+        results.Append(res);
         return;
     }
-    double timeMs = TimeSinceInMs(t);
-    logf(L"pageload   %3d: %.2f ms", pagenum, timeMs);
-
-    t = TimeGet();
-    RenderPageArgs args(pagenum, 1.0, 0);
-    RenderedBitmap* rendered = engine->RenderPage(args);
+    // pages are only loaded once, so this is always a cold measurement
+    res.loadMs = TimeSinceInMs(t);
+    logf(L"pageload   %3d: %.2f ms", pagenum, res.loadMs);
+
+    float zoom = gBench.dpi > 0 ? gBench.dpi / engine->GetFileDPI() : gBench.zoom;
+    RenderPageArgs args(pagenum, zoom, gBench.rotation);
+    for (int i = 0; i < gBench.warmup; i++) {
+        delete engine->RenderPage(args);
+    }
 
-    if (!rendered) {
-        logf(L"Error: failed to render page %d", pagenum);
-        return;
+    Vec<double> renderTimes;
+    Vec<double> textTimes;
+    for (int i = 0; i < gBench.repeat; i++) {
+        t = TimeGet();
+        RenderedBitmap* rendered = engine->RenderPage(args);
+        if (!rendered) {
+            logf(L"Error: failed to render page %d", pagenum);
+            results.Append(res);
+            return;
+        }
+        delete rendered;
+        double timeMs = TimeSinceInMs(t);
+        renderTimes.Append(timeMs);
+        logf(L"pagerender %3d: %.2f ms", pagenum, timeMs);
+
+        if (gBench.format != BenchFormat::Log) {
+            t = TimeGet();
+            WCHAR* text = engine->ExtractPageText(pagenum);
+            free(text);
+            textTimes.Append(TimeSinceInMs(t));
+        }
     }
-    delete rendered;
-    timeMs = TimeSinceInMs(t);
-    logf(L"pagerender %3d: %.2f ms", pagenum, timeMs);
+
+    res.ok = true;
+    res.render = CalcBenchStats(renderTimes);
+    res.text = CalcBenchStats(textTimes);
+    res.peakMemKb = GetPeakMemKb();
+    results.Append(res);
 }
 
 static int FormatWholeDoc(Doc& doc) {
@@ -138,12 +314,14 @@ void BenchEbookLayout(const WCHAR* filePath) {
     int nPages = TimeOneMethod(doc, TextRenderMethodGdi, L"gdi       ");
     TimeOneMethod(doc, TextRenderMethodGdiplus, L"gdi+      ");
     TimeOneMethod(doc, TextRenderMethodGdiplusQuick, L"gdi+ quick");
+    TimeOneMethod(doc, TextRenderMethodDWrite, L"dwrite    ");
 
     // do it twice because the first run is very unfair to the first version that runs
     // (probably because of font caching)
     TimeOneMethod(doc, TextRenderMethodGdi, L"gdi       ");
     TimeOneMethod(doc, TextRenderMethodGdiplus, L"gdi+      ");
     TimeOneMethod(doc, TextRenderMethodGdiplusQuick, L"gdi+ quick");
+    TimeOneMethod(doc, TextRenderMethodDWrite, L"dwrite    ");
 
     doc.Delete();
 
@@ -193,8 +371,10 @@ static void BenchFile(const WCHAR* filePath, const WCHAR* pagesSpec) {
 
     auto t = TimeGet();
     EngineBase* engine = EngineManager::CreateEngine(filePath);
+    Vec<BenchPageResult> results;
     if (!engine) {
         logf(L"Error: failed to load %s", filePath);
+        WriteBenchFileResult(filePath, nullptr, 0, results);
         return;
     }
 
@@ -205,7 +385,7 @@ static void BenchFile(const WCHAR* filePath, const WCHAR* pagesSpec) {
 
     if (nullptr == pagesSpec) {
         for (int i = 1; i <= pages; i++) {
-            BenchLoadRender(engine, i);
+            BenchLoadRender(engine, i, results);
         }
     }
 
@@ -215,11 +395,12 @@ static void BenchFile(const WCHAR* filePath, const WCHAR* pagesSpec) {
         for (size_t i = 0; i < ranges.size(); i++) {
             for (int j = ranges.at(i).start; j <= ranges.at(i).end; j++) {
                 if (1 <= j && j <= pages)
-                    BenchLoadRender(engine, j);
+                    BenchLoadRender(engine, j, results);
             }
         }
     }
 
+    WriteBenchFileResult(filePath, engine, timeMs, results);
     delete engine;
 
     logf(L"Finished (in %.2f ms): %s", TimeSinceInMs(total), filePath);
@@ -250,9 +431,35 @@ static void BenchDir(WCHAR* dir) {
     }
 }
 
-void BenchFileOrDir(WStrVec& pathsToBench) {
+static void SetBenchParams(Flags* flags) {
+    gBench.format = BenchFormat::Log;
+    if (str::EqI(flags->benchFormat, L"json")) {
+        gBench.format = BenchFormat::Json;
+    } else if (str::EqI(flags->benchFormat, L"csv")) {
+        gBench.format = BenchFormat::Csv;
+    }
+    gBench.repeat = std::max(flags->benchRepeat, 1);
+    gBench.warmup = std::max(flags->benchWarmup, 0);
+    gBench.zoom = flags->benchZoom / 100.f;
+    gBench.dpi = flags->benchDpi;
+    gBench.rotation = NormalizeRotation(flags->benchRotation);
+}
+
+void BenchFileOrDir(Flags* flags) {
     logToStderr = true;
+    SetBenchParams(flags);
+
+    if (gBench.format == BenchFormat::Json) {
+        fprintf(stdout, "{\"zoom\":%.3f,\"dpi\":%.1f,\"rotation\":%d,\"repeat\":%d,\"warmup\":%d,\"files\":[",
+                gBench.zoom, gBench.dpi, gBench.rotation, gBench.repeat, gBench.warmup);
+    } else if (gBench.format == BenchFormat::Csv) {
+        fprintf(stdout,
+                "file,engine,fileLoadMs,pageCount,page,ok,loadMs,renderMinMs,renderMedianMs,renderP95Ms,"
+                "textMinMs,textMedianMs,textP95Ms,peakMemKb\n");
+    }
+    gBenchWroteFile = false;
 
+    WStrVec& pathsToBench = flags->pathsToBenchmark;
     size_t n = pathsToBench.size() / 2;
     for (size_t i = 0; i < n; i++) {
         WCHAR* path = pathsToBench.at(2 * i);
@@ -263,6 +470,488 @@ void BenchFileOrDir(WStrVec& pathsToBench) {
         else
             logf(L"Error: file or dir %s doesn't exist", path);
     }
+
+    if (gBench.format == BenchFormat::Json) {
+        fprintf(stdout, "\n]}\n");
+    }
+    fflush(stdout);
+}
+
+struct BenchParallelThread {
+    EngineBase* engine = nullptr;
+    float zoom = 1.f;
+    int pageCount = 0;
+    // shared by all threads
+    volatile LONG* nextPage = nullptr;
+    int nRendered = 0;
+    HANDLE thread = nullptr;
+};
+
+static DWORD WINAPI BenchParallelThreadProc(LPVOID data) {
+    BenchParallelThread* bt = (BenchParallelThread*)data;
+    for (;;) {
+        int pageNo = (int)InterlockedIncrement(bt->nextPage);
+        if (pageNo > bt->pageCount) {
+            break;
+        }
+        RenderPageArgs args(pageNo, bt->zoom, gBench.rotation);
+        RenderedBitmap* rendered = bt->engine->RenderPage(args);
+        if (rendered) {
+            bt->nRendered++;
+        }
+        delete rendered;
+    }
+    return 0;
+}
+
+struct BenchParallelRun {
+    int nThreads = 0;
+    int nRendered = 0;
+    double timeMs = 0;
+    double lockWaitMs = 0;
+};
+
+// renders all pages once with nThreads threads, each of which uses
+// its own clone of the engine (loading the clones isn't timed)
+static bool BenchParallelRunOnce(EngineBase* engine, int nThreads, BenchParallelRun& run) {
+    Vec<BenchParallelThread> threads;
+    threads.AppendBlanks(nThreads);
+    for (BenchParallelThread& bt : threads) {
+        bt.engine = engine->Clone();
+        if (!bt.engine) {
+            for (BenchParallelThread& bt2 : threads) {
+                delete bt2.engine;
+            }
+            return false;
+        }
+    }
+
+    volatile LONG nextPage = 0;
+    run.nThreads = nThreads;
+    double lockWaitStart = EnginePdfLockWaitMs();
+    auto t = TimeGet();
+    for (BenchParallelThread& bt : threads) {
+        bt.zoom = gBench.dpi > 0 ? gBench.dpi / engine->GetFileDPI() : gBench.zoom;
+        bt.pageCount = engine->PageCount();
+        bt.nextPage = &nextPage;
+        bt.thread = CreateThread(nullptr, 0, BenchParallelThreadProc, &bt, 0, nullptr);
+    }
+    for (BenchParallelThread& bt : threads) {
+        if (bt.thread) {
+            WaitForSingleObject(bt.thread, INFINITE);
+            CloseHandle(bt.thread);
+        }
+    }
+    run.timeMs = TimeSinceInMs(t);
+    run.lockWaitMs = EnginePdfLockWaitMs() - lockWaitStart;
+
+    for (BenchParallelThread& bt : threads) {
+        run.nRendered += bt.nRendered;
+        delete bt.engine;
+    }
+    return true;
+}
+
+static void WriteBenchParallelResult(const WCHAR* filePath, EngineBase* engine, Vec<BenchParallelRun>& runs) {
+    if (gBench.format == BenchFormat::Log) {
+        return;
+    }
+    AutoFree path(strconv::WstrToUtf8(filePath));
+    str::Str s;
+    if (gBench.format == BenchFormat::Csv) {
+        s.Append("file,engine,pageCount,threads,rendered,ms,pagesPerSec,lockWaitMs\n");
+        for (BenchParallelRun& run : runs) {
+            AppendCsvStr(s, path.Get());
+            s.AppendFmt(",%s,%d,%d,%d,%.3f,%.3f,%.3f\n", engine->kind, engine->PageCount(), run.nThreads,
+                        run.nRendered, run.timeMs, run.nRendered * 1000 / run.timeMs, run.lockWaitMs);
+        }
+    } else {
+        s.Append("{\"file\":");
+        AppendJsonStr(s, path.Get());
+        s.AppendFmt(",\"engine\":\"%s\",\"pageCount\":%d,\"zoom\":%.3f,\"dpi\":%.1f,\"rotation\":%d,\"runs\":[",
+                    engine->kind, engine->PageCount(), gBench.zoom, gBench.dpi, gBench.rotation);
+        for (size_t i = 0; i < runs.size(); i++) {
+            BenchParallelRun& run = runs.at(i);
+            s.AppendFmt("%s\n{\"threads\":%d,\"rendered\":%d,\"ms\":%.3f,\"pagesPerSec\":%.3f,\"lockWaitMs\":%.3f}",
+                        i > 0 ? "," : "", run.nThreads, run.nRendered, run.timeMs, run.nRendered * 1000 / run.timeMs,
+                        run.lockWaitMs);
+        }
+        s.Append("\n]}\n");
+    }
+    fwrite(s.Get(), 1, s.size(), stdout);
+    fflush(stdout);
+}
+
+// measures how rendering throughput scales with the number of threads
+// by rendering all pages with 1, 2, 4, ... up to nThreads threads
+void BenchParallel(Flags* flags) {
+    logToStderr = true;
+    SetBenchParams(flags);
+
+    const WCHAR* filePath = flags->benchParallelPath;
+    int maxThreads = flags->benchParallelThreads;
+    if (maxThreads <= 0) {
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+        maxThreads = (int)si.dwNumberOfProcessors;
+    }
+    // each thread loads its own copy of the document
+    maxThreads = std::min(maxThreads, MAXIMUM_WAIT_OBJECTS);
+
+    EngineBase* engine = EngineManager::CreateEngine(filePath);
+    if (!engine) {
+        logf(L"Error: failed to load %s", filePath);
+        return;
+    }
+    logf(L"Starting: %s (%d pages)", filePath, engine->PageCount());
+
+    Vec<BenchParallelRun> runs;
+    for (int nThreads = 1;; nThreads = std::min(nThreads * 2, maxThreads)) {
+        BenchParallelRun run;
+        if (!BenchParallelRunOnce(engine, nThreads, run)) {
+            logf(L"Error: failed to clone the engine");
+            break;
+        }
+        logf(L"threads %2d: %d pages in %.2f ms, %.2f pages/s, %.2f ms waiting for locks", run.nThreads,
+             run.nRendered, run.timeMs, run.nRendered * 1000 / run.timeMs, run.lockWaitMs);
+        runs.Append(run);
+        if (nThreads == maxThreads) {
+            break;
+        }
+    }
+
+    WriteBenchParallelResult(filePath, engine, runs);
+    delete engine;
+}
+
+// expands %s to the file's name (without extension), %d (or e.g. %03d)
+// to the page number and %% to %. returns nullptr for invalid patterns
+static WCHAR* FormatRenderPagesPath(const WCHAR* pattern, const WCHAR* filePath, int pageNo) {
+    AutoFreeWstr baseName(str::Dup(path::GetBaseNameNoFree(filePath)));
+    WCHAR* ext = (WCHAR*)path::GetExtNoFree(baseName);
+    if (ext) {
+        *ext = 0;
+    }
+    str::WStr s;
+    for (const WCHAR* c = pattern; *c; c++) {
+        if (*c != '%') {
+            s.AppendChar(*c);
+            continue;
+        }
+        c++;
+        if (*c == '%') {
+            s.AppendChar('%');
+        } else if (*c == 's') {
+            s.Append(baseName);
+        } else {
+            int width = 0;
+            for (; str::IsDigit(*c); c++) {
+                width = width * 10 + (*c - '0');
+            }
+            if (*c != 'd' || width > 10) {
+                return nullptr;
+            }
+            s.AppendFmt(L"%0*d", width, pageNo);
+        }
+    }
+    return s.StealData();
+}
+
+static bool HasPageNumberPlaceholder(const WCHAR* pattern) {
+    AutoFreeWstr p1(FormatRenderPagesPath(pattern, L"", 1));
+    AutoFreeWstr p2(FormatRenderPagesPath(pattern, L"", 2));
+    return p1 && p2 && !str::Eq(p1, p2);
+}
+
+enum class RenderPagesFormat { Png, Pnm, Pam };
+
+struct RenderPagesThread {
+    EngineBase* engine = nullptr;
+    const WCHAR* pattern = nullptr;
+    RenderPagesFormat format = RenderPagesFormat::Png;
+    float zoom = 1.f;
+    Vec<int>* pages = nullptr;
+    // shared by all threads
+    volatile LONG* nextPage = nullptr;
+    int nRendered = 0;
+    int nFailed = 0;
+    double renderMs = 0;
+    double writeMs = 0;
+    HANDLE thread = nullptr;
+};
+
+// copies the pixels straight from the bitmap's DIB section (if possible)
+// into an RGB pixmap, so that they can be written by mupdf without GDI+
+static fz_pixmap* RenderedBitmapToPixmap(fz_context* ctx, RenderedBitmap* bmp) {
+    HBITMAP hbmp = bmp->GetBitmap();
+    int w = bmp->Size().dx;
+    int h = bmp->Size().dy;
+
+    ScopedMem<u8> copy;
+    u8* bits = nullptr;
+    ptrdiff_t stride = 0;
+    DIBSECTION info{};
+    if (GetObject(hbmp, sizeof(info), &info) == sizeof(info) && info.dsBm.bmBits &&
+        info.dsBmih.biBitCount == 32) {
+        bits = (u8*)info.dsBm.bmBits;
+        stride = info.dsBm.bmWidthBytes;
+        if (info.dsBmih.biHeight > 0) {
+            // bottom-up DIB
+            bits += (h - 1) * stride;
+            stride = -stride;
+        }
+    } else {
+        // e.g. bitonal or palettized bitmaps
+        copy.Set((u8*)malloc((size_t)w * h * 4));
+        if (!copy) {
+            return nullptr;
+        }
+        BITMAPINFO bmi{};
+        bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
+        bmi.bmiHeader.biWidth = w;
+        bmi.bmiHeader.biHeight = -h;
+        bmi.bmiHeader.biPlanes = 1;
+        bmi.bmiHeader.biBitCount = 32;
+        bmi.bmiHeader.biCompression = BI_RGB;
+        HDC hdc = GetDC(nullptr);
+        int res = GetDIBits(hdc, hbmp, 0, h, copy.Get(), &bmi, DIB_RGB_COLORS);
+        ReleaseDC(nullptr, hdc);
+        if (res != h) {
+            return nullptr;
+        }
+        bits = copy.Get();
+        stride = (ptrdiff_t)w * 4;
+    }
+
+    fz_pixmap* pix = fz_new_pixmap(ctx, fz_device_rgb(ctx), w, h, nullptr, 0);
+    for (int y = 0; y < h; y++) {
+        u8* src = bits + y * stride;
+        u8* dst = pix->samples + (size_t)y * pix->stride;
+        for (int x = 0; x < w; x++) {
+            dst[0] = src[2];
+            dst[1] = src[1];
+            dst[2] = src[0];
+            src += 4;
+            dst += 3;
+        }
+    }
+    return pix;
+}
+
+static bool SavePagePixmap(fz_context* ctx, fz_pixmap* pix, const char* path, RenderPagesFormat format) {
+    bool ok = true;
+    fz_try(ctx) {
+        switch (format) {
+            case RenderPagesFormat::Png:
+                fz_save_pixmap_as_png(ctx, pix, path);
+                break;
+            case RenderPagesFormat::Pnm:
+                fz_save_pixmap_as_pnm(ctx, pix, path);
+                break;
+            case RenderPagesFormat::Pam:
+                fz_save_pixmap_as_pam(ctx, pix, path);
+                break;
+        }
+    }
+    fz_catch(ctx) {
+        ok = false;
+    }
+    return ok;
+}
+
+static DWORD WINAPI RenderPagesThreadProc(LPVOID data) {
+    RenderPagesThread* rt = (RenderPagesThread*)data;
+    fz_context* ctx = fz_new_context(nullptr, nullptr, FZ_STORE_UNLIMITED);
+    for (;;) {
+        int idx = (int)InterlockedIncrement(rt->nextPage) - 1;
+        if (!ctx || idx >= rt->pages->isize()) {
+            break;
+        }
+        int pageNo = rt->pages->at(idx);
+        auto t = TimeGet();
+        RenderPageArgs args(pageNo, rt->zoom, 0, nullptr, RenderTarget::Export);
+        RenderedBitmap* rendered = rt->engine->RenderPage(args);
+        rt->renderMs += TimeSinceInMs(t);
+        if (!rendered) {
+            logf(L"Error: failed to render page %d", pageNo);
+            rt->nFailed++;
+            continue;
+        }
+
+        t = TimeGet();
+        AutoFreeWstr path(FormatRenderPagesPath(rt->pattern, rt->engine->FileName(), pageNo));
+        AutoFree pathUtf8(strconv::WstrToUtf8(path));
+        fz_pixmap* pix = nullptr;
+        fz_try(ctx) {
+            pix = RenderedBitmapToPixmap(ctx, rendered);
+        }
+        fz_catch(ctx) {
+            pix = nullptr;
+        }
+        delete rendered;
+        bool ok = pix && SavePagePixmap(ctx, pix, pathUtf8, rt->format);
+        fz_drop_pixmap(ctx, pix);
+        rt->writeMs += TimeSinceInMs(t);
+        if (ok) {
+            rt->nRendered++;
+        } else {
+            logf(L"Error: failed to write %s", path.Get());
+            rt->nFailed++;
+        }
+    }
+    fz_drop_context(ctx);
+    return 0;
+}
+
+// renders the pages of a single file with nThreads threads (each
+// additional thread uses its own clone of the engine)
+static bool RenderPagesOfFile(const WCHAR* filePath, Flags* flags, RenderPagesFormat format, int nThreads) {
+    auto total = TimeGet();
+    AutoFree pathUtf8(strconv::WstrToUtf8(filePath));
+
+    auto t = TimeGet();
+    EngineBase* engine = EngineManager::CreateEngine(filePath);
+    double loadMs = TimeSinceInMs(t);
+    if (!engine) {
+        logf(L"Error: failed to load %s", filePath);
+        str::Str s;
+        AppendCsvStr(s, pathUtf8.Get());
+        s.AppendFmt(",,0,0,0,%.3f,,,
+", loadMs);
+        fwrite(s.Get(), 1, s.size(), stdout);
+        return false;
+    }
+
+    Vec<int> pages;
+    Vec<PageRange> ranges;
+    if (!flags->renderPagesRanges || !ParsePageRanges(flags->renderPagesRanges, ranges)) {
+        ranges.Reset();
+        ranges.Append(PageRange());
+    }
+    for (PageRange& range : ranges) {
+        int end = std::min(range.end, engine->PageCount());
+        for (int pageNo = std::max(range.start, 1); pageNo <= end; pageNo++) {
+            pages.Append(pageNo);
+        }
+    }
+
+    nThreads = limitValue(nThreads, 1, std::max(pages.isize(), 1));
+    Vec<RenderPagesThread> threads;
+    threads.AppendBlanks(nThreads);
+    volatile LONG nextPage = 0;
+    float dpi = flags->renderPagesDpi > 0 ? flags->renderPagesDpi : engine->GetFileDPI();
+    for (int i = 0; i < nThreads; i++) {
+        RenderPagesThread& rt = threads.at(i);
+        rt.engine = i == 0 ? engine : engine->Clone();
+        if (!rt.engine) {
+            // render with fewer threads
+            threads.RemoveAt(i, threads.size() - i);
+            nThreads = i;
+            break;
+        }
+        rt.pattern = flags->renderPagesPattern;
+        rt.format = format;
+        rt.zoom = dpi / engine->GetFileDPI();
+        rt.pages = &pages;
+        rt.nextPage = &nextPage;
+    }
+    t = TimeGet();
+    for (RenderPagesThread& rt : threads) {
+        rt.thread = CreateThread(nullptr, 0, RenderPagesThreadProc, &rt, 0, nullptr);
+    }
+    // if a thread couldn't be started, the others render its pages
+    for (RenderPagesThread& rt : threads) {
+        if (rt.thread) {
+            WaitForSingleObject(rt.thread, INFINITE);
+            CloseHandle(rt.thread);
+        }
+    }
+    if (nextPage < pages.isize()) {
+        // no thread could be started
+        RenderPagesThreadProc(&threads.at(0));
+    }
+    double renderAllMs = TimeSinceInMs(t);
+
+    int nRendered = 0, nFailed = 0;
+    double renderMs = 0, writeMs = 0;
+    for (RenderPagesThread& rt : threads) {
+        nRendered += rt.nRendered;
+        nFailed += rt.nFailed;
+        renderMs += rt.renderMs;
+        writeMs += rt.writeMs;
+        if (rt.engine != engine) {
+            delete rt.engine;
+        }
+    }
+
+    // renderMs and writeMs are summed over all threads
+    str::Str s;
+    AppendCsvStr(s, pathUtf8.Get());
+    s.AppendFmt(",%s,%d,%d,%d,%.3f,%.3f,%.3f,%.3f
+", engine->kind, engine->PageCount(), nRendered, nFailed, loadMs,
+                renderAllMs, renderMs, writeMs);
+    fwrite(s.Get(), 1, s.size(), stdout);
+    fflush(stdout);
+    delete engine;
+
+    logf(L"Finished (in %.2f ms, %d pages with %d threads): %s", TimeSinceInMs(total), nRendered, nThreads,
+         filePath);
+    return nFailed == 0;
+}
+
+// -render-pages <output pattern> [<page ranges>] renders the pages of all given
+// files (or of all supported files in given directories) to image files.
+// returns the number of files that couldn't be loaded or rendered completely
+int RenderPagesToFiles(Flags* flags) {
+    logToStderr = true;
+
+    const WCHAR* pattern = flags->renderPagesPattern;
+    RenderPagesFormat format;
+    if (str::EndsWithI(pattern, L".png")) {
+        format = RenderPagesFormat::Png;
+    } else if (str::EndsWithI(pattern, L".pnm") || str::EndsWithI(pattern, L".ppm")) {
+        format = RenderPagesFormat::Pnm;
+    } else if (str::EndsWithI(pattern, L".pam")) {
+        format = RenderPagesFormat::Pam;
+    } else {
+        logf(L"Error: unsupported output format '%s' (only .png, .pnm, .ppm and .pam are supported)", pattern);
+        return 1;
+    }
+    if (!HasPageNumberPlaceholder(pattern)) {
+        logf(L"Error: output pattern '%s' doesn't contain a page number (%%d)", pattern);
+        return 1;
+    }
+
+    WStrVec files;
+    for (const WCHAR* path : flags->fileNames) {
+        if (dir::Exists(path)) {
+            CollectFilesToBench((WCHAR*)path, files);
+        } else {
+            files.Append(str::Dup(path));
+        }
+    }
+    if (files.size() > 1 && !str::Find(pattern, L"%s")) {
+        logf(L"Error: output pattern '%s' must contain the file name (%%s) for rendering several files", pattern);
+        return 1;
+    }
+
+    int nThreads = flags->renderPagesThreads;
+    if (nThreads <= 0) {
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+        nThreads = (int)si.dwNumberOfProcessors;
+    }
+    nThreads = std::min(nThreads, MAXIMUM_WAIT_OBJECTS);
+
+    fprintf(stdout, "file,engine,pageCount,rendered,failed,loadMs,ms,renderMs,writeMs\n");
+    int nFailed = 0;
+    for (const WCHAR* path : files) {
+        if (!RenderPagesOfFile(path, flags, format, nThreads)) {
+            nFailed++;
+        }
+    }
+    fflush(stdout);
+    return nFailed;
 }
 
 static bool IsStressTestSupportedFile(const WCHAR* filePath, const WCHAR* filter) {
@@ -466,6 +1155,22 @@ static size_t GetAllMatchingFiles(const WCHAR* dir, const WCHAR* filter, WStrVec
     return files.size();
 }
 
+// appends a line "<status>\t<page count>\t<time in ms>\t<path>" to a report
+// (opened anew every time, so that it's complete even after a crash)
+static void AppendStressReport(const WCHAR* reportPath, const char* status, int pageCount, double ms,
+                               const WCHAR* filePath) {
+    if (!reportPath) {
+        return;
+    }
+    FILE* f = _wfopen(reportPath, L"ab");
+    if (!f) {
+        return;
+    }
+    AutoFree path(strconv::WstrToUtf8(filePath));
+    fprintf(f, "%s\t%d\t%d\t%s\n", status, pageCount, (int)ms, path.Get());
+    fclose(f);
+}
+
 /* The idea of StressTest is to render a lot of PDFs sequentially, simulating
 a human advancing one page at a time. This is mostly to run through a large number
 of PDFs before a release to make sure we're crash proof. */
@@ -489,7 +1194,13 @@ class StressTest {
     // owned by StressTest
     TestFileProvider* fileProvider;
 
+    // for -stress-report
+    AutoFreeWstr reportPath;
+    AutoFreeWstr currFilePath;
+    LARGE_INTEGER currFileStartTime;
+
     bool OpenFile(const WCHAR* fileName);
+    void ReportFileDone(bool success);
 
     bool GoToNextPage();
     bool GoToNextFile();
@@ -515,6 +1226,9 @@ class StressTest {
 
     void Start(const WCHAR* path, const WCHAR* filter, const WCHAR* ranges, int cycles);
     void Start(TestFileProvider* fileProvider, int cycles);
+    void SetReportPath(const WCHAR* path) {
+        reportPath.SetCopy(path);
+    }
 
     void OnTimer(int timerIdGot);
     void GetLogInfo(str::Str* s);
@@ -573,6 +1287,7 @@ bool StressTest::GoToNextFile() {
                 continue;
             if (OpenFile(nextFile))
                 return true;
+            ReportFileDone(false);
             continue;
         }
         if (--cycles <= 0)
@@ -581,10 +1296,27 @@ bool StressTest::GoToNextFile() {
     }
 }
 
+void StressTest::ReportFileDone(bool success) {
+    if (!currFilePath) {
+        return;
+    }
+    int pageCount = success && win->IsDocLoaded() ? win->ctrl->PageCount() : 0;
+    AppendStressReport(reportPath, success ? "ok" : "fail", pageCount, TimeSinceInMs(currFileStartTime),
+                       currFilePath);
+    currFilePath.Reset();
+}
+
 bool StressTest::OpenFile(const WCHAR* fileName) {
     wprintf(L"%s\n", fileName);
     fflush(stdout);
 
+    if (reportPath) {
+        // written before loading so that the file is known if we crash or hang
+        AppendStressReport(reportPath, "start", 0, 0, fileName);
+        currFilePath.SetCopy(fileName);
+        currFileStartTime = TimeGet();
+    }
+
     LoadArgs args(fileName, nullptr);
     args.forceReuse = rand() % 3 != 1;
     WindowInfo* w = LoadDocument(args);
@@ -660,6 +1392,7 @@ bool StressTest::GoToNextPage() {
     }
 
     if (currPage > win->ctrl->PageCount()) {
+        ReportFileDone(true);
         if (GoToNextFile())
             return true;
         Finished(true);
@@ -842,7 +1575,13 @@ void StartStressTest(Flags* i, WindowInfo* win) {
     freopen_s(&nul, "NUL", "w", stderr);
 
     int n = i->stressParallelCount;
-    if (n > 1 || i->stressRandomizeFiles) {
+    if (i->stressTestFiles.size() > 0) {
+        // started by RunStressTestJobs
+        StressTest* dst = new StressTest(win, i->exitWhenDone);
+        win->stressTest = dst;
+        dst->SetReportPath(i->stressReportPath);
+        dst->Start(new FilesProvider(i->stressTestFiles, 1, 0), i->stressTestCycles);
+    } else if (n > 1 || i->stressRandomizeFiles) {
         WindowInfo** windows = AllocArray<WindowInfo*>(n);
         windows[0] = win;
         for (int j = 1; j < n; j++) {
@@ -889,6 +1628,247 @@ void StartStressTest(Flags* i, WindowInfo* win) {
     }
 }
 
+// a worker process is killed if testing a single file takes longer than this
+#define STRESS_JOB_FILE_TIMEOUT_SECS (5 * 60)
+#define STRESS_JOB_POLL_INTERVAL_MS 500
+// a worker process isn't restarted anymore if it fails to start this often in a row
+#define STRESS_JOB_MAX_FAILED_LAUNCHES 3
+
+// a share of the files tested in a worker process by RunStressTestJobs
+struct StressJob {
+    WStrVec files;
+    // the number of files the worker processes have started testing
+    size_t nStarted = 0;
+    // true if the last started file doesn't have a result yet
+    bool inFile = false;
+    AutoFreeWstr listPath;
+    AutoFreeWstr reportPath;
+    HANDLE process = nullptr;
+    DWORD fileStartTime = 0;
+    int nFailedLaunches = 0;
+    // how much of the report file has been read so far
+    i64 reportOffset = 0;
+    // an incomplete last line of the report
+    str::Str partialLine;
+};
+
+struct StressJobsResult {
+    // the lines of all worker reports (without the "start" lines)
+    str::Str report;
+    int nOk = 0;
+    int nFailed = 0;
+    int nCrashed = 0;
+    int nHung = 0;
+};
+
+static bool LaunchStressJob(StressJob& job) {
+    str::Str list;
+    for (size_t k = job.nStarted; k < job.files.size(); k++) {
+        AutoFree path(strconv::WstrToUtf8(job.files.at(k)));
+        list.Append(path.Get());
+        list.Append("\r\n");
+    }
+    if (!file::WriteFile(job.listPath, list.AsView())) {
+        return false;
+    }
+    file::Delete(job.reportPath);
+    job.reportOffset = 0;
+    job.partialLine.Reset();
+    job.inFile = false;
+
+    AutoFreeWstr exePath(GetExePath());
+    AutoFreeWstr cmdLine(str::Format(L"\"%s\" -stress-list \"%s\" -stress-report \"%s\" -exit-when-done", exePath.Get(),
+                                     job.listPath.Get(), job.reportPath.Get()));
+    job.process = LaunchProcess(cmdLine);
+    job.fileStartTime = GetTickCount();
+    return job.process != nullptr;
+}
+
+static void AddStressJobResult(StressJobsResult& res, const char* status, const WCHAR* filePath) {
+    AutoFree path(strconv::WstrToUtf8(filePath));
+    res.report.AppendFmt("%s\t0\t0\t%s\n", status, path.Get());
+}
+
+static void ProcessStressReportLine(StressJob& job, StressJobsResult& res, char* line) {
+    if (str::StartsWith(line, "start\t")) {
+        job.nStarted++;
+        job.inFile = true;
+        job.fileStartTime = GetTickCount();
+        job.nFailedLaunches = 0;
+        return;
+    }
+    if (!job.inFile) {
+        return;
+    }
+    job.inFile = false;
+    if (str::StartsWith(line, "ok\t")) {
+        res.nOk++;
+    } else {
+        res.nFailed++;
+    }
+    res.report.Append(line);
+    res.report.Append("\n");
+}
+
+// reads the lines appended to the report of the worker process since the last call
+static void ReadStressJobReport(StressJob& job, StressJobsResult& res) {
+    AutoCloseHandle h(file::OpenReadOnly(job.reportPath));
+    if (!h.IsValid()) {
+        return;
+    }
+    LARGE_INTEGER off;
+    off.QuadPart = job.reportOffset;
+    if (!SetFilePointerEx(h, off, nullptr, FILE_BEGIN)) {
+        return;
+    }
+    char buf[4096];
+    DWORD nRead = 0;
+    while (ReadFile(h, buf, sizeof(buf), &nRead, nullptr) && nRead > 0) {
+        job.reportOffset += nRead;
+        job.partialLine.Append(buf, nRead);
+    }
+
+    char* s = job.partialLine.Get();
+    char* end;
+    while ((end = (char*)str::FindChar(s, '\n')) != nullptr) {
+        *end = '\0';
+        ProcessStressReportLine(job, res, s);
+        s = end + 1;
+    }
+    size_t consumed = s - job.partialLine.Get();
+    job.partialLine.RemoveAt(0, consumed);
+}
+
+// called after the worker process has exited or has been killed
+static void FinishStressJobProcess(StressJob& job, StressJobsResult& res, bool hung) {
+    ReadStressJobReport(job, res);
+    CloseHandle(job.process);
+    job.process = nullptr;
+    if (job.inFile) {
+        // the file that was being tested when the process crashed or hung
+        const WCHAR* filePath = job.files.at(job.nStarted - 1);
+        AddStressJobResult(res, hung ? "hang" : "crash", filePath);
+        if (hung) {
+            res.nHung++;
+        } else {
+            res.nCrashed++;
+        }
+        job.inFile = false;
+    } else if (job.nStarted < job.files.size()) {
+        job.nFailedLaunches++;
+    }
+}
+
+// -stress-test <dir> -stress-jobs <n> splits the files among n worker processes
+// (each with its own window), so that a large corpus is tested in parallel and
+// a crash or hang doesn't stop testing. workers append to a report per file
+// (cf. AppendStressReport), which is followed here to detect hangs and be able to
+// restart a worker with the files remaining after the one it crashed on.
+// the merged results are written to -stress-report (or stdout)
+int RunStressTestJobs(Flags* i) {
+    WStrVec filesToTest;
+    if (file::Exists(i->stressTestPath)) {
+        filesToTest.Append(str::Dup(i->stressTestPath));
+    } else {
+        wprintf(L"Scanning for files in directory %s\n", i->stressTestPath);
+        fflush(stdout);
+        GetAllMatchingFiles(i->stressTestPath, i->stressTestFilter, filesToTest, true);
+        wprintf(L"\n");
+    }
+    if (i->stressRandomizeFiles) {
+        srand((unsigned int)time(nullptr));
+        RandomizeFiles(filesToTest, 100);
+    }
+    if (0 == filesToTest.size()) {
+        wprintf(L"Didn't find any files matching filter '%s'\n", i->stressTestFilter);
+        return 1;
+    }
+    Vec<PageRange> fileRanges;
+    if (!ParsePageRanges(i->stressTestRanges, fileRanges)) {
+        fileRanges.Append(PageRange());
+    }
+
+    int nJobs = std::min(i->stressJobs, (int)filesToTest.size());
+    Vec<StressJob*> jobs;
+    for (int j = 0; j < nJobs; j++) {
+        StressJob* job = new StressJob();
+        job->listPath.Set(path::GetTempPath(L"sst"));
+        job->reportPath.Set(path::GetTempPath(L"ssr"));
+        jobs.Append(job);
+    }
+    // divide the files among the jobs (with cycles, every job tests its share repeatedly)
+    for (int cycle = 0; cycle < std::max(i->stressTestCycles, 1); cycle++) {
+        int fileIndex = 0;
+        for (size_t k = 0; k < filesToTest.size(); k++) {
+            if (IsInRange(fileRanges, (int)k + 1)) {
+                jobs.at(fileIndex++ % nJobs)->files.Append(str::Dup(filesToTest.at(k)));
+            }
+        }
+    }
+    wprintf(L"Testing %d files in %d processes\n", (int)filesToTest.size(), nJobs);
+    fflush(stdout);
+
+    SYSTEMTIME startTime;
+    GetSystemTime(&startTime);
+    StressJobsResult res;
+    for (;;) {
+        int nRunning = 0;
+        for (StressJob* job : jobs) {
+            if (!job->process && job->nStarted < job->files.size() &&
+                job->nFailedLaunches < STRESS_JOB_MAX_FAILED_LAUNCHES) {
+                if (!LaunchStressJob(*job)) {
+                    job->nFailedLaunches++;
+                    continue;
+                }
+            }
+            if (!job->process) {
+                continue;
+            }
+            nRunning++;
+            if (WaitForSingleObject(job->process, 0) == WAIT_OBJECT_0) {
+                FinishStressJobProcess(*job, res, false);
+                continue;
+            }
+            ReadStressJobReport(*job, res);
+            DWORD secsInFile = (GetTickCount() - job->fileStartTime) / 1000;
+            if (secsInFile > STRESS_JOB_FILE_TIMEOUT_SECS) {
+                TerminateProcess(job->process, 1);
+                WaitForSingleObject(job->process, 5 * 1000);
+                FinishStressJobProcess(*job, res, true);
+            }
+        }
+        if (0 == nRunning) {
+            break;
+        }
+        Sleep(STRESS_JOB_POLL_INTERVAL_MS);
+    }
+
+    int nSkipped = 0;
+    for (StressJob* job : jobs) {
+        // the files a worker process couldn't be (re)started for
+        for (size_t k = job->nStarted; k < job->files.size(); k++) {
+            AddStressJobResult(res, "skipped", job->files.at(k));
+            nSkipped++;
+        }
+        file::Delete(job->listPath);
+        file::Delete(job->reportPath);
+    }
+    DeleteVecMembers(jobs);
+
+    AutoFreeWstr tm(FormatTime(SecsSinceSystemTime(startTime)));
+    res.report.AppendFmt("# %d ok, %d failed to load, %d crashed, %d hung, %d skipped in ", res.nOk, res.nFailed,
+                         res.nCrashed, res.nHung, nSkipped);
+    AutoFree tmUtf8(strconv::WstrToUtf8(tm));
+    res.report.AppendFmt("%s\n", tmUtf8.Get());
+    if (i->stressReportPath) {
+        file::WriteFile(i->stressReportPath, res.report.AsView());
+    } else {
+        fwrite(res.report.Get(), 1, res.report.size(), stdout);
+    }
+    fflush(stdout);
+    return res.nFailed + res.nCrashed + res.nHung + nSkipped;
+}
+
 void OnStressTestTimer(WindowInfo* win, int timerId) {
     win->stressTest->OnTimer(timerId);
 }
@@ -3,14 +3,17 @@
 
 bool IsValidPageRange(const WCHAR* ranges);
 bool IsBenchPagesInfo(const WCHAR* s);
-void BenchFileOrDir(WStrVec& pathsToBench);
+class Flags;
+void BenchFileOrDir(Flags* flags);
+void BenchParallel(Flags* flags);
+int RenderPagesToFiles(Flags* flags);
 bool IsStressTesting();
 void BenchEbookLayout(WCHAR* filePath);
 
-class Flags;
 class WindowInfo;
 
 void StartStressTest(Flags* i, WindowInfo* win);
+int RunStressTestJobs(Flags* i);
 
 void OnStressTestTimer(WindowInfo* win, int timerId);
 void FinishStressTest(WindowInfo* win);
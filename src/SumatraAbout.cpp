@@ -601,6 +601,40 @@ void DrawAboutPage(WindowInfo* win, HDC hdc) {
 #define DOCLIST_MAX_THUMBNAILS_X 5
 #define DOCLIST_BOTTOM_BOX_DY DpiScale(win->hwndFrame, 50)
 
+// documents whose thumbnails are being loaded or turned out not to have one
+// (reloading the file history discards loaded thumbnails which
+// is why documents are removed once their thumbnail has been loaded)
+static WStrVec gThumbnailsRequested;
+
+static void RequestThumbnail(const WCHAR* filePath) {
+    if (gThumbnailsRequested.Find(filePath) != -1) {
+        return;
+    }
+    WCHAR* path = str::Dup(filePath);
+    gThumbnailsRequested.Append(path);
+    LoadThumbnailAsync(path, [path](RenderedBitmap* bmp) {
+        // path is owned by gThumbnailsRequested
+        if (!bmp) {
+            return;
+        }
+        DisplayState* state = gFileHistory.Find(path, nullptr);
+        int idx = gThumbnailsRequested.Find(path);
+        if (idx != -1) {
+            free(gThumbnailsRequested.PopAt(idx));
+        }
+        if (!state || state->thumbnail) {
+            delete bmp;
+            return;
+        }
+        state->thumbnail = bmp;
+        for (WindowInfo* win : gWindows) {
+            if (win->IsAboutWindow()) {
+                win->RedrawAll(true);
+            }
+        }
+    });
+}
+
 void DrawStartPage(WindowInfo* win, HDC hdc, FileHistory& fileHistory, COLORREF textColor, COLORREF backgroundColor) {
     auto col = GetAppColor(AppColor::MainWindowText);
     AutoDeletePen penBorder(CreatePen(PS_SOLID, DOCLIST_SEPARATOR_DY, col));
@@ -690,10 +724,10 @@ void DrawStartPage(WindowInfo* win, HDC hdc, FileHistory& fileHistory, COLORREF
                       offset.y + h * (THUMBNAIL_DY + DOCLIST_MARGIN_BETWEEN_Y), THUMBNAIL_DX, THUMBNAIL_DY);
             if (isRtl)
                 page.x = rc.dx - page.x - page.dx;
-            bool loadOk = true;
-            if (!state->thumbnail)
-                loadOk = LoadThumbnail(*state);
-            if (loadOk && state->thumbnail) {
+            if (!state->thumbnail && !gDeferThumbnails)
+                RequestThumbnail(state->filePath);
+            // until the thumbnail has been loaded, only its frame is drawn
+            if (state->thumbnail) {
                 Size thumbSize = state->thumbnail->Size();
                 if (thumbSize.dx != THUMBNAIL_DX || thumbSize.dy != THUMBNAIL_DY) {
                     page.dy = thumbSize.dy * THUMBNAIL_DX / thumbSize.dx;
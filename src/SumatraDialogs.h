@@ -22,6 +22,8 @@ struct Print_Advanced_Data {
     PrintRangeAdv range;
     PrintScaleAdv scale;
     PrintRotationAdv rotation;
+    // cf. PrinterDefaults::printAsVector
+    bool printAsVector = false;
 
     explicit Print_Advanced_Data(PrintRangeAdv range = PrintRangeAdv::All, PrintScaleAdv scale = PrintScaleAdv::Shrink,
                                  PrintRotationAdv rotation = PrintRotationAdv::Auto)
@@ -13,6 +13,7 @@
 #include "utils/HttpUtil.h"
 #include "utils/SquareTreeParser.h"
 #include "utils/ThreadUtil.h"
+#include "utils/Trace.h"
 #include "utils/UITask.h"
 #include "utils/WinUtil.h"
 #include "utils/LogDbg.h"
@@ -51,6 +52,7 @@
 #include "ProgressUpdateUI.h"
 #include "TextSelection.h"
 #include "TextSearch.h"
+#include "TextIndex.h"
 #include "AppColors.h"
 #include "SumatraPDF.h"
 #include "Notifications.h"
@@ -88,6 +90,8 @@
 #include "Version.h"
 #include "SumatraConfig.h"
 #include "EditAnnotations.h"
+#include "SearchResults.h"
+#include "MemStats.h"
 
 // the default is for pre-release version.
 // for release we override BuildConfig.h and set to
@@ -128,6 +132,14 @@ bool gDebugShowLinks = false;
 // so always disable
 bool gShowFrameRate = false;
 
+// if true, the canvas shows statistics about rendering and caching
+// (so that users can report numbers when the app is slow)
+bool gShowPerfHud = false;
+
+// set until the first window has been painted at startup so that
+// the Start page doesn't have to wait for loading thumbnails
+bool gDeferThumbnails = false;
+
 // in plugin mode, the window's frame isn't drawn and closing and
 // fullscreen are disabled, so that SumatraPDF can be displayed
 // embedded (e.g. in a web browser)
@@ -694,9 +706,16 @@ class ControllerCallbackHandler : public ControllerCallback {
     void Repaint() override {
         win->RepaintAsync();
     }
+    void RepaintArea(Rect area) override {
+        // invalidated areas accumulate until the next WM_PAINT
+        RECT rc = area.ToRECT();
+        InvalidateRect(win->hwndCanvas, &rc, FALSE);
+    }
     void PageNoChanged(Controller* ctrl, int pageNo) override;
-    void UpdateScrollbars(Size canvas) override;
+    void UpdateScrollbars() override;
     void RequestRendering(int pageNo) override;
+    void PrefetchRendering(int pageNo, int distance) override;
+    void CancelRendering(int pageNo) override;
     void CleanUp(DisplayModel* dm) override;
     void RenderThumbnail(DisplayModel* dm, Size size, const onBitmapRenderedCb&) override;
     void GotoLink(PageDestination* dest) override {
@@ -780,8 +799,115 @@ void ControllerCallbackHandler::RequestRendering(int pageNo) {
     }
 }
 
+void ControllerCallbackHandler::PrefetchRendering(int pageNo, int distance) {
+    DisplayModel* dm = win->AsFixed();
+    CrashIf(!dm);
+    if (dm && dm->ShouldCacheRendering(pageNo)) {
+        gRenderCache.Prefetch(dm, pageNo, distance);
+    }
+}
+
+void ControllerCallbackHandler::CancelRendering(int pageNo) {
+    DisplayModel* dm = win->AsFixed();
+    CrashIf(!dm);
+    if (dm) {
+        gRenderCache.ClearQueueForDisplayModel(dm, pageNo);
+    }
+}
+
+#define SAVED_TEXT_DIR_NAME L"sumatrapdfcache\\text"
+// the text of smaller documents is extracted quickly enough
+#define SAVED_TEXT_MIN_PAGES 50
+#define SAVED_TEXT_MAX_SIZE (256 * 1024 * 1024)
+
+// the text extracted from larger documents is saved when they're closed, so
+// that they can be searched without extracting it again when they're reopened
+// caller must free() the result
+static WCHAR* GetSavedTextPath(DisplayModel* dm) {
+    if (dm->PageCount() < SAVED_TEXT_MIN_PAGES) {
+        return nullptr;
+    }
+    unsigned char digest[16];
+    if (!CalcFileFingerprint(dm->GetEngine()->FileName(), digest)) {
+        return nullptr;
+    }
+    AutoFree fingerPrint(_MemToHex(&digest));
+    AutoFreeWstr dir(AppGenDataFilename(SAVED_TEXT_DIR_NAME));
+    if (!dir || !dir::CreateAll(dir)) {
+        return nullptr;
+    }
+    AutoFreeWstr fileName(strconv::FromAnsi(fingerPrint));
+    fileName.Set(str::Join(fileName, L".text"));
+    return path::Join(dir, fileName);
+}
+
+struct SavedTextFileInfo {
+    WCHAR* name;
+    i64 size;
+    FILETIME lastWrite;
+};
+
+static int cmpSavedTextNewestFirst(const void* a, const void* b) {
+    const SavedTextFileInfo* fa = (const SavedTextFileInfo*)a;
+    const SavedTextFileInfo* fb = (const SavedTextFileInfo*)b;
+    return CompareFileTime(&fb->lastWrite, &fa->lastWrite);
+}
+
+// keeps the text of the most recently opened documents
+static void CleanUpSavedText() {
+    AutoFreeWstr dir(AppGenDataFilename(SAVED_TEXT_DIR_NAME));
+    if (!dir) {
+        return;
+    }
+    Vec<SavedTextFileInfo> files;
+    AutoFreeWstr pattern(path::Join(dir, L"*.text"));
+    WIN32_FIND_DATA fdata;
+    HANDLE hfind = FindFirstFile(pattern, &fdata);
+    if (INVALID_HANDLE_VALUE == hfind) {
+        return;
+    }
+    do {
+        i64 size = ((i64)fdata.nFileSizeHigh << 32) | fdata.nFileSizeLow;
+        files.Append(SavedTextFileInfo{str::Dup(fdata.cFileName), size, fdata.ftLastWriteTime});
+    } while (FindNextFile(hfind, &fdata));
+    FindClose(hfind);
+
+    files.Sort(cmpSavedTextNewestFirst);
+    i64 totalSize = 0;
+    for (SavedTextFileInfo& info : files) {
+        totalSize += info.size;
+        if (totalSize > SAVED_TEXT_MAX_SIZE) {
+            // fails for files still opened by another instance
+            AutoFreeWstr path(path::Join(dir, info.name));
+            file::Delete(path);
+        }
+        free(info.name);
+    }
+}
+
+static void LoadSavedText(DisplayModel* dm) {
+    AutoFreeWstr path(GetSavedTextPath(dm));
+    if (!path) {
+        return;
+    }
+    if (file::Exists(path)) {
+        // so that CleanUpSavedText keeps the file
+        FILETIME now;
+        GetSystemTimeAsFileTime(&now);
+        file::SetModificationTime(path, now);
+    }
+    // also remembers the path for saving the text
+    dm->textCache->LoadFromFile(path);
+}
+
 void ControllerCallbackHandler::CleanUp(DisplayModel* dm) {
     gRenderCache.CancelRendering(dm);
+    if (HasPermission(Perm_DiskAccess)) {
+        gRenderCache.SaveToTileCache(dm);
+        if (dm->textCache->SaveToFile()) {
+            CleanUpSavedText();
+        }
+    }
     gRenderCache.FreeForDisplayModel(dm);
 }
 
@@ -812,9 +938,10 @@ void ControllerCallbackHandler::RequestDelayedLayout(int delay) {
     SetTimer(win->hwndCanvas, EBOOK_LAYOUT_TIMER_ID, delay, nullptr);
 }
 
-void ControllerCallbackHandler::UpdateScrollbars(Size canvas) {
+void ControllerCallbackHandler::UpdateScrollbars() {
     CrashIf(!win->AsFixed());
     DisplayModel* dm = win->AsFixed();
+    CanvasSize canvas = dm->GetCanvasSize();
 
     SCROLLINFO si = {0};
     si.cbSize = sizeof(si);
@@ -842,15 +969,18 @@ void ControllerCallbackHandler::UpdateScrollbars(Size canvas) {
         si.nMax = 99;
         si.nPage = 100;
     } else {
-        si.nPos = dm->GetViewPort().y;
+        // canvas coordinates are scaled down for canvases too high for the scrollbar range
+        int scale = dm->GetScrollbarScaleY();
+        si.nPos = dm->CanvasYToScrollbar(dm->GetViewPort().y);
         si.nMin = 0;
-        si.nMax = canvas.dy - 1;
-        si.nPage = viewPort.dy;
+        si.nMax = dm->CanvasYToScrollbar(canvas.dy) - 1;
+        si.nPage = std::max(viewPort.dy / scale, 1);
 
         if (ZOOM_FIT_PAGE != dm->GetZoomVirtual()) {
             // keep the top/bottom 5% of the previous page visible after paging down/up
-            si.nPage = (UINT)(si.nPage * 0.95);
-            si.nMax -= viewPort.dy - si.nPage;
+            UINT fullPage = si.nPage;
+            si.nPage = std::max((UINT)(si.nPage * 0.95), 1U);
+            si.nMax -= fullPage - si.nPage;
         }
     }
     ShowScrollBar(win->hwndCanvas, SB_VERT, viewPort.dy < canvas.dy);
@@ -1089,6 +1219,7 @@ static void LoadDocIntoCurrentTab(const LoadArgs& args, Controller* ctrl, Displa
     }
 
     AbortFinding(args.win, false);
+    AbortCopying(args.win);
 
     Controller* prevCtrl = win->ctrl;
     tab->ctrl = ctrl;
@@ -1114,15 +1245,18 @@ static void LoadDocIntoCurrentTab(const LoadArgs& args, Controller* ctrl, Displa
             // TODO: also expose Manga Mode for image folders?
             if (tab->GetEngineType() == kindEngineComicBooks || tab->GetEngineType() == kindEngineImageDir)
                 dm->SetDisplayR2L(state ? state->displayR2L : gGlobalPrefs->comicBookUI.cbxMangaMode);
-            if (prevCtrl && prevCtrl->AsFixed() && str::Eq(win->ctrl->FilePath(), prevCtrl->FilePath())) {
-                gRenderCache.KeepForDisplayModel(prevCtrl->AsFixed(), dm);
-                dm->CopyNavHistory(*prevCtrl->AsFixed());
-            }
             // reload user annotations
             // TODO: are we losing unsaved annotations?
             auto annots = LoadFileModifications(args.fileName);
             dm->userAnnots = annots;
             dm->GetEngine()->SetUserAnnotations(annots);
+            // after the user annotations have been set, as they
+            // influence which pages are considered unchanged
+            if (prevCtrl && prevCtrl->AsFixed() && str::Eq(win->ctrl->FilePath(), prevCtrl->FilePath())) {
+                gRenderCache.KeepForDisplayModel(prevCtrl->AsFixed(), dm);
+                dm->textCache->TakeUnchangedPages(prevCtrl->AsFixed()->textCache);
+                dm->CopyNavHistory(*prevCtrl->AsFixed());
+            }
             // tell UI Automation about content change
             if (win->uia_provider) {
                 win->uia_provider->OnDocumentLoad(dm);
@@ -1219,6 +1353,12 @@ static void LoadDocIntoCurrentTab(const LoadArgs& args, Controller* ctrl, Displa
     if ((args.showWin || ss.page != 1) && win->AsFixed()) {
         win->AsFixed()->SetScrollState(ss);
     }
+    // show the pages as they were when the document was last closed,
+    // until they've been rendered
+    if (win->AsFixed() && HasPermission(Perm_DiskAccess)) {
+        gRenderCache.LoadFromTileCache(win->AsFixed());
+        LoadSavedText(win->AsFixed());
+    }
 
     win->RedrawAll(true);
     TabsOnChangedDoc(win);
@@ -1482,6 +1622,7 @@ void DeleteWindowInfo(WindowInfo* win) {
 
     CrashIf(win->findThread && WaitForSingleObject(win->findThread, 0) == WAIT_TIMEOUT);
     CrashIf(win->printThread && WaitForSingleObject(win->printThread, 0) == WAIT_TIMEOUT);
+    CrashIf(win->copyTextThread && WaitForSingleObject(win->copyTextThread, 0) == WAIT_TIMEOUT);
 
     if (win->uia_provider) {
         // tell UIA to release all objects cached in its store
@@ -1508,6 +1649,10 @@ static void RenameFileInHistory(const WCHAR* oldPath, const WCHAR* newPath) {
     ds = gFileHistory.Find(oldPath, nullptr);
     if (ds) {
         str::ReplacePtr(&ds->filePath, newPath);
+        if (ds->favorites->size() > 0) {
+            // the files with favorites are sorted by name
+            gFavorites.InvalidateIndex();
+        }
         // merge Frequently Read data, so that a file
         // doesn't accidentally vanish from there
         ds->isPinned = ds->isPinned || oldIsPinned;
@@ -1572,6 +1717,7 @@ void scheduleReloadTab(TabInfo* tab) {
 // window or creating a new window for the document)
 WindowInfo* LoadDocument(LoadArgs& args) {
     CrashAlwaysIf(gCrashOnOpen);
+    TraceSpan span("LoadDocument");
 
     int threadID = (int)GetCurrentThreadId();
     AutoFreeWstr fullPath(path::Normalize(args.fileName));
@@ -1751,6 +1897,204 @@ WindowInfo* LoadDocument(LoadArgs& args) {
     return win;
 }
 
+// state of a document being loaded by LoadDocumentAsync()
+// the engine is created on a background thread, everything else happens on the ui thread
+class AsyncLoadData : public PasswordUI {
+  public:
+    // set to nullptr if the window is closed before loading finishes
+    WindowInfo* win = nullptr;
+    AutoFreeWstr filePath;
+    bool showWin = true;
+    bool enableChm = false;
+    bool enableEbook = false;
+    NotificationWnd* wnd = nullptr;
+    // set when the user closes the progress notification
+    bool isCanceled = false;
+    HwndPasswordUI pwdUI;
+    EngineBase* engine = nullptr;
+
+    AsyncLoadData(WindowInfo* win, const WCHAR* filePath) : win(win), pwdUI(win->hwndFrame) {
+        this->filePath.SetCopy(filePath);
+    }
+
+    WCHAR* GetPassword(const WCHAR* fileName, unsigned char* fileDigest, unsigned char decryptionKeyOut[32],
+                       bool* saveKey) override;
+    bool UpdateRepairProgress(int percent) override;
+};
+
+// called on the loading thread. The dialog is shown on the ui thread
+// (HwndPasswordUI also accesses gFileHistory and gGlobalPrefs)
+WCHAR* AsyncLoadData::GetPassword(const WCHAR* fileName, unsigned char* fileDigest, unsigned char decryptionKeyOut[32],
+                                  bool* saveKey) {
+    WCHAR* pwd = nullptr;
+    *saveKey = false;
+    HANDLE hDone = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    uitask::Post([&] {
+        if (!isCanceled && WindowInfoStillValid(win)) {
+            pwd = pwdUI.GetPassword(fileName, fileDigest, decryptionKeyOut, saveKey);
+        }
+        SetEvent(hDone);
+    });
+    WaitForSingleObject(hDone, INFINITE);
+    CloseHandle(hDone);
+    return pwd;
+}
+
+// called on the loading thread
+bool AsyncLoadData::UpdateRepairProgress(int percent) {
+    uitask::Post([this, percent] {
+        if (isCanceled || !WindowInfoStillValid(win) || !win->notifications->Contains(wnd)) {
+            return;
+        }
+        AutoFreeWstr msg(str::Format(_TR("Repairing %s ... (%d%%)"), path::GetBaseNameNoFree(filePath), percent));
+        wnd->UpdateMessage(msg);
+    });
+    return !isCanceled;
+}
+
+static void FinishLoadDocumentAsync(AsyncLoadData* data) {
+    if (!WindowInfoStillValid(data->win)) {
+        // don't open a new window for a document whose window has been closed
+        data->win = nullptr;
+    } else if (data->win->notifications->Contains(data->wnd)) {
+        data->win->notifications->RemoveNotification(data->wnd);
+    }
+    if (data->isCanceled || !data->win) {
+        delete data->engine;
+        delete data;
+        return;
+    }
+
+    WindowInfo* win = data->win;
+    if (!data->engine) {
+        AutoFreeWstr msg(str::Format(_TR("Error loading %s"), data->filePath.get()));
+        win->ShowNotification(msg, NOS_HIGHLIGHT);
+        if (gFileHistory.MarkFileInexistent(data->filePath)) {
+            prefs::Save();
+            // update the Frequently Read list
+            if (1 == gWindows.size() && gWindows.at(0)->IsAboutWindow()) {
+                gWindows.at(0)->RedrawAll(true);
+            }
+        }
+        delete data;
+        return;
+    }
+
+    LoadArgs args(data->filePath, win);
+    args.engine = data->engine;
+    args.showWin = data->showWin;
+    LoadDocument(args);
+    delete data;
+}
+
+static DWORD WINAPI LoadDocumentThread(LPVOID arg) {
+    AsyncLoadData* data = (AsyncLoadData*)arg;
+    data->engine = EngineManager::CreateEngine(data->filePath, data, data->enableChm, data->enableEbook);
+    uitask::Post([data] { FinishLoadDocumentAsync(data); });
+    return 0;
+}
+
+// Loads a document without blocking the ui while the engine parses it
+// (which can take a long while for large files on network drives). Until then
+// a notification is shown in args.win which cancels the loading when closed.
+// Falls back to LoadDocument() when the document can only be loaded on the ui thread.
+void LoadDocumentAsync(LoadArgs& args) {
+    WindowInfo* win = args.win;
+    if (!win || args.engine || args.forceReuse || gPluginMode || IsStressTesting()) {
+        LoadDocument(args);
+        return;
+    }
+    AutoFreeWstr fullPath(path::Normalize(args.fileName));
+    bool enableChm = gGlobalPrefs->chmUI.useFixedPageUI;
+    bool enableEbook = gGlobalPrefs->ebookUI.useFixedPageUI;
+    // MSHTML and the ebook UI need the window, so these are created in CreateControllerForFile
+    // (same for missing files, which LoadDocument might look for on a different drive)
+    bool needsUiThread = (!enableChm && ChmModel::IsSupportedFile(fullPath)) ||
+                         (!enableEbook && Doc::IsSupportedFile(fullPath)) || IsModificationsFile(fullPath) ||
+                         !DocumentPathExists(fullPath);
+    if (needsUiThread) {
+        LoadDocument(args);
+        return;
+    }
+
+    auto data = new AsyncLoadData(win, fullPath);
+    data->showWin = args.showWin;
+    data->enableChm = enableChm;
+    data->enableEbook = enableEbook;
+
+    NotificationWnd* wnd = new NotificationWnd(win->hwndCanvas, 0);
+    Notifications* notifications = win->notifications;
+    wnd->wndRemovedCb = [notifications, data](NotificationWnd* wnd) {
+        data->isCanceled = true;
+        notifications->RemoveNotification(wnd);
+    };
+    AutoFreeWstr msg(str::Format(_TR("Loading %s ..."), path::GetBaseNameNoFree(fullPath)));
+    wnd->Create(msg, nullptr);
+    notifications->Add(wnd, nullptr);
+    data->wnd = wnd;
+
+    HANDLE hThread = CreateThread(nullptr, 0, LoadDocumentThread, data, 0, nullptr);
+    if (!hThread) {
+        notifications->RemoveNotification(wnd);
+        delete data;
+        LoadDocument(args);
+        return;
+    }
+    CloseHandle(hThread);
+}
+
+// applies the view settings saved for a tab in the previous session
+// to the document that has just been loaded into the current tab
+void RestoreTabState(WindowInfo* win, TabState* state) {
+    TabInfo* tab = win->currentTab;
+    if (!tab || !tab->ctrl) {
+        return;
+    }
+
+    tab->tocState = *state->tocState;
+    SetSidebarVisibility(win, state->showToc, gGlobalPrefs->showFavorites);
+
+    DisplayMode displayMode = prefs::conv::ToDisplayMode(state->displayMode, DM_AUTOMATIC);
+    if (displayMode != DM_AUTOMATIC) {
+        SwitchToDisplayMode(win, displayMode);
+    }
+    // TODO: make EbookController::GoToPage not crash
+    if (!tab->AsEbook()) {
+        tab->ctrl->GoToPage(state->pageNo, true);
+    }
+    float zoom = prefs::conv::ToZoom(state->zoom, INVALID_ZOOM);
+    if (zoom != INVALID_ZOOM) {
+        if (tab->AsFixed()) {
+            tab->AsFixed()->Relayout(zoom, state->rotation);
+        } else {
+            tab->ctrl->SetZoomVirtual(zoom, nullptr);
+        }
+    }
+    if (tab->AsFixed()) {
+        tab->AsFixed()->SetScrollState(ScrollState(state->pageNo, state->scrollPos.x, state->scrollPos.y));
+    }
+}
+
+// loads the document of a tab restored from the previous session
+// when the tab is selected for the first time
+static void LoadRestoredTab(TabInfo* tab) {
+    WindowInfo* win = tab->win;
+    TabState* state = tab->restoreState;
+    tab->restoreState = nullptr;
+
+    CloseDocumentInTab(win, true);
+    win->currentTab = tab;
+
+    // LoadDocument replaces tab->filePath
+    AutoFreeWstr path(str::Dup(tab->filePath));
+    LoadArgs args(path, win);
+    args.forceReuse = true;
+    if (LoadDocument(args)) {
+        RestoreTabState(win, state);
+    }
+    DeleteTabState(state);
+}
+
 // Loads document data into the WindowInfo.
 void LoadModelIntoTab(TabInfo* tab) {
     if (!tab) {
@@ -1761,10 +2105,25 @@ void LoadModelIntoTab(TabInfo* tab) {
         return;
     }
 
+    TabInfo* prevTab = win->currentTab;
+    if (prevTab && prevTab != tab && prevTab->ctrl) {
+        prevTab->backgroundSince = GetTickCount();
+        prevTab->cachesFreed = false;
+        SetTimer(win->hwndCanvas, FREE_BACKGROUND_TABS_TIMER_ID, FREE_BACKGROUND_TABS_DELAY_IN_MS / 4, nullptr);
+    }
+
+    if (tab->restoreState) {
+        LoadRestoredTab(tab);
+        return;
+    }
+
     CloseDocumentInTab(win, true);
 
     win->currentTab = tab;
     win->ctrl = tab->ctrl;
+    if (tab->AsFixed() && tab->AsFixed()->textIndex) {
+        tab->AsFixed()->textIndex->StartIndexing();
+    }
 
     if (win->AsChm()) {
         win->AsChm()->SetParentHwnd(win->hwndCanvas);
@@ -1789,6 +2148,12 @@ void LoadModelIntoTab(TabInfo* tab) {
             win->ctrl->SetViewPortSize(win->GetViewPortSize());
         }
         DisplayModel* dm = win->AsFixed();
+        // page sizes determined while the tab was in the background
+        int pageCount = dm->PageCount();
+        dm->UpdatePageSizes();
+        if (dm->PageCount() != pageCount) {
+            UpdateToolbarPageText(win, dm->PageCount(), true);
+        }
         dm->SetScrollState(dm->GetScrollState());
         if (dm->GetPresentationMode() != (win->presentation != PM_DISABLED)) {
             dm->SetPresentationMode(!dm->GetPresentationMode());
@@ -1817,14 +2182,56 @@ void LoadModelIntoTab(TabInfo* tab) {
     }
 }
 
+// drops the rendered bitmaps, extracted text and loaded pages of a document
+// in a background tab. all of it is recreated once the tab is selected again
+static void FreeTabCaches(TabInfo* tab) {
+    tab->cachesFreed = true;
+    DisplayModel* dm = tab->AsFixed();
+    if (!dm) {
+        return;
+    }
+    // the indexer might be using the text about to be freed (and would
+    // otherwise extract all of it again). it's resumed in LoadModelIntoTab
+    if (dm->textIndex) {
+        dm->textIndex->StopIndexing();
+    }
+    gRenderCache.CancelRendering(dm);
+    gRenderCache.FreeForDisplayModel(dm);
+    if (dm->textCache) {
+        dm->textCache->FreeAllText();
+    }
+    dm->GetEngine()->FreeCachedPages();
+}
+
+// called periodically by FREE_BACKGROUND_TABS_TIMER_ID, returns false
+// once there are no more background tabs with caches to free
+// if force is true, caches are freed right away (e.g. when running out of GDI objects)
+bool FreeBackgroundTabCaches(WindowInfo* win, bool force) {
+    bool pending = false;
+    for (TabInfo* tab : win->tabs) {
+        if (tab == win->currentTab || !tab->ctrl || tab->cachesFreed) {
+            continue;
+        }
+        if (!force && GetTickCount() - tab->backgroundSince < FREE_BACKGROUND_TABS_DELAY_IN_MS) {
+            pending = true;
+            continue;
+        }
+        FreeTabCaches(tab);
+    }
+    return pending;
+}
+
 static void UpdatePageInfoHelper(WindowInfo* win, NotificationWnd* wnd, int pageNo) {
     if (!win->ctrl->ValidPageNo(pageNo)) {
         pageNo = win->ctrl->CurrentPageNo();
     }
-    AutoFreeWstr pageInfo(str::Format(L"%s %d / %d", _TR("Page:"), pageNo, win->ctrl->PageCount()));
+    WCHAR pageInfo[256];
     if (win->ctrl->HasPageLabels()) {
         AutoFreeWstr label(win->ctrl->GetPageLabel(pageNo));
-        pageInfo.Set(str::Format(L"%s %s (%d / %d)", _TR("Page:"), label.get(), pageNo, win->ctrl->PageCount()));
+        str::BufFmt(pageInfo, dimof(pageInfo), L"%s %s (%d / %d)", _TR("Page:"), label.get(), pageNo,
+                    win->ctrl->PageCount());
+    } else {
+        str::BufFmt(pageInfo, dimof(pageInfo), L"%s %d / %d", _TR("Page:"), pageNo, win->ctrl->PageCount());
     }
     if (!wnd) {
         int options = IsShiftPressed() ? NOS_PERSIST : NOS_DEFAULT;
@@ -1940,6 +2347,11 @@ static void RememberSessionState() {
         }
         SessionData* data = NewSessionData();
         for (TabInfo* tab : win->tabs) {
+            if (tab->restoreState) {
+                // the tab hasn't been loaded in this session
+                data->tabStates->Append(CloneTabState(tab->restoreState));
+                continue;
+            }
             DisplayState* ds = NewDisplayState(tab->filePath);
             if (tab->ctrl) {
                 tab->ctrl->GetDisplayState(ds);
@@ -1973,10 +2385,9 @@ Stable 2.5.3
 # Stable is optional and indicates the oldest version for which automated update
 # checks don't yet report the available update
 */
-static DWORD ShowAutoUpdateDialog(HWND hParent, HttpRsp* rsp, bool silent) {
-    if (rsp->error != 0) {
-        return rsp->error;
-    }
+// remembers the update information (and its ETag / Last-Modified for making
+// the next check a conditional request)
+static DWORD CacheUpdateInfo(HttpRsp* rsp) {
     if (rsp->httpStatusCode != 200) {
         return ERROR_INTERNET_INVALID_URL;
     }
@@ -2003,6 +2414,29 @@ static DWORD ShowAutoUpdateDialog(HWND hParent, HttpRsp* rsp, bool silent) {
         return ERROR_INTERNET_INCORRECT_FORMAT;
     }
 
+    str::ReplacePtr(&gGlobalPrefs->updateCheckLatest, latest);
+    str::ReplacePtr(&gGlobalPrefs->updateCheckStable, node->GetValue("Stable"));
+    str::ReplacePtr(&gGlobalPrefs->updateCheckETag, rsp->etag.Get());
+    str::ReplacePtr(&gGlobalPrefs->updateCheckLastModified, rsp->lastModified.Get());
+    return 0;
+}
+
+static DWORD ShowAutoUpdateDialog(HWND hParent, HttpRsp* rsp, bool silent) {
+    if (rsp->error != 0) {
+        return rsp->error;
+    }
+    // 304 means that the update information hasn't changed since the last check
+    if (rsp->httpStatusCode != 304 || !gGlobalPrefs->updateCheckLatest) {
+        DWORD error = CacheUpdateInfo(rsp);
+        if (error != 0) {
+            return error;
+        }
+    }
+    const char* latest = gGlobalPrefs->updateCheckLatest;
+    if (!IsValidProgramVersion(latest)) {
+        return ERROR_INTERNET_INCORRECT_FORMAT;
+    }
+
     AutoFreeWstr verTxt = strconv::Utf8ToWstr(latest);
     const WCHAR* myVer = UPDATE_CHECK_VER;
     // myVer = L"3.1"; // for ad-hoc debugging of auto-update code
@@ -2016,7 +2450,7 @@ static DWORD ShowAutoUpdateDialog(HWND hParent, HttpRsp* rsp, bool silent) {
     }
 
     if (silent) {
-        const char* stable = node->GetValue("Stable");
+        const char* stable = gGlobalPrefs->updateCheckStable;
         if (stable && IsValidProgramVersion(stable) &&
             CompareVersion(AutoFreeWstr(strconv::Utf8ToWstr(stable)), myVer) <= 0) {
             // don't update just yet if the older version is still marked as stable
@@ -2046,6 +2480,47 @@ static DWORD ShowAutoUpdateDialog(HWND hParent, HttpRsp* rsp, bool silent) {
     return 0;
 }
 
+#define UPDATE_CHECK_MAX_JITTER_MS (10 * 60 * 1000)
+
+struct DelayedTask {
+    HANDLE timer = nullptr;
+    std::function<void()> func;
+};
+
+static void CALLBACK DelayedTaskTimerProc(void* data, BOOLEAN) {
+    DelayedTask* task = (DelayedTask*)data;
+    RunAsync(task->func);
+    // doesn't wait for the callback to return when called from it
+    DeleteTimerQueueTimer(nullptr, task->timer, nullptr);
+    delete task;
+}
+
+// runs func on the thread pool after the delay, without blocking a thread while waiting
+static void RunDelayedAsync(DWORD delayMs, const std::function<void()>& func) {
+    if (delayMs < 1000) {
+        RunAsync(func);
+        return;
+    }
+    DelayedTask* task = new DelayedTask;
+    task->func = func;
+    // the timer doesn't fire before task->timer is set, given the minimum delay
+    BOOL ok = CreateTimerQueueTimer(&task->timer, nullptr, DelayedTaskTimerProc, task, delayMs, 0, WT_EXECUTEONLYONCE);
+    if (!ok) {
+        delete task;
+        RunAsync(func);
+    }
+}
+
+// a random delay for starting an automated update check
+static DWORD GetUpdateCheckJitterMs() {
+    DWORD seed = GetTickCount() ^ (GetCurrentProcessId() << 16);
+    // a better spread for seeds that differ only a little (from murmurhash's finalizer)
+    seed ^= seed >> 16;
+    seed *= 0x85ebca6b;
+    seed ^= seed >> 13;
+    return seed % UPDATE_CHECK_MAX_JITTER_MS;
+}
+
 // prevent multiple update tasks from happening simultaneously
 // (this might e.g. happen if a user checks manually very quickly after startup)
 bool gUpdateTaskInProgress = false;
@@ -2101,9 +2576,32 @@ void UpdateCheckAsync(WindowInfo* win, bool autoCheck) {
     str::WStr url = gUpdateInfoURL;
     url.Append(L"?v=");
     url.Append(UPDATE_CHECK_VER);
-    HttpGetAsync(url.Get(), [=](HttpRsp* rsp) {
+    HttpRsp* rsp = new HttpRsp;
+    rsp->url.SetCopy(url.Get());
+    // only ask for the update information if it changed since the last check
+    // (which usually is the case, avoiding the download)
+    if (gGlobalPrefs->updateCheckLatest) {
+        rsp->etag.SetCopy(gGlobalPrefs->updateCheckETag);
+        rsp->lastModified.SetCopy(gGlobalPrefs->updateCheckLastModified);
+    }
+    // many installations are usually started around the same time (e.g. in
+    // the morning in a company), so spread their automated checks over a
+    // few minutes instead of having all of them hit the server at once
+    DWORD delayMs = autoCheck ? GetUpdateCheckJitterMs() : 0;
+    RunDelayedAsync(delayMs, [=] {
+        HttpGet(rsp->url, rsp);
         gUpdateTaskInProgress = false;
-        uitask::Post([=] { ProcessAutoUpdateCheckResult(hwnd, rsp, autoCheck); });
+        uitask::Post([=] {
+            // the window might have been closed in the meantime
+            HWND hwndParent = hwnd;
+            if (!IsWindow(hwndParent)) {
+                hwndParent = gWindows.empty() ? nullptr : gWindows.at(0)->hwndFrame;
+            }
+            if (hwndParent) {
+                ProcessAutoUpdateCheckResult(hwndParent, rsp, autoCheck);
+            }
+            delete rsp;
+        });
     });
 }
 
@@ -2176,6 +2674,7 @@ static void CloseDocumentInTab(WindowInfo* win, bool keepUIEnabled, bool deleteM
         win->AsChm()->RemoveParentHwnd();
     ClearTocBox(win);
     AbortFinding(win, true);
+    AbortCopying(win);
     delete win->linkOnLastButtonDown;
     win->linkOnLastButtonDown = nullptr;
     win->fwdSearchMark.show = false;
@@ -2185,6 +2684,8 @@ static void CloseDocumentInTab(WindowInfo* win, bool keepUIEnabled, bool deleteM
     win->ctrl = nullptr;
     auto currentTab = win->currentTab;
     if (deleteModel) {
+        // the hits refer to the document being closed
+        CloseSearchResults(currentTab);
         delete currentTab->ctrl;
         currentTab->ctrl = nullptr;
         FileWatcherUnsubscribe(win->currentTab->watcher);
@@ -2241,6 +2742,7 @@ void CloseTab(WindowInfo* win, bool quitIfLast) {
     } else {
         CrashIf(gPluginMode && !gWindows.Contains(win));
         AbortFinding(win, true);
+        AbortCopying(win);
         TabsOnCloseDoc(win);
     }
 }
@@ -2288,6 +2790,7 @@ void CloseWindow(WindowInfo* win, bool quitIfLast, bool forceClose) {
 
     AbortFinding(win, true);
     AbortPrinting(win);
+    AbortCopying(win);
 
     if (win->AsFixed()) {
         win->AsFixed()->dontRenderFlag = true;
@@ -2985,7 +3488,7 @@ static void OnMenuOpen(WindowInfo* win) {
     if (*(fileName - 1)) {
         // special case: single filename without nullptr separator
         LoadArgs args(ofn.lpstrFile, win);
-        LoadDocument(args);
+        LoadDocumentAsync(args);
         return;
     }
 
@@ -2993,7 +3496,7 @@ static void OnMenuOpen(WindowInfo* win) {
         AutoFreeWstr filePath = path::Join(ofn.lpstrFile, fileName);
         if (filePath) {
             LoadArgs args(filePath, win);
-            LoadDocument(args);
+            LoadDocumentAsync(args);
         }
         fileName += str::Len(fileName) + 1;
     }
@@ -3240,6 +3743,8 @@ static void OnMenuAdvancedOptions() {
         return;
     }
 
+    // the editor must see the current settings
+    prefs::Flush();
     AutoFreeWstr path = prefs::GetSettingsPath();
     // TODO: disable/hide the menu item when there's no prefs file
     //       (happens e.g. when run in portable mode from a CD)?
@@ -3828,10 +4333,11 @@ static void MakeAnnotationFromSelection(TabInfo* tab) {
         auto annot = MakeAnnotationSmx(AnnotationType::Highlight, sel.pageNo, sel.rect, c);
         annot->isChanged = true;
         annots->Append(annot);
-        gRenderCache.Invalidate(dm, sel.pageNo, sel.rect);
     }
     engine->SetUserAnnotations(dm->userAnnots);
-    ClearSearchResult(win); // causes invalidated tiles to be rerendered
+    // user annotations are painted over the rendered tiles,
+    // so the page doesn't have to be rendered again
+    ClearSearchResult(win);
 }
 
 static void OnFrameKeyM(WindowInfo* win) {
@@ -3947,10 +4453,10 @@ static void FrameOnChar(WindowInfo* win, WPARAM key, LPARAM info = 0) {
         case '=':
         case 0xE0:
         case 0xE4:
-            ZoomToSelection(win, ctrl->GetNextZoomStep(ZOOM_MAX), false);
+            ZoomToSelectionAnimated(win, ZOOM_MAX);
             break;
         case '-':
-            ZoomToSelection(win, ctrl->GetNextZoomStep(ZOOM_MIN), false);
+            ZoomToSelectionAnimated(win, ZOOM_MIN);
             break;
         case '/':
             if (!gIsDivideKeyDown) {
@@ -4184,7 +4690,7 @@ static LRESULT FrameOnCommand(WindowInfo* win, HWND hwnd, UINT msg, WPARAM wPara
         DisplayState* state = gFileHistory.Get(wmId - IDM_FILE_HISTORY_FIRST);
         if (state && HasPermission(Perm_DiskAccess)) {
             LoadArgs args(state->filePath, win);
-            LoadDocument(args);
+            LoadDocumentAsync(args);
         }
         return 0;
     }
@@ -4280,13 +4786,13 @@ static LRESULT FrameOnCommand(WindowInfo* win, HWND hwnd, UINT msg, WPARAM wPara
 
         case IDT_VIEW_ZOOMIN:
             if (win->IsDocLoaded()) {
-                ZoomToSelection(win, ctrl->GetNextZoomStep(ZOOM_MAX), false);
+                ZoomToSelectionAnimated(win, ZOOM_MAX);
             }
             break;
 
         case IDT_VIEW_ZOOMOUT:
             if (win->IsDocLoaded()) {
-                ZoomToSelection(win, ctrl->GetNextZoomStep(ZOOM_MIN), false);
+                ZoomToSelectionAnimated(win, ZOOM_MIN);
             }
             break;
 
@@ -4416,6 +4922,10 @@ static LRESULT FrameOnCommand(WindowInfo* win, HWND hwnd, UINT msg, WPARAM wPara
             OnMenuFind(win);
             break;
 
+        case IDM_FIND_ALL:
+            OnMenuFindAll(win);
+            break;
+
         case IDM_FIND_NEXT:
             OnMenuFindNext(win);
             break;
@@ -4542,6 +5052,17 @@ static LRESULT FrameOnCommand(WindowInfo* win, HWND hwnd, UINT msg, WPARAM wPara
             }
             break;
 
+        case IDM_DEBUG_SHOW_PERF_HUD:
+            gShowPerfHud = !gShowPerfHud;
+            for (auto& w : gWindows) {
+                w->RedrawAll(true);
+            }
+            break;
+
+        case IDM_DEBUG_MEM_STATS:
+            SaveMemStats(nullptr);
+            break;
+
         case IDM_DEBUG_EBOOK_UI:
             gGlobalPrefs->ebookUI.useFixedPageUI = !gGlobalPrefs->ebookUI.useFixedPageUI;
             // use the same setting to also toggle the CHM UI
@@ -4635,6 +5156,26 @@ LRESULT CALLBACK WndProcFrame(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp) {
             }
             break;
 
+        case WM_ENTERSIZEMOVE:
+            if (win) {
+                win->inSizeMove = true;
+            }
+            break;
+
+        case WM_EXITSIZEMOVE:
+            if (win) {
+                win->inSizeMove = false;
+                StopDeferringRenderingAfterResize(win);
+            }
+            break;
+
+        case WM_DPICHANGED:
+            // the resize that usually follows is coalesced with further ones
+            if (win) {
+                DeferRenderingWhileResizing(win);
+            }
+            break;
+
         case WM_GETMINMAXINFO:
             return OnFrameGetMinMaxInfo((MINMAXINFO*)lp);
 
@@ -4797,6 +5338,7 @@ LRESULT CALLBACK WndProcFrame(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp) {
             // TODO: check for unfinished print jobs in WM_QUERYENDSESSION?
             if (wp == TRUE) {
                 prefs::Save();
+                prefs::Flush();
                 // we must quit so that we restore opened files on start.
                 DestroyWindow(hwnd);
             }
@@ -4820,6 +5362,13 @@ LRESULT CALLBACK WndProcFrame(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp) {
             }
             break;
 
+        case WM_ACTIVATEAPP:
+            // the pooled bitmaps are only worth keeping while the user is scrolling
+            if (!wp) {
+                TrimBitmapPool();
+            }
+            break;
+
         case WM_MOUSEACTIVATE:
             if (win && win->presentation && hwnd != GetForegroundWindow()) {
                 return MA_ACTIVATEANDEAT;
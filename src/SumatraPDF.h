@@ -28,6 +28,14 @@
 
 #define EBOOK_LAYOUT_TIMER_ID 7
 
+#define FREE_BACKGROUND_TABS_TIMER_ID 8
+// background tabs free their cached pages after not being selected for this long
+#define FREE_BACKGROUND_TABS_DELAY_IN_MS (2 * 60 * 1000)
+
+#define RESIZE_RENDER_TIMER_ID 10
+// while resizing, pages are only rendered anew once the size has been stable for this long
+#define RESIZE_RENDER_DELAY_IN_MS 200
+
 // permissions that can be revoked through sumatrapdfrestrict.ini or the -restrict command line flag
 enum {
     // enables Update checks, crash report submitting and hyperlinks
@@ -82,11 +90,14 @@ class RenderCache;
 struct TabInfo;
 struct LabelWithCloseWnd;
 struct SessionData;
+struct TabState;
 struct DropDownCtrl;
 
 // all defined in SumatraPDF.cpp
 extern bool gDebugShowLinks;
 extern bool gShowFrameRate;
+extern bool gShowPerfHud;
+extern bool gDeferThumbnails;
 
 extern const WCHAR* gPluginURL;
 extern Vec<WindowInfo*> gWindows;
@@ -158,7 +169,10 @@ struct LoadArgs {
 };
 
 WindowInfo* LoadDocument(LoadArgs& args);
+void LoadDocumentAsync(LoadArgs& args);
 WindowInfo* CreateAndShowWindowInfo(SessionData* data = nullptr);
+void RestoreTabState(WindowInfo* win, TabState* state);
+bool FreeBackgroundTabCaches(WindowInfo* win, bool force = false);
 
 UINT MbRtlReadingMaybe();
 void MessageBoxWarning(HWND hwnd, const WCHAR* msg, const WCHAR* title = nullptr);
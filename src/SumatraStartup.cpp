@@ -13,6 +13,7 @@
 #include "mui/Mui.h"
 #include "utils/SquareTreeParser.h"
 #include "utils/ThreadUtil.h"
+#include "utils/Trace.h"
 #include "utils/UITask.h"
 #include "utils/WinUtil.h"
 #include "utils/Archive.h"
@@ -40,6 +41,7 @@
 #include "GlobalPrefs.h"
 #include "PdfSync.h"
 #include "RenderCache.h"
+#include "RenderWorker.h"
 #include "ProgressUpdateUI.h"
 #include "TextSelection.h"
 #include "TextSearch.h"
@@ -68,6 +70,7 @@
 #include "Tests.h"
 #include "Menu.h"
 #include "AppTools.h"
+#include "MemStats.h"
 #include "Installer.h"
 #include "SumatraConfig.h"
 
@@ -134,12 +137,14 @@ void FileExistenceChecker::Terminate() {
 }
 
 void FileExistenceChecker::Run() {
-    // filters all file paths on network drives, removable drives and
-    // all paths which still exist from the list (remaining paths will
-    // be marked as inexistent in gFileHistory)
+    // filters all file paths on removable drives, unreachable network
+    // drives and all paths which still exist from the list (remaining
+    // paths will be marked as inexistent in gFileHistory)
     for (size_t i = 0; i < paths.size(); i++) {
         const WCHAR* path = paths.at(i);
-        if (!path || !path::IsOnFixedDrive(path) || DocumentPathExists(path)) {
+        bool canCheck = path && (path::IsOnFixedDrive(path) ||
+                                 (!path::HasVariableDriveLetter(path) && path::IsVolumeReachable(path)));
+        if (!canCheck || DocumentPathExists(path)) {
             free(paths.PopAt(i--));
         }
     }
@@ -304,32 +309,45 @@ static void RestoreTabOnStartup(WindowInfo* win, TabState* state) {
     if (!LoadDocument(args)) {
         return;
     }
-    TabInfo* tab = win->currentTab;
-    if (!tab || !tab->ctrl) {
+    RestoreTabState(win, state);
+}
+
+// with tabs, only the selected tab's document is loaded right away,
+// the other tabs are loaded when they're selected for the first time
+static void RestoreTabsOnStartup(WindowInfo* win, SessionData* data) {
+    if (!gGlobalPrefs->useTabs) {
+        for (TabState* state : *data->tabStates) {
+            RestoreTabOnStartup(win, state);
+        }
+        TabsSelect(win, data->tabIndex - 1);
         return;
     }
 
-    tab->tocState = *state->tocState;
-    SetSidebarVisibility(win, state->showToc, gGlobalPrefs->showFavorites);
-
-    DisplayMode displayMode = prefs::conv::ToDisplayMode(state->displayMode, DM_AUTOMATIC);
-    if (displayMode != DM_AUTOMATIC) {
-        SwitchToDisplayMode(win, displayMode);
-    }
-    // TODO: make EbookController::GoToPage not crash
-    if (!tab->AsEbook()) {
-        tab->ctrl->GoToPage(state->pageNo, true);
-    }
-    float zoom = prefs::conv::ToZoom(state->zoom, INVALID_ZOOM);
-    if (zoom != INVALID_ZOOM) {
-        if (tab->AsFixed()) {
-            tab->AsFixed()->Relayout(zoom, state->rotation);
-        } else {
-            tab->ctrl->SetZoomVirtual(zoom, nullptr);
+    TabInfo* selectedTab = nullptr;
+    for (int i = 0; i < data->tabStates->isize(); i++) {
+        TabState* state = data->tabStates->at(i);
+        if (!state->filePath) {
+            continue;
+        }
+        // don't wait for the network timeout of unreachable shares
+        // (such tabs fail to load when they're selected)
+        if (path::IsVolumeReachable(state->filePath) && !DocumentPathExists(state->filePath)) {
+            continue;
+        }
+        if (win->IsAboutWindow()) {
+            // invalidate the links on the Frequently Read page
+            win->staticLinks.Reset();
+        }
+        TabInfo* tab = CreateNewTab(win, state->filePath);
+        tab->restoreState = CloneTabState(state);
+        tab->showToc = state->showToc;
+        if (i == data->tabIndex - 1 || !selectedTab) {
+            selectedTab = tab;
         }
     }
-    if (tab->AsFixed()) {
-        tab->AsFixed()->SetScrollState(ScrollState(state->pageNo, state->scrollPos.x, state->scrollPos.y));
+    if (selectedTab) {
+        TabCtrl_SetCurSel(win->hwndTabBar, win->tabs.Find(selectedTab));
+        LoadModelIntoTab(selectedTab);
     }
 }
 
@@ -486,6 +504,34 @@ static bool RegisterForPdfExtentions(HWND hwnd) {
     return true;
 }
 
+// work that isn't needed for showing the first window. It's done from the
+// message loop once the first window has been painted
+static void RunDeferredStartupTasks(WindowInfo* win, bool showStartPage) {
+    TraceSpan span("DeferredStartup");
+    logf("first paint after %.0f ms\n", GetProcessRunningTime());
+
+    if (gDeferThumbnails) {
+        gDeferThumbnails = false;
+        if (showStartPage && WindowInfoStillValid(win) && win->IsAboutWindow()) {
+            win->RedrawAll(true);
+        }
+    }
+    // Make sure that we're still registered as default,
+    // if the user has explicitly told us to be
+    if (gGlobalPrefs->associatedExtensions && WindowInfoStillValid(win)) {
+        RegisterForPdfExtentions(win->hwndFrame);
+    }
+    if (gGlobalPrefs->checkForUpdates && WindowInfoStillValid(win)) {
+        UpdateCheckAsync(win, true);
+    }
+    // only hide newly missing files when showing the start page on startup
+    if (showStartPage && gFileHistory.Get(0)) {
+        gFileExistenceChecker = new FileExistenceChecker();
+        gFileExistenceChecker->Start();
+    }
+    CleanUpThumbnailCache(gFileHistory);
+}
+
 static int RunMessageLoop() {
     HACCEL accTable = LoadAccelerators(GetModuleHandle(nullptr), MAKEINTRESOURCE(IDC_SUMATRAPDF));
     MSG msg = {0};
@@ -734,6 +780,8 @@ static void testLogf() {
 
 // in mupdf_load_system_font.c
 extern "C" void destroy_system_font_list();
+extern "C" void pdf_set_system_font_list_cache(const WCHAR* path);
+extern "C" void pdf_preload_system_font_list();
 
 int APIENTRY WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance, _In_ LPSTR cmdLine,
                      _In_ int nCmdShow) {
@@ -802,6 +850,11 @@ int APIENTRY WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
 
     Flags i;
     ParseCommandLine(GetCommandLineW(), i);
+    if (str::EqI(i.tracePath, L"etw")) {
+        TraceStartEtw();
+    } else if (i.tracePath) {
+        TraceStart();
+    }
 
     if (false && gIsDebugBuild) {
         int TestLice(HINSTANCE hInstance, int nCmdShow);
@@ -884,9 +937,22 @@ int APIENTRY WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
         return 0;
     }
 
-    prefs::Load();
-    UpdateGlobalPrefs(i);
-    SetCurrentLang(i.lang ? i.lang : gGlobalPrefs->uiLanguage);
+    {
+        TraceSpan span("LoadPrefs");
+        prefs::Load();
+        UpdateGlobalPrefs(i);
+        SetCurrentLang(i.lang ? i.lang : gGlobalPrefs->uiLanguage);
+        // before any document is loaded
+        EnableScalableFzAllocator(gGlobalPrefs->scalableAllocator);
+        SetFzStoreSizeMB(gGlobalPrefs->imageCacheSizeMB);
+        AutoFreeWstr repairCache(AppGenDataFilename(L"sumatrapdfcache\\repairs"));
+        SetPdfRepairCacheDir(repairCache);
+        AutoFreeWstr fontListCache(AppGenDataFilename(L"sumatrapdfcache\\fontlist.bin"));
+        pdf_set_system_font_list_cache(fontListCache);
+    }
+    // the list of system fonts is only needed for documents with
+    // non-embedded fonts, so prepare it without delaying startup
+    RunAsync(pdf_preload_system_font_list);
 
     // This allows ad-hoc comparison of gdi, gdi+ and gdi+ quick when used
     // in layout
@@ -908,11 +974,31 @@ int APIENTRY WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
     }
 
     if (i.pathsToBenchmark.size() > 0) {
-        BenchFileOrDir(i.pathsToBenchmark);
+        BenchFileOrDir(&i);
+        if (i.showConsole)
+            system("pause");
+    }
+
+    if (i.benchParallelPath) {
+        BenchParallel(&i);
         if (i.showConsole)
             system("pause");
     }
 
+    if (i.renderPagesPattern) {
+        retCode = RenderPagesToFiles(&i);
+    }
+
+    if (i.renderWorker) {
+        // exit right away, this process doesn't own any of the settings
+        ::ExitProcess(RunRenderWorker());
+    }
+
+    if (i.stressTestPath && i.stressJobs > 1) {
+        retCode = RunStressTestJobs(&i);
+        goto Exit;
+    }
+
     if (i.exitImmediately) {
         goto Exit;
     }
@@ -940,11 +1026,7 @@ int APIENTRY WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
     if (i.printerName) {
         // note: this prints all PDF files. Another option would be to
         // print only the first one
-        for (size_t n = 0; n < i.fileNames.size(); n++) {
-            bool ok = PrintFile(i.fileNames.at(n), i.printerName, !i.silent, i.printSettings);
-            if (!ok)
-                retCode++;
-        }
+        retCode += PrintFiles(i.fileNames, i.printerName, !i.silent, i.printSettings);
         --retCode; // was 1 if no print failures, turn 1 into 0
         goto Exit;
     }
@@ -996,20 +1078,19 @@ int APIENTRY WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
         }
     }
 
+    gDeferThumbnails = showStartPage;
     WindowInfo* win = nullptr;
     if (restoreSession) {
         for (SessionData* data : *gGlobalPrefs->sessionData) {
             win = CreateAndShowWindowInfo(data);
-            for (TabState* state : *data->tabStates) {
-                RestoreTabOnStartup(win, state);
-            }
-            TabsSelect(win, data->tabIndex - 1);
+            RestoreTabsOnStartup(win, data);
         }
     }
     ResetSessionState(gGlobalPrefs->sessionData);
     // prevent the same session from being restored twice
     if (restoreSession && !(gGlobalPrefs->reuseInstance || gGlobalPrefs->useTabs)) {
         prefs::Save();
+        prefs::Flush();
     }
 
     for (const WCHAR* filePath : i.fileNames) {
@@ -1061,12 +1142,6 @@ int APIENTRY WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
         }
     }
 
-    // Make sure that we're still registered as default,
-    // if the user has explicitly told us to be
-    if (gGlobalPrefs->associatedExtensions) {
-        RegisterForPdfExtentions(win->hwndFrame);
-    }
-
     if (i.stressTestPath) {
         // don't save file history and preference changes
         RestrictPolicies(Perm_SavePreferences);
@@ -1075,15 +1150,13 @@ int APIENTRY WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
         fastExit = true;
     }
 
-    if (gGlobalPrefs->checkForUpdates) {
-        UpdateCheckAsync(win, true);
+    // paint all windows now so that the deferred tasks (posted
+    // messages are processed before WM_PAINT) don't delay the first paint
+    for (WindowInfo* w : gWindows) {
+        RedrawWindow(w->hwndFrame, nullptr, nullptr, RDW_UPDATENOW | RDW_ALLCHILDREN);
     }
+    uitask::Post([=] { RunDeferredStartupTasks(win, showStartPage); });
 
-    // only hide newly missing files when showing the start page on startup
-    if (showStartPage && gFileHistory.Get(0)) {
-        gFileExistenceChecker = new FileExistenceChecker();
-        gFileExistenceChecker->Start();
-    }
     // call this once it's clear whether Perm_SavePreferences has been granted
     prefs::RegisterForFileChanges();
 
@@ -1102,10 +1175,16 @@ int APIENTRY WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
 
     retCode = RunMessageLoop();
     SafeCloseHandle(&hMutex);
-    CleanUpThumbnailCache(gFileHistory);
 
 Exit:
+    if (i.tracePath) {
+        TraceStopAndSave(i.tracePath);
+    }
+    if (i.memStatsPath) {
+        SaveMemStats(i.memStatsPath);
+    }
     prefs::UnregisterForFileChanges();
+    prefs::Flush();
 
     if (fastExit) {
         // leave all the remaining clean-up to the OS
@@ -1123,6 +1202,8 @@ Exit:
 
     extern void CleanupDjVuEngine(); // in EngineDjVu.cpp
     CleanupDjVuEngine();
+    extern void FreeCachedImages(); // in HtmlFormatter.cpp
+    FreeCachedImages();
     destroy_system_font_list();
 
     // wait for FileExistenceChecker to terminate
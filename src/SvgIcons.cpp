@@ -7,6 +7,8 @@ extern "C" {
 }
 
 #include "utils/BaseUtil.h"
+#include "utils/FileUtil.h"
+#include "utils/ThreadUtil.h"
 #include "utils/WinUtil.h"
 #include "utils/ScopedWin.h"
 
@@ -16,6 +18,8 @@ extern "C" {
 #include "EngineBase.h"
 #include "EngineFzUtil.h"
 
+#include "AppTools.h"
+
 // https://github.com/tabler/tabler-icons/blob/master/icons/folder.svg
 static const char* gIconFileOpen =
     R"(<svg xmlns="http://www.w3.org/2000/svg" class="icon icon-tabler icon-tabler-folder" width="24" height="24" viewBox="0 0 24 24" stroke-width="2" stroke="currentColor" fill="none" stroke-linecap="round" stroke-linejoin="round">
@@ -135,41 +139,6 @@ static const char* gAllIcons[] = {
 };
 // clang-format on
 
-struct MupdfContext {
-    fz_locks_context fz_locks_ctx{};
-    CRITICAL_SECTION mutexes[FZ_LOCK_MAX];
-    fz_context* ctx = nullptr;
-    MupdfContext();
-    ~MupdfContext();
-};
-
-static void fz_lock_context_cs(void* user, int lock) {
-    MupdfContext* ctx = (MupdfContext*)user;
-    EnterCriticalSection(&ctx->mutexes[lock]);
-}
-
-static void fz_unlock_context_cs(void* user, int lock) {
-    MupdfContext* ctx = (MupdfContext*)user;
-    LeaveCriticalSection(&ctx->mutexes[lock]);
-}
-
-MupdfContext::MupdfContext() {
-    for (int i = 0; i < FZ_LOCK_MAX; i++) {
-        InitializeCriticalSection(&mutexes[i]);
-    }
-    fz_locks_ctx.user = this;
-    fz_locks_ctx.lock = fz_lock_context_cs;
-    fz_locks_ctx.unlock = fz_unlock_context_cs;
-    ctx = fz_new_context(nullptr, &fz_locks_ctx, FZ_STORE_DEFAULT);
-}
-
-MupdfContext::~MupdfContext() {
-    fz_drop_context(ctx);
-    for (int i = 0; i < FZ_LOCK_MAX; i++) {
-        DeleteCriticalSection(&mutexes[i]);
-    }
-}
-
 void BlitPixmap(fz_pixmap* dst, fz_pixmap* src, int dstX, int dstY) {
     int dx = src->w;
     int dy = src->h;
@@ -219,8 +188,7 @@ void ClearPixmap(fz_pixmap* pixmap) {
     }
 }
 
-fz_pixmap* BuildIconsPixmap(MupdfContext* muctx, int dx, int dy) {
-    fz_context* ctx = muctx->ctx;
+fz_pixmap* BuildIconsPixmap(fz_context* ctx, int dx, int dy) {
     int nIcons = (int)dimof(gAllIcons);
     int bmpDx = dx * nIcons;
     int bmpDy = dy;
@@ -242,11 +210,8 @@ fz_pixmap* BuildIconsPixmap(MupdfContext* muctx, int dx, int dy) {
     return dstPixmap;
 }
 
-HBITMAP CreateBitmapFromPixmap(fz_pixmap* pixmap) {
-    int w = pixmap->w;
-    int h = pixmap->h;
-    int n = pixmap->n;
-    int imgSize = pixmap->stride * h;
+static HBITMAP CreateBitmapFromSamples(int w, int h, int n, int stride, const u8* samples) {
+    int imgSize = stride * h;
     int bitsCount = n * 8;
 
     ScopedMem<BITMAPINFO> bmi((BITMAPINFO*)calloc(1, sizeof(BITMAPINFO) + 255 * sizeof(RGBQUAD)));
@@ -266,35 +231,105 @@ HBITMAP CreateBitmapFromPixmap(fz_pixmap* pixmap) {
     UINT usage = DIB_RGB_COLORS;
     HBITMAP hbmp = CreateDIBSection(nullptr, bmi, usage, &data, hMap, 0);
     if (data) {
-        u8* samples = pixmap->samples;
         memcpy(data, samples, imgSize);
     }
     return hbmp;
 }
 
+HBITMAP CreateBitmapFromPixmap(fz_pixmap* pixmap) {
+    return CreateBitmapFromSamples(pixmap->w, pixmap->h, pixmap->n, (int)pixmap->stride, pixmap->samples);
+}
+
+// Rasterizing the icons takes a noticeable part of the startup time, so the
+// result is cached on disk, one file per icon size. A file is only used if it
+// was built from the same icons (identified by a hash over their data).
+#define ICONS_CACHE_MAGIC 0x31495053 // "SPI1"
+
+struct IconsCacheHeader {
+    u32 magic;
+    u32 iconsHash;
+    int dx;
+    int dy;
+    int n;
+    int stride;
+};
+
+static u32 GetIconsHash() {
+    u32 hash = (u32)dimof(gAllIcons);
+    for (const char* svgData : gAllIcons) {
+        hash = hash * 31 + MurmurHash2(svgData, str::Len(svgData));
+    }
+    return hash;
+}
+
+static WCHAR* GetIconsCachePath(int dx, int dy) {
+    AutoFreeWstr fileName(str::Format(L"sumatrapdfcache\\toolbar-%dx%d.bin", dx, dy));
+    return AppGenDataFilename(fileName);
+}
+
+static HBITMAP LoadCachedIconsBitmap(const WCHAR* path, u32 iconsHash, int dx, int dy) {
+    AutoFree data(file::ReadFile(path));
+    if (data.size() < sizeof(IconsCacheHeader)) {
+        return nullptr;
+    }
+    IconsCacheHeader* hdr = (IconsCacheHeader*)data.Get();
+    int bmpDx = dx * (int)dimof(gAllIcons);
+    if (hdr->magic != ICONS_CACHE_MAGIC || hdr->iconsHash != iconsHash || hdr->dx != bmpDx || hdr->dy != dy ||
+        hdr->n != 3 || hdr->stride < bmpDx * 3) {
+        return nullptr;
+    }
+    size_t imgSize = (size_t)hdr->stride * dy;
+    if (data.size() != sizeof(IconsCacheHeader) + imgSize) {
+        return nullptr;
+    }
+    return CreateBitmapFromSamples(hdr->dx, hdr->dy, hdr->n, hdr->stride, (u8*)(hdr + 1));
+}
+
+static void SaveCachedIconsBitmap(WCHAR* path, u32 iconsHash, fz_pixmap* pixmap) {
+    size_t imgSize = pixmap->stride * (size_t)pixmap->h;
+    size_t dataSize = sizeof(IconsCacheHeader) + imgSize;
+    char* data = (char*)malloc(dataSize);
+    if (!data) {
+        free(path);
+        return;
+    }
+    IconsCacheHeader* hdr = (IconsCacheHeader*)data;
+    hdr->magic = ICONS_CACHE_MAGIC;
+    hdr->iconsHash = iconsHash;
+    hdr->dx = pixmap->w;
+    hdr->dy = pixmap->h;
+    hdr->n = pixmap->n;
+    hdr->stride = (int)pixmap->stride;
+    memcpy(hdr + 1, pixmap->samples, imgSize);
+    // writing the file doesn't have to delay showing the window
+    RunAsync([path, data, dataSize] {
+        AutoFreeWstr dir(path::GetDir(path));
+        dir::CreateAll(dir);
+        file::WriteFile(path, {data, dataSize});
+        free(data);
+        free(path);
+    });
+}
+
 HBITMAP BuildIconsBitmap(int dx, int dy) {
-    MupdfContext* muctx = new MupdfContext();
-    fz_pixmap* pixmap = BuildIconsPixmap(muctx, dx, dy);
-    // ClearPixmap(pixmap);
-#if 1
-#if 0
-    RenderedBitmap* rbmp = new_rendered_fz_pixmap(muctx->ctx, pixmap);
-    HBITMAP bmp = rbmp->hbmp;
-#else
+    u32 iconsHash = GetIconsHash();
+    WCHAR* cachePath = GetIconsCachePath(dx, dy);
+    if (cachePath) {
+        HBITMAP bmp = LoadCachedIconsBitmap(cachePath, iconsHash, dx, dy);
+        if (bmp) {
+            free(cachePath);
+            return bmp;
+        }
+    }
+
+    fz_context* ctx = NewFzContext();
+    fz_pixmap* pixmap = BuildIconsPixmap(ctx, dx, dy);
     HBITMAP bmp = CreateBitmapFromPixmap(pixmap);
-#endif
-    fz_drop_pixmap(muctx->ctx, pixmap);
-    delete muctx;
+    if (cachePath) {
+        // takes ownership of cachePath
+        SaveCachedIconsBitmap(cachePath, iconsHash, pixmap);
+    }
+    fz_drop_pixmap(ctx, pixmap);
+    fz_drop_context(ctx);
     return bmp;
-#else
-    int nIcons = dimof(gAllIcons);
-    int bmpDx = dx * nIcons;
-    int bmpDy = dy;
-    u8* bits = pixmap->samples;
-    HBITMAP res = CreateBitmap(bmpDx, bmpDy, 1, 24, bits);
-    fz_drop_pixmap(muctx->ctx, pixmap);
-    delete muctx;
-
-    return res;
-#endif
 }
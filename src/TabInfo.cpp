@@ -27,6 +27,9 @@
 #include "Translations.h"
 #include "ParseBKM.h"
 #include "EditAnnotations.h"
+#include "TextSelection.h"
+#include "TextSearch.h"
+#include "SearchResults.h"
 
 TabInfo::TabInfo(WindowInfo* win, const WCHAR* filePath) {
     this->win = win;
@@ -43,6 +46,9 @@ TabInfo::~TabInfo() {
     delete ctrl;
     delete tocSorted;
     DeleteEditAnnotationsWindow(editAnnotsWindow);
+    DeleteSearchResultsWindow(searchResultsWindow);
+    delete searchHits;
+    DeleteTabState(restoreState);
 }
 
 bool TabInfo::IsDocLoaded() const {
@@ -5,6 +5,9 @@ struct SelectionOnPage;
 struct WatchedFile;
 struct VbkmFile;
 struct EditAnnotationsWindow;
+struct SearchResultsWindow;
+struct TextSearchHit;
+struct TabState;
 
 enum class TocSort { None, TagSmallFirst, TagBigFirst, Color };
 
@@ -40,6 +43,16 @@ struct TabInfo {
     // if sortTag is != SortTag::None, this is a sorted toc tree to be displayed
     TocTree* tocSorted = nullptr;
     EditAnnotationsWindow* editAnnotsWindow = nullptr;
+    // results of the last Find All (shown in searchResultsWindow and next to the scrollbar)
+    Vec<TextSearchHit>* searchHits = nullptr;
+    SearchResultsWindow* searchResultsWindow = nullptr;
+    // state from the previous session for tabs that haven't been selected
+    // since startup (their document is only loaded when they're selected)
+    TabState* restoreState = nullptr;
+    // GetTickCount() when the tab was moved to the background and whether
+    // its cached pages have been freed since (cf. FreeBackgroundTabCaches)
+    DWORD backgroundSince = 0;
+    bool cachesFreed = false;
 
     TabInfo(WindowInfo* win, const WCHAR* filePath = nullptr);
     ~TabInfo();
@@ -29,6 +29,8 @@
 #include "SumatraPDF.h"
 #include "WindowInfo.h"
 #include "TabInfo.h"
+#include "TextSelection.h"
+#include "Selection.h"
 #include "resource.h"
 #include "Caption.h"
 #include "Menu.h"
@@ -121,6 +123,9 @@ class TabPainter {
     bool inTitlebar = false;
     LPARAM mouseCoordinates = 0;
     COLORREF currBgCol = DEFAULT_CURRENT_BG_COL;
+    // kept around so that repainting (e.g. when hovering) doesn't have
+    // to allocate a bitmap (re-created when the tab bar is resized)
+    DoubleBuffer* buffer = nullptr;
 
     TabPainter(HWND wnd, Size tabSize) {
         hwnd = wnd;
@@ -129,6 +134,7 @@ class TabPainter {
 
     ~TabPainter() {
         delete data;
+        delete buffer;
         DeleteAll();
     }
 
@@ -216,7 +222,8 @@ class TabPainter {
         DeleteObject(hRgn);
     }
 
-    // Paints the tabs that intersect the window's update rectangle.
+    // Paints the tabs that intersect the window's update rectangle
+    // (and hdc's clip region, in client coordinates).
     void Paint(HDC hdc, RECT& rc) {
         IntersectClipRect(hdc, rc.left, rc.top, rc.right, rc.bottom);
 
@@ -263,7 +270,7 @@ class TabPainter {
         float yPosTab = inTitlebar ? 0.0f : float(ClientRect(hwnd).dy - height - 1);
         for (int i = 0; i < Count(); i++) {
             gfx.ResetTransform();
-            gfx.TranslateTransform(1.f + (float)(width + 1) * i - (float)rc.left, yPosTab - (float)rc.top);
+            gfx.TranslateTransform(1.f + (float)(width + 1) * i, yPosTab);
 
             if (!gfx.IsVisible(0, 0, width + 1, height + 1))
                 continue;
@@ -631,12 +638,27 @@ static LRESULT CALLBACK TabBarProc(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp, UI
         case WM_PAINT: {
             RECT rc;
             GetUpdateRect(hwnd, &rc, FALSE);
+            // only the tabs in the update region have to be repainted
+            // (e.g. just the previously and the newly highlighted one)
+            HRGN updateRgn = CreateRectRgn(0, 0, 0, 0);
+            int rgnType = GetUpdateRgn(hwnd, updateRgn, FALSE);
             // TODO: when is wp != nullptr?
             hdc = wp ? (HDC)wp : BeginPaint(hwnd, &ps);
 
-            DoubleBuffer buffer(hwnd, Rect::FromRECT(rc));
-            tab->Paint(buffer.GetDC(), rc);
-            buffer.Flush(hdc);
+            Rect rClient = ClientRect(hwnd);
+            if (!tab->buffer || tab->buffer->GetRect() != rClient) {
+                delete tab->buffer;
+                tab->buffer = new DoubleBuffer(hwnd, rClient);
+            }
+            HDC hdcBuffer = tab->buffer->GetDC();
+            int savedDC = SaveDC(hdcBuffer);
+            if (SIMPLEREGION == rgnType || COMPLEXREGION == rgnType) {
+                SelectClipRgn(hdcBuffer, updateRgn);
+            }
+            tab->Paint(hdcBuffer, rc);
+            RestoreDC(hdcBuffer, savedDC);
+            tab->buffer->Flush(hdc, Rect::FromRECT(rc));
+            DeleteObject(updateRgn);
 
             ValidateRect(hwnd, nullptr);
             if (!wp)
@@ -815,6 +837,7 @@ LRESULT TabsOnNotify(WindowInfo* win, LPARAM lparam, int tab1, int tab2) {
     switch (data->code) {
         case TCN_SELCHANGING:
             // TODO: Should we allow the switch of the tab if we are in process of printing?
+            AbortCopying(win);
             SaveCurrentTabInfo(win);
             return FALSE;
 
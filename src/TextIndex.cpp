@@ -0,0 +1,176 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#include "utils/BaseUtil.h"
+#include "utils/ScopedWin.h"
+
+#include "wingui/TreeModel.h"
+
+#include "Annotation.h"
+#include "EngineBase.h"
+#include "TextSelection.h"
+#include "TextIndex.h"
+
+// bits per trigram occurrence used for a page's signature
+// (most trigrams occur repeatedly, so that's about 8 to 10 bits per distinct trigram)
+#define SIGNATURE_BITS_PER_TRIGRAM 4
+#define SIGNATURE_MIN_BITS 64
+#define SIGNATURE_MAX_BITS (1 << 17)
+
+// same case folding as in TextSearch::MatchEnd
+static WCHAR FoldCase(WCHAR c) {
+    return LOWORD(CharLower((LPWSTR)(ULONG_PTR)c));
+}
+
+static u32 TrigramHash(WCHAR c1, WCHAR c2, WCHAR c3) {
+    u32 h = (u32)c1 * 0x9E3779B1u;
+    h = (h ^ (u32)c2) * 0x85EBCA77u;
+    h = (h ^ (u32)c3) * 0xC2B2AE3Du;
+    return h ^ (h >> 15);
+}
+
+void TextIndex::GetTrigrams(const WCHAR* s, Vec<u32>& trigramsOut) {
+    WCHAR c1 = 0, c2 = 0;
+    int nWordChars = 0;
+    for (; *s; s++) {
+        if (!isWordChar(*s)) {
+            nWordChars = 0;
+            continue;
+        }
+        WCHAR c3 = FoldCase(*s);
+        if (++nWordChars >= 3) {
+            trigramsOut.Append(TrigramHash(c1, c2, c3));
+        }
+        c1 = c2;
+        c2 = c3;
+    }
+}
+
+// each trigram sets two bits of the Bloom filter
+static void SetSignatureBits(u64* bits, u32 mask, u32 hash) {
+    u32 b1 = hash & mask;
+    u32 b2 = ((hash >> 17) | (hash << 15)) & mask;
+    bits[b1 / 64] |= (u64)1 << (b1 % 64);
+    bits[b2 / 64] |= (u64)1 << (b2 % 64);
+}
+
+static bool HasSignatureBits(u64* bits, u32 mask, u32 hash) {
+    u32 b1 = hash & mask;
+    u32 b2 = ((hash >> 17) | (hash << 15)) & mask;
+    return (bits[b1 / 64] & ((u64)1 << (b1 % 64))) && (bits[b2 / 64] & ((u64)1 << (b2 % 64)));
+}
+
+static DWORD WINAPI TextIndexThread(LPVOID data) {
+    TextIndex* index = (TextIndex*)data;
+    index->IndexPages();
+    return 0;
+}
+
+TextIndex::TextIndex(EngineBase* engine, DocumentTextCache* textCache) : engine(engine), textCache(textCache) {
+    nPages = engine->PageCount();
+    pages = AllocArray<PageIndex>(nPages);
+    InitializeCriticalSection(&access);
+    StartIndexing();
+}
+
+TextIndex::~TextIndex() {
+    StopIndexing();
+
+    for (int i = 0; i < nPages; i++) {
+        free(pages[i].bits);
+    }
+    free(pages);
+    DeleteCriticalSection(&access);
+}
+
+void TextIndex::StartIndexing() {
+    if (thread) {
+        if (WaitForSingleObject(thread, 0) == WAIT_TIMEOUT) {
+            // still running
+            return;
+        }
+        CloseHandle(thread);
+    }
+
+    stopIndexing = false;
+    thread = CreateThread(nullptr, 0, TextIndexThread, this, CREATE_SUSPENDED, nullptr);
+    if (thread) {
+        SetThreadPriority(thread, THREAD_PRIORITY_IDLE);
+        ResumeThread(thread);
+    }
+}
+
+void TextIndex::StopIndexing() {
+    if (!thread) {
+        return;
+    }
+    stopIndexing = true;
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+    thread = nullptr;
+}
+
+void TextIndex::IndexPages() {
+    Vec<u32> trigrams;
+    for (int pageNo = 1; pageNo <= nPages && !stopIndexing; pageNo++) {
+        // when indexing has been restarted
+        {
+            ScopedCritSec scope(&access);
+            if (pages[pageNo - 1].bits) {
+                continue;
+            }
+        }
+
+        // don't extract the text a second time if it was needed elsewhere already
+        AutoFreeWstr text;
+        const WCHAR* pageText = nullptr;
+        PageTextPin pin;
+        if (textCache->HasTextForPage(pageNo)) {
+            pin.Set(textCache, pageNo);
+            pageText = textCache->GetTextForPage(pageNo);
+        } else {
+            text.Set(engine->ExtractPageText(pageNo, nullptr));
+            pageText = text.Get();
+        }
+
+        trigrams.Reset();
+        if (pageText) {
+            GetTrigrams(pageText, trigrams);
+        }
+
+        u32 nBits = SIGNATURE_MIN_BITS;
+        while (nBits < trigrams.size() * SIGNATURE_BITS_PER_TRIGRAM && nBits < SIGNATURE_MAX_BITS) {
+            nBits *= 2;
+        }
+        u64* bits = AllocArray<u64>(nBits / 64);
+        if (!bits) {
+            continue;
+        }
+        for (u32 hash : trigrams) {
+            SetSignatureBits(bits, nBits - 1, hash);
+        }
+
+        ScopedCritSec scope(&access);
+        pages[pageNo - 1].bits = bits;
+        pages[pageNo - 1].mask = nBits - 1;
+    }
+}
+
+bool TextIndex::MightContain(int pageNo, const Vec<u32>& trigrams) {
+    CrashIf(pageNo < 1);
+    // pages added after the index has been built haven't been indexed
+    if (pageNo > nPages) {
+        return true;
+    }
+    ScopedCritSec scope(&access);
+    PageIndex& page = pages[pageNo - 1];
+    if (!page.bits) {
+        return true;
+    }
+    for (u32 hash : trigrams) {
+        if (!HasSignatureBits(page.bits, page.mask, hash)) {
+            return false;
+        }
+    }
+    return true;
+}
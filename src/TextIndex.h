@@ -0,0 +1,49 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+// documents with fewer pages are searched quickly enough without an index
+#define TEXT_INDEX_MIN_PAGES 50
+
+/* TextIndex extracts the text of all pages on a background thread at idle
+   priority and remembers a compact signature of the case-folded trigrams
+   (three consecutive word characters) contained in each page. This allows
+   TextSearch to skip pages which can't contain the text searched for without
+   having to extract and scan their text. */
+class TextIndex {
+  public:
+    TextIndex(EngineBase* engine, DocumentTextCache* textCache);
+    ~TextIndex();
+
+    // returns false only if pageNo has already been indexed and definitely
+    // doesn't contain the text <trigrams> have been collected from
+    bool MightContain(int pageNo, const Vec<u32>& trigrams);
+
+    // collects the trigrams of <s> (nothing for strings with less than three word characters)
+    static void GetTrigrams(const WCHAR* s, Vec<u32>& trigramsOut);
+
+    // (re)starts indexing the pages that haven't been indexed yet
+    void StartIndexing();
+    // waits for the indexing thread to stop (pages indexed so far remain usable)
+    void StopIndexing();
+
+    // runs on the indexing thread
+    void IndexPages();
+
+  protected:
+    struct PageIndex {
+        // a Bloom filter of the page's trigrams (nullptr if not indexed yet)
+        u64* bits = nullptr;
+        // number of bits - 1 (always a power of 2 minus 1)
+        u32 mask = 0;
+    };
+
+    EngineBase* engine = nullptr;
+    DocumentTextCache* textCache = nullptr;
+    int nPages = 0;
+    PageIndex* pages = nullptr;
+
+    // protects pages
+    CRITICAL_SECTION access;
+    HANDLE thread = nullptr;
+    bool stopIndexing = false;
+};
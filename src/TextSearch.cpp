@@ -1,8 +1,16 @@
 /* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
    License: GPLv3 */
 
+#include <intrin.h>
+#if defined(_M_ARM64)
+#include "utils/Sse2Neon.h"
+#else
+#include <immintrin.h>
+#endif
+
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
+#include "utils/WinUtil.h"
 
 #include "wingui/TreeModel.h"
 
@@ -11,6 +19,7 @@
 #include "ProgressUpdateUI.h"
 #include "TextSelection.h"
 #include "TextSearch.h"
+#include "TextIndex.h"
 
 #define SkipWhitespace(c) for (; str::IsWs(*(c)); (c)++)
 // ignore spaces between CJK glyphs but not between Latin, Greek, Cyrillic, etc. letters
@@ -34,10 +43,21 @@ TextSearch::~TextSearch() {
 
 void TextSearch::Reset() {
     pageText = nullptr;
+    pageTextPin.Reset();
     TextSelection::Reset();
 }
 
+// pageText remains pinned until another page's text is loaded
+const WCHAR* TextSearch::LoadPageText(int pageNo, int* lenOut) {
+    pageTextPin.Set(textCache, pageNo);
+    pageText = textCache->GetTextForPage(pageNo, lenOut);
+    return pageText;
+}
+
 void TextSearch::SetText(const WCHAR* text) {
+    bool prevMatchWordStart = this->matchWordStart;
+    bool prevMatchWordEnd = this->matchWordEnd;
+
     // search text starting with a single space enables the 'Match word start'
     // and search text ending in a single space enables the 'Match word end' option
     // (that behavior already "kind of" exists without special treatment, but
@@ -52,6 +72,12 @@ void TextSearch::SetText(const WCHAR* text) {
     if (str::Eq(this->lastText, text))
         return;
 
+    // when the text is only being extended (as it is while typing), pages
+    // without a match for the previous text can't match the new one either
+    // (unless the whole-word options have been relaxed)
+    bool refines = lastText && str::StartsWith(text, lastText) && !prevMatchWordEnd &&
+                   (this->matchWordStart || !prevMatchWordStart);
+
     this->Clear();
     this->lastText = str::Dup(text);
     this->findText = str::Dup(text);
@@ -76,7 +102,22 @@ void TextSearch::SetText(const WCHAR* text) {
     if (str::EndsWith(this->findText, L" "))
         this->findText[str::Len(this->findText) - 1] = '\0';
 
-    markAllPagesNonSkip(pagesToSkip);
+    anchorTrigrams.Reset();
+    if (anchor) {
+        TextIndex::GetTrigrams(anchor, anchorTrigrams);
+        foldedAnchor = str::Dup(anchor);
+        CharLowerBuffW(foldedAnchor, (DWORD)str::Len(foldedAnchor));
+    }
+
+    // the document might have gained pages since the last search
+    if (nPages != textCache->nPages) {
+        nPages = textCache->nPages;
+        pagesToSkip.SetSize(nPages);
+        refines = false;
+    }
+    if (!refines) {
+        markAllPagesNonSkip(pagesToSkip);
+    }
 }
 
 void TextSearch::SetSensitive(bool sensitive) {
@@ -103,6 +144,10 @@ void TextSearch::SetDirection(TextSearchDirection direction) {
     }
 }
 
+void TextSearch::SetTextIndex(TextIndex* index) {
+    textIndex = index;
+}
+
 void TextSearch::SetLastResult(TextSelection* sel) {
     CopySelection(sel);
 
@@ -112,7 +157,7 @@ void TextSearch::SetLastResult(TextSelection* sel) {
 
     searchHitStartAt = findPage = std::min(startPage, endPage);
     findIndex = (findPage == startPage ? startGlyph : endGlyph) + (int)str::Len(findText);
-    pageText = textCache->GetTextForPage(findPage);
+    LoadPageText(findPage);
     forward = true;
 }
 
@@ -123,6 +168,8 @@ TextSearch::PageAndOffset TextSearch::MatchEnd(const WCHAR* start) const {
     const PageAndOffset notFound = {-1, -1};
     int currentPage = findPage;
     const WCHAR* currentPageText = pageText;
+    // pins the text of the following pages the match continues on
+    PageTextPin currentPagePin;
     bool lookingAtWs;
 
     if (matchWordStart && start > pageText && isWordChar(start[-1]) && isWordChar(start[0]))
@@ -163,6 +210,7 @@ TextSearch::PageAndOffset TextSearch::MatchEnd(const WCHAR* start) const {
             // ... or because we were looking at whitespace in the pattern and we were at a page break
             // -> skip to next page
             ++currentPage;
+            currentPagePin.Set(textCache, currentPage);
             end = currentPageText = textCache->GetTextForPage(currentPage);
         }
         // treat "??" and "? ?" differently, since '?' could have been a word
@@ -175,6 +223,7 @@ TextSearch::PageAndOffset TextSearch::MatchEnd(const WCHAR* start) const {
             while ((!*end) && (currentPage < nPages)) {
                 // treat page break as whitespace, too
                 ++currentPage;
+                currentPagePin.Set(textCache, currentPage);
                 end = currentPageText = textCache->GetTextForPage(currentPage);
                 SkipWhitespace(end);
             }
@@ -187,6 +236,120 @@ TextSearch::PageAndOffset TextSearch::MatchEnd(const WCHAR* start) const {
     return {currentPage, off};
 }
 
+// search kernels for finding the anchor in a page's text: the SIMD versions
+// check 8 resp. 16 positions at once for whether both the first and the last
+// character of the needle match and only compare the whole needle there
+
+static const WCHAR* FindForwardScalar(const WCHAR* s, size_t sLen, const WCHAR* needle, size_t nLen) {
+    if (nLen == 0 || nLen > sLen) {
+        return nullptr;
+    }
+    WCHAR first = needle[0];
+    const WCHAR* last = s + sLen - nLen;
+    for (const WCHAR* c = s; c <= last; c++) {
+        if (*c == first && wmemcmp(c + 1, needle + 1, nLen - 1) == 0) {
+            return c;
+        }
+    }
+    return nullptr;
+}
+
+// mask has 2 bits set for every matching WCHAR position
+static const WCHAR* VerifyCandidates(const WCHAR* s, u32 mask, const WCHAR* needle, size_t nLen) {
+    while (mask) {
+        unsigned long bit;
+        _BitScanForward(&bit, mask);
+        const WCHAR* c = s + bit / 2;
+        if (wmemcmp(c + 1, needle + 1, nLen - 2) == 0) {
+            return c;
+        }
+        mask &= mask - 1;
+    }
+    return nullptr;
+}
+
+static const WCHAR* FindForwardSSE2(const WCHAR* s, size_t sLen, const WCHAR* needle, size_t nLen) {
+    if (nLen < 2 || nLen > sLen) {
+        return FindForwardScalar(s, sLen, needle, nLen);
+    }
+    __m128i first = _mm_set1_epi16((short)needle[0]);
+    __m128i last = _mm_set1_epi16((short)needle[nLen - 1]);
+    size_t i = 0;
+    for (; i + 8 + nLen - 1 <= sLen; i += 8) {
+        __m128i b1 = _mm_loadu_si128((const __m128i*)(s + i));
+        __m128i b2 = _mm_loadu_si128((const __m128i*)(s + i + nLen - 1));
+        __m128i eq = _mm_and_si128(_mm_cmpeq_epi16(b1, first), _mm_cmpeq_epi16(b2, last));
+        u32 mask = (u32)_mm_movemask_epi8(eq) & 0x5555;
+        const WCHAR* found = VerifyCandidates(s + i, mask, needle, nLen);
+        if (found) {
+            return found;
+        }
+    }
+    return FindForwardScalar(s + i, sLen - i, needle, nLen);
+}
+
+#if !defined(_M_ARM64)
+static const WCHAR* FindForwardAVX2(const WCHAR* s, size_t sLen, const WCHAR* needle, size_t nLen) {
+    if (nLen < 2 || nLen > sLen) {
+        return FindForwardScalar(s, sLen, needle, nLen);
+    }
+    __m256i first = _mm256_set1_epi16((short)needle[0]);
+    __m256i last = _mm256_set1_epi16((short)needle[nLen - 1]);
+    size_t i = 0;
+    for (; i + 16 + nLen - 1 <= sLen; i += 16) {
+        __m256i b1 = _mm256_loadu_si256((const __m256i*)(s + i));
+        __m256i b2 = _mm256_loadu_si256((const __m256i*)(s + i + nLen - 1));
+        __m256i eq = _mm256_and_si256(_mm256_cmpeq_epi16(b1, first), _mm256_cmpeq_epi16(b2, last));
+        u32 mask = (u32)_mm256_movemask_epi8(eq) & 0x55555555;
+        const WCHAR* found = VerifyCandidates(s + i, mask, needle, nLen);
+        if (found) {
+            return found;
+        }
+    }
+    return FindForwardSSE2(s + i, sLen - i, needle, nLen);
+}
+#endif
+
+typedef const WCHAR* (*FindForwardFunc)(const WCHAR* s, size_t sLen, const WCHAR* needle, size_t nLen);
+
+static FindForwardFunc GetFindForwardFunc() {
+#if defined(_M_ARM64)
+    // NEON is always available (cf. Sse2Neon.h)
+    return FindForwardSSE2;
+#else
+    if (CpuHasAVX2()) {
+        return FindForwardAVX2;
+    }
+    if (IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE)) {
+        return FindForwardSSE2;
+    }
+    return FindForwardScalar;
+#endif
+}
+
+// returns the first occurrence of needle in s[0..sLen)
+static const WCHAR* FindForward(const WCHAR* s, size_t sLen, const WCHAR* needle, size_t nLen) {
+    // initialization of function-local statics is thread-safe
+    static FindForwardFunc fn = GetFindForwardFunc();
+    return fn(s, sLen, needle, nLen);
+}
+
+// returns the last occurrence of needle in s[0..sLen) starting before s + end
+static const WCHAR* FindBackward(const WCHAR* s, size_t sLen, size_t end, const WCHAR* needle, size_t nLen) {
+    if (nLen == 0 || nLen > sLen) {
+        return nullptr;
+    }
+    WCHAR first = needle[0];
+    size_t pos = std::min(end, sLen - nLen + 1);
+    while (pos > 0) {
+        pos--;
+        if (s[pos] == first && wmemcmp(s + pos + 1, needle + 1, nLen - 1) == 0) {
+            return s + pos;
+        }
+    }
+    return nullptr;
+}
+
 static const WCHAR* GetNextIndex(const WCHAR* base, int offset, bool forward) {
     const WCHAR* c = base + offset + (forward ? 0 : -1);
     if (c < base || !*c)
@@ -203,21 +366,35 @@ bool TextSearch::FindTextInPage(int pageNo, TextSearch::PageAndOffset* finalGlyp
     // get here with pageNo != 0 the findText has already been set so I didn't add
     // a findText = textCache->GetData(findPage) here.
     findPage = pageNo;
+    // the page's text might have been evicted from the cache since the last search
+    LoadPageText(pageNo);
 
     const WCHAR* found;
     PageAndOffset fg;
     do {
         if (!anchor) {
             found = GetNextIndex(pageText, findIndex, forward);
-        } else if (forward) {
-            const WCHAR* s = pageText + findIndex;
-            if (caseSensitive) {
-                found = StrStr(s, anchor);
+        } else {
+            // backward searches ignore the case in any case (MatchEnd compares it)
+            bool useFolded = !caseSensitive || !forward;
+            int len = 0;
+            const WCHAR* text = nullptr;
+            if (useFolded) {
+                text = textCache->GetFoldedTextForPage(pageNo, &len);
             } else {
-                found = StrStrI(s, anchor);
+                text = textCache->GetTextForPage(pageNo, &len);
             }
-        } else {
-            found = StrRStrI(pageText, pageText + findIndex, anchor);
+            const WCHAR* needle = useFolded ? foldedAnchor : anchor;
+            size_t nLen = str::Len(needle);
+            int idx = limitValue(findIndex, 0, len);
+            const WCHAR* hit = nullptr;
+            if (forward) {
+                hit = FindForward(text + idx, len - idx, needle, nLen);
+            } else {
+                hit = FindBackward(text, len, idx, needle, nLen);
+            }
+            // both texts have the same length
+            found = hit ? pageText + (hit - text) : nullptr;
         }
         if (!found)
             return false;
@@ -241,10 +418,22 @@ bool TextSearch::FindTextInPage(int pageNo, TextSearch::PageAndOffset* finalGlyp
     return true;
 }
 
+// leave one core for the UI and for extracting the current page
+int GetTextPrefetchThreads() {
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return std::max((int)si.dwNumberOfProcessors - 1, 1);
+}
+
 bool TextSearch::FindStartingAtPage(int pageNo, ProgressUpdateUI* tracker) {
     if (str::IsEmpty(findText))
         return false;
 
+    // extract the text of the pages still to be searched in parallel
+    if (1 <= pageNo && pageNo <= nPages && !textCache->HasTextForPage(pageNo)) {
+        textCache->PrefetchRange(pageNo, forward ? nPages : 1, GetTextPrefetchThreads());
+    }
+
     int next = forward ? 1 : -1;
     while (1 <= pageNo && pageNo <= nPages && (!tracker || !tracker->WasCanceled())) {
         if (tracker) {
@@ -255,11 +444,17 @@ bool TextSearch::FindStartingAtPage(int pageNo, ProgressUpdateUI* tracker) {
             pageNo += next;
             continue;
         }
+        // the search text always starts with the anchor, so pages
+        // which don't contain it can be skipped without scanning their text
+        if (textIndex && anchorTrigrams.size() > 0 && !textIndex->MightContain(pageNo, anchorTrigrams)) {
+            pagesToSkip[pageNo - 1] = true;
+            pageNo += next;
+            continue;
+        }
 
         Reset();
 
-        pageText = textCache->GetTextForPage(pageNo, &findIndex);
-        if (pageText) {
+        if (LoadPageText(pageNo, &findIndex)) {
             if (forward) {
                 findIndex = 0;
             }
@@ -268,7 +463,7 @@ bool TextSearch::FindStartingAtPage(int pageNo, ProgressUpdateUI* tracker) {
                 if (forward) {
                     if (findPage != r.page) {
                         findPage = r.page;
-                        pageText = textCache->GetTextForPage(findPage);
+                        LoadPageText(findPage);
                     }
                     findIndex = r.offset;
                 }
@@ -280,6 +475,10 @@ bool TextSearch::FindStartingAtPage(int pageNo, ProgressUpdateUI* tracker) {
         pageNo += next;
     }
 
+    if (tracker && tracker->WasCanceled()) {
+        textCache->StopPrefetching();
+    }
+
     // allow for the first/last page to be included in the next search
     searchHitStartAt = findPage = forward ? nPages + 1 : 0;
 
@@ -311,7 +510,7 @@ TextSel* TextSearch::FindNext(ProgressUpdateUI* tracker) {
         if (forward) {
             findPage = finalGlyph.page;
             findIndex = finalGlyph.offset;
-            pageText = textCache->GetTextForPage(findPage);
+            LoadPageText(findPage);
         }
         return &result;
     }
@@ -322,3 +521,78 @@ TextSel* TextSearch::FindNext(ProgressUpdateUI* tracker) {
     }
     return nullptr;
 }
+
+bool TextSearch::FindAll(const WCHAR* text, Vec<TextSearchHit>& hitsOut, ProgressUpdateUI* tracker) {
+    SetText(text);
+    if (str::IsEmpty(findText)) {
+        return true;
+    }
+    bool wasForward = forward;
+    forward = true;
+
+    textCache->PrefetchRange(1, nPages, GetTextPrefetchThreads());
+
+    // a hit that spans pages ends at this offset of the next page
+    int nextPageStart = 0;
+    int lastPercent = -1;
+    for (int pageNo = 1; pageNo <= nPages; pageNo++) {
+        if (tracker) {
+            if (tracker->WasCanceled()) {
+                break;
+            }
+            // only report progress when it changes visibly (each update is posted to the UI thread)
+            int percent = pageNo * 100 / nPages;
+            if (percent != lastPercent) {
+                tracker->UpdateProgress(pageNo, nPages);
+                lastPercent = percent;
+            }
+        }
+
+        int startIndex = nextPageStart;
+        nextPageStart = 0;
+        if (pagesToSkip[pageNo - 1]) {
+            continue;
+        }
+        if (textIndex && anchorTrigrams.size() > 0 && !textIndex->MightContain(pageNo, anchorTrigrams)) {
+            pagesToSkip[pageNo - 1] = true;
+            continue;
+        }
+
+        Reset();
+        if (!LoadPageText(pageNo)) {
+            continue;
+        }
+        findIndex = startIndex;
+        bool foundAny = false;
+        PageAndOffset r;
+        while (FindTextInPage(pageNo, &r)) {
+            foundAny = true;
+            TextSearchHit hit;
+            GetGlyphRange(&hit.startPage, &hit.startGlyph, &hit.endPage, &hit.endGlyph);
+            if (result.len > 0) {
+                hit.rect = result.rects[0];
+            }
+            hitsOut.Append(hit);
+            if (r.page != pageNo) {
+                // nothing else can follow on this page
+                nextPageStart = r.offset;
+                break;
+            }
+        }
+        if (!foundAny && startIndex == 0) {
+            pagesToSkip[pageNo - 1] = true;
+        }
+    }
+
+    bool canceled = tracker && tracker->WasCanceled();
+    if (canceled) {
+        textCache->StopPrefetching();
+    }
+
+    Reset();
+    forward = wasForward;
+    findIndex = 0;
+    // make the next FindNext start at the first resp. last page
+    searchHitStartAt = findPage = 0;
+    return !canceled;
+}
@@ -3,6 +3,21 @@
 
 enum class TextSearchDirection : bool { Backward = false, Forward = true };
 
+class TextIndex;
+
+// number of threads to use for DocumentTextCache::PrefetchRange
+int GetTextPrefetchThreads();
+
+// position of a search hit, as a range of glyphs (from FindAll)
+struct TextSearchHit {
+    int startPage = 0;
+    int startGlyph = 0;
+    int endPage = 0;
+    int endGlyph = 0;
+    // bounding box (in user coordinates) of the hit's first line
+    Rect rect;
+};
+
 class TextSearch : public TextSelection {
   public:
     TextSearch(EngineBase* engine, DocumentTextCache* textCache);
@@ -11,8 +26,14 @@ class TextSearch : public TextSelection {
     void SetSensitive(bool sensitive);
     void SetDirection(TextSearchDirection direction);
     void SetLastResult(TextSelection* sel);
+    // allows skipping pages which can't contain the search text (the index isn't owned)
+    void SetTextIndex(TextIndex* index);
     TextSel* FindFirst(int page, const WCHAR* text, ProgressUpdateUI* tracker = nullptr);
     TextSel* FindNext(ProgressUpdateUI* tracker = nullptr);
+    // searches the whole document once (forward) and appends all hits to hitsOut.
+    // afterwards, the next FindNext starts over at the first page.
+    // returns false if the search was canceled
+    bool FindAll(const WCHAR* text, Vec<TextSearchHit>& hitsOut, ProgressUpdateUI* tracker = nullptr);
 
     // note: the result might not be a valid page number!
     int GetCurrentPageNo() const {
@@ -33,6 +54,8 @@ class TextSearch : public TextSelection {
 
     WCHAR* findText = nullptr;
     WCHAR* anchor = nullptr;
+    // lower-cased anchor for searching the case-folded page text
+    WCHAR* foldedAnchor = nullptr;
     int findPage = 0;
     int searchHitStartAt = 0; // when text found spans several pages, searchHitStartAt < findPage
     bool forward = true;
@@ -46,21 +69,29 @@ class TextSearch : public TextSelection {
     void SetText(const WCHAR* text);
     bool FindTextInPage(int pageNo, PageAndOffset* finalGlyph);
     bool FindStartingAtPage(int pageNo, ProgressUpdateUI* tracker);
+    const WCHAR* LoadPageText(int pageNo, int* lenOut = nullptr);
     PageAndOffset MatchEnd(const WCHAR* start) const;
 
     void Clear() {
         str::ReplacePtr(&findText, nullptr);
         str::ReplacePtr(&anchor, nullptr);
+        str::ReplacePtr(&foldedAnchor, nullptr);
         str::ReplacePtr(&lastText, nullptr);
         Reset();
     }
     void Reset();
 
   private:
+    // the text of findPage (owned by textCache, which pageTextPin keeps from evicting it)
     const WCHAR* pageText = nullptr;
+    PageTextPin pageTextPin;
     int findIndex = 0;
 
     WCHAR* lastText = nullptr;
     int nPages = 0;
     Vec<bool> pagesToSkip;
+
+    TextIndex* textIndex = nullptr;
+    // trigrams of anchor for looking up candidate pages in textIndex
+    Vec<u32> anchorTrigrams;
 };
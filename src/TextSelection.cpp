@@ -3,6 +3,8 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
+#include "utils/FileUtil.h"
+#include "utils/ThreadUtil.h"
 
 #include "wingui/TreeModel.h"
 
@@ -10,60 +12,804 @@
 #include "EngineBase.h"
 #include "TextSelection.h"
 
+#define SAVED_TEXT_MAGIC 0x31585453 // "STX1"
+
+// a file saved by DocumentTextCache::SaveToFile consists of this header followed by
+// a SavedPageText for every page and by the pages' zero-terminated text and packed
+// coordinates (offsets are from the start of the file)
+struct SavedTextHeader {
+    u32 magic;
+    int nPages;
+};
+
+struct SavedPageText {
+    // 0 if the page's text hasn't been saved
+    u32 textOffset;
+    int len;
+    u32 coordsOffset;
+    int coordsSize;
+};
+
+static size_t PageTextSize(PageText* pageText) {
+    // saved text is paged in and out of memory by the OS as needed
+    size_t size = 0;
+    if (!pageText->isSaved) {
+        size += (pageText->len + 1) * sizeof(WCHAR) + pageText->packedCoordsSize;
+    }
+    if (pageText->foldedText) {
+        size += (pageText->len + 1) * sizeof(WCHAR);
+    }
+    if (pageText->glyphGrid) {
+        size += pageText->glyphGrid->Size();
+    }
+    if (pageText->lineBreaks) {
+        size += (pageText->nLineBreaks + 1) * sizeof(int);
+    }
+    return size;
+}
+
+static void FreePageText(PageText* pageText) {
+    if (!pageText->isSaved) {
+        free(pageText->packedCoords);
+        free(pageText->text);
+    }
+    free(pageText->foldedText);
+    delete pageText->glyphGrid;
+    free(pageText->lineBreaks);
+    int nPins = pageText->nPins;
+    ZeroMemory(pageText, sizeof(*pageText));
+    pageText->nPins = nPins;
+}
+
 DocumentTextCache::DocumentTextCache(EngineBase* engine) : engine(engine) {
     nPages = engine->PageCount();
     pagesText = AllocArray<PageText>(nPages);
-    debugSize = nPages * (sizeof(Rect*) + sizeof(WCHAR*) + sizeof(int));
+    cachedSize = nPages * sizeof(PageText);
 
     InitializeCriticalSection(&access);
 }
 
 DocumentTextCache::~DocumentTextCache() {
+    StopPrefetching();
     EnterCriticalSection(&access);
 
-    int nPages = engine->PageCount();
     for (int i = 0; i < nPages; i++) {
-        PageText* pageText = &pagesText[i];
-        free(pageText->coords);
-        free(pageText->text);
+        FreePageText(&pagesText[i]);
     }
     free(pagesText);
+    delete savedText;
+    DeleteVecMembers(releasedSavedText);
+    free(savePath);
     LeaveCriticalSection(&access);
     DeleteCriticalSection(&access);
 }
 
+// for engines which add pages while laying out a document in the background
+void DocumentTextCache::SetPageCount(int newCount) {
+    ScopedCritSec scope(&access);
+    if (newCount <= nPages) {
+        return;
+    }
+    PageText* newPagesText = (PageText*)realloc(pagesText, newCount * sizeof(PageText));
+    if (!newPagesText) {
+        return;
+    }
+    ZeroMemory(newPagesText + nPages, (newCount - nPages) * sizeof(PageText));
+    pagesText = newPagesText;
+    cachedSize += (newCount - nPages) * sizeof(PageText);
+    nPages = newCount;
+}
+
 bool DocumentTextCache::HasTextForPage(int pageNo) {
     CrashIf(pageNo < 1 || pageNo > nPages);
+    ScopedCritSec scope(&access);
     PageText* pageText = &pagesText[pageNo - 1];
-    return pageText->text != nullptr;
+    return pageText->text != nullptr || RestoreSavedText(pageNo);
 }
 
-const WCHAR* DocumentTextCache::GetTextForPage(int pageNo, int* lenOut, Rect** coordsOut) {
+void DocumentTextCache::PinPage(int pageNo) {
     CrashIf(pageNo < 1 || pageNo > nPages);
+    ScopedCritSec scope(&access);
+    pagesText[pageNo - 1].nPins++;
+}
+
+void DocumentTextCache::UnpinPage(int pageNo) {
+    CrashIf(pageNo < 1 || pageNo > nPages);
+    ScopedCritSec scope(&access);
+    CrashIf(pagesText[pageNo - 1].nPins <= 0);
+    pagesText[pageNo - 1].nPins--;
+}
+
+PageTextPin::PageTextPin(DocumentTextCache* textCache, int pageNo) {
+    Set(textCache, pageNo);
+}
+
+PageTextPin::~PageTextPin() {
+    Reset();
+}
+
+void PageTextPin::Set(DocumentTextCache* textCache, int pageNo) {
+    if (textCache == this->textCache && pageNo == this->pageNo) {
+        return;
+    }
+    // pinned first, so that the text remains cached when pinning the same page again
+    textCache->PinPage(pageNo);
+    Reset();
+    this->textCache = textCache;
+    this->pageNo = pageNo;
+}
+
+void PageTextPin::Reset() {
+    if (textCache) {
+        textCache->UnpinPage(pageNo);
+    }
+    textCache = nullptr;
+    pageNo = 0;
+}
+
+const WCHAR* DocumentTextCache::GetFoldedTextForPage(int pageNo, int* lenOut) {
+    // keeps the text from being evicted until the folded copy has been made
+    PageTextPin pin(this, pageNo);
+    int len = 0;
+    GetTextForPage(pageNo, &len);
 
     ScopedCritSec scope(&access);
     PageText* pageText = &pagesText[pageNo - 1];
+    if (!pageText->foldedText) {
+        pageText->foldedText = str::DupN(pageText->text, len);
+        CharLowerBuffW(pageText->foldedText, (DWORD)len);
+        cachedSize += (len + 1) * sizeof(WCHAR);
+    }
+    if (lenOut) {
+        *lenOut = len;
+    }
+    return pageText->foldedText;
+}
+
+const int* DocumentTextCache::GetLineBreaksForPage(int pageNo, int* countOut) {
+    PageTextPin pin(this, pageNo);
+    int len = 0;
+    GetTextForPage(pageNo, &len);
+
+    ScopedCritSec scope(&access);
+    PageText* pageText = &pagesText[pageNo - 1];
+    if (!pageText->lineBreaks) {
+        int n = 0;
+        for (int i = 0; i < len; i++) {
+            if (pageText->text[i] == '\n') {
+                n++;
+            }
+        }
+        pageText->lineBreaks = AllocArray<int>((size_t)n + 1);
+        pageText->nLineBreaks = 0;
+        for (int i = 0; i < len; i++) {
+            if (pageText->text[i] == '\n') {
+                pageText->lineBreaks[pageText->nLineBreaks++] = i;
+            }
+        }
+        cachedSize += (n + 1) * sizeof(int);
+    }
+    *countOut = pageText->nLineBreaks;
+    return pageText->lineBreaks;
+}
+
+void DocumentTextCache::PrefetchRange(int from, int to, int nThreads) {
+    CrashIf(from < 1 || from > nPages || to < 1 || to > nPages);
+    if (IsPrefetching()) {
+        return;
+    }
+    StopPrefetching();
+
+    prefetchFrom = from;
+    prefetchStep = from <= to ? 1 : -1;
+    prefetchCount = abs(to - from) + 1;
+    prefetchNext = 0;
+    stopPrefetching = false;
+    prefetchToken = new CancelToken();
+    nThreads = limitValue(nThreads, 1, MAX_TEXT_PREFETCH_THREADS);
+    for (int i = 0; i < nThreads; i++) {
+        QueueWork(
+            WorkPriority::Prefetch,
+            [this] {
+                InterlockedIncrement(&nRunningPrefetchers);
+                PrefetchPages();
+                InterlockedDecrement(&nRunningPrefetchers);
+            },
+            prefetchToken);
+    }
+}
+
+// true if any prefetching work is still queued or running
+bool DocumentTextCache::IsPrefetching() {
+    return prefetchToken && prefetchToken->IsBusy();
+}
+
+void DocumentTextCache::StopPrefetching() {
+    stopPrefetching = true;
+    if (prefetchToken) {
+        prefetchToken->Cancel();
+        prefetchToken->Wait();
+        prefetchToken->Release();
+        prefetchToken = nullptr;
+    }
+}
+
+void DocumentTextCache::TakeUnchangedPages(DocumentTextCache* prev) {
+    prev->StopPrefetching();
+    Vec<int> pages;
+    {
+        ScopedCritSec scope(&prev->access);
+        for (int i = 0; i < prev->nPages && i < nPages; i++) {
+            if (prev->pagesText[i].text) {
+                pages.Append(i + 1);
+            }
+        }
+    }
+    // determined without holding the locks, as that requires the engines' locks
+    Vec<int> unchangedPages;
+    for (int pageNo : pages) {
+        if (IsPageUnchanged(prev->engine, engine, pageNo)) {
+            unchangedPages.Append(pageNo);
+        }
+    }
+
+    ScopedCritSec scope1(&prev->access);
+    ScopedCritSec scope2(&access);
+    for (int pageNo : unchangedPages) {
+        PageText* src = &prev->pagesText[pageNo - 1];
+        PageText* dst = &pagesText[pageNo - 1];
+        // the text of pinned pages is still in use
+        if (!src->text || dst->text || src->nPins > 0) {
+            continue;
+        }
+        size_t size = PageTextSize(src);
+        int nPins = dst->nPins;
+        *dst = *src;
+        dst->nPins = nPins;
+        if (src->isSaved) {
+            // the saved text is released along with prev
+            dst->text = str::DupN(src->text, src->len);
+            dst->packedCoords = src->packedCoords ? (u8*)memdup(src->packedCoords, src->packedCoordsSize) : nullptr;
+            dst->isSaved = false;
+        }
+        dst->lastUsed = ++useCount;
+        ZeroMemory(src, sizeof(*src));
+        prev->cachedSize -= size;
+        cachedSize += PageTextSize(dst);
+        hasUnsavedText = true;
+    }
+    EvictLeastRecentlyUsed();
+}
+
+void DocumentTextCache::FreeAllText() {
+    if (IsPrefetching()) {
+        return;
+    }
+    // releases the token of the finished prefetching
+    StopPrefetching();
 
+    ScopedCritSec scope(&access);
+    for (int i = 0; i < nPages; i++) {
+        if (pagesText[i].text && pagesText[i].nPins == 0) {
+            cachedSize -= PageTextSize(&pagesText[i]);
+            FreePageText(&pagesText[i]);
+        }
+    }
+}
+
+void DocumentTextCache::PrefetchPages() {
+    // extraction on the same engine is serialized by the engine,
+    // so each thread needs an engine of its own
+    EngineBase* clone = engine->Clone();
+    if (!clone) {
+        return;
+    }
+    while (!stopPrefetching) {
+        int idx = (int)InterlockedIncrement(&prefetchNext) - 1;
+        if (idx >= prefetchCount) {
+            break;
+        }
+        int pageNo = prefetchFrom + idx * prefetchStep;
+        if (HasTextForPage(pageNo)) {
+            continue;
+        }
+        ExtractTextForPage(clone, pageNo);
+    }
+    delete clone;
+}
+
+// Glyph coordinates take most of the memory of the cached text, so they're
+// stored delta-encoded: consecutive glyphs mostly share the same line (y and dy)
+// and follow each other closely, so that a glyph usually only needs 3 bytes
+// instead of sizeof(Rect): a byte of flags followed by varints for the
+// x offset from the end of the previous glyph and for the values that changed
+#define COORD_EMPTY 0x1
+#define COORD_SAME_DX 0x2
+#define COORD_SAME_Y 0x4
+#define COORD_SAME_DY 0x8
+
+static void AppendVarint(Vec<u8>& data, int n) {
+    // zigzag encoding, so that small negative numbers are short as well
+    u32 v = ((u32)n << 1) ^ (u32)(n >> 31);
+    while (v >= 0x80) {
+        data.Append((u8)(v | 0x80));
+        v >>= 7;
+    }
+    data.Append((u8)v);
+}
+
+static int ReadVarint(const u8*& data, const u8* end) {
+    u32 v = 0;
+    for (int shift = 0; data < end && shift < 35; shift += 7) {
+        u8 b = *data++;
+        v |= (u32)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            break;
+        }
+    }
+    return (int)(v >> 1) ^ -(int)(v & 1);
+}
+
+// caller must free() the result
+static u8* PackCoords(const Rect* coords, int len, int* sizeOut) {
+    *sizeOut = 0;
+    if (!coords || len == 0) {
+        return nullptr;
+    }
+    Vec<u8> data;
+    Rect prev;
+    for (int i = 0; i < len; i++) {
+        const Rect& rc = coords[i];
+        if (!rc.x && !rc.y && !rc.dx && !rc.dy) {
+            data.Append(COORD_EMPTY);
+            continue;
+        }
+        u8 flags = 0;
+        if (rc.dx == prev.dx) {
+            flags |= COORD_SAME_DX;
+        }
+        if (rc.y == prev.y) {
+            flags |= COORD_SAME_Y;
+        }
+        if (rc.dy == prev.dy) {
+            flags |= COORD_SAME_DY;
+        }
+        data.Append(flags);
+        AppendVarint(data, rc.x - (prev.x + prev.dx));
+        if (!(flags & COORD_SAME_DX)) {
+            AppendVarint(data, rc.dx - prev.dx);
+        }
+        if (!(flags & COORD_SAME_Y)) {
+            AppendVarint(data, rc.y - prev.y);
+        }
+        if (!(flags & COORD_SAME_DY)) {
+            AppendVarint(data, rc.dy - prev.dy);
+        }
+        prev = rc;
+    }
+    *sizeOut = (int)data.size();
+    return data.StealData();
+}
+
+static void UnpackCoords(const u8* data, int size, Rect* coords, int len) {
+    const u8* end = data + size;
+    Rect prev;
+    for (int i = 0; i < len && data < end; i++) {
+        u8 flags = *data++;
+        if (flags & COORD_EMPTY) {
+            coords[i] = Rect();
+            continue;
+        }
+        Rect rc;
+        rc.x = prev.x + prev.dx + ReadVarint(data, end);
+        rc.dx = (flags & COORD_SAME_DX) ? prev.dx : prev.dx + ReadVarint(data, end);
+        rc.y = (flags & COORD_SAME_Y) ? prev.y : prev.y + ReadVarint(data, end);
+        rc.dy = (flags & COORD_SAME_DY) ? prev.dy : prev.dy + ReadVarint(data, end);
+        coords[i] = rc;
+        prev = rc;
+    }
+}
+
+// extracts the text without holding the lock, so that the text of
+// other pages can be extracted and retrieved in the meantime
+void DocumentTextCache::ExtractTextForPage(EngineBase* engine, int pageNo) {
+    Rect* coords = nullptr;
+    WCHAR* text = engine->ExtractPageText(pageNo, &coords);
+    int packedSize = 0;
+    u8* packed = PackCoords(coords, text ? (int)str::Len(text) : 0, &packedSize);
+    free(coords);
+
+    ScopedCritSec scope(&access);
+    SetTextForPage(pageNo, text, packed, packedSize);
+}
+
+// takes ownership of text and packedCoords
+// Note: make sure to only call with access
+void DocumentTextCache::SetTextForPage(int pageNo, WCHAR* text, u8* packedCoords, int packedCoordsSize) {
+    PageText* pageText = &pagesText[pageNo - 1];
+    if (pageText->text) {
+        // the text has been extracted concurrently
+        free(text);
+        free(packedCoords);
+        return;
+    }
+    pageText->text = text;
+    pageText->packedCoords = packedCoords;
+    pageText->packedCoordsSize = packedCoordsSize;
     if (!pageText->text) {
-        pageText->text = engine->ExtractPageText(pageNo, &pageText->coords);
-        if (!pageText->text) {
-            pageText->text = str::Dup(L"");
-            pageText->len = 0;
-        } else {
-            pageText->len = (int)str::Len(pageText->text);
+        pageText->text = str::Dup(L"");
+        pageText->len = 0;
+    } else {
+        pageText->len = (int)str::Len(pageText->text);
+    }
+    pageText->lastUsed = ++useCount;
+    cachedSize += PageTextSize(pageText);
+    hasUnsavedText = true;
+    EvictLeastRecentlyUsed();
+}
+
+void DocumentTextCache::LoadFromFile(const WCHAR* path) {
+    ScopedCritSec scope(&access);
+    ReleaseSavedText();
+    str::ReplacePtr(&savePath, path);
+    if (!path) {
+        return;
+    }
+
+    auto file = new file::MappedFile(path);
+    std::string_view data = file->Data();
+    const SavedTextHeader* hdr = (const SavedTextHeader*)data.data();
+    size_t maxPages = 0;
+    if (data.size() >= sizeof(SavedTextHeader) && data.size() <= UINT32_MAX) {
+        maxPages = (data.size() - sizeof(SavedTextHeader)) / sizeof(SavedPageText);
+    }
+    if (!maxPages || hdr->magic != SAVED_TEXT_MAGIC || hdr->nPages <= 0 || (size_t)hdr->nPages > maxPages) {
+        delete file;
+        return;
+    }
+    // the text itself is only validated once it's needed, so that
+    // loading doesn't require reading the entire file
+    savedText = file;
+    savedPages = (const SavedPageText*)(hdr + 1);
+    nSavedPages = hdr->nPages;
+}
+
+// gives a page the text loaded by LoadFromFile (if there is any)
+// Note: make sure to only call with access
+bool DocumentTextCache::RestoreSavedText(int pageNo) {
+    if (pageNo > nSavedPages) {
+        return false;
+    }
+    const SavedPageText& saved = savedPages[pageNo - 1];
+    std::string_view data = savedText->Data();
+    if (!saved.textOffset || saved.len < 0 || saved.coordsSize < 0 || saved.textOffset % sizeof(WCHAR) != 0) {
+        return false;
+    }
+    u64 textEnd = (u64)saved.textOffset + ((u64)saved.len + 1) * sizeof(WCHAR);
+    u64 coordsEnd = (u64)saved.coordsOffset + (u64)saved.coordsSize;
+    if (textEnd > data.size() || coordsEnd > data.size()) {
+        return false;
+    }
+    WCHAR* text = (WCHAR*)(data.data() + saved.textOffset);
+    if (text[saved.len] != 0) {
+        return false;
+    }
+
+    PageText* pageText = &pagesText[pageNo - 1];
+    pageText->text = text;
+    pageText->len = saved.len;
+    pageText->packedCoords = saved.coordsSize > 0 ? (u8*)(data.data() + saved.coordsOffset) : nullptr;
+    pageText->packedCoordsSize = saved.coordsSize;
+    pageText->isSaved = true;
+    pageText->lastUsed = ++useCount;
+    cachedSize += PageTextSize(pageText);
+    return true;
+}
+
+// Note: make sure to only call with access
+void DocumentTextCache::ReleaseSavedText() {
+    bool keepSavedText = false;
+    for (int i = 0; i < nPages; i++) {
+        PageText* pageText = &pagesText[i];
+        if (!pageText->isSaved) {
+            continue;
         }
-        debugSize += (pageText->len + 1) * (sizeof(WCHAR) + sizeof(Rect));
+        if (pageText->nPins > 0) {
+            // the text of pinned pages is still in use and keeps pointing into the file
+            keepSavedText = true;
+            continue;
+        }
+        cachedSize -= PageTextSize(pageText);
+        FreePageText(pageText);
+    }
+    if (keepSavedText && savedText) {
+        releasedSavedText.Append(savedText);
+    } else {
+        delete savedText;
     }
+    savedText = nullptr;
+    savedPages = nullptr;
+    nSavedPages = 0;
+}
+
+bool DocumentTextCache::SaveToFile() {
+    StopPrefetching();
 
+    AutoFreeWstr path;
+    Vec<SavedPageText> pages;
+    str::Str text;
+    {
+        ScopedCritSec scope(&access);
+        if (!savePath || !hasUnsavedText) {
+            return false;
+        }
+        u64 offset = sizeof(SavedTextHeader) + (u64)nPages * sizeof(SavedPageText);
+        for (int pageNo = 1; pageNo <= nPages; pageNo++) {
+            SavedPageText saved{};
+            PageText* pageText = &pagesText[pageNo - 1];
+            if (pageText->text || RestoreSavedText(pageNo)) {
+                // align the text for reading it from the mapped file
+                if (text.size() % 2 != 0) {
+                    text.AppendChar('\0');
+                }
+                saved.textOffset = (u32)(offset + text.size());
+                saved.len = pageText->len;
+                text.Append((const char*)pageText->text, ((size_t)pageText->len + 1) * sizeof(WCHAR));
+                saved.coordsOffset = (u32)(offset + text.size());
+                saved.coordsSize = pageText->packedCoordsSize;
+                text.Append((const char*)pageText->packedCoords, pageText->packedCoordsSize);
+            }
+            pages.Append(saved);
+            if (offset + text.size() > UINT32_MAX) {
+                return false;
+            }
+        }
+        // the file might have to be replaced
+        ReleaseSavedText();
+        hasUnsavedText = false;
+        path.SetCopy(savePath);
+    }
+
+    SavedTextHeader hdr{SAVED_TEXT_MAGIC, pages.isize()};
+    str::Str data(sizeof(hdr) + pages.size() * sizeof(SavedPageText) + text.size());
+    data.Append((const char*)&hdr, sizeof(hdr));
+    data.Append((const char*)pages.LendData(), pages.size() * sizeof(SavedPageText));
+    data.AppendView(text.AsView());
+    return file::WriteFile(path, data.AsView());
+}
+
+static int cmpPageTextLeastRecentlyUsed(const void* a, const void* b) {
+    PageText* pa = *(PageText**)a;
+    PageText* pb = *(PageText**)b;
+    if (pa->lastUsed == pb->lastUsed) {
+        return 0;
+    }
+    return pa->lastUsed < pb->lastUsed ? -1 : 1;
+}
+
+// Note: make sure to only call with access
+void DocumentTextCache::EvictLeastRecentlyUsed() {
+    if (maxSize == 0 || cachedSize <= maxSize) {
+        return;
+    }
+    // searches extract the text of all pages in the background and then go
+    // through it page by page, so don't evict anything they still need
+    if (nRunningPrefetchers > 0) {
+        return;
+    }
+
+    Vec<PageText*> cached;
+    for (int i = 0; i < nPages; i++) {
+        if (pagesText[i].text && pagesText[i].nPins == 0) {
+            cached.Append(&pagesText[i]);
+        }
+    }
+    cached.Sort(cmpPageTextLeastRecentlyUsed);
+    // evict a bit more than necessary, so that this doesn't
+    // have to be repeated for every newly extracted page
+    size_t targetSize = maxSize / 4 * 3;
+    int nEvictable = cached.isize() - TEXT_CACHE_MIN_PAGES;
+    for (int i = 0; i < nEvictable && cachedSize > targetSize; i++) {
+        cachedSize -= PageTextSize(cached[i]);
+        FreePageText(cached[i]);
+    }
+}
+
+// the returned text remains valid only while the page is pinned
+const WCHAR* DocumentTextCache::GetTextForPage(int pageNo, int* lenOut) {
+    CrashIf(pageNo < 1 || pageNo > nPages);
+
+    ScopedCritSec scope(&access);
+    // the text might have been evicted in the meantime
+    while (!pagesText[pageNo - 1].text && !RestoreSavedText(pageNo)) {
+        LeaveCriticalSection(&access);
+        ExtractTextForPage(engine, pageNo);
+        EnterCriticalSection(&access);
+    }
+    // pagesText might have been reallocated by SetPageCount
+    PageText* pageText = &pagesText[pageNo - 1];
+    pageText->lastUsed = ++useCount;
     if (lenOut) {
         *lenOut = pageText->len;
     }
-    if (coordsOut) {
-        *coordsOut = pageText->coords;
-    }
     return pageText->text;
 }
 
+Rect* DocumentTextCache::GetCoordsForPage(int pageNo, int* lenOut) {
+    PageTextPin pin(this, pageNo);
+    int len = 0;
+    GetTextForPage(pageNo, &len);
+
+    // always return a valid array, so that callers don't have to check
+    Rect* coords = AllocArray<Rect>((size_t)len + 1);
+    ScopedCritSec scope(&access);
+    PageText* pageText = &pagesText[pageNo - 1];
+    UnpackCoords(pageText->packedCoords, pageText->packedCoordsSize, coords, len);
+    if (lenOut) {
+        *lenOut = len;
+    }
+    return coords;
+}
+
+GlyphGrid* DocumentTextCache::GetGlyphGridForPage(int pageNo) {
+    PageTextPin pin(this, pageNo);
+    int len = 0;
+    GetTextForPage(pageNo, &len);
+
+    ScopedCritSec scope(&access);
+    PageText* pageText = &pagesText[pageNo - 1];
+    if (!pageText->glyphGrid) {
+        Rect* coords = AllocArray<Rect>((size_t)len + 1);
+        UnpackCoords(pageText->packedCoords, pageText->packedCoordsSize, coords, len);
+        pageText->glyphGrid = new GlyphGrid(coords, len);
+        cachedSize += pageText->glyphGrid->Size();
+    }
+    return pageText->glyphGrid;
+}
+
+// on average, a cell of a GlyphGrid contains about this many glyphs
+#define GLYPHS_PER_GRID_CELL 4
+
+// line breaks have no coordinates and are never hit
+static bool IsGlyphHittable(const Rect& rc) {
+    return rc.x || rc.dx;
+}
+
+// takes ownership of coords
+GlyphGrid::GlyphGrid(Rect* coords, int len) : coords(coords), len(len) {
+    // note: Rect::Union ignores empty rectangles
+    int nGlyphs = 0;
+    int x0 = INT_MAX, y0 = INT_MAX, x1 = INT_MIN, y1 = INT_MIN;
+    for (int i = 0; i < len; i++) {
+        const Rect& rc = coords[i];
+        if (IsGlyphHittable(rc)) {
+            x0 = std::min(x0, std::min(rc.x, rc.x + rc.dx));
+            y0 = std::min(y0, std::min(rc.y, rc.y + rc.dy));
+            x1 = std::max(x1, std::max(rc.x, rc.x + rc.dx));
+            y1 = std::max(y1, std::max(rc.y, rc.y + rc.dy));
+            nGlyphs++;
+        }
+    }
+    if (0 == nGlyphs) {
+        return;
+    }
+    bounds = Rect(x0, y0, x1 - x0, y1 - y0);
+
+    // pick roughly square cells, so that a cell contains a few glyphs
+    int nCells = std::max(nGlyphs / GLYPHS_PER_GRID_CELL, 1);
+    double dx = std::max(bounds.dx, 1), dy = std::max(bounds.dy, 1);
+    cols = limitValue((int)sqrt(nCells * dx / dy), 1, nCells);
+    rows = std::max(nCells / cols, 1);
+    // cells are inclusive of the glyphs' right and bottom edges (cf. Rect::Contains)
+    cellDx = bounds.dx / cols + 1;
+    cellDy = bounds.dy / rows + 1;
+
+    auto forEachCell = [this](const Rect& rc, const std::function<void(int)>& f) {
+        int c0 = limitValue((std::min(rc.x, rc.x + rc.dx) - bounds.x) / cellDx, 0, cols - 1);
+        int c1 = limitValue((std::max(rc.x, rc.x + rc.dx) - bounds.x) / cellDx, 0, cols - 1);
+        int r0 = limitValue((std::min(rc.y, rc.y + rc.dy) - bounds.y) / cellDy, 0, rows - 1);
+        int r1 = limitValue((std::max(rc.y, rc.y + rc.dy) - bounds.y) / cellDy, 0, rows - 1);
+        for (int r = r0; r <= r1; r++) {
+            for (int c = c0; c <= c1; c++) {
+                f(r * cols + c);
+            }
+        }
+    };
+
+    // count the glyphs per cell, then fill them in
+    cellStart = AllocArray<int>((size_t)cols * rows + 1);
+    for (int i = 0; i < len; i++) {
+        if (IsGlyphHittable(coords[i])) {
+            forEachCell(coords[i], [this](int cell) { cellStart[cell + 1]++; });
+        }
+    }
+    for (int i = 0; i < cols * rows; i++) {
+        cellStart[i + 1] += cellStart[i];
+    }
+    glyphs = AllocArray<int>((size_t)cellStart[cols * rows] + 1);
+    ScopedMem<int> fill(AllocArray<int>((size_t)cols * rows));
+    for (int i = 0; i < len; i++) {
+        if (IsGlyphHittable(coords[i])) {
+            forEachCell(coords[i], [&](int cell) { glyphs[cellStart[cell] + fill[cell]++] = i; });
+        }
+    }
+}
+
+GlyphGrid::~GlyphGrid() {
+    free(coords);
+    free(cellStart);
+    free(glyphs);
+}
+
+size_t GlyphGrid::Size() const {
+    size_t size = sizeof(*this) + ((size_t)len + 1) * sizeof(Rect);
+    if (cellStart) {
+        size += ((size_t)cols * rows + 1 + cellStart[cols * rows] + 1) * sizeof(int);
+    }
+    return size;
+}
+
+// returns the glyph the point is over (the one with the closest center, if
+// the point is over several) or else the glyph with the closest center
+// (ties go to the first glyph), -1 if there are no glyphs
+int GlyphGrid::FindClosest(PointD pt) const {
+    if (!cellStart) {
+        return -1;
+    }
+
+    int result = -1;
+    unsigned int minDist = UINT_MAX;
+    auto checkGlyph = [&](int i) {
+        unsigned int dist = distSq((int)pt.x - coords[i].x - coords[i].dx / 2, (int)pt.y - coords[i].y - coords[i].dy / 2);
+        if (dist < minDist || (dist == minDist && i < result)) {
+            result = i;
+            minDist = dist;
+        }
+    };
+
+    // a glyph the point is over overlaps the cell containing the point
+    Point pti = pt.ToInt();
+    if (bounds.Contains(pti)) {
+        int cell = ((pti.y - bounds.y) / cellDy) * cols + (pti.x - bounds.x) / cellDx;
+        for (int k = cellStart[cell]; k < cellStart[cell + 1]; k++) {
+            if (coords[glyphs[k]].Contains(pti)) {
+                checkGlyph(glyphs[k]);
+            }
+        }
+        if (result != -1) {
+            return result;
+        }
+    }
+
+    // a glyph's center lies within one of the cells it overlaps, so search the
+    // cells in rings around the point until no closer center can remain
+    int qc = limitValue(((int)pt.x - bounds.x) / cellDx, 0, cols - 1);
+    int qr = limitValue(((int)pt.y - bounds.y) / cellDy, 0, rows - 1);
+    int minCellSize = std::min(cellDx, cellDy);
+    int maxRing = std::max(std::max(qc, cols - 1 - qc), std::max(qr, rows - 1 - qr));
+    for (int ring = 0; ring <= maxRing; ring++) {
+        for (int r = std::max(qr - ring, 0); r <= std::min(qr + ring, rows - 1); r++) {
+            bool edgeRow = r == qr - ring || r == qr + ring;
+            int step = edgeRow ? 1 : 2 * ring;
+            for (int c = qc - ring; c <= qc + ring; c += std::max(step, 1)) {
+                if (c < 0 || c >= cols) {
+                    continue;
+                }
+                int cell = r * cols + c;
+                for (int k = cellStart[cell]; k < cellStart[cell + 1]; k++) {
+                    checkGlyph(glyphs[k]);
+                }
+            }
+        }
+        // the centers in the remaining rings are at least ring * minCellSize away
+        i64 minRemaining = (i64)ring * minCellSize;
+        if (result != -1 && (i64)minDist < minRemaining * minRemaining) {
+            break;
+        }
+    }
+    return result;
+}
+
 TextSelection::TextSelection(EngineBase* engine, DocumentTextCache* textCache)
     : engine(engine), textCache(textCache), startPage(-1), endPage(-1), startGlyph(-1), endGlyph(-1) {
     result.len = 0;
@@ -88,35 +834,13 @@ void TextSelection::Reset() {
 // (i.e. when over the right half of a glyph, the returned index will be for the
 // glyph following it, which will be the first glyph (not) to be selected)
 int TextSelection::FindClosestGlyph(int pageNo, double x, double y) {
-    int textLen;
-    Rect* coords;
-    textCache->GetTextForPage(pageNo, &textLen, &coords);
-    PointD pt = PointD(x, y);
-
-    unsigned int maxDist = UINT_MAX;
-    Point pti = pt.ToInt();
-    bool overGlyph = false;
-    int result = -1;
-
-    for (int i = 0; i < textLen; i++) {
-        if (!coords[i].x && !coords[i].dx)
-            continue;
-        if (overGlyph && !coords[i].Contains(pti))
-            continue;
-
-        unsigned int dist = distSq((int)x - coords[i].x - coords[i].dx / 2, (int)y - coords[i].y - coords[i].dy / 2);
-        if (dist < maxDist) {
-            result = i;
-            maxDist = dist;
-        }
-        // prefer glyphs the cursor is actually over
-        if (!overGlyph && coords[i].Contains(pti)) {
-            overGlyph = true;
-            result = i;
-            maxDist = dist;
-        }
-    }
+    PageTextPin pin(textCache, pageNo);
+    GlyphGrid* grid = textCache->GetGlyphGridForPage(pageNo);
+    Rect* coords = grid->coords;
+    int textLen = grid->len;
 
+    PointD pt = PointD(x, y);
+    int result = grid->FindClosest(pt);
     if (-1 == result)
         return 0;
     CrashIf(result < 0 || result >= textLen);
@@ -136,9 +860,11 @@ int TextSelection::FindClosestGlyph(int pageNo, double x, double y) {
 }
 
 void TextSelection::FillResultRects(int pageNo, int glyph, int length, WStrVec* lines) {
-    int len;
-    Rect* coords;
-    const WCHAR* text = textCache->GetTextForPage(pageNo, &len, &coords);
+    PageTextPin pin(textCache, pageNo);
+    int len = 0;
+    const WCHAR* text = textCache->GetTextForPage(pageNo, &len);
+    // note: the text can't change once it has been cached
+    ScopedMem<Rect> coords(textCache->GetCoordsForPage(pageNo));
     CrashIf(len < glyph + length);
     Rect mediabox = engine->PageMediabox(pageNo).Round();
     Rect *c = &coords[glyph], *end = c + length;
@@ -192,9 +918,10 @@ void TextSelection::FillResultRects(int pageNo, int glyph, int length, WStrVec*
 }
 
 bool TextSelection::IsOverGlyph(int pageNo, double x, double y) {
-    int textLen;
-    Rect* coords;
-    textCache->GetTextForPage(pageNo, &textLen, &coords);
+    PageTextPin pin(textCache, pageNo);
+    GlyphGrid* grid = textCache->GetGlyphGridForPage(pageNo);
+    Rect* coords = grid->coords;
+    int textLen = grid->len;
 
     int glyphIx = FindClosestGlyph(pageNo, x, y);
     Point pt = PointD(x, y).ToInt();
@@ -248,6 +975,7 @@ void TextSelection::SelectUpTo(int pageNo, int glyphIx) {
 }
 
 void TextSelection::SelectWordAt(int pageNo, double x, double y) {
+    PageTextPin pin(textCache, pageNo);
     int ix = FindClosestGlyph(pageNo, x, y);
     int textLen;
     const WCHAR* text = textCache->GetTextForPage(pageNo, &textLen);
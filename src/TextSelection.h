@@ -9,25 +9,172 @@ inline bool isWordChar(WCHAR c) {
     return IsCharAlphaNumeric(c) || c == '_';
 }
 
+// uniform grid over the glyphs of a page, for finding the glyph
+// under or closest to the mouse cursor without checking all of them
+struct GlyphGrid {
+    // decoded coordinates of all glyphs
+    Rect* coords = nullptr;
+    int len = 0;
+
+    Rect bounds;
+    int cols = 0;
+    int rows = 0;
+    int cellDx = 1;
+    int cellDy = 1;
+    // the glyphs overlapping cell i are glyphs[cellStart[i]] to glyphs[cellStart[i + 1] - 1]
+    int* cellStart = nullptr;
+    int* glyphs = nullptr;
+
+    GlyphGrid(Rect* coords, int len);
+    ~GlyphGrid();
+
+    int FindClosest(PointD pt) const;
+    size_t Size() const;
+};
+
 struct PageText {
-    Rect* coords;
     WCHAR* text;
     int len;
+    // coordinates of the glyphs in a compact encoding (cf. PackCoords),
+    // decoded on demand by DocumentTextCache::GetCoordsForPage
+    u8* packedCoords;
+    int packedCoordsSize;
+    // lower-cased copy of text for case-insensitive searching (created on demand)
+    WCHAR* foldedText;
+    // built on demand for hit-testing
+    GlyphGrid* glyphGrid;
+    // offsets of the '\n' in text in ascending order (built on demand)
+    int* lineBreaks;
+    int nLineBreaks;
+    // value of DocumentTextCache::useCount at the last access (for LRU eviction)
+    u64 lastUsed;
+    // the text of pinned pages is neither evicted nor freed (cf. PageTextPin)
+    int nPins;
+    // text and packedCoords point into DocumentTextCache::savedText (and aren't freed)
+    bool isSaved;
 };
 
+// upper limit for the number of threads extracting text in parallel
+// (each one uses its own clone of the engine)
+#define MAX_TEXT_PREFETCH_THREADS 4
+// the text of this many most recently used pages is never evicted
+// (so that it isn't extracted over and over when going back and forth)
+#define TEXT_CACHE_MIN_PAGES 32
+
+class CancelToken;
+struct SavedPageText;
+namespace file {
+class MappedFile;
+}
+
 struct DocumentTextCache {
     EngineBase* engine = nullptr;
     int nPages = 0;
     PageText* pagesText = nullptr;
-    int debugSize;
+    size_t cachedSize = 0;
+    // when the cached text takes up more than this, the text of the least
+    // recently used pages is evicted (and extracted again when needed).
+    // 0 means no limit
+    size_t maxSize = 0;
+    u64 useCount = 0;
 
+    // only held for accessing pagesText, not while extracting text
     CRITICAL_SECTION access;
 
+    // pages from prefetchFrom in steps of prefetchStep are extracted by
+    // work items on the thread pool, prefetchNext is the index of the next one
+    CancelToken* prefetchToken = nullptr;
+    int prefetchFrom = 0;
+    int prefetchStep = 1;
+    int prefetchCount = 0;
+    LONG prefetchNext = 0;
+    LONG nRunningPrefetchers = 0;
+    bool stopPrefetching = false;
+
+    // the text saved by SaveToFile when the document was last closed
+    // (pages only get their text from there once it's accessed)
+    WCHAR* savePath = nullptr;
+    file::MappedFile* savedText = nullptr;
+    const SavedPageText* savedPages = nullptr;
+    int nSavedPages = 0;
+    // files released while the text of pinned pages still pointed into them
+    Vec<file::MappedFile*> releasedSavedText;
+    // set when text is extracted that hasn't been saved yet
+    bool hasUnsavedText = false;
+
     explicit DocumentTextCache(EngineBase* engine);
     ~DocumentTextCache();
 
+    // only ever grows the number of pages
+    void SetPageCount(int newCount);
+
     bool HasTextForPage(int pageNo);
-    const WCHAR* GetTextForPage(int pageNo, int* lenOut = nullptr, Rect** coordsOut = nullptr);
+    // the pointers returned for a page (its text, folded text, glyph grid and
+    // line breaks) are only valid for as long as the page is pinned, as the text
+    // might otherwise be evicted by any thread accessing the cache (use PageTextPin)
+    void PinPage(int pageNo);
+    void UnpinPage(int pageNo);
+
+    const WCHAR* GetTextForPage(int pageNo, int* lenOut = nullptr);
+    // returns the bounding boxes of all the glyphs of a page (one per WCHAR,
+    // line breaks have empty ones). caller must free() the result
+    Rect* GetCoordsForPage(int pageNo, int* lenOut = nullptr);
+    // same as GetCoordsForPage but indexed for hit-testing (the result
+    // is owned by the cache and remains valid as long as the page's text)
+    GlyphGrid* GetGlyphGridForPage(int pageNo);
+    // same as GetTextForPage but case-folded with CharLowerBuff
+    // (the result has the same length as the page's text)
+    const WCHAR* GetFoldedTextForPage(int pageNo, int* lenOut = nullptr);
+    // returns the offsets of all the line breaks in the text of a page in ascending
+    // order (owned by the cache and valid as long as the page's text)
+    const int* GetLineBreaksForPage(int pageNo, int* countOut);
+
+    // extracts the text of pages <from> to <to> (going backwards if from > to)
+    // in the background on up to <nThreads> threads. does nothing if
+    // a previous prefetch is still running
+    void PrefetchRange(int from, int to, int nThreads);
+    bool IsPrefetching();
+    void StopPrefetching();
+    // runs on the prefetch threads
+    void PrefetchPages();
+    // takes over the text of the pages that are the same in a previous
+    // version of the document (cf. IsPageUnchanged)
+    void TakeUnchangedPages(DocumentTextCache* prev);
+    // frees the text of all pages that aren't pinned (it's extracted again
+    // when needed) unless it's being extracted in the background for a search
+    void FreeAllText();
+    // memory-maps the text saved for the document at <path> (if any)
+    // and remembers <path> for SaveToFile
+    void LoadFromFile(const WCHAR* path);
+    // saves the text of all pages extracted so far (and that of pages loaded
+    // by LoadFromFile), if there's any new text. the loaded file is released,
+    // so its pages have to be extracted again when needed afterwards
+    bool SaveToFile();
+
+  private:
+    void SetTextForPage(int pageNo, WCHAR* text, u8* packedCoords, int packedCoordsSize);
+    void ExtractTextForPage(EngineBase* engine, int pageNo);
+    void EvictLeastRecentlyUsed();
+    bool RestoreSavedText(int pageNo);
+    void ReleaseSavedText();
+};
+
+// pins a page of a DocumentTextCache for as long as it exists
+// (or until another page is pinned with Set)
+class PageTextPin {
+  public:
+    PageTextPin() = default;
+    PageTextPin(DocumentTextCache* textCache, int pageNo);
+    PageTextPin(const PageTextPin&) = delete;
+    PageTextPin& operator=(const PageTextPin&) = delete;
+    ~PageTextPin();
+
+    void Set(DocumentTextCache* textCache, int pageNo);
+    void Reset();
+
+  private:
+    DocumentTextCache* textCache = nullptr;
+    int pageNo = 0;
 };
 
 // TODO: replace with Vec<TextSel>
@@ -0,0 +1,254 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#include "utils/BaseUtil.h"
+#include "utils/ScopedWin.h"
+#include "utils/CryptoUtil.h"
+#include "utils/FileUtil.h"
+#include "utils/WinUtil.h"
+
+#include "wingui/TreeModel.h"
+
+#include "Annotation.h"
+#include "EngineBase.h"
+#include "SettingsStructs.h"
+#include "GlobalPrefs.h"
+#include "RenderCache.h"
+
+#include "AppTools.h"
+#include "TileCache.h"
+
+#define TILE_CACHE_DIR_NAME L"sumatrapdfcache\\tiles"
+#define TILE_FILE_MAGIC 0x31545053 // "SPT1"
+
+// a tile file consists of this header followed by the tile's
+// uncompressed pixels (top-down rows in 32-bit BGRA)
+struct TileFileHeader {
+    u32 magic;
+    float zoom;
+    int dx;
+    int dy;
+    COLORREF textColor;
+    COLORREF bgColor;
+};
+
+WCHAR* GetTileCacheDir(const WCHAR* filePath) {
+    if (!filePath) {
+        return nullptr;
+    }
+    unsigned char digest[16];
+    if (!CalcFileFingerprint(filePath, digest)) {
+        return nullptr;
+    }
+    AutoFree fingerPrint(_MemToHex(&digest));
+
+    AutoFreeWstr cachePath(AppGenDataFilename(TILE_CACHE_DIR_NAME));
+    if (!cachePath) {
+        return nullptr;
+    }
+    AutoFreeWstr dirName(strconv::FromAnsi(fingerPrint));
+    return path::Join(cachePath, dirName);
+}
+
+static void DeleteCachedTiles(const WCHAR* dir) {
+    AutoFreeWstr pattern(path::Join(dir, L"*.tile"));
+    WIN32_FIND_DATA fdata;
+    HANDLE hfind = FindFirstFile(pattern, &fdata);
+    if (INVALID_HANDLE_VALUE == hfind) {
+        return;
+    }
+    do {
+        AutoFreeWstr path(path::Join(dir, fdata.cFileName));
+        file::Delete(path);
+    } while (FindNextFile(hfind, &fdata));
+    FindClose(hfind);
+}
+
+static bool SaveCachedTile(const WCHAR* path, CachedTile& tile, COLORREF textColor, COLORREF bgColor) {
+    HBITMAP hbmp = tile.bitmap ? tile.bitmap->GetBitmap() : nullptr;
+    Size size = tile.bitmap ? tile.bitmap->Size() : Size();
+    if (!hbmp || size.IsEmpty()) {
+        return false;
+    }
+
+    size_t pixelsSize = (size_t)size.dx * size.dy * 4;
+    size_t dataSize = sizeof(TileFileHeader) + pixelsSize;
+    ScopedMem<u8> data((u8*)malloc(dataSize));
+    if (!data) {
+        return false;
+    }
+    TileFileHeader* hdr = (TileFileHeader*)data.Get();
+    hdr->magic = TILE_FILE_MAGIC;
+    hdr->zoom = tile.zoom;
+    hdr->dx = size.dx;
+    hdr->dy = size.dy;
+    hdr->textColor = textColor;
+    hdr->bgColor = bgColor;
+
+    // GetDIBits converts paletted bitmaps as well
+    BITMAPINFO bmi{};
+    bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    bmi.bmiHeader.biWidth = size.dx;
+    bmi.bmiHeader.biHeight = -size.dy;
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+    HDC hdc = CreateCompatibleDC(nullptr);
+    int nLines = GetDIBits(hdc, hbmp, 0, size.dy, data.Get() + sizeof(TileFileHeader), &bmi, DIB_RGB_COLORS);
+    DeleteDC(hdc);
+    if (nLines != size.dy) {
+        return false;
+    }
+
+    return file::WriteFile(path, {(char*)data.Get(), dataSize});
+}
+
+void SaveCachedTiles(const WCHAR* dir, Vec<CachedTile>& tiles, COLORREF textColor, COLORREF bgColor) {
+    DeleteCachedTiles(dir);
+    if (!gGlobalPrefs->tileCacheSizeMB || tiles.size() == 0) {
+        dir::RemoveAll(dir);
+        return;
+    }
+    if (!dir::CreateAll(dir)) {
+        return;
+    }
+    for (CachedTile& tile : tiles) {
+        AutoFreeWstr fileName(str::Format(L"%d-%d-%d-%d-%d.tile", tile.pageNo, tile.rotation, tile.tile.res,
+                                          tile.tile.row, tile.tile.col));
+        AutoFreeWstr path(path::Join(dir, fileName));
+        SaveCachedTile(path, tile, textColor, bgColor);
+    }
+    CleanUpTileCache();
+}
+
+// reads the pixels directly into the memory of a DIB section
+static RenderedBitmap* LoadCachedTile(const WCHAR* path, TileFileHeader& hdr) {
+    AutoCloseHandle h(file::OpenReadOnly(path));
+    if (!h.IsValid()) {
+        return nullptr;
+    }
+    DWORD nRead = 0;
+    BOOL ok = ReadFile(h, &hdr, sizeof(hdr), &nRead, nullptr);
+    if (!ok || nRead != sizeof(hdr) || hdr.magic != TILE_FILE_MAGIC) {
+        return nullptr;
+    }
+    // tiles are never larger than the screen
+    if (hdr.dx <= 0 || hdr.dy <= 0 || hdr.dx > 32 * 1024 || hdr.dy > 32 * 1024) {
+        return nullptr;
+    }
+
+    Size size(hdr.dx, hdr.dy);
+    HANDLE hMap = nullptr;
+    HBITMAP hbmp = CreateMemoryBitmap(size, &hMap);
+    DIBSECTION info{};
+    if (!hbmp || GetObject(hbmp, sizeof(info), &info) != sizeof(info) || !info.dsBm.bmBits) {
+        DeleteObject(hbmp);
+        CloseHandle(hMap);
+        return nullptr;
+    }
+    DWORD pixelsSize = (DWORD)size.dx * size.dy * 4;
+    ok = ReadFile(h, info.dsBm.bmBits, pixelsSize, &nRead, nullptr);
+    if (!ok || nRead != pixelsSize) {
+        DeleteObject(hbmp);
+        CloseHandle(hMap);
+        return nullptr;
+    }
+    return new RenderedBitmap(hbmp, size, hMap);
+}
+
+void LoadCachedTiles(const WCHAR* dir, COLORREF textColor, COLORREF bgColor, Vec<CachedTile>& tilesOut) {
+    if (!gGlobalPrefs->tileCacheSizeMB) {
+        return;
+    }
+    AutoFreeWstr pattern(path::Join(dir, L"*.tile"));
+    WIN32_FIND_DATA fdata;
+    HANDLE hfind = FindFirstFile(pattern, &fdata);
+    if (INVALID_HANDLE_VALUE == hfind) {
+        return;
+    }
+    do {
+        CachedTile tile;
+        int res, row, col;
+        int n = swscanf_s(fdata.cFileName, L"%d-%d-%d-%d-%d.tile", &tile.pageNo, &tile.rotation, &res, &row, &col);
+        if (n != 5 || res < 0 || res > 30) {
+            continue;
+        }
+        tile.tile = TilePosition((USHORT)res, (USHORT)row, (USHORT)col);
+
+        AutoFreeWstr path(path::Join(dir, fdata.cFileName));
+        TileFileHeader hdr;
+        tile.bitmap = LoadCachedTile(path, hdr);
+        if (!tile.bitmap) {
+            continue;
+        }
+        if (hdr.textColor != textColor || hdr.bgColor != bgColor) {
+            delete tile.bitmap;
+            continue;
+        }
+        tile.zoom = hdr.zoom;
+        tilesOut.Append(tile);
+    } while (FindNextFile(hfind, &fdata));
+    FindClose(hfind);
+}
+
+struct TileCacheDirInfo {
+    WCHAR* name;
+    i64 size;
+    FILETIME lastWrite;
+};
+
+static int cmpDirInfoNewestFirst(const void* a, const void* b) {
+    const TileCacheDirInfo* da = (const TileCacheDirInfo*)a;
+    const TileCacheDirInfo* db = (const TileCacheDirInfo*)b;
+    return CompareFileTime(&db->lastWrite, &da->lastWrite);
+}
+
+void CleanUpTileCache() {
+    AutoFreeWstr cachePath(AppGenDataFilename(TILE_CACHE_DIR_NAME));
+    if (!cachePath) {
+        return;
+    }
+
+    Vec<TileCacheDirInfo> dirs;
+    AutoFreeWstr pattern(path::Join(cachePath, L"*"));
+    WIN32_FIND_DATA fdata;
+    HANDLE hfind = FindFirstFile(pattern, &fdata);
+    if (INVALID_HANDLE_VALUE == hfind) {
+        return;
+    }
+    do {
+        if (!(fdata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) || str::Eq(fdata.cFileName, L".") ||
+            str::Eq(fdata.cFileName, L"..")) {
+            continue;
+        }
+        TileCacheDirInfo info{str::Dup(fdata.cFileName), 0, {}};
+        AutoFreeWstr dir(path::Join(cachePath, fdata.cFileName));
+        AutoFreeWstr tilesPattern(path::Join(dir, L"*.tile"));
+        WIN32_FIND_DATA tdata;
+        HANDLE htiles = FindFirstFile(tilesPattern, &tdata);
+        if (INVALID_HANDLE_VALUE != htiles) {
+            do {
+                info.size += ((i64)tdata.nFileSizeHigh << 32) | tdata.nFileSizeLow;
+                if (CompareFileTime(&tdata.ftLastWriteTime, &info.lastWrite) > 0) {
+                    info.lastWrite = tdata.ftLastWriteTime;
+                }
+            } while (FindNextFile(htiles, &tdata));
+            FindClose(htiles);
+        }
+        dirs.Append(info);
+    } while (FindNextFile(hfind, &fdata));
+    FindClose(hfind);
+
+    // keep the tiles of the most recently closed documents
+    dirs.Sort(cmpDirInfoNewestFirst);
+    i64 maxSize = (i64)std::max(gGlobalPrefs->tileCacheSizeMB, 0) * 1024 * 1024;
+    i64 totalSize = 0;
+    for (TileCacheDirInfo& info : dirs) {
+        totalSize += info.size;
+        if (totalSize > maxSize) {
+            AutoFreeWstr dir(path::Join(cachePath, info.name));
+            dir::RemoveAll(dir);
+        }
+        free(info.name);
+    }
+}
@@ -0,0 +1,29 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+// The tile cache keeps the tiles that were visible when a document was
+// closed on disk, so that they can be shown right away when the document
+// is reopened (while the pages are being rendered anew).
+
+struct CachedTile {
+    int pageNo = 0;
+    int rotation = 0;
+    float zoom = 0.f;
+    TilePosition tile;
+    RenderedBitmap* bitmap = nullptr;
+};
+
+// returns the directory for the cached tiles of a given document
+// (its name is the file's fingerprint, cf. CalcFileFingerprint)
+// caller must free() the result
+WCHAR* GetTileCacheDir(const WCHAR* filePath);
+
+// replaces all the tiles cached for a document (bitmaps remain owned by the caller)
+void SaveCachedTiles(const WCHAR* dir, Vec<CachedTile>& tiles, COLORREF textColor, COLORREF bgColor);
+// only loads tiles that have been rendered with the given colors
+// (the caller takes ownership of the loaded bitmaps)
+void LoadCachedTiles(const WCHAR* dir, COLORREF textColor, COLORREF bgColor, Vec<CachedTile>& tilesOut);
+
+// removes the tiles of the least recently closed documents
+// until the cache fits into GlobalPrefs::tileCacheSizeMB
+void CleanUpTileCache();
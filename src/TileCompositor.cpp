@@ -0,0 +1,247 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#include "utils/BaseUtil.h"
+#include "utils/ScopedWin.h"
+#include "utils/WinDynCalls.h"
+#include "utils/WinUtil.h"
+#include "utils/Log.h"
+
+#include "wingui/TreeModel.h"
+
+#include "Annotation.h"
+#include "EngineBase.h"
+#include "SettingsStructs.h"
+#include "Controller.h"
+#include "DisplayModel.h"
+#include "RenderCache.h"
+#include "TileCompositor.h"
+
+// give up on Direct2D for a window after it failed this many times in a row
+// (it's then painted with GDI like in remote sessions)
+#define MAX_COMPOSITOR_FAILURES 3
+
+// render threads release the uploaded bitmaps of the tiles they free,
+// so the factory must be multi-threaded
+static ID2D1Factory* gD2DFactory = nullptr;
+// the bitmaps uploaded to a target can't be drawn into any other target
+static LONG gLastTargetId = 0;
+
+static ID2D1Factory* GetD2DFactory() {
+    static bool didTry = false;
+    if (!didTry && DynD2D1CreateFactory) {
+        didTry = true;
+        HRESULT hr = DynD2D1CreateFactory(D2D1_FACTORY_TYPE_MULTI_THREADED, __uuidof(ID2D1Factory), nullptr,
+                                          (void**)&gD2DFactory);
+        if (FAILED(hr)) {
+            logf("D2D1CreateFactory() failed with 0x%x\n", hr);
+            gD2DFactory = nullptr;
+        }
+    }
+    return gD2DFactory;
+}
+
+TileCompositor::TileCompositor(HWND hwnd) : hwnd(hwnd) {
+}
+
+TileCompositor* TileCompositor::Create(HWND hwnd) {
+    if (!GetD2DFactory()) {
+        return nullptr;
+    }
+    return new TileCompositor(hwnd);
+}
+
+TileCompositor::~TileCompositor() {
+    CrashIf(hdcGdi);
+    ReleaseTarget();
+}
+
+bool TileCompositor::CreateTarget() {
+    CrashIf(target);
+    // only composite on the GPU (software rendering isn't any faster than GDI)
+    auto props = D2D1::RenderTargetProperties(
+        D2D1_RENDER_TARGET_TYPE_HARDWARE, D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED),
+        96.f, 96.f, D2D1_RENDER_TARGET_USAGE_GDI_COMPATIBLE);
+    // only the area to repaint is drawn, the rest must remain as it was
+    auto hwndProps = D2D1::HwndRenderTargetProperties(hwnd, D2D1::SizeU(targetSize.dx, targetSize.dy),
+                                                      D2D1_PRESENT_OPTIONS_RETAIN_CONTENTS);
+    HRESULT hr = gD2DFactory->CreateHwndRenderTarget(props, hwndProps, &target);
+    if (FAILED(hr)) {
+        logf("TileCompositor: CreateHwndRenderTarget() failed with 0x%x\n", hr);
+        target = nullptr;
+        return false;
+    }
+    hr = target->QueryInterface(__uuidof(ID2D1GdiInteropRenderTarget), (void**)&gdiTarget);
+    if (FAILED(hr)) {
+        gdiTarget = nullptr;
+        ReleaseTarget();
+        return false;
+    }
+    // canvas coordinates are in pixels, not in DIPs
+    target->SetDpi(96.f, 96.f);
+    targetId = InterlockedIncrement(&gLastTargetId);
+    return true;
+}
+
+void TileCompositor::ReleaseTarget() {
+    if (gdiTarget) {
+        gdiTarget->Release();
+        gdiTarget = nullptr;
+    }
+    if (target) {
+        target->Release();
+        target = nullptr;
+    }
+    targetId = 0;
+}
+
+bool TileCompositor::BeginDraw(Rect& areaInOut) {
+    CrashIf(hdcGdi);
+    if (nFailures >= MAX_COMPOSITOR_FAILURES) {
+        return false;
+    }
+    Rect rc = ClientRect(hwnd);
+    if (rc.IsEmpty()) {
+        return false;
+    }
+
+    bool isNewTarget = false;
+    if (target && rc.Size() != targetSize) {
+        // the content isn't retained when resizing
+        HRESULT hr = target->Resize(D2D1::SizeU(rc.dx, rc.dy));
+        if (FAILED(hr)) {
+            ReleaseTarget();
+        }
+        isNewTarget = true;
+    }
+    if (!target) {
+        targetSize = rc.Size();
+        if (!CreateTarget()) {
+            nFailures++;
+            return false;
+        }
+        isNewTarget = true;
+    }
+    targetSize = rc.Size();
+
+    if (isNewTarget) {
+        areaInOut = rc;
+    }
+    area = areaInOut.Intersect(rc);
+    areaInOut = area;
+    target->BeginDraw();
+    return true;
+}
+
+bool TileCompositor::EndDraw() {
+    CrashIf(hdcGdi);
+    HRESULT hr = target->EndDraw();
+    if (FAILED(hr)) {
+        // D2DERR_RECREATE_TARGET when the device has been lost. in any case,
+        // the content of the target can no longer be relied on
+        logf("TileCompositor: EndDraw() failed with 0x%x\n", hr);
+        ReleaseTarget();
+        nFailures++;
+        return false;
+    }
+    nFailures = 0;
+    return true;
+}
+
+HDC TileCompositor::BeginGdi() {
+    CrashIf(hdcGdi);
+    HDC hdc = nullptr;
+    HRESULT hr = gdiTarget->GetDC(D2D1_DC_INITIALIZE_MODE_COPY, &hdc);
+    if (FAILED(hr)) {
+        return nullptr;
+    }
+    IntersectClipRect(hdc, area.x, area.y, area.x + area.dx, area.y + area.dy);
+    hdcGdi = hdc;
+    return hdc;
+}
+
+void TileCompositor::EndGdi() {
+    CrashIf(!hdcGdi);
+    RECT rc = area.ToRECT();
+    gdiTarget->ReleaseDC(&rc);
+    hdcGdi = nullptr;
+}
+
+static ID2D1Bitmap* UploadBitmap(ID2D1RenderTarget* target, RenderedBitmap* bmp) {
+    HBITMAP hbmp = bmp ? bmp->GetBitmap() : nullptr;
+    Size size = bmp ? bmp->Size() : Size();
+    if (!hbmp || size.IsEmpty()) {
+        return nullptr;
+    }
+    // rendered bitmaps are opaque, the fourth byte is padding
+    auto props = D2D1::BitmapProperties(D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_IGNORE));
+    auto bmpSize = D2D1::SizeU(size.dx, size.dy);
+    ID2D1Bitmap* gpuBmp = nullptr;
+
+    // top-down 32-bit DIB sections can be uploaded as they are
+    DIBSECTION info{};
+    if (GetObject(hbmp, sizeof(info), &info) == sizeof(info) && info.dsBm.bmBits && info.dsBm.bmBitsPixel == 32 &&
+        info.dsBmih.biHeight < 0) {
+        HRESULT hr = target->CreateBitmap(bmpSize, info.dsBm.bmBits, info.dsBm.bmWidthBytes, props, &gpuBmp);
+        return SUCCEEDED(hr) ? gpuBmp : nullptr;
+    }
+
+    // GetDIBits converts all other formats
+    ScopedMem<u8> data((u8*)malloc((size_t)size.dx * size.dy * 4));
+    if (!data) {
+        return nullptr;
+    }
+    BITMAPINFO bmi{};
+    bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    bmi.bmiHeader.biWidth = size.dx;
+    bmi.bmiHeader.biHeight = -size.dy;
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+    HDC hdc = CreateCompatibleDC(nullptr);
+    int nLines = GetDIBits(hdc, hbmp, 0, size.dy, data.Get(), &bmi, DIB_RGB_COLORS);
+    DeleteDC(hdc);
+    if (nLines != size.dy) {
+        return nullptr;
+    }
+    HRESULT hr = target->CreateBitmap(bmpSize, data.Get(), size.dx * 4, props, &gpuBmp);
+    return SUCCEEDED(hr) ? gpuBmp : nullptr;
+}
+
+static void DrawGpuBitmap(ID2D1RenderTarget* target, ID2D1Bitmap* bmp, Rect dst, RectD src) {
+    auto dstRect = D2D1::RectF((float)dst.x, (float)dst.y, (float)(dst.x + dst.dx), (float)(dst.y + dst.dy));
+    auto srcRect = D2D1::RectF((float)src.x, (float)src.y, (float)(src.x + src.dx), (float)(src.y + src.dy));
+    // scaled tiles are only shown until the page has been rendered at the current zoom
+    bool isScaled = src.dx != dst.dx || src.dy != dst.dy;
+    auto mode = isScaled ? D2D1_BITMAP_INTERPOLATION_MODE_LINEAR : D2D1_BITMAP_INTERPOLATION_MODE_NEAREST_NEIGHBOR;
+    target->DrawBitmap(bmp, dstRect, 1.f, mode, srcRect);
+}
+
+bool TileCompositor::DrawTile(BitmapCacheEntry* entry, Rect dst, RectD src) {
+    CrashIf(hdcGdi);
+    // the bitmap is uploaded once per target and then reused until the tile is freed
+    if (entry->gpuTargetId != targetId) {
+        if (entry->gpuBitmap) {
+            entry->gpuBitmap->Release();
+        }
+        entry->gpuBitmap = UploadBitmap(target, entry->bitmap);
+        entry->gpuTargetId = targetId;
+    }
+    if (!entry->gpuBitmap) {
+        return false;
+    }
+    DrawGpuBitmap(target, (ID2D1Bitmap*)entry->gpuBitmap, dst, src);
+    return true;
+}
+
+bool TileCompositor::DrawBitmap(RenderedBitmap* bmp, Rect dst) {
+    CrashIf(hdcGdi);
+    ID2D1Bitmap* gpuBmp = UploadBitmap(target, bmp);
+    if (!gpuBmp) {
+        return false;
+    }
+    Size size = bmp->Size();
+    DrawGpuBitmap(target, gpuBmp, dst, RectD(0, 0, size.dx, size.dy));
+    gpuBmp->Release();
+    return true;
+}
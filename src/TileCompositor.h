@@ -0,0 +1,54 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+// The tile compositor draws the cached tiles of a canvas with Direct2D, so
+// that blitting and scaling them is done by the GPU (cf. GlobalPrefs::gpuCompositing).
+// Everything else (background, frames, selection, ...) is still painted with GDI
+// into the same render target between BeginGdi and EndGdi.
+
+class RenderedBitmap;
+struct BitmapCacheEntry;
+struct ID2D1HwndRenderTarget;
+struct ID2D1GdiInteropRenderTarget;
+
+class TileCompositor {
+    HWND hwnd = nullptr;
+    ID2D1HwndRenderTarget* target = nullptr;
+    ID2D1GdiInteropRenderTarget* gdiTarget = nullptr;
+    // identifies target for the uploaded bitmaps (cf. BitmapCacheEntry::gpuTargetId)
+    LONG targetId = 0;
+    Size targetSize;
+    // the area being repainted between BeginDraw and EndDraw
+    Rect area;
+    HDC hdcGdi = nullptr;
+    // consecutive failures to create or present the target
+    int nFailures = 0;
+
+    explicit TileCompositor(HWND hwnd);
+    bool CreateTarget();
+
+  public:
+    // returns nullptr if Direct2D isn't available
+    static TileCompositor* Create(HWND hwnd);
+    ~TileCompositor();
+
+    // must be called after the window has been painted with GDI, since the
+    // target's content is then out of date (it's recreated when needed)
+    void ReleaseTarget();
+
+    // area is in client coordinates. the whole canvas is repainted instead
+    // if the target has just been (re)created, since it has no content yet
+    // (the returned rectangle is the area that's actually repainted)
+    bool BeginDraw(Rect& area);
+    // returns false if the target has been lost (and the canvas must be repainted)
+    bool EndDraw();
+
+    // the returned DC is clipped to the area being repainted
+    HDC BeginGdi();
+    void EndGdi();
+
+    // draws src (in the entry's bitmap coordinates) scaled to dst
+    bool DrawTile(BitmapCacheEntry* entry, Rect dst, RectD src);
+    // for bitmaps which aren't cached (cf. DisplayModel::ShouldCacheRendering)
+    bool DrawBitmap(RenderedBitmap* bmp, Rect dst);
+};
@@ -76,6 +76,8 @@ struct TocEditorWindow {
 
     void UpdateRemoveTocItemButtonStatus();
     void UpdateTreeModel();
+    void TocTreeChanged();
+    void TocItemInserted(TocItem* ti, TocItem* insertAfter);
     void SaveAsVirtual();
     void SaveAsPdf();
     void RemoveItem();
@@ -121,6 +123,32 @@ void TocEditorWindow::UpdateTreeModel() {
     treeCtrl->SetTreeModel(tree);
 }
 
+// edits only patch the tree control because re-populating it takes
+// seconds for outlines of merged documents with tens of thousands of
+// entries. Page ranges and parents are cheap to re-calculate
+void TocEditorWindow::TocTreeChanged() {
+    TocTree* tree = tocArgs->bookmarks->tree;
+    int nPages = 0;
+    CalcEndPageNo2(tree->root, nPages);
+    SetTocTreeParents(tree->root);
+    // the texts are provided on demand, so this updates the page ranges
+    InvalidateRect(treeCtrl->hwnd, nullptr, TRUE);
+}
+
+// ti has been added to the tree after insertAfter (nullptr if it's the first child)
+void TocEditorWindow::TocItemInserted(TocItem* ti, TocItem* insertAfter) {
+    TocTreeChanged();
+    treeCtrl->InsertItem(ti, insertAfter);
+    treeCtrl->EnsureVisible(ti);
+}
+
+static TocItem* LastSibling(TocItem* ti) {
+    while (ti->next) {
+        ti = ti->next;
+    }
+    return ti;
+}
+
 static void SetTocItemFromTocEditArgs(TocItem* ti, TocEditArgs* args) {
     std::string_view newTitle = args->title.as_view();
     str::Free(ti->title);
@@ -182,6 +210,8 @@ static void StartEditTocItem(HWND hwnd, TreeCtrl* treeCtrl, TocItem* ti) {
 
         SetTocItemFromTocEditArgs(ti, args);
         treeCtrl->UpdateItem(ti);
+        // the page ranges of the siblings might've changed
+        gWindow->TocTreeChanged();
     });
 }
 
@@ -256,9 +286,10 @@ static void EnsureExpanded(TocItem* ti) {
 void TocEditorWindow::RemoveTocItem(TocItem* ti, bool alsoDelete) {
     EnsureExpanded(ti->parent);
 
+    treeCtrl->RemoveItem(ti);
     bool ok = RemoveIt(treeCtrl, ti);
     if (ok && alsoDelete) {
-        UpdateTreeModel();
+        TocTreeChanged();
         ti->DeleteJustSelf();
     }
 }
@@ -308,7 +339,7 @@ void TocEditorWindow::AddPdfAsChild(TocItem* ti) {
     }
     TocItem* tocWrapper = CreateWrapperItem(engine);
     ti->AddChild(tocWrapper);
-    UpdateTreeModel();
+    TocItemInserted(tocWrapper, nullptr);
     delete engine;
 }
 
@@ -319,7 +350,7 @@ void TocEditorWindow::AddPdfAsSibling(TocItem* ti) {
     }
     TocItem* tocWrapper = CreateWrapperItem(engine);
     ti->AddSibling(tocWrapper);
-    UpdateTreeModel();
+    TocItemInserted(tocWrapper, ti);
     delete engine;
 }
 
@@ -330,8 +361,9 @@ void TocEditorWindow::AddPdf() {
     }
 
     TocItem* tocWrapper = CreateWrapperItem(engine);
-    tocArgs->bookmarks->tree->root->AddSiblingAtEnd(tocWrapper);
-    UpdateTreeModel();
+    TocItem* last = LastSibling(tocArgs->bookmarks->tree->root);
+    last->AddSibling(tocWrapper);
+    TocItemInserted(tocWrapper, last);
     delete engine;
 }
 
@@ -449,8 +481,9 @@ void TocEditorWindow::DropFilesHandler(DropFilesEvent* ev) {
     // didn't drop on an existing itme: add as a last sibling
     if (ti == nullptr) {
         TocItem* tocWrapper = CreateWrapperItem(engine);
-        tocArgs->bookmarks->tree->root->AddSiblingAtEnd(tocWrapper);
-        UpdateTreeModel();
+        TocItem* last = LastSibling(tocArgs->bookmarks->tree->root);
+        last->AddSibling(tocWrapper);
+        TocItemInserted(tocWrapper, last);
         return;
     }
 
@@ -459,7 +492,7 @@ void TocEditorWindow::DropFilesHandler(DropFilesEvent* ev) {
         if (CanAddPdfAsSibling(ti)) {
             TocItem* tocWrapper = CreateWrapperItem(engine);
             ti->AddSibling(tocWrapper);
-            UpdateTreeModel();
+            TocItemInserted(tocWrapper, ti);
         }
         return;
     }
@@ -467,7 +500,7 @@ void TocEditorWindow::DropFilesHandler(DropFilesEvent* ev) {
     if (CanAddPdfAsChild(ti)) {
         TocItem* tocWrapper = CreateWrapperItem(engine);
         ti->AddChild(tocWrapper);
-        UpdateTreeModel();
+        TocItemInserted(tocWrapper, nullptr);
     }
 }
 
@@ -518,15 +551,17 @@ void TocEditorWindow::TreeContextMenu(ContextMenuEvent* ev) {
                     // was cancelled or invalid
                     return;
                 }
+                TocItem* insertAfter = nullptr;
                 if (cmd == IDM_ADD_SIBLING) {
                     selectedTocItem->AddSibling(ti);
+                    insertAfter = selectedTocItem;
                 } else if (cmd == IDM_ADD_CHILD) {
                     selectedTocItem->AddChild(ti);
                 } else {
                     CrashMe();
                 }
                 EnsureExpanded(selectedTocItem);
-                UpdateTreeModel();
+                TocItemInserted(ti, insertAfter);
             });
         } break;
         case IDM_ADD_PDF_CHILD:
@@ -608,7 +643,7 @@ void TocEditorWindow::TreeItemDragStartEnd(TreeItemDraggeddEvent* ev) {
             if (src->engineFilePath && dst->engineFilePath) {
                 RemoveTocItem(src, false);
                 dst->AddSibling(src);
-                UpdateTreeModel();
+                TocItemInserted(src, dst);
             }
         }
         // TODO: show a temporary error message that will go away after a while
@@ -623,13 +658,15 @@ void TocEditorWindow::TreeItemDragStartEnd(TreeItemDraggeddEvent* ev) {
     }
 
     RemoveTocItem(src, false);
+    TocItem* insertAfter = nullptr;
     if (addAsSibling) {
         dst->AddSibling(src);
+        insertAfter = dst;
     } else {
         dst->AddChild(src);
         EnsureExpanded(src);
     }
-    UpdateTreeModel();
+    TocItemInserted(src, insertAfter);
 }
 
 TocEditorWindow::~TocEditorWindow() {
@@ -261,7 +261,7 @@ static LRESULT CALLBACK WndProcToolbar(HWND hwnd, UINT message, WPARAM wParam, L
         WindowInfo* win = FindWindowInfoByHwnd(hEdit);
         // "find as you type"
         if (EN_UPDATE == HIWORD(wParam) && hEdit == win->hwndFindBox && gGlobalPrefs->showToolbar) {
-            FindTextOnThread(win, TextSearchDirection::Forward, false);
+            FindTextAsYouType(win);
         }
     }
     return CallWindowProc(DefWndProcToolbar, hwnd, message, wParam, lParam);
@@ -486,20 +486,22 @@ void UpdateToolbarPageText(WindowInfo* win, int pageCount, bool updateOnly) {
     int pos_x = r.right + 10;
     int pos_y = (r.bottom - pageWndRect.dy) / 2;
 
-    WCHAR* buf;
+    // this is called for every page change in documents with page labels,
+    // so the text is formatted on the stack
+    WCHAR buf[64] = {0};
     Size size2;
     if (-1 == pageCount) {
         // preserve hwndPageTotal's text and size
-        buf = win::GetText(win->hwndPageTotal);
+        GetWindowTextW(win->hwndPageTotal, buf, dimof(buf));
         size2 = ClientRect(win->hwndPageTotal).Size();
         size2.dx -= TB_TEXT_PADDING_RIGHT;
     } else if (!pageCount)
-        buf = str::Dup(L"");
+        buf[0] = 0;
     else if (!win->ctrl || !win->ctrl->HasPageLabels())
-        buf = str::Format(L" / %d", pageCount);
+        str::BufFmt(buf, dimof(buf), L" / %d", pageCount);
     else {
-        buf = str::Format(L" (%d / %d)", win->ctrl->CurrentPageNo(), pageCount);
-        AutoFreeWstr buf2(str::Format(L" (%d / %d)", pageCount, pageCount));
+        str::BufFmt(buf, dimof(buf), L" (%d / %d)", win->ctrl->CurrentPageNo(), pageCount);
+        str::FmtBuf<WCHAR, 64> buf2(L" (%d / %d)", pageCount, pageCount);
         size2 = TextSizeInHwnd(win->hwndPageTotal, buf2);
     }
 
@@ -507,7 +509,6 @@ void UpdateToolbarPageText(WindowInfo* win, int pageCount, bool updateOnly) {
     if (0 == size2.dx)
         size2 = TextSizeInHwnd(win->hwndPageTotal, buf);
     size2.dx += TB_TEXT_PADDING_RIGHT;
-    free(buf);
 
     int padding = GetSystemMetrics(SM_CXEDGE);
     MoveWindow(win->hwndPageText, pos_x, (pageWndRect.dy - size.dy + 1) / 2 + pos_y, size.dx, size.dy, FALSE);
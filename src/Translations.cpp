@@ -11,6 +11,7 @@
 #endif
 
 // Note: this code is intentionally optimized for (small) size, not speed
+// (except for looking up strings, see GetEnglishStringIndex)
 
 namespace trans {
 
@@ -226,12 +227,46 @@ const char* DetectUserLang() {
     return "en";
 }
 
-static int GetEnglishStringIndex(const char* txt) {
+// _TR() is called hundreds of times when building menus and dialogs, so
+// instead of comparing against all the English strings, they're indexed
+// in a hash table (open addressing with linear probing). Slots contain
+// the index of the string + 1 (0 is an empty slot).
+// The index of a string is the same for all languages, so the table is
+// only built once.
+static int* gEnglishIndex = nullptr;
+static int gEnglishIndexMask = 0;
+
+static void BuildEnglishIndex() {
+    int size = 64;
+    // keep the table at most half full
+    while (size < gStringsCount * 2) {
+        size *= 2;
+    }
+    gEnglishIndex = AllocArray<int>(size);
+    gEnglishIndexMask = size - 1;
     const char** origStrings = GetOriginalStrings();
     for (int idx = 0; idx < gStringsCount; idx++) {
         const char* s = origStrings[idx];
-        if (str::Eq(s, txt))
+        int slot = (int)(MurmurHash2(s, str::Len(s)) & gEnglishIndexMask);
+        while (gEnglishIndex[slot] != 0) {
+            slot = (slot + 1) & gEnglishIndexMask;
+        }
+        gEnglishIndex[slot] = idx + 1;
+    }
+}
+
+static int GetEnglishStringIndex(const char* txt) {
+    if (!gEnglishIndex) {
+        BuildEnglishIndex();
+    }
+    const char** origStrings = GetOriginalStrings();
+    int slot = (int)(MurmurHash2(txt, str::Len(txt)) & gEnglishIndexMask);
+    while (gEnglishIndex[slot] != 0) {
+        int idx = gEnglishIndex[slot] - 1;
+        if (str::Eq(origStrings[idx], txt)) {
             return idx;
+        }
+        slot = (slot + 1) & gEnglishIndexMask;
     }
     return -1;
 }
@@ -267,6 +302,8 @@ void Destroy() {
 
     FreeTransCache();
     FreeMissingTranslations();
+    free(gEnglishIndex);
+    gEnglishIndex = nullptr;
 }
 
 } // namespace trans
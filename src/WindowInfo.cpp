@@ -38,6 +38,7 @@
 #include "WindowInfo.h"
 #include "TabInfo.h"
 #include "TableOfContents.h"
+#include "TileCompositor.h"
 #include "resource.h"
 #include "Caption.h"
 #include "Selection.h"
@@ -75,6 +76,7 @@ WindowInfo::~WindowInfo() {
 
     delete linkHandler;
     delete buffer;
+    delete compositor;
     delete notifications;
     delete tabSelectionHistory;
     DeleteCaption(caption);
@@ -9,6 +9,7 @@ class SumatraUIAutomationProvider;
 class FrameRateWnd;
 struct LabelWithCloseWnd;
 class SplitterWnd;
+class TileCompositor;
 struct SplitterCtrl;
 struct CaptionInfo;
 
@@ -156,6 +157,8 @@ class WindowInfo {
     bool isMenuHidden = false; // not persisted at shutdown
 
     DoubleBuffer* buffer = nullptr;
+    // only used if GlobalPrefs::gpuCompositing is set (created when first needed)
+    TileCompositor* compositor = nullptr;
 
     MouseAction mouseAction = MouseAction::Idle;
     bool dragStartPending = false;
@@ -173,6 +176,12 @@ class WindowInfo {
     int xScrollSpeed = 0;
     int yScrollSpeed = 0;
 
+    // zoom levels between which zooming is being animated
+    // (cf. ZoomToSelectionAnimated, zoomAnimFrame is 0 if there's no animation)
+    float zoomAnimFrom = 0;
+    float zoomAnimTo = 0;
+    int zoomAnimFrame = 0;
+
     // true while selecting and when currentTab->selectionOnPage != nullptr
     bool showSelection = false;
     // selection rectangle in screen coordinates (only needed while selecting)
@@ -191,6 +200,7 @@ class WindowInfo {
     Rect nonFullScreenFrameRect{};
 
     Rect canvasRc{};    // size of the canvas (excluding any scroll bars)
+    bool inSizeMove = false; // the window is being resized or moved by the user
     int currPageNo = 0; // cached value, needed to determine when to auto-update the ToC selection
 
     int wheelAccumDelta = 0;
@@ -203,6 +213,12 @@ class WindowInfo {
 
     HANDLE findThread = nullptr;
     bool findCanceled = false;
+    // set while find as you type waits for the user to stop typing
+    bool findAsYouTypePending = false;
+
+    // extracts the text of large selections for copying (cf. CopySelectionToClipboard)
+    HANDLE copyTextThread = nullptr;
+    bool copyTextCanceled = false;
 
     LinkHandler* linkHandler = nullptr;
     PageElement* linkOnLastButtonDown = nullptr;
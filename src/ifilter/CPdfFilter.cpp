@@ -15,10 +15,27 @@
 #include "PdfFilter.h"
 #include "CPdfFilter.h"
 
+// the limits can be changed through DWORD values MaxPages and
+// MaxTextSizeMB under HKLM or HKCU\Software\Classes\CLSID\{filter CLSID}
+#define PDF_FILTER_REG_KEY L"Software\\Classes\\CLSID\\" SZ_PDF_FILTER_CLSID
+#define PDF_FILTER_MAX_PAGES 5000
+#define PDF_FILTER_MAX_TEXT_SIZE_MB 16
+
+static DWORD ReadFilterLimit(const WCHAR* valName, DWORD defValue) {
+    DWORD value = 0;
+    if (ReadRegDWORD(HKEY_LOCAL_MACHINE, PDF_FILTER_REG_KEY, valName, value) && value > 0) {
+        return value;
+    }
+    if (ReadRegDWORD(HKEY_CURRENT_USER, PDF_FILTER_REG_KEY, valName, value) && value > 0) {
+        return value;
+    }
+    return defValue;
+}
+
 VOID CPdfFilter::CleanUp() {
-    if (m_pdfEngine) {
-        delete m_pdfEngine;
-        m_pdfEngine = nullptr;
+    if (m_pdfText) {
+        delete m_pdfText;
+        m_pdfText = nullptr;
     }
     m_state = STATE_PDF_END;
 }
@@ -26,27 +43,15 @@ VOID CPdfFilter::CleanUp() {
 HRESULT CPdfFilter::OnInit() {
     CleanUp();
 
-    // TODO: EnginePdf::CreateFromStream never returns with
-    //       m_pStream instead of a clone - why?
-
-    // load content of PDF document into a seekable stream
-    HRESULT res;
-    AutoFree data = GetDataFromStream(m_pStream, &res);
-    if (data.empty()) {
-        return res;
-    }
-
-    auto strm = CreateStreamFromData(data.as_view());
-    ScopedComPtr<IStream> stream(strm);
-    if (!stream) {
-        return E_FAIL;
-    }
-
-    m_pdfEngine = CreateEnginePdfFromStream(stream);
-    if (!m_pdfEngine) {
+    // only the text is needed, so the document isn't loaded as an engine
+    m_pdfText = PdfTextExtractor::CreateFromStream(m_pStream);
+    if (!m_pdfText) {
         return E_FAIL;
     }
 
+    m_maxPages = (int)ReadFilterLimit(L"MaxPages", PDF_FILTER_MAX_PAGES);
+    m_maxTextLen = (size_t)ReadFilterLimit(L"MaxTextSizeMB", PDF_FILTER_MAX_TEXT_SIZE_MB) << 20;
+    m_textLen = 0;
     m_state = STATE_PDF_START;
     m_iPageNo = 0;
     return S_OK;
@@ -77,7 +82,7 @@ HRESULT CPdfFilter::GetNextChunkValue(CChunkValue& chunkValue) {
 
         case STATE_PDF_AUTHOR:
             m_state = STATE_PDF_TITLE;
-            str.Set(m_pdfEngine->GetProperty(DocumentProperty::Author));
+            str.Set(m_pdfText->GetProperty(DocumentProperty::Author));
             if (!str::IsEmpty(str.Get())) {
                 chunkValue.SetTextValue(PKEY_Author, str);
                 return S_OK;
@@ -86,9 +91,9 @@ HRESULT CPdfFilter::GetNextChunkValue(CChunkValue& chunkValue) {
 
         case STATE_PDF_TITLE:
             m_state = STATE_PDF_DATE;
-            str.Set(m_pdfEngine->GetProperty(DocumentProperty::Title));
+            str.Set(m_pdfText->GetProperty(DocumentProperty::Title));
             if (!str)
-                str.Set(m_pdfEngine->GetProperty(DocumentProperty::Subject));
+                str.Set(m_pdfText->GetProperty(DocumentProperty::Subject));
             if (!str::IsEmpty(str.Get())) {
                 chunkValue.SetTextValue(PKEY_Title, str);
                 return S_OK;
@@ -97,9 +102,9 @@ HRESULT CPdfFilter::GetNextChunkValue(CChunkValue& chunkValue) {
 
         case STATE_PDF_DATE:
             m_state = STATE_PDF_CONTENT;
-            str.Set(m_pdfEngine->GetProperty(DocumentProperty::ModificationDate));
+            str.Set(m_pdfText->GetProperty(DocumentProperty::ModificationDate));
             if (!str)
-                str.Set(m_pdfEngine->GetProperty(DocumentProperty::CreationDate));
+                str.Set(m_pdfText->GetProperty(DocumentProperty::CreationDate));
             if (!str::IsEmpty(str.Get())) {
                 SYSTEMTIME systime;
                 FILETIME filetime;
@@ -111,12 +116,13 @@ HRESULT CPdfFilter::GetNextChunkValue(CChunkValue& chunkValue) {
             // fall through
 
         case STATE_PDF_CONTENT:
-            while (++m_iPageNo <= m_pdfEngine->PageCount()) {
-                str.Set(m_pdfEngine->ExtractPageText(m_iPageNo));
+            while (++m_iPageNo <= std::min(m_pdfText->PageCount(), m_maxPages) && m_textLen < m_maxTextLen) {
+                str.Set(m_pdfText->ExtractPageText(m_iPageNo));
                 if (str::IsEmpty(str.Get())) {
                     continue;
                 }
                 AutoFreeWstr str2 = str::Replace(str.get(), L"\n", L"\r\n");
+                m_textLen += str::Len(str2.get()) * sizeof(WCHAR);
                 chunkValue.SetTextValue(PKEY_Search_Contents, str2.get(), CHUNK_TEXT);
                 return S_OK;
             }
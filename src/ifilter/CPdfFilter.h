@@ -3,13 +3,13 @@
 
 enum PDF_FILTER_STATE { STATE_PDF_START, STATE_PDF_AUTHOR, STATE_PDF_TITLE, STATE_PDF_DATE, STATE_PDF_CONTENT, STATE_PDF_END };
 
-class EngineBase;
+class PdfTextExtractor;
 
 class CPdfFilter : public CFilterBase
 {
 public:
     CPdfFilter(long *plRefCount) : CFilterBase(plRefCount),
-        m_state(STATE_PDF_END), m_iPageNo(-1), m_pdfEngine(nullptr) { }
+        m_state(STATE_PDF_END), m_iPageNo(-1), m_pdfText(nullptr) { }
     ~CPdfFilter()  override { CleanUp(); }
 
     HRESULT OnInit() override;
@@ -25,5 +25,9 @@ public:
 private:
     PDF_FILTER_STATE m_state;
     int m_iPageNo;
-    EngineBase *m_pdfEngine;
+    // limits for how much text is indexed per document
+    int m_maxPages;
+    size_t m_maxTextLen;
+    size_t m_textLen;
+    PdfTextExtractor *m_pdfText;
 };
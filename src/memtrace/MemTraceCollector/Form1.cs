@@ -27,8 +27,19 @@ namespace MemTraceCollector
         public enum MsgId : ushort {
             AllocData  = 1,
             FreeData = 2,
+            CallSite = 3,
         };
 
+        // aggregated samples of allocations from the same call stack
+        // (only sent if memtrace.dll runs in sampling mode)
+        public class CallSite
+        {
+            public UInt32 SampledCount;
+            public UInt64 LiveBytes;
+            public UInt64 TotalBytes;
+            public UInt32[] Frames;
+        }
+
         public class PipeClient
         {
             public SafeFileHandle FileHandle;
@@ -37,6 +48,7 @@ namespace MemTraceCollector
             public event ClientDisconnectedHandler ClientDisconnected;
             public UInt64 CurrAllocated;
             public Dictionary<UInt32, UInt32> CurrAllocsMap = new Dictionary<uint, uint>(16 * 1024);
+            public Dictionary<UInt32, CallSite> CallSites = new Dictionary<uint, CallSite>();
 
             public void NotifyNewMessage(byte[] msg)
             {
@@ -125,6 +137,54 @@ namespace MemTraceCollector
             UpdateCurrAllocated(client.CurrAllocated);
         }
 
+        void DecodeCallSiteMsg(PipeClient client, byte[] msg)
+        {
+            UInt32 id = BitConverter.ToUInt32(msg, 2);
+            CallSite site;
+            if (!client.CallSites.TryGetValue(id, out site))
+            {
+                site = new CallSite();
+                client.CallSites[id] = site;
+            }
+            site.SampledCount = BitConverter.ToUInt32(msg, 6);
+            site.LiveBytes = BitConverter.ToUInt64(msg, 10);
+            site.TotalBytes = BitConverter.ToUInt64(msg, 18);
+            int nFrames = BitConverter.ToUInt16(msg, 26);
+            site.Frames = new UInt32[nFrames];
+            for (int i = 0; i < nFrames; i++)
+                site.Frames[i] = BitConverter.ToUInt32(msg, 28 + i * 4);
+            UpdateCallSites(client);
+        }
+
+        const int MAX_CALL_SITES_SHOWN = 25;
+
+        DateTime callSitesLastUpdateTime = DateTime.Now;
+        // shows the call sites with the most estimated live bytes
+        // (the return addresses aren't symbolized)
+        void UpdateCallSites(PipeClient client)
+        {
+            TimeSpan diff = DateTime.Now - callSitesLastUpdateTime;
+            if (diff.TotalMilliseconds < 1000)
+                return;
+            List<CallSite> sites = new List<CallSite>(client.CallSites.Values);
+            sites.Sort(delegate(CallSite a, CallSite b) { return b.LiveBytes.CompareTo(a.LiveBytes); });
+            UInt64 liveBytes = 0;
+            foreach (CallSite site in sites)
+                liveBytes += site.LiveBytes;
+
+            StringBuilder sb = new StringBuilder();
+            sb.AppendFormat("~{0} bytes allocated from {1} call sites\r\n", liveBytes, sites.Count);
+            for (int i = 0; i < sites.Count && i < MAX_CALL_SITES_SHOWN; i++)
+            {
+                CallSite site = sites[i];
+                sb.AppendFormat("\r\n~{0} bytes live ({1} samples), ~{2} bytes total:\r\n", site.LiveBytes, site.SampledCount, site.TotalBytes);
+                foreach (UInt32 addr in site.Frames)
+                    sb.AppendFormat("  0x{0:x8}\r\n", addr);
+            }
+            tbFromClients.Text = sb.ToString();
+            callSitesLastUpdateTime = DateTime.Now;
+        }
+
         DateTime currAllocatedLastUpdateTime = DateTime.Now;
         void UpdateCurrAllocated(ulong currAllocated)
         {
@@ -146,6 +206,9 @@ namespace MemTraceCollector
                 case MsgId.FreeData:
                     DecodeFreeDataMsg(client, msg);
                     break;
+                case MsgId.CallSite:
+                    DecodeCallSiteMsg(client, msg);
+                    break;
             }
         }
 
@@ -17,6 +17,16 @@ The data sent via named pipe is framed as messages (packets):
 uint16  messageLen; // length of the data follows
 uint16  msgId;      // determines how the data is to be decoded
 byte    data[];     // bytes for a given message
+
+Tracing every allocation makes programs too slow for realistic workloads.
+If the environment variable MEMTRACE_SAMPLE_BYTES is set to e.g. 524288,
+allocations are sampled instead: on average one sample is taken per that many
+allocated bytes (the distance between samples is exponentially distributed,
+like in tcmalloc, so that the samples are unbiased). For sampled allocations
+the call stack is captured and their bytes (scaled to estimate all allocations)
+are aggregated per call stack. Instead of a message per allocation and free,
+the call sites which changed are sent every SNAPSHOT_INTERVAL_MS as
+CallSiteMsgId messages.
 */
 
 #include "BaseUtil.h"
@@ -33,6 +43,13 @@ byte    data[];     // bytes for a given message
 #define MIN_BLOCK_SIZE      1024*32
 #define MEMCOPY_THRESHOLD   1024
 
+#define SAMPLE_BYTES_ENV_VAR    "MEMTRACE_SAMPLE_BYTES"
+#define SNAPSHOT_INTERVAL_MS    1000
+#define MAX_STACK_FRAMES        16
+// both must be powers of 2
+#define MAX_CALL_SITES          (16*1024)
+#define MAX_SAMPLED_ALLOCS      (256*1024)
+
 // a block of memory. data to be sent is appended at the end,
 // sending thread consumes the data from the beginning
 struct MemBlock {
@@ -53,6 +70,28 @@ struct MemBlock {
 struct PerThreadData {
     bool        inAlloc;
     bool        inFree;
+    // for sampling: the next allocation is sampled once they've come to that many bytes
+    int64       bytesUntilSample;
+    uint32      rngState;
+};
+
+// the aggregated samples of allocations from a given call stack
+struct CallSite {
+    uint32      hash; // 0 if the entry is unused
+    uint16      nFrames;
+    bool        changed;
+    void *      frames[MAX_STACK_FRAMES];
+    // estimates for all allocations (not just the sampled ones)
+    uint64      liveBytes;
+    uint64      totalBytes;
+    uint32      liveCount;
+};
+
+// a sampled allocation that hasn't been freed yet
+struct SampledAlloc {
+    void *      addr; // nullptr if the entry is unused
+    uint32      callSite;
+    uint32      weight;
 };
 
 static HANDLE           gModule;
@@ -85,6 +124,15 @@ static CRITICAL_SECTION gMemMutex;
 static HANDLE           gSendThreadEvent;
 static HANDLE           gSendThread;
 
+// 0 if every allocation is traced, else the average number of bytes per sample
+static int64            gSampleBytes;
+// hash tables (with linear probing) allocated from gHeap in sampling mode
+static CallSite *       gCallSites;
+static SampledAlloc *   gSampledAllocs;
+static int              gSampledAllocsCount;
+// protects gCallSites and gSampledAllocs
+static CRITICAL_SECTION gSampleMutex;
+
 static PerThreadData *GetPerThreadData(PerThreadData *threadDataEmergency)
 {
     void *data = TlsGetValue(gTlsIndex);
@@ -103,6 +151,8 @@ static PerThreadData *GetPerThreadData(PerThreadData *threadDataEmergency)
     PerThreadData *tmp = (PerThreadData*)data;
     tmp->inAlloc = false;
     tmp->inFree = false;
+    tmp->bytesUntilSample = 0;
+    tmp->rngState = GetCurrentThreadId() * 2654435761u | 1;
     return tmp;
 }
 
@@ -205,7 +255,9 @@ static void FreeAllBlocks()
 
 enum SerializeMsgId {
     AllocDataMsgId  = 1,
-    FreeDataMsgId   = 2
+    FreeDataMsgId   = 2,
+    // only sent in sampling mode, see SendSnapshot()
+    CallSiteMsgId   = 3
 };
 
 // TODO: since we use 32 bits, we don't support 64 builds
@@ -429,14 +481,17 @@ static void SendQueuedMessages()
 
 static DWORD WINAPI DataSendThreadProc(void* data)
 {
+    DWORD timeout = gSampleBytes ? SNAPSHOT_INTERVAL_MS : INFINITE;
     // if pipe was closed, we exit the thread
     while (gPipe) {
-        DWORD res = WaitForSingleObject(gSendThreadEvent, INFINITE);
+        DWORD res = WaitForSingleObject(gSendThreadEvent, timeout);
         if (gStopSendThread) {
             lf("memtrace.dll: DataSendThreadProc, gStopSendThread is true");
             return 0;
         }
-        if (WAIT_OBJECT_0 != res)
+        if (WAIT_TIMEOUT == res && gSampleBytes)
+            SendSnapshot();
+        else if (WAIT_OBJECT_0 != res)
             continue;
 
         SendQueuedMessages();
@@ -446,21 +501,212 @@ static DWORD WINAPI DataSendThreadProc(void* data)
 }
 
 // transfers the data to a thread that does the actual sending
-static void QueueMessageForSending(Vec<byte>& msg)
+static void QueueDataForSending(byte *data, size_t len)
 {
-    size_t len = msg.Size();
     if (0 == len)
         return;
 
     MemBlock *block = GetBlock(len);
     if (block) {
-        block->Append(msg.LendData(), len);
+        block->Append(data, len);
         SetEvent(gSendThreadEvent);
     } else {
-        lf("memtrace.dll: QueueMessageForSending() couldn't queu %d bytes", (int)len);
+        lf("memtrace.dll: QueueDataForSending() couldn't queu %d bytes", (int)len);
+    }
+}
+
+static void QueueMessageForSending(Vec<byte>& msg)
+{
+    QueueDataForSending(msg.LendData(), msg.Size());
+}
+
+// xorshift32, good enough for spacing out samples
+static uint32 NextRandom(PerThreadData *threadData)
+{
+    uint32 x = threadData->rngState;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    threadData->rngState = x;
+    return x;
+}
+
+// the number of bytes until the next sample is exponentially distributed
+// with a mean of gSampleBytes (so that every byte is equally likely to be sampled)
+static int64 NextSampleDistance(PerThreadData *threadData)
+{
+    // in (0, 1]
+    double u = ((double)(NextRandom(threadData) >> 8) + 1.0) / (double)(1 << 24);
+    return (int64)(-log(u) * (double)gSampleBytes) + 1;
+}
+
+// returns true if an allocation of size bytes should be sampled (and the
+// number of bytes it stands for in weightOut)
+static bool ShouldSample(PerThreadData *threadData, size_t size, uint32 *weightOut)
+{
+    threadData->bytesUntilSample -= (int64)size;
+    if (threadData->bytesUntilSample > 0)
+        return false;
+    threadData->bytesUntilSample = NextSampleDistance(threadData);
+    // an allocation of size bytes is sampled with probability 1 - exp(-size / gSampleBytes)
+    double p = 1.0 - exp(-(double)size / (double)gSampleBytes);
+    double weight = p > 0 ? (double)size / p : (double)gSampleBytes;
+    *weightOut = weight < (double)UINT_MAX ? (uint32)weight : UINT_MAX;
+    return true;
+}
+
+static uint32 PtrHash(void *addr)
+{
+    uintptr_t v = (uintptr_t)addr;
+    // heap allocations are aligned, so the lowest bits are always the same
+    return (uint32)((v >> 3) * 2654435761u);
+}
+
+// must be called with gSampleMutex held. returns the index of the call site in gCallSites
+static uint32 GetCallSite(void **frames, uint16 nFrames, uint32 hash)
+{
+    if (0 == hash)
+        hash = 1;
+    uint32 idx = hash & (MAX_CALL_SITES - 1);
+    for (int i = 0; i < MAX_CALL_SITES; i++) {
+        CallSite *site = &gCallSites[idx];
+        if (0 == site->hash) {
+            site->hash = hash;
+            site->nFrames = nFrames;
+            memcpy(site->frames, frames, nFrames * sizeof(void*));
+            return idx;
+        }
+        if (site->hash == hash && site->nFrames == nFrames && 0 == memcmp(site->frames, frames, nFrames * sizeof(void*)))
+            return idx;
+        idx = (idx + 1) & (MAX_CALL_SITES - 1);
+    }
+    // the table is full: attribute everything else to the last site
+    return (hash - 1) & (MAX_CALL_SITES - 1);
+}
+
+static void RecordSampledAlloc(void *addr, void **frames, uint16 nFrames, uint32 hash, uint32 weight)
+{
+    ScopedCritSec cs(&gSampleMutex);
+    // keep the table at most half full so that probe sequences remain short
+    if (gSampledAllocsCount >= MAX_SAMPLED_ALLOCS / 2) {
+        return;
+    }
+    uint32 siteIdx = GetCallSite(frames, nFrames, hash);
+    CallSite *site = &gCallSites[siteIdx];
+    site->liveBytes += weight;
+    site->totalBytes += weight;
+    site->liveCount++;
+    site->changed = true;
+
+    uint32 idx = PtrHash(addr) & (MAX_SAMPLED_ALLOCS - 1);
+    while (gSampledAllocs[idx].addr) {
+        idx = (idx + 1) & (MAX_SAMPLED_ALLOCS - 1);
+    }
+    gSampledAllocs[idx].addr = addr;
+    gSampledAllocs[idx].callSite = siteIdx;
+    gSampledAllocs[idx].weight = weight;
+    gSampledAllocsCount++;
+}
+
+static void RecordFree(void *addr)
+{
+    // most frees are of allocations that weren't sampled
+    if (0 == gSampledAllocsCount)
+        return;
+    ScopedCritSec cs(&gSampleMutex);
+    uint32 idx = PtrHash(addr) & (MAX_SAMPLED_ALLOCS - 1);
+    while (gSampledAllocs[idx].addr != addr) {
+        if (!gSampledAllocs[idx].addr)
+            return;
+        idx = (idx + 1) & (MAX_SAMPLED_ALLOCS - 1);
+    }
+    CallSite *site = &gCallSites[gSampledAllocs[idx].callSite];
+    site->liveBytes -= gSampledAllocs[idx].weight;
+    site->liveCount--;
+    site->changed = true;
+    gSampledAllocsCount--;
+
+    // backward shift deletion, so that lookups don't need tombstones
+    uint32 hole = idx;
+    for (;;) {
+        idx = (idx + 1) & (MAX_SAMPLED_ALLOCS - 1);
+        void *other = gSampledAllocs[idx].addr;
+        if (!other)
+            break;
+        uint32 home = PtrHash(other) & (MAX_SAMPLED_ALLOCS - 1);
+        // can the entry at idx be moved into the hole (i.e. is home cyclically outside (hole, idx])?
+        bool canMove = (hole <= idx) ? (home <= hole || home > idx) : (home <= hole && home > idx);
+        if (canMove) {
+            gSampledAllocs[hole] = gSampledAllocs[idx];
+            hole = idx;
+        }
+    }
+    gSampledAllocs[hole].addr = nullptr;
+}
+
+static byte *AppendNum(byte *dst, const void *src, size_t len)
+{
+    memcpy(dst, src, len);
+    return dst + len;
+}
+
+// sends the aggregated samples of all the call sites that changed since the
+// last snapshot. a CallSiteMsgId message consists of:
+// uint32 callSiteId, uint32 liveCount, uint64 liveBytes, uint64 totalBytes,
+// uint16 nFrames followed by nFrames uint32 return addresses
+static void SendSnapshot()
+{
+    byte buf[2 + 2 + 4 + 4 + 8 + 8 + 2 + MAX_STACK_FRAMES * 4];
+    for (uint32 i = 0; i < MAX_CALL_SITES; i++) {
+        byte *d = buf;
+        {
+            ScopedCritSec cs(&gSampleMutex);
+            CallSite *site = &gCallSites[i];
+            if (!site->changed)
+                continue;
+            site->changed = false;
+            d += 2; // the message length is filled in below
+            uint16 msgId = CallSiteMsgId;
+            d = AppendNum(d, &msgId, 2);
+            d = AppendNum(d, &i, 4);
+            d = AppendNum(d, &site->liveCount, 4);
+            d = AppendNum(d, &site->liveBytes, 8);
+            d = AppendNum(d, &site->totalBytes, 8);
+            d = AppendNum(d, &site->nFrames, 2);
+            for (uint16 j = 0; j < site->nFrames; j++) {
+                // TODO: like the rest of the messages, this doesn't support 64-bit builds
+                uint32 addr = (uint32)(uintptr_t)site->frames[j];
+                d = AppendNum(d, &addr, 4);
+            }
+        }
+        uint16 msgLen = (uint16)(d - buf - 2);
+        memcpy(buf, &msgLen, 2);
+        QueueDataForSending(buf, d - buf);
     }
 }
 
+static bool InitSampling()
+{
+    char val[32];
+    DWORD n = GetEnvironmentVariableA(SAMPLE_BYTES_ENV_VAR, val, dimof(val));
+    if (0 == n || n >= dimof(val))
+        return true;
+    gSampleBytes = _atoi64(val);
+    if (gSampleBytes <= 0) {
+        gSampleBytes = 0;
+        return true;
+    }
+    InitializeCriticalSection(&gSampleMutex);
+    gCallSites = (CallSite*)HeapAlloc(gHeap, HEAP_ZERO_MEMORY, MAX_CALL_SITES * sizeof(CallSite));
+    gSampledAllocs = (SampledAlloc*)HeapAlloc(gHeap, HEAP_ZERO_MEMORY, MAX_SAMPLED_ALLOCS * sizeof(SampledAlloc));
+    if (!gCallSites || !gSampledAllocs) {
+        lf("memtrace.dll: failed to allocate tables for sampling");
+        return false;
+    }
+    lf("memtrace.dll: sampling every %d bytes", (int)gSampleBytes);
+    return true;
+}
+
 WindowsDllInterceptor gNtdllIntercept;
 
 //http://msdn.microsoft.com/en-us/library/windows/hardware/ff552108(v=vs.85).aspx
@@ -483,6 +729,19 @@ PVOID WINAPI RtlAllocateHeapHook(PVOID heapHandle, ULONG flags, SIZE_T size)
     if (inAlloc)
         return res;
 
+    if (gSampleBytes) {
+        uint32 weight;
+        if (res && ShouldSample(threadData, size, &weight)) {
+            void *frames[MAX_STACK_FRAMES];
+            ULONG hash = 0;
+            // skip this hook
+            USHORT nFrames = RtlCaptureStackBackTrace(1, MAX_STACK_FRAMES, frames, &hash);
+            RecordSampledAlloc(res, frames, (uint16)nFrames, (uint32)hash, weight);
+        }
+        threadData->inAlloc = false;
+        return res;
+    }
+
     AllocData d = { (uint32)size, (uint32)res };
     Vec<byte> msg;
     SerializeType((byte*)&d, &allocDataTypeInfo, msg);
@@ -501,10 +760,18 @@ BOOLEAN WINAPI RtlFreeHeapHook(PVOID heapHandle, ULONG flags, PVOID heapBase)
     bool inFree = threadData->inFree;
     // prevent infinite recursion
     threadData->inFree = true;
+    // forget about the allocation before the address can be re-used
+    if (gSampleBytes && !inFree)
+        RecordFree(heapBase);
     BOOLEAN res = gRtlFreeHeapOrig(heapHandle, flags, heapBase);
     if (inFree)
         return res;
 
+    if (gSampleBytes) {
+        threadData->inFree = false;
+        return res;
+    }
+
     FreeData d = { (uint32)heapBase };
     Vec<byte> msg;
     SerializeType((byte*)&d, &freeDataTypeInfo, msg);
@@ -549,6 +816,8 @@ static BOOL ProcessAttach()
     }
 
     InitializeCriticalSection(&gMemMutex);
+    if (!InitSampling())
+        return FALSE;
     gSendThreadEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
     if (!gSendThreadEvent) {
         lf("memtrace.dll: couldn't create gSendThreadEvent");
@@ -582,6 +851,8 @@ static void TerminateSendingThread()
         lf("memtrace.dll: terminated sending thread");
     }
     CloseHandle(gSendThread);
+    if (gSampleBytes)
+        SendSnapshot();
     SendQueuedMessages();
 }
 
@@ -591,6 +862,8 @@ static BOOL ProcessDetach()
     TerminateSendingThread();
     ClosePipe();
     DeleteCriticalSection(&gMemMutex);
+    if (gSampleBytes)
+        DeleteCriticalSection(&gSampleMutex);
     CloseHandle(gSendThreadEvent);
     FreeAllBlocks();
     lf("memtrace.dll: allocated total %d blocks", gBlocksAllocated);
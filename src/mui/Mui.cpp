@@ -207,9 +207,19 @@ void RequestRepaint(Control* c, const Gdiplus::Rect* r1, const Gdiplus::Rect* r2
     InvalidateAtOff(hwnd, &wRect, offX, offY);
 }
 
+// only the area of c is repainted unless the layout moves other controls
 void RequestLayout(Control* c) {
     HwndWrapper* wnd = GetRootHwndWnd(c);
-    if (wnd)
+    if (!wnd)
+        return;
+    if (c == wnd) {
         wnd->RequestLayout();
+        return;
+    }
+    int offX = 0, offY = 0;
+    c->MapMyToRootPos(offX, offY);
+    Gdiplus::Rect r(offX, offY, c->pos.Width, c->pos.Height);
+    r.Inflate(1, 1);
+    wnd->RequestLayout(&r);
 }
 } // namespace mui
@@ -22,7 +22,8 @@ void LeaveMuiCriticalSection() {
 
 class FontListItem {
   public:
-    FontListItem(const WCHAR* name, float sizePt, FontStyle style, Font* font, HFONT hFont) : next(nullptr) {
+    FontListItem(const WCHAR* name, float sizePt, FontStyle style, Font* font, HFONT hFont, u32 hash)
+        : hash(hash), next(nullptr) {
         cf.name = str::Dup(name);
         cf.sizePt = sizePt;
         cf.style = style;
@@ -37,15 +38,63 @@ class FontListItem {
     }
 
     CachedFont cf;
+    u32 hash;
     FontListItem* next;
 };
 
 // Global, thread-safe font cache. Font objects live forever.
 static FontListItem* gFontsCache = nullptr;
 
-// Graphics objects cannot be used across threads. We have a per-thread
-// cache so that it's easy to grab Graphics object to be used for
-// measuring text
+// Open-addressing hash index into gFontsCache for lookups without taking gMuiCs.
+// Slots only ever change from nullptr to a fully constructed item (under gMuiCs),
+// so readers can probe it concurrently. Fonts that don't fit into the index
+// are only found by walking gFontsCache.
+#define FONTS_INDEX_SIZE 1024
+static FontListItem* volatile gFontsIndex[FONTS_INDEX_SIZE];
+static int gFontsIndexCount = 0;
+
+static u32 HashFont(const WCHAR* name, float sizePt, FontStyle style) {
+    u32 h = name ? MurmurHash2(name, str::Len(name) * sizeof(WCHAR)) : 0;
+    u32 sizeBits;
+    memcpy(&sizeBits, &sizePt, sizeof(sizeBits));
+    h ^= sizeBits * 0x9e3779b1;
+    h ^= (u32)style * 0x85ebca6b;
+    return h;
+}
+
+static FontListItem* FindIndexedFont(u32 hash, const WCHAR* name, float sizePt, FontStyle style) {
+    for (u32 i = 0; i < FONTS_INDEX_SIZE; i++) {
+        u32 slot = (hash + i) % FONTS_INDEX_SIZE;
+        FontListItem* item = (FontListItem*)ReadPointerAcquire((PVOID volatile*)&gFontsIndex[slot]);
+        if (!item) {
+            return nullptr;
+        }
+        if (item->hash == hash && item->cf.SameAs(name, sizePt, style)) {
+            return item;
+        }
+    }
+    return nullptr;
+}
+
+// must be called under gMuiCs
+static void IndexFont(FontListItem* item) {
+    // keep the index sparse so that probe sequences remain short
+    if (gFontsIndexCount >= FONTS_INDEX_SIZE * 3 / 4) {
+        return;
+    }
+    for (u32 i = 0; i < FONTS_INDEX_SIZE; i++) {
+        u32 slot = (item->hash + i) % FONTS_INDEX_SIZE;
+        if (!gFontsIndex[slot]) {
+            InterlockedExchangePointer((PVOID volatile*)&gFontsIndex[slot], item);
+            gFontsIndexCount++;
+            return;
+        }
+    }
+}
+
+// Graphics objects cannot be used across threads. Every thread measuring
+// text gets its own Graphics object (created on first use and freed when
+// the thread exits), so that getting one doesn't need any locking
 struct GraphicsCacheEntry {
     enum {
         bmpDx = 32,
@@ -53,7 +102,6 @@ struct GraphicsCacheEntry {
         stride = bmpDx * 4,
     };
 
-    DWORD threadId;
     int refCount;
 
     Graphics* gfx;
@@ -62,9 +110,14 @@ struct GraphicsCacheEntry {
 
     bool Create();
     void Free();
+    ~GraphicsCacheEntry();
 };
 
-static Vec<GraphicsCacheEntry>* gGraphicsCache = nullptr;
+static thread_local GraphicsCacheEntry gThreadGraphics;
+
+// all entries that have been created, so that DestroyBase can free
+// the ones of threads that are still running (protected by gMuiCs)
+static Vec<GraphicsCacheEntry*>* gGraphicsCache = nullptr;
 
 // set consistent mode for our graphics objects so that we get
 // the same results when measuring text
@@ -78,8 +131,7 @@ void InitGraphicsMode(Graphics* g) {
 
 bool GraphicsCacheEntry::Create() {
     memset(data, 0, sizeof(data));
-    refCount = 1;
-    threadId = GetCurrentThreadId();
+    refCount = 0;
     // using a small bitmap under assumption that Graphics used only
     // for measuring text doesn't need the actual bitmap
     bmp = ::new Bitmap(bmpDx, bmpDy, stride, PixelFormat32bppARGB, data);
@@ -96,22 +148,38 @@ void GraphicsCacheEntry::Free() {
     CrashIf(0 != refCount);
     ::delete gfx;
     ::delete bmp;
+    gfx = nullptr;
+    bmp = nullptr;
+}
+
+// called when a thread exits (unless DestroyBase has already freed the entry)
+GraphicsCacheEntry::~GraphicsCacheEntry() {
+    if (!gfx) {
+        return;
+    }
+    {
+        ScopedMuiCritSec muiCs;
+        gGraphicsCache->Remove(this);
+    }
+    Free();
 }
 
 void InitializeBase() {
     InitializeCriticalSection(&gMuiCs);
-    gGraphicsCache = new Vec<GraphicsCacheEntry>();
-    // allocate the first entry in gGraphicsCache for UI thread, ref count
+    gGraphicsCache = new Vec<GraphicsCacheEntry*>();
+    // allocate the entry for the UI thread, ref count
     // ensures it stays alive forever
     AllocGraphicsForMeasureText();
 }
 
 void DestroyBase() {
-    FreeGraphicsForMeasureText(gGraphicsCache->at(0).gfx);
-    for (GraphicsCacheEntry& e : *gGraphicsCache) {
-        e.Free();
+    FreeGraphicsForMeasureText(gThreadGraphics.gfx);
+    for (GraphicsCacheEntry* e : *gGraphicsCache) {
+        e->Free();
     }
     delete gGraphicsCache;
+    ZeroMemory((void*)gFontsIndex, sizeof(gFontsIndex));
+    gFontsIndexCount = 0;
     delete gFontsCache;
     DeleteCriticalSection(&gMuiCs);
 }
@@ -145,11 +213,21 @@ HFONT CachedFont::GetHFont() {
 // convenience function: given cached style, get a Font object matching the font
 // properties.
 // Caller should not delete the font - it's cached for performance and deleted at exit
+// The lookup doesn't lock, so that layout threads (which ask for a font
+// at every style change) don't contend with each other.
 CachedFont* GetCachedFont(const WCHAR* name, float sizePt, FontStyle style) {
+    u32 hash = HashFont(name, sizePt, style);
+    FontListItem* found = FindIndexedFont(hash, name, sizePt, style);
+    if (found) {
+        return &found->cf;
+    }
+
     ScopedMuiCritSec muiCs;
 
+    // another thread might've added the font in the meantime
+    // (or it might not have fit into the index)
     for (FontListItem* item = gFontsCache; item; item = item->next) {
-        if (item->cf.SameAs(name, sizePt, style) && item->cf.font != nullptr) {
+        if (item->hash == hash && item->cf.SameAs(name, sizePt, style)) {
             return &item->cf;
         }
     }
@@ -163,55 +241,39 @@ CachedFont* GetCachedFont(const WCHAR* name, float sizePt, FontStyle style) {
         }
     }
 
-    FontListItem* item = new FontListItem(name, sizePt, style, font, nullptr);
+    FontListItem* item = new FontListItem(name, sizePt, style, font, nullptr, hash);
     ListInsert(&gFontsCache, item);
+    IndexFont(item);
     return &item->cf;
 }
 
-Graphics* AllocGraphicsForMeasureText() {
+void GetCachedFontsCount(int* nFonts, int* nHFonts) {
     ScopedMuiCritSec muiCs;
-
-    DWORD threadId = GetCurrentThreadId();
-    for (GraphicsCacheEntry& e : *gGraphicsCache) {
-        if (e.threadId == threadId) {
-            e.refCount++;
-            return e.gfx;
+    *nFonts = 0;
+    *nHFonts = 0;
+    for (FontListItem* item = gFontsCache; item; item = item->next) {
+        (*nFonts)++;
+        if (item->cf.hFont) {
+            (*nHFonts)++;
         }
     }
-    GraphicsCacheEntry ce;
-    ce.Create();
-    gGraphicsCache->Append(ce);
-    if (gGraphicsCache->size() < 64)
-        return ce.gfx;
-
-    // try to limit the size of cache by evicting the oldest entries, but don't remove
-    // first (for ui thread) or last (one we just added) entries
-    for (size_t i = 1; i < gGraphicsCache->size() - 1; i++) {
-        GraphicsCacheEntry e = gGraphicsCache->at(i);
-        if (0 == e.refCount) {
-            e.Free();
-            gGraphicsCache->RemoveAt(i);
-            return ce.gfx;
-        }
+}
+
+Graphics* AllocGraphicsForMeasureText() {
+    GraphicsCacheEntry& e = gThreadGraphics;
+    if (!e.gfx && e.Create()) {
+        ScopedMuiCritSec muiCs;
+        gGraphicsCache->Append(&e);
     }
-    // We shouldn't get here - indicates ref counting problem
-    CrashIf(true);
-    return ce.gfx;
+    e.refCount++;
+    return e.gfx;
 }
 
 void FreeGraphicsForMeasureText(Graphics* gfx) {
-    ScopedMuiCritSec muiCs;
-
-    DWORD threadId = GetCurrentThreadId();
-    for (GraphicsCacheEntry& e : *gGraphicsCache) {
-        if (e.gfx == gfx) {
-            CrashIf(e.threadId != threadId);
-            e.refCount--;
-            CrashIf(e.refCount < 0);
-            return;
-        }
-    }
-    CrashIf(true);
+    GraphicsCacheEntry& e = gThreadGraphics;
+    CrashIf(e.gfx != gfx);
+    e.refCount--;
+    CrashIf(e.refCount < 0);
 }
 
 int CeilI(float n) {
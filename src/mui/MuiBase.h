@@ -42,6 +42,8 @@ struct CachedFont {
 
 void InitGraphicsMode(Graphics* g);
 CachedFont* GetCachedFont(const WCHAR* name, float sizePt, FontStyle style);
+// for -memstats: the number of cached fonts and of their HFONTs (cf. CachedFont::GetHFont)
+void GetCachedFontsCount(int* nFonts, int* nHFonts);
 
 Graphics* AllocGraphicsForMeasureText();
 void FreeGraphicsForMeasureText(Graphics* gfx);
@@ -115,11 +115,17 @@ void HwndWrapper::TopLevelLayout() {
 }
 
 // mark for re-layout as soon as possible
-void HwndWrapper::RequestLayout() {
+void HwndWrapper::RequestLayout(const Gdiplus::Rect* dirtyRect) {
     layoutRequested = true;
     markedForRepaint = true;
     // trigger message queue so that the layout request is processed
-    InvalidateRect(hwndParent, nullptr, TRUE);
+    if (dirtyRect) {
+        const Gdiplus::Rect& r = *dirtyRect;
+        RECT rc = {r.X, r.Y, r.X + r.Width, r.Y + r.Height};
+        InvalidateRect(hwndParent, &rc, FALSE);
+    } else {
+        InvalidateRect(hwndParent, nullptr, TRUE);
+    }
     UpdateWindow(hwndParent);
 }
 
@@ -29,7 +29,10 @@ class HwndWrapper : public Control {
     void SetMinSize(Gdiplus::Size minSize);
     void SetMaxSize(Gdiplus::Size maxSize);
 
-    void RequestLayout();
+    // the controls that end up at a different position are repainted after
+    // the layout, so only the area in dirtyRect (or everything if it's nullptr)
+    // needs to be repainted in addition
+    void RequestLayout(const Gdiplus::Rect* dirtyRect = nullptr);
     void MarkForRepaint() {
         markedForRepaint = true;
     }
@@ -69,9 +69,15 @@ static void PaintWindowsInZOrder(Graphics* g, Control* c) {
         }
         for (CtrlAndOffset& coff : toPaint) {
             if (minUnpaintedZOrder == coff.c->zOrder) {
+                Gdiplus::Rect bbox(coff.offX, coff.offY, coff.c->pos.Width, coff.c->pos.Height);
+                // only controls within the invalidated area need to be repainted,
+                // everything else is already up-to-date in the cached bitmap
+                if (!g->IsVisible(bbox)) {
+                    ++paintedCount;
+                    continue;
+                }
                 coff.c->Paint(g, coff.offX, coff.offY);
                 if (IsDebugPaint()) {
-                    Gdiplus::Rect bbox(coff.offX, coff.offY, coff.c->pos.Width, coff.c->pos.Height);
                     g->DrawRectangle(&debugPen, bbox);
                 }
                 ++paintedCount;
@@ -2,6 +2,8 @@
    License: Simplified BSD (see COPYING.BSD) */
 
 #include "utils/BaseUtil.h"
+#include "utils/ScopedWin.h"
+#include "utils/WinDynCalls.h"
 #include "utils/WinUtil.h"
 #include "utils/GdiPlusUtil.h"
 #include "utils/HtmlParserLookup.h"
@@ -29,6 +31,42 @@ be in mui to avoid circular dependency */
 
 namespace mui {
 
+TextMeasureCache::TextMeasureCache() {
+    entries = AllocArray<Entry>(TEXT_MEASURE_CACHE_SIZE);
+}
+
+TextMeasureCache::~TextMeasureCache() {
+    free(entries);
+}
+
+TextMeasureCache::Entry* TextMeasureCache::EntryFor(CachedFont* font, const WCHAR* s, size_t len) {
+    if (!entries || !font || len == 0 || len > TEXT_MEASURE_CACHE_MAX_LEN) {
+        return nullptr;
+    }
+    u32 hash = MurmurHash2(s, len * sizeof(WCHAR)) ^ (u32)(uintptr_t)font;
+    return &entries[hash & (TEXT_MEASURE_CACHE_SIZE - 1)];
+}
+
+bool TextMeasureCache::Get(CachedFont* font, const WCHAR* s, size_t len, RectF& bboxOut) {
+    Entry* e = EntryFor(font, s, len);
+    if (!e || e->font != font || e->len != len || memcmp(e->s, s, len * sizeof(WCHAR)) != 0) {
+        return false;
+    }
+    bboxOut = e->bbox;
+    return true;
+}
+
+void TextMeasureCache::Put(CachedFont* font, const WCHAR* s, size_t len, RectF bbox) {
+    Entry* e = EntryFor(font, s, len);
+    if (!e) {
+        return;
+    }
+    e->font = font;
+    e->len = len;
+    memcpy(e->s, s, len * sizeof(WCHAR));
+    e->bbox = bbox;
+}
+
 TextRenderGdi* TextRenderGdi::Create(Graphics* gfx) {
     TextRenderGdi* res = new TextRenderGdi();
     res->gfx = gfx;
@@ -111,9 +149,16 @@ float TextRenderGdi::GetCurrFontLineSpacing() {
 }
 
 RectF TextRenderGdi::Measure(const WCHAR* s, size_t sLen) {
+    RectF res;
+    if (measureCache && measureCache->Get(currFont, s, sLen, res)) {
+        return res;
+    }
     SIZE txtSize;
     GetTextExtentPoint32W(hdcForTextMeasure, s, (int)sLen, &txtSize);
-    RectF res(0.0f, 0.0f, (float)txtSize.cx, (float)txtSize.cy);
+    res = RectF(0.0f, 0.0f, (float)txtSize.cx, (float)txtSize.cy);
+    if (measureCache) {
+        measureCache->Put(currFont, s, sLen, res);
+    }
     return res;
 }
 
@@ -300,13 +345,21 @@ float TextRenderGdiplus::GetCurrFontLineSpacing() {
 
 RectF TextRenderGdiplus::Measure(const WCHAR* s, size_t sLen) {
     CrashIf(!currFont);
-    return MeasureText(gfx, currFont->font, s, sLen, measureAlgo);
+    RectF res;
+    if (measureCache && measureCache->Get(currFont, s, sLen, res)) {
+        return res;
+    }
+    res = MeasureText(gfx, currFont->font, s, sLen, measureAlgo);
+    if (measureCache) {
+        measureCache->Put(currFont, s, sLen, res);
+    }
+    return res;
 }
 
 RectF TextRenderGdiplus::Measure(const char* s, size_t sLen) {
     CrashIf(!currFont);
     size_t strLen = strconv::Utf8ToWcharBuf(s, sLen, txtConvBuf, dimof(txtConvBuf));
-    return MeasureText(gfx, currFont->font, txtConvBuf, strLen, measureAlgo);
+    return Measure(txtConvBuf, strLen);
 }
 
 TextRenderGdiplus::~TextRenderGdiplus() {
@@ -422,10 +475,17 @@ Gdiplus::RectF TextRenderHdc::Measure(const char* s, size_t sLen) {
 }
 
 Gdiplus::RectF TextRenderHdc::Measure(const WCHAR* s, size_t sLen) {
+    RectF res;
+    if (measureCache && measureCache->Get(currFont, s, sLen, res)) {
+        return res;
+    }
     SIZE txtSize;
     CrashIf(!hdc);
     GetTextExtentPoint32W(hdc, s, (int)sLen, &txtSize);
-    RectF res(0.0f, 0.0f, (float)txtSize.cx, (float)txtSize.cy);
+    res = RectF(0.0f, 0.0f, (float)txtSize.cx, (float)txtSize.cy);
+    if (measureCache) {
+        measureCache->Put(currFont, s, sLen, res);
+    }
     return res;
 }
 
@@ -454,6 +514,375 @@ TextRenderHdc::~TextRenderHdc() {
     DeleteDC(hdc);
 }
 
+// number of characters (starting at 0) whose glyphs and advances are cached per font
+#define DWRITE_CACHED_CHARS 256
+
+// metrics (in pixels) and cached glyphs of a CachedFont. immutable once
+// created, so that it can be shared by TextRenderDWrite on all threads
+struct DWriteFontInfo {
+    CachedFont* font = nullptr;
+    IDWriteFontFace* face = nullptr;
+    float emSize = 0;
+    float ascent = 0;
+    float descent = 0;
+    float lineGap = 0;
+    UINT16 designUnitsPerEm = 0;
+    // 0 for characters the font doesn't have
+    u16 glyphs[DWRITE_CACHED_CHARS] = {};
+    float advances[DWRITE_CACHED_CHARS] = {};
+};
+
+// DirectWrite objects shared by all TextRenderDWrite (they're thread-safe)
+struct DWriteGlobals {
+    IDWriteFactory* factory = nullptr;
+    IDWriteGdiInterop* gdiInterop = nullptr;
+    IDWriteRenderingParams* renderingParams = nullptr;
+    CRITICAL_SECTION fontsCs;
+    Vec<DWriteFontInfo*> fonts;
+};
+
+static DWriteGlobals* CreateDWriteGlobals() {
+    if (!DynDWriteCreateFactory) {
+        return nullptr;
+    }
+    IDWriteFactory* factory = nullptr;
+    HRESULT hr = DynDWriteCreateFactory(DWRITE_FACTORY_TYPE_SHARED, __uuidof(IDWriteFactory), (IUnknown**)&factory);
+    if (FAILED(hr)) {
+        return nullptr;
+    }
+    IDWriteGdiInterop* gdiInterop = nullptr;
+    IDWriteRenderingParams* renderingParams = nullptr;
+    hr = factory->GetGdiInterop(&gdiInterop);
+    if (SUCCEEDED(hr)) {
+        hr = factory->CreateRenderingParams(&renderingParams);
+    }
+    if (FAILED(hr)) {
+        if (gdiInterop) {
+            gdiInterop->Release();
+        }
+        factory->Release();
+        return nullptr;
+    }
+    auto res = new DWriteGlobals();
+    res->factory = factory;
+    res->gdiInterop = gdiInterop;
+    res->renderingParams = renderingParams;
+    InitializeCriticalSection(&res->fontsCs);
+    return res;
+}
+
+// created on first use and kept until the process exits
+// returns nullptr if DirectWrite isn't available
+static DWriteGlobals* GetDWriteGlobals() {
+    static DWriteGlobals* globals = CreateDWriteGlobals();
+    return globals;
+}
+
+// the advances match the ones GDI uses for drawing text with the same font
+static bool GetGdiCompatibleAdvances(DWriteFontInfo* fi, const u16* glyphs, size_t n, float* advancesOut) {
+    Vec<DWRITE_GLYPH_METRICS> metrics;
+    metrics.AppendBlanks(n);
+    HRESULT hr = fi->face->GetGdiCompatibleGlyphMetrics(fi->emSize, 1.f, nullptr, FALSE, glyphs, (UINT32)n,
+                                                        metrics.LendData(), FALSE);
+    if (FAILED(hr)) {
+        return false;
+    }
+    float scale = fi->emSize / fi->designUnitsPerEm;
+    for (size_t i = 0; i < n; i++) {
+        advancesOut[i] = roundf(metrics.at(i).advanceWidth * scale);
+    }
+    return true;
+}
+
+static DWriteFontInfo* CreateDWriteFontInfo(DWriteGlobals* g, CachedFont* font) {
+    // the LOGFONT of the GDI font has the font's size in pixels
+    LOGFONTW lf{};
+    if (!GetObjectW(font->GetHFont(), sizeof(lf), &lf)) {
+        return nullptr;
+    }
+    IDWriteFont* dwFont = nullptr;
+    HRESULT hr = g->gdiInterop->CreateFontFromLOGFONT(&lf, &dwFont);
+    if (FAILED(hr)) {
+        return nullptr;
+    }
+    IDWriteFontFace* face = nullptr;
+    hr = dwFont->CreateFontFace(&face);
+    dwFont->Release();
+    if (FAILED(hr)) {
+        return nullptr;
+    }
+
+    DWRITE_FONT_METRICS fm;
+    face->GetMetrics(&fm);
+    float emSize = (float)-lf.lfHeight;
+    if (lf.lfHeight > 0) {
+        // a positive height is the height of the character cell
+        emSize = (float)lf.lfHeight * fm.designUnitsPerEm / (fm.ascent + fm.descent);
+    }
+    if (emSize <= 0 || FAILED(face->GetGdiCompatibleMetrics(emSize, 1.f, nullptr, &fm))) {
+        face->Release();
+        return nullptr;
+    }
+
+    auto fi = new DWriteFontInfo();
+    fi->font = font;
+    fi->face = face;
+    fi->emSize = emSize;
+    fi->designUnitsPerEm = fm.designUnitsPerEm;
+    float scale = emSize / fm.designUnitsPerEm;
+    fi->ascent = roundf(fm.ascent * scale);
+    fi->descent = roundf(fm.descent * scale);
+    fi->lineGap = roundf(fm.lineGap * scale);
+
+    UINT32 codepoints[DWRITE_CACHED_CHARS];
+    for (UINT32 i = 0; i < DWRITE_CACHED_CHARS; i++) {
+        codepoints[i] = i;
+    }
+    hr = face->GetGlyphIndices(codepoints, DWRITE_CACHED_CHARS, fi->glyphs);
+    if (FAILED(hr) || !GetGdiCompatibleAdvances(fi, fi->glyphs, DWRITE_CACHED_CHARS, fi->advances)) {
+        face->Release();
+        delete fi;
+        return nullptr;
+    }
+    return fi;
+}
+
+// returns nullptr if the font can't be used with DirectWrite
+static DWriteFontInfo* GetDWriteFontInfo(DWriteGlobals* g, CachedFont* font) {
+    ScopedCritSec scope(&g->fontsCs);
+    for (DWriteFontInfo* fi : g->fonts) {
+        if (fi->font == font) {
+            return fi;
+        }
+    }
+    DWriteFontInfo* fi = CreateDWriteFontInfo(g, font);
+    if (fi) {
+        g->fonts.Append(fi);
+    }
+    return fi;
+}
+
+TextRenderDWrite* TextRenderDWrite::Create(Graphics* gfx) {
+    if (!GetDWriteGlobals()) {
+        return nullptr;
+    }
+    TextRenderDWrite* res = new TextRenderDWrite();
+    res->gfx = gfx;
+    HDC hdc = gfx->GetHDC();
+    res->hdcForTextMeasure = CreateCompatibleDC(hdc);
+    gfx->ReleaseHDC(hdc);
+    // default to red to make mistakes stand out
+    res->SetTextColor(Color(0xff, 0xff, 0x0, 0x0));
+    return res;
+}
+
+TextRenderDWrite::~TextRenderDWrite() {
+    if (renderTarget) {
+        renderTarget->Release();
+    }
+    if (hdcForTextMeasurePrevFont) {
+        SelectObject(hdcForTextMeasure, hdcForTextMeasurePrevFont);
+    }
+    DeleteDC(hdcForTextMeasure);
+    CrashIf(hdcGfxLocked); // hasn't been Unlock()ed
+}
+
+void TextRenderDWrite::SetFont(CachedFont* font) {
+    if (currFont == font) {
+        return;
+    }
+    currFont = font;
+    currFontInfo = GetDWriteFontInfo(GetDWriteGlobals(), font);
+    HGDIOBJ prevFont = SelectObject(hdcForTextMeasure, font->GetHFont());
+    if (!hdcForTextMeasurePrevFont) {
+        hdcForTextMeasurePrevFont = prevFont;
+    }
+}
+
+void TextRenderDWrite::SetTextColor(Gdiplus::Color col) {
+    textColor = col;
+}
+
+float TextRenderDWrite::GetCurrFontLineSpacing() {
+    CrashIf(!currFont);
+    if (!currFontInfo) {
+        return currFont->font->GetHeight(gfx);
+    }
+    return currFontInfo->ascent + currFontInfo->descent + currFontInfo->lineGap;
+}
+
+// fills glyphs and advances for s and returns false if the font
+// is missing glyphs for s (which GDI's font linking might provide)
+bool TextRenderDWrite::GetGlyphRun(const WCHAR* s, size_t sLen, float* dxOut) {
+    DWriteFontInfo* fi = currFontInfo;
+    if (!fi) {
+        return false;
+    }
+    glyphs.Reset();
+    advances.Reset();
+    float dx = 0;
+    size_t i = 0;
+    for (; i < sLen && s[i] < DWRITE_CACHED_CHARS; i++) {
+        u16 glyph = fi->glyphs[s[i]];
+        if (!glyph) {
+            return false;
+        }
+        glyphs.Append(glyph);
+        advances.Append(fi->advances[s[i]]);
+        dx += fi->advances[s[i]];
+    }
+
+    if (i < sLen) {
+        // look up the glyphs of the whole string at once
+        Vec<UINT32> codepoints;
+        for (i = 0; i < sLen; i++) {
+            UINT32 c = s[i];
+            if (IS_HIGH_SURROGATE(s[i]) && i + 1 < sLen && IS_LOW_SURROGATE(s[i + 1])) {
+                c = 0x10000 + ((c - 0xd800) << 10) + (s[i + 1] - 0xdc00);
+                i++;
+            }
+            codepoints.Append(c);
+        }
+        size_t n = codepoints.size();
+        glyphs.Reset();
+        glyphs.AppendBlanks(n);
+        HRESULT hr = fi->face->GetGlyphIndices(codepoints.LendData(), (UINT32)n, glyphs.LendData());
+        if (FAILED(hr)) {
+            return false;
+        }
+        for (u16 glyph : glyphs) {
+            if (!glyph) {
+                return false;
+            }
+        }
+        advances.Reset();
+        advances.AppendBlanks(n);
+        if (!GetGdiCompatibleAdvances(fi, glyphs.LendData(), n, advances.LendData())) {
+            return false;
+        }
+        dx = 0;
+        for (float advance : advances) {
+            dx += advance;
+        }
+    }
+
+    *dxOut = dx;
+    return true;
+}
+
+RectF TextRenderDWrite::Measure(const WCHAR* s, size_t sLen) {
+    CrashIf(!currFont);
+    RectF res;
+    if (measureCache && measureCache->Get(currFont, s, sLen, res)) {
+        return res;
+    }
+    float dx;
+    if (GetGlyphRun(s, sLen, &dx)) {
+        res = RectF(0.0f, 0.0f, dx, currFontInfo->ascent + currFontInfo->descent);
+    } else {
+        SIZE txtSize;
+        GetTextExtentPoint32W(hdcForTextMeasure, s, (int)sLen, &txtSize);
+        res = RectF(0.0f, 0.0f, (float)txtSize.cx, (float)txtSize.cy);
+    }
+    if (measureCache) {
+        measureCache->Put(currFont, s, sLen, res);
+    }
+    return res;
+}
+
+RectF TextRenderDWrite::Measure(const char* s, size_t sLen) {
+    size_t strLen = strconv::Utf8ToWcharBuf(s, sLen, txtConvBuf, dimof(txtConvBuf));
+    return Measure(txtConvBuf, strLen);
+}
+
+void TextRenderDWrite::Lock() {
+    CrashIf(hdcGfxLocked);
+    Region r;
+    Status st = gfx->GetClip(&r); // must call before GetHDC(), which locks gfx
+    CrashIf(st != Ok);
+    HRGN hrgn = r.GetHRGN(gfx);
+
+    hdcGfxLocked = gfx->GetHDC();
+    SelectClipRgn(hdcGfxLocked, hrgn);
+    DeleteObject(hrgn);
+    SetBkMode(hdcGfxLocked, TRANSPARENT);
+}
+
+void TextRenderDWrite::Unlock() {
+    CrashIf(!hdcGfxLocked);
+    gfx->ReleaseHDC(hdcGfxLocked);
+    hdcGfxLocked = nullptr;
+}
+
+void TextRenderDWrite::DrawFallback(const WCHAR* s, size_t sLen, RectF& bb, bool isRtl) {
+    SelectFont(hdcGfxLocked, currFont->GetHFont());
+    ::SetTextColor(hdcGfxLocked, textColor.ToCOLORREF());
+    UINT opts = isRtl ? ETO_RTLREADING : 0;
+    ExtTextOut(hdcGfxLocked, (int)bb.X, (int)bb.Y, opts, nullptr, s, (UINT)sLen, nullptr);
+}
+
+void TextRenderDWrite::Draw(const WCHAR* s, size_t sLen, RectF& bb, bool isRtl) {
+    CrashIf(!hdcGfxLocked); // hasn't been Lock()ed
+    float dx;
+    if (!GetGlyphRun(s, sLen, &dx)) {
+        DrawFallback(s, sLen, bb, isRtl);
+        return;
+    }
+    if (glyphs.size() == 0) {
+        return;
+    }
+
+    DWriteGlobals* g = GetDWriteGlobals();
+    DWriteFontInfo* fi = currFontInfo;
+    // glyphs might extend a bit beyond their advances
+    int dxPad = (int)(fi->emSize / 4);
+    int bmpDx = (int)ceilf(dx) + 2 * dxPad;
+    int bmpDy = (int)ceilf(fi->ascent + fi->descent);
+    if (!renderTarget || bmpDx > renderTargetDx || bmpDy > renderTargetDy) {
+        int newDx = std::max(bmpDx, renderTargetDx);
+        int newDy = std::max(bmpDy, renderTargetDy);
+        HRESULT hr;
+        if (!renderTarget) {
+            hr = g->gdiInterop->CreateBitmapRenderTarget(hdcGfxLocked, newDx, newDy, &renderTarget);
+        } else {
+            hr = renderTarget->Resize(newDx, newDy);
+        }
+        if (FAILED(hr) || !renderTarget) {
+            DrawFallback(s, sLen, bb, isRtl);
+            return;
+        }
+        renderTarget->SetPixelsPerDip(1.f);
+        renderTargetDx = newDx;
+        renderTargetDy = newDy;
+    }
+
+    // DirectWrite draws on top of what's in the bitmap, so copy
+    // what's under the text there to get transparent drawing
+    int x = (int)bb.X - dxPad;
+    int y = (int)bb.Y;
+    HDC memHdc = renderTarget->GetMemoryDC();
+    BitBlt(memHdc, 0, 0, bmpDx, bmpDy, hdcGfxLocked, x, y, SRCCOPY);
+
+    DWRITE_GLYPH_RUN run{};
+    run.fontFace = fi->face;
+    run.fontEmSize = fi->emSize;
+    run.glyphCount = (UINT32)glyphs.size();
+    run.glyphIndices = glyphs.LendData();
+    run.glyphAdvances = advances.LendData();
+    // right-to-left runs are drawn leftwards from their origin
+    run.bidiLevel = isRtl ? 1 : 0;
+    float originX = (float)dxPad + (isRtl ? dx : 0.f);
+    renderTarget->DrawGlyphRun(originX, fi->ascent, DWRITE_MEASURING_MODE_GDI_CLASSIC, &run, g->renderingParams,
+                               textColor.ToCOLORREF(), nullptr);
+
+    BitBlt(hdcGfxLocked, x, y, bmpDx, bmpDy, memHdc, 0, 0, SRCCOPY);
+}
+
+void TextRenderDWrite::Draw(const char* s, size_t sLen, RectF& bb, bool isRtl) {
+    size_t strLen = strconv::Utf8ToWcharBuf(s, sLen, txtConvBuf, dimof(txtConvBuf));
+    Draw(txtConvBuf, strLen, bb, isRtl);
+}
+
 ITextRender* CreateTextRender(TextRenderMethod method, Graphics* gfx, int dx, int dy) {
     ITextRender* res = nullptr;
     if (TextRenderMethodGdiplus == method) {
@@ -468,6 +897,13 @@ ITextRender* CreateTextRender(TextRenderMethod method, Graphics* gfx, int dx, in
     if (TextRenderMethodHdc == method) {
         res = TextRenderHdc::Create(gfx, dx, dy);
     }
+    if (TextRenderMethodDWrite == method) {
+        res = TextRenderDWrite::Create(gfx);
+        if (!res) {
+            method = TextRenderMethodGdi;
+            res = TextRenderGdi::Create(gfx);
+        }
+    }
     CrashIf(!res);
     if (res) {
         res->method = method;
@@ -6,8 +6,35 @@ enum TextRenderMethod {
     TextRenderMethodGdiplusQuick, // uses MeasureTextQuick
     TextRenderMethodGdi,
     TextRenderMethodHdc,
-    // TODO: implement TextRenderDirectDraw
-    // TextRenderDirectDraw
+    TextRenderMethodDWrite, // falls back to TextRenderMethodGdi if DirectWrite isn't available
+};
+
+// only strings up to this length are cached (i.e. mostly single words)
+#define TEXT_MEASURE_CACHE_MAX_LEN 24
+// must be a power of 2
+#define TEXT_MEASURE_CACHE_SIZE 2048
+
+// remembers the bounding boxes of short strings measured in a given font
+// (laying out a document measures the same words over and over again).
+// strings whose hashes collide replace each other, so that the cache
+// doesn't grow beyond TEXT_MEASURE_CACHE_SIZE entries
+class TextMeasureCache {
+    struct Entry {
+        CachedFont* font;
+        size_t len;
+        WCHAR s[TEXT_MEASURE_CACHE_MAX_LEN];
+        Gdiplus::RectF bbox;
+    };
+    Entry* entries = nullptr;
+
+    Entry* EntryFor(CachedFont* font, const WCHAR* s, size_t len);
+
+  public:
+    TextMeasureCache();
+    ~TextMeasureCache();
+
+    bool Get(CachedFont* font, const WCHAR* s, size_t len, Gdiplus::RectF& bboxOut);
+    void Put(CachedFont* font, const WCHAR* s, size_t len, Gdiplus::RectF bbox);
 };
 
 class ITextRender {
@@ -36,7 +63,14 @@ class ITextRender {
     virtual void Draw(const char* s, size_t sLen, RectF& bb, bool isRtl) = 0;
     virtual void Draw(const WCHAR* s, size_t sLen, RectF& bb, bool isRtl) = 0;
 
-    virtual ~ITextRender(){};
+    virtual ~ITextRender() {
+        delete measureCache;
+    };
+
+    // results of Measure() are only cached if this is set (and
+    // owned by us). only use for ITextRenders which are just
+    // used for measuring, e.g. for HtmlFormatter
+    TextMeasureCache* measureCache = nullptr;
 
     TextRenderMethod method;
 };
@@ -182,6 +216,63 @@ class TextRenderHdc : public ITextRender {
     ~TextRenderHdc() override;
 };
 
+struct DWriteFontInfo;
+struct IDWriteBitmapRenderTarget;
+
+// measures text with DirectWrite (using advances of the glyphs compatible
+// with GDI, cached per font for the most common characters) and draws it
+// with DirectWrite's GDI interop, blended over what's already in the hdc
+class TextRenderDWrite : public ITextRender {
+  private:
+    HDC hdcGfxLocked = nullptr;
+    // for measuring and drawing text for which the font is missing glyphs
+    HDC hdcForTextMeasure = nullptr;
+    HGDIOBJ hdcForTextMeasurePrevFont = nullptr;
+    IDWriteBitmapRenderTarget* renderTarget = nullptr;
+    int renderTargetDx = 0;
+    int renderTargetDy = 0;
+
+    // We don't own gfx and currFont
+    Gdiplus::Graphics* gfx = nullptr;
+    CachedFont* currFont = nullptr;
+    // owned by the shared font info cache
+    DWriteFontInfo* currFontInfo = nullptr;
+    Gdiplus::Color textColor;
+    WCHAR txtConvBuf[512] = {0};
+
+    // glyph run of the last string passed to GetGlyphRun
+    Vec<u16> glyphs;
+    Vec<float> advances;
+
+    TextRenderDWrite() = default;
+
+    bool GetGlyphRun(const WCHAR* s, size_t sLen, float* dxOut);
+    void DrawFallback(const WCHAR* s, size_t sLen, RectF& bb, bool isRtl);
+
+  public:
+    // returns nullptr if DirectWrite isn't available
+    static TextRenderDWrite* Create(Gdiplus::Graphics* gfx);
+
+    void SetFont(CachedFont* font) override;
+    void SetTextColor(Gdiplus::Color col) override;
+    void SetTextBgColor(Gdiplus::Color col) override {
+        UNUSED(col);
+    }
+
+    float GetCurrFontLineSpacing() override;
+
+    Gdiplus::RectF Measure(const char* s, size_t sLen) override;
+    Gdiplus::RectF Measure(const WCHAR* s, size_t sLen) override;
+
+    void Lock() override;
+    void Unlock() override;
+
+    void Draw(const char* s, size_t sLen, RectF& bb, bool isRtl) override;
+    void Draw(const WCHAR* s, size_t sLen, RectF& bb, bool isRtl) override;
+
+    ~TextRenderDWrite() override;
+};
+
 ITextRender* CreateTextRender(TextRenderMethod method, Graphics* gfx, int dx, int dy);
 
 size_t StringLenForWidth(ITextRender* textRender, const WCHAR* s, size_t len, float dx);
@@ -24,16 +24,30 @@
 #include "PdfPreviewBase.h"
 
 IFACEMETHODIMP PreviewBase::GetThumbnail(UINT cx, HBITMAP* phbmp, WTS_ALPHATYPE* pdwAlpha) {
-    EngineBase* engine = GetEngine();
-    if (!engine) {
-        return E_FAIL;
+    dbglogf("PdfPreview: PreviewBase::GetThumbnail(cx=%d)\n", (int)cx);
+
+    RenderedBitmap* bmp = nullptr;
+    Rect thumb;
+    if (!m_engine && m_pStream) {
+        bmp = RenderThumbnail(m_pStream, cx);
+        if (bmp) {
+            thumb = Rect(Point(), bmp->Size());
+        }
     }
+    if (!bmp) {
+        EngineBase* engine = GetEngine();
+        if (!engine) {
+            return E_FAIL;
+        }
 
-    dbglogf("PdfPreview: PreviewBase::GetThumbnail(cx=%d)\n", (int)cx);
+        RectD page = engine->Transform(engine->PageMediabox(1), 1, 1.0, 0);
+        float zoom = std::min(cx / (float)page.dx, cx / (float)page.dy) - 0.001f;
+        thumb = RectD(0, 0, page.dx * zoom, page.dy * zoom).Round();
 
-    RectD page = engine->Transform(engine->PageMediabox(1), 1, 1.0, 0);
-    float zoom = std::min(cx / (float)page.dx, cx / (float)page.dy) - 0.001f;
-    Rect thumb = RectD(0, 0, page.dx * zoom, page.dy * zoom).Round();
+        page = engine->Transform(thumb.Convert<double>(), 1, zoom, 0, true);
+        RenderPageArgs args(1, zoom, 0, &page);
+        bmp = engine->RenderPage(args);
+    }
 
     BITMAPINFO bmi = {0};
     bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
@@ -46,13 +60,10 @@ IFACEMETHODIMP PreviewBase::GetThumbnail(UINT cx, HBITMAP* phbmp, WTS_ALPHATYPE*
     unsigned char* bmpData = nullptr;
     HBITMAP hthumb = CreateDIBSection(nullptr, &bmi, DIB_RGB_COLORS, (void**)&bmpData, nullptr, 0);
     if (!hthumb) {
+        delete bmp;
         return E_OUTOFMEMORY;
     }
 
-    page = engine->Transform(thumb.Convert<double>(), 1, zoom, 0, true);
-    RenderPageArgs args(1, zoom, 0, &page);
-    RenderedBitmap* bmp = engine->RenderPage(args);
-
     HDC hdc = GetDC(nullptr);
     if (bmp && GetDIBits(hdc, bmp->GetBitmap(), 0, thumb.dy, bmpData, &bmi, DIB_RGB_COLORS)) {
         // cf. http://msdn.microsoft.com/en-us/library/bb774612(v=VS.85).aspx
@@ -78,20 +89,30 @@ IFACEMETHODIMP PreviewBase::GetThumbnail(UINT cx, HBITMAP* phbmp, WTS_ALPHATYPE*
 #define COL_WINDOW_BG RGB(0x99, 0x99, 0x99)
 #define PREVIEW_MARGIN 2
 #define UWM_PAINT_AGAIN (WM_USER + 101)
+// the requested page and its neighbors (which are rendered ahead
+// in the background, so that scrolling by a page is instantaneous)
+#define PREVIEW_CACHED_PAGES 3
+
+struct PreviewPage {
+    int pageNo = 0;
+    // due to rounding differences, bmp->Size() and size can differ slightly
+    Size size;
+    RenderedBitmap* bmp = nullptr;
+};
 
 class PageRenderer {
     EngineBase* engine;
     HWND hwnd;
+    int pageCount;
 
-    int currPage;
-    RenderedBitmap* currBmp;
-    // due to rounding differences, currBmp->Size() and currSize can differ slightly
-    Size currSize;
+    PreviewPage cache[PREVIEW_CACHED_PAGES];
     int reqPage;
     float reqZoom;
     Size reqSize;
     bool reqAbort;
     AbortCookie* abortCookie;
+    // the page around which all neighbors have been rendered
+    int prefetchedPage;
 
     CRITICAL_SECTION currAccess;
     HANDLE thread;
@@ -104,15 +125,15 @@ class PageRenderer {
     bool preventRecursion;
 
   public:
-    PageRenderer(EngineBase* engine, HWND hwnd)
+    PageRenderer(EngineBase* engine, HWND hwnd, int pageCount)
         : engine(engine),
           hwnd(hwnd),
-          currPage(0),
-          currBmp(nullptr),
+          pageCount(pageCount),
           reqPage(0),
           reqZoom(0),
           reqAbort(false),
           abortCookie(nullptr),
+          prefetchedPage(0),
           thread(nullptr),
           preventRecursion(false) {
         InitializeCriticalSection(&currAccess);
@@ -121,7 +142,9 @@ class PageRenderer {
         if (thread) {
             WaitForSingleObject(thread, INFINITE);
         }
-        delete currBmp;
+        for (PreviewPage& page : cache) {
+            delete page.bmp;
+        }
         DeleteCriticalSection(&currAccess);
     }
 
@@ -142,15 +165,20 @@ class PageRenderer {
         dbglog("PdfPreview: PageRenderer::Render()\n");
 
         ScopedCritSec scope(&currAccess);
-        if (currBmp && currPage == pageNo && currSize == target.Size()) {
-            currBmp->StretchDIBits(hdc, target);
-        } else if (!thread) {
+        PreviewPage* cached = FindCached(pageNo, target.Size());
+        if (cached) {
+            cached->bmp->StretchDIBits(hdc, target);
+        }
+        if (!thread) {
+            if (cached && prefetchedPage == pageNo) {
+                return;
+            }
             reqPage = pageNo;
             reqZoom = zoom;
             reqSize = target.Size();
             reqAbort = false;
             thread = CreateThread(nullptr, 0, RenderThread, this, 0, 0);
-        } else if (reqPage != pageNo || reqSize != target.Size()) {
+        } else if (!cached && (reqPage != pageNo || reqSize != target.Size())) {
             if (abortCookie) {
                 abortCookie->Abort();
             }
@@ -159,26 +187,93 @@ class PageRenderer {
     }
 
   protected:
+    // must be called under currAccess
+    PreviewPage* FindCached(int pageNo, Size size) {
+        for (PreviewPage& page : cache) {
+            if (page.bmp && page.pageNo == pageNo && page.size == size) {
+                return &page;
+            }
+        }
+        return nullptr;
+    }
+
+    // replaces the page farthest away from the requested one
+    // (must be called under currAccess)
+    void AddToCache(int pageNo, RenderedBitmap* bmp) {
+        PreviewPage* slot = &cache[0];
+        for (PreviewPage& page : cache) {
+            if (!page.bmp) {
+                slot = &page;
+                break;
+            }
+            if (abs(page.pageNo - reqPage) > abs(slot->pageNo - reqPage)) {
+                slot = &page;
+            }
+        }
+        delete slot->bmp;
+        slot->pageNo = pageNo;
+        slot->size = reqSize;
+        slot->bmp = bmp;
+    }
+
+    // returns the next page to render or 0 if there's nothing left to do
+    // (neighbors are only rendered ahead if they'd be displayed at the same
+    // size as the requested page, which is the case for most documents)
+    int NextPageToRender(RectD& reqPageRect) {
+        int candidates[] = {reqPage, reqPage + 1, reqPage - 1};
+        for (int pageNo : candidates) {
+            if (pageNo < 1 || pageNo > pageCount) {
+                continue;
+            }
+            {
+                ScopedCritSec scope(&currAccess);
+                if (reqAbort) {
+                    return 0;
+                }
+                if (FindCached(pageNo, reqSize)) {
+                    continue;
+                }
+            }
+            if (pageNo == reqPage) {
+                return pageNo;
+            }
+            RectD rect = engine->Transform(engine->PageMediabox(pageNo), pageNo, 1.0, 0);
+            if (rect.dx == reqPageRect.dx && rect.dy == reqPageRect.dy) {
+                return pageNo;
+            }
+        }
+        return 0;
+    }
+
     static DWORD WINAPI RenderThread(LPVOID data) {
         ScopedCom comScope; // because the engine reads data from a COM IStream
 
         PageRenderer* pr = (PageRenderer*)data;
-        RenderPageArgs args(pr->reqPage, pr->reqZoom, 0, nullptr, RenderTarget::View, &pr->abortCookie);
-        RenderedBitmap* bmp = pr->engine->RenderPage(args);
+        RectD reqPageRect = pr->engine->Transform(pr->engine->PageMediabox(pr->reqPage), pr->reqPage, 1.0, 0);
+        for (int pageNo = pr->NextPageToRender(reqPageRect); pageNo; pageNo = pr->NextPageToRender(reqPageRect)) {
+            RenderPageArgs args(pageNo, pr->reqZoom, 0, nullptr, RenderTarget::View, &pr->abortCookie);
+            RenderedBitmap* bmp = pr->engine->RenderPage(args);
+
+            ScopedCritSec scope(&pr->currAccess);
+            if (bmp && !pr->reqAbort) {
+                pr->AddToCache(pageNo, bmp);
+            } else {
+                delete bmp;
+            }
+            delete pr->abortCookie;
+            pr->abortCookie = nullptr;
+            if (pageNo == pr->reqPage) {
+                PostMessage(pr->hwnd, UWM_PAINT_AGAIN, 0, 0);
+            }
+            if (!bmp) {
+                break;
+            }
+        }
 
         ScopedCritSec scope(&pr->currAccess);
-
         if (!pr->reqAbort) {
-            delete pr->currBmp;
-            pr->currBmp = bmp;
-            pr->currPage = pr->reqPage;
-            pr->currSize = pr->reqSize;
-        } else {
-            delete bmp;
+            pr->prefetchedPage = pr->reqPage;
         }
-        delete pr->abortCookie;
-        pr->abortCookie = nullptr;
-
         HANDLE thread = pr->thread;
         pr->thread = nullptr;
         PostMessage(pr->hwnd, UWM_PAINT_AGAIN, 0, 0);
@@ -335,7 +430,7 @@ IFACEMETHODIMP PreviewBase::DoPreview() {
     int pageCount = 1;
     if (engine) {
         pageCount = engine->PageCount();
-        this->renderer = new PageRenderer(engine, m_hwnd);
+        this->renderer = new PageRenderer(engine, m_hwnd, pageCount);
         // don't use the engine afterwards directly (cf. PageRenderer::preventRecursion)
         engine = nullptr;
     }
@@ -358,6 +453,11 @@ EngineBase* CPdfPreview::LoadEngine(IStream* stream) {
     return CreateEnginePdfFromStream(stream);
 }
 
+RenderedBitmap* CPdfPreview::RenderThumbnail(IStream* stream, UINT cx) {
+    dbglog("PdfPreview: CPdfPreview::RenderThumbnail()\n");
+    return RenderPdfThumbnailFromStream(stream, (int)cx);
+}
+
 #ifdef BUILD_XPS_PREVIEW
 EngineBase* CXpsPreview::LoadEngine(IStream* stream) {
     return CreateXpsEngineFromStream(stream);
@@ -236,6 +236,12 @@ protected:
     FILETIME    m_dateStamp;
 
     virtual EngineBase *LoadEngine(IStream *stream) = 0;
+    // allows rendering a thumbnail without loading a full engine
+    // (the caller falls back to LoadEngine if this returns nullptr)
+    virtual RenderedBitmap *RenderThumbnail(IStream *stream, UINT cx) {
+        UNUSED(stream); UNUSED(cx);
+        return nullptr;
+    }
 };
 
 class CPdfPreview : public PreviewBase {
@@ -244,6 +250,7 @@ public:
 
 protected:
     virtual EngineBase *LoadEngine(IStream *stream);
+    virtual RenderedBitmap *RenderThumbnail(IStream *stream, UINT cx);
 };
 
 #ifdef BUILD_XPS_PREVIEW
@@ -63,6 +63,7 @@
 #define IDM_FIND_NEXT                   472
 #define IDM_FIND_PREV                   474
 #define IDM_FIND_MATCH                  476
+#define IDM_FIND_ALL                    477
 #define IDM_SAVE_ANNOTATIONS_SMX        478
 #define IDM_EDIT_ANNOTATIONS            479
 
@@ -135,6 +136,8 @@
 #define IDM_DEBUG_TEST_APP              631
 #define IDM_ADVANCED_OPTIONS            632
 #define IDM_NEW_BOOKMARKS               634
+#define IDM_DEBUG_SHOW_PERF_HUD         636
+#define IDM_DEBUG_MEM_STATS             637
 
 #define IDM_FAV_FIRST                   700
 #define IDM_FAV_LAST                    900
@@ -0,0 +1,245 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+// Microbenchmarks for hot code paths in src/utils (and some of the pixel
+// conversions done after rendering). Each benchmark does a fixed amount of
+// work on synthetic data. After a warm-up run it's repeated and the minimum
+// and median times are reported, which are much more stable than a single
+// measurement, so that optimizations can be verified.
+//
+// Usage: bench_util [-repeat <n>] [<benchmark name substring>]
+
+#include "utils/BaseUtil.h"
+#include "utils/CssParser.h"
+#include "utils/Dict.h"
+#include "utils/HtmlPullParser.h"
+#include "utils/SettingsUtil.h"
+#include "utils/SquareTreeParser.h"
+#include "utils/Timer.h"
+#include "utils/WinDynCalls.h"
+#include "utils/WinUtil.h"
+
+#define INCLUDE_SETTINGSSTRUCTS_METADATA
+#include "SettingsStructs.h"
+
+// results are accumulated here so that the compiler can't optimize the work away
+static volatile size_t gSink = 0;
+
+static str::Str gHtml;
+static str::Str gCss;
+static AutoFree gSettings;
+static AutoFreeWstr gWideText;
+static AutoFree gUtf8Text;
+static Vec<char*> gKeys;
+static HBITMAP gBitmap = nullptr;
+static ScopedMem<u8> gPixels;
+
+#define BITMAP_DX 1024
+#define BITMAP_DY 1024
+
+static void PrepareHtml() {
+    for (int i = 0; i < 20000; i++) {
+        gHtml.AppendFmt("<p class=\"para\" id=\"p%d\">Some <b>bold</b> and <i>italic</i> text, ", i);
+        gHtml.Append("an &amp; entity and a <a href=\"#target\">link</a>.<br/></p>\n");
+    }
+}
+
+static void PrepareCss() {
+    for (int i = 0; i < 10000; i++) {
+        gCss.AppendFmt("p.c%d, div > span.c%d { margin: 0 1em; font-weight: bold; color: #%06x }\n", i, i, i);
+    }
+}
+
+// a settings file with a typical number of history entries
+static void PrepareSettings() {
+    GlobalPrefs* prefs = (GlobalPrefs*)DeserializeStruct(&gGlobalPrefsInfo, nullptr);
+    for (int i = 0; i < 256; i++) {
+        FileState* fs = (FileState*)DeserializeStruct(&gFileStateInfo, nullptr);
+        fs->filePath = str::Format(L"C:\\Users\\user\\Documents\\Some Directory\\document %d.pdf", i);
+        fs->pageNo = i;
+        prefs->fileStates->Append(fs);
+    }
+    gSettings.Set(SerializeStruct(&gGlobalPrefsInfo, prefs));
+    FreeStruct(&gGlobalPrefsInfo, prefs);
+}
+
+static void PrepareText() {
+    str::WStr s;
+    for (int i = 0; i < 50000; i++) {
+        s.Append(L"Lorem ipsum dolor sit amet, \u00e4\u00f6\u00fc \u0436\u0437 \u4e2d\u6587 ");
+    }
+    gWideText.Set(s.StealData());
+    gUtf8Text.Set((char*)strconv::WstrToUtf8(gWideText).data());
+}
+
+static void PrepareKeys() {
+    for (int i = 0; i < 100000; i++) {
+        gKeys.Append(str::Format("key-%d-%x", i, i * 7919));
+    }
+}
+
+// black text on white with anti-aliased edges, as rendered documents look like
+static void PrepareBitmap() {
+    gBitmap = CreateMemoryBitmap(Size(BITMAP_DX, BITMAP_DY));
+    size_t n = (size_t)BITMAP_DX * BITMAP_DY * 4;
+    gPixels.Set((u8*)malloc(n));
+    for (size_t i = 0; i < n; i += 4) {
+        size_t x = (i / 4) % BITMAP_DX;
+        u8 v = (x % 16) < 3 ? (u8)(x * 37) : 255;
+        gPixels.Get()[i] = gPixels.Get()[i + 1] = gPixels.Get()[i + 2] = v;
+        gPixels.Get()[i + 3] = 255;
+    }
+}
+
+static size_t BenchHtmlPullParser() {
+    HtmlPullParser parser(gHtml.Get(), gHtml.size());
+    size_t n = 0;
+    HtmlToken* t;
+    while ((t = parser.Next()) != nullptr && !t->IsError()) {
+        n++;
+    }
+    return n;
+}
+
+static size_t BenchCssPullParser() {
+    CssPullParser parser(gCss.Get(), gCss.size());
+    size_t n = 0;
+    while (parser.NextRule()) {
+        while (parser.NextSelector()) {
+            n++;
+        }
+        while (parser.NextProperty()) {
+            n++;
+        }
+    }
+    return n;
+}
+
+static size_t BenchSquareTree() {
+    SquareTree sqt(gSettings);
+    return sqt.root ? sqt.root->data.size() : 0;
+}
+
+static size_t BenchSettingsLoad() {
+    GlobalPrefs* prefs = (GlobalPrefs*)DeserializeStruct(&gGlobalPrefsInfo, gSettings);
+    size_t n = prefs->fileStates->size();
+    FreeStruct(&gGlobalPrefsInfo, prefs);
+    return n;
+}
+
+static size_t BenchWstrToUtf8() {
+    AutoFree s(strconv::WstrToUtf8(gWideText));
+    return str::Len(s);
+}
+
+static size_t BenchUtf8ToWstr() {
+    AutoFreeWstr s(strconv::Utf8ToWstr({gUtf8Text.Get(), gUtf8Text.size()}));
+    return str::Len(s);
+}
+
+static size_t BenchVecAppend() {
+    Vec<int> v;
+    for (int i = 0; i < 1000000; i++) {
+        v.Append(i);
+    }
+    return v.size();
+}
+
+static size_t BenchMurmurHash() {
+    size_t n = 0;
+    for (char* key : gKeys) {
+        n += MurmurHash2(key, str::Len(key));
+    }
+    return n;
+}
+
+static size_t BenchDict() {
+    dict::MapStrToInt d;
+    for (int i = 0; i < gKeys.isize(); i++) {
+        d.Insert(gKeys.at(i), i);
+    }
+    size_t n = 0;
+    int val;
+    for (char* key : gKeys) {
+        n += d.Get(key, &val) ? 1 : 0;
+    }
+    return n;
+}
+
+static size_t BenchUpdateBitmapColors() {
+    UpdateBitmapColors(gBitmap, RGB(0x20, 0x20, 0x20), RGB(0xf0, 0xe0, 0xc0));
+    return 1;
+}
+
+static size_t BenchConvertToPalette() {
+    ScopedMem<u8> dst((u8*)malloc((size_t)BITMAP_DX * BITMAP_DY));
+    RGBQUAD palette[256];
+    return (size_t)ConvertToPalette(gPixels, BITMAP_DX, BITMAP_DY, false, dst, BITMAP_DX, palette);
+}
+
+struct Benchmark {
+    const char* name;
+    size_t (*fn)();
+};
+
+static Benchmark gBenchmarks[] = {
+    {"HtmlPullParser", BenchHtmlPullParser},
+    {"CssPullParser", BenchCssPullParser},
+    {"SquareTree", BenchSquareTree},
+    {"SettingsLoad", BenchSettingsLoad},
+    {"WstrToUtf8", BenchWstrToUtf8},
+    {"Utf8ToWstr", BenchUtf8ToWstr},
+    {"VecAppend", BenchVecAppend},
+    {"MurmurHash2", BenchMurmurHash},
+    {"Dict", BenchDict},
+    {"UpdateBitmapColors", BenchUpdateBitmapColors},
+    {"ConvertToPalette", BenchConvertToPalette},
+};
+
+static int cmpDouble(const void* a, const void* b) {
+    double da = *(const double*)a;
+    double db = *(const double*)b;
+    return da < db ? -1 : da > db ? 1 : 0;
+}
+
+static void RunBenchmark(Benchmark& b, int repeat) {
+    gSink += b.fn();
+    Vec<double> times;
+    for (int i = 0; i < repeat; i++) {
+        auto t = TimeGet();
+        gSink += b.fn();
+        times.Append(TimeSinceInMs(t));
+    }
+    times.Sort(cmpDouble);
+    printf("%-20s min: %9.3f ms  median: %9.3f ms\n", b.name, times.at(0), times.at(times.size() / 2));
+}
+
+int main(int argc, char** argv) {
+    int repeat = 10;
+    const char* filter = nullptr;
+    for (int i = 1; i < argc; i++) {
+        if (str::Eq(argv[i], "-repeat") && i + 1 < argc) {
+            repeat = std::max(atoi(argv[++i]), 1);
+        } else {
+            filter = argv[i];
+        }
+    }
+
+    InitDynCalls();
+    PrepareHtml();
+    PrepareCss();
+    PrepareSettings();
+    PrepareText();
+    PrepareKeys();
+    PrepareBitmap();
+
+    for (Benchmark& b : gBenchmarks) {
+        if (filter && !str::FindI(b.name, filter)) {
+            continue;
+        }
+        RunBenchmark(b, repeat);
+    }
+    DeleteObject(gBitmap);
+    gKeys.FreeMembers();
+    return 0;
+}
@@ -13,6 +13,7 @@ extern void SumatraPDF_UnitTests();
 // in src/mui/SvgPath_ut.cpp
 extern void SvgPath_UnitTests();
 
+extern void AhoCorasickTest();
 extern void BaseUtilTest();
 extern void ByteOrderTests();
 extern void CmdLineParserTest();
@@ -39,6 +40,7 @@ int main(int argc, char** argv) {
     UNUSED(argv);
     printf("Running unit tests\n");
     InitDynCalls();
+    AhoCorasickTest();
     BaseUtilTest();
     ByteOrderTests();
     CmdLineParserTest();
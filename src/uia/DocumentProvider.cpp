@@ -15,6 +15,8 @@
 #include "Controller.h"
 #include "EngineManager.h"
 #include "DisplayModel.h"
+#include "TextSelection.h"
+#include "TextSearch.h"
 #include "utils/FileUtil.h"
 #include "uia/DocumentProvider.h"
 #include "uia/Constants.h"
@@ -59,6 +61,11 @@ void SumatraUIAutomationDocumentProvider::LoadDocument(DisplayModel* newDm) {
 
     dm = newDm;
     released = false;
+
+    // screen readers go through the text of the entire document, so extract it in
+    // the background instead of page by page on the UI thread while they ask for it
+    if (dm->PageCount() > 0)
+        dm->textCache->PrefetchRange(1, dm->PageCount(), GetTextPrefetchThreads());
 }
 
 void SumatraUIAutomationDocumentProvider::FreeDocument() {
@@ -216,6 +216,7 @@ HRESULT STDMETHODCALLTYPE SumatraUIAutomationPageProvider::get_Value(BSTR* pRetV
     if (released)
         return E_FAIL;
 
+    PageTextPin pin(dm->textCache, pageNum);
     const WCHAR* pageContent = dm->textCache->GetTextForPage(pageNum);
     if (!pageContent) {
         *pRetVal = nullptr;
@@ -125,6 +125,7 @@ int SumatraUIAutomationTextRange::FindPreviousWordEndpoint(int pageno, int idx,
     // based on TextSelection::SelectWordAt
     int textLen;
     auto cache = document->GetDM()->textCache;
+    PageTextPin pin(cache, pageno);
     const WCHAR* pageText = cache->GetTextForPage(pageno, &textLen);
 
     if (dontReturnInitial) {
@@ -144,6 +145,7 @@ int SumatraUIAutomationTextRange::FindPreviousWordEndpoint(int pageno, int idx,
 int SumatraUIAutomationTextRange::FindNextWordEndpoint(int pageno, int idx, bool dontReturnInitial) {
     int textLen;
     auto cache = document->GetDM()->textCache;
+    PageTextPin pin(cache, pageno);
     const WCHAR* pageText = cache->GetTextForPage(pageno, &textLen);
 
     if (dontReturnInitial) {
@@ -160,9 +162,25 @@ int SumatraUIAutomationTextRange::FindNextWordEndpoint(int pageno, int idx, bool
     return idx;
 }
 
+// returns the index of the first line break at or after idx (or count, if there's none)
+static int FindLineBreakIdx(const int* lineBreaks, int count, int idx) {
+    int lo = 0, hi = count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (lineBreaks[mid] < idx)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// screen readers move through documents line by line, so the line
+// breaks are looked up in an index instead of scanning the page's text
 int SumatraUIAutomationTextRange::FindPreviousLineEndpoint(int pageno, int idx, bool dontReturnInitial) {
     int textLen;
     auto cache = document->GetDM()->textCache;
+    PageTextPin pin(cache, pageno);
     const WCHAR* pageText = cache->GetTextForPage(pageno, &textLen);
 
     if (dontReturnInitial) {
@@ -172,16 +190,16 @@ int SumatraUIAutomationTextRange::FindPreviousLineEndpoint(int pageno, int idx,
         }
     }
 
-    for (; idx > 0; idx--) {
-        if (pageText[idx - 1] == L'\n')
-            break;
-    }
-    return idx;
+    int count;
+    const int* lineBreaks = cache->GetLineBreaksForPage(pageno, &count);
+    int i = FindLineBreakIdx(lineBreaks, count, idx);
+    return i > 0 ? lineBreaks[i - 1] + 1 : 0;
 }
 
 int SumatraUIAutomationTextRange::FindNextLineEndpoint(int pageno, int idx, bool dontReturnInitial) {
     int textLen;
     auto cache = document->GetDM()->textCache;
+    PageTextPin pin(cache, pageno);
     const WCHAR* pageText = cache->GetTextForPage(pageno, &textLen);
 
     if (dontReturnInitial) {
@@ -191,11 +209,10 @@ int SumatraUIAutomationTextRange::FindNextLineEndpoint(int pageno, int idx, bool
         }
     }
 
-    for (; idx < textLen; idx++) {
-        if (pageText[idx] == L'\n')
-            break;
-    }
-    return idx;
+    int count;
+    const int* lineBreaks = cache->GetLineBreaksForPage(pageno, &count);
+    int i = FindLineBreakIdx(lineBreaks, count, idx);
+    return i < count ? lineBreaks[i] : std::max(idx, textLen);
 }
 
 // IUnknown
@@ -423,26 +440,40 @@ HRESULT STDMETHODCALLTYPE SumatraUIAutomationTextRange::GetText(int maxLength, B
         return S_OK;
     }
 
-    TextSelection selection(document->GetDM()->GetEngine(), document->GetDM()->textCache);
-    selection.StartAt(startPage, startGlyph);
-    selection.SelectUpTo(endPage, endGlyph);
-
-    AutoFreeWstr selected_text(selection.ExtractText(L"\r\n"));
-    size_t selected_text_length = str::Len(selected_text);
-
     // -1 and [0, inf) are allowed
-    if (maxLength > -2) {
-        if (maxLength != -1 && selected_text_length > (size_t)maxLength)
-            selected_text[maxLength] = '\0'; // truncate
-
-        *text = SysAllocString(selected_text);
-        if (*text)
-            return S_OK;
-        else
-            return E_OUTOFMEMORY;
-    } else {
+    if (maxLength < -1)
         return E_INVALIDARG;
+
+    // screen readers often ask for (the start of) the text of the entire document,
+    // so the cached page text is copied directly (instead of going through a
+    // TextSelection which needs the coordinates of all glyphs) and only as much as needed
+    auto cache = document->GetDM()->textCache;
+    str::WStr selected_text;
+    for (int page = startPage; page <= endPage; page++) {
+        if (maxLength != -1 && selected_text.size() >= (size_t)maxLength)
+            break;
+        int textLen;
+        PageTextPin pin(cache, page);
+        const WCHAR* pageText = cache->GetTextForPage(page, &textLen);
+        int glyph = page == startPage ? startGlyph : 0;
+        int end = page == endPage ? std::min(endGlyph, textLen) : textLen;
+        if (page > startPage && selected_text.size() > 0)
+            selected_text.Append(L"\r\n");
+        for (int i = glyph; i < end; i++) {
+            if (pageText[i] == '\n')
+                selected_text.Append(L"\r\n");
+            else
+                selected_text.Append(pageText[i]);
+        }
     }
+    if (maxLength != -1 && selected_text.size() > (size_t)maxLength)
+        selected_text.RemoveAt(maxLength, selected_text.size() - maxLength); // truncate
+
+    *text = SysAllocStringLen(selected_text.Get(), (UINT)selected_text.size());
+    if (*text)
+        return S_OK;
+    else
+        return E_OUTOFMEMORY;
 }
 
 HRESULT STDMETHODCALLTYPE SumatraUIAutomationTextRange::Move(enum TextUnit unit, int count, int* moved) {
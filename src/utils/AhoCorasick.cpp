@@ -0,0 +1,109 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/AhoCorasick.h"
+
+int AhoCorasick::AddNode(WCHAR c) {
+    nodes.Append(Node{0, -1, -1, -1, -1, c});
+    return nodes.isize() - 1;
+}
+
+int AhoCorasick::Child(int node, WCHAR c) const {
+    if (node == 0 && built && (size_t)c < dimof(rootChildren)) {
+        return rootChildren[c];
+    }
+    if (nodes.size() == 0) {
+        return -1;
+    }
+    for (int n = nodes.at(node).firstChild; n >= 0; n = nodes.at(n).sibling) {
+        if (nodes.at(n).c == c) {
+            return n;
+        }
+    }
+    return -1;
+}
+
+int AhoCorasick::AddPattern(const WCHAR* s) {
+    CrashIf(built);
+    if (str::IsEmpty(s)) {
+        return -1;
+    }
+    if (nodes.size() == 0) {
+        // the root
+        AddNode(0);
+    }
+    int node = 0;
+    for (const WCHAR* c = s; *c; c++) {
+        int next = Child(node, *c);
+        if (next < 0) {
+            next = AddNode(*c);
+            nodes.at(next).sibling = nodes.at(node).firstChild;
+            nodes.at(node).firstChild = next;
+        }
+        node = next;
+    }
+    if (nodes.at(node).pattern < 0) {
+        nodes.at(node).pattern = patternLens.isize();
+        patternLens.Append((int)str::Len(s));
+    }
+    return nodes.at(node).pattern;
+}
+
+void AhoCorasick::Build() {
+    CrashIf(built);
+    for (int& n : rootChildren) {
+        n = -1;
+    }
+    built = true;
+    if (nodes.size() == 0) {
+        return;
+    }
+
+    // breadth-first, so that the failure links of all shallower nodes are known
+    Vec<int> queue;
+    for (int n = nodes.at(0).firstChild; n >= 0; n = nodes.at(n).sibling) {
+        nodes.at(n).fail = 0;
+        queue.Append(n);
+        WCHAR c = nodes.at(n).c;
+        if ((size_t)c < dimof(rootChildren)) {
+            rootChildren[c] = n;
+        }
+    }
+    for (size_t i = 0; i < queue.size(); i++) {
+        int node = queue.at(i);
+        for (int n = nodes.at(node).firstChild; n >= 0; n = nodes.at(n).sibling) {
+            WCHAR c = nodes.at(n).c;
+            int f = nodes.at(node).fail;
+            int next;
+            while ((next = Child(f, c)) < 0 && f != 0) {
+                f = nodes.at(f).fail;
+            }
+            int fail = next < 0 ? 0 : next;
+            nodes.at(n).fail = fail;
+            nodes.at(n).outLink = nodes.at(fail).pattern >= 0 ? fail : nodes.at(fail).outLink;
+            queue.Append(n);
+        }
+    }
+}
+
+void AhoCorasick::FindAll(const WCHAR* text, int len, const AhoCorasickMatchCb& onMatch) const {
+    CrashIf(!built);
+    if (!built || nodes.size() == 0) {
+        return;
+    }
+    int state = 0;
+    for (int i = 0; i < len; i++) {
+        WCHAR c = text[i];
+        int next;
+        while ((next = Child(state, c)) < 0 && state != 0) {
+            state = nodes.at(state).fail;
+        }
+        state = next < 0 ? 0 : next;
+        int n = nodes.at(state).pattern >= 0 ? state : nodes.at(state).outLink;
+        for (; n >= 0; n = nodes.at(n).outLink) {
+            int pattern = nodes.at(n).pattern;
+            onMatch(pattern, i + 1 - patternLens.at(pattern));
+        }
+    }
+}
@@ -0,0 +1,51 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+// finds all occurrences of a set of strings in a single pass over a text
+// (an Aho-Corasick automaton over WCHARs, patterns are compared verbatim)
+
+typedef std::function<void(int pattern, int start)> AhoCorasickMatchCb;
+
+class AhoCorasick {
+  public:
+    AhoCorasick() = default;
+    AhoCorasick(AhoCorasick const&) = delete;
+    AhoCorasick& operator=(AhoCorasick const&) = delete;
+
+    // returns the index of the pattern (or of an identical pattern added before)
+    // or -1 for empty patterns. must be called before Build()
+    int AddPattern(const WCHAR* s);
+    // computes the failure links after all patterns have been added
+    void Build();
+
+    int PatternsCount() const {
+        return patternLens.isize();
+    }
+    int PatternLen(int pattern) const {
+        return patternLens.at(pattern);
+    }
+
+    // calls onMatch for all (possibly overlapping) occurrences, ordered by where they end
+    void FindAll(const WCHAR* text, int len, const AhoCorasickMatchCb& onMatch) const;
+
+  private:
+    struct Node {
+        int fail;
+        // index of the pattern ending at this node or -1
+        int pattern;
+        // closest node on the failure chain at which a pattern ends or -1
+        int outLink;
+        int firstChild;
+        int sibling;
+        WCHAR c;
+    };
+
+    Vec<Node> nodes;
+    Vec<int> patternLens;
+    // direct lookup of the children of the root for ASCII characters
+    int rootChildren[128];
+    bool built = false;
+
+    int AddNode(WCHAR c);
+    int Child(int node, WCHAR c) const;
+};
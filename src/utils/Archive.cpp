@@ -4,6 +4,7 @@
 #include "utils/BaseUtil.h"
 #include "utils/Archive.h"
 
+#include "utils/ScopedWin.h"
 #include "utils/StrSlice.h"
 #include "utils/FileUtil.h"
 #include "utils/WinUtil.h"
@@ -41,13 +42,24 @@ bool MultiFormatArchive::Open(ar_stream* data, const char* archivePath) {
     if (!data) {
         return false;
     }
+    if (archivePath && OpenFromCachedListing(archivePath)) {
+        return true;
+    }
+    bool ok = ListEntries(archivePath);
+    if (ok && archivePath) {
+        CacheListing(archivePath);
+    }
+    return ok;
+}
+
+bool MultiFormatArchive::ListEntries(const char* archivePath) {
     if ((format == Format::Rar) && archivePath && tryUnrarDllFirst) {
         bool ok = OpenUnrarFallback(archivePath);
         if (ok) {
             return true;
         }
     }
-    ar_ = opener_(data);
+    ar_ = opener_(data_);
     if (!ar_ || ar_at_eof(ar_)) {
         if (format == Format::Rar && archivePath) {
             return OpenUnrarFallback(archivePath);
@@ -75,6 +87,135 @@ bool MultiFormatArchive::Open(ar_stream* data, const char* archivePath) {
     return true;
 }
 
+// the entries of the most recently opened archives, so that an archive which is
+// opened again (e.g. for reading it after its thumbnail has been created) doesn't
+// have to be enumerated again, which is slow for large archives on network drives
+struct ArchiveListing {
+    char* path = nullptr;
+    archive_opener_t opener = nullptr;
+    // the archive's fingerprint
+    i64 fileSize = 0;
+    FILETIME modTime{};
+
+    bool usedUnrarDll = false;
+    Vec<MultiFormatArchive::FileInfo> fileInfos;
+    // for the names in fileInfos
+    PoolAllocator allocator;
+
+    ~ArchiveListing() {
+        str::Free(path);
+    }
+};
+
+#define MAX_CACHED_ARCHIVE_LISTINGS 16
+
+static CRITICAL_SECTION gArchiveListingsAccess;
+// the most recently used listing is at the end
+static Vec<ArchiveListing*> gArchiveListings;
+
+static CRITICAL_SECTION* GetArchiveListingsAccess() {
+    static bool initialized = [] {
+        InitializeCriticalSection(&gArchiveListingsAccess);
+        return true;
+    }();
+    UNUSED(initialized);
+    return &gArchiveListingsAccess;
+}
+
+static bool GetArchiveFingerprint(const char* path, i64& fileSize, FILETIME& modTime) {
+    AutoFreeWstr pathW = strconv::Utf8ToWstr(path);
+    WIN32_FILE_ATTRIBUTE_DATA fileInfo{};
+    if (!GetFileAttributesExW(pathW, GetFileExInfoStandard, &fileInfo)) {
+        return false;
+    }
+    fileSize = ((i64)fileInfo.nFileSizeHigh << 32) | fileInfo.nFileSizeLow;
+    modTime = fileInfo.ftLastWriteTime;
+    return true;
+}
+
+// Note: make sure to only call with gArchiveListingsAccess
+static int FindArchiveListing(const char* path, archive_opener_t opener) {
+    for (int i = 0; i < gArchiveListings.isize(); i++) {
+        ArchiveListing* listing = gArchiveListings.at(i);
+        if (listing->opener == opener && str::EqI(listing->path, path)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool MultiFormatArchive::OpenFromCachedListing(const char* archivePath) {
+    i64 fileSize;
+    FILETIME modTime;
+    if (!GetArchiveFingerprint(archivePath, fileSize, modTime)) {
+        return false;
+    }
+
+    ScopedCritSec scope(GetArchiveListingsAccess());
+    int idx = FindArchiveListing(archivePath, opener_);
+    if (idx < 0) {
+        return false;
+    }
+    ArchiveListing* listing = gArchiveListings.at(idx);
+    if (listing->fileSize != fileSize || !FileTimeEq(listing->modTime, modTime)) {
+        // the archive has been modified
+        gArchiveListings.RemoveAt(idx);
+        delete listing;
+        return false;
+    }
+
+    if (listing->usedUnrarDll) {
+        CrashIf(rarFilePath_);
+        auto tmp = Allocator::AllocString(&allocator_, archivePath);
+        rarFilePath_ = tmp.data();
+    } else {
+        // the entries are extracted by seeking to their cached positions
+        ar_ = opener_(data_);
+        if (!ar_) {
+            return false;
+        }
+    }
+    for (FileInfo& cached : listing->fileInfos) {
+        FileInfo* i = allocator_.AllocStruct<FileInfo>();
+        *i = cached;
+        i->name = Allocator::AllocString(&allocator_, cached.name);
+        fileInfos_.Append(i);
+    }
+
+    // move it to the end so that it's evicted last
+    gArchiveListings.RemoveAt(idx);
+    gArchiveListings.Append(listing);
+    return true;
+}
+
+void MultiFormatArchive::CacheListing(const char* archivePath) {
+    auto* listing = new ArchiveListing();
+    if (!GetArchiveFingerprint(archivePath, listing->fileSize, listing->modTime)) {
+        delete listing;
+        return;
+    }
+    listing->path = str::Dup(archivePath);
+    listing->opener = opener_;
+    listing->usedUnrarDll = LoadedUsingUnrarDll();
+    for (FileInfo* fi : fileInfos_) {
+        FileInfo cached = *fi;
+        cached.name = Allocator::AllocString(&listing->allocator, fi->name);
+        listing->fileInfos.Append(cached);
+    }
+
+    ScopedCritSec scope(GetArchiveListingsAccess());
+    int idx = FindArchiveListing(archivePath, opener_);
+    if (idx >= 0) {
+        delete gArchiveListings.at(idx);
+        gArchiveListings.RemoveAt(idx);
+    }
+    if (gArchiveListings.size() >= MAX_CACHED_ARCHIVE_LISTINGS) {
+        delete gArchiveListings.at(0);
+        gArchiveListings.RemoveAt(0);
+    }
+    gArchiveListings.Append(listing);
+}
+
 MultiFormatArchive::~MultiFormatArchive() {
     ar_close_archive(ar_);
     ar_close(data_);
@@ -109,6 +250,22 @@ std::string_view MultiFormatArchive::GetFileDataByName(const char* fileName) {
     return GetFileDataById(fileId);
 }
 
+// uncompresses (the start of) the entry ar is currently positioned at
+static std::string_view uncompressCurrentEntry(ar_archive* ar, size_t size) {
+    if (addOverflows<size_t>(size, ZERO_PADDING_COUNT)) {
+        return {};
+    }
+    char* data = AllocArray<char>(size + ZERO_PADDING_COUNT);
+    if (!data) {
+        return {};
+    }
+    if (!ar_entry_uncompress(ar, data, size)) {
+        free(data);
+        return {};
+    }
+    return {data, size};
+}
+
 std::string_view MultiFormatArchive::GetFileDataById(size_t fileId) {
     if (fileId == (size_t)-1) {
         return {};
@@ -130,19 +287,96 @@ std::string_view MultiFormatArchive::GetFileDataById(size_t fileId) {
     if (!ar_parse_entry_at(ar_, filePos)) {
         return {};
     }
-    size_t size = fileInfo->fileSizeUncompressed;
-    if (addOverflows<size_t>(size, ZERO_PADDING_COUNT)) {
+    return uncompressCurrentEntry(ar_, fileInfo->fileSizeUncompressed);
+}
+
+std::string_view MultiFormatArchive::GetFileDataPartById(size_t fileId, size_t maxSize) {
+    if (fileId == (size_t)-1) {
         return {};
     }
-    char* data = AllocArray<char>(size + ZERO_PADDING_COUNT);
-    if (!data) {
-        return {};
+    CrashIf(fileId >= fileInfos_.size());
+
+    auto* fileInfo = fileInfos_[fileId];
+    if (LoadedUsingUnrarDll() || fileInfo->fileSizeUncompressed <= maxSize) {
+        return GetFileDataById(fileId);
     }
-    if (!ar_entry_uncompress(ar_, data, size)) {
+    if (!ar_ || !ar_parse_entry_at(ar_, fileInfo->filePos)) {
         return {};
     }
+    return uncompressCurrentEntry(ar_, maxSize);
+}
 
-    return {data, size};
+bool MultiFormatArchive::HasRandomAccess() const {
+    return format == Format::Zip || format == Format::Tar;
+}
+
+static int cmpFileIds(const void* a, const void* b) {
+    size_t id1 = *(const size_t*)a;
+    size_t id2 = *(const size_t*)b;
+    return id1 < id2 ? -1 : id1 > id2 ? 1 : 0;
+}
+
+bool MultiFormatArchive::ExtractFiles(Vec<size_t> const& fileIds, const ExtractedFileCb& fileCb) {
+    Vec<size_t> ids(fileIds);
+    ids.Sort(cmpFileIds);
+    if (ids.size() == 0) {
+        return true;
+    }
+    CrashIf(ids.Last() >= fileInfos_.size());
+
+    if (LoadedUsingUnrarDll()) {
+        return ExtractFilesUnrarDll(ids, fileCb);
+    }
+
+    if (HasRandomAccess() || !ar_) {
+        for (size_t fileId : ids) {
+            if (!fileCb(fileId, GetFileDataById(fileId))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // in solid RAR archives, skipping an entry without uncompressing it makes
+    // unarr start over from the beginning of the solid block for the next one,
+    // so the entries in between have to be uncompressed as well
+    // (7z folders are uncompressed as a whole and cached by unarr)
+    bool uncompressSkipped = format == Format::Rar;
+    char* skipped = nullptr;
+    size_t skippedSize = 0;
+    defer {
+        free(skipped);
+    };
+
+    size_t idx = 0;
+    bool ok = ar_parse_entry_at(ar_, fileInfos_[ids[0]]->filePos);
+    for (size_t fileId = ids[0]; idx < ids.size(); fileId++) {
+        bool isWanted = ids[idx] == fileId;
+        while (idx < ids.size() && ids[idx] == fileId) {
+            idx++;
+        }
+        size_t size = fileInfos_[fileId]->fileSizeUncompressed;
+        if (isWanted) {
+            std::string_view data;
+            if (ok) {
+                data = uncompressCurrentEntry(ar_, size);
+            }
+            if (!fileCb(fileId, data)) {
+                return false;
+            }
+        } else if (ok && uncompressSkipped && size > 0) {
+            if (size > skippedSize) {
+                free(skipped);
+                skipped = AllocArray<char>(size);
+                skippedSize = skipped ? size : 0;
+            }
+            ok = skipped && ar_entry_uncompress(ar_, skipped, size);
+        }
+        if (ok && idx < ids.size()) {
+            ok = ar_parse_entry(ar_);
+        }
+    }
+    return true;
 }
 
 std::string_view MultiFormatArchive::GetComment() {
@@ -364,6 +598,70 @@ Exit:
     return {data, size};
 }
 
+// extracts all files in a single pass (instead of re-opening the archive
+// and skipping to the requested file for every single one of them)
+bool MultiFormatArchive::ExtractFilesUnrarDll(Vec<size_t> const& ids, const ExtractedFileCb& fileCb) {
+    CrashIf(!rarFilePath_);
+
+    AutoFreeWstr rarPath = strconv::Utf8ToWstr(rarFilePath_);
+
+    str::Slice uncompressedBuf;
+
+    RAROpenArchiveDataEx arcData = {0};
+    arcData.ArcNameW = rarPath.Get();
+    arcData.OpenMode = RAR_OM_EXTRACT;
+    arcData.Callback = unrarCallback;
+    arcData.UserData = (LPARAM)&uncompressedBuf;
+
+    HANDLE hArc = RAROpenArchiveEx(&arcData);
+    bool ok = hArc && arcData.OpenResult == 0;
+
+    bool completed = true;
+    size_t idx = 0;
+    for (size_t fileId = 0; idx < ids.size(); fileId++) {
+        RARHeaderDataEx rarHeader = {0};
+        ok = ok && RARReadHeaderEx(hArc, &rarHeader) == 0;
+        if (ids[idx] != fileId) {
+            if (ok) {
+                RARProcessFile(hArc, RAR_SKIP, nullptr, nullptr);
+            }
+            continue;
+        }
+        while (idx < ids.size() && ids[idx] == fileId) {
+            idx++;
+        }
+
+        char* data = nullptr;
+        size_t size = fileInfos_[fileId]->fileSizeUncompressed;
+        bool fileOk = ok && rarHeader.UnpSizeHigh == 0 && size == rarHeader.UnpSize &&
+                      !addOverflows<size_t>(size, ZERO_PADDING_COUNT);
+        if (fileOk) {
+            data = AllocArray<char>(size + ZERO_PADDING_COUNT);
+        }
+        if (data) {
+            uncompressedBuf.Set(data, size);
+            int res = RARProcessFile(hArc, RAR_TEST, nullptr, nullptr);
+            fileOk = (res == 0) && (uncompressedBuf.Left() == 0);
+        } else if (ok) {
+            RARProcessFile(hArc, RAR_SKIP, nullptr, nullptr);
+        }
+        if (!fileOk) {
+            str::Free(data);
+            data = nullptr;
+            size = 0;
+        }
+        if (!fileCb(fileId, {data, size})) {
+            completed = false;
+            break;
+        }
+    }
+
+    if (hArc) {
+        RARCloseArchive(hArc);
+    }
+    return completed;
+}
+
 // asan build crashes in UnRAR code
 // see https://codeeval.dev/gist/801ad556960e59be41690d0c2fa7cba0
 #if defined(ASAN_BUILD)
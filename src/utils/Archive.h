@@ -42,6 +42,19 @@ class MultiFormatArchive {
 #endif
     std::string_view GetFileDataByName(const char* filename);
     std::string_view GetFileDataById(size_t fileId);
+    // uncompresses at most <maxSize> bytes from the start of a file
+    // (cheap for non-solid archives, e.g. for reading an image's header)
+    std::string_view GetFileDataPartById(size_t fileId, size_t maxSize);
+
+    // true if any file can be extracted without decompressing the ones before it
+    bool HasRandomAccess() const;
+
+    // calls <fileCb> for each of the given files in the order in which they're stored
+    // in the archive, which for solid archives avoids restarting decompression for
+    // every file; <fileCb> takes ownership of the data (which is empty if a file couldn't
+    // be extracted) and may return false to stop, in which case false is returned
+    typedef std::function<bool(size_t fileId, std::string_view data)> ExtractedFileCb;
+    bool ExtractFiles(Vec<size_t> const& fileIds, const ExtractedFileCb& fileCb);
 
     std::string_view GetComment();
 
@@ -57,8 +70,13 @@ class MultiFormatArchive {
     // only set when we loaded file infos using unrar.dll fallback
     const char* rarFilePath_ = nullptr;
 
+    bool ListEntries(const char* archivePath);
+    bool OpenFromCachedListing(const char* archivePath);
+    void CacheListing(const char* archivePath);
+
     bool OpenUnrarFallback(const char* rarPathUtf);
     std::string_view GetFileDataByIdUnarrDll(size_t fileId);
+    bool ExtractFilesUnrarDll(Vec<size_t> const& ids, const ExtractedFileCb& fileCb);
     bool LoadedUsingUnrarDll() const {
         return rarFilePath_ != nullptr;
     }
@@ -74,17 +74,28 @@ WCHAR* Allocator::StrDup(Allocator* a, const WCHAR* s) {
 }
 #endif
 
+MemCounter gPoolAllocatorMem;
+MemCounter gHeapAllocatorMem;
+MemCounter gArenaAllocatorMem;
+
 void PoolAllocator::Free(const void*) {
     // does nothing, we can't free individual pieces of memory
 }
 
 void PoolAllocator::FreeAll() {
     Block* curr = firstBlock;
+    int hdrSize = RoundUp((int)sizeof(PoolAllocator::Block), allocAlign);
     while (curr) {
         Block* next = curr->next;
+        MemCounterFree(gPoolAllocatorMem, (size_t)hdrSize + curr->dataSize);
         free(curr);
         curr = next;
     }
+    for (int i = 0; i < POOL_INDEX_MAX_CHUNKS && indexChunks[i]; i++) {
+        MemCounterFree(gPoolAllocatorMem, ((size_t)POOL_INDEX_FIRST_CHUNK_SIZE << i) * sizeof(void*));
+        free(indexChunks[i]);
+        indexChunks[i] = nullptr;
+    }
     currBlock = nullptr;
     firstBlock = nullptr;
     nAllocs = 0;
@@ -130,17 +141,45 @@ static bool BlockHasSpaceFor(PoolAllocator::Block* block, int size, int allocAli
         return false;
     }
     char* d = RoundUp(block->curr, allocAlign);
-    // data + i32 index of allocation
-    d += (size + sizeof(i32));
+    d += size;
     if (d > block->end) {
         return false;
     }
     return true;
 }
 
+// index i is entry <*idxInChunk> of chunk <return value>
+static int IndexChunkFor(int i, int* idxInChunk) {
+    unsigned int n = (unsigned int)(i / POOL_INDEX_FIRST_CHUNK_SIZE) + 1;
+    int chunk = 0;
+#if defined(_MSC_VER)
+    unsigned long bit;
+    _BitScanReverse(&bit, n);
+    chunk = (int)bit;
+#else
+    chunk = 31 - __builtin_clz(n);
+#endif
+    *idxInChunk = i - POOL_INDEX_FIRST_CHUNK_SIZE * ((1 << chunk) - 1);
+    return chunk;
+}
+
 void* PoolAllocator::Alloc(size_t size) {
+    int idxInChunk;
+    int chunk = IndexChunkFor(nAllocs, &idxInChunk);
+    if (chunk >= POOL_INDEX_MAX_CHUNKS) {
+        return nullptr;
+    }
+    if (!indexChunks[chunk]) {
+        size_t chunkSize = ((size_t)POOL_INDEX_FIRST_CHUNK_SIZE << chunk) * sizeof(void*);
+        indexChunks[chunk] = (void**)malloc(chunkSize);
+        if (!indexChunks[chunk]) {
+            return nullptr;
+        }
+        MemCounterAlloc(gPoolAllocatorMem, chunkSize);
+    }
+
     if (!BlockHasSpaceFor(currBlock, (int)size, allocAlign)) {
-        int freeSpaceSize = (int)size + sizeof(i32); // + space for index
+        int freeSpaceSize = (int)size;
         int hdrSize = RoundUp((int)sizeof(PoolAllocator::Block), allocAlign);
         int blockSize = hdrSize + freeSpaceSize;
         if (blockSize < minBlockSize) {
@@ -149,12 +188,13 @@ void* PoolAllocator::Alloc(size_t size) {
         }
         // TODO: zero with calloc()? slower but safer
         auto block = (Block*)malloc(blockSize);
+        MemCounterAlloc(gPoolAllocatorMem, blockSize);
         char* start = (char*)block;
 
         block->nAllocs = 0;
         block->curr = start + hdrSize;
         block->dataSize = freeSpaceSize;
-        block->end = start + block->dataSize;
+        block->end = start + blockSize;
         block->next = nullptr;
         if (!firstBlock) {
             firstBlock = block;
@@ -166,16 +206,11 @@ void* PoolAllocator::Alloc(size_t size) {
     }
     char* res = RoundUp(currBlock->curr, allocAlign);
     currBlock->curr = res + size;
-
-    char* blockStart = (char*)currBlock;
-
-    i32 offset = (i32)(res - blockStart);
-    i32* index = (i32*)currBlock->end;
-    index -= 1;
-    index[0] = offset;
-    currBlock->end = (char*)index;
     currBlock->nAllocs += 1;
-    nAllocs += 1;
+
+    indexChunks[chunk][idxInChunk] = res;
+    // publish the index entry before the allocation becomes visible to readers
+    InterlockedIncrement((LONG*)&nAllocs);
     return res;
 }
 
@@ -184,19 +219,113 @@ void* PoolAllocator::At(int i) {
     if (i < 0 || i >= nAllocs) {
         return nullptr;
     }
-    auto curr = firstBlock;
-    while (curr && i >= curr->nAllocs) {
-        i -= curr->nAllocs;
-        curr = curr->next;
-    }
-    CrashIf(!curr);
-    CrashIf(i >= curr->nAllocs);
-    i32* index = (i32*)curr->end;
-    // elements are in reverse
-    int idx = curr->nAllocs - i - 1;
-    i32 offset = index[idx];
-    char* d = (char*)curr + offset;
-    return (void*)d;
+    int idxInChunk;
+    int chunk = IndexChunkFor(i, &idxInChunk);
+    return indexChunks[chunk][idxInChunk];
+}
+
+// each allocation is preceded by its size, which also keeps the data 16-byte aligned
+#define ARENA_HDR_SIZE 16
+
+static size_t ChunkHdrSize() {
+    return RoundUp(sizeof(ArenaAllocator::Chunk), (size_t)ARENA_HDR_SIZE);
+}
+
+static char* ChunkData(ArenaAllocator::Chunk* chunk) {
+    return (char*)chunk + ChunkHdrSize();
+}
+
+ArenaAllocator::~ArenaAllocator() {
+    FreeAll();
+}
+
+void* ArenaAllocator::Alloc(size_t size) {
+    size_t need = ARENA_HDR_SIZE + RoundUp(size, (size_t)ARENA_HDR_SIZE);
+    if (!curr || curr->used + need > curr->size) {
+        size_t dataSize = std::max(need, minChunkSize);
+        size_t chunkSize = ChunkHdrSize() + dataSize;
+        Chunk* chunk = (Chunk*)malloc(chunkSize);
+        if (!chunk) {
+            return nullptr;
+        }
+        MemCounterAlloc(gArenaAllocatorMem, chunkSize);
+        chunk->prev = curr;
+        chunk->size = dataSize;
+        chunk->used = 0;
+        curr = chunk;
+    }
+    char* res = ChunkData(curr) + curr->used + ARENA_HDR_SIZE;
+    *(size_t*)(res - ARENA_HDR_SIZE) = size;
+    curr->used += need;
+    last = res;
+    return res;
+}
+
+void* ArenaAllocator::Realloc(void* mem, size_t size) {
+    if (!mem) {
+        return Alloc(size);
+    }
+    char* d = (char*)mem;
+    size_t* sizePtr = (size_t*)(d - ARENA_HDR_SIZE);
+    if (d == last) {
+        // grow (or shrink) in place
+        size_t start = (size_t)(d - ChunkData(curr));
+        size_t end = start + RoundUp(size, (size_t)ARENA_HDR_SIZE);
+        if (end <= curr->size) {
+            curr->used = end;
+            *sizePtr = size;
+            return mem;
+        }
+    } else if (size <= *sizePtr) {
+        return mem;
+    }
+    void* res = Alloc(size);
+    if (res) {
+        memcpy(res, mem, std::min(*sizePtr, size));
+    }
+    return res;
+}
+
+void ArenaAllocator::Free(const void* mem) {
+    if (mem && mem == last) {
+        curr->used = (size_t)(last - ChunkData(curr)) - ARENA_HDR_SIZE;
+        last = nullptr;
+    }
+}
+
+ArenaAllocator::Mark ArenaAllocator::GetMark() const {
+    Mark mark;
+    mark.chunk = curr;
+    mark.used = curr ? curr->used : 0;
+    return mark;
+}
+
+void ArenaAllocator::ResetTo(const Mark& mark) {
+    while (curr && curr != mark.chunk && (curr->prev || mark.chunk)) {
+        Chunk* prev = curr->prev;
+        MemCounterFree(gArenaAllocatorMem, ChunkHdrSize() + curr->size);
+        free(curr);
+        curr = prev;
+    }
+    if (curr) {
+        curr->used = curr == mark.chunk ? mark.used : 0;
+    }
+    last = nullptr;
+}
+
+void ArenaAllocator::FreeAll() {
+    while (curr) {
+        Chunk* prev = curr->prev;
+        MemCounterFree(gArenaAllocatorMem, ChunkHdrSize() + curr->size);
+        free(curr);
+        curr = prev;
+    }
+    last = nullptr;
+}
+
+ArenaAllocator* GetThreadArena() {
+    static thread_local ArenaAllocator arena;
+    return &arena;
 }
 
 #if !OS_WIN
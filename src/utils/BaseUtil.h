@@ -374,6 +374,30 @@ bool ListRemove(T** root, T* el) {
     return true;
 }
 
+// process-wide count and size of live allocations of some kind, cheap enough
+// to always be kept up to date (thread-safe). Used for -memstats reports
+struct MemCounter {
+    LONG64 count = 0;
+    LONG64 bytes = 0;
+};
+
+inline void MemCounterAlloc(MemCounter& c, size_t size) {
+    InterlockedIncrement64(&c.count);
+    InterlockedExchangeAdd64(&c.bytes, (LONG64)size);
+}
+
+inline void MemCounterFree(MemCounter& c, size_t size) {
+    InterlockedDecrement64(&c.count);
+    InterlockedExchangeAdd64(&c.bytes, -(LONG64)size);
+}
+
+// blocks allocated by all PoolAllocators
+extern MemCounter gPoolAllocatorMem;
+// allocations made through all HeapAllocators
+extern MemCounter gHeapAllocatorMem;
+// chunks allocated by all ArenaAllocators
+extern MemCounter gArenaAllocatorMem;
+
 // Base class for allocators that can be provided to Vec class
 // (and potentially others). Needed because e.g. in crash handler
 // we want to use Vec but not use standard malloc()/free() functions
@@ -415,6 +439,13 @@ struct Allocator {
 //
 // Note: we could be a bit more clever here by allocating data in 4K chunks
 // via VirtualAlloc() etc. instead of malloc(), which would lower the overhead
+
+// the first chunk of PoolAllocator's index has this many entries
+// and every following one twice as many as the previous one
+#define POOL_INDEX_FIRST_CHUNK_SIZE 256
+// enough chunks for INT_MAX allocations
+#define POOL_INDEX_MAX_CHUNKS 24
+
 struct PoolAllocator : Allocator {
     // we'll allocate block of the minBlockSize unless
     // asked for a block of bigger size
@@ -425,15 +456,12 @@ struct PoolAllocator : Allocator {
     // requirements or to ensure CPU operations (like SSE) are fast
     int allocAlign = 8;
 
-    // contains allocated data and index of each allocation
+    // contains allocated data
     struct Block {
         struct Block* next;
         int dataSize; // for debugging, not used
         int nAllocs;
         char* curr;
-        // from the end, we store index of each allocation relative
-        // to start of the block. <end> points at the current
-        // reverse end of i32 array of indexes
         char* end;
         // data follows here
     };
@@ -442,6 +470,11 @@ struct PoolAllocator : Allocator {
     Block* firstBlock = nullptr;
     int nAllocs = 0;
 
+    // pointers to all allocations, for O(1) At(). The chunks grow in size
+    // and are never reallocated, so that allocations can be read by other
+    // threads while new ones are added
+    void** indexChunks[POOL_INDEX_MAX_CHUNKS] = {};
+
     PoolAllocator() = default;
 
     // Allocator methods
@@ -511,12 +544,29 @@ struct HeapAllocator : Allocator {
         HeapDestroy(allocHeap);
     }
     void* Alloc(size_t size) override {
-        return HeapAlloc(allocHeap, 0, size);
+        void* mem = HeapAlloc(allocHeap, 0, size);
+        if (mem) {
+            MemCounterAlloc(gHeapAllocatorMem, size);
+        }
+        return mem;
     }
     void* Realloc(void* mem, size_t size) override {
-        return HeapReAlloc(allocHeap, 0, mem, size);
+        if (!mem) {
+            return Alloc(size);
+        }
+        size_t oldSize = HeapSize(allocHeap, 0, mem);
+        void* newMem = HeapReAlloc(allocHeap, 0, mem, size);
+        if (newMem) {
+            MemCounterFree(gHeapAllocatorMem, oldSize);
+            MemCounterAlloc(gHeapAllocatorMem, size);
+        }
+        return newMem;
     }
     void Free(const void* mem) override {
+        if (!mem) {
+            return;
+        }
+        MemCounterFree(gHeapAllocatorMem, HeapSize(allocHeap, 0, mem));
         HeapFree(allocHeap, 0, (void*)mem);
     }
 
@@ -524,6 +574,58 @@ struct HeapAllocator : Allocator {
     HeapAllocator& operator=(const HeapAllocator&) = delete;
 };
 
+// ArenaAllocator is a bump allocator for short-lived temporaries, e.g. while
+// rendering or laying out a page. Unlike PoolAllocator, it supports Realloc
+// (the most recent allocation grows in place) so that it can be used with Vec
+// and str::Str. Free only reclaims the most recent allocation, everything
+// else is reclaimed with ResetTo (cf. ScopedArenaMark)
+struct ArenaAllocator : Allocator {
+    struct Chunk {
+        Chunk* prev;
+        size_t size; // of the data, which follows here
+        size_t used;
+    };
+    struct Mark {
+        Chunk* chunk = nullptr;
+        size_t used = 0;
+    };
+
+    size_t minChunkSize = 64 * 1024;
+    Chunk* curr = nullptr;
+    // the most recent allocation
+    char* last = nullptr;
+
+    ArenaAllocator() = default;
+
+    // Allocator methods
+    ~ArenaAllocator() override;
+    void* Alloc(size_t size) override;
+    void* Realloc(void* mem, size_t size) override;
+    void Free(const void* mem) override;
+
+    Mark GetMark() const;
+    // frees everything allocated after mark was taken
+    // (the first chunk is kept for re-use)
+    void ResetTo(const Mark& mark);
+    void FreeAll();
+};
+
+// returns an ArenaAllocator that's only used by the calling thread
+// (so that temporaries in render threads don't contend for the heap lock)
+ArenaAllocator* GetThreadArena();
+
+// frees everything allocated from the arena during the lifetime of this object
+struct ScopedArenaMark {
+    ArenaAllocator* arena;
+    ArenaAllocator::Mark mark;
+
+    explicit ScopedArenaMark(ArenaAllocator* arena) : arena(arena), mark(arena->GetMark()) {
+    }
+    ~ScopedArenaMark() {
+        arena->ResetTo(mark);
+    }
+};
+
 // A helper for allocating an array of elements of type T
 // either on stack (if they fit within StackBufInBytes)
 // or in memory. Allocating on stack is a perf optimization
@@ -50,6 +50,65 @@ void CalcSHA2Digest(const unsigned char* data, size_t byteCount, unsigned char d
 
 #endif
 
+// how many blocks of which size CalcFileFingerprint samples
+#define FINGERPRINT_BLOCK_SIZE 4096
+#define FINGERPRINT_BLOCKS 16
+
+bool CalcFileFingerprint(const WCHAR* filePath, unsigned char digest[16]) {
+    if (!filePath) {
+        return false;
+    }
+    DWORD share = FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE;
+    HANDLE h = CreateFileW(filePath, GENERIC_READ, share, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (INVALID_HANDLE_VALUE == h) {
+        return false;
+    }
+    BY_HANDLE_FILE_INFORMATION info;
+    if (!GetFileInformationByHandle(h, &info)) {
+        CloseHandle(h);
+        return false;
+    }
+
+    // the digest is the MD5 of the size, the modification time and
+    // the (much faster to calculate) MurmurHash2 of each block
+    u32 key[4 + FINGERPRINT_BLOCKS] = {0};
+    key[0] = info.nFileSizeHigh;
+    key[1] = info.nFileSizeLow;
+    key[2] = info.ftLastWriteTime.dwHighDateTime;
+    key[3] = info.ftLastWriteTime.dwLowDateTime;
+
+    u64 size = ((u64)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+    // for smaller files, all blocks are hashed
+    u64 step = FINGERPRINT_BLOCK_SIZE;
+    if (size > (u64)FINGERPRINT_BLOCK_SIZE * FINGERPRINT_BLOCKS) {
+        step = (size - FINGERPRINT_BLOCK_SIZE) / (FINGERPRINT_BLOCKS - 1);
+    }
+    u8 block[FINGERPRINT_BLOCK_SIZE];
+    bool ok = true;
+    for (int i = 0; i < FINGERPRINT_BLOCKS && ok; i++) {
+        u64 offset = i * step;
+        if (i == FINGERPRINT_BLOCKS - 1 && size > FINGERPRINT_BLOCK_SIZE) {
+            offset = size - FINGERPRINT_BLOCK_SIZE;
+        }
+        if (offset >= size) {
+            break;
+        }
+        LARGE_INTEGER off;
+        off.QuadPart = (LONGLONG)offset;
+        DWORD toRead = (DWORD)std::min(size - offset, (u64)FINGERPRINT_BLOCK_SIZE);
+        DWORD nRead = 0;
+        ok = SetFilePointerEx(h, off, nullptr, FILE_BEGIN) && ReadFile(h, block, toRead, &nRead, nullptr) &&
+             nRead == toRead;
+        key[4 + i] = MurmurHash2(block, nRead);
+    }
+    CloseHandle(h);
+    if (!ok) {
+        return false;
+    }
+    CalcMD5Digest((const unsigned char*)key, sizeof(key), digest);
+    return true;
+}
+
 // Note: this crashes under Win2000, use SHA2 or MD5 instad
 void CalcSHA1Digest(const unsigned char* data, size_t byteCount, unsigned char digest[20]) {
     CalcSha1DigestWin(data, byteCount, digest);
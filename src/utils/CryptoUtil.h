@@ -9,5 +9,11 @@ void CalcMD5DigestWin(const void* data, size_t byteCount, unsigned char digest[1
 void CalcSha1DigestWin(const void* data, size_t byteCount, unsigned char digest[20]);
 void CalcSha2DigestWin(const void* data, size_t byteCount, unsigned char digest[32]);
 
+// a quick fingerprint of a file for use as key of persistent caches: instead of the
+// entire content, only the size, the last modification time and a few 4 KB blocks
+// (the first, the last and some evenly spaced in between) are hashed, so that larger
+// files and files on slow drives don't take much longer than smaller ones
+bool CalcFileFingerprint(const WCHAR* filePath, unsigned char digest[16]);
+
 bool VerifySHA1Signature(const void* data, size_t dataLen, const char* hexSignature, const void* pubkey,
                          size_t pubkeyLen);
@@ -146,6 +146,16 @@ bool Initialize(const WCHAR* symPathW, bool force) {
     if (needsCleanup)
         DynSymCleanup(GetCurrentProcess());
 
+    // the options must be set before SymInitialize(): with invadeProcess=TRUE
+    // it would otherwise load the symbols of all modules right away instead
+    // of only for the modules we actually need to resolve addresses in
+    if (DynSymGetOptions && DynSymSetOptions) {
+        DWORD symOptions = DynSymGetOptions();
+        symOptions |= (SYMOPT_LOAD_LINES | SYMOPT_DEFERRED_LOADS | SYMOPT_UNDNAME);
+        symOptions |= SYMOPT_FAIL_CRITICAL_ERRORS; // don't show system msg box on errors
+        DynSymSetOptions(symOptions);
+    }
+
     if (DynSymInitializeW) {
         gSymInitializeOk = DynSymInitializeW(GetCurrentProcess(), symPathW, TRUE);
     } else {
@@ -160,11 +170,6 @@ bool Initialize(const WCHAR* symPathW, bool force) {
         return false;
     }
 
-    DWORD symOptions = DynSymGetOptions();
-    symOptions |= (SYMOPT_LOAD_LINES | SYMOPT_DEFERRED_LOADS | SYMOPT_UNDNAME);
-    symOptions |= SYMOPT_FAIL_CRITICAL_ERRORS; // don't show system msg box on errors
-    DynSymSetOptions(symOptions);
-
     // SetupSymbolPath();
     return true;
 }
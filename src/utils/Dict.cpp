@@ -10,21 +10,23 @@ just as well be a tree of some kind.
 Usually those things are done as a templated hash table class,
 but I want to avoid code bloat and awful syntax.
 
-The classes are based on a generic, untyped uintptr => uintptr
+The classes are based on a generic, untyped uintptr => int
 hash table. The actual dict class is a wrapper that provides
 a type-safe API and handles policy decisions like allocations
 (if they are necessary).
 
-Our hash table uses the same parameters as the one in redis
-(but without complexity of incremental hashing):
-- we use chaining on collisions
-- size of the hash table is power of two
+Our hash table uses open addressing with Robin Hood hashing:
+- all entries live in a single array whose size is a power of two
+- each slot stores the key's hash next to the key, so that probing
+  only compares keys whose hashes match and resizing doesn't re-hash
+- on insertion, an entry displaces those that are closer to their
+  home slot, which keeps probe sequences short even at high load:
+  a lookup can stop as soon as it sees an entry closer to its home
+  than the probed key would be
+- removal shifts the following entries back, so there are no tombstones
 
 TODO:
 - add iterator for keys/values
-- would hash function be faster if we got bytes one at a time
-  but only with a single pass vs. getting 4 at a time but
-  doing 2 passes (the first to calculate the length)?
 */
 
 #include "utils/BaseUtil.h"
@@ -32,17 +34,43 @@ TODO:
 
 namespace dict {
 
+// hash tables don't need hashes to be stable across runs or versions, so this
+// trades some of MurmurHash2's quality for speed by mixing in 8 bytes at a time
+static inline u64 HashMix(u64 h, u64 v) {
+    h ^= v;
+    h *= 0x9E3779B97F4A7C15ULL;
+    return h ^ (h >> 29);
+}
+
+static u32 HashBytes(const void* data, size_t len) {
+    const u8* s = (const u8*)data;
+    u64 h = HashMix(0xCBF29CE484222325ULL, (u64)len);
+    for (; len >= 8; len -= 8, s += 8) {
+        u64 v;
+        memcpy(&v, s, 8);
+        h = HashMix(h, v);
+    }
+    if (len > 0) {
+        u64 v = 0;
+        memcpy(&v, s, len);
+        h = HashMix(h, v);
+    }
+    h ^= h >> 32;
+    h *= 0xFF51AFD7ED558CCDULL;
+    return (u32)(h ^ (h >> 32));
+}
+
 class HasherComparator {
   public:
-    virtual size_t Hash(uintptr_t key) = 0;
+    virtual u32 Hash(uintptr_t key) = 0;
     virtual bool Equal(uintptr_t k1, uintptr_t k2) = 0;
     virtual ~HasherComparator() {
     }
 };
 
 class StrKeyHasherComparator : public HasherComparator {
-    virtual size_t Hash(uintptr_t key) {
-        return MurmurHash2((const void*)key, str::Len((const char*)key));
+    virtual u32 Hash(uintptr_t key) {
+        return HashBytes((const void*)key, str::Len((const char*)key));
     }
     virtual bool Equal(uintptr_t k1, uintptr_t k2) {
         const char* s1 = (const char*)k1;
@@ -52,9 +80,9 @@ class StrKeyHasherComparator : public HasherComparator {
 };
 
 class WStrKeyHasherComparator : public HasherComparator {
-    virtual size_t Hash(uintptr_t key) {
+    virtual u32 Hash(uintptr_t key) {
         size_t cbLen = str::Len((const WCHAR*)key) * sizeof(WCHAR);
-        return MurmurHash2((const void*)key, cbLen);
+        return HashBytes((const void*)key, cbLen);
     }
     virtual bool Equal(uintptr_t k1, uintptr_t k2) {
         const WCHAR* s1 = (const WCHAR*)k1;
@@ -66,141 +94,140 @@ class WStrKeyHasherComparator : public HasherComparator {
 static StrKeyHasherComparator gStrKeyHasherComparator;
 static WStrKeyHasherComparator gWStrKeyHasherComparator;
 
-struct HashTableEntry {
+// a hash of 0 marks an empty slot, so that's never used for keys
+#define EMPTY_SLOT_HASH 0
+#define NO_SLOT ((size_t)-1)
+// the minimum number of slots a table starts with
+#define MIN_HASH_TABLE_SIZE 8
+
+struct HashTableSlot {
     uintptr_t key;
-    uintptr_t val;
-    struct HashTableEntry* next;
+    u32 hash;
+    int val;
 };
 
 // not a class so that it can be allocated with an allocator
 struct HashTable {
-    HashTableEntry** entries;
-    HashTableEntry* freeList;
-
-    size_t nEntries;
-    size_t nUsed; // total number of inserted entries
+    HashTableSlot* slots;
+    size_t nSlots; // always a power of 2
+    size_t nUsed;  // total number of inserted entries
 
     // for debugging
     size_t nResizes;
-    size_t nCollisions;
 };
 
 static HashTable* NewHashTable(size_t size, Allocator* allocator) {
     CrashIf(!allocator); // we'll leak otherwise
     HashTable* h = (HashTable*)Allocator::AllocZero(allocator, sizeof(HashTable));
-    // number of hash table entries should be power of 2
-    size = RoundToPowerOf2(size);
-    // entries are not allocated with allocator since those are large blocks
-    // and we don't want to waste their memory after
-    h->entries = AllocArray<HashTableEntry*>(size);
-    h->nEntries = size;
+    size = RoundToPowerOf2(std::max(size, (size_t)MIN_HASH_TABLE_SIZE));
+    // slots are not allocated with allocator since those are large blocks
+    // and we don't want to waste their memory after resizing
+    h->slots = AllocArray<HashTableSlot>(size);
+    h->nSlots = size;
     return h;
 }
 
 static void DeleteHashTable(HashTable* h) {
-    free(h->entries);
+    free(h->slots);
     // the rest is freed by allocator
 }
 
-static void HashTableResize(HashTable* h, HasherComparator* hc) {
-    size_t newSize = RoundToPowerOf2(h->nEntries + 1);
-    CrashIf(newSize <= h->nEntries);
-    HashTableEntry** newEntries = AllocArray<HashTableEntry*>(newSize);
-    HashTableEntry *e, *next;
-    size_t hash, pos;
-    for (size_t i = 0; i < h->nEntries; i++) {
-        e = h->entries[i];
-        while (e) {
-            next = e->next;
-            hash = hc->Hash(e->key);
-            pos = hash % newSize;
-            e->next = newEntries[pos];
-            newEntries[pos] = e;
-            e = next;
+static inline u32 KeyHash(HasherComparator* hc, uintptr_t key) {
+    u32 hash = hc->Hash(key);
+    return hash != EMPTY_SLOT_HASH ? hash : 1;
+}
+
+// how far the entry at pos is from the slot its hash maps to
+static inline size_t ProbeDistance(HashTable* h, u32 hash, size_t pos) {
+    return (pos - hash) & (h->nSlots - 1);
+}
+
+static size_t FindSlot(HashTable* h, HasherComparator* hc, uintptr_t key, u32 hash) {
+    size_t mask = h->nSlots - 1;
+    size_t pos = hash & mask;
+    for (size_t dist = 0;; dist++) {
+        HashTableSlot* s = &h->slots[pos];
+        // had the key been inserted, it would've displaced an entry closer to its home
+        if (s->hash == EMPTY_SLOT_HASH || ProbeDistance(h, s->hash, pos) < dist) {
+            return NO_SLOT;
         }
+        if (s->hash == hash && hc->Equal(key, s->key)) {
+            return pos;
+        }
+        pos = (pos + 1) & mask;
     }
-    free(h->entries);
-    h->entries = newEntries;
-    h->nEntries = newSize;
-    h->nResizes += 1;
+}
+
+// the key must not be in the table yet and there must be a free slot
+static void InsertNewEntry(HashTable* h, uintptr_t key, u32 hash, int val) {
+    size_t mask = h->nSlots - 1;
+    HashTableSlot e = {key, hash, val};
+    size_t pos = hash & mask;
+    size_t dist = 0;
+    for (;;) {
+        HashTableSlot* s = &h->slots[pos];
+        if (s->hash == EMPTY_SLOT_HASH) {
+            *s = e;
+            return;
+        }
+        size_t sDist = ProbeDistance(h, s->hash, pos);
+        if (sDist < dist) {
+            std::swap(*s, e);
+            dist = sDist;
+        }
+        pos = (pos + 1) & mask;
+        dist++;
+    }
+}
 
-    CrashIf(h->nUsed >= (h->nEntries * 3) / 2);
+static void HashTableResize(HashTable* h) {
+    HashTableSlot* oldSlots = h->slots;
+    size_t oldSize = h->nSlots;
+    h->nSlots = oldSize * 2;
+    h->slots = AllocArray<HashTableSlot>(h->nSlots);
+    for (size_t i = 0; i < oldSize; i++) {
+        HashTableSlot* s = &oldSlots[i];
+        if (s->hash != EMPTY_SLOT_HASH) {
+            InsertNewEntry(h, s->key, s->hash, s->val);
+        }
+    }
+    free(oldSlots);
+    h->nResizes += 1;
 }
 
 // micro optimization: this is called often, so we want this check inlined. Resizing logic
 // is called rarely, so doesn't need to be inlined
-static inline void HashTableResizeIfNeeded(HashTable* h, HasherComparator* hc) {
-    // per http://stackoverflow.com/questions/1603712/when-should-i-do-rehashing-of-entire-hash-table/1604428#1604428
-    // when using collision chaining, load factor can be 150%
-    if (h->nUsed < (h->nEntries * 3) / 2)
+static inline void HashTableResizeIfNeeded(HashTable* h) {
+    // Robin Hood hashing keeps probe sequences short up to a load factor of 7/8
+    if (h->nUsed + 1 <= h->nSlots - h->nSlots / 8) {
         return;
-    HashTableResize(h, hc);
-}
-
-// note: allocator must be nullptr for get, non-nullptr for create
-static HashTableEntry* GetOrCreateEntry(HashTable* h, HasherComparator* hc, uintptr_t key, Allocator* allocator,
-                                        bool& newEntry) {
-    bool shouldCreate = (allocator != nullptr);
-    size_t hash = hc->Hash(key);
-    size_t pos = hash % h->nEntries;
-    HashTableEntry* e = h->entries[pos];
-    newEntry = false;
-    while (e) {
-        if (hc->Equal(key, e->key))
-            return e;
-        e = e->next;
     }
-    if (!shouldCreate)
-        return nullptr;
-
-    if (h->freeList) {
-        e = h->freeList;
-        h->freeList = h->freeList->next;
-    } else {
-        e = (HashTableEntry*)Allocator::AllocZero(allocator, sizeof(HashTableEntry));
-    }
-    e->next = h->entries[pos];
-    h->entries[pos] = e;
-    h->nUsed++;
-    if (e->next != nullptr)
-        h->nCollisions++;
-    newEntry = true;
-    return e;
+    HashTableResize(h);
 }
 
-static bool RemoveEntry(HashTable* h, HasherComparator* hc, uintptr_t key, uintptr_t* removedValOut) {
-    size_t hash = hc->Hash(key);
-    size_t pos = hash % h->nEntries;
-    HashTableEntry* e = h->entries[pos];
-    while (e) {
-        if (hc->Equal(key, e->key))
-            break;
-        e = e->next;
-    }
-    if (!e)
+static bool RemoveEntry(HashTable* h, HasherComparator* hc, uintptr_t key, int* removedValOut) {
+    size_t pos = FindSlot(h, hc, key, KeyHash(hc, key));
+    if (pos == NO_SLOT) {
         return false;
-
-    // remove the the entry from the list
-    HashTableEntry* e2 = h->entries[pos];
-    if (e2 == e) {
-        h->entries[pos] = e->next;
-    } else {
-        while (e2->next != e) {
-            e2 = e2->next;
-        }
-        e2->next = e->next;
     }
-    e->next = h->freeList;
-    h->freeList = e;
-    *removedValOut = e->val;
+    *removedValOut = h->slots[pos].val;
+
+    // move the following entries one slot closer to their home
+    size_t mask = h->nSlots - 1;
+    size_t next = (pos + 1) & mask;
+    while (h->slots[next].hash != EMPTY_SLOT_HASH && ProbeDistance(h, h->slots[next].hash, next) > 0) {
+        h->slots[pos] = h->slots[next];
+        pos = next;
+        next = (next + 1) & mask;
+    }
+    h->slots[pos] = {};
     CrashIf(0 == h->nUsed);
     h->nUsed -= 1;
     return true;
 }
 
 MapStrToInt::MapStrToInt(size_t initialSize) {
-    // we use PoolAllocator to allocate HashTableEntry entries
-    // and copies of string keys
+    // we use PoolAllocator to allocate copies of string keys
     allocator.allocAlign = 4;
     h = NewHashTable(initialSize, &allocator);
 }
@@ -223,45 +250,44 @@ size_t MapStrToInt::Count() const {
 //   * inserts a copy of the key allocated with allocator
 //   * sets existingKeyOut to (interned) key
 bool MapStrToInt::Insert(const char* key, int val, int* existingValOut, const char** existingKeyOut) {
-    bool newEntry;
-    HashTableEntry* e = GetOrCreateEntry(h, &gStrKeyHasherComparator, (uintptr_t)key, &allocator, newEntry);
-    if (!newEntry) {
+    HasherComparator* hc = &gStrKeyHasherComparator;
+    u32 hash = KeyHash(hc, (uintptr_t)key);
+    size_t pos = FindSlot(h, hc, (uintptr_t)key, hash);
+    if (pos != NO_SLOT) {
         if (existingValOut)
-            *existingValOut = (int)e->val;
+            *existingValOut = h->slots[pos].val;
         if (existingKeyOut)
-            *existingKeyOut = (const char*)e->key;
+            *existingKeyOut = (const char*)h->slots[pos].key;
         return false;
     }
-    e->key = (intptr_t)Allocator::StrDup(&allocator, key);
-    e->val = (intptr_t)val;
+    HashTableResizeIfNeeded(h);
+    const char* keyCopy = Allocator::StrDup(&allocator, key);
+    InsertNewEntry(h, (uintptr_t)keyCopy, hash, val);
+    h->nUsed++;
     if (existingKeyOut)
-        *existingKeyOut = (const char*)e->key;
-
-    HashTableResizeIfNeeded(h, &gStrKeyHasherComparator);
+        *existingKeyOut = keyCopy;
     return true;
 }
 
 bool MapStrToInt::Remove(const char* key, int* removedValOut) {
-    uintptr_t removedVal;
+    int removedVal;
     bool removed = RemoveEntry(h, &gStrKeyHasherComparator, (uintptr_t)key, &removedVal);
     if (removed && removedValOut)
-        *removedValOut = (int)removedVal;
+        *removedValOut = removedVal;
     return removed;
 }
 
 bool MapStrToInt::Get(const char* key, int* valOut) {
-    StrKeyHasherComparator hc;
-    bool newEntry;
-    HashTableEntry* e = GetOrCreateEntry(h, &hc, (uintptr_t)key, nullptr, newEntry);
-    if (!e)
+    HasherComparator* hc = &gStrKeyHasherComparator;
+    size_t pos = FindSlot(h, hc, (uintptr_t)key, KeyHash(hc, (uintptr_t)key));
+    if (pos == NO_SLOT)
         return false;
-    *valOut = (int)e->val;
+    *valOut = h->slots[pos].val;
     return true;
 }
 
 MapWStrToInt::MapWStrToInt(size_t initialSize) {
-    // we use PoolAllocator to allocate HashTableEntry entries
-    // and copies of string keys
+    // we use PoolAllocator to allocate copies of string keys
     h = NewHashTable(initialSize, &allocator);
 }
 
@@ -274,35 +300,35 @@ size_t MapWStrToInt::Count() const {
 }
 
 bool MapWStrToInt::Insert(const WCHAR* key, int val, int* prevVal) {
-    bool newEntry;
-    HashTableEntry* e = GetOrCreateEntry(h, &gWStrKeyHasherComparator, (uintptr_t)key, &allocator, newEntry);
-    if (!newEntry) {
+    HasherComparator* hc = &gWStrKeyHasherComparator;
+    u32 hash = KeyHash(hc, (uintptr_t)key);
+    size_t pos = FindSlot(h, hc, (uintptr_t)key, hash);
+    if (pos != NO_SLOT) {
         if (prevVal)
-            *prevVal = (int)e->val;
+            *prevVal = h->slots[pos].val;
         return false;
     }
-    e->key = (intptr_t)Allocator::StrDup(&allocator, key);
-    e->val = (intptr_t)val;
-
-    HashTableResizeIfNeeded(h, &gWStrKeyHasherComparator);
+    HashTableResizeIfNeeded(h);
+    const WCHAR* keyCopy = Allocator::StrDup(&allocator, key);
+    InsertNewEntry(h, (uintptr_t)keyCopy, hash, val);
+    h->nUsed++;
     return true;
 }
 
 bool MapWStrToInt::Remove(const WCHAR* key, int* removedValOut) {
-    uintptr_t removedVal;
-    bool removed = RemoveEntry(h, &gStrKeyHasherComparator, (uintptr_t)key, &removedVal);
+    int removedVal;
+    bool removed = RemoveEntry(h, &gWStrKeyHasherComparator, (uintptr_t)key, &removedVal);
     if (removed && removedValOut)
-        *removedValOut = (int)removedVal;
+        *removedValOut = removedVal;
     return removed;
 }
 
 bool MapWStrToInt::Get(const WCHAR* key, int* valOut) {
-    WStrKeyHasherComparator hc;
-    bool newEntry;
-    HashTableEntry* e = GetOrCreateEntry(h, &hc, (uintptr_t)key, nullptr, newEntry);
-    if (!e)
+    HasherComparator* hc = &gWStrKeyHasherComparator;
+    size_t pos = FindSlot(h, hc, (uintptr_t)key, KeyHash(hc, (uintptr_t)key));
+    if (pos == NO_SLOT)
         return false;
-    *valOut = (int)e->val;
+    *valOut = h->slots[pos].val;
     return true;
 }
 
@@ -5,14 +5,12 @@ namespace dict {
 
 struct HashTable;
 
-// we are very generous with default initial size. It's a trade-off
-// between memory used by hash table and how often we need to resize it.
-// We allocate size*sizeof(ptr) which is 64k on 32-bit for 16k entries.
-// 64k is very little on today's machines, especially for short-lived
-// hash tables.
-// Should use smaller values for long-lived hash tables, especially
-// if there are many of them.
-enum { DEFAULT_HASH_TABLE_INITIAL_SIZE = 16 * 1024 };
+// the hash table doubles in size whenever it gets 7/8 full, so the initial
+// size is small: a slot takes 16 bytes (on 64-bit) and many dictionaries
+// (e.g. StringInterner for a single HTML document) only hold a few entries.
+// Should use larger values for dictionaries known to get large, to avoid
+// the cost of resizing
+enum { DEFAULT_HASH_TABLE_INITIAL_SIZE = 64 };
 
 // a dictionary whose keys are char * strings and the values are integers
 // note: StrToInt would be more natural name but it's re-#define'd in <shlwapi.h>
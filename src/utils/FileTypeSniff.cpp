@@ -72,12 +72,49 @@ Kind SniffFileType(SniffedFile* f) {
     f->wasSniffed = true;
 
     CrashIf(!f->filePath);
-    char buf[64] = {0};
-    int n = file::ReadN(f->filePath, buf, dimof(buf));
-    if (n <= 0) {
+    std::string_view header = ReadFileHeader(f->filePath);
+    if (header.empty()) {
         f->wasError = true;
         return nullptr;
     }
-    f->kind = SniffFileType({(char*)buf, (size_t)n});
+    f->kind = SniffFileType(header);
     return f->kind;
 }
+
+struct FileHeaderCache {
+    // > 0 while a ScopedFileHeaderCache is alive
+    int nScopes = 0;
+    WCHAR* path = nullptr;
+    int len = 0;
+    // zero-terminated for sniffers using str:: functions
+    char data[FILE_SNIFF_HEADER_SIZE + 1];
+};
+
+static thread_local FileHeaderCache gFileHeaderCache;
+
+std::string_view ReadFileHeader(const WCHAR* path) {
+    FileHeaderCache& c = gFileHeaderCache;
+    if (c.nScopes > 0 && c.path && str::Eq(c.path, path)) {
+        return {c.data, (size_t)c.len};
+    }
+    str::ReplacePtr(&c.path, nullptr);
+    int n = file::ReadN(path, c.data, FILE_SNIFF_HEADER_SIZE);
+    c.len = std::max(n, 0);
+    c.data[c.len] = 0;
+    if (c.nScopes > 0) {
+        // failures to read are cached as well
+        c.path = str::Dup(path);
+    }
+    return {c.data, (size_t)c.len};
+}
+
+ScopedFileHeaderCache::ScopedFileHeaderCache() {
+    gFileHeaderCache.nScopes++;
+}
+
+ScopedFileHeaderCache::~ScopedFileHeaderCache() {
+    FileHeaderCache& c = gFileHeaderCache;
+    if (--c.nScopes == 0) {
+        str::ReplacePtr(&c.path, nullptr);
+    }
+}
@@ -28,3 +28,20 @@ struct SniffedFile {
 // detect file type based on file content
 Kind SniffFileType(std::string_view d);
 Kind SniffFileType(SniffedFile*);
+
+// sniffing only ever looks at the start of a file
+#define FILE_SNIFF_HEADER_SIZE 4096
+
+// returns up to FILE_SNIFF_HEADER_SIZE bytes from the start of a file.
+// the result is only valid until the next call on the same thread
+std::string_view ReadFileHeader(const WCHAR* path);
+
+// while an instance is alive, the header of the most recently read file
+// is cached by ReadFileHeader (on the same thread), so that all engines
+// can sniff a file in turn while it's only read once
+struct ScopedFileHeaderCache {
+    bool wasActive = false;
+
+    ScopedFileHeaderCache();
+    ~ScopedFileHeaderCache();
+};
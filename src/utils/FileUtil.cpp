@@ -365,6 +365,151 @@ bool IsOnFixedDrive(const WCHAR* path) {
     return DRIVE_FIXED == type;
 }
 
+// the root of a network volume ("\\server\share\" or "X:\" for mapped
+// drives) or nullptr for paths on local drives
+static WCHAR* GetNetworkVolumeRoot(const WCHAR* path) {
+    if (str::StartsWith(path, L"\\\\?\\") || str::StartsWith(path, L"\\\\.\\")) {
+        return nullptr;
+    }
+    if (IsSep(path[0]) && IsSep(path[1])) {
+        const WCHAR* server = path + 2;
+        const WCHAR* share = server;
+        while (*share && !IsSep(*share)) {
+            share++;
+        }
+        if (!*share || share == server) {
+            return nullptr;
+        }
+        const WCHAR* end = share + 1;
+        while (*end && !IsSep(*end)) {
+            end++;
+        }
+        if (end == share + 1) {
+            return nullptr;
+        }
+        AutoFreeWstr root(str::DupN(path, end - path));
+        return str::Join(root, L"\\");
+    }
+    WCHAR root[] = L"?:\\";
+    root[0] = towupper(path[0]);
+    if (root[0] < 'A' || 'Z' < root[0] || path[1] != ':') {
+        return nullptr;
+    }
+    if (GetDriveType(root) != DRIVE_REMOTE) {
+        return nullptr;
+    }
+    return str::Dup(root);
+}
+
+// checking whether a network volume is reachable is done on a thread of
+// its own, so that callers can give up after a short time while the check
+// might take as long as the network timeout
+struct VolumeProbe {
+    // released by both the probing thread and IsVolumeReachable
+    LONG refCount = 2;
+    WCHAR* root = nullptr;
+    HANDLE done = nullptr;
+    bool reachable = false;
+};
+
+struct VolumeState {
+    WCHAR* root = nullptr;
+    bool reachable = false;
+    bool probing = false;
+    DWORD checkedAt = 0;
+};
+
+// results are remembered for this long
+#define VOLUME_STATE_CACHE_MS (30 * 1000)
+
+static CRITICAL_SECTION gVolumesAccess;
+static Vec<VolumeState> gVolumes;
+
+static CRITICAL_SECTION* GetVolumesAccess() {
+    static bool initialized = [] {
+        InitializeCriticalSection(&gVolumesAccess);
+        return true;
+    }();
+    UNUSED(initialized);
+    return &gVolumesAccess;
+}
+
+// Note: make sure to only call with gVolumesAccess
+static VolumeState* FindVolumeState(const WCHAR* root) {
+    for (VolumeState& vs : gVolumes) {
+        if (str::EqI(vs.root, root)) {
+            return &vs;
+        }
+    }
+    return nullptr;
+}
+
+static void ReleaseVolumeProbe(VolumeProbe* probe) {
+    if (InterlockedDecrement(&probe->refCount) == 0) {
+        CloseHandle(probe->done);
+        free(probe->root);
+        delete probe;
+    }
+}
+
+static DWORD WINAPI VolumeProbeThread(void* data) {
+    VolumeProbe* probe = (VolumeProbe*)data;
+    probe->reachable = GetFileAttributesW(probe->root) != INVALID_FILE_ATTRIBUTES;
+    {
+        ScopedCritSec scope(GetVolumesAccess());
+        VolumeState* vs = FindVolumeState(probe->root);
+        if (vs) {
+            vs->reachable = probe->reachable;
+            vs->probing = false;
+            vs->checkedAt = GetTickCount();
+        }
+    }
+    SetEvent(probe->done);
+    ReleaseVolumeProbe(probe);
+    return 0;
+}
+
+bool IsVolumeReachable(const WCHAR* path, DWORD timeoutMs) {
+    AutoFreeWstr root(GetNetworkVolumeRoot(path));
+    if (!root) {
+        return true;
+    }
+
+    VolumeProbe* probe = nullptr;
+    {
+        ScopedCritSec scope(GetVolumesAccess());
+        VolumeState* vs = FindVolumeState(root);
+        if (!vs) {
+            VolumeState newState;
+            newState.root = str::Dup(root);
+            gVolumes.Append(newState);
+            vs = &gVolumes.Last();
+        } else if (vs->probing || GetTickCount() - vs->checkedAt < VOLUME_STATE_CACHE_MS) {
+            // while a probe hasn't finished, the volume is considered unreachable
+            return vs->reachable && !vs->probing;
+        }
+        probe = new VolumeProbe();
+        probe->root = str::Dup(root);
+        probe->done = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+        HANDLE thread = CreateThread(nullptr, 0, VolumeProbeThread, probe, 0, nullptr);
+        if (!thread) {
+            ReleaseVolumeProbe(probe);
+            ReleaseVolumeProbe(probe);
+            return true;
+        }
+        CloseHandle(thread);
+        vs->probing = true;
+    }
+
+    // if the probe takes longer, the cached state is updated when it finishes
+    bool reachable = false;
+    if (WaitForSingleObject(probe->done, timeoutMs) == WAIT_OBJECT_0) {
+        reachable = probe->reachable;
+    }
+    ReleaseVolumeProbe(probe);
+    return reachable;
+}
+
 static bool MatchWildcardsRec(const WCHAR* fileName, const WCHAR* filter) {
 #define AtEndOf(str) (*(str) == '\0')
     switch (*filter) {
@@ -603,6 +748,39 @@ std::string_view ReadFileWithAllocator(const WCHAR* path, Allocator* allocator)
     return ReadFileWithAllocator(pathUtf8.data, allocator);
 }
 
+MappedFile::MappedFile(const WCHAR* path) {
+    // files on removable and network drives might disappear
+    // while they're mapped (and accessing them would then crash)
+    if (path && path::IsOnFixedDrive(path)) {
+        AutoCloseHandle h = OpenReadOnly(path);
+        LARGE_INTEGER size{};
+        if (h != INVALID_HANDLE_VALUE && GetFileSizeEx(h, &size) && size.QuadPart > 0 &&
+            (u64)size.QuadPart <= SIZE_MAX) {
+            HANDLE hMap = CreateFileMappingW(h, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (hMap) {
+                view = (char*)MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+                // the view keeps the mapping alive
+                CloseHandle(hMap);
+            }
+            if (view) {
+                data = {view, (size_t)size.QuadPart};
+                return;
+            }
+        }
+    }
+    if (path) {
+        data = ReadFile(path);
+    }
+}
+
+MappedFile::~MappedFile() {
+    if (view) {
+        UnmapViewOfFile(view);
+    } else {
+        str::Free(data.data());
+    }
+}
+
 // buf must be at least toRead in size (note: it won't be zero-terminated)
 // returns -1 for error
 int ReadN(const WCHAR* filePath, char* buf, size_t toRead) {
@@ -26,6 +26,9 @@ WCHAR* ShortPath(const WCHAR* path);
 bool IsSame(const WCHAR* path1, const WCHAR* path2);
 bool HasVariableDriveLetter(const WCHAR* path);
 bool IsOnFixedDrive(const WCHAR* path);
+// false for files on network volumes which haven't responded within timeoutMs.
+// results are cached per volume, true for files on local drives
+bool IsVolumeReachable(const WCHAR* path, DWORD timeoutMs = 1000);
 bool Match(const WCHAR* path, const WCHAR* filter);
 bool IsAbsolute(const WCHAR* path);
 
@@ -66,6 +69,27 @@ int GetZoneIdentifier(const WCHAR* path);
 bool SetZoneIdentifier(const WCHAR* path, int zoneId = URLZONE_INTERNET);
 
 HANDLE OpenReadOnly(const WCHAR* path);
+
+// read-only view of a file's content which for files on fixed drives is mapped
+// into memory instead of being read into a heap buffer, so that only the parts
+// actually accessed are read (through the OS's file cache)
+// note: unlike ReadFile's, the data isn't zero-terminated
+class MappedFile {
+  public:
+    explicit MappedFile(const WCHAR* path);
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    std::string_view Data() const {
+        return data;
+    }
+
+  private:
+    std::string_view data;
+    // nullptr if data had to be read into a heap buffer
+    char* view = nullptr;
+};
 #endif
 } // namespace file
 
@@ -30,17 +30,19 @@ worker thread so must be protected via g_threadCritSec.
 ReadDirectChangesW() doesn't always work for files on network drives,
 so for those files, we do manual checks, by using a timeout to
 periodically wake up thread.
+
+Programs often write a file in many chunks (or truncate it first), which
+results in a burst of notifications, and the file might not be readable
+until it's complete. So instead of calling the callback right away, the
+change is marked as pending and the callback is only called once the file
+has stopped changing for FILEWATCH_SETTLE_DELAY_MS and can be opened without
+a sharing violation (cf. RunSettleChecks).
 */
 
 /*
 TODO:
   - should I end the thread when there are no files to watch?
 
-  - a single file copy can generate multiple notifications for the same
-    file. add some delay mechanism so that subsequent change notifications
-    cancel a previous, delayed one ? E.g. a copy f2.pdf f.pdf generates 3
-    notifications if f2.pdf is 2 MB.
-
   - try to handle short file names as well: http://blogs.msdn.com/b/ericgu/archive/2005/10/07/478396.aspx
     but how to test it?
 
@@ -51,6 +53,12 @@ TODO:
 
 // there's a balance between responsiveness to changes and efficiency
 #define FILEWATCH_DELAY_IN_MS 1000
+// a changed file must have the same size and modification time for this long
+// before the change is reported (checked every FILEWATCH_SETTLE_CHECK_MS)
+#define FILEWATCH_SETTLE_DELAY_MS 500
+#define FILEWATCH_SETTLE_CHECK_MS 100
+// changes are reported after this long even if the file doesn't settle
+#define FILEWATCH_MAX_SETTLE_MS 10000
 
 // Some people use overlapped.hEvent to store data but I'm playing it safe.
 struct OverlappedEx {
@@ -83,6 +91,13 @@ struct WatchedFile {
     // file state for changes
     bool isManualCheck;
     FileState fileState;
+
+    // a change has been detected but not reported yet
+    bool isChangePending;
+    FileState pendingState;
+    // when the first and the most recent change of the current burst were detected
+    ULONGLONG pendingSince;
+    ULONGLONG lastChange;
 };
 
 static HANDLE g_threadHandle = 0;
@@ -99,6 +114,8 @@ static WatchedFile* g_watchedFiles = nullptr;
 
 static LONG gRemovalsPending = 0;
 
+static ULONGLONG g_lastManualCheck = 0;
+
 static void StartMonitoringDirForChanges(WatchedDir* wd);
 
 static void AwakeWatcherThread() {
@@ -135,14 +152,55 @@ static bool FileStateChanged(const WCHAR* filePath, FileState* fs) {
     return true;
 }
 
+static void MarkChangePending(WatchedFile* wf) {
+    ULONGLONG now = GetTickCount64();
+    if (!wf->isChangePending) {
+        wf->isChangePending = true;
+        wf->pendingSince = now;
+    }
+    wf->lastChange = now;
+    GetFileState(wf->filePath, &wf->pendingState);
+}
+
+// fails with a sharing violation while another process has the file open for writing
+static bool CanOpenForReading(const WCHAR* filePath) {
+    HANDLE h = file::OpenReadOnly(filePath);
+    if (INVALID_HANDLE_VALUE == h) {
+        return false;
+    }
+    CloseHandle(h);
+    return true;
+}
+
+// reports the pending changes of files that have settled
+static void RunSettleChecks() {
+    ScopedCritSec cs(&g_threadCritSec);
+
+    ULONGLONG now = GetTickCount64();
+    for (WatchedFile* wf = g_watchedFiles; wf; wf = wf->next) {
+        if (!wf->isChangePending) {
+            continue;
+        }
+        if (FileStateChanged(wf->filePath, &wf->pendingState)) {
+            wf->lastChange = now;
+        }
+        bool isOverdue = now - wf->pendingSince >= FILEWATCH_MAX_SETTLE_MS;
+        if (!isOverdue) {
+            if (now - wf->lastChange < FILEWATCH_SETTLE_DELAY_MS || !CanOpenForReading(wf->filePath)) {
+                continue;
+            }
+        }
+        wf->isChangePending = false;
+        // so that RunManualChecks doesn't report the same change again
+        wf->fileState = wf->pendingState;
+        wf->onFileChangedCb();
+    }
+}
+
 // TODO: per internet, fileName could be short, 8.3 dos-style name
 // and we don't handle that. On the other hand, I've only seen references
 // to it wrt. to rename/delete operation, which we don't get notified about
 //
-// TODO: to collapse multiple notifications for the same file, could put it on a
-// queue, restart the thread with a timeout, restart the process if we
-// get notified again before timeout expires, call OnFileChanges() when
-// timeout expires
 static void NotifyAboutFile(WatchedDir* d, const WCHAR* fileName) {
     // logf(L"NotifyAboutFile(): %s", fileName);
 
@@ -158,7 +216,7 @@ static void NotifyAboutFile(WatchedDir* d, const WCHAR* fileName) {
         // because the time granularity is so big that this can cause genuine
         // file notifications to be ignored. (This happens for instance for
         // PDF files produced by pdftex from small.tex document)
-        wf->onFileChangedCb();
+        MarkChangePending(wf);
     }
 }
 
@@ -250,22 +308,31 @@ static void StartMonitoringDirForChanges(WatchedDir* wd) {
 
 static DWORD GetTimeoutInMs() {
     ScopedCritSec cs(&g_threadCritSec);
+    DWORD timeout = INFINITE;
     for (WatchedFile* wf = g_watchedFiles; wf; wf = wf->next) {
+        if (wf->isChangePending)
+            return FILEWATCH_SETTLE_CHECK_MS;
         if (wf->isManualCheck)
-            return FILEWATCH_DELAY_IN_MS;
+            timeout = FILEWATCH_DELAY_IN_MS;
     }
-    return INFINITE;
+    return timeout;
 }
 
 static void RunManualChecks() {
     ScopedCritSec cs(&g_threadCritSec);
 
+    // the thread wakes up more often while changes are pending
+    ULONGLONG now = GetTickCount64();
+    if (now - g_lastManualCheck < FILEWATCH_DELAY_IN_MS)
+        return;
+    g_lastManualCheck = now;
+
     for (WatchedFile* wf = g_watchedFiles; wf; wf = wf->next) {
         if (!wf->isManualCheck)
             continue;
         if (FileStateChanged(wf->filePath, &wf->fileState)) {
             // logf(L"RunManualCheck() %s changed\n", wf->filePath);
-            wf->onFileChangedCb();
+            MarkChangePending(wf);
         }
     }
 }
@@ -282,12 +349,15 @@ static DWORD WINAPI FileWatcherThread(void* param) {
         DWORD obj = WaitForMultipleObjectsEx(1, handles, FALSE, timeout, alertable);
         if (WAIT_TIMEOUT == obj) {
             RunManualChecks();
+            RunSettleChecks();
             continue;
         }
 
         if (WAIT_IO_COMPLETION == obj) {
-            // APC complete. Nothing to do
+            // APC complete. Nothing to do, except for checking pending
+            // changes which might be delayed by a burst of notifications
             // logf("FileWatcherThread(): APC complete\n");
+            RunSettleChecks();
             continue;
         }
 
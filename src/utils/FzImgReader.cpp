@@ -11,6 +11,12 @@ extern "C" {
 }
 #endif
 
+#if defined(_M_ARM64)
+#include "utils/Sse2Neon.h"
+#else
+#include <emmintrin.h>
+#endif
+
 #include "utils/BaseUtil.h"
 #include "FzImgReader.h"
 
@@ -20,6 +26,55 @@ extern "C" {
 
 namespace fitz {
 
+// CMYK JPEGs are decoded with inverted colors
+static void InvertBytes(unsigned char* data, size_t len) {
+    size_t i = 0;
+    __m128i ones = _mm_set1_epi8((char)0xFF);
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        _mm_storeu_si128((__m128i*)(data + i), _mm_xor_si128(v, ones));
+    }
+    for (; i < len; i++) {
+        data[i] = 255 - data[i];
+    }
+}
+
+static void SwapRedBlue(unsigned char* line, int w) {
+    int x = 0;
+#if defined(_M_ARM64)
+    // vld3q_u8 de-interleaves 16 pixels into one register per channel
+    for (; x + 16 <= w; x += 16, line += 48) {
+        uint8x16x3_t px = vld3q_u8(line);
+        uint8x16_t tmp = px.val[0];
+        px.val[0] = px.val[2];
+        px.val[2] = tmp;
+        vst3q_u8(line, px);
+    }
+#endif
+    for (; x < w; x++, line += 3) {
+        std::swap(line[0], line[2]);
+    }
+}
+
+// expands gray values stored at the end of line in place (as the
+// output never overtakes the input, when going from left to right)
+static void ExpandGray(unsigned char* line, int w) {
+    const unsigned char* src = line + 2 * w;
+    int x = 0;
+#if defined(_M_ARM64)
+    // the 48 bytes written end at most where the 16 bytes just read end
+    for (; x + 16 <= w; x += 16, line += 48) {
+        uint8x16_t gray = vld1q_u8(src + x);
+        uint8x16x3_t px;
+        px.val[0] = px.val[1] = px.val[2] = gray;
+        vst3q_u8(line, px);
+    }
+#endif
+    for (; x < w; x++, line += 3) {
+        line[0] = line[1] = line[2] = src[x];
+    }
+}
+
 static Gdiplus::Bitmap* ImageFromJpegData(fz_context* ctx, const char* data, int len) {
     int w = 0, h = 0, xres = 0, yres = 0;
     fz_colorspace* cs = nullptr;
@@ -65,23 +120,20 @@ static Gdiplus::Bitmap* ImageFromJpegData(fz_context* ctx, const char* data, int
     fz_var(bmpRect);
 
     fz_try(ctx) {
+        // decode a whole row at once and convert it in place
+        size_t rowLen = (size_t)w * cs->n;
         for (int y = 0; y < h; y++) {
             unsigned char* line = (unsigned char*)bmpData.Scan0 + y * bmpData.Stride;
-            for (int x = 0; x < w; x++) {
-                int read = fz_read(ctx, stm, line, cs->n);
-                if (read != cs->n)
-                    fz_throw(ctx, FZ_ERROR_GENERIC, "insufficient data for image");
-                if (3 == cs->n) { // RGB -> BGR
-                    std::swap(line[0], line[2]);
-                    line += 3;
-                } else if (1 == cs->n) { // gray -> BGR
-                    line[1] = line[2] = line[0];
-                    line += 3;
-                } else if (4 == cs->n) { // CMYK color inversion
-                    for (int k = 0; k < 4; k++)
-                        line[k] = 255 - line[k];
-                    line += 4;
-                }
+            unsigned char* dst = 1 == cs->n ? line + 2 * w : line;
+            size_t read = fz_read(ctx, stm, dst, rowLen);
+            if (read != rowLen)
+                fz_throw(ctx, FZ_ERROR_GENERIC, "insufficient data for image");
+            if (3 == cs->n) { // RGB -> BGR
+                SwapRedBlue(line, w);
+            } else if (1 == cs->n) { // gray -> BGR
+                ExpandGray(line, w);
+            } else if (4 == cs->n) { // CMYK color inversion
+                InvertBytes(line, rowLen);
             }
         }
     }
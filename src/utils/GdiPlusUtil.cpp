@@ -321,6 +321,53 @@ static Bitmap* WICDecodeImageFromStream(IStream* stream) {
     return bmp.Clone(0, 0, w, h, PixelFormat32bppARGB);
 }
 
+// WIC's JPEG decoder can scale by 1/2, 1/4 and 1/8 while decoding (in the DCT domain)
+static Bitmap* WICDecodeImageReducedFromStream(IStream* stream, int reduction) {
+    ScopedCom com;
+
+#define HR(hr)      \
+    if (FAILED(hr)) \
+        return nullptr;
+    ScopedComPtr<IWICImagingFactory> pFactory;
+    if (!pFactory.Create(CLSID_WICImagingFactory))
+        return nullptr;
+    ScopedComPtr<IWICBitmapDecoder> pDecoder;
+    HR(pFactory->CreateDecoderFromStream(stream, nullptr, WICDecodeMetadataCacheOnDemand, &pDecoder));
+    ScopedComPtr<IWICBitmapFrameDecode> srcFrame;
+    HR(pDecoder->GetFrame(0, &srcFrame));
+    ScopedComPtr<IWICBitmapSourceTransform> pTransform;
+    HR(srcFrame->QueryInterface(IID_PPV_ARGS(&pTransform)));
+
+    UINT fullDx, fullDy;
+    HR(srcFrame->GetSize(&fullDx, &fullDy));
+    UINT w = std::max((fullDx + reduction - 1) / reduction, 1U);
+    UINT h = std::max((fullDy + reduction - 1) / reduction, 1U);
+    HR(pTransform->GetClosestSize(&w, &h));
+    if (w >= fullDx || h >= fullDy) {
+        // the decoder can't scale
+        return nullptr;
+    }
+    WICPixelFormatGUID format = GUID_WICPixelFormat32bppBGRA;
+    HR(pTransform->GetClosestPixelFormat(&format));
+    if (format != GUID_WICPixelFormat32bppBGRA) {
+        return nullptr;
+    }
+
+    Bitmap bmp(w, h, PixelFormat32bppARGB);
+    Gdiplus::Rect bmpRect(0, 0, w, h);
+    BitmapData bmpData;
+    Status ok = bmp.LockBits(&bmpRect, Gdiplus::ImageLockModeWrite, PixelFormat32bppARGB, &bmpData);
+    if (ok != Ok)
+        return nullptr;
+    HRESULT hr = pTransform->CopyPixels(nullptr, w, h, &format, WICBitmapTransformRotate0, bmpData.Stride,
+                                        bmpData.Stride * h, (BYTE*)bmpData.Scan0);
+    bmp.UnlockBits(&bmpData);
+    HR(hr);
+#undef HR
+
+    return bmp.Clone(0, 0, w, h, PixelFormat32bppARGB);
+}
+
 ImgFormat GfxFormatFromData(const char* data, size_t len) {
     if (!data || len < 12) {
         return ImgFormat::Unknown;
@@ -460,6 +507,22 @@ Bitmap* BitmapFromData(const char* data, size_t len) {
     return bmp;
 }
 
+Bitmap* BitmapFromDataReduced(const char* data, size_t len, int reduction) {
+    ImgFormat format = GfxFormatFromData(data, len);
+    if (ImgFormat::WebP == format) {
+        return webp::ImageFromDataReduced(data, len, reduction);
+    }
+    if (ImgFormat::JPEG != format || JpegUsesArithmeticCoding(data, len)) {
+        return nullptr;
+    }
+    auto strm = CreateStreamFromData({data, len});
+    ScopedComPtr<IStream> stream(strm);
+    if (!stream) {
+        return nullptr;
+    }
+    return WICDecodeImageReducedFromStream(stream, reduction);
+}
+
 // adapted from http://cpansearch.perl.org/src/RJRAY/Image-Size-3.230/lib/Image/Size.pm
 Gdiplus::Size BitmapSizeFromData(const char* data, size_t len) {
     Gdiplus::Size result;
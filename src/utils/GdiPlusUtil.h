@@ -33,6 +33,9 @@ void GetBaseTransform(Gdiplus::Matrix& m, Gdiplus::RectF pageRect, float zoom, i
 const WCHAR* GfxFileExtFromData(const char* data, size_t len);
 bool IsGdiPlusNativeFormat(const char* data, size_t len);
 Gdiplus::Bitmap* BitmapFromData(const char* data, size_t len);
+// decodes an image at roughly 1/<reduction> of its size in each dimension
+// without decoding it at full size first (only supported for JPEG and WebP)
+Gdiplus::Bitmap* BitmapFromDataReduced(const char* data, size_t len, int reduction);
 Gdiplus::Size BitmapSizeFromData(const char* data, size_t len);
 CLSID GetEncoderClsid(const WCHAR* format);
 
@@ -1,6 +1,13 @@
 /* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
    License: Simplified BSD (see COPYING.BSD) */
 
+#include <intrin.h>
+#if defined(_M_ARM64)
+#include "Sse2Neon.h"
+#else
+#include <emmintrin.h>
+#endif
+
 #include "BaseUtil.h"
 #include "HtmlParserLookup.h"
 #include "HtmlPullParser.h"
@@ -29,16 +36,54 @@ int HtmlEntityNameToRune(const WCHAR* name, size_t nameLen) {
     return FindHtmlEntityRune(asciiName, nameLen);
 }
 
-bool SkipUntil(const char*& s, const char* end, char c) {
+// text and tags are scanned 16 bytes at a time with SSE2, so that
+// long runs of text don't have to be looked at byte by byte
+
+// returns a bit mask of the bytes (out of the 16 at s) that are whitespace
+// (the same characters as str::IsWs(), i.e. ' ' and '\t' to '\r')
+static inline u32 WsMaskSSE2(const char* s) {
+    __m128i v = _mm_loadu_si128((const __m128i*)s);
+    __m128i isSpace = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+    __m128i d = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+    __m128i isCtrlWs = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8('\r' - '\t')), d);
+    return (u32)_mm_movemask_epi8(_mm_or_si128(isSpace, isCtrlWs));
+}
+
+// advances s to the first occurence of c (or end) and returns
+// false if c wasn't found
+static bool FindCharSSE2(const char*& s, const char* end, char c) {
+    __m128i vc = _mm_set1_epi8(c);
+    while (end - s >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)s);
+        u32 mask = (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(v, vc));
+        if (mask != 0) {
+            unsigned long bit;
+            _BitScanForward(&bit, mask);
+            s += bit;
+            return true;
+        }
+        s += 16;
+    }
     while ((s < end) && (*s != c)) {
         ++s;
     }
+    return s < end;
+}
+
+bool SkipUntil(const char*& s, const char* end, char c) {
+    FindCharSSE2(s, end, c);
     return *s == c;
 }
 
 bool SkipUntil(const char*& s, const char* end, char* term) {
     size_t len = str::Len(term);
+    if (len == 0) {
+        return s < end;
+    }
     for (; s < end; s++) {
+        if (!FindCharSSE2(s, end, term[0])) {
+            return false;
+        }
         if (s + len <= end && str::StartsWith(s, term))
             return true;
     }
@@ -48,9 +93,25 @@ bool SkipUntil(const char*& s, const char* end, char* term) {
 // return true if skipped
 bool SkipWs(const char*& s, const char* end) {
     const char* start = s;
-    while ((s < end) && str::IsWs(*s)) {
+    // most of the time there's at most a single space to skip
+    if ((s < end) && str::IsWs(*s)) {
         ++s;
     }
+    if ((s < end) && str::IsWs(*s)) {
+        while (end - s >= 16) {
+            u32 mask = ~WsMaskSSE2(s) & 0xffff;
+            if (mask != 0) {
+                unsigned long bit;
+                _BitScanForward(&bit, mask);
+                s += bit;
+                return true;
+            }
+            s += 16;
+        }
+        while ((s < end) && str::IsWs(*s)) {
+            ++s;
+        }
+    }
     return start != s;
 }
 
@@ -322,7 +383,26 @@ AttrInfo* HtmlToken::NextAttr() {
 // are part of attribute value. We're not very strict here
 // Returns false if didn't find
 static bool SkipUntilTagEnd(const char*& s, const char* end) {
+    __m128i gt = _mm_set1_epi8('>');
+    __m128i apos = _mm_set1_epi8('\'');
+    __m128i quot = _mm_set1_epi8('"');
     while (s < end) {
+        // skip to the next character that might end the tag or start a quote
+        while (end - s >= 16) {
+            __m128i v = _mm_loadu_si128((const __m128i*)s);
+            __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, gt), _mm_or_si128(_mm_cmpeq_epi8(v, apos), _mm_cmpeq_epi8(v, quot)));
+            u32 mask = (u32)_mm_movemask_epi8(m);
+            if (mask != 0) {
+                unsigned long bit;
+                _BitScanForward(&bit, mask);
+                s += bit;
+                break;
+            }
+            s += 16;
+        }
+        if (s >= end) {
+            break;
+        }
         char c = *s++;
         if ('>' == c) {
             --s;
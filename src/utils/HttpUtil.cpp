@@ -13,7 +13,51 @@
 #define USER_AGENT L"BaseHTTP"
 
 bool HttpRspOk(const HttpRsp* rsp) {
-    return (rsp->error == ERROR_SUCCESS) && (rsp->httpStatusCode == 200);
+    if (rsp->error != ERROR_SUCCESS) {
+        return false;
+    }
+    // a server might ignore the Range header and send all the data
+    return (rsp->httpStatusCode == 200) || (rsp->rangeStart >= 0 && rsp->httpStatusCode == 206);
+}
+
+static HINTERNET OpenInternetSession() {
+    HINTERNET session = InternetOpen(USER_AGENT, INTERNET_OPEN_TYPE_PRECONFIG, nullptr, nullptr, 0);
+    if (session) {
+        // have wininet send Accept-Encoding and transparently decompress gzip and deflate
+        // responses (if this isn't supported, responses remain uncompressed)
+        BOOL enable = TRUE;
+        InternetSetOption(session, INTERNET_OPTION_HTTP_DECODING, &enable, sizeof(enable));
+    }
+    return session;
+}
+
+// wininet keeps connections alive per session handle, so sharing a single
+// session for all requests allows re-using a connection (and skipping the
+// tls handshake) for follow-up requests to the same server.
+// HttpPost() doesn't use it as it's called from the crash handler
+static HINTERNET GetInternetSession() {
+    // initialization of a static local is thread-safe. the session is
+    // never closed, it's needed until the process exits
+    static HINTERNET session = OpenInternetSession();
+    return session;
+}
+
+static char* QueryHeader(HINTERNET hReq, DWORD infoLevel) {
+    char buf[256] = {0};
+    DWORD size = sizeof(buf) - 1;
+    if (!HttpQueryInfoA(hReq, infoLevel, buf, &size, nullptr)) {
+        return nullptr;
+    }
+    return str::Dup(buf);
+}
+
+// parses the total size out of e.g. "bytes 0-1023/146515"
+static i64 ParseContentRangeTotal(const char* s) {
+    const char* total = s ? str::FindChar(s, '/') : nullptr;
+    if (!total || !str::IsDigit(total[1])) {
+        return -1;
+    }
+    return _atoi64(total + 1);
 }
 
 // returns false if failed to download or status code is not 200
@@ -27,14 +71,30 @@ bool HttpGet(const WCHAR* url, HttpRsp* rspOut) {
     rspOut->data.allowFailure = true;
 
     rspOut->error = ERROR_SUCCESS;
-    HINTERNET hInet = InternetOpen(USER_AGENT, INTERNET_OPEN_TYPE_PRECONFIG, nullptr, nullptr, 0);
+    HINTERNET hInet = GetInternetSession();
     if (!hInet) {
         logf("HttpGet: InternetOpen failed\n");
         LogLastError();
         goto Error;
     }
 
-    hReq = InternetOpenUrl(hInet, url, nullptr, 0, flags, 0);
+    str::WStr headers;
+    if (rspOut->etag) {
+        AutoFreeWstr etag = strconv::Utf8ToWstr(rspOut->etag.Get());
+        headers.AppendFmt(L"If-None-Match: %s\r\n", etag.Get());
+    }
+    if (rspOut->lastModified) {
+        AutoFreeWstr lastModified = strconv::Utf8ToWstr(rspOut->lastModified.Get());
+        headers.AppendFmt(L"If-Modified-Since: %s\r\n", lastModified.Get());
+    }
+    if (rspOut->rangeStart >= 0) {
+        if (rspOut->rangeEnd >= rspOut->rangeStart) {
+            headers.AppendFmt(L"Range: bytes=%I64d-%I64d\r\n", rspOut->rangeStart, rspOut->rangeEnd);
+        } else {
+            headers.AppendFmt(L"Range: bytes=%I64d-\r\n", rspOut->rangeStart);
+        }
+    }
+    hReq = InternetOpenUrl(hInet, url, headers.Get(), (DWORD)headers.size(), flags, 0);
     if (!hReq) {
         logf("HttpGet: InternetOpenUrl failed\n");
         LogLastError();
@@ -47,9 +107,19 @@ bool HttpGet(const WCHAR* url, HttpRsp* rspOut) {
         LogLastError();
         goto Error;
     }
+    if (rspOut->httpStatusCode == 304) {
+        // not modified, so there's no data (and the validators remain the same)
+        goto Exit;
+    }
+    rspOut->etag.Set(QueryHeader(hReq, HTTP_QUERY_ETAG));
+    rspOut->lastModified.Set(QueryHeader(hReq, HTTP_QUERY_LAST_MODIFIED));
+    if (rspOut->httpStatusCode == 206) {
+        AutoFree contentRange(QueryHeader(hReq, HTTP_QUERY_CONTENT_RANGE));
+        rspOut->totalSize = ParseContentRangeTotal(contentRange);
+    }
 
     for (;;) {
-        char buf[1024];
+        char buf[16 * 1024];
         DWORD dwRead = 0;
         if (!InternetReadFile(hReq, buf, sizeof(buf), &dwRead)) {
             logf("HttpGet: InternetReadFile failed\n");
@@ -70,9 +140,6 @@ Exit:
     if (hReq) {
         InternetCloseHandle(hReq);
     }
-    if (hInet) {
-        InternetCloseHandle(hInet);
-    }
     return HttpRspOk(rspOut);
 
 Error:
@@ -91,7 +158,7 @@ bool HttpGetToFile(const WCHAR* url, const WCHAR* destFilePath) {
     DWORD dwRead = 0;
     DWORD headerBuffSize = sizeof(DWORD);
     DWORD statusCode = 0;
-    char buf[1024];
+    char buf[16 * 1024];
 
     HANDLE hf = CreateFileW(destFilePath, GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL,
                             nullptr);
@@ -101,7 +168,7 @@ bool HttpGetToFile(const WCHAR* url, const WCHAR* destFilePath) {
         goto Exit;
     }
 
-    hInet = InternetOpen(USER_AGENT, INTERNET_OPEN_TYPE_PRECONFIG, nullptr, nullptr, 0);
+    hInet = GetInternetSession();
     if (!hInet) {
         goto Exit;
     }
@@ -143,9 +210,6 @@ Exit:
     if (hReq) {
         InternetCloseHandle(hReq);
     }
-    if (hInet) {
-        InternetCloseHandle(hInet);
-    }
     if (!ok) {
         file::Delete(destFilePath);
     }
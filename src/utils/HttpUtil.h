@@ -7,6 +7,17 @@ class HttpRsp {
     str::Str data;
     DWORD error = (DWORD)-1;
     DWORD httpStatusCode = (DWORD)-1;
+    // for conditional requests: if set, they're sent as If-None-Match and
+    // If-Modified-Since (if the data hasn't changed, httpStatusCode is 304).
+    // they're replaced with the ETag and Last-Modified headers of the response
+    AutoFree etag;
+    AutoFree lastModified;
+    // for Range requests: if rangeStart is >= 0, only the bytes from rangeStart to
+    // rangeEnd (inclusive, -1 for the rest of the data) are requested. servers
+    // supporting this respond with httpStatusCode 206 and set totalSize
+    i64 rangeStart = -1;
+    i64 rangeEnd = -1;
+    i64 totalSize = -1;
 
     HttpRsp() {
     }
@@ -14,16 +14,48 @@ str::Str* gLogBuf = nullptr;
 bool logToStderr = false;
 bool logToDebugger = false;
 
-static char* logFilePath;
+// the log file is written by a background thread, so that logging
+// doesn't make the render, search and UI threads wait for the disk
+static FILE* gLogFile = nullptr;
+// lines that haven't been written to gLogFile yet (protected by gLogMutex)
+static str::Str* gLogPending = nullptr;
+// the lines currently being written (only used by WritePendingLog)
+static str::Str* gLogWriting = nullptr;
+// serializes WritePendingLog (always taken before gLogMutex)
+static Mutex gLogFileMutex;
+static HANDLE gLogWriteEvent = nullptr;
 
 // 1 MB - 128 to stay under 1 MB even after appending (an estimate)
 constexpr int kMaxLogBuf = 1024 * 1024 - 128;
 
 static bool shouldLog() {
+    // not taking gLogMutex for this: a stale size at worst
+    // means that a line more or less gets logged
+    str::Str* buf = gLogBuf;
+    return !buf || buf->isize() <= kMaxLogBuf;
+}
+
+static void WritePendingLog() {
+    gLogFileMutex.Lock();
     gLogMutex.Lock();
-    bool bufFull = gLogBuf && gLogBuf->isize() > kMaxLogBuf;
+    std::swap(gLogPending, gLogWriting);
     gLogMutex.Unlock();
-    return !bufFull;
+
+    if (gLogWriting->size() > 0) {
+        fwrite(gLogWriting->Get(), 1, gLogWriting->size(), gLogFile);
+        fflush(gLogFile);
+        gLogWriting->Reset();
+    }
+    gLogFileMutex.Unlock();
+}
+
+// writes all the lines logged since it last woke up at once
+static DWORD WINAPI LogFileWriterThread(void*) {
+    for (;;) {
+        WaitForSingleObject(gLogWriteEvent, INFINITE);
+        WritePendingLog();
+    }
+    return 0;
 }
 
 void log(std::string_view s) {
@@ -44,18 +76,20 @@ void log(std::string_view s) {
         fflush(stderr);
     }
 
-    if (logFilePath) {
-        auto f = fopen(logFilePath, "a");
-        if (f != nullptr) {
-            fwrite(s.data(), 1, s.size(), f);
-            fflush(f);
-            fclose(f);
-        }
+    // the writer only has to be woken up for the first pending line
+    bool wakeWriter = false;
+    if (gLogPending) {
+        wakeWriter = gLogPending->size() == 0;
+        gLogPending->Append(s.data(), s.size());
     }
     if (logToDebugger) {
         OutputDebugStringA(s.data());
     }
     gLogMutex.Unlock();
+
+    if (wakeWriter) {
+        SetEvent(gLogWriteEvent);
+    }
 }
 
 void log(const char* s) {
@@ -67,16 +101,42 @@ void logf(const char* fmt, ...) {
     if (!shouldLog()) {
         return;
     }
+    // most lines fit into buf and we don't have to allocate
+    char buf[512];
     va_list args;
     va_start(args, fmt);
-    AutoFree s = str::FmtV(fmt, args);
-    log(s.as_view());
+    char* s = str::FmtV(buf, dimof(buf), fmt, args);
     va_end(args);
+    if (s) {
+        log(s);
+    }
+    if (s != buf) {
+        free(s);
+    }
 }
 
 void StartLogToFile(const char* path) {
-    logFilePath = str::Dup(path);
+    if (gLogFile) {
+        return;
+    }
     remove(path);
+    gLogFile = fopen(path, "a");
+    if (!gLogFile) {
+        return;
+    }
+    gLogWriting = new str::Str(32 * 1024);
+    gLogWriting->allowFailure = true;
+    str::Str* pending = new str::Str(32 * 1024);
+    pending->allowFailure = true;
+    gLogWriteEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+    HANDLE hThread = CreateThread(nullptr, 0, LogFileWriterThread, nullptr, 0, nullptr);
+    CloseHandle(hThread);
+
+    gLogMutex.Lock();
+    gLogPending = pending;
+    gLogMutex.Unlock();
+    // the lines logged right before exiting would get lost otherwise
+    atexit(WritePendingLog);
 }
 
 #if OS_WIN
@@ -87,19 +147,22 @@ void log(const WCHAR* s) {
     if (!shouldLog()) {
         return;
     }
-    AutoFree tmp = strconv::WstrToUtf8(s);
-    auto sv = tmp.as_view();
-    log(sv);
+    strconv::StackWstrToUtf8 tmp(s);
+    log(tmp.Get());
 }
 
 void logf(const WCHAR* fmt, ...) {
     if (!shouldLog()) {
         return;
     }
+    WCHAR buf[256];
     va_list args;
     va_start(args, fmt);
-    AutoFreeWstr s = str::FmtV(fmt, args);
-    log(s);
+    WCHAR* s = str::FmtV(buf, dimof(buf), fmt, args);
     va_end(args);
+    log(s);
+    if (s != buf) {
+        free(s);
+    }
 }
 #endif
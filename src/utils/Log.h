@@ -5,6 +5,7 @@ extern HeapAllocator* gLogAllocator;
 extern str::Str* gLogBuf;
 extern bool logToStderr;
 extern bool logToDebugger;
+// the file is written to in batches by a background thread
 void StartLogToFile(const char* path);
 
 void log(std::string_view s);
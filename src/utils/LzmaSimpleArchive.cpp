@@ -40,22 +40,26 @@ struct ISzAllocatorAlloc : ISzAlloc {
 };
 
 /* code adapted from https://gnunet.org/svn/gnunet/src/util/crypto_crc.c (public domain) */
-static bool crc_table_ready = false;
 static uint32_t crc_table[256];
 
-uint32_t lzma_crc32(uint32_t crc32, const unsigned char* data, size_t data_len) {
-    if (!crc_table_ready) {
-        uint32_t i, j;
-        uint32_t h = 1;
-        crc_table[0] = 0;
-        for (i = 128; i; i >>= 1) {
-            h = (h >> 1) ^ ((h & 1) ? 0xEDB88320 : 0);
-            for (j = 0; j < 256; j += 2 * i) {
-                crc_table[i + j] = crc_table[j] ^ h;
-            }
+static bool InitCrcTable() {
+    uint32_t i, j;
+    uint32_t h = 1;
+    crc_table[0] = 0;
+    for (i = 128; i; i >>= 1) {
+        h = (h >> 1) ^ ((h & 1) ? 0xEDB88320 : 0);
+        for (j = 0; j < 256; j += 2 * i) {
+            crc_table[i + j] = crc_table[j] ^ h;
         }
-        crc_table_ready = true;
     }
+    return true;
+}
+
+uint32_t lzma_crc32(uint32_t crc32, const unsigned char* data, size_t data_len) {
+    // initialization of a static local is thread-safe,
+    // files might be extracted from several threads
+    static bool crc_table_ready = InitCrcTable();
+    (void)crc_table_ready;
 
     crc32 = crc32 ^ 0xFFFFFFFF;
     while (data_len-- > 0) {
@@ -257,6 +261,53 @@ char* GetFileDataByName(SimpleArchive* archive, const char* fileName, Allocator*
     return nullptr;
 }
 
+bool ExtractFileToPath(SimpleArchive* archive, int idx, const WCHAR* filePath, bool* corruptedOut) {
+    if (corruptedOut) {
+        *corruptedOut = false;
+    }
+    if (idx < 0 || idx >= archive->filesCount) {
+        return false;
+    }
+    FileInfo* fi = &archive->files[idx];
+
+    HANDLE h = CreateFileW(filePath, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL,
+                           nullptr);
+    if (h == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    if (fi->uncompressedSize == 0) {
+        CloseHandle(h);
+        bool ok = fi->uncompressedCrc32 == lzma_crc32(0, nullptr, 0);
+        if (corruptedOut) {
+            *corruptedOut = !ok;
+        }
+        return ok;
+    }
+
+    // decompress straight into the file's pages: there's no need for a heap buffer
+    // of the file's size and the system writes out the pages in the background
+    // while the rest of the file is being decoded
+    bool ok = false;
+    HANDLE hMap = CreateFileMappingW(h, nullptr, PAGE_READWRITE, 0, fi->uncompressedSize, nullptr);
+    if (hMap) {
+        char* view = (char*)MapViewOfFile(hMap, FILE_MAP_WRITE, 0, 0, 0);
+        if (view) {
+            ok = Decompress(fi->compressedData, fi->compressedSize, view, fi->uncompressedSize, nullptr);
+            ok = ok && lzma_crc32(0, (const uint8_t*)view, fi->uncompressedSize) == fi->uncompressedCrc32;
+            if (corruptedOut) {
+                *corruptedOut = !ok;
+            }
+            UnmapViewOfFile(view);
+        }
+        CloseHandle(hMap);
+    }
+    CloseHandle(h);
+    if (!ok) {
+        file::Delete(filePath);
+    }
+    return ok;
+}
+
 static bool ExtractFileByIdx(SimpleArchive* archive, int idx, const char* dstDir, Allocator* allocator) {
     FileInfo* fi = &archive->files[idx];
 
@@ -25,6 +25,10 @@ bool ParseSimpleArchive(const char* archiveHeader, size_t dataLen, SimpleArchive
 int GetIdxFromName(SimpleArchive* archive, const char* name);
 char* GetFileDataByIdx(SimpleArchive* archive, int idx, Allocator* allocator);
 char* GetFileDataByName(SimpleArchive* archive, const char* fileName, Allocator* allocator);
+// decompresses a file directly to disk (without buffering it in memory) and checks its crc32
+// the file is deleted on failure. safe to call for different files from several threads
+// corruptedOut (can be nullptr) tells apart bad data from a failure to write the file
+bool ExtractFileToPath(SimpleArchive* archive, int idx, const WCHAR* filePath, bool* corruptedOut = nullptr);
 // files is an array of char * entries, last element must be nullptr
 bool ExtractFiles(const char* archivePath, const char* dstDir, const char** files, Allocator* allocator);
 
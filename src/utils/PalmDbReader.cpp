@@ -46,6 +46,11 @@ static bool DecodePdbHeader(ByteOrderDecoder& dec, PdbHeader* hdr) {
     return dec.IsOk();
 }
 
+bool PdbReader::ParseHeaderOnly(std::string_view d, PdbHeader* hdrOut) {
+    ByteOrderDecoder dec(d.data(), d.size(), ByteOrderDecoder::BigEndian);
+    return DecodePdbHeader(dec, hdrOut) && hdrOut->numRecords != 0;
+}
+
 bool PdbReader::ParseHeader() {
     CrashIf(recInfos.size() > 0);
 
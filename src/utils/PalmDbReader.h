@@ -50,6 +50,9 @@ class PdbReader {
     size_t GetRecordCount();
     std::string_view GetRecord(size_t recNo);
 
+    // only decodes the header at the start of a file (e.g. for sniffing)
+    static bool ParseHeaderOnly(std::string_view, PdbHeader* hdrOut);
+
     static PdbReader* CreateFromData(std::string_view);
     static PdbReader* CreateFromFile(const char* filePath);
 
@@ -39,6 +39,13 @@ class AutoCloseHandle {
     bool IsValid() const {
         return handle != NULL && handle != INVALID_HANDLE_VALUE;
     }
+
+    // the caller becomes responsible for closing the handle
+    HANDLE Detach() {
+        HANDLE h = handle;
+        handle = nullptr;
+        return h;
+    }
 };
 
 template <class T>
@@ -560,3 +560,280 @@ void FreeStruct(const StructInfo* info, void* strct) {
         FreeStructData(info, (uint8_t*)strct);
     free(strct);
 }
+
+// binary snapshots: a header (magic, hash of the StructInfo layout and
+// hash of the payload) followed by the values of all fields in the order
+// of the fields. Strings and arrays are prefixed with their length
+// (NO_STR for nullptr strings), numbers are stored in native byte order.
+
+#define BIN_MAGIC 0x31425053 // "SPB1"
+#define NO_STR 0xFFFFFFFF
+
+struct BinHeader {
+    u32 magic;
+    u32 layoutHash;
+    u32 dataHash;
+    u32 dataSize;
+};
+
+static void HashStructInfo(str::Str& out, const StructInfo* info) {
+    out.AppendFmt("%d:%d{", (int)info->structSize, (int)info->fieldCount);
+    const char* fieldName = info->fieldNames;
+    for (size_t i = 0; i < info->fieldCount; i++, fieldName += str::Len(fieldName) + 1) {
+        const FieldInfo& field = info->fields[i];
+        out.AppendFmt("%s:%d:%d;", fieldName, (int)field.type, (int)field.offset);
+        if (Type_Struct == field.type || Type_Prerelease == field.type || Type_Array == field.type ||
+            Type_Compact == field.type) {
+            HashStructInfo(out, GetSubstruct(field));
+        }
+    }
+    out.AppendChar('}');
+}
+
+static u32 GetLayoutHash(const StructInfo* info) {
+    str::Str s;
+    HashStructInfo(s, info);
+    return MurmurHash2(s.Get(), s.size());
+}
+
+static void AppendU32(str::Str& out, u32 v) {
+    out.Append((const char*)&v, sizeof(v));
+}
+
+static void AppendBinStr(str::Str& out, const void* s, size_t len, size_t charSize) {
+    if (!s) {
+        AppendU32(out, NO_STR);
+        return;
+    }
+    AppendU32(out, (u32)len);
+    out.Append((const char*)s, len * charSize);
+}
+
+static void SerializeStructBinRec(str::Str& out, const StructInfo* info, const uint8_t* base) {
+    for (size_t i = 0; i < info->fieldCount; i++) {
+        const FieldInfo& field = info->fields[i];
+        const uint8_t* fieldPtr = base + field.offset;
+        switch (field.type) {
+            case Type_Struct:
+            case Type_Prerelease:
+            case Type_Compact:
+                SerializeStructBinRec(out, GetSubstruct(field), fieldPtr);
+                break;
+            case Type_Array: {
+                Vec<void*>* array = *(Vec<void*>**)fieldPtr;
+                u32 n = array ? (u32)array->size() : 0;
+                AppendU32(out, n);
+                for (u32 j = 0; j < n; j++) {
+                    SerializeStructBinRec(out, GetSubstruct(field), (const uint8_t*)array->at(j));
+                }
+                break;
+            }
+            case Type_Bool:
+                out.AppendChar(*(bool*)fieldPtr ? 1 : 0);
+                break;
+            case Type_Color:
+            case Type_Float:
+            case Type_Int:
+                out.Append((const char*)fieldPtr, 4);
+                break;
+            case Type_String: {
+                const WCHAR* s = *(const WCHAR**)fieldPtr;
+                AppendBinStr(out, s, str::Len(s), sizeof(WCHAR));
+                break;
+            }
+            case Type_Utf8String: {
+                const char* s = *(const char**)fieldPtr;
+                AppendBinStr(out, s, str::Len(s), sizeof(char));
+                break;
+            }
+            case Type_ColorArray:
+            case Type_FloatArray:
+            case Type_IntArray: {
+                Vec<int>* v = *(Vec<int>**)fieldPtr;
+                u32 n = v ? (u32)v->size() : 0;
+                AppendU32(out, n);
+                if (n > 0) {
+                    out.Append((const char*)v->LendData(), n * sizeof(int));
+                }
+                break;
+            }
+            case Type_StringArray: {
+                Vec<WCHAR*>* v = *(Vec<WCHAR*>**)fieldPtr;
+                u32 n = v ? (u32)v->size() : 0;
+                AppendU32(out, n);
+                for (u32 j = 0; j < n; j++) {
+                    AppendBinStr(out, v->at(j), str::Len(v->at(j)), sizeof(WCHAR));
+                }
+                break;
+            }
+            case Type_Comment:
+                break;
+            default:
+                CrashIf(true);
+        }
+    }
+}
+
+char* SerializeStructBin(const StructInfo* info, const void* strct, size_t* sizeOut) {
+    str::Str out;
+    out.AppendBlanks(sizeof(BinHeader));
+    SerializeStructBinRec(out, info, (const uint8_t*)strct);
+    BinHeader* hdr = (BinHeader*)out.Get();
+    hdr->magic = BIN_MAGIC;
+    hdr->layoutHash = GetLayoutHash(info);
+    hdr->dataSize = (u32)(out.size() - sizeof(BinHeader));
+    hdr->dataHash = MurmurHash2(out.Get() + sizeof(BinHeader), hdr->dataSize);
+    if (sizeOut) {
+        *sizeOut = out.size();
+    }
+    return out.StealData();
+}
+
+struct BinReader {
+    const char* curr;
+    const char* end;
+
+    bool Read(void* dst, size_t n) {
+        if ((size_t)(end - curr) < n) {
+            return false;
+        }
+        memcpy(dst, curr, n);
+        curr += n;
+        return true;
+    }
+    bool ReadU32(u32* v) {
+        return Read(v, sizeof(*v));
+    }
+    bool ReadCount(u32* n, size_t minSizePerItem) {
+        return ReadU32(n) && *n <= (size_t)(end - curr) / minSizePerItem;
+    }
+};
+
+static bool ReadBinWstr(BinReader& r, WCHAR** dst) {
+    u32 len;
+    if (!r.ReadU32(&len)) {
+        return false;
+    }
+    if (NO_STR == len) {
+        return true;
+    }
+    if (len > (size_t)(r.end - r.curr) / sizeof(WCHAR)) {
+        return false;
+    }
+    *dst = AllocArray<WCHAR>((size_t)len + 1);
+    return r.Read(*dst, len * sizeof(WCHAR));
+}
+
+static bool ReadBinStr(BinReader& r, char** dst) {
+    u32 len;
+    if (!r.ReadU32(&len)) {
+        return false;
+    }
+    if (NO_STR == len) {
+        return true;
+    }
+    if (len > (size_t)(r.end - r.curr)) {
+        return false;
+    }
+    *dst = AllocArray<char>((size_t)len + 1);
+    return r.Read(*dst, len);
+}
+
+// on failure, all fields read so far are still valid so that the struct can be freed
+static bool DeserializeStructBinRec(BinReader& r, const StructInfo* info, uint8_t* base) {
+    for (size_t i = 0; i < info->fieldCount; i++) {
+        const FieldInfo& field = info->fields[i];
+        uint8_t* fieldPtr = base + field.offset;
+        bool ok = true;
+        switch (field.type) {
+            case Type_Struct:
+            case Type_Prerelease:
+            case Type_Compact:
+                ok = DeserializeStructBinRec(r, GetSubstruct(field), fieldPtr);
+                break;
+            case Type_Array: {
+                Vec<void*>* array = new Vec<void*>();
+                *(Vec<void*>**)fieldPtr = array;
+                u32 n;
+                ok = r.ReadCount(&n, 1);
+                for (u32 j = 0; ok && j < n; j++) {
+                    uint8_t* item = AllocArray<uint8_t>(GetSubstruct(field)->structSize);
+                    array->Append(item);
+                    ok = DeserializeStructBinRec(r, GetSubstruct(field), item);
+                }
+                break;
+            }
+            case Type_Bool: {
+                u8 b;
+                ok = r.Read(&b, 1);
+                *(bool*)fieldPtr = b != 0;
+                break;
+            }
+            case Type_Color:
+            case Type_Float:
+            case Type_Int:
+                ok = r.Read(fieldPtr, 4);
+                break;
+            case Type_String:
+                ok = ReadBinWstr(r, (WCHAR**)fieldPtr);
+                break;
+            case Type_Utf8String:
+                ok = ReadBinStr(r, (char**)fieldPtr);
+                break;
+            case Type_ColorArray:
+            case Type_FloatArray:
+            case Type_IntArray: {
+                Vec<int>* v = new Vec<int>();
+                *(Vec<int>**)fieldPtr = v;
+                u32 n;
+                ok = r.ReadCount(&n, sizeof(int));
+                if (ok && n > 0) {
+                    ok = r.Read(v->AppendBlanks(n), n * sizeof(int));
+                }
+                break;
+            }
+            case Type_StringArray: {
+                Vec<WCHAR*>* v = new Vec<WCHAR*>();
+                *(Vec<WCHAR*>**)fieldPtr = v;
+                u32 n;
+                ok = r.ReadCount(&n, sizeof(u32));
+                for (u32 j = 0; ok && j < n; j++) {
+                    WCHAR* s = nullptr;
+                    ok = ReadBinWstr(r, &s);
+                    v->Append(s);
+                }
+                break;
+            }
+            case Type_Comment:
+                break;
+            default:
+                CrashIf(true);
+                ok = false;
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void* DeserializeStructBin(const StructInfo* info, std::string_view data) {
+    BinHeader hdr;
+    if (data.size() < sizeof(hdr)) {
+        return nullptr;
+    }
+    memcpy(&hdr, data.data(), sizeof(hdr));
+    const char* payload = data.data() + sizeof(hdr);
+    if (hdr.magic != BIN_MAGIC || hdr.dataSize != data.size() - sizeof(hdr) ||
+        hdr.layoutHash != GetLayoutHash(info) || hdr.dataHash != MurmurHash2(payload, hdr.dataSize)) {
+        return nullptr;
+    }
+
+    BinReader r{payload, payload + hdr.dataSize};
+    uint8_t* base = AllocArray<uint8_t>(info->structSize);
+    if (!DeserializeStructBinRec(r, info, base) || r.curr != r.end) {
+        FreeStruct(info, base);
+        return nullptr;
+    }
+    return base;
+}
@@ -64,3 +64,9 @@ char* SerializeStruct(const StructInfo* info, const void* strct, const char* pre
                       size_t* sizeOut = nullptr);
 void* DeserializeStruct(const StructInfo* info, const char* data, void* strct = nullptr);
 void FreeStruct(const StructInfo* info, void* strct);
+
+// a binary snapshot of all fields is much faster to load than the text format
+// (but doesn't preserve unknown settings). DeserializeStructBin returns nullptr
+// if data is corrupted or was serialized with a different StructInfo layout
+char* SerializeStructBin(const StructInfo* info, const void* strct, size_t* sizeOut = nullptr);
+void* DeserializeStructBin(const StructInfo* info, std::string_view data);
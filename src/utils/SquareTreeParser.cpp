@@ -1,6 +1,13 @@
 /* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
    License: Simplified BSD (see COPYING.BSD) */
 
+#include <intrin.h>
+#if defined(_M_ARM64)
+#include "Sse2Neon.h"
+#else
+#include <emmintrin.h>
+#endif
+
 #include "BaseUtil.h"
 #include "SquareTreeParser.h"
 
@@ -63,6 +70,52 @@ static inline char* SkipWsRev(char* begin, char* s) {
     return s;
 }
 
+// lines are scanned 16 bytes at a time with SSE2, as settings files
+// mostly consist of long values (such as file paths)
+
+// returns the first '\n' at or after s (or end)
+static char* FindLineEnd(char* s, char* end) {
+    __m128i nl = _mm_set1_epi8('\n');
+    while (end - s >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)s);
+        u32 mask = (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        if (mask != 0) {
+            unsigned long bit;
+            _BitScanForward(&bit, mask);
+            return s + bit;
+        }
+        s += 16;
+    }
+    for (; s < end && *s != '\n'; s++)
+        ;
+    return s;
+}
+
+// returns the first key/value separator, square bracket or '\n' at or after s (or end)
+static char* FindKeyEnd(char* s, char* end) {
+    __m128i eq = _mm_set1_epi8('=');
+    __m128i colon = _mm_set1_epi8(':');
+    __m128i open = _mm_set1_epi8('[');
+    __m128i close = _mm_set1_epi8(']');
+    __m128i nl = _mm_set1_epi8('\n');
+    while (end - s >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)s);
+        __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, eq), _mm_cmpeq_epi8(v, colon));
+        m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi8(v, open), _mm_cmpeq_epi8(v, close)));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, nl));
+        u32 mask = (u32)_mm_movemask_epi8(m);
+        if (mask != 0) {
+            unsigned long bit;
+            _BitScanForward(&bit, mask);
+            return s + bit;
+        }
+        s += 16;
+    }
+    for (; s < end && *s != '=' && *s != ':' && *s != '[' && *s != ']' && *s != '\n'; s++)
+        ;
+    return s;
+}
+
 static char* SkipWsAndComments(char* s) {
     do {
         s = SkipWs(s);
@@ -118,7 +171,9 @@ SquareTreeNode* SquareTreeNode::GetChild(const char* key, size_t* startIdx) cons
     return nullptr;
 }
 
-static SquareTreeNode* ParseSquareTreeRec(char*& data, bool isTopLevel = false) {
+// end is the position of the terminating '\0' (the data in front of
+// the current position is modified, so this only holds for what follows)
+static SquareTreeNode* ParseSquareTreeRec(char*& data, char* end, bool isTopLevel = false) {
     SquareTreeNode* node = new SquareTreeNode();
 
     while (*(data = SkipWsAndComments(data))) {
@@ -126,8 +181,7 @@ static SquareTreeNode* ParseSquareTreeRec(char*& data, bool isTopLevel = false)
         // where the value is either a string (separated by '=' or ':')
         // or a list of child nodes (if the key is followed by '[' alone)
         char* key = data;
-        for (data = key; *data && *data != '=' && *data != ':' && *data != '[' && *data != ']' && *data != '\n'; data++)
-            ;
+        data = FindKeyEnd(key, end);
         if (!*data || '\n' == *data) {
             // use first whitespace as a fallback separator
             for (data = key; *data && !str::IsWs(*data); data++)
@@ -140,8 +194,7 @@ static SquareTreeNode* ParseSquareTreeRec(char*& data, bool isTopLevel = false)
         }
         char* value = data;
         // skip to the end of the line
-        for (; *data && *data != '\n'; data++)
-            ;
+        data = FindLineEnd(data, end);
         if (IsBracketLine(separator) ||
             // also tolerate "key \n [ \n ... \n ]" (else the key
             // gets an empty value and the child node an empty key)
@@ -149,12 +202,12 @@ static SquareTreeNode* ParseSquareTreeRec(char*& data, bool isTopLevel = false)
             // parse child node(s)
             data = SkipWsAndComments(separator) + 1;
             *SkipWsRev(key, separator) = '\0';
-            node->data.Append(SquareTreeNode::DataItem(key, ParseSquareTreeRec(data)));
+            node->data.Append(SquareTreeNode::DataItem(key, ParseSquareTreeRec(data, end)));
             // arrays are created by either reusing the same key for a different child
             // or by concatenating multiple children ("[ \n ] [ \n ] [ \n ]")
             while (IsBracketLine((data = SkipWsAndComments(data)))) {
                 data++;
-                node->data.Append(SquareTreeNode::DataItem(key, ParseSquareTreeRec(data)));
+                node->data.Append(SquareTreeNode::DataItem(key, ParseSquareTreeRec(data, end)));
             }
         } else if (']' == *key) {
             // finish parsing child node
@@ -173,7 +226,7 @@ static SquareTreeNode* ParseSquareTreeRec(char*& data, bool isTopLevel = false)
             // trim whitespace around section name (for consistency with GetPrivateProfileString)
             key = SkipWs(key + 1);
             *SkipWsRev(key, SkipWsRev(value, data) - 1) = '\0';
-            node->data.Append(SquareTreeNode::DataItem(key, ParseSquareTreeRec(data)));
+            node->data.Append(SquareTreeNode::DataItem(key, ParseSquareTreeRec(data, end)));
         } else if ('[' == *separator || ']' == *separator) {
             // invalid line (ignored)
         } else {
@@ -208,6 +261,6 @@ SquareTree::SquareTree(const char* data) : root(nullptr) {
     }
 
     char* start = dataUtf8.Get();
-    root = ParseSquareTreeRec(start, true);
+    root = ParseSquareTreeRec(start, start + str::Len(start), true);
     CrashIf(*start || !root);
 }
@@ -0,0 +1,81 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+// The SSE2 intrinsics used by the text scanning loops (HtmlPullParser,
+// SquareTreeParser, StrconvUtil, TextSearch), implemented with NEON so that
+// these loops compile unchanged for ARM64 (cf. the sse2neon project).
+// Include instead of <emmintrin.h> only when building for _M_ARM64.
+
+#include <arm64_neon.h>
+
+typedef uint8x16_t __m128i;
+
+static inline __m128i _mm_loadu_si128(const __m128i* p) {
+    return vld1q_u8((const uint8_t*)p);
+}
+
+static inline void _mm_storeu_si128(__m128i* p, __m128i a) {
+    vst1q_u8((uint8_t*)p, a);
+}
+
+static inline __m128i _mm_setzero_si128() {
+    return vdupq_n_u8(0);
+}
+
+static inline __m128i _mm_set1_epi8(char c) {
+    return vdupq_n_u8((uint8_t)c);
+}
+
+static inline __m128i _mm_set1_epi16(short c) {
+    return vreinterpretq_u8_u16(vdupq_n_u16((uint16_t)c));
+}
+
+static inline __m128i _mm_and_si128(__m128i a, __m128i b) {
+    return vandq_u8(a, b);
+}
+
+static inline __m128i _mm_or_si128(__m128i a, __m128i b) {
+    return vorrq_u8(a, b);
+}
+
+static inline __m128i _mm_xor_si128(__m128i a, __m128i b) {
+    return veorq_u8(a, b);
+}
+
+static inline __m128i _mm_sub_epi8(__m128i a, __m128i b) {
+    return vsubq_u8(a, b);
+}
+
+static inline __m128i _mm_min_epu8(__m128i a, __m128i b) {
+    return vminq_u8(a, b);
+}
+
+static inline __m128i _mm_cmpeq_epi8(__m128i a, __m128i b) {
+    return vceqq_u8(a, b);
+}
+
+static inline __m128i _mm_cmpeq_epi16(__m128i a, __m128i b) {
+    return vreinterpretq_u8_u16(vceqq_u16(vreinterpretq_u16_u8(a), vreinterpretq_u16_u8(b)));
+}
+
+// interleaves the lower (upper) 8 bytes of a and b
+static inline __m128i _mm_unpacklo_epi8(__m128i a, __m128i b) {
+    return vzip1q_u8(a, b);
+}
+
+static inline __m128i _mm_unpackhi_epi8(__m128i a, __m128i b) {
+    return vzip2q_u8(a, b);
+}
+
+// narrows signed 16-bit values to unsigned bytes with saturation
+static inline __m128i _mm_packus_epi16(__m128i a, __m128i b) {
+    return vcombine_u8(vqmovun_s16(vreinterpretq_s16_u8(a)), vqmovun_s16(vreinterpretq_s16_u8(b)));
+}
+
+// NEON has no equivalent, so the top bit of every byte is shifted
+// into its position and the bits of each half are added up
+static inline int _mm_movemask_epi8(__m128i a) {
+    static const int8_t shifts[16] = {0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7};
+    uint8x16_t bits = vshlq_u8(vshrq_n_u8(a, 7), vld1q_s8(shifts));
+    return (int)vaddv_u8(vget_low_u8(bits)) | ((int)vaddv_u8(vget_high_u8(bits)) << 8);
+}
@@ -439,11 +439,18 @@ bool BufFmtV(char* buf, size_t bufCchSize, const char* fmt, va_list args) {
     return false;
 }
 
-// TODO: need to finish StrFormat and use it instead.
-char* FmtV(const char* fmt, va_list args) {
-    char message[256] = {0};
-    size_t bufCchSize = dimof(message);
-    char* buf = message;
+bool BufFmt(char* buf, size_t bufCchSize, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    bool ok = BufFmtV(buf, bufCchSize, fmt, args);
+    va_end(args);
+    return ok;
+}
+
+// formats into buf if the result fits and into an allocated buffer otherwise
+// the caller must free() the result if it's not buf
+char* FmtV(char* bufIn, size_t bufCchSize, const char* fmt, va_list args) {
+    char* buf = bufIn;
     for (;;) {
         int count = vsnprintf(buf, bufCchSize, fmt, args);
         // happened in https://github.com/sumatrapdfreader/sumatrapdf/issues/878
@@ -454,7 +461,7 @@ char* FmtV(const char* fmt, va_list args) {
         }
         /* we have to make the buffer bigger. The algorithm used to calculate
            the new size is arbitrary (aka. educated guess) */
-        if (buf != message) {
+        if (buf != bufIn) {
             free(buf);
         }
         if (bufCchSize < 4 * 1024) {
@@ -467,11 +474,16 @@ char* FmtV(const char* fmt, va_list args) {
             break;
         }
     }
+    return buf;
+}
 
+// TODO: need to finish StrFormat and use it instead.
+char* FmtV(const char* fmt, va_list args) {
+    char message[256] = {0};
+    char* buf = FmtV(message, dimof(message), fmt, args);
     if (buf == message) {
         buf = str::Dup(message);
     }
-
     return buf;
 }
 
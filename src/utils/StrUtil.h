@@ -87,6 +87,8 @@ const char* FindI(const char* str, const char* find);
 bool Contains(std::string_view s, const char* txt);
 
 bool BufFmtV(char* buf, size_t bufCchSize, const char* fmt, va_list args);
+bool BufFmt(char* buf, size_t bufCchSize, const char* fmt, ...);
+char* FmtV(char* buf, size_t bufCchSize, const char* fmt, va_list args);
 char* FmtV(const char* fmt, va_list args);
 char* Format(const char* fmt, ...);
 
@@ -99,6 +101,8 @@ const WCHAR* Find(const WCHAR* str, const WCHAR* find);
 
 const WCHAR* FindI(const WCHAR* str, const WCHAR* find);
 bool BufFmtV(WCHAR* buf, size_t bufCchSize, const WCHAR* fmt, va_list args);
+bool BufFmt(WCHAR* buf, size_t bufCchSize, const WCHAR* fmt, ...);
+WCHAR* FmtV(WCHAR* buf, size_t bufCchSize, const WCHAR* fmt, va_list args);
 WCHAR* FmtV(const WCHAR* fmt, va_list args);
 WCHAR* Format(const WCHAR* fmt, ...);
 
@@ -149,6 +153,42 @@ const WCHAR* Parse(const WCHAR* str, const WCHAR* format, ...);
 bool IsStringEmptyOrWhiteSpaceOnly(std::string_view sv);
 
 #endif
+
+// formats into an inline buffer and only allocates if the result
+// doesn't fit, for short strings formatted over and over again
+// (status bar and toolbar texts, log lines)
+// FmtBuf<WCHAR> s(L"%d / %d", pageNo, pageCount);
+// is valid until s goes out of scope
+template <typename T, size_t N = 256>
+struct FmtBuf {
+    T buf[N];
+    T* s = nullptr;
+
+    explicit FmtBuf(const T* fmt, ...) {
+        va_list args;
+        va_start(args, fmt);
+        s = FmtV(buf, N, fmt, args);
+        va_end(args);
+    }
+    FmtBuf(const FmtBuf&) = delete;
+    FmtBuf& operator=(const FmtBuf&) = delete;
+    ~FmtBuf() {
+        if (s != buf) {
+            free(s);
+        }
+    }
+
+    const T* Get() const {
+        return s;
+    }
+    operator const T*() const {
+        return s;
+    }
+    size_t size() const {
+        return Len(s);
+    }
+};
+
 } // namespace str
 
 namespace url {
@@ -215,10 +215,18 @@ bool BufFmtV(WCHAR* buf, size_t bufCchSize, const WCHAR* fmt, va_list args) {
     return false;
 }
 
-WCHAR* FmtV(const WCHAR* fmt, va_list args) {
-    WCHAR message[256];
-    size_t bufCchSize = dimof(message);
-    WCHAR* buf = message;
+bool BufFmt(WCHAR* buf, size_t bufCchSize, const WCHAR* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    bool ok = BufFmtV(buf, bufCchSize, fmt, args);
+    va_end(args);
+    return ok;
+}
+
+// formats into buf if the result fits and into an allocated buffer otherwise
+// the caller must free() the result if it's not buf
+WCHAR* FmtV(WCHAR* bufIn, size_t bufCchSize, const WCHAR* fmt, va_list args) {
+    WCHAR* buf = bufIn;
     for (;;) {
         // TODO: _vsnwprintf_s fails for certain inputs (e.g. strings containing U+FFFF)
         //       but doesn't correctly set errno, either, so there's no way of telling
@@ -227,16 +235,21 @@ WCHAR* FmtV(const WCHAR* fmt, va_list args) {
         if ((count >= 0) && ((size_t)count < bufCchSize))
             break;
         // always grow the buffer exponentially (cf. TODO above)
-        if (buf != message)
+        if (buf != bufIn)
             free(buf);
         bufCchSize = bufCchSize / 2 * 3;
         buf = AllocArray<WCHAR>(bufCchSize);
         if (!buf)
             break;
     }
+    return buf;
+}
+
+WCHAR* FmtV(const WCHAR* fmt, va_list args) {
+    WCHAR message[256];
+    WCHAR* buf = FmtV(message, dimof(message), fmt, args);
     if (buf == message)
         buf = str::Dup(message);
-
     return buf;
 }
 
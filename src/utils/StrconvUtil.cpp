@@ -1,10 +1,107 @@
 /* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
    License: Simplified BSD (see COPYING.BSD) */
 
+#include <intrin.h>
+#if defined(_M_ARM64)
+#include "Sse2Neon.h"
+#else
+#include <emmintrin.h>
+#endif
+
 #include "BaseUtil.h"
 
 namespace strconv {
 
+// Most text converted between UTF-8 and UTF-16 is mostly ASCII, which only needs
+// to be narrowed or widened. These helpers do that 16 characters at a time
+// (using SSE2), up to the first non-ASCII character, and return how many
+// characters they've copied. WideCharToMultiByte/MultiByteToWideChar then
+// only need to convert the rest
+
+static size_t AsciiPrefixLen(const WCHAR* s, size_t len) {
+    const __m128i nonAsciiBits = _mm_set1_epi16((short)0xff80);
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, nonAsciiBits), zero));
+        if (mask != 0xffff) {
+            unsigned long bit;
+            _BitScanForward(&bit, ~mask & 0xffff);
+            return i + bit / 2;
+        }
+    }
+    while (i < len && s[i] < 0x80) {
+        i++;
+    }
+    return i;
+}
+
+static size_t AsciiPrefixLen(const char* s, size_t len) {
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+        int mask = _mm_movemask_epi8(v);
+        if (mask != 0) {
+            unsigned long bit;
+            _BitScanForward(&bit, mask);
+            return i + bit;
+        }
+    }
+    while (i < len && (u8)s[i] < 0x80) {
+        i++;
+    }
+    return i;
+}
+
+// s must only contain ASCII characters
+static void NarrowAscii(const WCHAR* s, size_t len, char* dst) {
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v1 = _mm_loadu_si128((const __m128i*)(s + i));
+        __m128i v2 = _mm_loadu_si128((const __m128i*)(s + i + 8));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(v1, v2));
+    }
+    for (; i < len; i++) {
+        dst[i] = (char)s[i];
+    }
+}
+
+static size_t WidenAsciiPrefix(const char* s, size_t len, WCHAR* dst) {
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+        if (_mm_movemask_epi8(v) != 0) {
+            break;
+        }
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_unpacklo_epi8(v, zero));
+        _mm_storeu_si128((__m128i*)(dst + i + 8), _mm_unpackhi_epi8(v, zero));
+    }
+    for (; i < len && (u8)s[i] < 0x80; i++) {
+        dst[i] = (WCHAR)s[i];
+    }
+    return i;
+}
+
+// code pages in which all bytes < 0x80 are the same characters as in ASCII
+// (which excludes e.g. EBCDIC and the ISO-2022 encodings)
+static bool IsAsciiCompatibleCodePage(UINT cp) {
+    switch (cp) {
+        case CP_UTF8:
+        case 20127: // US-ASCII
+        case 437:
+        case 850:
+        case 874:
+        case 932:
+        case 936:
+        case 949:
+        case 950:
+            return true;
+    }
+    return (1250 <= cp && cp <= 1258) || (28591 <= cp && cp <= 28605);
+}
+
 size_t Utf8ToWcharBuf(const char* s, size_t cbLen, WCHAR* bufOut, size_t cchBufOutSize) {
     CrashIf(!bufOut || (0 == cchBufOutSize));
     int cchConverted = MultiByteToWideChar(CP_UTF8, 0, s, (int)cbLen, bufOut, (int)cchBufOutSize);
@@ -18,15 +115,24 @@ size_t Utf8ToWcharBuf(const char* s, size_t cbLen, WCHAR* bufOut, size_t cchBufO
     return cchConverted;
 }
 
+// if the result doesn't fit, nothing is converted
 size_t WcharToUtf8Buf(const WCHAR* s, char* bufOut, size_t cbBufOutSize) {
     CrashIf(!bufOut || (0 == cbBufOutSize));
-    int cbConverted = WideCharToMultiByte(CP_UTF8, 0, s, -1, nullptr, 0, nullptr, nullptr);
-    if ((size_t)cbConverted >= cbBufOutSize)
-        cbConverted = (int)cbBufOutSize - 1;
-    int res = WideCharToMultiByte(CP_UTF8, 0, s, (int)str::Len(s), bufOut, cbConverted, nullptr, nullptr);
-    CrashIf(res > cbConverted);
-    bufOut[res] = '\0';
-    return res;
+    size_t len = str::Len(s);
+    size_t cbMax = cbBufOutSize - 1;
+    size_t n = AsciiPrefixLen(s, len);
+    if (n > cbMax || (n < len && n == cbMax)) {
+        bufOut[0] = '\0';
+        return 0;
+    }
+    NarrowAscii(s, n, bufOut);
+    if (n < len) {
+        int res = WideCharToMultiByte(CP_UTF8, 0, s + n, (int)(len - n), bufOut + n, (int)(cbMax - n), nullptr,
+                                      nullptr);
+        n = res > 0 ? n + res : 0;
+    }
+    bufOut[n] = '\0';
+    return n;
 }
 
 std::string_view WstrToCodePage(const WCHAR* txt, UINT codePage, int cchTxtLen) {
@@ -34,6 +140,9 @@ std::string_view WstrToCodePage(const WCHAR* txt, UINT codePage, int cchTxtLen)
     if (!txt) {
         return {};
     }
+    if (codePage == CP_UTF8) {
+        return WstrToUtf8(txt, cchTxtLen < 0 ? (size_t)-1 : (size_t)cchTxtLen);
+    }
 
     int bufSize = WideCharToMultiByte(codePage, 0, txt, cchTxtLen, nullptr, 0, nullptr, nullptr);
     if (0 == bufSize) {
@@ -54,6 +163,9 @@ WCHAR* ToWideChar(const char* src, UINT codePage, int cbSrcLen) {
     if (!src) {
         return nullptr;
     }
+    if (codePage == CP_UTF8) {
+        return Utf8ToWstr({src, cbSrcLen < 0 ? str::Len(src) : (size_t)cbSrcLen});
+    }
 
     int requiredBufSize = MultiByteToWideChar(codePage, 0, src, cbSrcLen, nullptr, 0);
     if (0 == requiredBufSize) {
@@ -84,6 +196,14 @@ std::string_view ToMultiByte(const char* src, UINT codePageSrc, UINT codePageDes
         return std::string_view(str::Dup(src));
     }
 
+    // text in ASCII doesn't need to be converted between ASCII-compatible code pages
+    if (IsAsciiCompatibleCodePage(codePageSrc) && IsAsciiCompatibleCodePage(codePageDest)) {
+        size_t len = str::Len(src);
+        if (AsciiPrefixLen(src, len) == len) {
+            return str::DupN(src, len);
+        }
+    }
+
     AutoFreeWstr tmp(ToWideChar(src, codePageSrc));
     if (!tmp) {
         return {};
@@ -136,16 +256,69 @@ WCHAR* FromCodePage(const char* src, UINT cp) {
     return ToWideChar(src, cp);
 }
 
-WCHAR* Utf8ToWstr(std::string_view sv) {
-    return ToWideChar(sv.data(), CP_UTF8, (int)sv.size());
+// converts in a single pass: UTF-8 never needs fewer bytes than UTF-16 needs code units,
+// so the result is allocated for the worst case (and shrunk if that was way off,
+// unless it's been allocated by <a>, as not all allocators can reallocate)
+WCHAR* Utf8ToWstr(std::string_view sv, Allocator* a) {
+    const char* s = sv.data();
+    size_t len = sv.size();
+    CrashIf(!s);
+    if (!s || len >= INT_MAX) {
+        return nullptr;
+    }
+    WCHAR* res = (WCHAR*)Allocator::Alloc(a, (len + 1) * sizeof(WCHAR));
+    if (!res) {
+        return nullptr;
+    }
+    size_t n = WidenAsciiPrefix(s, len, res);
+    if (n < len) {
+        int cchLeft = (int)(len - n);
+        n += MultiByteToWideChar(CP_UTF8, 0, s + n, cchLeft, res + n, cchLeft);
+        if (!a && n < len / 2) {
+            WCHAR* shrunk = (WCHAR*)Allocator::Realloc(a, res, (n + 1) * sizeof(WCHAR));
+            res = shrunk ? shrunk : res;
+        }
+    }
+    res[n] = 0;
+    return res;
 }
 
-std::string_view WstrToUtf8(const WCHAR* src, size_t cchSrcLen) {
-    return WstrToCodePage(src, CP_UTF8, (int)cchSrcLen);
+// converts in a single pass: a UTF-16 code unit never needs more than 3 bytes in UTF-8
+// (surrogate pairs need 4 for 2), so the result is allocated for the worst case
+// (and shrunk if that was way off and it's been allocated with malloc)
+std::string_view WstrToUtf8(const WCHAR* src, size_t cchSrcLen, Allocator* a) {
+    CrashIf(!src);
+    if (!src) {
+        return {};
+    }
+    if (cchSrcLen == (size_t)-1) {
+        cchSrcLen = str::Len(src);
+    }
+    size_t nAscii = AsciiPrefixLen(src, cchSrcLen);
+    size_t cchLeft = cchSrcLen - nAscii;
+    if (cchLeft >= INT_MAX / 3) {
+        return {};
+    }
+    size_t cbMax = nAscii + cchLeft * 3;
+    char* res = (char*)Allocator::Alloc(a, cbMax + 1);
+    if (!res) {
+        return {};
+    }
+    NarrowAscii(src, nAscii, res);
+    size_t n = nAscii;
+    if (cchLeft > 0) {
+        n += WideCharToMultiByte(CP_UTF8, 0, src + nAscii, (int)cchLeft, res + n, (int)(cbMax - n), nullptr, nullptr);
+        if (!a && n < cbMax / 2) {
+            char* shrunk = (char*)Allocator::Realloc(a, res, n + 1);
+            res = shrunk ? shrunk : res;
+        }
+    }
+    res[n] = 0;
+    return {res, n};
 }
 
-std::string_view WstrToUtf8(std::wstring_view sv) {
-    return WstrToCodePage(sv.data(), CP_UTF8, (int)sv.size());
+std::string_view WstrToUtf8(std::wstring_view sv, Allocator* a) {
+    return WstrToUtf8(sv.data(), sv.size(), a);
 }
 
 WCHAR* FromAnsi(const char* src, size_t cbSrcLen) {
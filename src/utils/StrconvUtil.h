@@ -12,10 +12,11 @@ std::string_view UnknownToUtf8(const std::string_view&);
 
 WCHAR* FromCodePage(const char* src, UINT cp);
 
-WCHAR* Utf8ToWstr(std::string_view sv);
+// the results are allocated with a (or malloc() if it's nullptr)
+WCHAR* Utf8ToWstr(std::string_view sv, Allocator* a = nullptr);
 
-std::string_view WstrToUtf8(const WCHAR* src, size_t cchSrcLen = -1);
-std::string_view WstrToUtf8(std::wstring_view);
+std::string_view WstrToUtf8(const WCHAR* src, size_t cchSrcLen = -1, Allocator* a = nullptr);
+std::string_view WstrToUtf8(std::wstring_view, Allocator* a = nullptr);
 
 std::string_view WstrToCodePage(const WCHAR* txt, UINT codePage, int cchTxtLen = -1);
 std::string_view WstrToAnsi(const WCHAR*);
@@ -300,6 +300,48 @@ static void ReadPixel(ReadState& s, char* dst) {
         s.data += s.n;
 }
 
+// same as calling ReadPixel for all pixels of a true color row but copies
+// whole runs at once (only valid if the pixel format matches the data's)
+static void ReadTruecolorRow(ReadState& s, char* dst, int w) {
+    if (!s.isRLE) {
+        size_t rowLen = (size_t)w * s.n;
+        if (s.data + rowLen > s.end) {
+            s.failed = true;
+            return;
+        }
+        memcpy(dst, s.data, rowLen);
+        s.data += rowLen;
+        return;
+    }
+    for (int x = 0; x < w;) {
+        if (0 == s.repeat && s.data < s.end) {
+            s.repeat = (*s.data & 0x7F) + 1;
+            s.repeatSame = (*s.data & 0x80);
+            s.data++;
+        }
+        // RLE packets may continue on the next row
+        int count = std::min(s.repeat, w - x);
+        size_t runLen = (size_t)(s.repeatSame ? 1 : count) * s.n;
+        if (0 == count || s.data + runLen > s.end) {
+            s.failed = true;
+            return;
+        }
+        if (s.repeatSame) {
+            for (int i = 0; i < count; i++) {
+                CopyPixel(dst + i * s.n, s.data, s.n);
+            }
+        } else {
+            memcpy(dst, s.data, runLen);
+        }
+        s.repeat -= count;
+        if (!s.repeatSame || 0 == s.repeat) {
+            s.data += runLen;
+        }
+        dst += count * s.n;
+        x += count;
+    }
+}
+
 Gdiplus::Bitmap* ImageFromData(const char* data, size_t len) {
     if (len < sizeof(TgaHeader))
         return nullptr;
@@ -328,6 +370,8 @@ Gdiplus::Bitmap* ImageFromData(const char* data, size_t len) {
     int n = ((format >> 8) & 0x3F) / 8;
     bool invertX = (headerLE->flags & Flag_InvertX);
     bool invertY = (headerLE->flags & Flag_InvertY);
+    bool isTruecolor = Type_Truecolor == s.type || Type_Truecolor_RLE == s.type;
+    bool copyRows = isTruecolor && n == s.n && !invertX;
 
     Gdiplus::Bitmap bmp(w, h, format);
     Gdiplus::Rect bmpRect(0, 0, w, h);
@@ -337,6 +381,13 @@ Gdiplus::Bitmap* ImageFromData(const char* data, size_t len) {
         return nullptr;
     for (int y = 0; y < h; y++) {
         char* rowOut = (char*)bmpData.Scan0 + bmpData.Stride * (invertY ? y : h - 1 - y);
+        if (copyRows) {
+            ReadTruecolorRow(s, rowOut, w);
+            if (s.failed) {
+                break;
+            }
+            continue;
+        }
         for (int x = 0; x < w; x++) {
             ReadPixel(s, rowOut + n * (invertX ? w - 1 - x : x));
         }
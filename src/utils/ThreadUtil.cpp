@@ -1,6 +1,8 @@
 /* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
    License: Simplified BSD (see COPYING.BSD) */
 
+#include <deque>
+
 #include "BaseUtil.h"
 #include "ThreadUtil.h"
 #include "ScopedWin.h"
@@ -88,6 +90,163 @@ bool ThreadBase::Join(DWORD waitMs) {
     return false;
 }
 
+CancelToken::CancelToken() {
+    InitializeCriticalSection(&cs);
+    idle = CreateEvent(nullptr, TRUE, TRUE, nullptr);
+}
+
+CancelToken::~CancelToken() {
+    CloseHandle(idle);
+    DeleteCriticalSection(&cs);
+}
+
+void CancelToken::AddRef() {
+    InterlockedIncrement(&refCount);
+}
+
+void CancelToken::Release() {
+    if (InterlockedDecrement(&refCount) == 0) {
+        delete this;
+    }
+}
+
+void CancelToken::Cancel() {
+    std::function<void()> fn;
+    {
+        ScopedCritSec scope(&cs);
+        if (canceled) {
+            return;
+        }
+        InterlockedExchange(&canceled, 1);
+        fn = std::move(onCancel);
+        onCancel = nullptr;
+    }
+    if (fn) {
+        fn();
+    }
+}
+
+bool CancelToken::IsCanceled() {
+    return InterlockedAdd(&canceled, 0) != 0;
+}
+
+void CancelToken::SetOnCancel(const std::function<void()>& fn) {
+    {
+        ScopedCritSec scope(&cs);
+        if (!canceled) {
+            onCancel = fn;
+            return;
+        }
+    }
+    if (fn) {
+        fn();
+    }
+}
+
+void CancelToken::WorkQueued() {
+    ScopedCritSec scope(&cs);
+    if (nPending++ == 0) {
+        ResetEvent(idle);
+    }
+}
+
+void CancelToken::WorkDone() {
+    ScopedCritSec scope(&cs);
+    CrashIf(nPending <= 0);
+    if (--nPending == 0) {
+        SetEvent(idle);
+    }
+}
+
+bool CancelToken::IsBusy() {
+    ScopedCritSec scope(&cs);
+    return nPending > 0;
+}
+
+bool CancelToken::Wait(DWORD waitMs) {
+    return WaitForSingleObject(idle, waitMs) == WAIT_OBJECT_0;
+}
+
+// Most work is queued from the ui thread, so instead of per-thread
+// queues with stealing between them, all threads take work from the
+// same queues, one per priority.
+struct WorkItem {
+    std::function<void()> func;
+    CancelToken* token = nullptr;
+};
+
+struct ThreadPool {
+    CRITICAL_SECTION cs;
+    CONDITION_VARIABLE hasWork;
+    std::deque<WorkItem> queues[(int)WorkPriority::Count];
+    int nThreads = 0;
+};
+
+static DWORD WINAPI PoolThreadProc(void* data) {
+    ThreadPool* pool = (ThreadPool*)data;
+    SetThreadName(GetCurrentThreadId(), "ThreadPool");
+    for (;;) {
+        WorkItem item;
+        EnterCriticalSection(&pool->cs);
+        for (;;) {
+            std::deque<WorkItem>* queue = nullptr;
+            for (auto& q : pool->queues) {
+                if (!q.empty()) {
+                    queue = &q;
+                    break;
+                }
+            }
+            if (queue) {
+                item = std::move(queue->front());
+                queue->pop_front();
+                break;
+            }
+            SleepConditionVariableCS(&pool->hasWork, &pool->cs, INFINITE);
+        }
+        LeaveCriticalSection(&pool->cs);
+
+        if (!item.token || !item.token->IsCanceled()) {
+            item.func();
+        }
+        if (item.token) {
+            item.token->WorkDone();
+            item.token->Release();
+        }
+    }
+}
+
+// the threads are never stopped, they're idle while
+// there's no work and go away when the process exits
+static ThreadPool* GetThreadPool() {
+    static ThreadPool* pool = [] {
+        auto p = new ThreadPool();
+        InitializeCriticalSection(&p->cs);
+        InitializeConditionVariable(&p->hasWork);
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+        p->nThreads = std::max((int)si.dwNumberOfProcessors, 2);
+        for (int i = 0; i < p->nThreads; i++) {
+            AutoCloseHandle h(CreateThread(nullptr, 0, PoolThreadProc, p, 0, 0));
+        }
+        return p;
+    }();
+    return pool;
+}
+
+void QueueWork(WorkPriority prio, const std::function<void()>& func, CancelToken* token) {
+    CrashIf(prio < WorkPriority::Render || prio >= WorkPriority::Count);
+    ThreadPool* pool = GetThreadPool();
+    if (token) {
+        token->AddRef();
+        token->WorkQueued();
+    }
+    {
+        ScopedCritSec scope(&pool->cs);
+        pool->queues[(int)prio].push_back({func, token});
+    }
+    WakeConditionVariable(&pool->hasWork);
+}
+
 static DWORD WINAPI ThreadFunc(void* data) {
     auto* func = reinterpret_cast<std::function<void()>*>(data);
     (*func)();
@@ -69,4 +69,57 @@ class ThreadBase {
 
 void SetThreadName(DWORD threadId, const char* threadName);
 
+// runs func on a thread of its own. meant for work that might block for a
+// long time (e.g. downloads), which would otherwise hold up the work queued
+// on the shared thread pool (for which use QueueWork instead)
 void RunAsync(const std::function<void()>&);
+
+// queued work is run by a pool of threads shared by the whole process
+// (one per CPU). work of a higher priority is started before any work
+// of a lower priority, work of equal priority in the order it was queued
+enum class WorkPriority {
+    Render = 0, // rendering of visible pages
+    Prefetch,   // rendering and text extraction ahead of time
+    Index,      // building of search and synchronization indexes
+    Background, // thumbnails and everything else
+    Count
+};
+
+// lets the code queueing work cancel it and wait for it having finished.
+// work that hasn't started when the token is canceled is dropped,
+// running work should poll IsCanceled() (or use SetOnCancel to e.g.
+// call AbortCookie::Abort for rendering and text extraction)
+class CancelToken {
+    LONG refCount = 1;
+    LONG canceled = 0;
+    int nPending = 0;
+    CRITICAL_SECTION cs;
+    // signaled while no work is pending
+    HANDLE idle = nullptr;
+    std::function<void()> onCancel;
+
+    ~CancelToken();
+
+  public:
+    CancelToken();
+
+    void AddRef();
+    void Release();
+
+    void Cancel();
+    bool IsCanceled();
+    // called (once) from Cancel() or right away if already canceled
+    void SetOnCancel(const std::function<void()>&);
+
+    // used by QueueWork
+    void WorkQueued();
+    void WorkDone();
+
+    // true while work queued with this token has not yet finished
+    bool IsBusy();
+    // returns false if waiting timed out
+    bool Wait(DWORD waitMs = INFINITE);
+};
+
+// token can be nullptr. if not, it's kept alive until the work has finished
+void QueueWork(WorkPriority prio, const std::function<void()>& func, CancelToken* token = nullptr);
@@ -0,0 +1,104 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/FileUtil.h"
+#include "utils/ThreadUtil.h"
+#include "utils/Trace.h"
+
+#include <TraceLoggingProvider.h>
+
+// {5A3F6C1E-7B0D-4E53-9B8A-2D6C1F0E4B71}
+TRACELOGGING_DEFINE_PROVIDER(gTraceProvider, "SumatraPDF.Trace",
+                             (0x5a3f6c1e, 0x7b0d, 0x4e53, 0x9b, 0x8a, 0x2d, 0x6c, 0x1f, 0x0e, 0x4b, 0x71));
+
+// a full trace of opening and scrolling through a large document
+// needs a few 100k spans, this limits the memory use to ~100 MB
+#define TRACE_MAX_SPANS (4 * 1024 * 1024)
+
+struct TraceSpanRecord {
+    const char* name;
+    DWORD threadId;
+    i64 start;
+    i64 end;
+};
+
+bool gTraceEnabled = false;
+static bool gTraceToEtw = false;
+static Mutex gTraceMutex;
+static Vec<TraceSpanRecord>* gTraceSpans = nullptr;
+static LARGE_INTEGER gTraceStart;
+
+void TraceStart() {
+    gTraceMutex.Lock();
+    if (!gTraceSpans) {
+        gTraceSpans = new Vec<TraceSpanRecord>();
+    }
+    gTraceSpans->Reset();
+    QueryPerformanceCounter(&gTraceStart);
+    gTraceMutex.Unlock();
+    gTraceEnabled = true;
+}
+
+void TraceStartEtw() {
+    if (gTraceToEtw) {
+        return;
+    }
+    TraceLoggingRegister(gTraceProvider);
+    gTraceToEtw = true;
+    gTraceEnabled = true;
+}
+
+void TraceRecordSpan(const char* name, LARGE_INTEGER start, LARGE_INTEGER end) {
+    if (gTraceToEtw) {
+        LARGE_INTEGER freq;
+        QueryPerformanceFrequency(&freq);
+        u64 durationUs = (u64)((end.QuadPart - start.QuadPart) * 1000000 / freq.QuadPart);
+        TraceLoggingWrite(gTraceProvider, "Span", TraceLoggingString(name, "Name"),
+                          TraceLoggingUInt64(durationUs, "DurationUs"));
+        return;
+    }
+    gTraceMutex.Lock();
+    if (gTraceSpans && gTraceSpans->size() < TRACE_MAX_SPANS) {
+        gTraceSpans->Append({name, GetCurrentThreadId(), start.QuadPart, end.QuadPart});
+    }
+    gTraceMutex.Unlock();
+}
+
+// https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU
+bool TraceStopAndSave(const WCHAR* path) {
+    gTraceEnabled = false;
+    if (gTraceToEtw) {
+        TraceLoggingUnregister(gTraceProvider);
+        gTraceToEtw = false;
+        return true;
+    }
+
+    gTraceMutex.Lock();
+    Vec<TraceSpanRecord>* spans = gTraceSpans;
+    gTraceSpans = nullptr;
+    gTraceMutex.Unlock();
+    if (!spans) {
+        return false;
+    }
+
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    double usPerTick = 1000000.0 / (double)freq.QuadPart;
+    DWORD pid = GetCurrentProcessId();
+
+    str::Str s;
+    s.Append("{\"traceEvents\":[");
+    for (size_t i = 0; i < spans->size(); i++) {
+        TraceSpanRecord& span = spans->at(i);
+        double ts = (double)(span.start - gTraceStart.QuadPart) * usPerTick;
+        double dur = (double)(span.end - span.start) * usPerTick;
+        // span names are identifiers, so they need no escaping
+        s.AppendFmt("%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                    i > 0 ? "," : "", span.name, (unsigned)pid, (unsigned)span.threadId, ts, dur);
+    }
+    s.Append("\n]}\n");
+    delete spans;
+
+    return file::WriteFile(path, s.AsView());
+}
@@ -0,0 +1,44 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+// Scoped timing spans for hot code paths. While tracing is disabled,
+// a span only checks gTraceEnabled. While enabled, spans are either
+// buffered and saved as a chrome://tracing JSON file or emitted as
+// ETW events (provider "SumatraPDF.Trace").
+//
+// Usage:
+//   void RenderPage(...) {
+//       TraceSpan span("RenderPage");
+//       ...
+//   }
+
+extern bool gTraceEnabled;
+
+// starts recording spans, which TraceStopAndSave() writes to a file
+void TraceStart();
+// starts emitting spans as ETW events instead (e.g. for WPR/WPA)
+void TraceStartEtw();
+// stops tracing and writes the recorded spans to path (if started with TraceStart())
+bool TraceStopAndSave(const WCHAR* path);
+
+void TraceRecordSpan(const char* name, LARGE_INTEGER start, LARGE_INTEGER end);
+
+struct TraceSpan {
+    // must be a string literal (or otherwise outlive tracing)
+    const char* name = nullptr;
+    LARGE_INTEGER start;
+
+    explicit TraceSpan(const char* name) {
+        if (gTraceEnabled) {
+            this->name = name;
+            QueryPerformanceCounter(&start);
+        }
+    }
+    ~TraceSpan() {
+        if (name) {
+            LARGE_INTEGER end;
+            QueryPerformanceCounter(&end);
+            TraceRecordSpan(name, start, end);
+        }
+    }
+};
@@ -5,24 +5,102 @@
 #include "utils/WinUtil.h"
 #include "utils/UITask.h"
 
+/* Tasks are queued in a lock-free list (SLIST), so that any thread can post
+without taking a lock. Only the post which makes the list non-empty also
+posts WM_EXECUTE_TASK, after which the UI thread runs all queued tasks at once.
+Task nodes are re-used, so posting a task which fits into std::function's
+inline storage doesn't allocate. */
+
 namespace uitask {
 
 static HWND gTaskDispatchHwnd = nullptr;
 
 #define UITASK_CLASS_NAME L"UITask_Wnd_Class"
 #define WM_EXECUTE_TASK (WM_USER + 104)
+// maximum number of task nodes kept for re-use
+#define MAX_POOLED_TASKS 256
+
+struct TaskNode {
+    SLIST_ENTRY entry; // must be first
+    TaskNode* next = nullptr;
+    std::function<void()> func;
+};
+
+static SLIST_HEADER gPostedTasks;
+static SLIST_HEADER gFreeTasks;
+// tasks taken from gPostedTasks, in the order they were posted
+// (only accessed on the UI thread)
+static TaskNode* gRunFirst = nullptr;
+static TaskNode* gRunLast = nullptr;
+
+static TaskNode* AllocTaskNode() {
+    void* mem = InterlockedPopEntrySList(&gFreeTasks);
+    if (!mem) {
+        mem = _aligned_malloc(sizeof(TaskNode), MEMORY_ALLOCATION_ALIGNMENT);
+        CrashAlwaysIf(!mem);
+    }
+    return new (mem) TaskNode();
+}
+
+static void FreeTaskNode(TaskNode* node) {
+    node->~TaskNode();
+    if (QueryDepthSList(&gFreeTasks) < MAX_POOLED_TASKS) {
+        InterlockedPushEntrySList(&gFreeTasks, &node->entry);
+    } else {
+        _aligned_free(node);
+    }
+}
+
+// moves the posted tasks to the end of the run queue
+static void TakePostedTasks() {
+    TaskNode* node = (TaskNode*)InterlockedFlushSList(&gPostedTasks);
+    // the list is in reverse order of posting
+    TaskNode* first = nullptr;
+    TaskNode* last = node;
+    while (node) {
+        TaskNode* nextNode = (TaskNode*)node->entry.Next;
+        node->next = first;
+        first = node;
+        node = nextNode;
+    }
+    if (!first) {
+        return;
+    }
+    if (gRunLast) {
+        gRunLast->next = first;
+    } else {
+        gRunFirst = first;
+    }
+    gRunLast = last;
+}
+
+// tasks might run nested message loops (e.g. by showing a message box) which
+// run later tasks, so the run queue is shared to keep them in order
+static void RunPendingTasks() {
+    TakePostedTasks();
+    while (gRunFirst) {
+        TaskNode* node = gRunFirst;
+        gRunFirst = node->next;
+        if (!gRunFirst) {
+            gRunLast = nullptr;
+        }
+        node->func();
+        FreeTaskNode(node);
+    }
+}
 
 static LRESULT CALLBACK WndProcTaskDispatch(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
     if (WM_EXECUTE_TASK == msg) {
-        auto func = (std::function<void()>*)lParam;
-        (*func)();
-        delete func;
+        RunPendingTasks();
         return 0;
     }
     return DefWindowProc(hwnd, msg, wParam, lParam);
 }
 
 void Initialize() {
+    InitializeSListHead(&gPostedTasks);
+    InitializeSListHead(&gFreeTasks);
+
     WNDCLASSEX wcex;
     FillWndClassEx(wcex, UITASK_CLASS_NAME, WndProcTaskDispatch);
     RegisterClassEx(&wcex);
@@ -38,16 +116,40 @@ void DrainQueue() {
     while (PeekMessage(&msg, gTaskDispatchHwnd, WM_EXECUTE_TASK, WM_EXECUTE_TASK, PM_REMOVE)) {
         DispatchMessage(&msg);
     }
+    RunPendingTasks();
 }
 
 void Destroy() {
     DrainQueue();
     DestroyWindow(gTaskDispatchHwnd);
     gTaskDispatchHwnd = nullptr;
+
+    void* node;
+    while ((node = InterlockedPopEntrySList(&gFreeTasks)) != nullptr) {
+        _aligned_free(node);
+    }
+}
+
+void Post(std::function<void()>&& f) {
+    TaskNode* node = AllocTaskNode();
+    node->func = std::move(f);
+    if (!InterlockedPushEntrySList(&gPostedTasks, &node->entry)) {
+        PostMessage(gTaskDispatchHwnd, WM_EXECUTE_TASK, 0, 0);
+    }
 }
 
 void Post(const std::function<void()>& f) {
-    auto func = new std::function<void()>(f);
-    PostMessage(gTaskDispatchHwnd, WM_EXECUTE_TASK, 0, (LPARAM)func);
+    Post(std::function<void()>(f));
+}
+
+void PostCoalesced(LONG* pending, std::function<void()>&& f) {
+    if (InterlockedExchange(pending, 1) != 0) {
+        return;
+    }
+    Post([pending, f = std::move(f)] {
+        // reset before running, so that later updates are posted anew
+        InterlockedExchange(pending, 0);
+        f();
+    });
 }
 } // namespace uitask
@@ -10,5 +10,13 @@ void Destroy();
 // call only from the same thread as Initialize() and Destroy()
 void DrainQueue();
 
+// can be called from any thread and doesn't block
 void Post(const std::function<void()>&);
+void Post(std::function<void()>&&);
+
+// posts f unless a task posted with the same pending flag hasn't run yet.
+// meant for tasks which only show the latest state (e.g. progress updates)
+// and are posted at high rates: f must read that state when it runs
+// instead of capturing it when posted
+void PostCoalesced(LONG* pending, std::function<void()>&& f);
 } // namespace uitask
@@ -7,27 +7,32 @@
 store pointer types or POD types
 (http://stackoverflow.com/questions/146452/what-are-pod-types-in-c).
 
+The first N - 1 elements are stored inline, without allocating. Short-lived
+vectors known to stay small can use a smaller or larger N (e.g. Vec<T, 4>)
+to save stack space or allocations.
+
 We always pad the elements with a single 0 value. This makes
 Vec<char> and Vec<WCHAR> a C-compatible string. Although it's
 not useful for other types, the code is simpler if we always do it
 (rather than have it an optional behavior).
 */
-template <typename T>
+template <typename T, size_t N = 16>
 class Vec {
   public:
     static const size_t PADDING = 1;
+    static_assert(N > PADDING, "Vec needs room for at least one inline element");
 
     size_t len = 0;
     size_t cap = 0;
     size_t capacityHint = 0;
     T* els = nullptr;
-    T buf[16];
+    T buf[N];
     Allocator* allocator = nullptr;
     // don't crash if we run out of memory
     bool allowFailure = false;
 
   protected:
-    bool EnsureCap(size_t needed) {
+    [[nodiscard]] bool EnsureCap(size_t needed) {
         if (cap >= needed) {
             return true;
         }
@@ -67,7 +72,7 @@ class Vec {
         return true;
     }
 
-    T* MakeSpaceAt(size_t idx, size_t count) {
+    [[nodiscard]] T* MakeSpaceAt(size_t idx, size_t count) {
         size_t newLen = std::max(len, idx) + count;
         bool ok = EnsureCap(newLen);
         if (!ok) {
@@ -88,6 +93,26 @@ class Vec {
             Allocator::Free(allocator, els);
     }
 
+    // takes over the elements of that (which must be a different Vec) and leaves it empty.
+    // heap-allocated elements are taken as is, inline elements are copied
+    void TakeFrom(Vec& that) {
+        FreeEls();
+        if (that.els == that.buf) {
+            memcpy(buf, that.buf, sizeof(buf));
+            els = buf;
+        } else {
+            els = that.els;
+        }
+        len = that.len;
+        cap = that.cap;
+        capacityHint = that.capacityHint;
+        // the elements must be freed with the allocator that allocated them
+        allocator = that.allocator;
+        allowFailure = that.allowFailure;
+        that.els = that.buf;
+        that.Reset();
+    }
+
   public:
     // allocator is not owned by Vec and must outlive it
     explicit Vec(size_t capHint = 0, Allocator* allocator = nullptr) : capacityHint(capHint), allocator(allocator) {
@@ -104,11 +129,19 @@ class Vec {
     Vec(const Vec& orig) {
         els = buf;
         Reset();
-        EnsureCap(orig.cap);
+        bool ok = EnsureCap(orig.len);
+        CrashAlwaysIf(!ok);
         // using memcpy, as Vec only supports POD types
         memcpy(els, orig.els, sizeof(T) * (len = orig.len));
     }
 
+    // moving is cheap: it doesn't allocate and leaves orig empty
+    Vec(Vec&& orig) noexcept {
+        els = buf;
+        Reset();
+        TakeFrom(orig);
+    }
+
     // this frees all elements and clears the array.
     // only applicable where T is a pointer. Otherwise will fail to compile
     void FreeMembers() {
@@ -121,7 +154,8 @@ class Vec {
 
     Vec& operator=(const Vec& that) {
         if (this != &that) {
-            EnsureCap(that.cap);
+            bool ok = EnsureCap(that.len);
+            CrashAlwaysIf(!ok);
             // using memcpy, as Vec only supports POD types
             memcpy(els, that.els, sizeof(T) * (len = that.len));
             memset(els + len, 0, sizeof(T) * (cap - len));
@@ -129,6 +163,13 @@ class Vec {
         return *this;
     }
 
+    Vec& operator=(Vec&& that) noexcept {
+        if (this != &that) {
+            TakeFrom(that);
+        }
+        return *this;
+    }
+
     [[nodiscard]] T& operator[](size_t idx) const {
         CrashIf(idx >= len);
         return els[idx];
@@ -150,7 +191,12 @@ class Vec {
 
     bool SetSize(size_t newSize) {
         Reset();
-        return MakeSpaceAt(0, newSize);
+        return MakeSpaceAt(0, newSize) != nullptr;
+    }
+
+    // makes sure that at least n elements can be stored without re-allocating
+    [[nodiscard]] bool Reserve(size_t n) {
+        return EnsureCap(n);
     }
 
     [[nodiscard]] T& at(size_t idx) const {
@@ -350,8 +396,8 @@ class Vec {
 };
 
 // only suitable for T that are pointers to C++ objects
-template <typename T>
-inline void DeleteVecMembers(Vec<T>& v) {
+template <typename T, size_t N>
+inline void DeleteVecMembers(Vec<T, N>& v) {
     for (T& el : v) {
         delete el;
     }
@@ -40,6 +40,39 @@ Gdiplus::Bitmap* ImageFromData(const char* data, size_t len) {
     return bmp.Clone(0, 0, w, h, PixelFormat32bppARGB);
 }
 
+Gdiplus::Bitmap* ImageFromDataReduced(const char* data, size_t len, int reduction) {
+    WebPDecoderConfig config;
+    if (!WebPInitDecoderConfig(&config))
+        return nullptr;
+    if (WebPGetFeatures((const uint8_t*)data, len, &config.input) != VP8_STATUS_OK)
+        return nullptr;
+    int w = std::max((config.input.width + reduction - 1) / reduction, 1);
+    int h = std::max((config.input.height + reduction - 1) / reduction, 1);
+
+    Gdiplus::Bitmap bmp(w, h, PixelFormat32bppARGB);
+    Gdiplus::Rect bmpRect(0, 0, w, h);
+    Gdiplus::BitmapData bmpData;
+    Gdiplus::Status ok = bmp.LockBits(&bmpRect, Gdiplus::ImageLockModeWrite, PixelFormat32bppARGB, &bmpData);
+    if (ok != Gdiplus::Ok)
+        return nullptr;
+    // libwebp scales while decoding, so that the full-size image is never allocated
+    config.options.use_scaling = 1;
+    config.options.scaled_width = w;
+    config.options.scaled_height = h;
+    config.output.colorspace = MODE_BGRA;
+    config.output.is_external_memory = 1;
+    config.output.u.RGBA.rgba = (uint8_t*)bmpData.Scan0;
+    config.output.u.RGBA.stride = bmpData.Stride;
+    config.output.u.RGBA.size = (size_t)bmpData.Stride * h;
+    VP8StatusCode status = WebPDecode((const uint8_t*)data, len, &config);
+    WebPFreeDecBuffer(&config.output);
+    bmp.UnlockBits(&bmpData);
+    if (status != VP8_STATUS_OK)
+        return nullptr;
+
+    return bmp.Clone(0, 0, w, h, PixelFormat32bppARGB);
+}
+
 } // namespace webp
 
 #else
@@ -60,6 +93,12 @@ Gdiplus::Bitmap* ImageFromData(const char* data, size_t len) {
     UNUSED(len);
     return nullptr;
 }
+Gdiplus::Bitmap* ImageFromDataReduced(const char* data, size_t len, int reduction) {
+    UNUSED(data);
+    UNUSED(len);
+    UNUSED(reduction);
+    return nullptr;
+}
 } // namespace webp
 
 #endif
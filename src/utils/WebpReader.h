@@ -6,5 +6,7 @@ namespace webp {
 bool HasSignature(const char* data, size_t len);
 Gdiplus::Size SizeFromData(const char* data, size_t len);
 Gdiplus::Bitmap* ImageFromData(const char* data, size_t len);
+// decodes the image scaled down by <reduction> in each dimension
+Gdiplus::Bitmap* ImageFromDataReduced(const char* data, size_t len, int reduction);
 
 } // namespace webp
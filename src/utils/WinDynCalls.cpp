@@ -13,6 +13,8 @@ UXTHEME_API_LIST(API_DECLARATION)
 NORMALIZ_API_LIST(API_DECLARATION)
 USER32_API_LIST(API_DECLARATION)
 DWMAPI_API_LIST(API_DECLARATION)
+DWRITE_API_LIST(API_DECLARATION)
+D2D1_API_LIST(API_DECLARATION)
 DBGHELP_API_LIST(API_DECLARATION)
 
 #undef API_DECLARATION
@@ -57,6 +59,16 @@ void InitDynCalls() {
         DWMAPI_API_LIST(API_LOAD);
     }
 
+    h = SafeLoadLibrary("dwrite.dll");
+    if (h) {
+        DWRITE_API_LIST(API_LOAD);
+    }
+
+    h = SafeLoadLibrary("d2d1.dll");
+    if (h) {
+        D2D1_API_LIST(API_LOAD);
+    }
+
     h = SafeLoadLibrary("normaliz.dll");
     if (h) {
         NORMALIZ_API_LIST(API_LOAD);
@@ -20,6 +20,8 @@ The intent is to standardize how we do it.
 #include <OleAcc.h>
 #include <WinNls.h>
 #include <processthreadsapi.h>
+#include <dwrite.h>
+#include <d2d1.h>
 
 // dbghelp.h is included here so that warning C4091 can be disabled in a single location
 #pragma warning(push)
@@ -105,6 +107,19 @@ UXTHEME_API_LIST(API_DECLARATION2)
 
 DWMAPI_API_LIST(API_DECLARATION2)
 
+// dwrite.dll
+#define DWRITE_API_LIST(V) V(DWriteCreateFactory)
+
+DWRITE_API_LIST(API_DECLARATION2)
+
+// d2d1.dll, D2D1CreateFactory is overloaded in d2d1.h so decltype() can't be used
+typedef HRESULT(WINAPI* Sig_D2D1CreateFactory)(D2D1_FACTORY_TYPE factoryType, REFIID riid,
+                                               const D2D1_FACTORY_OPTIONS* factoryOptions, void** factory);
+
+#define D2D1_API_LIST(V) V(D2D1CreateFactory)
+
+D2D1_API_LIST(API_DECLARATION)
+
 // dbghelp.dll, there are different versions not sure if I can rely on
 // this to be always present on every Windows version
 #define DBGHELP_API_LIST(V)     \
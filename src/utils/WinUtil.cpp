@@ -4,6 +4,12 @@
 #include "utils/BaseUtil.h"
 #include "utils/Dpi.h"
 #include <mlang.h>
+#include <intrin.h>
+#if defined(_M_ARM64)
+#include <arm64_neon.h>
+#else
+#include <immintrin.h>
+#endif
 
 #include "utils/BitManip.h"
 #include "utils/ScopedWin.h"
@@ -1066,6 +1072,10 @@ HDC DoubleBuffer::GetDC() const {
     return hdcCanvas;
 }
 
+Rect DoubleBuffer::GetRect() const {
+    return rect;
+}
+
 void DoubleBuffer::Flush(HDC hdc) {
     CrashIf(hdc == hdcBuffer);
     if (hdcBuffer) {
@@ -1073,6 +1083,14 @@ void DoubleBuffer::Flush(HDC hdc) {
     }
 }
 
+void DoubleBuffer::Flush(HDC hdc, Rect r) {
+    CrashIf(hdc == hdcBuffer);
+    r = r.Intersect(rect);
+    if (hdcBuffer && !r.IsEmpty()) {
+        BitBlt(hdc, r.x, r.y, r.dx, r.dy, hdcBuffer, r.x - rect.x, r.y - rect.y, SRCCOPY);
+    }
+}
+
 DeferWinPosHelper::DeferWinPosHelper() {
     hdwp = ::BeginDeferWindowPos(32);
 }
@@ -1430,6 +1448,148 @@ inline int mul255(int a, int b) {
     return x >> 8;
 }
 
+// the SIMD versions compute exactly the same as mul255: for each channel
+// _mm_madd_epi16 on (a, 1) and (diff, 128) pairs yields a * diff + 128 in 32 bits
+
+static void UpdateBgraColorsScalar(u8* data, size_t nBytes, const int base[4], const int diff[4]) {
+    for (size_t i = 0; i < nBytes; i += 4) {
+        for (int k = 0; k < 4; k++) {
+            data[i + k] = (u8)(base[k] + mul255(data[i + k], diff[k]));
+        }
+    }
+}
+
+#if defined(_M_ARM64)
+
+// vmlal_s16 yields a * diff + 128 in 32 bits (as _mm_madd_epi16 does for SSE2)
+static inline int32x4_t UpdateBgraPixelNEON(int16x4_t px16, int16x4_t diff, int32x4_t round, int32x4_t base) {
+    int32x4_t x = vmlal_s16(round, px16, diff);
+    x = vsraq_n_s32(x, x, 8);
+    return vsraq_n_s32(base, x, 8);
+}
+
+static void UpdateBgraColorsNEON(u8* data, size_t nBytes, const int base[4], const int diff[4]) {
+    const int16_t diff16[4] = {(int16_t)diff[0], (int16_t)diff[1], (int16_t)diff[2], (int16_t)diff[3]};
+    int16x4_t vdiff = vld1_s16(diff16);
+    int32x4_t vbase = vld1q_s32((const int32_t*)base);
+    int32x4_t round = vdupq_n_s32(128);
+    size_t n = nBytes & ~(size_t)15;
+    for (size_t i = 0; i < n; i += 16) {
+        uint8x16_t v = vld1q_u8(data + i);
+        int16x8_t lo = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(v)));
+        int16x8_t hi = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(v)));
+        int32x4_t p0 = UpdateBgraPixelNEON(vget_low_s16(lo), vdiff, round, vbase);
+        int32x4_t p1 = UpdateBgraPixelNEON(vget_high_s16(lo), vdiff, round, vbase);
+        int32x4_t p2 = UpdateBgraPixelNEON(vget_low_s16(hi), vdiff, round, vbase);
+        int32x4_t p3 = UpdateBgraPixelNEON(vget_high_s16(hi), vdiff, round, vbase);
+        // saturates like _mm_packs_epi32 and _mm_packus_epi16
+        int16x8_t r01 = vcombine_s16(vqmovn_s32(p0), vqmovn_s32(p1));
+        int16x8_t r23 = vcombine_s16(vqmovn_s32(p2), vqmovn_s32(p3));
+        vst1q_u8(data + i, vcombine_u8(vqmovun_s16(r01), vqmovun_s16(r23)));
+    }
+    UpdateBgraColorsScalar(data + n, nBytes - n, base, diff);
+}
+
+bool CpuHasAVX2() {
+    return false;
+}
+
+#else
+
+static inline __m128i UpdateBgraPixelSSE2(__m128i px16, __m128i one, __m128i coeff, __m128i base) {
+    // px16 has 4 channels of 1 pixel in the lower 64 bits
+    __m128i x = _mm_madd_epi16(_mm_unpacklo_epi16(px16, one), coeff);
+    x = _mm_add_epi32(x, _mm_srai_epi32(x, 8));
+    return _mm_add_epi32(base, _mm_srai_epi32(x, 8));
+}
+
+static void UpdateBgraColorsSSE2(u8* data, size_t nBytes, const int base[4], const int diff[4]) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i one = _mm_set1_epi16(1);
+    __m128i coeff = _mm_setr_epi16((short)diff[0], 128, (short)diff[1], 128, (short)diff[2], 128, (short)diff[3], 128);
+    __m128i vbase = _mm_setr_epi32(base[0], base[1], base[2], base[3]);
+    size_t n = nBytes & ~(size_t)15;
+    for (size_t i = 0; i < n; i += 16) {
+        __m128i v = _mm_loadu_si128((__m128i*)(data + i));
+        __m128i lo = _mm_unpacklo_epi8(v, zero);
+        __m128i hi = _mm_unpackhi_epi8(v, zero);
+        __m128i p0 = UpdateBgraPixelSSE2(lo, one, coeff, vbase);
+        __m128i p1 = UpdateBgraPixelSSE2(_mm_srli_si128(lo, 8), one, coeff, vbase);
+        __m128i p2 = UpdateBgraPixelSSE2(hi, one, coeff, vbase);
+        __m128i p3 = UpdateBgraPixelSSE2(_mm_srli_si128(hi, 8), one, coeff, vbase);
+        __m128i r = _mm_packus_epi16(_mm_packs_epi32(p0, p1), _mm_packs_epi32(p2, p3));
+        _mm_storeu_si128((__m128i*)(data + i), r);
+    }
+    UpdateBgraColorsScalar(data + n, nBytes - n, base, diff);
+}
+
+static void UpdateBgraColorsAVX2(u8* data, size_t nBytes, const int base[4], const int diff[4]) {
+    __m256i one = _mm256_set1_epi16(1);
+    __m128i coeff128 =
+        _mm_setr_epi16((short)diff[0], 128, (short)diff[1], 128, (short)diff[2], 128, (short)diff[3], 128);
+    __m256i coeff = _mm256_broadcastsi128_si256(coeff128);
+    __m256i vbase = _mm256_broadcastsi128_si256(_mm_setr_epi32(base[0], base[1], base[2], base[3]));
+    size_t n = nBytes & ~(size_t)15;
+    for (size_t i = 0; i < n; i += 16) {
+        // 4 pixels, widened to 16 bits: pixels 0 and 1 in the low lane, 2 and 3 in the high lane
+        __m256i v = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i*)(data + i)));
+        __m256i x0 = _mm256_madd_epi16(_mm256_unpacklo_epi16(v, one), coeff);
+        __m256i x1 = _mm256_madd_epi16(_mm256_unpackhi_epi16(v, one), coeff);
+        x0 = _mm256_add_epi32(x0, _mm256_srai_epi32(x0, 8));
+        x1 = _mm256_add_epi32(x1, _mm256_srai_epi32(x1, 8));
+        x0 = _mm256_add_epi32(vbase, _mm256_srai_epi32(x0, 8));
+        x1 = _mm256_add_epi32(vbase, _mm256_srai_epi32(x1, 8));
+        // packing is per lane, which restores the pixel order 0, 1 | 2, 3
+        __m256i r = _mm256_packs_epi32(x0, x1);
+        __m128i res = _mm_packus_epi16(_mm256_castsi256_si128(r), _mm256_extracti128_si256(r, 1));
+        _mm_storeu_si128((__m128i*)(data + i), res);
+    }
+    UpdateBgraColorsScalar(data + n, nBytes - n, base, diff);
+}
+
+bool CpuHasAVX2() {
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    // the OS must also save the YMM registers on context switch
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+}
+
+#endif
+
+typedef void (*UpdateBgraColorsFunc)(u8* data, size_t nBytes, const int base[4], const int diff[4]);
+
+static UpdateBgraColorsFunc GetUpdateBgraColorsFunc() {
+#if defined(_M_ARM64)
+    // NEON is part of the ARM64 baseline
+    return UpdateBgraColorsNEON;
+#else
+    if (CpuHasAVX2()) {
+        return UpdateBgraColorsAVX2;
+    }
+    if (IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE)) {
+        return UpdateBgraColorsSSE2;
+    }
+    return UpdateBgraColorsScalar;
+#endif
+}
+
+// nBytes must be a multiple of 4
+static void UpdateBgraColors(u8* data, size_t nBytes, const int base[4], const int diff[4]) {
+    // initialization of function-local statics is thread-safe
+    static UpdateBgraColorsFunc fn = GetUpdateBgraColorsFunc();
+    fn(data, nBytes, base, diff);
+}
+
 void FinalizeBitmapPixels(BitmapPixels* bitmapPixels) {
     HDC hdc = bitmapPixels->hdc;
     if (hdc) {
@@ -1520,6 +1680,89 @@ BitmapPixels* GetBitmapPixels(HBITMAP hbmp) {
     return res;
 }
 
+#define PALETTE_HASH_SIZE 1024
+
+// maps colors to their palette index (open addressing with linear probing)
+struct PaletteHash {
+    u32 colors[PALETTE_HASH_SIZE];
+    short idxs[PALETTE_HASH_SIZE]; // -1 for unused slots
+
+    PaletteHash() {
+        memset(idxs, 0xff, sizeof(idxs));
+    }
+};
+
+// returns the pixel's color in RGBQUAD layout
+static inline u32 ReadPaletteColor(const u8* src, bool isBgr) {
+    if (isBgr) {
+        return src[0] | (src[1] << 8) | (src[2] << 16);
+    }
+    return src[2] | (src[1] << 8) | (src[0] << 16);
+}
+
+// returns the color's index in pal, adding it if necessary (or -1 if pal is full)
+static inline int FindOrAddPaletteColor(PaletteHash& hash, u32* pal, int& paletteSize, u32 c) {
+    u32 slot = (c * 2654435761u) >> 22;
+    while (hash.idxs[slot] >= 0) {
+        if (hash.colors[slot] == c) {
+            return hash.idxs[slot];
+        }
+        slot = (slot + 1) & (PALETTE_HASH_SIZE - 1);
+    }
+    if (paletteSize == 256) {
+        return -1;
+    }
+    hash.colors[slot] = c;
+    hash.idxs[slot] = (short)paletteSize;
+    pal[paletteSize] = c;
+    return paletteSize++;
+}
+
+// images and gradients usually have many more colors than a palette can hold,
+// which a sparse grid of pixels is mostly enough to find out
+bool MayConvertToPalette(const u8* src, int w, int h, bool isBgr) {
+    const int probeStep = 7;
+    u32 pal[256];
+    PaletteHash hash;
+    int paletteSize = 0;
+    for (int j = 0; j < h; j += probeStep) {
+        const u8* s = src + (size_t)j * w * 4;
+        for (int i = 0; i < w; i += probeStep) {
+            if (FindOrAddPaletteColor(hash, pal, paletteSize, ReadPaletteColor(s + (size_t)i * 4, isBgr)) < 0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int ConvertToPalette(const u8* src, int w, int h, bool isBgr, u8* dst, int dstStride, RGBQUAD palette[256]) {
+    u32* pal = (u32*)palette;
+    PaletteHash hash;
+    int paletteSize = 0;
+
+    // neighboring pixels usually have the same color
+    u32 lastColor = 0;
+    int lastIdx = -1;
+    for (int j = 0; j < h; j++) {
+        u8* d = dst + (size_t)j * dstStride;
+        for (int i = 0; i < w; i++) {
+            u32 c = ReadPaletteColor(src, isBgr);
+            src += 4;
+            if (c != lastColor || lastIdx < 0) {
+                lastIdx = FindOrAddPaletteColor(hash, pal, paletteSize, c);
+                if (lastIdx < 0) {
+                    return -1;
+                }
+                lastColor = c;
+            }
+            /* 8-bit data consists of indices into the color palette */
+            *d++ = (u8)lastIdx;
+        }
+    }
+    return paletteSize;
+}
+
 void UpdateBitmapColors(HBITMAP hbmp, COLORREF textColor, COLORREF bgColor) {
     if ((textColor & 0xFFFFFF) == WIN_COL_BLACK && (bgColor & 0xFFFFFF) == WIN_COL_WHITE)
         return;
@@ -1540,12 +1783,9 @@ void UpdateBitmapColors(HBITMAP hbmp, COLORREF textColor, COLORREF bgColor) {
     // for mapped 32-bit DI bitmaps: directly access the pixel data
     if (ret >= sizeof(info.dsBm) && info.dsBm.bmBits && 32 == info.dsBm.bmBitsPixel &&
         size.dx * 4 == info.dsBm.bmWidthBytes) {
-        int bmpBytes = size.dx * size.dy * 4;
+        size_t bmpBytes = (size_t)size.dx * size.dy * 4;
         uint8_t* bmpData = (uint8_t*)info.dsBm.bmBits;
-        for (int i = 0; i < bmpBytes; i++) {
-            int k = i % 4;
-            bmpData[i] = (uint8_t)(base[k] + mul255(bmpData[i], diff[k]));
-        }
+        UpdateBgraColors(bmpData, bmpBytes, base, diff);
         return;
     }
 
@@ -1595,10 +1835,7 @@ void UpdateBitmapColors(HBITMAP hbmp, COLORREF textColor, COLORREF bgColor) {
     CrashIf(!bmpData);
 
     if (GetDIBits(hDC, hbmp, 0, size.dy, bmpData, &bmi, DIB_RGB_COLORS)) {
-        for (int i = 0; i < bmpBytes; i++) {
-            int k = i % 4;
-            bmpData[i] = (uint8_t)(base[k] + mul255(bmpData[i], diff[k]));
-        }
+        UpdateBgraColors(bmpData, bmpBytes, base, diff);
         SetDIBits(hDC, hbmp, 0, size.dy, bmpData, &bmi, DIB_RGB_COLORS);
     }
 
@@ -1659,6 +1896,137 @@ HBITMAP CreateMemoryBitmap(Size size, HANDLE* hDataMapping) {
     return CreateDIBSection(nullptr, &bmi, DIB_RGB_COLORS, &data, hDataMapping ? *hDataMapping : nullptr, 0);
 }
 
+// the RenderCache evicts bitmaps as fast as new ones get rendered and while
+// scrolling those are mostly tiles of the same few sizes. re-using their DIB
+// sections saves the kernel from allocating and zeroing the memory anew
+// every time. bitmaps that haven't been re-used for a while are freed
+#define BITMAP_POOL_MAX_BYTES (64 * 1024 * 1024)
+#define BITMAP_POOL_MAX_AGE_MS (10 * 1000)
+
+struct PooledBitmap {
+    HBITMAP hbmp = nullptr;
+    HANDLE hMap = nullptr;
+    void* data = nullptr;
+    Size size;
+    DWORD returnedAt = 0;
+};
+
+struct BitmapPool {
+    CRITICAL_SECTION cs;
+    // in the order they've been returned
+    Vec<PooledBitmap> bitmaps;
+    size_t nBytes = 0;
+
+    BitmapPool() {
+        InitializeCriticalSection(&cs);
+    }
+};
+
+// never freed because bitmaps can be returned until the very end
+static BitmapPool* GetBitmapPool() {
+    static BitmapPool* pool = new BitmapPool();
+    return pool;
+}
+
+static size_t PooledBitmapBytes(Size size) {
+    return (size_t)size.dx * size.dy * 4;
+}
+
+// must be called with pool->cs
+static void FreeOldestPooledBitmaps(BitmapPool* pool, size_t maxBytes, DWORD maxAgeMs) {
+    DWORD now = GetTickCount();
+    while (pool->bitmaps.size() > 0) {
+        PooledBitmap& b = pool->bitmaps.at(0);
+        if (pool->nBytes <= maxBytes && now - b.returnedAt <= maxAgeMs) {
+            break;
+        }
+        pool->nBytes -= PooledBitmapBytes(b.size);
+        DeleteObject(b.hbmp);
+        CloseHandle(b.hMap);
+        pool->bitmaps.RemoveAt(0);
+    }
+}
+
+HBITMAP CreatePooledMemoryBitmap(Size size, HANDLE* hDataMapping, void** dataOut) {
+    BitmapPool* pool = GetBitmapPool();
+    {
+        ScopedCritSec scope(&pool->cs);
+        FreeOldestPooledBitmaps(pool, BITMAP_POOL_MAX_BYTES, BITMAP_POOL_MAX_AGE_MS);
+        // the most recently returned bitmaps are the most likely to still be paged in
+        for (int i = pool->bitmaps.isize() - 1; i >= 0; i--) {
+            PooledBitmap b = pool->bitmaps.at(i);
+            if (b.size == size) {
+                pool->bitmaps.RemoveAt(i);
+                pool->nBytes -= PooledBitmapBytes(size);
+                *hDataMapping = b.hMap;
+                *dataOut = b.data;
+                return b.hbmp;
+            }
+        }
+    }
+
+    *hDataMapping = nullptr;
+    HBITMAP hbmp = CreateMemoryBitmap(size, hDataMapping);
+    DIBSECTION info{};
+    if (!hbmp || GetObject(hbmp, sizeof(info), &info) != sizeof(info) || !info.dsBm.bmBits) {
+        if (hbmp) {
+            DeleteObject(hbmp);
+        }
+        if (*hDataMapping) {
+            CloseHandle(*hDataMapping);
+            *hDataMapping = nullptr;
+        }
+        return nullptr;
+    }
+    *dataOut = info.dsBm.bmBits;
+    return hbmp;
+}
+
+bool ReturnToBitmapPool(HBITMAP hbmp, HANDLE hDataMapping) {
+    if (!hbmp || !hDataMapping) {
+        return false;
+    }
+    DIBSECTION info{};
+    if (GetObject(hbmp, sizeof(info), &info) != sizeof(info) || !info.dsBm.bmBits) {
+        return false;
+    }
+    // only 32-bit top-down bitmaps, as created by CreateMemoryBitmap
+    if (info.dsBm.bmBitsPixel != 32 || info.dsBmih.biHeight > 0) {
+        return false;
+    }
+    Size size(info.dsBm.bmWidth, info.dsBm.bmHeight);
+    size_t nBytes = PooledBitmapBytes(size);
+    if (nBytes > BITMAP_POOL_MAX_BYTES / 4) {
+        return false;
+    }
+
+    BitmapPool* pool = GetBitmapPool();
+    ScopedCritSec scope(&pool->cs);
+    PooledBitmap b;
+    b.hbmp = hbmp;
+    b.hMap = hDataMapping;
+    b.data = info.dsBm.bmBits;
+    b.size = size;
+    b.returnedAt = GetTickCount();
+    pool->bitmaps.Append(b);
+    pool->nBytes += nBytes;
+    FreeOldestPooledBitmaps(pool, BITMAP_POOL_MAX_BYTES, BITMAP_POOL_MAX_AGE_MS);
+    return true;
+}
+
+void TrimBitmapPool(size_t maxBytes) {
+    BitmapPool* pool = GetBitmapPool();
+    ScopedCritSec scope(&pool->cs);
+    FreeOldestPooledBitmaps(pool, maxBytes, BITMAP_POOL_MAX_AGE_MS);
+}
+
+void GetBitmapPoolStats(int* nBitmaps, size_t* nBytes) {
+    BitmapPool* pool = GetBitmapPool();
+    ScopedCritSec scope(&pool->cs);
+    *nBitmaps = pool->bitmaps.isize();
+    *nBytes = pool->nBytes;
+}
+
 // render the bitmap into the target rectangle (streching and skewing as requird)
 bool BlitHBITMAP(HBITMAP hbmp, HDC hdc, Rect target) {
     HDC bmpDC = CreateCompatibleDC(hdc);
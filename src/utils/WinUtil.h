@@ -193,7 +193,10 @@ class DoubleBuffer {
     ~DoubleBuffer();
 
     HDC GetDC() const;
+    Rect GetRect() const;
     void Flush(HDC hdc);
+    // only copies r (in the target's coordinates)
+    void Flush(HDC hdc, Rect r);
 };
 
 class DeferWinPosHelper {
@@ -226,10 +229,28 @@ BitmapPixels* GetBitmapPixels(HBITMAP hbmp);
 void FinalizeBitmapPixels(BitmapPixels* bitmapPixels);
 COLORREF GetPixel(BitmapPixels* bitmap, int x, int y);
 void UpdateBitmapColors(HBITMAP hbmp, COLORREF textColor, COLORREF bgColor);
+// returns false if a sparse sample of the w * h 4-byte pixels (RGBx or, if isBgr
+// is true, BGRx) already has more than 256 colors (i.e. ConvertToPalette would fail)
+bool MayConvertToPalette(const u8* src, int w, int h, bool isBgr);
+// converts w * h 4-byte pixels (RGBx or, if isBgr is true, BGRx) into 8-bit
+// indexes into palette (rows of dst are dstStride bytes apart). Returns the
+// number of palette entries used or -1 if there are more than 256 colors
+int ConvertToPalette(const u8* src, int w, int h, bool isBgr, u8* dst, int dstStride, RGBQUAD palette[256]);
 unsigned char* SerializeBitmap(HBITMAP hbmp, size_t* bmpBytesOut);
 HBITMAP CreateMemoryBitmap(Size size, HANDLE* hDataMapping = nullptr);
+// like CreateMemoryBitmap but re-uses a bitmap of the same size from the
+// bitmap pool if there is one (whose pixels are not cleared)
+HBITMAP CreatePooledMemoryBitmap(Size size, HANDLE* hDataMapping, void** dataOut);
+// gives a 32-bit top-down DIB section and its file mapping to the bitmap pool,
+// returns false if it doesn't want them (the caller still owns them then)
+bool ReturnToBitmapPool(HBITMAP hbmp, HANDLE hDataMapping);
+// frees the pooled bitmaps until there are at most maxBytes of them left
+void TrimBitmapPool(size_t maxBytes = 0);
+void GetBitmapPoolStats(int* nBitmaps, size_t* nBytes);
 bool BlitHBITMAP(HBITMAP hbmp, HDC hdc, Rect target);
 double GetProcessRunningTime();
+// true if AVX2 instructions can be used (by the CPU and the OS)
+bool CpuHasAVX2();
 
 void RunNonElevated(const WCHAR* exePath);
 void VariantInitBstr(VARIANT& urlVar, const WCHAR* s);
@@ -9,6 +9,7 @@
 #include "utils/ScopedWin.h"
 #include "utils/DirIter.h"
 #include "utils/FileUtil.h"
+#include "utils/ThreadUtil.h"
 
 extern "C" {
 #include <unarr.h>
@@ -56,19 +57,67 @@ class FileWriteStream : public ISequentialStream {
     }
 };
 
+// large files are split into chunks of this size which are compressed
+// independently and concatenated (as done by pigz). each chunk but the first
+// uses the data preceding it as dictionary, so that splitting costs very
+// little compression
+#define ZIP_CHUNK_SIZE (1024 * 1024)
+#define ZIP_DICT_SIZE (32 * 1024)
+
+struct ZipCreatorChunk {
+    const u8* data = nullptr;
+    size_t size = 0;
+    // the dictionary are the dictSize bytes before data
+    size_t dictSize = 0;
+    bool isLast = false;
+    int level = Z_DEFAULT_COMPRESSION;
+    // set by whoever compresses the chunk (a pool thread or Finish())
+    LONG claimed = 0;
+
+    bool ok = false;
+    uLong crc = 0;
+    str::Str compressed;
+};
+
+struct ZipCreatorEntry {
+    AutoFree nameUtf8;
+    uint32_t dosdate = 0;
+    AutoFree data;
+    // empty for stored files
+    Vec<ZipCreatorChunk*> chunks;
+
+    ~ZipCreatorEntry() {
+        DeleteVecMembers(chunks);
+    }
+};
+
 ZipCreator::ZipCreator(const WCHAR* zipFilePath) : bytesWritten(0), fileCount(0) {
     stream = new FileWriteStream(zipFilePath);
+    token = new CancelToken();
 }
 
 ZipCreator::ZipCreator(ISequentialStream* stream) : bytesWritten(0), fileCount(0) {
     stream->AddRef();
     this->stream = stream;
+    token = new CancelToken();
 }
 
 ZipCreator::~ZipCreator() {
+    // wait for chunks that are being compressed before freeing their data
+    token->Cancel();
+    token->Wait();
+    token->Release();
+    DeleteVecMembers(entries);
     stream->Release();
 }
 
+void ZipCreator::SetCompressionLevel(int level) {
+    CrashIf(level < Z_DEFAULT_COMPRESSION || level > Z_BEST_COMPRESSION);
+    if (level >= Z_DEFAULT_COMPRESSION && level <= Z_BEST_COMPRESSION) {
+        compressionLevel = level;
+    }
+}
+
 bool ZipCreator::WriteData(const void* data, size_t size) {
     ULONG written = 0;
     HRESULT res = stream->Write(data, (ULONG)size, &written);
@@ -78,49 +127,111 @@ bool ZipCreator::WriteData(const void* data, size_t size) {
     return true;
 }
 
-static uint32_t zip_compress(void* dst, uint32_t dstlen, const void* src, uint32_t srclen) {
+// compresses a chunk into a raw deflate stream which can be concatenated
+// with the streams of the following chunks (only the last one is finished)
+static void CompressChunk(ZipCreatorChunk* c) {
+    c->crc = crc32(0, c->data, (uInt)c->size);
+
     z_stream stream = {0};
-    stream.next_in = (Bytef*)src;
-    stream.avail_in = srclen;
-    stream.next_out = (Bytef*)dst;
-    stream.avail_out = dstlen;
-
-    uint32_t newdstlen = 0;
-    int err = deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
-    if (err != Z_OK)
-        return 0;
-    err = deflate(&stream, Z_FINISH);
-    if (Z_STREAM_END == err)
-        newdstlen = stream.total_out;
-    err = deflateEnd(&stream);
-    if (err != Z_OK)
-        return 0;
-    return newdstlen;
-}
-
-bool ZipCreator::AddFileData(const char* nameUtf8, const void* data, size_t size, uint32_t dosdate) {
+    int err = deflateInit2(&stream, c->level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+    if (err != Z_OK) {
+        return;
+    }
+    if (c->dictSize > 0) {
+        err = deflateSetDictionary(&stream, c->data - c->dictSize, (uInt)c->dictSize);
+    }
+    // + 16 for the empty block of Z_SYNC_FLUSH
+    size_t outSize = deflateBound(&stream, (uLong)c->size) + 16;
+    char* out = c->compressed.AppendBlanks(outSize);
+    if (err == Z_OK && out) {
+        stream.next_in = (Bytef*)c->data;
+        stream.avail_in = (uInt)c->size;
+        stream.next_out = (Bytef*)out;
+        stream.avail_out = (uInt)outSize;
+        err = deflate(&stream, c->isLast ? Z_FINISH : Z_SYNC_FLUSH);
+        c->ok = (c->isLast ? Z_STREAM_END == err : Z_OK == err) && stream.avail_in == 0;
+        c->compressed.RemoveAt(stream.total_out, outSize - stream.total_out);
+    }
+    deflateEnd(&stream);
+}
+
+static void CompressChunkOnce(ZipCreatorChunk* c) {
+    if (InterlockedCompareExchange(&c->claimed, 1, 0) == 0) {
+        CompressChunk(c);
+    }
+}
+
+// files in these formats are already compressed and are stored as is
+static bool IsCompressedFormat(const char* nameUtf8) {
+    static const char* exts[] = {".jpg",  ".jpeg", ".png", ".gif", ".webp", ".jp2", ".zip", ".cbz", ".epub",
+                                 ".docx", ".xlsx", ".rar", ".cbr", ".7z",   ".cb7", ".gz",  ".bz2", ".xz"};
+    for (const char* ext : exts) {
+        if (str::EndsWithI(nameUtf8, ext)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// takes ownership of data. queues the compression of the file's
+// chunks, the file is written by Finish()
+bool ZipCreator::AddFileData(const char* nameUtf8, std::string_view data, uint32_t dosdate) {
+    auto e = new ZipCreatorEntry();
+    e->data = data;
+    e->nameUtf8.SetCopy(nameUtf8);
+    e->dosdate = dosdate;
+    size_t size = data.size();
     CrashIf(size >= UINT32_MAX);
     CrashIf(str::Len(nameUtf8) >= UINT16_MAX);
-    if (size >= UINT32_MAX)
+    if (size >= UINT32_MAX || str::Len(nameUtf8) >= UINT16_MAX) {
+        delete e;
         return false;
+    }
+    entries.Append(e);
+
+    if (compressionLevel == 0 || size == 0 || IsCompressedFormat(nameUtf8)) {
+        return true;
+    }
+    const u8* d = (const u8*)e->data.get();
+    for (size_t off = 0; off < size; off += ZIP_CHUNK_SIZE) {
+        auto c = new ZipCreatorChunk();
+        c->data = d + off;
+        c->size = std::min(size - off, (size_t)ZIP_CHUNK_SIZE);
+        c->dictSize = std::min(off, (size_t)ZIP_DICT_SIZE);
+        c->isLast = off + c->size == size;
+        c->level = compressionLevel;
+        e->chunks.Append(c);
+        QueueWork(WorkPriority::Background, [c] { CompressChunkOnce(c); }, token);
+    }
+    return true;
+}
+
+bool ZipCreator::WriteEntry(ZipCreatorEntry* e) {
+    const char* nameUtf8 = e->nameUtf8.get();
+    const u8* data = (const u8*)e->data.get();
+    size_t size = e->data.size();
 
     size_t fileOffset = bytesWritten;
     uint16_t flags = (1 << 11); // filename is UTF-8
-    uInt crc = crc32(0, (const Bytef*)data, (uInt)size);
     size_t namelen = str::Len(nameUtf8);
-    if (namelen >= UINT16_MAX)
-        return false;
 
+    // rather store files that don't get any smaller
     uint16_t method = Z_DEFLATED;
-    uLongf compressedSize = (uint32_t)size;
-    AutoFree compressed((char*)malloc(size));
-    if (!compressed)
-        return false;
-    compressedSize = zip_compress(compressed, (uint32_t)size, data, (uint32_t)size);
-    if (!compressedSize) {
+    uLong crc = 0;
+    size_t compressedSize = 0;
+    for (ZipCreatorChunk* c : e->chunks) {
+        crc = crc32_combine(crc, c->crc, (z_off_t)c->size);
+        compressedSize += c->compressed.size();
+        if (!c->ok) {
+            method = 0;
+        }
+    }
+    if (e->chunks.size() == 0) {
+        crc = crc32(0, data, (uInt)size);
+    }
+    if (e->chunks.size() == 0 || compressedSize >= size) {
         method = 0; // Store
-        memcpy(compressed.Get(), data, size);
-        compressedSize = (uint32_t)size;
+        compressedSize = size;
     }
 
     char localHeader[30];
@@ -130,14 +241,20 @@ bool ZipCreator::AddFileData(const char* nameUtf8, const void* data, size_t size
     local.Write16(flags);
     local.Write16(method);
     local.Write32(dosdate);
-    local.Write32(crc);
-    local.Write32(compressedSize);
+    local.Write32((uint32_t)crc);
+    local.Write32((uint32_t)compressedSize);
     local.Write32((uint32_t)size);
     local.Write16((uint16_t)namelen);
     local.Write16(0); // extra field length
 
-    bool ok = WriteData(localHeader, sizeof(localHeader)) && WriteData(nameUtf8, namelen) &&
-              WriteData(compressed, compressedSize);
+    bool ok = WriteData(localHeader, sizeof(localHeader)) && WriteData(nameUtf8, namelen);
+    if (method == 0) {
+        ok = ok && WriteData(data, size);
+    } else {
+        for (ZipCreatorChunk* c : e->chunks) {
+            ok = ok && WriteData(c->compressed.Get(), c->compressed.size());
+        }
+    }
 
     ByteWriter central = MakeByteWriterLE(centraldir.AppendBlanks(46), 46);
     central.Write32(0x02014B50); // signature
@@ -146,8 +263,8 @@ bool ZipCreator::AddFileData(const char* nameUtf8, const void* data, size_t size
     central.Write16(flags);
     central.Write16(method);
     central.Write32(dosdate);
-    central.Write32(crc);
-    central.Write32(compressedSize);
+    central.Write32((uint32_t)crc);
+    central.Write32((uint32_t)compressedSize);
     central.Write32((uint32_t)size);
     central.Write16((uint16_t)namelen);
     central.Write16(0); // extra field length
@@ -186,7 +303,9 @@ bool ZipCreator::AddFile(const WCHAR* filePath, const WCHAR* nameInZip) {
     AutoFree nameUtf8 = strconv::WstrToUtf8(nameInZip);
     str::TransChars(nameUtf8.get(), "\\", "/");
 
-    return AddFileData(nameUtf8.get(), fileData.get(), fileData.size(), dosdatetime);
+    std::string_view data = {fileData.data, fileData.len};
+    fileData.data = nullptr;
+    return AddFileData(nameUtf8.get(), data, dosdatetime);
 }
 
 // we use the filePath relative to dir as the zip name
@@ -209,6 +328,25 @@ bool ZipCreator::AddDir(const WCHAR* dirPath, bool recursive) {
 }
 
 bool ZipCreator::Finish() {
+    // compress the chunks that no pool thread has started on yet ourselves
+    // (this also avoids waiting for the pool from a pool thread) and
+    // wait for the others
+    for (ZipCreatorEntry* e : entries) {
+        for (ZipCreatorChunk* c : e->chunks) {
+            CompressChunkOnce(c);
+        }
+    }
+    token->Wait();
+
+    bool ok = true;
+    for (ZipCreatorEntry* e : entries) {
+        ok = ok && WriteEntry(e);
+    }
+    DeleteVecMembers(entries);
+    if (!ok) {
+        return false;
+    }
+
     CrashIf(bytesWritten >= UINT32_MAX);
     CrashIf(fileCount >= UINT16_MAX);
     if (bytesWritten >= UINT32_MAX || fileCount >= UINT16_MAX)
@@ -6,20 +6,35 @@ typedef struct ar_stream_s ar_stream;
 typedef struct ar_archive_s ar_archive;
 }
 
+class CancelToken;
+struct ZipCreatorEntry;
+
+// files are compressed on the thread pool while more of them are being added
+// (large files in independently compressed chunks) and written out in the order
+// they were added by Finish()
 class ZipCreator {
     ISequentialStream* stream;
     str::Str centraldir;
     size_t bytesWritten;
     size_t fileCount;
+    // zlib compression level (0 stores all files)
+    int compressionLevel = -1;
+    Vec<ZipCreatorEntry*> entries;
+    CancelToken* token = nullptr;
 
     bool WriteData(const void* data, size_t size);
-    bool AddFileData(const char* nameUtf8, const void* data, size_t size, uint32_t dosdate = 0);
+    bool AddFileData(const char* nameUtf8, std::string_view data, uint32_t dosdate = 0);
+    bool WriteEntry(ZipCreatorEntry* e);
 
   public:
     ZipCreator(const WCHAR* zipFilePath);
     ZipCreator(ISequentialStream* stream);
     ~ZipCreator();
 
+    // level is from 0 (store) to 9 (best), -1 is zlib's default.
+    // applies to the files added after the call
+    void SetCompressionLevel(int level);
+
     bool AddFile(const WCHAR* filePath, const WCHAR* nameInZip = nullptr);
     bool AddFileFromDir(const WCHAR* filePath, const WCHAR* dir);
     bool AddDir(const WCHAR* dirPath, bool recursive = false);
@@ -0,0 +1,71 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/AhoCorasick.h"
+
+// must be last due to assert() over-write
+#include "utils/UtAssert.h"
+
+struct AhoCorasickMatch {
+    int pattern;
+    int start;
+};
+
+static void FindAllMatches(AhoCorasick& ac, const WCHAR* text, Vec<AhoCorasickMatch>& matches) {
+    matches.Reset();
+    ac.FindAll(text, (int)str::Len(text), [&](int pattern, int start) { matches.Append({pattern, start}); });
+}
+
+void AhoCorasickTest() {
+    Vec<AhoCorasickMatch> matches;
+
+    {
+        AhoCorasick ac;
+        ac.Build();
+        FindAllMatches(ac, L"nothing to find", matches);
+        utassert(matches.size() == 0);
+    }
+
+    {
+        AhoCorasick ac;
+        utassert(0 == ac.AddPattern(L"he"));
+        utassert(1 == ac.AddPattern(L"she"));
+        utassert(2 == ac.AddPattern(L"his"));
+        utassert(3 == ac.AddPattern(L"hers"));
+        // duplicate and empty patterns aren't added
+        utassert(1 == ac.AddPattern(L"she"));
+        utassert(-1 == ac.AddPattern(L""));
+        utassert(4 == ac.PatternsCount());
+        utassert(4 == ac.PatternLen(3));
+        ac.Build();
+
+        FindAllMatches(ac, L"ushers", matches);
+        utassert(matches.size() == 3);
+        utassert(matches.at(0).pattern == 1 && matches.at(0).start == 1);
+        utassert(matches.at(1).pattern == 0 && matches.at(1).start == 2);
+        utassert(matches.at(2).pattern == 3 && matches.at(2).start == 2);
+
+        FindAllMatches(ac, L"ahishe", matches);
+        utassert(matches.size() == 3);
+        utassert(matches.at(0).pattern == 2 && matches.at(0).start == 1);
+        utassert(matches.at(1).pattern == 1 && matches.at(1).start == 3);
+        utassert(matches.at(2).pattern == 0 && matches.at(2).start == 4);
+
+        FindAllMatches(ac, L"HERS", matches);
+        utassert(matches.size() == 0);
+    }
+
+    {
+        // overlapping occurrences of the same pattern and non-ASCII characters
+        AhoCorasick ac;
+        ac.AddPattern(L"aa");
+        ac.AddPattern(L"\x00e4\x00df");
+        ac.Build();
+        FindAllMatches(ac, L"aaa \x00e4\x00df", matches);
+        utassert(matches.size() == 3);
+        utassert(matches.at(0).pattern == 0 && matches.at(0).start == 0);
+        utassert(matches.at(1).pattern == 0 && matches.at(1).start == 1);
+        utassert(matches.at(2).pattern == 1 && matches.at(2).start == 4);
+    }
+}
@@ -111,12 +111,45 @@ static void PoolAllocatorTest() {
     PoolAllocatorStringsTest(a, 2048);
 }
 
+static void ArenaAllocatorTest() {
+    ArenaAllocator a;
+    a.minChunkSize = 1024;
+    ArenaAllocator::Mark empty = a.GetMark();
+
+    // growing a Vec in the arena reallocs its most recent allocation in place
+    Vec<int> v(0, &a);
+    for (int i = 0; i < 10000; i++) {
+        v.Append(i);
+    }
+    for (int i = 0; i < 10000; i++) {
+        utassert(v.at(i) == i);
+    }
+
+    {
+        ScopedArenaMark mark(&a);
+        char* s = Allocator::StrDup(&a, "a string");
+        char* s2 = (char*)Allocator::Realloc(&a, s, 4096);
+        utassert(str::Eq(s2, "a string"));
+        for (int i = 0; i < 100; i++) {
+            utassert(a.Alloc(100) != nullptr);
+        }
+    }
+    // the Vec's memory is still intact
+    utassert(v.at(9999) == 9999);
+
+    v.Reset();
+    a.ResetTo(empty);
+    utassert(a.curr && !a.curr->prev && a.curr->used == 0);
+    utassert(GetThreadArena() == GetThreadArena());
+}
+
 static int roundUpTestCases[] = {
     0, 0, 1, 8, 2, 8, 3, 8, 4, 8, 5, 8, 6, 8, 7, 8, 8, 8, 9, 16,
 };
 
 void BaseUtilTest() {
     PoolAllocatorTest();
+    ArenaAllocatorTest();
 
     size_t n = dimof(roundUpTestCases) / 2;
     for (size_t i = 0; i < n; i++) {
@@ -3,6 +3,7 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/CryptoUtil.h"
+#include "utils/FileUtil.h"
 
 // must be last due to assert() over-write
 #include "utils/UtAssert.h"
@@ -28,7 +29,41 @@ static bool TestDigestSHA2(const char* data, size_t size, const char* verify) {
     return str::Eq(hash, verify);
 }
 
+static void TestFileFingerprint() {
+    AutoFreeWstr path(path::GetTempPath(L"Fpt"));
+    utassert(path);
+    if (!path) {
+        return;
+    }
+    size_t size = 1024 * 1024;
+    ScopedMem<char> data((char*)calloc(size, 1));
+    utassert(file::WriteFile(path, {data.Get(), size}));
+
+    unsigned char digest1[16], digest2[16];
+    utassert(CalcFileFingerprint(path, digest1));
+    utassert(CalcFileFingerprint(path, digest2));
+    utassert(memeq(digest1, digest2, sizeof(digest1)));
+
+    // the first block is always sampled
+    data.Get()[10] = 'x';
+    utassert(file::WriteFile(path, {data.Get(), size}));
+    utassert(CalcFileFingerprint(path, digest2));
+    utassert(!memeq(digest1, digest2, sizeof(digest1)));
+
+    // so are very small files
+    utassert(file::WriteFile(path, {"a", 1}));
+    utassert(CalcFileFingerprint(path, digest1));
+    utassert(file::WriteFile(path, {"b", 1}));
+    utassert(CalcFileFingerprint(path, digest2));
+    utassert(!memeq(digest1, digest2, sizeof(digest1)));
+
+    file::Delete(path);
+    utassert(!CalcFileFingerprint(path, digest1));
+}
+
 void CryptoUtilTest() {
+    TestFileFingerprint();
+
     utassert(TestDigestMD5("", 0, "d41d8cd98f00b204e9800998ecf8427e"));
     utassert(TestDigestMD5("The quick brown fox jumps over the lazy dog", 43, "9e107d9d372bb6826bd81d3542a419d6"));
     utassert(TestDigestMD5("The quick brown fox jumps over the lazy dog.", 44, "e4d909c290d0fb1ca068ffaddf22cbd0"));
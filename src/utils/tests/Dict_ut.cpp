@@ -70,13 +70,46 @@ void DictTestMapStrToInt() {
         CrashIf(!ok);
         CrashIf(i != val);
     }
-    for (const char* k : toRemove) {
-        ok = d.Remove(k, nullptr);
+    // removing entries moves others around, which must remain findable
+    for (size_t i = 0; i < toRemove.size(); i += 2) {
+        ok = d.Remove(toRemove.at(i), nullptr);
         utassert(ok);
+        ok = d.Get(toRemove.at(i), &val);
+        utassert(!ok);
     }
+    for (size_t i = 1; i < toRemove.size(); i += 2) {
+        ok = d.Get(toRemove.at(i), &val);
+        utassert(ok);
+        ok = d.Remove(toRemove.at(i), nullptr);
+        utassert(ok);
+    }
+    utassert(0 == d.Count());
     toRemove.FreeMembers();
 }
 
+static void DictTestMapWStrToInt() {
+    dict::MapWStrToInt d(4);
+    bool ok;
+    int val;
+
+    for (int i = 0; i < 100; i++) {
+        AutoFreeWstr k(str::Format(L"key%d", i));
+        ok = d.Insert(k, i, nullptr);
+        utassert(ok);
+    }
+    utassert(100 == d.Count());
+    ok = d.Insert(L"key42", 0, &val);
+    utassert(!ok && val == 42);
+    ok = d.Remove(L"key42", &val);
+    utassert(ok && val == 42);
+    ok = d.Get(L"key42", &val);
+    utassert(!ok);
+    ok = d.Get(L"key99", &val);
+    utassert(ok && val == 99);
+    utassert(99 == d.Count());
+}
+
 void DictTest() {
     DictTestMapStrToInt();
+    DictTestMapWStrToInt();
 }
@@ -108,6 +108,27 @@ static void Test03() {
     utassert(!t);
 }
 
+// long runs of text, whitespace and attribute values are scanned 16 bytes at a time
+static void Test04() {
+    const char* s =
+        "<p   \t\r\n              a1='a value with > and \" that is quite long'"
+        "                    foo=bar\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t/><!-- a comment - with dashes -- that "
+        "goes on for a while -->A text that is longer than sixteen characters<b>";
+    HtmlPullParser parser(s, str::Len(s));
+    HtmlToken* t = parser.Next();
+    utassert(t && t->IsEmptyElementEndTag() && Tag_P == t->tag);
+    AttrInfo* a = t->GetAttrByName("a1");
+    utassert(a && a->ValIs("a value with > and \" that is quite long"));
+    a = t->GetAttrByName("foo");
+    utassert(a && a->ValIs("bar"));
+    t = parser.Next();
+    utassert(t && t->IsText() && str::EqNIx(t->s, t->sLen, "A text that is longer than sixteen characters"));
+    t = parser.Next();
+    utassert(t && t->IsStartTag() && Tag_B == t->tag);
+    t = parser.Next();
+    utassert(!t);
+}
+
 void HtmlPullParser_UnitTests() {
     Test00("<p a1='>' foo=bar />", HtmlToken::EmptyElementTag);
     Test00("<p a1 ='>'     foo=\"bar\"/>", HtmlToken::EmptyElementTag);
@@ -118,4 +139,5 @@ void HtmlPullParser_UnitTests() {
     Test01();
     Test02();
     Test03();
+    Test04();
 }
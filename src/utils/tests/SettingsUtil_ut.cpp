@@ -200,4 +200,24 @@ Key = Value";
         utassert(data->boolean == ((i % 2) == 0));
         FreeStruct(&gSutStructInfo, data);
     }
+
+    // a binary snapshot must deserialize to the same values
+    data = (SutStruct*)DeserializeStruct(&gSutStructInfo, serialized);
+    size_t binSize = 0;
+    AutoFree bin(SerializeStructBin(&gSutStructInfo, data, &binSize));
+    FreeStruct(&gSutStructInfo, data);
+    data = (SutStruct*)DeserializeStructBin(&gSutStructInfo, {bin.Get(), binSize});
+    utassert(data && !data->nullString && !data->nullUtf8String);
+    utassert(data->sutStructItems && 2 == data->sutStructItems->size());
+    char* reserialized = SerializeStruct(&gSutStructInfo, data, unknownOnly);
+    utassert(str::Eq(serialized, reserialized));
+    free(reserialized);
+    FreeStruct(&gSutStructInfo, data);
+    // truncated or modified snapshots are rejected
+    utassert(!DeserializeStructBin(&gSutStructInfo, {bin.Get(), binSize - 1}));
+    bin.Get()[binSize - 1] ^= 1;
+    utassert(!DeserializeStructBin(&gSutStructInfo, {bin.Get(), binSize}));
+    bin.Get()[binSize - 1] ^= 1;
+    // as are snapshots of a different struct
+    utassert(!DeserializeStructBin(&gSutStructItemInfo, {bin.Get(), binSize}));
 }
@@ -155,6 +155,20 @@ void SquareTreeTest() {
     }
     utassert(node && 1 == node->data.size() && str::Eq(node->GetValue("depth"), "5"));
 
+    // lines longer than the 16 bytes that are scanned at once
+    SquareTree longLines(UTF8_BOM "a rather long key name = C:\\Users\\Some User\\Documents\\file.pdf\n"
+                                  "another.long.key.name.without.separator\n"
+                                  "x = 0123456789012345678901234567890\n"
+                                  "child.node.with.a.long.name [\n the key = the value\n]\n"
+                                  "last = 0123456789abcdef");
+    utassert(longLines.root && 5 == longLines.root->data.size());
+    utassert(str::Eq(longLines.root->GetValue("a rather long key name"), "C:\\Users\\Some User\\Documents\\file.pdf"));
+    utassert(str::Eq(longLines.root->GetValue("another.long.key.name.without.separator"), ""));
+    utassert(str::Eq(longLines.root->GetValue("x"), "0123456789012345678901234567890"));
+    node = longLines.root->GetChild("child.node.with.a.long.name");
+    utassert(node && str::Eq(node->GetValue("the key"), "the value"));
+    utassert(str::Eq(longLines.root->GetValue("last"), "0123456789abcdef"));
+
     SquareTree mixed(UTF8_BOM "node1 [\n [node2] \n key:value");
     utassert(mixed.root && mixed.root->GetChild("node1") && mixed.root->GetChild("node2"));
     utassert(0 == mixed.root->GetChild("node1")->data.size());
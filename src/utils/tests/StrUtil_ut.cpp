@@ -118,6 +118,25 @@ static void StrConvTest() {
     utassert(conv == 0 && str::Eq(cbuf, ""));
     conv = strconv::WcharToUtf8Buf(L"abcd", cbuf, dimof(cbuf));
     utassert(conv == 0 && str::Eq(cbuf, ""));
+
+    // long enough for the SSE2 code paths, with non-ASCII text at the end
+    const WCHAR* ws = L"0123456789abcdefghijklmnopqrstuvwxyz\u00E4\u20AC\U0001F600";
+    const char* s = "0123456789abcdefghijklmnopqrstuvwxyz\xC3\xA4\xE2\x82\xAC\xF0\x9F\x98\x80";
+    AutoFree u = strconv::WstrToUtf8(ws);
+    utassert(u.size() == str::Len(s) && str::Eq(u.Get(), s));
+    AutoFreeWstr w(strconv::Utf8ToWstr(s));
+    utassert(str::Eq(w.Get(), ws));
+    PoolAllocator a;
+    std::string_view sv = strconv::WstrToUtf8(L"0123456789abcdefghijklmnopqrstuvwxyz", (size_t)-1, &a);
+    utassert(sv.size() == 36 && str::Eq(sv.data(), "0123456789abcdefghijklmnopqrstuvwxyz"));
+    // results much shorter than the worst case (PoolAllocator can't reallocate)
+    const char* cjk = "\xE4\xB8\xAD\xE6\x96\x87\xE4\xB8\xAD\xE6\x96\x87\xE4\xB8\xAD\xE6\x96\x87";
+    WCHAR* wcjk = strconv::Utf8ToWstr(cjk, &a);
+    utassert(str::Eq(wcjk, L"\u4E2D\u6587\u4E2D\u6587\u4E2D\u6587"));
+    sv = strconv::WstrToUtf8(L"\u00E40123456789abcdefghijklmnopqrstuvwxyz", (size_t)-1, &a);
+    utassert(sv.size() == 38 && str::Eq(sv.data(), "\xC3\xA4" "0123456789abcdefghijklmnopqrstuvwxyz"));
+    AutoFree same = strconv::ToMultiByte("0123456789abcdefghijklmnopqrstuvwxyz", 1252, CP_UTF8);
+    utassert(str::Eq(same.Get(), "0123456789abcdefghijklmnopqrstuvwxyz"));
 }
 
 static void StrUrlExtractTest() {
@@ -220,6 +239,17 @@ void StrTest() {
         utassert(str::Eq(str, large));
         free(str);
     }
+    {
+        str::FmtBuf<WCHAR, 16> s(L"%d / %d", 3, 14);
+        utassert(s.Get() == s.buf && str::Eq(s, L"3 / 14") && s.size() == 6);
+        str::FmtBuf<WCHAR, 16> s2(L"%s and %s", buf, buf);
+        utassert(s2.Get() != s2.buf && str::Len(s2) == 2 * str::Len(buf) + 5);
+        str::FmtBuf<char, 8> s3("%s-%d", "page", 12345);
+        utassert(s3.Get() != s3.buf && str::Eq(s3, "page-12345"));
+        WCHAR small[8];
+        utassert(str::BufFmt(small, dimof(small), L"%d", 1234567));
+        utassert(!str::BufFmt(small, dimof(small), L"%d", 12345678) && str::Len(small) == 7);
+    }
 #if 0
     // TODO: this test slows down DEBUG builds significantly
     str = str::Format(L"%s", L"\uFFFF");
@@ -131,7 +131,7 @@ struct Num {
 
 static void VecSegmentedTest() {
     VecSegmented<Num> vec;
-    int nTotal = 1033;
+    int nTotal = 5033;
     for (int i = 0; i < nTotal; i++) {
         vec.Append(Num{i, i + 1});
     }
@@ -142,6 +142,12 @@ static void VecSegmentedTest() {
         utassert(n->n2 == i + 1);
         ++i;
     }
+    // random access spanning several index chunks
+    for (i = nTotal - 1; i >= 0; i -= 7) {
+        Num* n = vec.AtPtr(i);
+        utassert(n->n == i);
+        utassert(n->n2 == i + 1);
+    }
 }
 
 void VecTest() {
@@ -304,6 +310,40 @@ void VecTest() {
         utassert(v.size() == 3);
     }
 
+    {
+        // moving steals heap-allocated elements and copies inline ones
+        Vec<int> v;
+        for (int i = 0; i < 100; i++) {
+            v.Append(i);
+        }
+        int* data = v.LendData();
+        Vec<int> v2(std::move(v));
+        utassert(v2.size() == 100 && v2.LendData() == data && v2.at(99) == 99);
+        utassert(v.size() == 0 && v.LendData() != data);
+        v.Append(5);
+        v2 = std::move(v);
+        utassert(v2.size() == 1 && v2.at(0) == 5 && v.size() == 0);
+        v2.Append(6);
+        utassert(v2.size() == 2 && v2.at(1) == 6);
+
+        str::Str s("moved");
+        str::Str s2(std::move(s));
+        utassert(str::Eq(s2.Get(), "moved") && s.size() == 0);
+    }
+
+    {
+        Vec<int, 4> v;
+        int* inlineData = v.LendData();
+        for (int i = 0; i < 3; i++) {
+            v.Append(i);
+        }
+        utassert(v.LendData() == inlineData);
+        v.Append(3);
+        utassert(v.LendData() != inlineData && v.size() == 4 && v.at(3) == 3);
+        bool ok = v.Reserve(100);
+        utassert(ok && v.size() == 4);
+    }
+
     WStrVecTest();
     StrListTest();
     VecStrTest();
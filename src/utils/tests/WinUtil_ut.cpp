@@ -38,6 +38,37 @@ void WinUtilTest() {
         utassert(allScreens.Intersect(oneScreen) == oneScreen);
     }
 
+    {
+        const int w = 37, h = 23;
+        Vec<u8> pixels;
+        for (int i = 0; i < w * h; i++) {
+            u8 v = (u8)(i % 3 == 0 ? 0x10 : i % 5 == 0 ? 0x80 : 0xff);
+            pixels.Append(v);
+            pixels.Append(v);
+            pixels.Append(i % 7 == 0 ? 0 : v);
+            pixels.Append(0xff);
+        }
+        utassert(MayConvertToPalette(pixels.LendData(), w, h, true));
+        const int stride = (w + 3) / 4 * 4;
+        u8 dst[stride * h];
+        RGBQUAD palette[256];
+        int n = ConvertToPalette(pixels.LendData(), w, h, true, dst, stride, palette);
+        utassert(n > 0 && n <= 6);
+        for (int i = 0; i < w * h; i++) {
+            RGBQUAD c = palette[dst[(i / w) * stride + i % w]];
+            u8* p = pixels.LendData() + i * 4;
+            utassert(c.rgbBlue == p[0] && c.rgbGreen == p[1] && c.rgbRed == p[2]);
+        }
+
+        // more than 256 colors (but too few of them sampled by MayConvertToPalette)
+        for (int i = 0; i < w * h; i++) {
+            pixels.at(i * 4) = (u8)i;
+            pixels.at(i * 4 + 1) = (u8)(i >> 8);
+        }
+        utassert(MayConvertToPalette(pixels.LendData(), w, h, false));
+        utassert(ConvertToPalette(pixels.LendData(), w, h, false, dst, stride, palette) == -1);
+    }
+
     // TODO: moved AdjustLigthness() to Colors.[h|cpp] which is outside of utils directory
 #if 0
     {
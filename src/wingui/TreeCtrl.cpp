@@ -50,12 +50,16 @@ static void DispatchMouseDuringDrag(void* user, WndEvent* ev) {
     w->HandleMouseDuringDrag(ev);
 }
 
-static void TreeViewExpandRecursively(HWND hTree, HTREEITEM hItem, UINT flag, bool subtree) {
+static void TreeViewExpandRecursively(TreeCtrl* tree, HTREEITEM hItem, UINT flag, bool subtree) {
+    HWND hTree = tree->hwnd;
     while (hItem) {
+        if (flag == TVE_EXPAND) {
+            tree->EnsureChildrenInserted(hItem);
+        }
         TreeView_Expand(hTree, hItem, flag);
         HTREEITEM child = TreeView_GetChild(hTree, hItem);
         if (child) {
-            TreeViewExpandRecursively(hTree, child, flag, false);
+            TreeViewExpandRecursively(tree, child, flag, false);
         }
         if (subtree) {
             break;
@@ -87,6 +91,7 @@ static TVITEMW* GetTVITEM(TreeCtrl* tree, TreeItem* ti) {
 // expand if collapse, collapse if expanded
 static void TreeViewToggle(TreeCtrl* tree, HTREEITEM hItem, bool recursive) {
     HWND hTree = tree->hwnd;
+    tree->EnsureChildrenInserted(hItem);
     HTREEITEM child = TreeView_GetChild(hTree, hItem);
     if (!child) {
         // only applies to nodes with children
@@ -103,7 +108,7 @@ static void TreeViewToggle(TreeCtrl* tree, HTREEITEM hItem, bool recursive) {
         flag = TVE_COLLAPSE;
     }
     if (recursive) {
-        TreeViewExpandRecursively(hTree, hItem, flag, false);
+        TreeViewExpandRecursively(tree, hItem, flag, false);
     } else {
         TreeView_Expand(hTree, hItem, flag);
     }
@@ -155,6 +160,11 @@ void TreeCtrl::HandleWM_NOTIFY(WndEvent* ev) {
     CrashIf(GetParent(treeCtrl->hwnd) != (HWND)ev->hwnd);
 
     NMTREEVIEWW* nmtv = (NMTREEVIEWW*)(lp);
+    // https://docs.microsoft.com/en-us/windows/win32/controls/tvn-itemexpanding
+    if (nmtv->hdr.code == TVN_ITEMEXPANDING && nmtv->action == TVE_EXPAND) {
+        // the children must exist before the item is shown expanded
+        treeCtrl->EnsureChildrenInserted(nmtv->itemNew.hItem);
+    }
     if (treeCtrl->onTreeNotify) {
         TreeNotifyEvent a{};
         CopyWndEvent cp(&a, ev);
@@ -321,16 +331,39 @@ void TreeCtrl::HandleWM_NOTIFY(WndEvent* ev) {
     }
 
     // https://docs.microsoft.com/en-us/windows/win32/controls/tvn-getdispinfo
+    // items are inserted with LPSTR_TEXTCALLBACK and I_CHILDRENCALLBACK
+    // so that the text and children are only asked for visible items
     if (code == TVN_GETDISPINFO) {
+        auto* dispInfo = (NMTVDISPINFOEXW*)lp;
+        TVITEMEXW* tvitem = &dispInfo->item;
+        auto* ti = reinterpret_cast<TreeItem*>(tvitem->lParam);
+        if (!ti) {
+            return;
+        }
+        if (tvitem->mask & TVIF_CHILDREN) {
+            tvitem->cChildren = ti->ChildCount() > 0 ? 1 : 0;
+        }
+        if (!(tvitem->mask & TVIF_TEXT)) {
+            return;
+        }
         if (!treeCtrl->onTreeGetDispInfo) {
+            // copy (rather than point to) the text as callers of
+            // TreeView_GetItem() might rely on it being in their buffer
+            WCHAR* text = ti->Text();
+            if (tvitem->pszText && tvitem->cchTextMax > 0) {
+                str::BufSet(tvitem->pszText, tvitem->cchTextMax, text ? text : L"");
+            }
             return;
         }
+        UINT mask = tvitem->mask;
+        tvitem->mask = TVIF_TEXT;
         TreeGetDispInfoEvent a{};
         CopyWndEvent cp(&a, ev);
         a.treeCtrl = treeCtrl;
-        a.dispInfo = (NMTVDISPINFOEXW*)lp;
-        a.treeItem = treeCtrl->GetTreeItemByHandle(a.dispInfo->item.hItem);
+        a.dispInfo = dispInfo;
+        a.treeItem = ti;
         treeCtrl->onTreeGetDispInfo(&a);
+        tvitem->mask = mask;
         return;
     }
 
@@ -558,7 +591,14 @@ bool TreeCtrl::Create(const WCHAR* title) {
     return true;
 }
 
+static int FindInsertedItem(TreeCtrl* tree, TreeItem* ti);
+
 bool TreeCtrl::IsExpanded(TreeItem* ti) {
+    if (FindInsertedItem(this, ti) < 0) {
+        // items are only inserted once their parent is expanded,
+        // so this item can't have been toggled in the tree view yet
+        return ti->IsExpanded();
+    }
     auto state = GetItemState(ti);
     return state.isExpanded;
 }
@@ -595,20 +635,21 @@ void TreeCtrl::SetTextColor(COLORREF col) {
 void TreeCtrl::ExpandAll() {
     SuspendRedraw();
     auto root = TreeView_GetRoot(this->hwnd);
-    TreeViewExpandRecursively(this->hwnd, root, TVE_EXPAND, false);
+    TreeViewExpandRecursively(this, root, TVE_EXPAND, false);
     ResumeRedraw();
 }
 
 void TreeCtrl::CollapseAll() {
     SuspendRedraw();
     auto root = TreeView_GetRoot(this->hwnd);
-    TreeViewExpandRecursively(this->hwnd, root, TVE_COLLAPSE, false);
+    TreeViewExpandRecursively(this, root, TVE_COLLAPSE, false);
     ResumeRedraw();
 }
 
 void TreeCtrl::Clear() {
     treeModel = nullptr;
     insertedItems.Reset();
+    insertedItemsIndex.Reset();
 
     HWND hwnd = this->hwnd;
     ::SendMessage(hwnd, WM_SETREDRAW, FALSE, 0);
@@ -652,25 +693,91 @@ TreeItem* TreeCtrl::GetItemAt(int x, int y) {
     return GetTreeItemByHandle(ht.hItem);
 }
 
-// TODO: speed up by storing the pointer as TVINSERTSTRUCTW.lParam
-HTREEITEM TreeCtrl::GetHandleByTreeItem(TreeItem* item) {
-    for (auto t : this->insertedItems) {
-        auto* i = std::get<0>(t);
-        if (i == item) {
-            return std::get<1>(t);
+static size_t InsertedItemSlot(TreeCtrl* tree, TreeItem* ti) {
+    u64 h = (u64)(uintptr_t)ti * 0x9E3779B97F4A7C15ull;
+    return (size_t)(h >> 32) & (tree->insertedItemsIndex.size() - 1);
+}
+
+// returns index into insertedItems or -1 if ti hasn't been inserted
+static int FindInsertedItem(TreeCtrl* tree, TreeItem* ti) {
+    auto& index = tree->insertedItemsIndex;
+    if (index.size() == 0) {
+        return -1;
+    }
+    for (size_t slot = InsertedItemSlot(tree, ti);; slot = (slot + 1) & (index.size() - 1)) {
+        int idx = index.at(slot);
+        if (0 == idx) {
+            return -1;
+        }
+        if (tree->insertedItems.at(idx - 1).item == ti) {
+            return idx - 1;
         }
     }
-    return nullptr;
 }
 
-TreeItem* TreeCtrl::GetTreeItemByHandle(HTREEITEM item) {
-    for (auto t : this->insertedItems) {
-        auto* i = std::get<1>(t);
-        if (i == item) {
-            return std::get<0>(t);
+static void AddToIndex(TreeCtrl* tree, int idx) {
+    auto& index = tree->insertedItemsIndex;
+    size_t slot = InsertedItemSlot(tree, tree->insertedItems.at(idx).item);
+    while (index.at(slot) != 0) {
+        slot = (slot + 1) & (index.size() - 1);
+    }
+    index.at(slot) = idx + 1;
+}
+
+static void AppendInsertedItem(TreeCtrl* tree, TreeItem* ti, HTREEITEM hItem) {
+    TreeCtrl::InsertedItem inserted;
+    inserted.item = ti;
+    inserted.hItem = hItem;
+    tree->insertedItems.Append(inserted);
+    auto& index = tree->insertedItemsIndex;
+    int n = tree->insertedItems.isize();
+    // keep the index at most half full
+    if ((size_t)n * 2 > index.size()) {
+        size_t newSize = std::max(index.size() * 2, (size_t)256);
+        index.Reset();
+        index.AppendBlanks(newSize);
+        for (int i = 0; i < n - 1; i++) {
+            if (tree->insertedItems.at(i).item) {
+                AddToIndex(tree, i);
+            }
         }
     }
-    return nullptr;
+    AddToIndex(tree, n - 1);
+}
+
+HTREEITEM TreeCtrl::GetHandleByTreeItem(TreeItem* item) {
+    if (!item) {
+        return nullptr;
+    }
+    int idx = FindInsertedItem(this, item);
+    if (idx >= 0) {
+        return insertedItems.at(idx).hItem;
+    }
+    // the item might be the child of an item whose
+    // children haven't been inserted yet
+    TreeItem* parent = item->Parent();
+    HTREEITEM hParent = parent ? GetHandleByTreeItem(parent) : nullptr;
+    if (!hParent) {
+        return nullptr;
+    }
+    EnsureChildrenInserted(hParent);
+    idx = FindInsertedItem(this, item);
+    return idx >= 0 ? insertedItems.at(idx).hItem : nullptr;
+}
+
+// we store TreeItem* as lParam of every inserted item
+TreeItem* TreeCtrl::GetTreeItemByHandle(HTREEITEM item) {
+    if (!item) {
+        return nullptr;
+    }
+    TVITEMW tvi{};
+    tvi.hItem = item;
+    tvi.mask = TVIF_HANDLE | TVIF_PARAM;
+    BOOL ok = TreeView_GetItem(hwnd, &tvi);
+    if (!ok) {
+        return nullptr;
+    }
+    return reinterpret_cast<TreeItem*>(tvi.lParam);
 }
 
 void FillTVITEM(TVITEMEXW* tvitem, TreeItem* ti, bool withCheckboxes) {
@@ -694,23 +801,25 @@ void FillTVITEM(TVITEMEXW* tvitem, TreeItem* ti, bool withCheckboxes) {
     tvitem->state = state;
     tvitem->stateMask = stateMask;
     tvitem->lParam = reinterpret_cast<LPARAM>(ti);
-    auto title = ti->Text();
-    tvitem->pszText = title;
+    // the text and whether there are children (which might not be
+    // inserted yet) are provided on demand in TVN_GETDISPINFO
+    tvitem->mask |= TVIF_CHILDREN;
+    tvitem->cChildren = I_CHILDRENCALLBACK;
+    tvitem->pszText = LPSTR_TEXTCALLBACK;
 }
 
-static HTREEITEM insertItem(TreeCtrl* tree, HTREEITEM parent, TreeItem* ti) {
+static HTREEITEM insertItem(TreeCtrl* tree, HTREEITEM parent, TreeItem* ti, HTREEITEM insertAfter = TVI_LAST) {
     TVINSERTSTRUCTW toInsert{};
 
     toInsert.hParent = parent;
-    toInsert.hInsertAfter = TVI_LAST;
+    toInsert.hInsertAfter = insertAfter;
 
     TVITEMEXW* tvitem = &toInsert.itemex;
     FillTVITEM(tvitem, ti, tree->withCheckboxes);
-    bool onDemand = tree->onTreeGetDispInfo != nullptr;
-    if (onDemand) {
-        tvitem->pszText = LPSTR_TEXTCALLBACK;
-    }
     HTREEITEM res = TreeView_InsertItem(tree->hwnd, &toInsert);
+    if (res) {
+        AppendInsertedItem(tree, ti, res);
+    }
     return res;
 }
 
@@ -724,22 +833,33 @@ bool TreeCtrl::UpdateItem(TreeItem* ti) {
     TVITEMEXW tvitem;
     tvitem.hItem = ht;
     FillTVITEM(&tvitem, ti, withCheckboxes);
-    bool onDemand = onTreeGetDispInfo != nullptr;
-    if (onDemand) {
-        tvitem.pszText = LPSTR_TEXTCALLBACK;
-    }
     BOOL ok = TreeView_SetItem(hwnd, &tvitem);
     return ok ? true : false;
 }
 
+static void PopulateTreeItem(TreeCtrl* tree, TreeItem* item, HTREEITEM parent);
+
+// children of collapsed items are inserted by EnsureChildrenInserted()
+static HTREEITEM InsertItemAndVisibleChildren(TreeCtrl* tree, TreeItem* ti, HTREEITEM parent,
+                                              HTREEITEM insertAfter = TVI_LAST) {
+    HTREEITEM h = insertItem(tree, parent, ti, insertAfter);
+    if (h && ti->IsExpanded()) {
+        PopulateTreeItem(tree, ti, h);
+    }
+    return h;
+}
+
 static void PopulateTreeItem(TreeCtrl* tree, TreeItem* item, HTREEITEM parent) {
+    int idx = FindInsertedItem(tree, item);
+    CrashIf(idx < 0);
+    if (idx < 0 || tree->insertedItems.at(idx).childrenInserted) {
+        return;
+    }
+    tree->insertedItems.at(idx).childrenInserted = true;
     int n = item->ChildCount();
     for (int i = 0; i < n; i++) {
         auto* ti = item->ChildAt(i);
-        HTREEITEM h = insertItem(tree, parent, ti);
-        auto v = std::make_tuple(ti, h);
-        tree->insertedItems.Append(v);
-        PopulateTreeItem(tree, ti, h);
+        InsertItemAndVisibleChildren(tree, ti, parent);
     }
 }
 
@@ -748,19 +868,89 @@ static void PopulateTree(TreeCtrl* tree, TreeModel* tm) {
     int n = tm->RootCount();
     for (int i = 0; i < n; i++) {
         auto* ti = tm->RootAt(i);
-        HTREEITEM h = insertItem(tree, parent, ti);
-        auto v = std::make_tuple(ti, h);
-        tree->insertedItems.Append(v);
-        PopulateTreeItem(tree, ti, h);
+        InsertItemAndVisibleChildren(tree, ti, parent);
+    }
+}
+
+void TreeCtrl::EnsureChildrenInserted(HTREEITEM hItem) {
+    TreeItem* ti = GetTreeItemByHandle(hItem);
+    if (!ti) {
+        return;
+    }
+    PopulateTreeItem(this, ti, hItem);
+}
+
+bool TreeCtrl::InsertItem(TreeItem* ti, TreeItem* insertAfter) {
+    TreeItem* parent = ti->Parent();
+    HTREEITEM hParent = nullptr;
+    if (parent) {
+        hParent = GetHandleByTreeItem(parent);
+        if (!hParent) {
+            return false;
+        }
+        int idx = FindInsertedItem(this, parent);
+        if (!insertedItems.at(idx).childrenInserted) {
+            // this inserts ti along with its siblings
+            EnsureChildrenInserted(hParent);
+            return FindInsertedItem(this, ti) >= 0;
+        }
+    }
+    HTREEITEM hInsertAfter = TVI_FIRST;
+    if (insertAfter) {
+        hInsertAfter = GetHandleByTreeItem(insertAfter);
+        CrashIf(!hInsertAfter);
+        if (!hInsertAfter) {
+            return false;
+        }
+    }
+    HTREEITEM h = InsertItemAndVisibleChildren(this, ti, hParent, hInsertAfter);
+    return h != nullptr;
+}
+
+// forgets ti and its inserted descendants (found through the tree view
+// because TreeItem::ChildAt() can be slow for items with many children)
+static void ForgetInsertedItems(TreeCtrl* tree, HTREEITEM hItem) {
+    TreeItem* ti = tree->GetTreeItemByHandle(hItem);
+    int idx = FindInsertedItem(tree, ti);
+    if (idx >= 0) {
+        tree->insertedItems.at(idx).item = nullptr;
+        tree->insertedItems.at(idx).hItem = nullptr;
+    }
+    HTREEITEM child = TreeView_GetChild(tree->hwnd, hItem);
+    while (child) {
+        ForgetInsertedItems(tree, child);
+        child = TreeView_GetNextSibling(tree->hwnd, child);
     }
 }
 
+void TreeCtrl::RemoveItem(TreeItem* ti) {
+    int idx = FindInsertedItem(this, ti);
+    if (idx < 0) {
+        // its parent hasn't been expanded yet
+        return;
+    }
+    HTREEITEM hItem = insertedItems.at(idx).hItem;
+    ForgetInsertedItems(this, hItem);
+    TreeView_DeleteItem(hwnd, hItem);
+}
+
+// expands the parents of the item and scrolls it into view
+bool TreeCtrl::EnsureVisible(TreeItem* ti) {
+    HTREEITEM hItem = GetHandleByTreeItem(ti);
+    if (!hItem) {
+        return false;
+    }
+    TreeView_EnsureVisible(hwnd, hItem);
+    return true;
+}
+
 void TreeCtrl::SetTreeModel(TreeModel* tm) {
     CrashIf(!tm);
 
     SuspendRedraw();
 
     insertedItems.Reset();
+    insertedItemsIndex.Reset();
     TreeView_DeleteAllItems(hwnd);
 
     treeModel = tm;
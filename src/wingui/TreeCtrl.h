@@ -167,7 +167,18 @@ struct TreeCtrl : WindowBase {
 
     // TreeItem* -> HTREEITEM mapping so that we can
     // find HTREEITEM from TreeItem*
-    Vec<std::tuple<TreeItem*, HTREEITEM>> insertedItems;
+    // children of collapsed items are only inserted once they're needed
+    // (e.g. when the item gets expanded) so that trees with tens of
+    // thousands of items (e.g. PDF outlines) can be shown quickly
+    // removed items are kept with item == nullptr until the next SetTreeModel()
+    struct InsertedItem {
+        TreeItem* item = nullptr;
+        HTREEITEM hItem = nullptr;
+        bool childrenInserted = false;
+    };
+    Vec<InsertedItem> insertedItems;
+    // hash index into insertedItems by TreeItem* (entries are index + 1)
+    Vec<int> insertedItemsIndex;
 
     TreeCtrl(HWND parent);
     ~TreeCtrl();
@@ -186,6 +197,13 @@ struct TreeCtrl : WindowBase {
     TreeItem* GetSelection();
 
     bool UpdateItem(TreeItem*);
+    // for patching the tree after the TreeModel has been changed:
+    // InsertItem() must be called after the item has been added to the model
+    // (insertAfter is its previous sibling or nullptr if it's the first child)
+    // and RemoveItem() before its subtree is deleted
+    bool InsertItem(TreeItem*, TreeItem* insertAfter);
+    void RemoveItem(TreeItem*);
+    bool EnsureVisible(TreeItem*);
     bool SelectItem(TreeItem*);
     bool GetItemRect(TreeItem*, bool justText, RECT& r);
     TreeItem* GetItemAt(int x, int y);
@@ -201,6 +219,7 @@ struct TreeCtrl : WindowBase {
 
     HTREEITEM GetHandleByTreeItem(TreeItem*);
     TreeItem* GetTreeItemByHandle(HTREEITEM);
+    void EnsureChildrenInserted(HTREEITEM);
 
     void SetCheckState(TreeItem*, bool);
     bool GetCheckState(TreeItem*);